@@ -47,6 +47,16 @@ SpyMessage (
     _Out_ PULONG ReturnOutputBufferLength
     );
 
+NTSTATUS
+SpyMessageCommand (
+    _In_ PSPY_CLIENT Client,
+    _In_reads_bytes_opt_(InputBufferSize) PVOID InputBuffer,
+    _In_ ULONG InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferSize,
+    _Out_ PULONG ReturnOutputBufferLength
+    );
+
 NTSTATUS
 SpyConnect(
     _In_ PFLT_PORT ClientPort,
@@ -77,6 +87,7 @@ SpyEnlistInTransaction (
     #pragma alloc_text(PAGE, SpyConnect)
     #pragma alloc_text(PAGE, SpyDisconnect)
     #pragma alloc_text(PAGE, SpyMessage)
+    #pragma alloc_text(PAGE, SpyMessageCommand)
 #endif
 
 
@@ -127,11 +138,13 @@ Return Value:
         MiniSpyData.MaxRecordsToAllocate = DEFAULT_MAX_RECORDS_TO_ALLOCATE;
         MiniSpyData.RecordsAllocated = 0;
         MiniSpyData.NameQueryMethod = DEFAULT_NAME_QUERY_METHOD;
+        MiniSpyData.RingRecords = DEFAULT_RING_RECORDS;
+        MiniSpyData.ClientCount = 0;
 
         MiniSpyData.DriverObject = DriverObject;
 
-        InitializeListHead( &MiniSpyData.OutputBufferList );
         KeInitializeSpinLock( &MiniSpyData.OutputBufferLock );
+        ExInitializeFastMutex( &MiniSpyData.RulesLock );
 
         ExInitializeNPagedLookasideList( &MiniSpyData.FreeBufferList,
                                          NULL,
@@ -162,6 +175,18 @@ Return Value:
 
         SpyReadDriverParameters(RegistryPath);
 
+        //
+        //  Allocate the buffer the log records are copied into for the
+        //  user mode clients.
+        //
+
+        status = SpyAllocateOutputRing();
+
+        if (!NT_SUCCESS( status )) {
+
+           leave;
+        }
+
         //
         //  Now that our global configuration is complete, register with FltMgr.
         //
@@ -198,7 +223,7 @@ Return Value:
                                              SpyConnect,
                                              SpyDisconnect,
                                              SpyMessage,
-                                             1 );
+                                             MINISPY_MAX_CONNECTIONS );
 
         FltFreeSecurityDescriptor( sd );
 
@@ -206,6 +231,18 @@ Return Value:
             leave;
         }
 
+#if MINISPY_VISTA
+
+        //
+        //  Report processes as they are created and exit.  Not fatal, user
+        //  mode looks up the processes it was not told about itself.
+        //
+
+        MiniSpyData.ProcessNotifyRegistered =
+            NT_SUCCESS( PsSetCreateProcessNotifyRoutineEx( SpyProcessNotifyCallback, FALSE ) );
+
+#endif
+
         //
         //  We are now ready to start filtering
         //
@@ -216,6 +253,13 @@ Return Value:
 
         if (!NT_SUCCESS( status ) ) {
 
+#if MINISPY_VISTA
+             if (MiniSpyData.ProcessNotifyRegistered) {
+                 PsSetCreateProcessNotifyRoutineEx( SpyProcessNotifyCallback, TRUE );
+                 MiniSpyData.ProcessNotifyRegistered = FALSE;
+             }
+#endif
+
              if (NULL != MiniSpyData.ServerPort) {
                  FltCloseCommunicationPort( MiniSpyData.ServerPort );
              }
@@ -224,6 +268,7 @@ Return Value:
                  FltUnregisterFilter( MiniSpyData.Filter );
              }
 
+             SpyFreeOutputRing();
              ExDeleteNPagedLookasideList( &MiniSpyData.FreeBufferList );
         }
     }
@@ -244,7 +289,10 @@ SpyConnect(
 Routine Description
 
     This is called when user-mode connects to the server
-    port - to establish a connection
+    port - to establish a connection.  Each connection gets its own cursor
+    into the output ring, starting with the next record logged, so
+    several clients can read the log at the same time.  Records logged
+    before the client connected are not replayed to it.
 
 Arguments
 
@@ -253,23 +301,41 @@ Arguments
     ServerPortCookie - unused
     ConnectionContext - unused
     SizeofContext   - unused
-    ConnectionCookie - unused
+    ConnectionCookie - Receives the SPY_CLIENT for this connection.
 
 Return Value
 
     STATUS_SUCCESS - to accept the connection
+    STATUS_INSUFFICIENT_RESOURCES - if the client state could not be allocated
 --*/
 {
+    PSPY_CLIENT client;
 
     PAGED_CODE();
 
     UNREFERENCED_PARAMETER( ServerPortCookie );
     UNREFERENCED_PARAMETER( ConnectionContext );
     UNREFERENCED_PARAMETER( SizeOfContext);
-    UNREFERENCED_PARAMETER( ConnectionCookie );
 
-    FLT_ASSERT( MiniSpyData.ClientPort == NULL );
-    MiniSpyData.ClientPort = ClientPort;
+    client = ExAllocatePoolWithTag( NonPagedPoolNx,
+                                    sizeof( SPY_CLIENT ),
+                                    SPY_TAG );
+
+    if (client == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( client, sizeof( SPY_CLIENT ) );
+    client->ClientPort = ClientPort;
+    ExInitializeRundownProtection( &client->Rundown );
+    ExInitializeFastMutex( &client->ReadLock );
+
+    SpyAttachClient( client );
+
+    InterlockedIncrement( &MiniSpyData.ClientCount );
+
+    *ConnectionCookie = client;
     return STATUS_SUCCESS;
 }
 
@@ -286,23 +352,38 @@ Routine Description
 
 Arguments
 
-    ConnectionCookie - unused
+    ConnectionCookie - The SPY_CLIENT allocated in SpyConnect.
 
 Return value
 
     None
 --*/
 {
+    PSPY_CLIENT client = ConnectionCookie;
 
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER( ConnectionCookie );
+    if (client == NULL) {
+
+        return;
+    }
 
     //
     //  Close our handle
     //
 
-    FltCloseClientPort( MiniSpyData.Filter, &MiniSpyData.ClientPort );
+    FltCloseClientPort( MiniSpyData.Filter, &client->ClientPort );
+
+    //
+    //  Wait for the messages still being processed on this connection,
+    //  they use the client we are about to free.
+    //
+
+    ExWaitForRundownProtectionRelease( &client->Rundown );
+
+    InterlockedDecrement( &MiniSpyData.ClientCount );
+
+    ExFreePoolWithTag( client, SPY_TAG );
 }
 
 NTSTATUS
@@ -335,6 +416,20 @@ Return Value:
 
     PAGED_CODE();
 
+#if MINISPY_VISTA
+
+    //
+    //  No process records once the ring is gone.
+    //
+
+    if (MiniSpyData.ProcessNotifyRegistered) {
+
+        PsSetCreateProcessNotifyRoutineEx( SpyProcessNotifyCallback, TRUE );
+        MiniSpyData.ProcessNotifyRegistered = FALSE;
+    }
+
+#endif
+
     //
     //  Close the server port. This will stop new connections.
     //
@@ -343,7 +438,8 @@ Return Value:
 
     FltUnregisterFilter( MiniSpyData.Filter );
 
-    SpyEmptyOutputBufferList();
+    SpyFreeOutputRing();
+    SpyFreeRules();
     ExDeleteNPagedLookasideList( &MiniSpyData.FreeBufferList );
 
     return STATUS_SUCCESS;
@@ -393,11 +489,74 @@ SpyMessage (
 Routine Description:
 
     This is called whenever a user mode application wishes to communicate
-    with this minifilter.
+    with this minifilter.  The connection's client is kept from being
+    freed by SpyDisconnect while the message is processed.
 
 Arguments:
 
-    ConnectionCookie - unused
+    ConnectionCookie - The SPY_CLIENT of the connection the message came in on.
+
+    InputBuffer - A buffer containing input data, can be NULL if there
+        is no input data.
+    InputBufferSize - The size in bytes of the InputBuffer.
+    OutputBuffer - A buffer provided by the application that originated
+        the communication in which to store data to be returned to this
+        application.
+    OutputBufferSize - The size in bytes of the OutputBuffer.
+    ReturnOutputBufferSize - The size in bytes of meaningful data
+        returned in the OutputBuffer.
+
+Return Value:
+
+    Returns the status of processing the message, or
+    STATUS_PORT_DISCONNECTED if the connection is being torn down.
+
+--*/
+{
+    PSPY_CLIENT client = ConnectionCookie;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    *ReturnOutputBufferLength = 0;
+
+    if (!ExAcquireRundownProtection( &client->Rundown )) {
+
+        return STATUS_PORT_DISCONNECTED;
+    }
+
+    status = SpyMessageCommand( client,
+                                InputBuffer,
+                                InputBufferSize,
+                                OutputBuffer,
+                                OutputBufferSize,
+                                ReturnOutputBufferLength );
+
+    ExReleaseRundownProtection( &client->Rundown );
+
+    return status;
+}
+
+
+NTSTATUS
+SpyMessageCommand (
+    _In_ PSPY_CLIENT Client,
+    _In_reads_bytes_opt_(InputBufferSize) PVOID InputBuffer,
+    _In_ ULONG InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferSize,
+    _Out_ PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    Processes a message from a user mode application on behalf of
+    SpyMessage, which holds the connection's rundown protection.
+
+Arguments:
+
+    Client - The SPY_CLIENT of the connection the message came in on.
 
     OperationCode - An identifier describing what type of message this
         is.  These codes are defined by the MiniFilter.
@@ -418,12 +577,12 @@ Return Value:
 --*/
 {
     MINISPY_COMMAND command;
+    MINISPY_CLIENT_FILTER filter;
+    MINISPY_CLIENT_STATS stats;
     NTSTATUS status;
 
     PAGED_CODE();
 
-    UNREFERENCED_PARAMETER( ConnectionCookie );
-
     //
     //                      **** PLEASE READ ****
     //
@@ -516,7 +675,8 @@ Return Value:
                 //  Get the log record.
                 //
 
-                status = SpyGetLog( OutputBuffer,
+                status = SpyGetLog( Client,
+                                    OutputBuffer,
                                     OutputBufferSize,
                                     ReturnOutputBufferLength );
                 break;
@@ -569,6 +729,93 @@ Return Value:
                 status = STATUS_SUCCESS;
                 break;
 
+            case SetMiniSpyClientFilter:
+
+                //
+                //  Replace the record filter of this connection.  The
+                //  filter follows the command in the input buffer.
+                //
+
+                if (InputBufferSize < (FIELD_OFFSET( COMMAND_MESSAGE, Data ) +
+                                       sizeof( MINISPY_CLIENT_FILTER ))) {
+
+                    status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+
+                try {
+
+                    RtlCopyMemory( &filter,
+                                   ((PCOMMAND_MESSAGE) InputBuffer)->Data,
+                                   sizeof( MINISPY_CLIENT_FILTER ) );
+
+                } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                    return GetExceptionCode();
+                }
+
+                SpySetClientFilter( Client, &filter );
+
+                *ReturnOutputBufferLength = 0;
+                status = STATUS_SUCCESS;
+                break;
+
+            case GetMiniSpyClientStats:
+
+                //
+                //  Return the cursor position and counters of this
+                //  connection.
+                //
+
+                if ((OutputBufferSize < sizeof( MINISPY_CLIENT_STATS )) ||
+                    (OutputBuffer == NULL)) {
+
+                    status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+
+                if (!IS_ALIGNED(OutputBuffer,sizeof(ULONG))) {
+
+                    status = STATUS_DATATYPE_MISALIGNMENT;
+                    break;
+                }
+
+                SpyQueryClientStats( Client, &stats );
+
+                try {
+
+                    RtlCopyMemory( OutputBuffer, &stats, sizeof( MINISPY_CLIENT_STATS ) );
+
+                } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                      return GetExceptionCode();
+                }
+
+                *ReturnOutputBufferLength = sizeof( MINISPY_CLIENT_STATS );
+                status = STATUS_SUCCESS;
+                break;
+
+            case SetMiniSpyRules:
+
+                //
+                //  Replace the rules creates, writes and set information
+                //  operations are matched against.  The rule set follows
+                //  the command in the input buffer and is captured and
+                //  validated by SpySetRules.
+                //
+
+                if (InputBufferSize < FIELD_OFFSET( COMMAND_MESSAGE, Data )) {
+
+                    status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+
+                status = SpySetRules( ((PCOMMAND_MESSAGE) InputBuffer)->Data,
+                                      InputBufferSize - FIELD_OFFSET( COMMAND_MESSAGE, Data ) );
+
+                *ReturnOutputBufferLength = 0;
+                break;
+
             default:
                 status = STATUS_INVALID_PARAMETER;
                 break;
@@ -628,9 +875,8 @@ Return Value:
     UNICODE_STRING defaultName;
     PUNICODE_STRING nameToUse;
     NTSTATUS status;
-
-    //
-    INT blockingRuleID = 0;
+    SPY_RULE_REF rule = { 0, 0 };
+    BOOLEAN applyRules;
 
 #if MINISPY_VISTA
 
@@ -646,6 +892,12 @@ Return Value:
 
 #endif
 
+    //
+    //  See if the rules pushed by user mode have to be checked
+    //
+
+    applyRules = SpyRulesApply( Data, FltObjects );
+
     //
     //  Try and get a log record
     //
@@ -704,8 +956,6 @@ Return Value:
 #else
 
                 FltParseFileNameInformation( nameInfo );
-                
-                //BOOLEAN blockProcess;
 #endif
 
             }
@@ -866,6 +1116,15 @@ Return Value:
 
 #endif
 
+        //
+        //  Match the rules while we still hold the name
+        //
+
+        if (applyRules && (NULL != nameInfo)) {
+
+            rule = SpyMatchRules( &nameInfo->Name );
+        }
+
         //
         //  Release the name information structure (if defined)
         //
@@ -879,14 +1138,37 @@ Return Value:
         //  Set all of the operation information into the record
         //
 
-        SpyLogPreOperationData( Data, FltObjects, blockingRuleID, recordList);
+        SpyLogPreOperationData( Data, FltObjects, rule, recordList );
 
         //
         //  Pass the record to our completions routine and return that
         //  we want our completion routine called.
         //
 
-        if (Data->Iopb->MajorFunction == IRP_MJ_SHUTDOWN) {
+        if (rule.Action == RULE_ACTION_BLOCK) {
+
+            //
+            //  A rule blocks this operation.  If it is failed here our
+            //  completion routine will not be called, so do the completion
+            //  processing now.  Otherwise it comes back as an IRP and is
+            //  logged then.
+            //
+
+            returnStatus = SpyBlockOperation( Data );
+
+            if (returnStatus == FLT_PREOP_COMPLETE) {
+
+                SpyPostOperationCallback( Data,
+                                          FltObjects,
+                                          recordList,
+                                          0 );
+
+            } else {
+
+                SpyFreeRecord( recordList );
+            }
+
+        } else if (Data->Iopb->MajorFunction == IRP_MJ_SHUTDOWN) {
 
             //
             //  Since completion callbacks are not supported for
@@ -905,6 +1187,28 @@ Return Value:
             *CompletionContext = recordList;
             returnStatus = FLT_PREOP_SUCCESS_WITH_CALLBACK;
         }
+
+    } else if (applyRules) {
+
+        //
+        //  We could not log the operation but the rules still apply
+        //
+
+        status = FltGetFileNameInformation( Data,
+                                            FLT_FILE_NAME_NORMALIZED |
+                                                MiniSpyData.NameQueryMethod,
+                                            &nameInfo );
+
+        if (NT_SUCCESS( status )) {
+
+            rule = SpyMatchRules( &nameInfo->Name );
+            FltReleaseFileNameInformation( nameInfo );
+        }
+
+        if (rule.Action == RULE_ACTION_BLOCK) {
+
+            returnStatus = SpyBlockOperation( Data );
+        }
     }
 
     return returnStatus;
@@ -1320,6 +1624,44 @@ SpyKtmNotificationCallback (
     return STATUS_SUCCESS;
 }
 
+VOID
+SpyProcessNotifyCallback (
+    _Inout_ PEPROCESS Process,
+    _In_ HANDLE ProcessId,
+    _Inout_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo
+    )
+/*++
+
+Routine Description:
+
+    Called as a process is created, with CreateInfo, and as it exits,
+    without.  Logs a process record for user mode.
+
+Arguments:
+
+    Process - The process.
+
+    ProcessId - Its id.
+
+    CreateInfo - Describes the new process, NULL on exit.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PRECORD_LIST recordList;
+
+    recordList = SpyNewRecord();
+
+    if (recordList) {
+
+        SpyLogProcessNotify( Process, ProcessId, CreateInfo, recordList );
+        SpyLog( recordList );
+    }
+}
+
 #endif // MINISPY_VISTA
 
 VOID
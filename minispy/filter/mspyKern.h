@@ -23,6 +23,10 @@ Environment:
 //#include <dontuse.h>
 #include <suppress.h>
 #include "minispy.h"
+#include "spyRing.h"
+
+#define SPY_RULES_UPCASE_WIDE   RtlUpcaseUnicodeChar
+#include "spyRules.h"
 
 #pragma prefast(disable:__WARNING_ENCODE_MEMBER_FUNCTION_POINTER, "Not valid for kernel mode drivers")
 
@@ -137,17 +141,31 @@ typedef struct _MINISPY_DATA {
     PFLT_PORT ServerPort;
 
     //
-    //  Client connection port: only one connection is allowed at a time.,
+    //  Number of connected clients, at most MINISPY_MAX_CONNECTIONS.
     //
 
-    PFLT_PORT ClientPort;
+    __volatile LONG ClientCount;
 
     //
-    //  List of buffers with data to send to user mode.
+    //  Shared buffer of records to send to user mode.  Every connected
+    //  client reads it through its own SPY_CLIENT cursor.
     //
 
     KSPIN_LOCK OutputBufferLock;
-    LIST_ENTRY OutputBufferList;
+    SPY_RING OutputRing;
+    ULONG RingRecords;
+
+    //
+    //  Rule sets pushed by user mode.  A reader counts itself in
+    //  RuleReaders of the slot ActiveRules names and uses that slot's rules,
+    //  SpySetRules waits for the other slot to drain, fills it and flips
+    //  ActiveRules.  RulesLock only serializes SpySetRules.
+    //
+
+    PSPY_RULES_HEADER Rules[2];
+    __volatile LONG RuleReaders[2];
+    __volatile LONG ActiveRules;
+    FAST_MUTEX RulesLock;
 
     //
     //  Lookaside list used for allocating buffers.
@@ -210,6 +228,14 @@ typedef struct _MINISPY_DATA {
 
     PFLT_ENLIST_IN_TRANSACTION PFltEnlistInTransaction;
 
+    //
+    //  TRUE once SpyProcessNotifyCallback is registered.  It is only
+    //  accepted from an image linked with /INTEGRITYCHECK, without it user
+    //  mode falls back to querying processes itself.
+    //
+
+    BOOLEAN ProcessNotifyRegistered;
+
 #endif
 
 } MINISPY_DATA, *PMINISPY_DATA;
@@ -225,6 +251,53 @@ typedef struct _MINISPY_TRANSACTION_CONTEXT {
 
 }MINISPY_TRANSACTION_CONTEXT, *PMINISPY_TRANSACTION_CONTEXT;
 
+//
+//  Bytes of records SpyGetLog copies out of the ring per hold of the ring
+//  lock, at least one record of the largest size.  Larger batches take
+//  the lock less often but hold it longer against the operations logging.
+//
+
+#define SPY_STAGING_SIZE    (16 * RECORD_SIZE)
+
+//
+//  Per connection state, used as the port connection cookie.
+//
+
+typedef struct _SPY_CLIENT {
+
+    PFLT_PORT ClientPort;
+
+    //
+    //  Held by SpyMessage while it uses the client.  SpyDisconnect waits
+    //  for it to be released before freeing the client.
+    //
+
+    EX_RUNDOWN_REF Rundown;
+
+    //
+    //  Serializes SpyGetLog calls on this connection, which share Staging
+    //  and rewind Cursor when a record does not get to the user's buffer.
+    //
+
+    FAST_MUTEX ReadLock;
+
+    //
+    //  Read position and filter in MiniSpyData.OutputRing.  Protected by
+    //  MiniSpyData.OutputBufferLock.
+    //
+
+    SPY_RING_CURSOR Cursor;
+
+    //
+    //  Records are copied here under the ring lock, a batch at a time, so
+    //  that the copy into the raw user buffer can be done without holding
+    //  a spin lock.  Protected by ReadLock.
+    //
+
+    PVOID Staging[SPY_STAGING_SIZE/sizeof( PVOID )];
+
+} SPY_CLIENT, *PSPY_CLIENT;
+
 //
 //  This macro below is used to set the flags field in minispy's
 //  MINISPY_TRANSACTION_CONTEXT structure once it has been
@@ -242,6 +315,9 @@ extern MINISPY_DATA MiniSpyData;
 #define DEFAULT_MAX_RECORDS_TO_ALLOCATE     3000 //	~3.0 MB RAM usage
 #define MAX_RECORDS_TO_ALLOCATE             L"MaxRecords"
 
+#define DEFAULT_RING_RECORDS                4096 //	~4.0 MB RAM usage
+#define RING_RECORDS                        L"RingRecords"
+
 #define DEFAULT_NAME_QUERY_METHOD           FLT_FILE_NAME_QUERY_ALWAYS_ALLOW_CACHE_LOOKUP
 #define NAME_QUERY_METHOD                   L"NameQueryMethod"
 
@@ -283,6 +359,17 @@ SpyKtmNotificationCallback (
     _In_ ULONG TransactionNotification
     );
 
+#if MINISPY_VISTA
+
+VOID
+SpyProcessNotifyCallback (
+    _Inout_ PEPROCESS Process,
+    _In_ HANDLE ProcessId,
+    _Inout_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo
+    );
+
+#endif
+
 NTSTATUS
 SpyFilterUnload (
     _In_ FLT_FILTER_UNLOAD_FLAGS Flags
@@ -369,7 +456,7 @@ VOID
 SpyLogPreOperationData (
     _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
-    _In_ INT BlockingRuleID,
+    _In_ SPY_RULE_REF Rule,
     _Inout_ PRECORD_LIST RecordList
     );
 
@@ -386,29 +473,95 @@ SpyLogTransactionNotify (
     _In_ ULONG TransactionNotification
     );
 
+#if MINISPY_VISTA
+
+VOID
+SpyLogProcessNotify (
+    _In_ PEPROCESS Process,
+    _In_ HANDLE ProcessId,
+    _In_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo,
+    _Inout_ PRECORD_LIST RecordList
+    );
+
+#endif
+
 VOID
 SpyLog (
     _In_ PRECORD_LIST RecordList
     );
 
 NTSTATUS
-SpyGetLog (
-    _Out_writes_bytes_to_(OutputBufferLength,*ReturnOutputBufferLength) PUCHAR OutputBuffer,
-    _In_ ULONG OutputBufferLength,
-    _Out_ PULONG ReturnOutputBufferLength
+SpyAllocateOutputRing (
+    VOID
     );
 
 VOID
-SpyEmptyOutputBufferList (
+SpyFreeOutputRing (
     VOID
     );
 
+VOID
+SpyAttachClient (
+    _Inout_ PSPY_CLIENT Client
+    );
+
+VOID
+SpySetClientFilter (
+    _Inout_ PSPY_CLIENT Client,
+    _In_ PMINISPY_CLIENT_FILTER Filter
+    );
+
+VOID
+SpyQueryClientStats (
+    _In_ PSPY_CLIENT Client,
+    _Out_ PMINISPY_CLIENT_STATS Stats
+    );
+
+NTSTATUS
+SpyGetLog (
+    _Inout_ PSPY_CLIENT Client,
+    _Out_writes_bytes_to_(OutputBufferLength,*ReturnOutputBufferLength) PUCHAR OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+    );
+
 VOID
 SpyDeleteTxfContext (
     _Inout_ PFLT_CONTEXT  Context,
     _In_ FLT_CONTEXT_TYPE  ContextType
     );
 
+//---------------------------------------------------------------------------
+//  Rule routines
+//---------------------------------------------------------------------------
+
+NTSTATUS
+SpySetRules (
+    _In_reads_bytes_(Size) PVOID UserRules,
+    _In_ ULONG Size
+    );
+
+VOID
+SpyFreeRules (
+    VOID
+    );
+
+BOOLEAN
+SpyRulesApply (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    );
+
+SPY_RULE_REF
+SpyMatchRules (
+    _In_ PUNICODE_STRING Name
+    );
+
+FLT_PREOP_CALLBACK_STATUS
+SpyBlockOperation (
+    _Inout_ PFLT_CALLBACK_DATA Data
+    );
+
 
 #endif  //__MSPYKERN_H__
 
@@ -35,6 +35,8 @@ Environment:
 
 #ifdef ALLOC_PRAGMA
     #pragma alloc_text(INIT, SpyReadDriverParameters)
+    #pragma alloc_text(PAGE, SpySetRules)
+    #pragma alloc_text(PAGE, SpyFreeRules)
 #if MINISPY_VISTA
     #pragma alloc_text(PAGE, SpyBuildEcpDataString)
     #pragma alloc_text(PAGE, SpyParseEcps)
@@ -102,227 +104,10 @@ Return Value:
 }
 
 
-//---------------------------------------------------------------------------
-//                    Log Record allocation routines
-//---------------------------------------------------------------------------
-
-PRECORD_LIST
-SpyAllocateBuffer (
-    _Out_ PULONG RecordType
-    )
-/*++
-
-Routine Description:
-
-    Allocates a new buffer from the MiniSpyData.FreeBufferList if there is
-    enough memory to do so and we have not exceed our maximum buffer
-    count.
-
-    NOTE:  Because there is no interlock between testing if we have exceeded
-           the record allocation limit and actually increment the in use
-           count it is possible to temporarily allocate one or two buffers
-           more then the limit.  Because this is such a rare situation there
-           is not point to handling this.
-
-    NOTE:  This code must be NON-PAGED because it can be called on the
-           paging path or at DPC level.
-
-Arguments:
-
-    RecordType - Receives information on what type of record was allocated.
-
-Return Value:
-
-    Pointer to the allocated buffer, or NULL if the allocation failed.
-
---*/
-{
-    PVOID newBuffer;
-    ULONG newRecordType = RECORD_TYPE_NORMAL;
-
-    //
-    //  See if we have room to allocate more buffers
-    //
-
-    if (MiniSpyData.RecordsAllocated < MiniSpyData.MaxRecordsToAllocate) {
-
-        InterlockedIncrement( &MiniSpyData.RecordsAllocated );
-
-        newBuffer = ExAllocateFromNPagedLookasideList( &MiniSpyData.FreeBufferList );
-
-        if (newBuffer == NULL) {
-
-            //
-            //  We failed to allocate the memory.  Decrement our global count
-            //  and return what type of memory we have.
-            //
-
-            InterlockedDecrement( &MiniSpyData.RecordsAllocated );
-
-            newRecordType = RECORD_TYPE_FLAG_OUT_OF_MEMORY;
-            DbgPrint("Failed to allocated memory\n");
-        }
-
-    } else {
-
-        //
-        //  No more room to allocate memory, return we didn't get a buffer
-        //  and why.
-        //
-
-        newRecordType = RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE;
-        newBuffer = NULL;
-    }
-
-    *RecordType = newRecordType;
-    return newBuffer;
-}
-
-
-VOID
-SpyFreeBuffer (
-    _In_ PVOID Buffer
-    )
-/*++
-
-Routine Description:
-
-    Free an allocate buffer.
-
-    NOTE:  This code must be NON-PAGED because it can be called on the
-           paging path or at DPC level.
-
-Arguments:
-
-    Buffer - The buffer to free.
-
-Return Value:
-
-    None.
-
---*/
-{
-    //
-    //  Free the memory, update the counter
-    //
-
-    InterlockedDecrement( &MiniSpyData.RecordsAllocated );
-    ExFreeToNPagedLookasideList( &MiniSpyData.FreeBufferList, Buffer );
-}
-
-
 //---------------------------------------------------------------------------
 //                    Logging routines
 //---------------------------------------------------------------------------
 
-PRECORD_LIST
-SpyNewRecord (
-    VOID
-    )
-/*++
-
-Routine Description:
-
-    Allocates a new RECORD_LIST structure if there is enough memory to do so. A
-    sequence number is updated for each request for a new record.
-
-    NOTE:  This code must be NON-PAGED because it can be called on the
-           paging path or at DPC level.
-
-Arguments:
-
-    None
-
-Return Value:
-
-    Pointer to the RECORD_LIST allocated, or NULL if no memory is available.
-
---*/
-{
-    PRECORD_LIST newRecord;
-    ULONG initialRecordType;
-
-    //
-    //  Allocate the buffer
-    //
-
-    newRecord = SpyAllocateBuffer( &initialRecordType );
-
-    if (newRecord == NULL) {
-
-        //
-        //  We could not allocate a record, see if the static buffer is
-        //  in use.  If not, we will use it
-        //
-
-        if (!InterlockedExchange( &MiniSpyData.StaticBufferInUse, TRUE )) {
-
-            newRecord = (PRECORD_LIST)MiniSpyData.OutOfMemoryBuffer;
-            initialRecordType |= RECORD_TYPE_FLAG_STATIC;
-        }
-        else {
-            return NULL;
-        }
-    }
-
-    //
-    //  If we got a record (doesn't matter if it is static or not), init it
-    //
-
-    if (newRecord != NULL) {
-
-        //
-        // Init the new record
-        //
-
-        newRecord->LogRecord.RecordType = initialRecordType;
-        newRecord->LogRecord.Length = sizeof(LOG_RECORD);
-        newRecord->LogRecord.SequenceNumber = InterlockedIncrement( &MiniSpyData.LogSequenceNumber );
-        RtlZeroMemory( &newRecord->LogRecord.Data, sizeof( RECORD_DATA ) );
-    }
-
-    return( newRecord );
-}
-
-
-VOID
-SpyFreeRecord (
-    _In_ PRECORD_LIST Record
-    )
-/*++
-
-Routine Description:
-
-    Free the given buffer
-
-    NOTE:  This code must be NON-PAGED because it can be called on the
-           paging path or at DPC level.
-
-Arguments:
-
-    Record - the buffer to free
-
-Return Value:
-
-    None.
-
---*/
-{
-    if (FlagOn(Record->LogRecord.RecordType,RECORD_TYPE_FLAG_STATIC)) {
-
-        //
-        // This was our static buffer, mark it available.
-        //
-
-        FLT_ASSERT(MiniSpyData.StaticBufferInUse);
-        MiniSpyData.StaticBufferInUse = FALSE;
-
-    } else {
-
-        SpyFreeBuffer( Record );
-    }
-}
-
 #if MINISPY_VISTA
 
 VOID
@@ -1051,7 +836,7 @@ VOID
 SpyLogPreOperationData (
     _In_ PFLT_CALLBACK_DATA Data,
     _In_ PCFLT_RELATED_OBJECTS FltObjects,
-    _In_ INT BlockingRuleID,
+    _In_ SPY_RULE_REF Rule,
     _Inout_ PRECORD_LIST RecordList
     )
 /*++
@@ -1070,6 +855,8 @@ Arguments:
 
     FltObjects - Pointer to the io objects involved in this operation.
 
+    Rule - The rule the operation matched, RuleId is 0 if none did.
+
     RecordList - Where we want to save the data
 
 Return Value:
@@ -1114,8 +901,20 @@ Return Value:
     recordData->Arg5 = Data->Iopb->Parameters.Others.Argument5;
     recordData->Arg6.QuadPart = Data->Iopb->Parameters.Others.Argument6.QuadPart;
 
+    //
+    //  The lock length is passed by reference, the pointer means nothing
+    //  to the client so keep the value instead.
+    //
+
+    if (Data->Iopb->MajorFunction == IRP_MJ_LOCK_CONTROL &&
+        Data->Iopb->Parameters.LockControl.Length != NULL) {
+
+        recordData->Arg1 = (PVOID)(ULONG_PTR)Data->Iopb->Parameters.LockControl.Length->QuadPart;
+    }
+
     recordData->RequestorMode = Data->RequestorMode;
-    recordData->BlockingRuleID = BlockingRuleID;
+    recordData->BlockingRuleID = Rule.RuleId;
+    recordData->RuleAction = Rule.Action;
 
     KeQuerySystemTime( &recordData->OriginatingTime );
 }
@@ -1210,241 +1009,384 @@ Return Value:
 }
 
 
+#if MINISPY_VISTA
+
 VOID
-SpyLog (
-    _In_ PRECORD_LIST RecordList
+SpyLogProcessNotify (
+    _In_ PEPROCESS Process,
+    _In_ HANDLE ProcessId,
+    _In_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo,
+    _Inout_ PRECORD_LIST RecordList
     )
 /*++
 
 Routine Description:
 
-    This routine inserts the given log record into the list to be sent
-    to the user mode application.
-
-    NOTE:  This code must be NON-PAGED because it can be called on the
-           paging path or at DPC level and uses a spin-lock
+    This routine logs a process being created or exiting, so user mode can
+    attribute operations to the image that issued them without opening
+    the process after the fact.
 
 Arguments:
 
-    RecordList - The record to append to the MiniSpyData.OutputBufferList
+    Process - The process being created or exiting.
 
-Return Value:
+    ProcessId - Its id.
 
-    The function returns STATUS_SUCCESS.
+    CreateInfo - Describes the new process, NULL when it exits.
 
+    RecordList - Where we want to save the data
+
+Return Value:
 
+    None.
 
 --*/
 {
-    KIRQL oldIrql;
+    PRECORD_DATA recordData = &RecordList->LogRecord.Data;
+    PEPROCESS parent;
+
+    RecordList->LogRecord.RecordType |= RECORD_TYPE_PROCESS;
+
+    recordData->ProcessId = (FILE_ID)ProcessId;
+    recordData->OriginatingTime.QuadPart = PsGetProcessCreateTimeQuadPart( Process );
+    recordData->RequestorMode = KernelMode;
+
+    if (CreateInfo == NULL) {
 
-    KeAcquireSpinLock(&MiniSpyData.OutputBufferLock, &oldIrql);
-    InsertTailList(&MiniSpyData.OutputBufferList, &RecordList->List);
-    KeReleaseSpinLock(&MiniSpyData.OutputBufferLock, oldIrql);
+        recordData->CallbackMinorId = PROCESS_RECORD_EXIT;
+        recordData->Status = PsGetProcessExitStatus( Process );
+        KeQuerySystemTime( &recordData->CompletionTime );
+        return;
+    }
+
+    recordData->CallbackMinorId = PROCESS_RECORD_CREATE;
+    recordData->Information = (ULONG_PTR)CreateInfo->ParentProcessId;
+    recordData->ThreadId = (FILE_ID)CreateInfo->CreatingThreadId.UniqueThread;
+
+    //
+    //  The parent may be gone already, its id alone is then ambiguous.
+    //
+
+    if (NT_SUCCESS( PsLookupProcessByProcessId( CreateInfo->ParentProcessId, &parent ) )) {
+
+        recordData->Arg6.QuadPart = PsGetProcessCreateTimeQuadPart( parent );
+        ObDereferenceObject( parent );
+    }
+
+    if (CreateInfo->ImageFileName != NULL) {
+
+        SpySetRecordNameAndEcpData( &RecordList->LogRecord,
+                                    (PUNICODE_STRING)CreateInfo->ImageFileName,
+                                    NULL );
+    }
 }
 
+#endif // MINISPY_VISTA
+
+//---------------------------------------------------------------------------
+//                    Rule routines
+//---------------------------------------------------------------------------
 
 NTSTATUS
-SpyGetLog (
-    _Out_writes_bytes_to_(OutputBufferLength,*ReturnOutputBufferLength) PUCHAR OutputBuffer,
-    _In_ ULONG OutputBufferLength,
-    _Out_ PULONG ReturnOutputBufferLength
+SpySetRules (
+    _In_reads_bytes_(Size) PVOID UserRules,
+    _In_ ULONG Size
     )
 /*++
 
 Routine Description:
-    This function fills OutputBuffer with as many LOG_RECORDs as possible.
-    The LOG_RECORDs are variable sizes and are tightly packed in the
-    OutputBuffer.
 
-    NOTE:  This code must be NON-PAGED because it uses a spin-lock.
+    Captures a rule set sent by user mode and makes it the one operations
+    are matched against.  The previous rule set stays in its slot, and is
+    only freed by the next update once every reader has left it.
 
 Arguments:
-    OutputBuffer - The user's buffer to fill with the log data we have
-        collected
 
-    OutputBufferLength - The size in bytes of OutputBuffer
+    UserRules - Raw user mode buffer holding the rule set.
 
-    ReturnOutputBufferLength - The amount of data actually written into the
-        OutputBuffer.
+    Size - Size of the rule set in bytes, 0 removes every rule.
 
 Return Value:
-    STATUS_SUCCESS if some records were able to be written to the OutputBuffer.
-
-    STATUS_NO_MORE_ENTRIES if we have no data to return.
 
-    STATUS_BUFFER_TOO_SMALL if the OutputBuffer is too small to
-        hold even one record and we have data to return.
+    STATUS_SUCCESS, STATUS_INVALID_PARAMETER if the rule set is malformed,
+    STATUS_INSUFFICIENT_RESOURCES, or the exception raised while copying.
 
 --*/
 {
-    PLIST_ENTRY pList;
-    ULONG bytesWritten = 0;
-    PLOG_RECORD pLogRecord;
-    NTSTATUS status = STATUS_NO_MORE_ENTRIES;
-    PRECORD_LIST pRecordList;
-    KIRQL oldIrql;
-    BOOLEAN recordsAvailable = FALSE;
+    PSPY_RULES_HEADER rules = NULL;
+    PSPY_RULES_HEADER oldRules;
+    LARGE_INTEGER interval;
+    LONG slot;
 
-    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    PAGED_CODE();
 
-    while (!IsListEmpty( &MiniSpyData.OutputBufferList ) && (OutputBufferLength > 0)) {
+    if (Size > SPY_RULES_MAX_SIZE) {
 
-        //
-        //  Mark we have records
-        //
+        return STATUS_INVALID_PARAMETER;
+    }
 
-        recordsAvailable = TRUE;
+    if (Size != 0) {
 
-        //
-        //  Get the next available record
-        //
-
-        pList = RemoveHeadList( &MiniSpyData.OutputBufferList );
+        rules = ExAllocatePoolWithTag( NonPagedPoolNx, Size, SPY_TAG );
 
-        pRecordList = CONTAINING_RECORD( pList, RECORD_LIST, List );
+        if (rules == NULL) {
 
-        pLogRecord = &pRecordList->LogRecord;
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
 
-        //
-        //  If no filename was set then make it into a NULL file name.
-        //
+        try {
 
-        if (REMAINING_NAME_SPACE( pLogRecord ) == MAX_NAME_SPACE) {
+            RtlCopyMemory( rules, UserRules, Size );
 
-            //
-            //  We don't have a name, so return an empty string.
-            //  We have to always start a new log record on a PVOID aligned boundary.
-            //
+        } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
 
-            pLogRecord->Length += ROUND_TO_SIZE( sizeof( UNICODE_NULL ), sizeof( PVOID ) );
-            pLogRecord->Name[0] = UNICODE_NULL;
+            ExFreePoolWithTag( rules, SPY_TAG );
+            return GetExceptionCode();
         }
 
         //
-        //  Put it back if we've run out of room.
+        //  Only the captured copy is validated, user mode can no longer
+        //  change it.
         //
 
-        if (OutputBufferLength < pLogRecord->Length) {
+        if (!SpyRulesValidate( rules, Size )) {
 
-            InsertHeadList( &MiniSpyData.OutputBufferList, pList );
-            break;
+            ExFreePoolWithTag( rules, SPY_TAG );
+            return STATUS_INVALID_PARAMETER;
         }
 
-        KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
-
         //
-        //  The lock is released, return the data, adjust pointers.
-        //  Protect access to raw user-mode OutputBuffer with an exception handler
+        //  Without rules there is no point querying names to match.
         //
 
-        try {
-            RtlCopyMemory( OutputBuffer, pLogRecord, pLogRecord->Length );
-        } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+        if (rules->RuleCount == 0) {
 
-            //
-            //  Put the record back in
-            //
+            ExFreePoolWithTag( rules, SPY_TAG );
+            rules = NULL;
+        }
+    }
 
-            KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
-            InsertHeadList( &MiniSpyData.OutputBufferList, pList );
-            KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    ExAcquireFastMutex( &MiniSpyData.RulesLock );
 
-            return GetExceptionCode();
+    slot = 1 - MiniSpyData.ActiveRules;
 
-        }
+    //
+    //  Readers only stay in a slot for one match, so waiting a millisecond
+    //  at a time is plenty.
+    //
+
+    interval.QuadPart = -10 * 1000;
 
-        bytesWritten += pLogRecord->Length;
+    while (MiniSpyData.RuleReaders[slot] != 0) {
 
-        OutputBufferLength -= pLogRecord->Length;
+        KeDelayExecutionThread( KernelMode, FALSE, &interval );
+    }
 
-        OutputBuffer += pLogRecord->Length;
+    oldRules = MiniSpyData.Rules[slot];
+    MiniSpyData.Rules[slot] = rules;
 
-        SpyFreeRecord( pRecordList );
+    InterlockedExchange( &MiniSpyData.ActiveRules, slot );
 
-        //
-        //  Relock the list
-        //
+    ExReleaseFastMutex( &MiniSpyData.RulesLock );
 
-        KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    if (oldRules != NULL) {
+
+        ExFreePoolWithTag( oldRules, SPY_TAG );
     }
 
-    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    return STATUS_SUCCESS;
+}
 
-    //
-    //  Set proper status
-    //
 
-    if ((bytesWritten == 0) && recordsAvailable) {
+VOID
+SpyFreeRules (
+    VOID
+    )
+/*++
 
-        //
-        //  There were records to be sent up but
-        //  there was not enough room in the buffer.
-        //
+Routine Description:
 
-        status = STATUS_BUFFER_TOO_SMALL;
+    Frees both rule slots.  Only called once no more operations can come
+    in, when the filter is unloading.
 
-    } else if (bytesWritten > 0) {
+Arguments:
 
-        //
-        //  We were able to write some data to the output buffer,
-        //  so this was a success.
-        //
+    None.
 
-        status = STATUS_SUCCESS;
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG slot;
+
+    PAGED_CODE();
+
+    for (slot = 0; slot < 2; slot++) {
+
+        if (MiniSpyData.Rules[slot] != NULL) {
+
+            ExFreePoolWithTag( MiniSpyData.Rules[slot], SPY_TAG );
+            MiniSpyData.Rules[slot] = NULL;
+        }
     }
+}
+
+
+BOOLEAN
+SpyRulesApply (
+    _In_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects
+    )
+/*++
+
+Routine Description:
 
-    *ReturnOutputBufferLength = bytesWritten;
+    Tells whether an operation has to be matched against the rules: a
+    create, write or set information on a file while there are rules.
+    Paging writes are left alone, failing them would lose data already
+    accepted into the cache.
 
-    return status;
+    The rule set may change right after this returns, it only decides
+    whether it is worth getting the file name.
+
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path.
+
+Arguments:
+
+    Data - The operation.
+
+    FltObjects - Objects of the operation.
+
+Return Value:
+
+    TRUE if the caller should match the file name with SpyMatchRules.
+
+--*/
+{
+    switch (Data->Iopb->MajorFunction) {
+
+        case IRP_MJ_CREATE:
+        case IRP_MJ_SET_INFORMATION:
+            break;
+
+        case IRP_MJ_WRITE:
+
+            if (FlagOn( Data->Iopb->IrpFlags, IRP_PAGING_IO )) {
+
+                return FALSE;
+            }
+            break;
+
+        default:
+            return FALSE;
+    }
+
+    return (FltObjects->FileObject != NULL) &&
+           (MiniSpyData.Rules[MiniSpyData.ActiveRules] != NULL);
 }
 
 
-VOID
-SpyEmptyOutputBufferList (
-    VOID
+SPY_RULE_REF
+SpyMatchRules (
+    _In_ PUNICODE_STRING Name
     )
 /*++
 
 Routine Description:
 
-    This routine frees all the remaining log records in the OutputBufferList
-    that are not going to get sent up to the user mode application since
-    MiniSpy is shutting down.
+    Matches a file name against the active rule set without taking a lock
+    or allocating.
 
-    NOTE:  This code must be NON-PAGED because it uses a spin-lock
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path.
 
 Arguments:
 
-    None.
+    Name - Normalized name of the file.
 
 Return Value:
 
-    None.
+    The strongest matching rule, RuleId is 0 if none matched.
 
 --*/
 {
-    PLIST_ENTRY pList;
-    PRECORD_LIST pRecordList;
-    KIRQL oldIrql;
+    SPY_RULE_REF rule = { 0, 0 };
+    PSPY_RULES_HEADER rules;
+    LONG slot;
+
+    //
+    //  Count ourselves in the slot, then make sure it is still the active
+    //  one.  If SpySetRules flipped in between it may be about to free
+    //  that slot's rules, so start over on the new slot.
+    //
+
+    for (;;) {
+
+        slot = MiniSpyData.ActiveRules;
+
+        InterlockedIncrement( &MiniSpyData.RuleReaders[slot] );
+
+        if (slot == InterlockedCompareExchange( &MiniSpyData.ActiveRules, 0, 0 )) {
+
+            break;
+        }
+
+        InterlockedDecrement( &MiniSpyData.RuleReaders[slot] );
+    }
+
+    rules = MiniSpyData.Rules[slot];
 
-    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    if (rules != NULL) {
 
-    while (!IsListEmpty( &MiniSpyData.OutputBufferList )) {
+        rule = SpyRulesMatch( rules, Name->Buffer, Name->Length / sizeof( WCHAR ) );
+    }
 
-        pList = RemoveHeadList( &MiniSpyData.OutputBufferList );
-        KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    InterlockedDecrement( &MiniSpyData.RuleReaders[slot] );
 
-        pRecordList = CONTAINING_RECORD( pList, RECORD_LIST, List );
+    return rule;
+}
 
-        SpyFreeRecord( pRecordList );
 
-        KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+FLT_PREOP_CALLBACK_STATUS
+SpyBlockOperation (
+    _Inout_ PFLT_CALLBACK_DATA Data
+    )
+/*++
+
+Routine Description:
+
+    Fails an operation a Block rule matched with STATUS_ACCESS_DENIED.  A
+    fast I/O operation is disallowed instead, so that it is sent again as
+    an IRP and failed then.
+
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path.
+
+Arguments:
+
+    Data - The operation to fail.
+
+Return Value:
+
+    The status the pre-operation callback must return.
+
+--*/
+{
+    if (FLT_IS_FASTIO_OPERATION( Data )) {
+
+        return FLT_PREOP_DISALLOW_FASTIO;
     }
 
-    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    Data->IoStatus.Status = STATUS_ACCESS_DENIED;
+    Data->IoStatus.Information = 0;
+
+    return FLT_PREOP_COMPLETE;
 }
 
+
 //---------------------------------------------------------------------------
 //                    Logging routines
 //---------------------------------------------------------------------------
@@ -1464,6 +1406,7 @@ Routine Description:
     This processes the following registry keys:
     hklm\system\CurrentControlSet\Services\Minispy\MaxRecords
     hklm\system\CurrentControlSet\Services\Minispy\NameQueryMethod
+    hklm\system\CurrentControlSet\Services\Minispy\RingRecords
 
 
 Arguments:
@@ -1544,6 +1487,26 @@ Return Value:
         MiniSpyData.NameQueryMethod = *((PLONG)&(pValuePartialInfo->Data));
     }
 
+    //
+    // Read the RingRecords entry from the registry
+    //
+
+    RtlInitUnicodeString( &valueName, RING_RECORDS );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status )) {
+
+        pValuePartialInfo = (PKEY_VALUE_PARTIAL_INFORMATION) buffer;
+        FLT_ASSERT( pValuePartialInfo->Type == REG_DWORD );
+        MiniSpyData.RingRecords = *((PULONG)&(pValuePartialInfo->Data));
+    }
+
     ZwClose(driverRegKey);
 }
 
@@ -0,0 +1,656 @@
+/*++
+
+Copyright (c) 1989-2002  Microsoft Corporation
+
+Module Name:
+
+    mspyRecord.c
+
+Abstract:
+    Log record allocation and the output ring the records are handed to
+    user mode through.
+
+    These routines use nothing of the kernel beyond spin locks, interlocked
+    operations, a lookaside list and pool allocations, and are kept apart
+    from the rest of the filter so tools/mspyRecordBench.c can build them
+    in user mode against a shim of those and measure them.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "mspyKern.h"
+
+//---------------------------------------------------------------------------
+//                    Log Record allocation routines
+//---------------------------------------------------------------------------
+
+PRECORD_LIST
+SpyAllocateBuffer (
+    _Out_ PULONG RecordType
+    )
+/*++
+
+Routine Description:
+
+    Allocates a new buffer from the MiniSpyData.FreeBufferList if there is
+    enough memory to do so and we have not exceed our maximum buffer
+    count.
+
+    NOTE:  Because there is no interlock between testing if we have exceeded
+           the record allocation limit and actually increment the in use
+           count it is possible to temporarily allocate one or two buffers
+           more then the limit.  Because this is such a rare situation there
+           is not point to handling this.
+
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path or at DPC level.
+
+Arguments:
+
+    RecordType - Receives information on what type of record was allocated.
+
+Return Value:
+
+    Pointer to the allocated buffer, or NULL if the allocation failed.
+
+--*/
+{
+    PVOID newBuffer;
+    ULONG newRecordType = RECORD_TYPE_NORMAL;
+
+    //
+    //  See if we have room to allocate more buffers
+    //
+
+    if (MiniSpyData.RecordsAllocated < MiniSpyData.MaxRecordsToAllocate) {
+
+        InterlockedIncrement( &MiniSpyData.RecordsAllocated );
+
+        newBuffer = ExAllocateFromNPagedLookasideList( &MiniSpyData.FreeBufferList );
+
+        if (newBuffer == NULL) {
+
+            //
+            //  We failed to allocate the memory.  Decrement our global count
+            //  and return what type of memory we have.
+            //
+
+            InterlockedDecrement( &MiniSpyData.RecordsAllocated );
+
+            newRecordType = RECORD_TYPE_FLAG_OUT_OF_MEMORY;
+            DbgPrint("Failed to allocated memory\n");
+        }
+
+    } else {
+
+        //
+        //  No more room to allocate memory, return we didn't get a buffer
+        //  and why.
+        //
+
+        newRecordType = RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE;
+        newBuffer = NULL;
+    }
+
+    *RecordType = newRecordType;
+    return newBuffer;
+}
+
+
+VOID
+SpyFreeBuffer (
+    _In_ PVOID Buffer
+    )
+/*++
+
+Routine Description:
+
+    Free an allocate buffer.
+
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path or at DPC level.
+
+Arguments:
+
+    Buffer - The buffer to free.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    //
+    //  Free the memory, update the counter
+    //
+
+    InterlockedDecrement( &MiniSpyData.RecordsAllocated );
+    ExFreeToNPagedLookasideList( &MiniSpyData.FreeBufferList, Buffer );
+}
+
+
+//---------------------------------------------------------------------------
+//                    Logging routines
+//---------------------------------------------------------------------------
+
+PRECORD_LIST
+SpyNewRecord (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Allocates a new RECORD_LIST structure if there is enough memory to do so. A
+    sequence number is updated for each request for a new record.
+
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path or at DPC level.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    Pointer to the RECORD_LIST allocated, or NULL if no memory is available.
+
+--*/
+{
+    PRECORD_LIST newRecord;
+    ULONG initialRecordType;
+
+    //
+    //  Allocate the buffer
+    //
+
+    newRecord = SpyAllocateBuffer( &initialRecordType );
+
+    if (newRecord == NULL) {
+
+        //
+        //  We could not allocate a record, see if the static buffer is
+        //  in use.  If not, we will use it
+        //
+
+        if (!InterlockedExchange( &MiniSpyData.StaticBufferInUse, TRUE )) {
+
+            newRecord = (PRECORD_LIST)MiniSpyData.OutOfMemoryBuffer;
+            initialRecordType |= RECORD_TYPE_FLAG_STATIC;
+        }
+        else {
+            return NULL;
+        }
+    }
+
+    //
+    //  If we got a record (doesn't matter if it is static or not), init it
+    //
+
+    if (newRecord != NULL) {
+
+        //
+        // Init the new record
+        //
+
+        newRecord->LogRecord.RecordType = initialRecordType;
+        newRecord->LogRecord.Length = sizeof(LOG_RECORD);
+        newRecord->LogRecord.SequenceNumber = InterlockedIncrement( &MiniSpyData.LogSequenceNumber );
+        RtlZeroMemory( &newRecord->LogRecord.Data, sizeof( RECORD_DATA ) );
+    }
+
+    return( newRecord );
+}
+
+
+VOID
+SpyFreeRecord (
+    _In_ PRECORD_LIST Record
+    )
+/*++
+
+Routine Description:
+
+    Free the given buffer
+
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path or at DPC level.
+
+Arguments:
+
+    Record - the buffer to free
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (FlagOn(Record->LogRecord.RecordType,RECORD_TYPE_FLAG_STATIC)) {
+
+        //
+        // This was our static buffer, mark it available.
+        //
+
+        FLT_ASSERT(MiniSpyData.StaticBufferInUse);
+        MiniSpyData.StaticBufferInUse = FALSE;
+
+    } else {
+
+        SpyFreeBuffer( Record );
+    }
+}
+
+
+VOID
+SpyLog (
+    _In_ PRECORD_LIST RecordList
+    )
+/*++
+
+Routine Description:
+
+    This routine copies the given log record into the output ring that is
+    read by the user mode applications and then frees the record.  Every
+    connected client reads the ring through its own cursor, so a record is
+    only copied once no matter how many clients are connected.
+
+    NOTE:  This code must be NON-PAGED because it can be called on the
+           paging path or at DPC level and uses a spin-lock
+
+Arguments:
+
+    RecordList - The record to append to MiniSpyData.OutputRing
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PLOG_RECORD pLogRecord = &RecordList->LogRecord;
+    KIRQL oldIrql;
+
+    //
+    //  If no filename was set then make it into a NULL file name.
+    //
+
+    if (REMAINING_NAME_SPACE( pLogRecord ) == MAX_NAME_SPACE) {
+
+        //
+        //  We don't have a name, so return an empty string.
+        //  We have to always start a new log record on a PVOID aligned boundary.
+        //
+
+        pLogRecord->Length += ROUND_TO_SIZE( sizeof( UNICODE_NULL ), sizeof( PVOID ) );
+        pLogRecord->Name[0] = UNICODE_NULL;
+    }
+
+    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    SpyRingPush( &MiniSpyData.OutputRing, pLogRecord );
+    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+
+    //
+    //  The ring holds its own copy, so the record no longer counts against
+    //  MaxRecordsToAllocate.
+    //
+
+    SpyFreeRecord( RecordList );
+}
+
+
+NTSTATUS
+SpyAllocateOutputRing (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Allocates the output ring with room for at least
+    MiniSpyData.RingRecords records.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+{
+    PSPY_RING_SLOT slots;
+    ULONG slotCount;
+
+    slotCount = SpyRingSlotsFor( max( MiniSpyData.RingRecords, 2 ) );
+
+    slots = ExAllocatePoolWithTag( NonPagedPoolNx,
+                                   (SIZE_T)slotCount * sizeof( SPY_RING_SLOT ),
+                                   SPY_TAG );
+
+    if (slots == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    SpyRingInitialize( &MiniSpyData.OutputRing, slots, slotCount );
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+SpyFreeOutputRing (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine frees the output ring and every record still in it that
+    is not going to get sent up to the user mode applications since
+    MiniSpy is shutting down.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (MiniSpyData.OutputRing.Slots != NULL) {
+
+        ExFreePoolWithTag( MiniSpyData.OutputRing.Slots, SPY_TAG );
+        RtlZeroMemory( &MiniSpyData.OutputRing, sizeof( SPY_RING ) );
+    }
+}
+
+
+VOID
+SpyAttachClient (
+    _Inout_ PSPY_CLIENT Client
+    )
+/*++
+
+Routine Description:
+
+    Positions a new client's cursor at the head of the output ring, so it
+    reads the records logged from now on.  The records the ring still holds
+    from before were meant for the clients connected then, replaying them
+    would hand a reconnecting client up to RingRecords records it already
+    logged.
+
+    NOTE:  This code must be NON-PAGED because it uses a spin-lock.
+
+Arguments:
+
+    Client - The client being connected.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    KIRQL oldIrql;
+
+    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    Client->Cursor.Next = MiniSpyData.OutputRing.Head;
+    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+}
+
+
+VOID
+SpySetClientFilter (
+    _Inout_ PSPY_CLIENT Client,
+    _In_ PMINISPY_CLIENT_FILTER Filter
+    )
+/*++
+
+Routine Description:
+
+    Replaces the record filter of a client.  Records already read are not
+    affected.
+
+    NOTE:  This code must be NON-PAGED because it uses a spin-lock.
+
+Arguments:
+
+    Client - The client to update.
+
+    Filter - The captured filter from the user's message.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    KIRQL oldIrql;
+
+    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    Client->Cursor.Filter = *Filter;
+    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+}
+
+
+VOID
+SpyQueryClientStats (
+    _In_ PSPY_CLIENT Client,
+    _Out_ PMINISPY_CLIENT_STATS Stats
+    )
+/*++
+
+Routine Description:
+
+    Takes a consistent snapshot of a client's cursor and counters.
+
+    NOTE:  This code must be NON-PAGED because it uses a spin-lock.
+
+Arguments:
+
+    Client - The client to query.
+
+    Stats - Receives the snapshot.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    KIRQL oldIrql;
+
+    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    SpyRingCursorStats( &MiniSpyData.OutputRing, &Client->Cursor, Stats );
+    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+}
+
+
+NTSTATUS
+SpyGetLog (
+    _Inout_ PSPY_CLIENT Client,
+    _Out_writes_bytes_to_(OutputBufferLength,*ReturnOutputBufferLength) PUCHAR OutputBuffer,
+    _In_ ULONG OutputBufferLength,
+    _Out_ PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+    This function fills OutputBuffer with as many LOG_RECORDs as possible
+    starting at the client's cursor.  The LOG_RECORDs are variable sizes and
+    are tightly packed in the OutputBuffer.  Records are not removed from the
+    ring, other clients read them through their own cursors.
+
+    Calls on one client are serialized by its ReadLock, so several threads
+    reading the same connection neither share the staging copy nor rewind
+    each other's cursor.
+
+    NOTE:  This code must be NON-PAGED because it uses a spin-lock.  It
+           must be called at IRQL <= APC_LEVEL for the ReadLock.
+
+Arguments:
+    Client - The connection the request came in on.
+
+    OutputBuffer - The user's buffer to fill with the log data we have
+        collected
+
+    OutputBufferLength - The size in bytes of OutputBuffer
+
+    ReturnOutputBufferLength - The amount of data actually written into the
+        OutputBuffer.
+
+Return Value:
+    STATUS_SUCCESS if some records were able to be written to the OutputBuffer.
+
+    STATUS_NO_MORE_ENTRIES if we have no data to return.
+
+    STATUS_BUFFER_TOO_SMALL if the OutputBuffer is too small to
+        hold even one record and we have data to return.
+
+--*/
+{
+    ULONG bytesWritten = 0;
+    ULONG stagedLength;
+    PLOG_RECORD pLogRecord;
+    PUCHAR staging = (PUCHAR)Client->Staging;
+    NTSTATUS status = STATUS_NO_MORE_ENTRIES;
+    ULONGLONG sequence;
+    SPY_RING_CURSOR mark;
+    KIRQL oldIrql;
+    BOOLEAN recordsAvailable = FALSE;
+
+    ExAcquireFastMutex( &Client->ReadLock );
+
+    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+
+    while (OutputBufferLength > 0) {
+
+        //
+        //  Take as many records as fit both the staging buffer and what is
+        //  left of the user's buffer while we hold the lock.  The slots may
+        //  be overwritten as soon as the lock is dropped, so they are
+        //  copied, and copying a batch at a time keeps the ring lock from
+        //  being taken again for every record.
+        //
+
+        mark = Client->Cursor;
+        stagedLength = 0;
+
+        for (;;) {
+
+            pLogRecord = SpyRingCursorNext( &MiniSpyData.OutputRing,
+                                            &Client->Cursor,
+                                            &sequence );
+
+            if (pLogRecord == NULL) {
+
+                break;
+            }
+
+            //
+            //  Mark we have records
+            //
+
+            recordsAvailable = TRUE;
+
+            //
+            //  Leave it for the next batch, or the next call if we've run
+            //  out of room.
+            //
+
+            if ((pLogRecord->Length > OutputBufferLength - stagedLength) ||
+                (pLogRecord->Length > sizeof( Client->Staging ) - stagedLength)) {
+
+                SpyRingCursorRewind( &Client->Cursor, sequence );
+                break;
+            }
+
+            RtlCopyMemory( staging + stagedLength, pLogRecord, pLogRecord->Length );
+            stagedLength += pLogRecord->Length;
+        }
+
+        if (stagedLength == 0) {
+
+            break;
+        }
+
+        KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+
+        //
+        //  The lock is released, return the data, adjust pointers.
+        //  Protect access to raw user-mode OutputBuffer with an exception handler
+        //
+
+        try {
+            RtlCopyMemory( OutputBuffer, staging, stagedLength );
+        } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+            //
+            //  Hand the batch out again on the next call.  The filter may
+            //  have been replaced meanwhile, only the position and counts
+            //  are put back.
+            //
+
+            KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+            mark.Filter = Client->Cursor.Filter;
+            Client->Cursor = mark;
+            KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+
+            ExReleaseFastMutex( &Client->ReadLock );
+
+            return GetExceptionCode();
+
+        }
+
+        bytesWritten += stagedLength;
+
+        OutputBufferLength -= stagedLength;
+
+        OutputBuffer += stagedLength;
+
+        //
+        //  Relock the ring
+        //
+
+        KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    }
+
+    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+
+    ExReleaseFastMutex( &Client->ReadLock );
+
+    //
+    //  Set proper status
+    //
+
+    if ((bytesWritten == 0) && recordsAvailable) {
+
+        //
+        //  There were records to be sent up but
+        //  there was not enough room in the buffer.
+        //
+
+        status = STATUS_BUFFER_TOO_SMALL;
+
+    } else if (bytesWritten > 0) {
+
+        //
+        //  We were able to write some data to the output buffer,
+        //  so this was a success.
+        //
+
+        status = STATUS_SUCCESS;
+    }
+
+    *ReturnOutputBufferLength = bytesWritten;
+
+    return status;
+}
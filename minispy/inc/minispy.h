@@ -54,7 +54,7 @@ Environment:
 //
 
 #define MINISPY_MAJ_VERSION 2
-#define MINISPY_MIN_VERSION 0
+#define MINISPY_MIN_VERSION 4
 
 typedef struct _MINISPYVER {
 
@@ -69,6 +69,14 @@ typedef struct _MINISPYVER {
 
 #define MINISPY_PORT_NAME                   L"\\MiniSpyPort"
 
+//
+//  Maximum number of user mode clients that may be connected to the port at
+//  the same time.  Every client reads the shared record buffer through its
+//  own cursor.
+//
+
+#define MINISPY_MAX_CONNECTIONS             8
+
 //
 //  Local definitions for passing parameters between the filter and user mode
 //
@@ -88,6 +96,7 @@ typedef _Return_type_success_(return >= 0) LONG NTSTATUS;
 
 #define RECORD_TYPE_NORMAL                       0x00000000
 #define RECORD_TYPE_FILETAG                      0x00000004
+#define RECORD_TYPE_PROCESS                      0x00000008
 
 #define RECORD_TYPE_FLAG_STATIC                  0x80000000
 #define RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE 0x20000000
@@ -121,6 +130,12 @@ typedef struct _RECORD_DATA {
     UCHAR CallbackMinorId;
     UCHAR Reserved[2];      // Alignment on IA64
 
+    //
+    //  Parameters.Others as the filter saw it, except that for
+    //  IRP_MJ_LOCK_CONTROL Arg1 holds the lock length rather than a
+    //  pointer to it.
+    //
+
     PVOID Arg1;
     PVOID Arg2;
     PVOID Arg3;
@@ -138,6 +153,28 @@ typedef struct _RECORD_DATA {
 
 } RECORD_DATA, *PRECORD_DATA;
 
+//
+//  RECORD_TYPE_PROCESS records report a process being created or exiting,
+//  reusing RECORD_DATA as follows.  ProcessId and OriginatingTime together
+//  name the process for its whole life, ids are reused once it is gone.
+//
+//      ProcessId           The process.
+//      OriginatingTime     Its create time.
+//      CompletionTime      Its exit time, 0 on create.
+//      CallbackMinorId     PROCESS_RECORD_CREATE or PROCESS_RECORD_EXIT.
+//      Information         Parent process id, on create.
+//      Arg6                Parent create time, on create, 0 if the parent
+//                          was already gone.
+//      ThreadId            Thread that created the process, on create.
+//      Status              Exit status, on exit.
+//
+//  Name is the image path on create, as the kernel opened it, and empty
+//  on exit.
+//
+
+#define PROCESS_RECORD_CREATE   0
+#define PROCESS_RECORD_EXIT     1
+
 //
 //  What information we actually log.
 //
@@ -188,10 +225,73 @@ typedef struct _RECORD_LIST {
 typedef enum _MINISPY_COMMAND {
 
     GetMiniSpyLog,
-    GetMiniSpyVersion
+    GetMiniSpyVersion,
+    SetMiniSpyClientFilter,
+    GetMiniSpyClientStats,
+    SetMiniSpyRules
 
 } MINISPY_COMMAND;
 
+//
+//  Per client record filter, sent in COMMAND_MESSAGE.Data with the
+//  SetMiniSpyClientFilter command.  A zero ProcessId matches every process
+//  and an all zero MajorFunctionMask matches every operation.  Bit N of the
+//  mask selects CallbackMajorId N (the FltMgr specific codes are negative
+//  and therefore land in the upper half of the mask).
+//
+
+#define MINISPY_MAJOR_MASK_ULONGS   (256 / 32)
+
+typedef struct _MINISPY_CLIENT_FILTER {
+
+    FILE_ID ProcessId;
+    ULONG MajorFunctionMask[MINISPY_MAJOR_MASK_ULONGS];
+
+} MINISPY_CLIENT_FILTER, *PMINISPY_CLIENT_FILTER;
+
+//
+//  Per client counters, returned by the GetMiniSpyClientStats command.
+//  Sequences are positions in the filter's shared record buffer, not the
+//  LOG_RECORD.SequenceNumber of a record.
+//
+
+typedef struct _MINISPY_CLIENT_STATS {
+
+    ULONGLONG NextSequence;     // Next buffer position this client will read
+    ULONGLONG OldestSequence;   // Oldest position still held in the buffer
+    ULONGLONG HeadSequence;     // Position the next record will be written to
+
+    ULONGLONG Delivered;        // Records copied to this client
+    ULONGLONG Dropped;          // Records overwritten before this client read them
+    ULONGLONG Filtered;         // Records skipped by this client's filter
+
+} MINISPY_CLIENT_STATS, *PMINISPY_CLIENT_STATS;
+
+//
+//  Values of the Action, RuleType and RuleTarget columns of the Rules
+//  table, also used for RECORD_DATA.RuleAction.  When several rules match
+//  the same operation the strongest action wins.
+//
+
+#define RULE_ACTION_IGNORE      0       // drop the record, it is not logged
+#define RULE_ACTION_ALERT       1       // log the record and raise an alert
+#define RULE_ACTION_BLOCK       2       // fail the operation
+
+#define RULE_TYPE_HASH          0       // SHA-256 of the file, as 64 hex digits
+#define RULE_TYPE_LOCATION      1       // path prefix, whole components only
+#define RULE_TYPE_EXTENSION     2       // file extension, without the dot
+
+#define RULE_TARGET_PROCESS     0       // image of the requesting process
+#define RULE_TARGET_FILE        1       // file the operation is on
+
+//
+//  The SetMiniSpyRules command carries a compiled rule set, laid out as
+//  described in spyRules.h, in COMMAND_MESSAGE.Data.  The filter applies it
+//  to creates, writes and set information operations, failing those that
+//  match a Block rule with STATUS_ACCESS_DENIED.  A command without a rule
+//  set removes the rules.
+//
+
 //
 //  Defines the command structure between the utility and the filter.
 //
@@ -207,6 +307,29 @@ typedef struct _COMMAND_MESSAGE {
 
 #pragma warning(pop)
 
+//
+//  The user mode executable can be pointed at a stand-in for the filter,
+//  tools/mspyFake.c, over a local (AF_UNIX) socket instead of the port.
+//  Each FilterSendMessage is a MINISPY_LOCAL_REQUEST followed by
+//  InputSize bytes of COMMAND_MESSAGE, answered with a MINISPY_LOCAL_REPLY
+//  followed by BytesReturned bytes.  Status is the HRESULT
+//  FilterSendMessage would have returned for the filter's NTSTATUS.
+//
+
+typedef struct _MINISPY_LOCAL_REQUEST {
+
+    ULONG InputSize;
+    ULONG OutputSize;
+
+} MINISPY_LOCAL_REQUEST, *PMINISPY_LOCAL_REQUEST;
+
+typedef struct _MINISPY_LOCAL_REPLY {
+
+    LONG Status;
+    ULONG BytesReturned;
+
+} MINISPY_LOCAL_REPLY, *PMINISPY_LOCAL_REPLY;
+
 //
 //  The maximum number of BYTES that can be used to store the file name in the
 //  RECORD_LIST structure
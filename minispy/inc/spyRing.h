@@ -0,0 +1,348 @@
+/*++
+
+Module Name:
+
+    spyRing.h
+
+Abstract:
+
+    The shared record buffer used by minispy.sys to serve several user mode
+    clients at once.  Log records are copied into a fixed array of slots that
+    is addressed by a monotonically increasing buffer sequence.  Writers never
+    wait for readers: once the buffer is full the oldest slot is overwritten.
+    Every client owns a cursor holding the next sequence it wants to read and
+    a record filter, so a slow client only loses its own data and accounts
+    for it in its own drop counter.
+
+    The routines here do no locking and no allocation, the caller provides
+    both.  They only depend on the types in minispy.h so the same code can be
+    compiled into the filter and into user mode programs.
+
+Environment:
+
+    Kernel and user mode
+
+--*/
+#ifndef __SPYRING_H__
+#define __SPYRING_H__
+
+#include <string.h>
+#include "minispy.h"
+
+//
+//  One slot holds a full LOG_RECORD.  Sequence is the buffer sequence the
+//  slot was last written with, 0 if it was never written.
+//
+
+typedef struct _SPY_RING_SLOT {
+
+    ULONGLONG Sequence;
+
+    //
+    //  PVOID aligned so the copied LOG_RECORD is aligned the same way as
+    //  in a RECORD_LIST.
+    //
+
+    PVOID Record[MAX_LOG_RECORD_LENGTH / sizeof( PVOID )];
+
+} SPY_RING_SLOT, *PSPY_RING_SLOT;
+
+typedef struct _SPY_RING {
+
+    PSPY_RING_SLOT Slots;
+
+    //
+    //  SlotCount is a power of two so a sequence maps to a slot with a mask.
+    //
+
+    ULONG SlotCount;
+    ULONG SlotMask;
+
+    //
+    //  Sequence the next record will be written with.  Sequences start at
+    //  1 so that a zero slot sequence means "empty".
+    //
+
+    ULONGLONG Head;
+
+} SPY_RING, *PSPY_RING;
+
+typedef struct _SPY_RING_CURSOR {
+
+    ULONGLONG Next;
+
+    MINISPY_CLIENT_FILTER Filter;
+
+    ULONGLONG Delivered;
+    ULONGLONG Dropped;
+    ULONGLONG Filtered;
+
+} SPY_RING_CURSOR, *PSPY_RING_CURSOR;
+
+//
+//  Number of slots needed for at least the given number of records.
+//
+
+__inline
+ULONG
+SpyRingSlotsFor (
+    _In_ ULONG Records
+    )
+{
+    ULONG count = 1;
+
+    while (count < Records && count < 0x80000000) {
+
+        count <<= 1;
+    }
+
+    return count;
+}
+
+__inline
+VOID
+SpyRingInitialize (
+    _Out_ PSPY_RING Ring,
+    _In_ PSPY_RING_SLOT Slots,
+    _In_ ULONG SlotCount
+    )
+/*++
+
+Routine Description:
+
+    Initializes an empty ring over caller supplied slot storage.
+
+Arguments:
+
+    Ring - The ring to initialize.
+
+    Slots - Storage for SlotCount slots.
+
+    SlotCount - Number of slots, must be a power of two.
+
+--*/
+{
+    ULONG index;
+
+    Ring->Slots = Slots;
+    Ring->SlotCount = SlotCount;
+    Ring->SlotMask = SlotCount - 1;
+    Ring->Head = 1;
+
+    for (index = 0; index < SlotCount; index++) {
+
+        Slots[index].Sequence = 0;
+    }
+}
+
+__inline
+ULONGLONG
+SpyRingOldest (
+    _In_ PSPY_RING Ring
+    )
+/*++
+
+Routine Description:
+
+    Returns the oldest sequence still held in the ring.  If the ring is
+    empty this is the same as Ring->Head.
+
+--*/
+{
+    if (Ring->Head > Ring->SlotCount) {
+
+        return Ring->Head - Ring->SlotCount;
+    }
+
+    return 1;
+}
+
+__inline
+ULONGLONG
+SpyRingPush (
+    _Inout_ PSPY_RING Ring,
+    _In_ PLOG_RECORD LogRecord
+    )
+/*++
+
+Routine Description:
+
+    Copies a log record into the slot for the head sequence, overwriting the
+    oldest record if the ring is full.  The caller must serialize against
+    every other ring routine.
+
+Arguments:
+
+    Ring - The ring to append to.
+
+    LogRecord - The record to copy, Length must not exceed
+        MAX_LOG_RECORD_LENGTH.
+
+Return Value:
+
+    The sequence the record was stored with.
+
+--*/
+{
+    PSPY_RING_SLOT slot;
+    ULONGLONG sequence = Ring->Head;
+
+    slot = &Ring->Slots[sequence & Ring->SlotMask];
+
+    memcpy( slot->Record, LogRecord, LogRecord->Length );
+    slot->Sequence = sequence;
+
+    Ring->Head = sequence + 1;
+
+    return sequence;
+}
+
+__inline
+BOOLEAN
+SpyRingFilterMatch (
+    _In_ PMINISPY_CLIENT_FILTER Filter,
+    _In_ PLOG_RECORD LogRecord
+    )
+/*++
+
+Routine Description:
+
+    Tests a record against a client filter.  Records flagged as out of
+    memory or over the allowance are always delivered so that every client
+    learns that it may be missing data, and process records so that every
+    client can attribute the operations it does receive.
+
+--*/
+{
+    ULONG index;
+    ULONG major;
+    ULONG anyMajor = 0;
+
+    if ((LogRecord->RecordType & (RECORD_TYPE_FLAG_OUT_OF_MEMORY |
+                                  RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE |
+                                  RECORD_TYPE_PROCESS)) != 0) {
+
+        return TRUE;
+    }
+
+    if ((Filter->ProcessId != 0) &&
+        (Filter->ProcessId != LogRecord->Data.ProcessId)) {
+
+        return FALSE;
+    }
+
+    for (index = 0; index < MINISPY_MAJOR_MASK_ULONGS; index++) {
+
+        anyMajor |= Filter->MajorFunctionMask[index];
+    }
+
+    if (anyMajor == 0) {
+
+        return TRUE;
+    }
+
+    major = LogRecord->Data.CallbackMajorId;
+
+    return (Filter->MajorFunctionMask[major / 32] & (1UL << (major % 32))) != 0;
+}
+
+__inline
+PLOG_RECORD
+SpyRingCursorNext (
+    _In_ PSPY_RING Ring,
+    _Inout_ PSPY_RING_CURSOR Cursor,
+    _Out_ PULONGLONG Sequence
+    )
+/*++
+
+Routine Description:
+
+    Returns the next record a client should read and advances its cursor
+    past it.  If the client fell behind the oldest record in the ring the
+    overwritten records are added to its drop counter.  Records rejected by
+    the client filter are skipped and counted.
+
+    The returned pointer refers to ring storage and is only valid while the
+    caller keeps the ring serialized.  If the caller then fails to hand the
+    record over it should call SpyRingCursorRewind.
+
+Arguments:
+
+    Ring - The ring to read from.
+
+    Cursor - The client cursor.
+
+    Sequence - Receives the sequence of the returned record.
+
+Return Value:
+
+    The next record for this client, or NULL if the client is caught up.
+
+--*/
+{
+    ULONGLONG oldest = SpyRingOldest( Ring );
+    PSPY_RING_SLOT slot;
+    PLOG_RECORD logRecord;
+
+    if (Cursor->Next < oldest) {
+
+        Cursor->Dropped += oldest - Cursor->Next;
+        Cursor->Next = oldest;
+    }
+
+    while (Cursor->Next < Ring->Head) {
+
+        slot = &Ring->Slots[Cursor->Next & Ring->SlotMask];
+        logRecord = (PLOG_RECORD)slot->Record;
+
+        *Sequence = Cursor->Next;
+        Cursor->Next++;
+
+        if (SpyRingFilterMatch( &Cursor->Filter, logRecord )) {
+
+            Cursor->Delivered++;
+            return logRecord;
+        }
+
+        Cursor->Filtered++;
+    }
+
+    return NULL;
+}
+
+__inline
+VOID
+SpyRingCursorRewind (
+    _Inout_ PSPY_RING_CURSOR Cursor,
+    _In_ ULONGLONG Sequence
+    )
+/*++
+
+Routine Description:
+
+    Undoes the last SpyRingCursorNext so the record at Sequence is returned
+    again by the next read.
+
+--*/
+{
+    Cursor->Next = Sequence;
+    Cursor->Delivered--;
+}
+
+__inline
+VOID
+SpyRingCursorStats (
+    _In_ PSPY_RING Ring,
+    _In_ PSPY_RING_CURSOR Cursor,
+    _Out_ PMINISPY_CLIENT_STATS Stats
+    )
+{
+    Stats->NextSequence = Cursor->Next;
+    Stats->OldestSequence = SpyRingOldest( Ring );
+    Stats->HeadSequence = Ring->Head;
+    Stats->Delivered = Cursor->Delivered;
+    Stats->Dropped = Cursor->Dropped;
+    Stats->Filtered = Cursor->Filtered;
+}
+
+#endif /* __SPYRING_H__ */
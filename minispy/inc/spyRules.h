@@ -0,0 +1,524 @@
+/*++
+
+Module Name:
+
+    spyRules.h
+
+Abstract:
+
+    The compiled rule set user mode hands to minispy.sys with the
+    SetMiniSpyRules command, and the routines that match a file name
+    against it.
+
+    The rule set is one flat, position independent block: a header followed
+    by the trie nodes, the trie edge table, the extension table and the
+    upcased text every entry points into.  It is built by minispy.exe from
+    the Rules table (the same trie and hash layout the log writer matches
+    with) and checked with SpyRulesValidate before the filter uses it, after
+    which matching needs no allocation and no lock.
+
+    The routines only depend on the types in minispy.h so the same code is
+    compiled into the filter and into user mode programs.  Characters
+    outside ASCII are upcased with SPY_RULES_UPCASE_WIDE when the includer
+    defines it and compared as they are otherwise.
+
+Environment:
+
+    Kernel and user mode
+
+--*/
+#ifndef __SPYRULES_H__
+#define __SPYRULES_H__
+
+#include "minispy.h"
+
+#define SPY_RULES_VERSION           1
+
+//
+//  Upper bound on the size of a rule set the filter accepts.  The filter
+//  keeps its copy in non paged pool.
+//
+
+#define SPY_RULES_MAX_SIZE          (256 * 1024)
+
+#define SPY_RULES_MAX_EXTENSION     32      // WCHARs, without the dot
+
+#define SPY_RULES_HASH_SEED         2166136261UL
+
+//
+//  A rule as it applies to a match.  RuleId 0 means no rule.
+//
+
+typedef struct _SPY_RULE_REF {
+
+    LONG RuleId;
+    LONG Action;
+
+} SPY_RULE_REF, *PSPY_RULE_REF;
+
+//
+//  Edge of the trie over path components, keyed by parent node and the
+//  component.  Text is an index in WCHARs into the text area.
+//
+
+typedef struct _SPY_RULE_EDGE {
+
+    ULONG Parent;
+    ULONG Hash;
+    ULONG Child;            // 0 means the slot is empty
+    USHORT Length;          // in WCHARs
+    USHORT Reserved;
+    ULONG Text;
+
+} SPY_RULE_EDGE, *PSPY_RULE_EDGE;
+
+typedef struct _SPY_RULE_EXTENSION {
+
+    ULONG Hash;
+    USHORT Length;          // 0 means the slot is empty
+    USHORT Reserved;
+    ULONG Text;
+    SPY_RULE_REF Rule;
+
+} SPY_RULE_EXTENSION, *PSPY_RULE_EXTENSION;
+
+//
+//  Offsets are in bytes from the start of the header, counts of the edge
+//  and extension tables are Mask + 1, a power of two.
+//
+
+typedef struct _SPY_RULES_HEADER {
+
+    ULONG Version;
+    ULONG Size;             // of the whole rule set, header included
+    ULONG RuleCount;
+
+    ULONG NodeCount;        // node 0 is the root
+    ULONG NodeOffset;       // SPY_RULE_REF[NodeCount]
+
+    ULONG EdgeMask;
+    ULONG EdgeOffset;       // SPY_RULE_EDGE[EdgeMask + 1]
+
+    ULONG ExtensionMask;
+    ULONG ExtensionOffset;  // SPY_RULE_EXTENSION[ExtensionMask + 1]
+
+    ULONG TextLength;       // in WCHARs
+    ULONG TextOffset;
+
+} SPY_RULES_HEADER, *PSPY_RULES_HEADER;
+
+#define SpyRulesNodes(R)        ((PSPY_RULE_REF)Add2Ptr( (R), (R)->NodeOffset ))
+#define SpyRulesEdges(R)        ((PSPY_RULE_EDGE)Add2Ptr( (R), (R)->EdgeOffset ))
+#define SpyRulesExtensions(R)   ((PSPY_RULE_EXTENSION)Add2Ptr( (R), (R)->ExtensionOffset ))
+#define SpyRulesText(R)         ((PWCHAR)Add2Ptr( (R), (R)->TextOffset ))
+
+//
+//  Hashing and probing shared with the builder in minispy.exe.  Changing
+//  either changes the rule set format.
+//
+
+__inline
+WCHAR
+SpyRulesUpcase (
+    _In_ WCHAR Char
+    )
+{
+    if (Char < 0x80) {
+
+        return (Char >= L'a' && Char <= L'z') ? (WCHAR)(Char - (L'a' - L'A')) : Char;
+    }
+
+#ifdef SPY_RULES_UPCASE_WIDE
+    return SPY_RULES_UPCASE_WIDE( Char );
+#else
+    return Char;
+#endif
+}
+
+__inline
+ULONG
+SpyRulesHashStep (
+    _In_ ULONG Hash,
+    _In_ WCHAR Char
+    )
+{
+    return (Hash ^ Char) * 16777619UL;
+}
+
+__inline
+ULONG
+SpyRulesEdgeSlot (
+    _In_ ULONG Parent,
+    _In_ ULONG Hash
+    )
+{
+    return Hash ^ (Parent * 0x9E3779B1UL);
+}
+
+__inline
+BOOLEAN
+SpyRulesIsSeparator (
+    _In_ WCHAR Char
+    )
+{
+    return Char == L'\\' || Char == L'/';
+}
+
+__inline
+SPY_RULE_REF
+SpyRulesStronger (
+    _In_ SPY_RULE_REF Current,
+    _In_ SPY_RULE_REF Candidate
+    )
+/*++
+
+Routine Description:
+
+    Picks the rule that applies when both match: the stronger action, or
+    the lower RuleId if the actions are the same.
+
+--*/
+{
+    if (Candidate.RuleId == 0) {
+
+        return Current;
+    }
+
+    if (Current.RuleId == 0 ||
+        Candidate.Action > Current.Action ||
+        (Candidate.Action == Current.Action && Candidate.RuleId < Current.RuleId)) {
+
+        return Candidate;
+    }
+
+    return Current;
+}
+
+__inline
+BOOLEAN
+SpyRulesTableValid (
+    _In_ ULONG Size,
+    _In_ ULONG Offset,
+    _In_ ULONG Count,
+    _In_ ULONG EntrySize
+    )
+{
+    return (Offset % sizeof( ULONG )) == 0 &&
+           Offset >= sizeof( SPY_RULES_HEADER ) &&
+           Offset <= Size &&
+           (ULONGLONG)Count * EntrySize <= (ULONGLONG)(Size - Offset);
+}
+
+__inline
+BOOLEAN
+SpyRulesValidate (
+    _In_reads_bytes_(Size) PSPY_RULES_HEADER Rules,
+    _In_ ULONG Size
+    )
+/*++
+
+Routine Description:
+
+    Checks that a rule set received from user mode is safe to match with:
+    every table and every string lies inside it, every edge leads to an
+    existing node and every hash table keeps at least one empty slot, so
+    lookups always terminate.
+
+Arguments:
+
+    Rules - The captured rule set.
+
+    Size - Number of bytes captured.
+
+Return Value:
+
+    TRUE if SpyRulesMatch may be used on the rule set.
+
+--*/
+{
+    PSPY_RULE_EDGE edges;
+    PSPY_RULE_EXTENSION extensions;
+    ULONG index;
+    ULONG used;
+
+    if (Size < sizeof( SPY_RULES_HEADER ) ||
+        Size > SPY_RULES_MAX_SIZE ||
+        Rules->Version != SPY_RULES_VERSION ||
+        Rules->Size != Size ||
+        Rules->NodeCount == 0 ||
+        Rules->EdgeMask >= SPY_RULES_MAX_SIZE ||
+        (Rules->EdgeMask & (Rules->EdgeMask + 1)) != 0 ||
+        Rules->ExtensionMask >= SPY_RULES_MAX_SIZE ||
+        (Rules->ExtensionMask & (Rules->ExtensionMask + 1)) != 0) {
+
+        return FALSE;
+    }
+
+    if (!SpyRulesTableValid( Size, Rules->NodeOffset, Rules->NodeCount, sizeof( SPY_RULE_REF ) ) ||
+        !SpyRulesTableValid( Size, Rules->EdgeOffset, Rules->EdgeMask + 1, sizeof( SPY_RULE_EDGE ) ) ||
+        !SpyRulesTableValid( Size, Rules->ExtensionOffset, Rules->ExtensionMask + 1, sizeof( SPY_RULE_EXTENSION ) ) ||
+        !SpyRulesTableValid( Size, Rules->TextOffset, Rules->TextLength, sizeof( WCHAR ) )) {
+
+        return FALSE;
+    }
+
+    edges = SpyRulesEdges( Rules );
+
+    for (index = 0, used = 0; index <= Rules->EdgeMask; index++) {
+
+        if (edges[index].Child == 0) {
+
+            continue;
+        }
+
+        used++;
+
+        if (edges[index].Child >= Rules->NodeCount ||
+            edges[index].Parent >= Rules->NodeCount ||
+            edges[index].Length == 0 ||
+            edges[index].Text > Rules->TextLength ||
+            edges[index].Length > Rules->TextLength - edges[index].Text) {
+
+            return FALSE;
+        }
+    }
+
+    if (used > Rules->EdgeMask) {
+
+        return FALSE;
+    }
+
+    extensions = SpyRulesExtensions( Rules );
+
+    for (index = 0, used = 0; index <= Rules->ExtensionMask; index++) {
+
+        if (extensions[index].Length == 0) {
+
+            continue;
+        }
+
+        used++;
+
+        if (extensions[index].Length > SPY_RULES_MAX_EXTENSION ||
+            extensions[index].Text > Rules->TextLength ||
+            extensions[index].Length > Rules->TextLength - extensions[index].Text) {
+
+            return FALSE;
+        }
+    }
+
+    return used <= Rules->ExtensionMask;
+}
+
+__inline
+SPY_RULE_REF
+SpyRulesMatchLocation (
+    _In_ PSPY_RULES_HEADER Rules,
+    _In_reads_(Length) PCWSTR Name,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Walks the trie one path component at a time and returns the strongest
+    rule on the way.  A rule only matches whole components.
+
+--*/
+{
+    SPY_RULE_REF best = { 0, 0 };
+    PSPY_RULE_REF nodes = SpyRulesNodes( Rules );
+    PSPY_RULE_EDGE edges = SpyRulesEdges( Rules );
+    PCWSTR text = SpyRulesText( Rules );
+    PSPY_RULE_EDGE edge;
+    ULONG node = 0;
+    ULONG position = 0;
+    ULONG start;
+    ULONG hash;
+    ULONG slot;
+    ULONG index;
+
+    while (position < Length) {
+
+        while (position < Length && SpyRulesIsSeparator( Name[position] )) {
+
+            position++;
+        }
+
+        if (position == Length) {
+
+            break;
+        }
+
+        start = position;
+        hash = SPY_RULES_HASH_SEED;
+
+        while (position < Length && !SpyRulesIsSeparator( Name[position] )) {
+
+            hash = SpyRulesHashStep( hash, SpyRulesUpcase( Name[position] ) );
+            position++;
+        }
+
+        slot = SpyRulesEdgeSlot( node, hash ) & Rules->EdgeMask;
+
+        for (;;) {
+
+            edge = &edges[slot];
+
+            if (edge->Child == 0) {
+
+                return best;
+            }
+
+            if (edge->Parent == node &&
+                edge->Hash == hash &&
+                edge->Length == position - start) {
+
+                for (index = 0; index < edge->Length; index++) {
+
+                    if (text[edge->Text + index] != SpyRulesUpcase( Name[start + index] )) {
+
+                        break;
+                    }
+                }
+
+                if (index == edge->Length) {
+
+                    break;
+                }
+            }
+
+            slot = (slot + 1) & Rules->EdgeMask;
+        }
+
+        node = edge->Child;
+        best = SpyRulesStronger( best, nodes[node] );
+    }
+
+    return best;
+}
+
+__inline
+SPY_RULE_REF
+SpyRulesMatchExtension (
+    _In_ PSPY_RULES_HEADER Rules,
+    _In_reads_(Length) PCWSTR Name,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Looks up the extension of the last component of Name, ignoring any
+    :stream suffix.  Only the last component is read, from the end of the
+    name, and the extension is hashed and compared where it is.
+
+--*/
+{
+    SPY_RULE_REF none = { 0, 0 };
+    PSPY_RULE_EXTENSION extensions = SpyRulesExtensions( Rules );
+    PCWSTR text = SpyRulesText( Rules );
+    PCWSTR extension;
+    PSPY_RULE_EXTENSION entry;
+    ULONG nameStart = Length;
+    ULONG end;
+    ULONG dot = MAXULONG;
+    ULONG extensionLength;
+    ULONG hash = SPY_RULES_HASH_SEED;
+    ULONG slot;
+    ULONG index;
+
+    while (nameStart > 0 && !SpyRulesIsSeparator( Name[nameStart - 1] )) {
+
+        nameStart--;
+    }
+
+    for (end = nameStart; end < Length && Name[end] != L':'; end++) {
+
+        if (Name[end] == L'.') {
+
+            dot = end;
+        }
+    }
+
+    if (dot == MAXULONG || end == dot + 1 || end - dot - 1 > SPY_RULES_MAX_EXTENSION) {
+
+        return none;
+    }
+
+    extension = Name + dot + 1;
+    extensionLength = end - dot - 1;
+
+    for (index = 0; index < extensionLength; index++) {
+
+        hash = SpyRulesHashStep( hash, SpyRulesUpcase( extension[index] ) );
+    }
+
+    slot = hash & Rules->ExtensionMask;
+
+    for (;;) {
+
+        entry = &extensions[slot];
+
+        if (entry->Length == 0) {
+
+            return none;
+        }
+
+        if (entry->Hash == hash && entry->Length == extensionLength) {
+
+            for (index = 0; index < extensionLength; index++) {
+
+                if (text[entry->Text + index] != SpyRulesUpcase( extension[index] )) {
+
+                    break;
+                }
+            }
+
+            if (index == extensionLength) {
+
+                return entry->Rule;
+            }
+        }
+
+        slot = (slot + 1) & Rules->ExtensionMask;
+    }
+}
+
+__inline
+SPY_RULE_REF
+SpyRulesMatch (
+    _In_ PSPY_RULES_HEADER Rules,
+    _In_reads_(Length) PCWSTR Name,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Matches a file name against a validated rule set.  Name does not need
+    to be NUL terminated.
+
+Arguments:
+
+    Rules - A rule set SpyRulesValidate accepted.
+
+    Name - The file name.
+
+    Length - Length of Name in WCHARs.
+
+Return Value:
+
+    The strongest matching rule, RuleId is 0 if none matched.
+
+--*/
+{
+    SPY_RULE_REF best;
+
+    best = SpyRulesMatchLocation( Rules, Name, Length );
+    best = SpyRulesStronger( best, SpyRulesMatchExtension( Rules, Name, Length ) );
+
+    return best;
+}
+
+#endif /* __SPYRULES_H__ */
@@ -0,0 +1,422 @@
+/*++
+
+Module Name:
+
+    fltKernel.h
+
+Abstract:
+
+    A stand-in for the WDK's fltKernel.h, so the parts of the filter that
+    need nothing of the kernel beyond spin locks, interlocked operations,
+    lookaside lists and pool can be built into a Linux program and
+    measured there, see mspyRecordBench.c.
+
+    Types the filter only passes around are left incomplete.  The
+    primitives behave as the kernel's do for the code that uses them, and
+    count what the benchmark reports:
+
+        KSPIN_LOCK          A test and test-and-set lock.  Acquisitions
+                            that find it held are counted, with the time
+                            spent waiting.  A waiter yields the processor
+                            after a while, since the holder may have been
+                            descheduled.
+
+        FAST_MUTEX          A pthread mutex.
+
+        EX_RUNDOWN_REF      A count of holders, and a flag set once the
+                            owner waits for them, after which no one
+                            acquires it.
+
+        Lookaside lists     malloc and free, failing one allocation in
+                            FailEvery when it is set, to drive the filter's
+                            out of memory paths.
+
+        Pool                malloc and free.
+
+    IRQL is not modelled, and there is no preemption to disable: a thread
+    holding a spin lock here can be descheduled, which makes contention
+    look worse than it is at DISPATCH_LEVEL.
+
+Environment:
+
+    Linux user mode
+
+--*/
+#ifndef __KSHIM_FLTKERNEL_H__
+#define __KSHIM_FLTKERNEL_H__
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//
+//  Build the filter's Windows 8 configuration
+//
+
+#define NTDDI_WIN2K                 0x05000000
+#define NTDDI_VISTA                 0x06000000
+#define NTDDI_WIN7                  0x06010000
+#define NTDDI_WIN8                  0x06020000
+#define NTDDI_VERSION               NTDDI_WIN8
+#define OSVER(Version)              ((Version) & 0xFF000000)
+
+//
+//  Types
+//
+
+typedef void VOID;
+typedef void *PVOID;
+typedef char CHAR;
+typedef char CCHAR;
+typedef uint8_t UCHAR, *PUCHAR;
+typedef uint8_t BOOLEAN;
+typedef uint16_t USHORT;
+typedef uint16_t WCHAR, *PWCHAR;
+typedef const WCHAR *PCWSTR;
+typedef int32_t LONG;
+typedef uint32_t ULONG, *PULONG;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG, *PULONGLONG;
+typedef uintptr_t ULONG_PTR;
+typedef size_t SIZE_T;
+typedef int INT;
+typedef LONG NTSTATUS;
+typedef PVOID HANDLE;
+typedef UCHAR KIRQL, *PKIRQL;
+
+_Static_assert( sizeof( PVOID ) == 8, "The shim lays records out as x64 Windows does" );
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCHAR Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+//
+//  Passed around only
+//
+
+typedef struct _DRIVER_OBJECT *PDRIVER_OBJECT;
+typedef struct _FLT_FILTER *PFLT_FILTER;
+typedef struct _FLT_PORT *PFLT_PORT;
+typedef struct _FLT_INSTANCE *PFLT_INSTANCE;
+typedef struct _KTRANSACTION *PKTRANSACTION;
+typedef struct _EPROCESS *PEPROCESS;
+typedef struct _PS_CREATE_NOTIFY_INFO *PPS_CREATE_NOTIFY_INFO;
+typedef struct _EXCEPTION_POINTERS *PEXCEPTION_POINTERS;
+typedef struct _FLT_CALLBACK_DATA *PFLT_CALLBACK_DATA;
+typedef const struct _FLT_RELATED_OBJECTS *PCFLT_RELATED_OBJECTS;
+typedef struct _FLT_REGISTRATION FLT_REGISTRATION;
+typedef PVOID PFLT_CONTEXT;
+typedef int FLT_SET_CONTEXT_OPERATION;
+typedef ULONG NOTIFICATION_MASK;
+typedef int FLT_PREOP_CALLBACK_STATUS;
+typedef int FLT_POSTOP_CALLBACK_STATUS;
+typedef ULONG FLT_POST_OPERATION_FLAGS;
+typedef ULONG FLT_FILTER_UNLOAD_FLAGS;
+typedef ULONG FLT_INSTANCE_QUERY_TEARDOWN_FLAGS;
+typedef USHORT FLT_CONTEXT_TYPE;
+
+#define FLT_FILE_NAME_QUERY_ALWAYS_ALLOW_CACHE_LOOKUP   0x0300
+
+//
+//  Annotations and compiler keywords
+//
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Inout_opt_
+#define _Outptr_
+#define _Outptr_opt_
+#define _In_reads_(Count)
+#define _In_reads_bytes_(Size)
+#define _Out_writes_bytes_to_(Size, Count)
+#define _Flt_CompletionContext_Outptr_
+#define _Return_type_success_(Expr)
+#define __volatile                  volatile
+#define __inline                    static inline
+
+//
+//  Structured exception handling.  Nothing the shimmed code touches can
+//  fault in a way it could handle, so the handler is never entered.
+//
+
+#define try                         if (1)
+#define except(Filter)              else if (0)
+#define leave                       break
+#define GetExceptionCode()          ((NTSTATUS)0xC0000005L)
+
+//
+//  Macros
+//
+
+#define TRUE                        1
+#define FALSE                       0
+#define UNICODE_NULL                ((WCHAR)0)
+#define MAXULONG                    0xFFFFFFFFUL
+#define FIELD_OFFSET(Type, Field)   ((LONG)offsetof( Type, Field ))
+#define Add2Ptr(Ptr, Inc)           ((PVOID)((PUCHAR)(Ptr) + (Inc)))
+#define FlagOn(Flags, Flag)         ((Flags) & (Flag))
+#define SetFlag(Flags, Flag)        ((Flags) |= (Flag))
+#define ClearFlag(Flags, Flag)      ((Flags) &= ~(Flag))
+
+#ifndef max
+#define max(a, b)                   (((a) > (b)) ? (a) : (b))
+#define min(a, b)                   (((a) < (b)) ? (a) : (b))
+#endif
+
+#define NT_SUCCESS(Status)                  (((NTSTATUS)(Status)) >= 0)
+#define STATUS_SUCCESS                      ((NTSTATUS)0x00000000L)
+#define STATUS_NO_MORE_ENTRIES              ((NTSTATUS)0x8000001AL)
+#define STATUS_BUFFER_TOO_SMALL             ((NTSTATUS)0xC0000023L)
+#define STATUS_INSUFFICIENT_RESOURCES       ((NTSTATUS)0xC000009AL)
+#define STATUS_INVALID_PARAMETER            ((NTSTATUS)0xC000000DL)
+#define STATUS_PORT_DISCONNECTED            ((NTSTATUS)0xC0000037L)
+
+#define FLT_ASSERT(Expr)            assert( Expr )
+#define DbgPrint(...)               ((void)0)
+
+#define RtlZeroMemory(Dest, Length)         memset( (Dest), 0, (Length) )
+#define RtlCopyMemory(Dest, Src, Length)    memcpy( (Dest), (Src), (Length) )
+
+//
+//  ASCII only, the rule matching the shimmed code pulls in is not measured.
+//
+
+static inline WCHAR
+RtlUpcaseUnicodeChar (
+    WCHAR SourceCharacter
+    )
+{
+    return (SourceCharacter >= 'a' && SourceCharacter <= 'z') ? (WCHAR)(SourceCharacter - ('a' - 'A')) : SourceCharacter;
+}
+
+//
+//  Interlocked operations, full barriers as on x64
+//
+
+#define InterlockedIncrement(Addend)        __atomic_add_fetch( (Addend), 1, __ATOMIC_SEQ_CST )
+#define InterlockedDecrement(Addend)        __atomic_sub_fetch( (Addend), 1, __ATOMIC_SEQ_CST )
+#define InterlockedExchange(Target, Value)  __atomic_exchange_n( (Target), (Value), __ATOMIC_SEQ_CST )
+#define InterlockedExchangeAdd(Addend, Value) __atomic_fetch_add( (Addend), (Value), __ATOMIC_SEQ_CST )
+
+static inline LONG
+InterlockedCompareExchange (
+    volatile LONG *Destination,
+    LONG Exchange,
+    LONG Comparand
+    )
+{
+    __atomic_compare_exchange_n( Destination, &Comparand, Exchange, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+    return Comparand;
+}
+
+static inline long long
+KshimNow (
+    void
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//
+//  Spin locks
+//
+
+#define KSHIM_SPINS_BEFORE_YIELD    1000
+
+typedef struct _KSPIN_LOCK {
+
+    volatile LONG Held;
+
+    //
+    //  Counters, updated while holding the lock.
+    //
+
+    unsigned long long Acquisitions;
+    unsigned long long Contended;
+    unsigned long long WaitNanoseconds;
+
+} KSPIN_LOCK, *PKSPIN_LOCK;
+
+static inline VOID
+KeInitializeSpinLock (
+    PKSPIN_LOCK SpinLock
+    )
+{
+    memset( SpinLock, 0, sizeof( KSPIN_LOCK ) );
+}
+
+static inline VOID
+KshimAcquireSpinLock (
+    PKSPIN_LOCK SpinLock
+    )
+{
+    long long start;
+    ULONG spins;
+
+    if (__atomic_exchange_n( &SpinLock->Held, 1, __ATOMIC_ACQUIRE ) == 0) {
+
+        SpinLock->Acquisitions++;
+        return;
+    }
+
+    start = KshimNow();
+
+    do {
+
+        for (spins = 0; __atomic_load_n( &SpinLock->Held, __ATOMIC_RELAXED ); spins++) {
+
+            if (spins < KSHIM_SPINS_BEFORE_YIELD) {
+
+                __builtin_ia32_pause();
+
+            } else {
+
+                sched_yield();
+            }
+        }
+
+    } while (__atomic_exchange_n( &SpinLock->Held, 1, __ATOMIC_ACQUIRE ) != 0);
+
+    SpinLock->Acquisitions++;
+    SpinLock->Contended++;
+    SpinLock->WaitNanoseconds += (unsigned long long)(KshimNow() - start);
+}
+
+#define KeAcquireSpinLock(SpinLock, OldIrql)    (*(OldIrql) = 0, KshimAcquireSpinLock( SpinLock ))
+#define KeReleaseSpinLock(SpinLock, NewIrql)    ((void)(NewIrql), __atomic_store_n( &(SpinLock)->Held, 0, __ATOMIC_RELEASE ))
+
+//
+//  Fast mutexes
+//
+
+typedef struct _FAST_MUTEX {
+    pthread_mutex_t Mutex;
+} FAST_MUTEX, *PFAST_MUTEX;
+
+#define ExInitializeFastMutex(FastMutex)    pthread_mutex_init( &(FastMutex)->Mutex, NULL )
+#define ExAcquireFastMutex(FastMutex)       pthread_mutex_lock( &(FastMutex)->Mutex )
+#define ExReleaseFastMutex(FastMutex)       pthread_mutex_unlock( &(FastMutex)->Mutex )
+
+//
+//  Rundown protection
+//
+
+#define KSHIM_RUNDOWN_ACTIVE        0x80000000UL
+
+typedef struct _EX_RUNDOWN_REF {
+    volatile ULONG Count;
+} EX_RUNDOWN_REF, *PEX_RUNDOWN_REF;
+
+#define ExInitializeRundownProtection(RunRef)   ((RunRef)->Count = 0)
+
+static inline BOOLEAN
+ExAcquireRundownProtection (
+    PEX_RUNDOWN_REF RunRef
+    )
+{
+    ULONG count = __atomic_load_n( &RunRef->Count, __ATOMIC_RELAXED );
+
+    do {
+
+        if (count & KSHIM_RUNDOWN_ACTIVE) {
+
+            return FALSE;
+        }
+
+    } while (!__atomic_compare_exchange_n( &RunRef->Count, &count, count + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ));
+
+    return TRUE;
+}
+
+#define ExReleaseRundownProtection(RunRef)      ((void)__atomic_sub_fetch( &(RunRef)->Count, 1, __ATOMIC_RELEASE ))
+
+static inline VOID
+ExWaitForRundownProtectionRelease (
+    PEX_RUNDOWN_REF RunRef
+    )
+{
+    __atomic_or_fetch( &RunRef->Count, KSHIM_RUNDOWN_ACTIVE, __ATOMIC_SEQ_CST );
+
+    while (__atomic_load_n( &RunRef->Count, __ATOMIC_ACQUIRE ) != KSHIM_RUNDOWN_ACTIVE) {
+
+        sched_yield();
+    }
+}
+
+//
+//  Lookaside lists
+//
+
+#define POOL_NX_ALLOCATION          0x00000200
+
+typedef struct _NPAGED_LOOKASIDE_LIST {
+
+    SIZE_T Size;
+
+    //
+    //  Fail one allocation in FailEvery, 0 to never fail.
+    //
+
+    ULONG FailEvery;
+    volatile ULONGLONG Allocations;
+    volatile ULONGLONG Failures;
+
+} NPAGED_LOOKASIDE_LIST, *PNPAGED_LOOKASIDE_LIST;
+
+#define ExInitializeNPagedLookasideList(Lookaside, Allocate, Free, Flags, EntrySize, Tag, Depth) \
+    (memset( (Lookaside), 0, sizeof( NPAGED_LOOKASIDE_LIST ) ), (Lookaside)->Size = (EntrySize))
+
+static inline PVOID
+ExAllocateFromNPagedLookasideList (
+    PNPAGED_LOOKASIDE_LIST Lookaside
+    )
+{
+    ULONGLONG count = __atomic_add_fetch( &Lookaside->Allocations, 1, __ATOMIC_RELAXED );
+
+    if (Lookaside->FailEvery != 0 && count % Lookaside->FailEvery == 0) {
+
+        __atomic_add_fetch( &Lookaside->Failures, 1, __ATOMIC_RELAXED );
+        return NULL;
+    }
+
+    return malloc( Lookaside->Size );
+}
+
+#define ExFreeToNPagedLookasideList(Lookaside, Entry)   free( Entry )
+#define ExDeleteNPagedLookasideList(Lookaside)          ((void)(Lookaside))
+
+//
+//  Pool
+//
+
+#define NonPagedPoolNx              512
+
+#define ExAllocatePoolWithTag(PoolType, NumberOfBytes, Tag)     malloc( NumberOfBytes )
+#define ExFreePoolWithTag(P, Tag)                               free( P )
+
+#endif //__KSHIM_FLTKERNEL_H__
@@ -0,0 +1,3 @@
+//
+//  A stand-in for the WDK's suppress.h, see fltKernel.h.
+//
@@ -0,0 +1,489 @@
+/*++
+
+Module Name:
+
+    mspyArgsTest.c
+
+Abstract:
+
+    Checks and measures the decoding of operation arguments by major
+    function, user/mspyArgs.c, in a Linux program against ushim.
+
+    mspyArgs.c is included rather than linked.  Records are made the way
+    the filter makes them: Parameters.Others filled with random bytes,
+    standing for the members of FLT_PARAMETERS and whatever the kernel
+    left in their padding, copied into Arg1..Arg6, with the lock length
+    read through its pointer into Arg1 for IRP_MJ_LOCK_CONTROL.  Where
+    each member lies is written out here a second time, as byte offsets
+    into Parameters.Others taken from fltKernel.h for the 64 bit builds,
+    rather than through ARGS_PARAMETERS.
+
+    Every major and minor function, 0 to 255, is decoded from -n random
+    records and from records holding edge values: lengths of 0 and
+    0xFFFFFFFF, the FILE_WRITE_TO_END_OF_FILE and
+    FILE_USE_FILE_POINTER_POSITION offsets, locks of more than 4 GB.  The
+    fields decoded must be the ones fltKernel.h has for the function,
+    with the values it has there, ULONGs not picking up the padding after
+    them; the others must be 0.
+
+    The measurement decodes a mix of records as a busy volume sees them
+    and prints ns a record.
+
+    It returns 1 when a check fails.
+
+    Built on its own, for instance:
+
+        gcc -O2 -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspyArgsTest mspyArgsTest.c
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../user/mspyArgs.c"
+#include "mspyBench.h"
+
+#define BENCH_OTHERS_SIZE       48          // Parameters.Others on 64 bit
+#define BENCH_NONE              -1
+#define BENCH_MIX_SIZE          (1 << 16)
+
+//
+//  Where fltKernel.h puts what is decoded, in bytes into Parameters.Others,
+//  BENCH_NONE if the function has none.
+//
+
+typedef struct _BENCH_LAYOUT {
+
+    int OffsetAt;
+    int LengthAt;
+    int LengthSize;
+    int InfoClassAt;
+    int ControlCodeAt;
+
+} BENCH_LAYOUT, *PBENCH_LAYOUT;
+
+typedef struct _BENCH_STATE {
+
+    RECORD_DATA Mix[BENCH_MIX_SIZE];
+    ULONGLONG Sink;                 // keeps the measured decodes
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static VOID
+BenchLayout (
+    _In_ UCHAR Major,
+    _In_ UCHAR Minor,
+    _Out_ PBENCH_LAYOUT Layout
+    )
+/*++
+
+Routine Description:
+
+    What fltKernel.h declares for a major and minor function, on 64 bit.
+    A ULONG declared POINTER_ALIGNMENT starts a slot of 8 bytes.
+
+--*/
+{
+    Layout->OffsetAt = BENCH_NONE;
+    Layout->LengthAt = BENCH_NONE;
+    Layout->LengthSize = 4;
+    Layout->InfoClassAt = BENCH_NONE;
+    Layout->ControlCodeAt = BENCH_NONE;
+
+    switch (Major) {
+
+        case IRP_MJ_READ:
+        case IRP_MJ_WRITE:
+
+            //
+            //  ULONG Length; ULONG POINTER_ALIGNMENT Key; ULONG Flags;
+            //  LARGE_INTEGER ByteOffset.  Completing an MDL transfer
+            //  names none.
+            //
+
+            if (!FlagOn( Minor, IRP_MN_COMPLETE )) {
+
+                Layout->LengthAt = 0;
+                Layout->OffsetAt = 16;
+            }
+            break;
+
+        case IRP_MJ_QUERY_INFORMATION:
+        case IRP_MJ_SET_INFORMATION:
+        case IRP_MJ_QUERY_VOLUME_INFORMATION:
+        case IRP_MJ_SET_VOLUME_INFORMATION:
+
+            //
+            //  ULONG Length; FILE_ or FS_INFORMATION_CLASS POINTER_ALIGNMENT.
+            //
+
+            Layout->LengthAt = 0;
+            Layout->InfoClassAt = 8;
+            break;
+
+        case IRP_MJ_QUERY_EA:
+        case IRP_MJ_SET_EA:
+
+            Layout->LengthAt = 0;
+            break;
+
+        case IRP_MJ_DIRECTORY_CONTROL:
+
+            //
+            //  QueryDirectory: ULONG Length; PUNICODE_STRING FileName;
+            //  FILE_INFORMATION_CLASS FileInformationClass.
+            //  NotifyDirectory: ULONG Length; ULONG POINTER_ALIGNMENT
+            //  CompletionFilter.
+            //
+
+            if (Minor == IRP_MN_QUERY_DIRECTORY) {
+
+                Layout->LengthAt = 0;
+                Layout->InfoClassAt = 16;
+
+            } else if (Minor == IRP_MN_NOTIFY_CHANGE_DIRECTORY) {
+
+                Layout->LengthAt = 0;
+            }
+            break;
+
+        case IRP_MJ_FILE_SYSTEM_CONTROL:
+
+            //
+            //  Common: ULONG OutputBufferLength; ULONG POINTER_ALIGNMENT
+            //  InputBufferLength; ULONG POINTER_ALIGNMENT FsControlCode.
+            //  Mounts, verifies and loads are laid out otherwise.
+            //
+
+            if (Minor == IRP_MN_USER_FS_REQUEST || Minor == IRP_MN_KERNEL_CALL) {
+
+                Layout->ControlCodeAt = 16;
+            }
+            break;
+
+        case IRP_MJ_DEVICE_CONTROL:
+        case IRP_MJ_INTERNAL_DEVICE_CONTROL:
+
+            Layout->ControlCodeAt = 16;
+            break;
+
+        case IRP_MJ_LOCK_CONTROL:
+
+            //
+            //  PLARGE_INTEGER Length, replaced by the filter with the
+            //  length; ULONG POINTER_ALIGNMENT Key; LARGE_INTEGER
+            //  ByteOffset.  Unlocking all names no range.
+            //
+
+            if (Minor == IRP_MN_LOCK || Minor == IRP_MN_UNLOCK_SINGLE) {
+
+                Layout->LengthAt = 0;
+                Layout->LengthSize = 8;
+                Layout->OffsetAt = 16;
+            }
+            break;
+    }
+}
+
+static ULONGLONG
+BenchRead (
+    _In_reads_(BENCH_OTHERS_SIZE) const UCHAR *Others,
+    _In_ int At,
+    _In_ int Size
+    )
+{
+    ULONGLONG value = 0;
+
+    memcpy( &value, Others + At, Size );
+    return value;
+}
+
+static VOID
+BenchEdge (
+    _Inout_updates_(BENCH_OTHERS_SIZE) UCHAR *Others,
+    _In_ int At,
+    _In_ int Size
+    )
+/*++
+
+Routine Description:
+
+    Writes an edge value at a field now and then, random bytes stay
+    otherwise.
+
+--*/
+{
+    static const ULONGLONG edges[] = {
+        0,
+        1,
+        0xFFFFFFFF,
+        0x80000000,
+        0xFFFFFFFFFFFFFFFFULL,      // FILE_WRITE_TO_END_OF_FILE, whole file lock
+        0xFFFFFFFFFFFFFFFEULL,      // FILE_USE_FILE_POINTER_POSITION
+        0x7FFFFFFFFFFFFFFFULL,
+        0x0000010000000000ULL,      // a lock of 1 TB
+    };
+    ULONGLONG value;
+
+    if (At == BENCH_NONE || BenchBelow( 4 ) != 0) {
+
+        return;
+    }
+
+    value = edges[BenchBelow( sizeof( edges ) / sizeof( edges[0] ) )];
+    memcpy( Others + At, &value, Size );
+}
+
+static VOID
+BenchRecord (
+    _In_ UCHAR Major,
+    _In_ UCHAR Minor,
+    _In_reads_(BENCH_OTHERS_SIZE) const UCHAR *Others,
+    _Out_ PRECORD_DATA Record
+    )
+/*++
+
+Routine Description:
+
+    Copies Parameters.Others into a record as SpyLogPreOperationData
+    does.
+
+--*/
+{
+    memset( Record, 0, sizeof( RECORD_DATA ) );
+
+    Record->CallbackMajorId = Major;
+    Record->CallbackMinorId = Minor;
+
+    memcpy( &Record->Arg1, Others + 0, sizeof( PVOID ) );
+    memcpy( &Record->Arg2, Others + 8, sizeof( PVOID ) );
+    memcpy( &Record->Arg3, Others + 16, sizeof( PVOID ) );
+    memcpy( &Record->Arg4, Others + 24, sizeof( PVOID ) );
+    memcpy( &Record->Arg5, Others + 32, sizeof( PVOID ) );
+    memcpy( &Record->Arg6, Others + 40, sizeof( LARGE_INTEGER ) );
+}
+
+static VOID
+BenchCheckDecode (
+    _In_ ULONG Records
+    )
+{
+    BENCH_LAYOUT layout;
+    RECORD_DATA record;
+    RECORD_ARGS args;
+    RECORD_ARGS expected;
+    UCHAR others[BENCH_OTHERS_SIZE];
+    char detail[200];
+    ULONG major;
+    ULONG minor;
+    ULONG index;
+    ULONG byte;
+    ULONG decoded = 0;
+
+    for (major = 0; major < 256; major++) {
+
+        for (minor = 0; minor < 256; minor++) {
+
+            BenchLayout( (UCHAR)major, (UCHAR)minor, &layout );
+
+            for (index = 0; index < Records; index++) {
+
+                for (byte = 0; byte < BENCH_OTHERS_SIZE; byte++) {
+
+                    others[byte] = (UCHAR)BenchRandom();
+                }
+
+                BenchEdge( others, layout.OffsetAt, 8 );
+                BenchEdge( others, layout.LengthAt, layout.LengthSize );
+                BenchEdge( others, layout.InfoClassAt, 4 );
+                BenchEdge( others, layout.ControlCodeAt, 4 );
+
+                memset( &expected, 0, sizeof( expected ) );
+
+                if (layout.OffsetAt != BENCH_NONE) {
+
+                    expected.Offset = (LONGLONG)BenchRead( others, layout.OffsetAt, 8 );
+                    expected.Valid |= ARGS_OFFSET;
+                }
+
+                if (layout.LengthAt != BENCH_NONE) {
+
+                    expected.Length = BenchRead( others, layout.LengthAt, layout.LengthSize );
+                    expected.Valid |= ARGS_LENGTH;
+                }
+
+                if (layout.InfoClassAt != BENCH_NONE) {
+
+                    expected.InfoClass = (ULONG)BenchRead( others, layout.InfoClassAt, 4 );
+                    expected.Valid |= ARGS_INFO_CLASS;
+                }
+
+                if (layout.ControlCodeAt != BENCH_NONE) {
+
+                    expected.ControlCode = (ULONG)BenchRead( others, layout.ControlCodeAt, 4 );
+                    expected.Valid |= ARGS_CONTROL_CODE;
+                }
+
+                BenchRecord( (UCHAR)major, (UCHAR)minor, others, &record );
+
+                //
+                //  Garbage where the decoder has nothing to write.
+                //
+
+                memset( &args, 0xA5, sizeof( args ) );
+                ArgsDecode( &record, &args );
+
+                decoded += (args.Valid != 0);
+                BenchCommon.Checks++;
+
+                if (args.Valid != expected.Valid ||
+                    args.Offset != expected.Offset ||
+                    args.Length != expected.Length ||
+                    args.InfoClass != expected.InfoClass ||
+                    args.ControlCode != expected.ControlCode) {
+
+                    snprintf( detail, sizeof( detail ),
+                              "major 0x%02x minor 0x%02x: valid 0x%x offset %lld length %llu class %u code 0x%x, "
+                              "expected 0x%x %lld %llu %u 0x%x",
+                              major, minor,
+                              args.Valid, (long long)args.Offset, (unsigned long long)args.Length, args.InfoClass, args.ControlCode,
+                              expected.Valid, (long long)expected.Offset, (unsigned long long)expected.Length,
+                              expected.InfoClass, expected.ControlCode );
+                    BenchFail( "arguments decoded as fltKernel.h lays them out", detail );
+                }
+            }
+        }
+    }
+
+    printf( "%u records over every major and minor function, %u with arguments decoded\n",
+            256 * 256 * Records, decoded );
+}
+
+static VOID
+BenchMeasure (
+    _In_ ULONG Decodes
+    )
+/*++
+
+Routine Description:
+
+    Decodes a mix of reads and writes, queries and sets, directory
+    enumerations, controls, locks and creates and closes, which have
+    nothing to decode.
+
+--*/
+{
+    static const struct {
+        UCHAR Major;
+        UCHAR Minor;
+        ULONG Percent;
+    } mix[] = {
+        { IRP_MJ_READ, IRP_MN_NORMAL, 40 },
+        { IRP_MJ_WRITE, IRP_MN_NORMAL, 20 },
+        { IRP_MJ_QUERY_INFORMATION, 0, 12 },
+        { IRP_MJ_SET_INFORMATION, 0, 3 },
+        { IRP_MJ_DIRECTORY_CONTROL, IRP_MN_QUERY_DIRECTORY, 4 },
+        { IRP_MJ_FILE_SYSTEM_CONTROL, IRP_MN_USER_FS_REQUEST, 4 },
+        { IRP_MJ_DEVICE_CONTROL, 0, 1 },
+        { IRP_MJ_LOCK_CONTROL, IRP_MN_LOCK, 1 },
+        { IRP_MJ_CREATE, 0, 8 },
+        { IRP_MJ_CLEANUP, 0, 4 },
+        { IRP_MJ_CLOSE, 0, 3 },
+    };
+    UCHAR others[BENCH_OTHERS_SIZE];
+    RECORD_ARGS args;
+    ULONG index;
+    ULONG byte;
+    ULONG kind;
+    ULONG roll;
+    long long start;
+
+    for (index = 0; index < BENCH_MIX_SIZE; index++) {
+
+        roll = BenchBelow( 100 );
+
+        for (kind = 0; roll >= mix[kind].Percent; kind++) {
+
+            roll -= mix[kind].Percent;
+        }
+
+        for (byte = 0; byte < BENCH_OTHERS_SIZE; byte++) {
+
+            others[byte] = (UCHAR)BenchRandom();
+        }
+
+        BenchRecord( mix[kind].Major, mix[kind].Minor, others, &Bench.Mix[index] );
+    }
+
+    start = BenchNow();
+
+    for (index = 0; index < Decodes; index++) {
+
+        ArgsDecode( &Bench.Mix[index & (BENCH_MIX_SIZE - 1)], &args );
+        Bench.Sink += args.Valid + args.Length;
+    }
+
+    printf( "ArgsDecode: %.1f ns a record over %u records\n",
+            (double)(BenchNow() - start) / Decodes, Decodes );
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    printf( "Usage: mspyArgsTest [-n <records>] [-m <decodes>]\n"
+            "\n"
+            "    [-n <records>] records for each major and minor function, 16 by default\n"
+            "    [-m <decodes>] decodes measured, 50000000 by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    ULONG records = 16;
+    ULONG decodes = 50000000;
+    int option;
+
+    while ((option = getopt( argc, argv, "n:m:" )) != -1) {
+
+        switch (option) {
+
+            case 'n':
+                records = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'm':
+                decodes = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || records == 0 || decodes == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    BenchCheckDecode( records );
+    BenchMeasure( decodes );
+
+    return BenchSummary();
+}
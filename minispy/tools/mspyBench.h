@@ -0,0 +1,168 @@
+/*++
+
+Module Name:
+
+    mspyBench.h
+
+Abstract:
+
+    What the checks and benchmarks in this directory share: a monotonic
+    clock in ns, a xorshift64* generator that gives the same sequence
+    every run, and the count of checks and failures, of which the first
+    BENCH_MAX_FAILURES are printed.
+
+    A tool keeps its own state in Bench, and the shared part is in
+    BenchCommon.  Include it after windows.h from ushim.
+
+Environment:
+
+    Linux user mode
+
+--*/
+#ifndef __MSPYBENCH_H__
+#define __MSPYBENCH_H__
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_MAX_FAILURES      10
+#define BENCH_RANDOM_SEED       2463534242ULL
+
+typedef struct _BENCH_COMMON {
+
+    unsigned long long Random;
+
+    ULONG Checks;
+    ULONG Failures;
+
+} BENCH_COMMON;
+
+static BENCH_COMMON BenchCommon = { BENCH_RANDOM_SEED, 0, 0 };
+
+__inline
+long long
+BenchNow (
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+__inline
+unsigned long long
+BenchNext (
+    _Inout_ unsigned long long *State
+    )
+/*++
+
+Routine Description:
+
+    Steps a xorshift64* generator, for a thread that keeps its own
+    sequence.  State must not be 0.
+
+--*/
+{
+    *State ^= *State >> 12;
+    *State ^= *State << 25;
+    *State ^= *State >> 27;
+    return *State * 2685821657736338717ULL;
+}
+
+__inline
+unsigned long long
+BenchRandom (
+    VOID
+    )
+{
+    return BenchNext( &BenchCommon.Random );
+}
+
+__inline
+ULONG
+BenchRandom32 (
+    VOID
+    )
+{
+    //
+    //  The high half, the better mixed one.
+    //
+
+    return (ULONG)(BenchRandom() >> 32);
+}
+
+__inline
+ULONG
+BenchBelow (
+    _In_ ULONG Limit
+    )
+{
+    return (ULONG)(BenchRandom() % Limit);
+}
+
+__inline
+VOID
+BenchFail (
+    _In_z_ const char *Check,
+    _In_z_ const char *Detail
+    )
+{
+    if (BenchCommon.Failures++ < BENCH_MAX_FAILURES) {
+
+        printf( "FAILED %s: %s\n", Check, Detail );
+    }
+}
+
+__inline
+VOID
+BenchFailFormat (
+    _In_z_ const char *Check,
+    _In_z_ _Printf_format_string_ const char *Format,
+    ...
+    )
+/*++
+
+Routine Description:
+
+    BenchFail with the detail formatted as printf does.
+
+--*/
+{
+    va_list arguments;
+
+    if (BenchCommon.Failures++ < BENCH_MAX_FAILURES) {
+
+        printf( "FAILED %s: ", Check );
+        va_start( arguments, Format );
+        vprintf( Format, arguments );
+        va_end( arguments );
+        printf( "\n" );
+    }
+}
+
+__inline
+int
+BenchSummary (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Prints how many checks ran and failed.
+
+Return Value:
+
+    What main returns: 0, or 1 if a check failed.
+
+--*/
+{
+    printf( "%u checks, %u failed\n", BenchCommon.Checks, BenchCommon.Failures );
+
+    return (BenchCommon.Failures == 0) ? 0 : 1;
+}
+
+#endif //__MSPYBENCH_H__
@@ -0,0 +1,945 @@
+/*++
+
+Module Name:
+
+    mspyColStoreBench.c
+
+Abstract:
+
+    Compares the column store of the recent records, user/mspyColStore.c,
+    with asking SQLite the same questions of the same records, in a Linux
+    program built from the client's own modules against ushim.
+
+    Records are appended to a store of -n rows until the ring has wrapped
+    -w times.  Each record goes to one of -f files, drawn skewed, and the
+    working set moves on to new files every time the ring wraps, as it
+    does when a machine goes from one job to the next, so the store keeps
+    seeing names it has not seen before.  The records the store holds at
+    the end are also inserted into MinifilterLog, laid out by the client's
+    create.sql, files.sql and index.sql, the way the writer inserts them.
+
+    The breakdowns /q prints, operations by major function with the
+    kernel, completed and duration figures, and the top processes, files
+    and status codes, are then computed from the store and with SQL, over
+    every record held and over the last tenth of them, and must agree.
+    The store's name table must hold the names of the files its records
+    name and no others, and must not have turned a name away while the
+    working sets it held fit.
+
+    It prints the time an append took, the fastest of five runs of each
+    query against the store and of three against SQLite, and how the name
+    table fared.  It returns 1 when a check fails.
+
+    The database is written to a new directory in /tmp unless -o names
+    one, and removed at the end.  The schema is read from ../user unless
+    -s names the directory.
+
+    Built on its own with every client module but mspyUser.c, at -O3,
+    which vectorizes the store's operators behind a check that their
+    arrays do not overlap as the Visual Studio build's /O2 does, and gcc's
+    -O2 does not, for instance:
+
+        gcc -O3 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -I../user -o mspyColStoreBench mspyColStoreBench.c $(ls ../user/mspy*.c | grep -v mspyUser.c) -lsqlite3 -lm
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <windows.h>
+#include <sqlite3.h>
+#include "mspyLog.h"
+#include "mspyColStore.h"
+#include "mspyBench.h"
+
+#define BENCH_PATH_SIZE         512
+#define BENCH_TOP               10
+#define BENCH_PROCESSES         200
+#define BENCH_FIRST_TIME        133500000000000000LL
+
+typedef enum _BENCH_QUERY_KIND {
+
+    BenchQueryMajor,
+    BenchQueryProcess,
+    BenchQueryName,
+    BenchQueryStatus,
+    BenchQueries
+
+} BENCH_QUERY_KIND;
+
+static const char *const BenchQueryNames[BenchQueries] = {
+
+    "by major",
+    "top processes",
+    "top files",
+    "top status codes"
+};
+
+//
+//  The SQL for each breakdown.  Durations only count rows with a
+//  completion time, as the store's do; the writer stores a missing one
+//  as 0.
+//
+
+static const char *const BenchQuerySql[BenchQueries] = {
+
+    "SELECT MajorOp, COUNT(*), SUM(RequestorMode = 'Kernel'), SUM(PostOpTime != 0), "
+    "TOTAL(CASE WHEN PostOpTime != 0 THEN PostOpTime - PreOpTime END), "
+    "MAX(CASE WHEN PostOpTime != 0 THEN PostOpTime - PreOpTime ELSE 0 END) "
+    "FROM MinifilterLog WHERE PreOpTime >= ?1 GROUP BY MajorOp;",
+
+    "SELECT ProcessId, COUNT(*) FROM MinifilterLog WHERE PreOpTime >= ?1 "
+    "GROUP BY ProcessId ORDER BY 2 DESC LIMIT 10;",
+
+    "SELECT Files.Path, COUNT(*) FROM MinifilterLog JOIN Files ON Files.FileID = MinifilterLog.FileID "
+    "WHERE PreOpTime >= ?1 GROUP BY MinifilterLog.FileID ORDER BY 2 DESC LIMIT 10;",
+
+    "SELECT StatusCode & 0xFFFFFFFF, COUNT(*) FROM MinifilterLog WHERE PreOpTime >= ?1 "
+    "GROUP BY StatusCode ORDER BY 2 DESC LIMIT 10;"
+};
+
+static const UCHAR BenchMajors[] = {
+
+    IRP_MJ_CREATE,
+    IRP_MJ_READ,
+    IRP_MJ_QUERY_INFORMATION,
+    IRP_MJ_CLEANUP,
+    IRP_MJ_CLOSE,
+    IRP_MJ_WRITE,
+    IRP_MJ_DIRECTORY_CONTROL,
+    IRP_MJ_SET_INFORMATION,
+    IRP_MJ_FILE_SYSTEM_CONTROL,
+    IRP_MJ_QUERY_SECURITY,
+    IRP_MJ_LOCK_CONTROL,
+    IRP_MJ_FLUSH_BUFFERS
+};
+
+static const NTSTATUS BenchStatuses[] = {
+
+    (NTSTATUS)0x00000000,       // STATUS_SUCCESS
+    (NTSTATUS)0xC0000034,       // STATUS_OBJECT_NAME_NOT_FOUND
+    (NTSTATUS)0x80000006,       // STATUS_NO_MORE_FILES
+    (NTSTATUS)0xC0000022,       // STATUS_ACCESS_DENIED
+    (NTSTATUS)0x00000104,       // STATUS_REPARSE
+    (NTSTATUS)0xC0000043        // STATUS_SHARING_VIOLATION
+};
+
+typedef struct _BENCH_STATE {
+
+    ULONG Events;
+    ULONG Wraps;
+    ULONG FileCount;
+    const char *SqlDirectory;
+    char File[BENCH_PATH_SIZE];
+
+    COL_STORE Store;
+
+    //
+    //  When each file of every working set was last named, by the number
+    //  of the record that named it, plus one.
+    //
+
+    unsigned long long *LastNamed;
+    ULONG Names;
+
+    unsigned long long Appended;
+    long long AppendNanoseconds;
+    LONGLONG LastTime;
+
+    double StoreSeconds[2][BenchQueries];
+    double SqlSeconds[2][BenchQueries];
+    ULONG Mismatches;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static ULONG
+BenchSkewed (
+    ULONG Count
+    )
+{
+    unsigned long long uniform = BenchRandom32();
+
+    //
+    //  Squaring a uniform pick twice gives the first few most of the
+    //  picks and leaves a long tail picked now and then.
+    //
+
+    uniform = uniform * uniform >> 32;
+    uniform = uniform * uniform >> 32;
+
+    return (ULONG)(uniform * Count >> 32);
+}
+
+static void
+BenchPath (
+    ULONG Name,
+    char *Path,
+    size_t Size
+    )
+{
+    snprintf( Path, Size,
+              "\\Device\\HarddiskVolume3\\Users\\user%02u\\AppData\\Local\\Temp\\job%04u\\%08X.tmp",
+              Name % 7,
+              Name / Bench.FileCount,
+              Name * 2654435761U );
+}
+
+static void
+BenchRecord (
+    PLOG_RECORD Record,
+    PULONG Name
+    )
+/*++
+
+Routine Description:
+
+    Makes the next record, from the working set of the ring's current
+    lap.
+
+--*/
+{
+    PRECORD_DATA data = &Record->Data;
+    char path[BENCH_PATH_SIZE];
+    ULONG lap = (ULONG)(Bench.Appended / Bench.Events);
+    ULONG pick = BenchRandom32() % 100;
+    ULONG index;
+
+    ZeroMemory( data, sizeof( RECORD_DATA ) );
+
+    Record->RecordType = RECORD_TYPE_NORMAL;
+
+    Bench.LastTime += 1 + BenchRandom32() % 200;
+
+    data->OriginatingTime.QuadPart = Bench.LastTime;
+    data->CompletionTime.QuadPart = (pick < 6) ? 0 : Bench.LastTime + BenchRandom32() % 5000;
+    data->ProcessId = 4 * (1 + BenchSkewed( BENCH_PROCESSES ));
+    data->ThreadId = data->ProcessId * 16 + BenchRandom32() % 16;
+    data->Status = BenchStatuses[(pick < 80) ? 0 : 1 + pick % (ARRAYSIZE( BenchStatuses ) - 1)];
+    data->CallbackMajorId = BenchMajors[BenchSkewed( ARRAYSIZE( BenchMajors ) )];
+    data->RequestorMode = (BenchRandom32() % 4 == 0);
+    data->Flags = FLT_CALLBACK_DATA_IRP_OPERATION;
+
+    *Name = lap * Bench.FileCount + BenchSkewed( Bench.FileCount );
+    BenchPath( *Name, path, sizeof( path ) );
+
+    for (index = 0; path[index] != '\0'; index++) {
+
+        Record->Name[index] = (WCHAR)path[index];
+    }
+
+    Record->Name[index] = UNICODE_NULL;
+}
+
+static char *
+BenchReadFile (
+    const char *Name
+    )
+{
+    char path[BENCH_PATH_SIZE];
+    char *text;
+    FILE *file;
+    long size;
+
+    snprintf( path, sizeof( path ), "%s/%s", Bench.SqlDirectory, Name );
+    file = fopen( path, "rb" );
+
+    if (file == NULL) {
+
+        fprintf( stderr, "Could not open %s\n", path );
+        return NULL;
+    }
+
+    fseek( file, 0, SEEK_END );
+    size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    text = malloc( size + 1 );
+
+    if (text == NULL || fread( text, 1, size, file ) != (size_t)size) {
+
+        fprintf( stderr, "Could not read %s\n", path );
+        fclose( file );
+        free( text );
+        return NULL;
+    }
+
+    fclose( file );
+    text[size] = '\0';
+
+    return text;
+}
+
+static int
+BenchExecFile (
+    sqlite3 *Db,
+    const char *Name
+    )
+/*++
+
+Routine Description:
+
+    Runs one of the client's .sql files, as ExecEmbeddedSQL runs it from
+    the resources.
+
+--*/
+{
+    char *text = BenchReadFile( Name );
+    char *message = NULL;
+    int rc;
+
+    if (text == NULL) {
+
+        return -1;
+    }
+
+    rc = sqlite3_exec( Db, text, NULL, NULL, &message );
+
+    if (rc != SQLITE_OK) {
+
+        fprintf( stderr, "%s: %s\n", Name, message ? message : sqlite3_errstr( rc ) );
+    }
+
+    sqlite3_free( message );
+    free( text );
+
+    return (rc == SQLITE_OK) ? 0 : -1;
+}
+
+static void
+BenchRemove (
+    const char *Path
+    )
+{
+    char path[BENCH_PATH_SIZE + 8];
+
+    unlink( Path );
+    snprintf( path, sizeof( path ), "%s-wal", Path );
+    unlink( path );
+    snprintf( path, sizeof( path ), "%s-shm", Path );
+    unlink( path );
+}
+
+static int
+BenchInsert (
+    sqlite3 *Db,
+    sqlite3_stmt *Insert,
+    sqlite3_stmt *File,
+    PLOG_RECORD Record,
+    ULONG Name
+    )
+/*++
+
+Routine Description:
+
+    Inserts a record with the columns the breakdowns and the writer's
+    indexes use, and its file in Files.
+
+--*/
+{
+    PRECORD_DATA data = &Record->Data;
+    const CHAR *major;
+    const CHAR *minor;
+    char path[BENCH_PATH_SIZE];
+    char status[256];
+
+    BenchPath( Name, path, sizeof( path ) );
+
+    sqlite3_bind_int64( File, 1, (sqlite3_int64)Name + 1 );
+    sqlite3_bind_text( File, 2, path, -1, SQLITE_TRANSIENT );
+
+    if (sqlite3_step( File ) != SQLITE_DONE) {
+
+        fprintf( stderr, "Files insert failed: %s\n", sqlite3_errmsg( Db ) );
+        return -1;
+    }
+
+    sqlite3_reset( File );
+
+    PrintIrpCode( data->CallbackMajorId, data->CallbackMinorId, &major, &minor );
+    NtStatusToString( data->Status, status, sizeof( status ) );
+
+    sqlite3_bind_int64( Insert, 1, (sqlite3_int64)Record->SequenceNumber );
+    sqlite3_bind_text( Insert, 2, "IRP", -1, SQLITE_STATIC );
+    sqlite3_bind_int64( Insert, 3, data->OriginatingTime.QuadPart );
+    sqlite3_bind_int64( Insert, 4, data->CompletionTime.QuadPart );
+    sqlite3_bind_int64( Insert, 5, (sqlite3_int64)data->ProcessId );
+    sqlite3_bind_text( Insert, 6, "C:\\Windows\\System32\\svchost.exe", -1, SQLITE_STATIC );
+    sqlite3_bind_int64( Insert, 7, (sqlite3_int64)data->ThreadId );
+    sqlite3_bind_text( Insert, 8, major, -1, SQLITE_TRANSIENT );
+    sqlite3_bind_text( Insert, 9, minor, -1, SQLITE_TRANSIENT );
+    sqlite3_bind_text( Insert, 10, status, -1, SQLITE_TRANSIENT );
+    sqlite3_bind_text( Insert, 11, data->RequestorMode ? "Kernel" : "User", -1, SQLITE_STATIC );
+    sqlite3_bind_int64( Insert, 12, (sqlite3_int64)(LONG)data->Status );
+    sqlite3_bind_int64( Insert, 13, (sqlite3_int64)Name + 1 );
+
+    if (sqlite3_step( Insert ) != SQLITE_DONE) {
+
+        fprintf( stderr, "Insert failed: %s\n", sqlite3_errmsg( Db ) );
+        return -1;
+    }
+
+    sqlite3_reset( Insert );
+
+    return 0;
+}
+
+static int
+BenchFill (
+    sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Appends Events * Wraps records to the store, timing each append, and
+    inserts the last Events of them, the ones the store keeps, into the
+    database.
+
+--*/
+{
+    ULONG size = sizeof( LOG_RECORD ) + BENCH_PATH_SIZE * sizeof( WCHAR );
+    unsigned long long total = (unsigned long long)Bench.Events * Bench.Wraps;
+    sqlite3_stmt *insert = NULL;
+    sqlite3_stmt *file = NULL;
+    PLOG_RECORD record;
+    long long start;
+    ULONG name;
+    int rc = 0;
+
+    record = calloc( 1, size );
+
+    if (record == NULL ||
+        sqlite3_prepare_v2( Db,
+                            "INSERT INTO MinifilterLog (SeqNum, OprType, PreOpTime, PostOpTime, ProcessId, ProcessFilePath, ThreadId, MajorOp, MinorOp, OpStatus, RequestorMode, StatusCode, FileID) "
+                            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);",
+                            -1,
+                            &insert,
+                            NULL ) != SQLITE_OK ||
+        sqlite3_prepare_v2( Db, "INSERT OR IGNORE INTO Files (FileID, Path) VALUES (?, ?);", -1, &file, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not prepare the inserts: %s\n", sqlite3_errmsg( Db ) );
+        rc = -1;
+        goto Exit;
+    }
+
+    Bench.LastTime = BENCH_FIRST_TIME;
+
+    sqlite3_exec( Db, "BEGIN;", NULL, NULL, NULL );
+
+    for (Bench.Appended = 0; Bench.Appended < total && rc == 0; ) {
+
+        record->SequenceNumber = (ULONG)Bench.Appended;
+        BenchRecord( record, &name );
+
+        start = BenchNow();
+        ColStoreAppend( &Bench.Store, record );
+        Bench.AppendNanoseconds += BenchNow() - start;
+
+        Bench.Appended++;
+        Bench.LastNamed[name] = Bench.Appended;
+
+        if (Bench.Appended > total - Bench.Events) {
+
+            rc = BenchInsert( Db, insert, file, record, name );
+        }
+    }
+
+    sqlite3_exec( Db, "COMMIT;", NULL, NULL, NULL );
+
+Exit:
+
+    sqlite3_finalize( insert );
+    sqlite3_finalize( file );
+    free( record );
+
+    return rc;
+}
+
+static double
+BenchStoreQuery (
+    BENCH_QUERY_KIND Kind,
+    LONGLONG Since,
+    PCOL_MAJOR_SUMMARY Summary,
+    PCOL_GROUP Groups,
+    PULONG GroupCount
+    )
+/*++
+
+Routine Description:
+
+    Runs one breakdown against the store five times.
+
+Return Value:
+
+    The fastest run in seconds.
+
+--*/
+{
+    static const COL_GROUP_KEY keys[BenchQueries] = { 0, ColGroupByProcess, ColGroupByName, ColGroupByStatus };
+    double best = 0;
+    double seconds;
+    long long start;
+    int run;
+
+    for (run = 0; run < 5; run++) {
+
+        start = BenchNow();
+
+        if (Kind == BenchQueryMajor) {
+
+            ColStoreGroupByMajor( &Bench.Store, Since, Summary );
+
+        } else {
+
+            *GroupCount = ColStoreTopGroups( &Bench.Store, keys[Kind], Since, Groups, BENCH_TOP );
+        }
+
+        seconds = (BenchNow() - start) / 1e9;
+
+        if (run == 0 || seconds < best) {
+
+            best = seconds;
+        }
+    }
+
+    return best;
+}
+
+static void
+BenchMismatch (
+    BENCH_QUERY_KIND Kind,
+    LONGLONG Since,
+    const char *What
+    )
+{
+    printf( "    %s%s: %s\n", BenchQueryNames[Kind], Since ? " in the last tenth" : "", What );
+    Bench.Mismatches++;
+}
+
+static BOOLEAN
+BenchSameName (
+    ULONG NameId,
+    const char *Path
+    )
+/*++
+
+Routine Description:
+
+    Compares a name from the store with one from Files.  The store keeps
+    the name as the record had it, the database as UTF-8; the generated
+    names are ASCII.
+
+--*/
+{
+    WCHAR name[BENCH_PATH_SIZE];
+    ULONG index;
+
+    ColStoreName( &Bench.Store, NameId, name, ARRAYSIZE( name ) );
+
+    for (index = 0; name[index] != UNICODE_NULL; index++) {
+
+        if (name[index] != (WCHAR)(UCHAR)Path[index]) {
+
+            return FALSE;
+        }
+    }
+
+    return (Path[index] == '\0');
+}
+
+static int
+BenchCompare (
+    sqlite3 *Db,
+    BENCH_QUERY_KIND Kind,
+    LONGLONG Since,
+    int Window
+    )
+/*++
+
+Routine Description:
+
+    Times a breakdown against the store and with SQL, and checks that
+    both give the same answer.  Top groups are compared by their counts,
+    and for files by their names too, as groups with the same count may
+    come in either order.
+
+--*/
+{
+    COL_MAJOR_SUMMARY summary[256];
+    COL_GROUP groups[BENCH_TOP];
+    ULONG groupCount = 0;
+    sqlite3_stmt *stmt = NULL;
+    const CHAR *major;
+    const CHAR *minor;
+    ULONGLONG rowCount = 0;
+    ULONG majorCount = 0;
+    double best = 0;
+    double seconds;
+    long long start;
+    ULONG index;
+    ULONG row;
+    ULONG id;
+    int run;
+
+    Bench.StoreSeconds[Window][Kind] = BenchStoreQuery( Kind, Since, summary, groups, &groupCount );
+
+    if (sqlite3_prepare_v2( Db, BenchQuerySql[Kind], -1, &stmt, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not prepare %s: %s\n", BenchQuerySql[Kind], sqlite3_errmsg( Db ) );
+        return -1;
+    }
+
+    sqlite3_bind_int64( stmt, 1, Since );
+
+    for (run = 0; run < 3; run++) {
+
+        start = BenchNow();
+
+        for (row = 0; sqlite3_step( stmt ) == SQLITE_ROW; row++) {
+
+            if (run != 0) {
+
+                continue;
+            }
+
+            if (Kind == BenchQueryMajor) {
+
+                for (id = 0; id < 256; id++) {
+
+                    PrintIrpCode( (UCHAR)id, 0, &major, &minor );
+
+                    if (summary[id].Count != 0 && strcmp( major, (const char *)sqlite3_column_text( stmt, 0 ) ) == 0) {
+
+                        break;
+                    }
+                }
+
+                if (id == 256 ||
+                    summary[id].Count != (ULONGLONG)sqlite3_column_int64( stmt, 1 ) ||
+                    summary[id].KernelCount != (ULONGLONG)sqlite3_column_int64( stmt, 2 ) ||
+                    summary[id].Completed != (ULONGLONG)sqlite3_column_int64( stmt, 3 ) ||
+                    summary[id].DurationSum != sqlite3_column_int64( stmt, 4 ) ||
+                    summary[id].DurationMax != sqlite3_column_int64( stmt, 5 )) {
+
+                    BenchMismatch( Kind, Since, (const char *)sqlite3_column_text( stmt, 0 ) );
+                }
+
+                rowCount += sqlite3_column_int64( stmt, 1 );
+                majorCount++;
+
+            } else if (row >= groupCount || groups[row].Count != (ULONGLONG)sqlite3_column_int64( stmt, 1 )) {
+
+                BenchMismatch( Kind, Since, "the counts differ" );
+
+            } else if (Kind == BenchQueryName) {
+
+                for (index = 0; index < groupCount; index++) {
+
+                    if (groups[index].Count == groups[row].Count &&
+                        BenchSameName( groups[index].Key, (const char *)sqlite3_column_text( stmt, 0 ) )) {
+
+                        break;
+                    }
+                }
+
+                if (index == groupCount) {
+
+                    BenchMismatch( Kind, Since, (const char *)sqlite3_column_text( stmt, 0 ) );
+                }
+            }
+        }
+
+        seconds = (BenchNow() - start) / 1e9;
+        sqlite3_reset( stmt );
+
+        if (run == 0 && Kind != BenchQueryMajor && row != groupCount) {
+
+            BenchMismatch( Kind, Since, "the number of groups differs" );
+        }
+
+        if (run == 0 || seconds < best) {
+
+            best = seconds;
+        }
+    }
+
+    sqlite3_finalize( stmt );
+    Bench.SqlSeconds[Window][Kind] = best;
+
+    if (Kind == BenchQueryMajor) {
+
+        for (id = 0; id < 256; id++) {
+
+            majorCount -= (summary[id].Count != 0);
+        }
+
+        if (majorCount != 0) {
+
+            BenchMismatch( Kind, Since, "the number of groups differs" );
+        }
+
+        if (Since == 0 && rowCount != Bench.Events) {
+
+            BenchMismatch( Kind, Since, "not every record held was counted" );
+        }
+    }
+
+    return 0;
+}
+
+static BOOLEAN
+BenchCheckNames (
+    void
+    )
+/*++
+
+Routine Description:
+
+    Checks the name table against the records the store holds: the
+    names in use are the names those records have, each counted once per
+    record.  No record may have been turned away from the table if two
+    laps' working sets fit in it, as at most those are held at once.
+
+--*/
+{
+    PCOL_NAME_TABLE table = &Bench.Store.Names;
+    unsigned long long first = Bench.Appended - Bench.Events;
+    ULONG *references;
+    ULONG live = 0;
+    ULONG inUse = 0;
+    ULONG overflowed = 0;
+    ULONG wrong = 0;
+    ULONG name;
+    ULONG row;
+    ULONG id;
+
+    for (name = 0; name < Bench.Names; name++) {
+
+        live += (Bench.LastNamed[name] > first);
+    }
+
+    references = calloc( table->MaxNames, sizeof( ULONG ) );
+
+    if (references == NULL) {
+
+        return FALSE;
+    }
+
+    for (row = 0; row < Bench.Events; row++) {
+
+        references[Bench.Store.NameId[row]]++;
+        overflowed += (Bench.Store.NameId[row] == COL_STORE_NAME_OVERFLOW);
+    }
+
+    for (id = 1; id < table->Count; id++) {
+
+        inUse += (table->Names[id] != NULL);
+        wrong += (table->Names[id] != NULL && table->References[id] != references[id]);
+        wrong += (table->Names[id] == NULL && references[id] != 0);
+    }
+
+    free( references );
+
+    printf( "    %u names in the records held, %u in the table of %u, %llu freed, %u records named %S\n",
+            live,
+            inUse,
+            table->MaxNames - 1,
+            (unsigned long long)table->Evicted,
+            overflowed,
+            table->Names[COL_STORE_NAME_OVERFLOW] );
+
+    if (inUse != min( live, table->MaxNames - 1 ) ||
+        (2 * Bench.FileCount < table->MaxNames && overflowed != 0) ||
+        wrong != 0) {
+
+        printf( "    the name table does not match the records, %u reference counts wrong\n", wrong );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+BenchUsage (
+    void
+    )
+{
+    printf( "Usage: mspyColStoreBench [-n <records>] [-w <wraps>] [-f <files>] [-s <sql directory>] [-o <directory>]\n"
+            "\n"
+            "    [-n <records>] records the store holds, %u by default\n"
+            "    [-w <wraps>] times the ring wraps, 4 by default\n"
+            "    [-f <files>] files in the working set of each lap, 20000 by default\n"
+            "    [-s <sql directory>] where create.sql and the others are, ../user by default\n"
+            "    [-o <directory>] where the database is written, a new directory in /tmp by default\n",
+            COL_STORE_DEFAULT_EVENTS );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    char directory[BENCH_PATH_SIZE] = "/tmp/mspyColStoreBench.XXXXXX";
+    const char *output = NULL;
+    sqlite3 *db = NULL;
+    LONGLONG since;
+    BOOLEAN namesOk;
+    ULONG kind;
+    int window;
+    int option;
+    int rc = 0;
+
+    Bench.Events = COL_STORE_DEFAULT_EVENTS;
+    Bench.Wraps = 4;
+    Bench.FileCount = 20000;
+    Bench.SqlDirectory = "../user";
+
+    while ((option = getopt( argc, argv, "n:w:f:s:o:" )) != -1) {
+
+        switch (option) {
+
+            case 'n':
+                Bench.Events = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'w':
+                Bench.Wraps = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'f':
+                Bench.FileCount = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 's':
+                Bench.SqlDirectory = optarg;
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || Bench.Wraps == 0 || Bench.FileCount == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    if (output == NULL) {
+
+        if (mkdtemp( directory ) == NULL) {
+
+            perror( "mkdtemp" );
+            return 2;
+        }
+
+        output = directory;
+    }
+
+    //
+    //  The store rounds its size up to a power of two.
+    //
+
+    if (!ColStoreInitialize( &Bench.Store, Bench.Events )) {
+
+        fprintf( stderr, "Could not allocate a store of %u records\n", Bench.Events );
+        return 2;
+    }
+
+    Bench.Events = Bench.Store.Capacity;
+    Bench.Names = (Bench.Wraps + 1) * Bench.FileCount;
+    Bench.LastNamed = calloc( Bench.Names, sizeof( unsigned long long ) );
+    snprintf( Bench.File, sizeof( Bench.File ), "%s/mspyColStoreBench.db", output );
+    BenchRemove( Bench.File );
+
+    if (Bench.LastNamed == NULL || sqlite3_open( Bench.File, &db ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not open %s\n", Bench.File );
+        rc = 2;
+        goto Exit;
+    }
+
+    sqlite3_exec( db, "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;", NULL, NULL, NULL );
+
+    if (BenchExecFile( db, "create.sql" ) != 0 ||
+        BenchExecFile( db, "files.sql" ) != 0 ||
+        BenchExecFile( db, "index.sql" ) != 0 ||
+        BenchFill( db ) != 0) {
+
+        rc = 2;
+        goto Exit;
+    }
+
+    sqlite3_exec( db, "ANALYZE; PRAGMA wal_checkpoint(TRUNCATE);", NULL, NULL, NULL );
+
+    printf( "Appended %llu records to a store of %u, %u files a lap\n",
+            Bench.Appended,
+            Bench.Events,
+            Bench.FileCount );
+    printf( "    %.0f ns an append\n", (double)Bench.AppendNanoseconds / Bench.Appended );
+
+    namesOk = BenchCheckNames();
+
+    for (window = 0; window < 2; window++) {
+
+        since = window ? Bench.LastTime - (Bench.LastTime - BENCH_FIRST_TIME) / Bench.Wraps / 10 : 0;
+
+        for (kind = 0; kind < BenchQueries; kind++) {
+
+            if (BenchCompare( db, kind, since, window ) != 0) {
+
+                rc = 2;
+                goto Exit;
+            }
+        }
+    }
+
+    printf( "\n    %-18s %14s %14s %14s %14s\n", "", "store ms", "SQLite ms", "last 10% ms", "SQLite ms" );
+
+    for (kind = 0; kind < BenchQueries; kind++) {
+
+        printf( "    %-18s %14.3f %14.3f %14.3f %14.3f\n",
+                BenchQueryNames[kind],
+                Bench.StoreSeconds[0][kind] * 1000,
+                Bench.SqlSeconds[0][kind] * 1000,
+                Bench.StoreSeconds[1][kind] * 1000,
+                Bench.SqlSeconds[1][kind] * 1000 );
+    }
+
+    if (Bench.Mismatches != 0 || !namesOk) {
+
+        printf( "    %u breakdowns differ\n", Bench.Mismatches );
+        rc = 1;
+    }
+
+Exit:
+
+    sqlite3_close( db );
+    BenchRemove( Bench.File );
+
+    if (output == directory) {
+
+        rmdir( directory );
+    }
+
+    ColStoreCleanup( &Bench.Store );
+    free( Bench.LastNamed );
+
+    return rc;
+}
@@ -0,0 +1,1908 @@
+/*++
+
+Module Name:
+
+    mspyExport.c
+
+Abstract:
+
+    Exports MinifilterLog to a Parquet file, for pandas, Spark, DuckDB
+    and the like to scan in parallel instead of paging through SQLite.
+
+    Every column of MinifilterLog is exported under its own name, all of
+    them nullable, typed:
+
+        PreOpTime, PostOpTime       timestamps, microseconds UTC.  The log
+                                    keeps 100ns ticks, the last digit is
+                                    lost, order rows by SeqNum or LogID.
+                                    0 (never completed) is exported as
+                                    null.
+
+        DeviceObj, FileObj,         unsigned 64 bit integers, logged as
+        FileTransaction,            hexadecimal text.
+        Information
+
+        the text columns            UTF-8 strings, dictionary encoded per
+                                    row group, so repeated paths, process
+                                    paths and operation names are stored
+                                    once.  A dictionary that grows past
+                                    EXPORT_MAX_DICTIONARY bytes stops and
+                                    the rest of the row group is stored
+                                    plain.
+
+        the others                  64 or 32 bit integers.
+
+    OpFileName is the name of the file, looked up in the Files table of
+    the input for rows that refer to it by FileID.  FileID itself is not
+    exported, it only means something within one database.
+
+    Integer and timestamp columns carry their minimum and maximum in every
+    row group, so readers can skip row groups on time and process filters.
+    Columns an older log does not have are exported as nulls.
+
+    Rows can be limited to a PreOpTime range and a process.  They are
+    exported in LogID order, in row groups of about the requested number
+    of rows: the selected LogID range is cut into one span per row group,
+    and worker threads read and encode spans concurrently, each on its own
+    connection, while the main thread writes the finished row groups in
+    order.  Several inputs, for instance the main database and its
+    partition files, are exported one after the other into one file.
+
+    Pages are stored uncompressed, or compressed with GZIP.
+
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -o mspyExport mspyExport.c -lsqlite3 -lz
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <zlib.h>
+
+#define EXPORT_DEFAULT_ROWS         1000000     // a row group
+#define EXPORT_PAGE_ROWS            20000       // a data page
+#define EXPORT_MAX_WORKERS          64
+#define EXPORT_MAX_INPUTS           1024
+#define EXPORT_MAX_DICTIONARY       (8 * 1024 * 1024)
+#define EXPORT_EPOCH_DIFF           116444736000000000LL
+
+//
+//  Parquet's thrift enumerations, parquet.thrift.
+//
+
+#define PARQUET_INT32               1
+#define PARQUET_INT64               2
+#define PARQUET_BYTE_ARRAY          6
+
+#define PARQUET_OPTIONAL            1
+
+#define PARQUET_UTF8                0
+#define PARQUET_TIMESTAMP_MICROS    10
+#define PARQUET_UINT_64             14
+
+#define PARQUET_PLAIN               0
+#define PARQUET_RLE                 3
+#define PARQUET_RLE_DICTIONARY      8
+
+#define PARQUET_UNCOMPRESSED        0
+#define PARQUET_GZIP                2
+
+#define PARQUET_DATA_PAGE           0
+#define PARQUET_DICTIONARY_PAGE     2
+
+//
+//  Thrift compact protocol types.
+//
+
+#define THRIFT_TRUE                 1
+#define THRIFT_FALSE                2
+#define THRIFT_BYTE                 3
+#define THRIFT_I16                  4
+#define THRIFT_I32                  5
+#define THRIFT_I64                  6
+#define THRIFT_BINARY               8
+#define THRIFT_LIST                 9
+#define THRIFT_STRUCT               12
+
+#define THRIFT_MAX_DEPTH            16
+
+typedef enum _EXPORT_KIND {
+
+    ExportInt64,
+    ExportInt32,
+    ExportTime,             // 100ns ticks since 1601
+    ExportPointer,          // hexadecimal text
+    ExportString
+
+} EXPORT_KIND;
+
+static const struct {
+
+    const char *Name;
+    EXPORT_KIND Kind;
+
+} ExportColumns[] = {
+
+    { "LogID",              ExportInt64 },
+    { "SeqNum",             ExportInt64 },
+    { "OprType",            ExportString },
+    { "PreOpTime",          ExportTime },
+    { "PostOpTime",         ExportTime },
+    { "ProcessId",          ExportInt64 },
+    { "ProcessFilePath",    ExportString },
+    { "ThreadId",           ExportInt64 },
+    { "MajorOp",            ExportString },
+    { "MinorOp",            ExportString },
+    { "IrpFlags",           ExportString },
+    { "DeviceObj",          ExportPointer },
+    { "FileObj",            ExportPointer },
+    { "FileTransaction",    ExportPointer },
+    { "OpStatus",           ExportString },
+    { "Information",        ExportPointer },
+    { "Arg1",               ExportInt64 },
+    { "Arg2",               ExportInt64 },
+    { "Arg3",               ExportInt64 },
+    { "Arg4",               ExportInt64 },
+    { "Arg5",               ExportInt64 },
+    { "Arg6",               ExportInt64 },
+    { "OpFileName",         ExportString },
+    { "RequestorMode",      ExportString },
+    { "RuleID",             ExportInt32 },
+    { "RuleAction",         ExportInt32 },
+    { "StatusCode",         ExportInt32 },
+    { "ByteOffset",         ExportInt64 },
+    { "ByteLength",         ExportInt64 },
+    { "InfoClass",          ExportInt32 },
+    { "ControlCode",        ExportInt64 },
+};
+
+#define EXPORT_COLUMNS      (sizeof( ExportColumns ) / sizeof( ExportColumns[0] ))
+#define EXPORT_FILE_NAME    22          // OpFileName
+
+static const char ExportFileNameSql[] =
+    "COALESCE((SELECT Path FROM Files WHERE Files.FileID = MinifilterLog.FileID), OpFileName)";
+
+typedef struct _EXPORT_BUFFER {
+
+    unsigned char *Data;
+    size_t Length;
+    size_t Size;
+
+} EXPORT_BUFFER;
+
+typedef struct _THRIFT {
+
+    EXPORT_BUFFER *Out;
+    int Depth;
+    short Last[THRIFT_MAX_DEPTH];
+
+} THRIFT;
+
+//
+//  A column of the row group a worker is encoding.
+//
+
+typedef struct _EXPORT_COLUMN {
+
+    //
+    //  The page being filled
+    //
+
+    unsigned PageRows;
+    unsigned PageValues;
+    uint32_t *Levels;               // 1 for a value, 0 for null
+    int64_t *Values;                // integer columns
+    uint32_t *Indices;              // string columns, into the dictionary
+    EXPORT_BUFFER Plain;            // string columns once the dictionary stopped
+
+    //
+    //  The dictionary, its entries PLAIN encoded as the dictionary page
+    //  holds them.
+    //
+
+    EXPORT_BUFFER Dictionary;
+    uint32_t *Offsets;              // of each entry in Dictionary
+    uint32_t *Hashes;
+    uint32_t Entries;
+    uint32_t EntrySize;
+    uint32_t *Slots;                // entry + 1, 0 for empty
+    uint32_t SlotCount;
+    int Stopped;
+
+    //
+    //  The column chunk
+    //
+
+    EXPORT_BUFFER Pages;
+    long long Rows;
+    long long Nulls;
+    int64_t Min;
+    int64_t Max;
+    int UsedPlain;
+
+} EXPORT_COLUMN;
+
+//
+//  A column chunk as the footer describes it, offsets from the start of
+//  its row group until the row group is written.
+//
+
+typedef struct _EXPORT_CHUNK_META {
+
+    long long Offset;
+    long long DataOffset;
+    long long DictionaryOffset;     // -1 without a dictionary
+    long long Uncompressed;
+    long long Compressed;
+    long long Rows;
+    long long Nulls;
+    int64_t Min;
+    int64_t Max;
+    int Dictionary;
+    int Plain;
+
+} EXPORT_CHUNK_META;
+
+typedef struct _EXPORT_ROW_GROUP {
+
+    EXPORT_BUFFER Data;
+    long long Rows;
+    long long Offset;
+    EXPORT_CHUNK_META Columns[EXPORT_COLUMNS];
+
+} EXPORT_ROW_GROUP;
+
+//
+//  A span of LogIDs of one input, exported as one row group.
+//
+
+typedef struct _EXPORT_SPAN {
+
+    unsigned Input;
+    long long First;
+    long long Last;
+
+} EXPORT_SPAN;
+
+typedef struct _EXPORT_WORKER {
+
+    pthread_t Thread;
+
+    sqlite3 *Db;
+    sqlite3_stmt *Rows;
+    unsigned Input;
+
+    EXPORT_COLUMN Columns[EXPORT_COLUMNS];
+
+    unsigned long long BytesRead;
+    unsigned long long Stopped;
+
+} EXPORT_WORKER;
+
+typedef struct _EXPORT_STATE {
+
+    //
+    //  Options
+    //
+
+    const char *Inputs[EXPORT_MAX_INPUTS];
+    unsigned InputCount;
+    long long From;
+    long long To;
+    long long ProcessId;
+    long long GroupRows;
+    unsigned WorkerCount;
+    int Gzip;
+
+    //
+    //  Present columns of every input
+    //
+
+    char Present[EXPORT_MAX_INPUTS][EXPORT_COLUMNS];
+
+    //
+    //  Inputs whose rows refer to their file by FileID
+    //
+
+    char HasFiles[EXPORT_MAX_INPUTS];
+
+    EXPORT_SPAN *Spans;
+    unsigned SpanCount;
+
+    //
+    //  Spans are handed out in order and their row groups written in
+    //  order.  Workers stay within a window of the next one to write.
+    //
+
+    pthread_mutex_t Lock;
+    pthread_cond_t Changed;
+    unsigned NextSpan;
+    unsigned NextWrite;
+    EXPORT_ROW_GROUP **Done;
+    int Failed;
+
+    EXPORT_WORKER Workers[EXPORT_MAX_WORKERS];
+
+} EXPORT_STATE;
+
+static EXPORT_STATE Export;
+
+static void *
+ExportAlloc (
+    void *Block,
+    size_t Size
+    )
+{
+    void *block = realloc( Block, Size );
+
+    if (block == NULL && Size != 0) {
+
+        fprintf( stderr, "Out of memory\n" );
+        exit( 1 );
+    }
+
+    return block;
+}
+
+static long long
+ExportNow (
+    void
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint32_t
+ExportHash (
+    const unsigned char *Data,
+    size_t Length
+    )
+{
+    uint32_t hash = 2166136261u;
+
+    while (Length-- > 0) {
+
+        hash = (hash ^ *Data++) * 16777619u;
+    }
+
+    return hash;
+}
+
+//---------------------------------------------------------------------------
+//                      Buffers and thrift
+//---------------------------------------------------------------------------
+
+static void
+BufferReserve (
+    EXPORT_BUFFER *Buffer,
+    size_t Length
+    )
+{
+    if (Buffer->Length + Length > Buffer->Size) {
+
+        Buffer->Size = (Buffer->Size * 2 > Buffer->Length + Length) ? Buffer->Size * 2 : Buffer->Length + Length + 4096;
+        Buffer->Data = ExportAlloc( Buffer->Data, Buffer->Size );
+    }
+}
+
+static void
+BufferAppend (
+    EXPORT_BUFFER *Buffer,
+    const void *Data,
+    size_t Length
+    )
+{
+    BufferReserve( Buffer, Length );
+    memcpy( Buffer->Data + Buffer->Length, Data, Length );
+    Buffer->Length += Length;
+}
+
+static void
+BufferByte (
+    EXPORT_BUFFER *Buffer,
+    unsigned char Byte
+    )
+{
+    BufferReserve( Buffer, 1 );
+    Buffer->Data[Buffer->Length++] = Byte;
+}
+
+static void
+BufferLittle (
+    EXPORT_BUFFER *Buffer,
+    uint64_t Value,
+    int Bytes
+    )
+{
+    while (Bytes-- > 0) {
+
+        BufferByte( Buffer, (unsigned char)Value );
+        Value >>= 8;
+    }
+}
+
+static void
+BufferVarint (
+    EXPORT_BUFFER *Buffer,
+    uint64_t Value
+    )
+{
+    while (Value >= 0x80) {
+
+        BufferByte( Buffer, (unsigned char)(Value | 0x80) );
+        Value >>= 7;
+    }
+
+    BufferByte( Buffer, (unsigned char)Value );
+}
+
+static void
+BufferFree (
+    EXPORT_BUFFER *Buffer
+    )
+{
+    free( Buffer->Data );
+    memset( Buffer, 0, sizeof( EXPORT_BUFFER ) );
+}
+
+static void
+ThriftField (
+    THRIFT *Thrift,
+    short Id,
+    int Type
+    )
+{
+    int delta = Id - Thrift->Last[Thrift->Depth];
+
+    if (delta > 0 && delta <= 15) {
+
+        BufferByte( Thrift->Out, (unsigned char)((delta << 4) | Type) );
+
+    } else {
+
+        BufferByte( Thrift->Out, (unsigned char)Type );
+        BufferVarint( Thrift->Out, (uint64_t)(((int64_t)Id << 1) ^ ((int64_t)Id >> 63)) );
+    }
+
+    Thrift->Last[Thrift->Depth] = Id;
+}
+
+static void
+ThriftZigzag (
+    THRIFT *Thrift,
+    int64_t Value
+    )
+{
+    BufferVarint( Thrift->Out, ((uint64_t)Value << 1) ^ (uint64_t)(Value >> 63) );
+}
+
+static void
+ThriftI32 (
+    THRIFT *Thrift,
+    short Id,
+    int32_t Value
+    )
+{
+    ThriftField( Thrift, Id, THRIFT_I32 );
+    ThriftZigzag( Thrift, Value );
+}
+
+static void
+ThriftI64 (
+    THRIFT *Thrift,
+    short Id,
+    int64_t Value
+    )
+{
+    ThriftField( Thrift, Id, THRIFT_I64 );
+    ThriftZigzag( Thrift, Value );
+}
+
+static void
+ThriftBinary (
+    THRIFT *Thrift,
+    short Id,
+    const void *Data,
+    size_t Length
+    )
+{
+    ThriftField( Thrift, Id, THRIFT_BINARY );
+    BufferVarint( Thrift->Out, Length );
+    BufferAppend( Thrift->Out, Data, Length );
+}
+
+static void
+ThriftBool (
+    THRIFT *Thrift,
+    short Id,
+    int Value
+    )
+{
+    ThriftField( Thrift, Id, Value ? THRIFT_TRUE : THRIFT_FALSE );
+}
+
+static void
+ThriftList (
+    THRIFT *Thrift,
+    short Id,
+    int Type,
+    size_t Count
+    )
+{
+    ThriftField( Thrift, Id, THRIFT_LIST );
+
+    if (Count < 15) {
+
+        BufferByte( Thrift->Out, (unsigned char)((Count << 4) | Type) );
+
+    } else {
+
+        BufferByte( Thrift->Out, (unsigned char)(0xF0 | Type) );
+        BufferVarint( Thrift->Out, Count );
+    }
+}
+
+//
+//  A struct is begun as a field, or as an element of a list with Id 0,
+//  and ended with ThriftEnd.
+//
+
+static void
+ThriftBegin (
+    THRIFT *Thrift,
+    short Id
+    )
+{
+    if (Id != 0) {
+
+        ThriftField( Thrift, Id, THRIFT_STRUCT );
+    }
+
+    Thrift->Last[++Thrift->Depth] = 0;
+}
+
+static void
+ThriftEnd (
+    THRIFT *Thrift
+    )
+{
+    BufferByte( Thrift->Out, 0 );
+    Thrift->Depth--;
+}
+
+//---------------------------------------------------------------------------
+//                      Encoding
+//---------------------------------------------------------------------------
+
+static void
+ExportBitPack (
+    EXPORT_BUFFER *Out,
+    const uint32_t *Values,
+    size_t Count,
+    size_t Padded,
+    int BitWidth
+    )
+{
+    uint64_t bits = 0;
+    int held = 0;
+    size_t i;
+
+    for (i = 0; i < Padded; i++) {
+
+        bits |= (uint64_t)((i < Count) ? Values[i] : 0) << held;
+        held += BitWidth;
+
+        while (held >= 8) {
+
+            BufferByte( Out, (unsigned char)bits );
+            bits >>= 8;
+            held -= 8;
+        }
+    }
+}
+
+static void
+ExportRle (
+    EXPORT_BUFFER *Out,
+    const uint32_t *Values,
+    size_t Count,
+    int BitWidth
+    )
+/*++
+
+Routine Description:
+
+    Encodes values with the RLE / bit packing hybrid: runs of 8 or more
+    equal values as runs, the rest bit packed 8 at a time.
+
+--*/
+{
+    size_t i = 0;
+    size_t start;
+    size_t run;
+
+    while (i < Count) {
+
+        for (run = 1; i + run < Count && Values[i + run] == Values[i]; run++) {
+        }
+
+        if (run >= 8) {
+
+            BufferVarint( Out, (uint64_t)run << 1 );
+            BufferLittle( Out, Values[i], (BitWidth + 7) / 8 );
+            i += run;
+            continue;
+        }
+
+        //
+        //  Bit pack groups of 8 until one starts a run.  Only the last
+        //  group of the page is padded.
+        //
+
+        start = i;
+
+        for (;;) {
+
+            i += 8;
+
+            if (i >= Count) {
+
+                break;
+            }
+
+            for (run = 1; i + run < Count && Values[i + run] == Values[i]; run++) {
+            }
+
+            if (run >= 8) {
+
+                break;
+            }
+        }
+
+        BufferVarint( Out, (((uint64_t)(i - start) / 8) << 1) | 1 );
+        ExportBitPack( Out, Values + start, ((i < Count) ? i : Count) - start, i - start, BitWidth );
+
+        if (i > Count) {
+
+            i = Count;
+        }
+    }
+}
+
+static int
+ExportBitWidth (
+    uint32_t Entries
+    )
+{
+    int width = 1;
+
+    while (Entries > 1 && (Entries - 1) >> width != 0) {
+
+        width++;
+    }
+
+    return width;
+}
+
+static void
+ExportPage (
+    EXPORT_BUFFER *Pages,
+    int Type,
+    int Encoding,
+    unsigned Values,
+    EXPORT_BUFFER *Body,
+    long long *Uncompressed,
+    long long *Compressed
+    )
+/*++
+
+Routine Description:
+
+    Appends a page with its header, compressing the body when asked to.
+
+--*/
+{
+    EXPORT_BUFFER compressed = { 0 };
+    EXPORT_BUFFER *stored = Body;
+    THRIFT thrift = { Pages, 0, { 0 } };
+    size_t start = Pages->Length;
+    z_stream stream;
+
+    if (Export.Gzip) {
+
+        memset( &stream, 0, sizeof( stream ) );
+        deflateInit2( &stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY );
+
+        BufferReserve( &compressed, deflateBound( &stream, Body->Length ) );
+        stream.next_in = Body->Data;
+        stream.avail_in = (uInt)Body->Length;
+        stream.next_out = compressed.Data;
+        stream.avail_out = (uInt)compressed.Size;
+        deflate( &stream, Z_FINISH );
+        compressed.Length = stream.total_out;
+        deflateEnd( &stream );
+
+        stored = &compressed;
+    }
+
+    ThriftI32( &thrift, 1, Type );
+    ThriftI32( &thrift, 2, (int32_t)Body->Length );
+    ThriftI32( &thrift, 3, (int32_t)stored->Length );
+
+    if (Type == PARQUET_DATA_PAGE) {
+
+        ThriftBegin( &thrift, 5 );
+        ThriftI32( &thrift, 1, (int32_t)Values );
+        ThriftI32( &thrift, 2, Encoding );
+        ThriftI32( &thrift, 3, PARQUET_RLE );
+        ThriftI32( &thrift, 4, PARQUET_RLE );
+        ThriftEnd( &thrift );
+
+    } else {
+
+        ThriftBegin( &thrift, 7 );
+        ThriftI32( &thrift, 1, (int32_t)Values );
+        ThriftI32( &thrift, 2, Encoding );
+        ThriftEnd( &thrift );
+    }
+
+    BufferByte( Pages, 0 );
+
+    *Uncompressed += (long long)(Pages->Length - start + Body->Length);
+    BufferAppend( Pages, stored->Data, stored->Length );
+    *Compressed += (long long)(Pages->Length - start);
+
+    BufferFree( &compressed );
+}
+
+static void
+ExportFlushPage (
+    EXPORT_COLUMN *Column,
+    EXPORT_KIND Kind,
+    long long *Uncompressed,
+    long long *Compressed
+    )
+/*++
+
+Routine Description:
+
+    Encodes the page a column has filled as a data page.  A string column
+    whose dictionary outgrew EXPORT_MAX_DICTIONARY stops adding to it, and
+    its later pages are PLAIN.
+
+--*/
+{
+    EXPORT_BUFFER body = { 0 };
+    size_t lengthAt;
+    uint32_t length;
+    int encoding = PARQUET_PLAIN;
+    int width;
+    unsigned i;
+
+    if (Column->PageRows == 0) {
+
+        return;
+    }
+
+    //
+    //  Definition levels, prefixed with their length
+    //
+
+    BufferLittle( &body, 0, 4 );
+    lengthAt = body.Length;
+    ExportRle( &body, Column->Levels, Column->PageRows, 1 );
+    length = (uint32_t)(body.Length - lengthAt);
+    memcpy( body.Data, &length, 4 );
+
+    if (Kind != ExportString) {
+
+        for (i = 0; i < Column->PageValues; i++) {
+
+            BufferLittle( &body, (uint64_t)Column->Values[i], (Kind == ExportInt32) ? 4 : 8 );
+        }
+
+    } else if (Column->Plain.Length != 0 || Column->Stopped) {
+
+        BufferAppend( &body, Column->Plain.Data, Column->Plain.Length );
+        Column->Plain.Length = 0;
+        Column->UsedPlain = 1;
+
+    } else {
+
+        encoding = PARQUET_RLE_DICTIONARY;
+        width = ExportBitWidth( Column->Entries );
+        BufferByte( &body, (unsigned char)width );
+        ExportRle( &body, Column->Indices, Column->PageValues, width );
+    }
+
+    ExportPage( &Column->Pages, PARQUET_DATA_PAGE, encoding, Column->PageRows, &body, Uncompressed, Compressed );
+
+    Column->PageRows = 0;
+    Column->PageValues = 0;
+
+    if (Kind == ExportString && Column->Dictionary.Length > EXPORT_MAX_DICTIONARY) {
+
+        Column->Stopped = 1;
+    }
+
+    BufferFree( &body );
+}
+
+static uint32_t
+ExportIntern (
+    EXPORT_COLUMN *Column,
+    const unsigned char *Text,
+    uint32_t Length
+    )
+/*++
+
+Routine Description:
+
+    Returns the dictionary entry of a string, adding it if it is new.
+
+--*/
+{
+    uint32_t hash = ExportHash( Text, Length );
+    uint32_t slot;
+    uint32_t entry;
+    uint32_t i;
+
+    if (Column->Entries * 2 >= Column->SlotCount) {
+
+        free( Column->Slots );
+        Column->SlotCount = Column->SlotCount ? Column->SlotCount * 2 : 4096;
+        Column->Slots = ExportAlloc( NULL, Column->SlotCount * sizeof( uint32_t ) );
+        memset( Column->Slots, 0, Column->SlotCount * sizeof( uint32_t ) );
+
+        for (i = 0; i < Column->Entries; i++) {
+
+            for (slot = Column->Hashes[i] & (Column->SlotCount - 1);
+                 Column->Slots[slot] != 0;
+                 slot = (slot + 1) & (Column->SlotCount - 1)) {
+            }
+
+            Column->Slots[slot] = i + 1;
+        }
+    }
+
+    for (slot = hash & (Column->SlotCount - 1);
+         Column->Slots[slot] != 0;
+         slot = (slot + 1) & (Column->SlotCount - 1)) {
+
+        entry = Column->Slots[slot] - 1;
+
+        if (Column->Hashes[entry] == hash &&
+            memcmp( &Length, Column->Dictionary.Data + Column->Offsets[entry], 4 ) == 0 &&
+            memcmp( Text, Column->Dictionary.Data + Column->Offsets[entry] + 4, Length ) == 0) {
+
+            return entry;
+        }
+    }
+
+    if (Column->Entries == Column->EntrySize) {
+
+        Column->EntrySize = Column->EntrySize ? Column->EntrySize * 2 : 1024;
+        Column->Offsets = ExportAlloc( Column->Offsets, Column->EntrySize * sizeof( uint32_t ) );
+        Column->Hashes = ExportAlloc( Column->Hashes, Column->EntrySize * sizeof( uint32_t ) );
+    }
+
+    entry = Column->Entries++;
+    Column->Offsets[entry] = (uint32_t)Column->Dictionary.Length;
+    Column->Hashes[entry] = hash;
+    Column->Slots[slot] = entry + 1;
+
+    BufferAppend( &Column->Dictionary, &Length, 4 );
+    BufferAppend( &Column->Dictionary, Text, Length );
+
+    return entry;
+}
+
+static void
+ExportValue (
+    EXPORT_WORKER *Worker,
+    EXPORT_ROW_GROUP *Group,
+    unsigned Index,
+    sqlite3_stmt *Row
+    )
+/*++
+
+Routine Description:
+
+    Adds the value of one column of the current row.
+
+--*/
+{
+    EXPORT_COLUMN *column = &Worker->Columns[Index];
+    EXPORT_KIND kind = ExportColumns[Index].Kind;
+    const unsigned char *text;
+    uint32_t length;
+    int64_t value = 0;
+    int null = (sqlite3_column_type( Row, (int)Index ) == SQLITE_NULL);
+
+    if (!null) {
+
+        switch (kind) {
+
+            case ExportTime:
+
+                value = sqlite3_column_int64( Row, (int)Index );
+                null = (value == 0);
+                value = (value - EXPORT_EPOCH_DIFF) / 10;
+                break;
+
+            case ExportPointer:
+
+                if (sqlite3_column_type( Row, (int)Index ) == SQLITE_INTEGER) {
+
+                    value = sqlite3_column_int64( Row, (int)Index );
+
+                } else {
+
+                    text = sqlite3_column_text( Row, (int)Index );
+                    value = (int64_t)strtoull( (const char *)text, NULL, 16 );
+                    Worker->BytesRead += (unsigned long long)sqlite3_column_bytes( Row, (int)Index );
+                }
+
+                break;
+
+            case ExportInt32:
+
+                value = (int32_t)sqlite3_column_int64( Row, (int)Index );
+                break;
+
+            case ExportInt64:
+
+                value = sqlite3_column_int64( Row, (int)Index );
+                break;
+
+            default:
+
+                text = sqlite3_column_text( Row, (int)Index );
+                length = (uint32_t)sqlite3_column_bytes( Row, (int)Index );
+                Worker->BytesRead += length;
+
+                if (column->Stopped) {
+
+                    BufferAppend( &column->Plain, &length, 4 );
+                    BufferAppend( &column->Plain, text, length );
+
+                } else {
+
+                    column->Indices[column->PageValues] = ExportIntern( column, text, length );
+                }
+
+                break;
+        }
+    }
+
+    column->Levels[column->PageRows++] = !null;
+    column->Rows++;
+
+    if (null) {
+
+        column->Nulls++;
+
+    } else {
+
+        if (kind != ExportString) {
+
+            column->Values[column->PageValues] = value;
+
+            Worker->BytesRead += (kind == ExportInt32) ? 4 : 8;
+
+            if (column->Rows - column->Nulls == 1) {
+
+                column->Min = column->Max = value;
+
+            } else if (kind == ExportPointer) {
+
+                if ((uint64_t)value < (uint64_t)column->Min) column->Min = value;
+                if ((uint64_t)value > (uint64_t)column->Max) column->Max = value;
+
+            } else {
+
+                if (value < column->Min) column->Min = value;
+                if (value > column->Max) column->Max = value;
+            }
+        }
+
+        column->PageValues++;
+    }
+
+    if (column->PageRows == EXPORT_PAGE_ROWS) {
+
+        ExportFlushPage( column, kind, &Group->Columns[Index].Uncompressed, &Group->Columns[Index].Compressed );
+    }
+}
+
+static void
+ExportFinishGroup (
+    EXPORT_WORKER *Worker,
+    EXPORT_ROW_GROUP *Group
+    )
+/*++
+
+Routine Description:
+
+    Lays out the column chunks of a row group, each its dictionary page
+    followed by its data pages, and resets the columns for the next one.
+
+--*/
+{
+    EXPORT_COLUMN *column;
+    EXPORT_CHUNK_META *meta;
+    EXPORT_BUFFER dictionaryPage = { 0 };
+    unsigned i;
+
+    for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+        column = &Worker->Columns[i];
+        meta = &Group->Columns[i];
+
+        ExportFlushPage( column, ExportColumns[i].Kind, &meta->Uncompressed, &meta->Compressed );
+
+        meta->Offset = (long long)Group->Data.Length;
+        meta->DictionaryOffset = -1;
+        meta->Rows = column->Rows;
+        meta->Nulls = column->Nulls;
+        meta->Min = column->Min;
+        meta->Max = column->Max;
+        meta->Plain = column->UsedPlain || ExportColumns[i].Kind != ExportString;
+
+        if (ExportColumns[i].Kind == ExportString) {
+
+            meta->Dictionary = 1;
+            meta->DictionaryOffset = meta->Offset;
+
+            ExportPage( &dictionaryPage,
+                        PARQUET_DICTIONARY_PAGE,
+                        PARQUET_PLAIN,
+                        column->Entries,
+                        &column->Dictionary,
+                        &meta->Uncompressed,
+                        &meta->Compressed );
+
+            BufferAppend( &Group->Data, dictionaryPage.Data, dictionaryPage.Length );
+            dictionaryPage.Length = 0;
+
+            if (column->Stopped) {
+
+                Worker->Stopped++;
+            }
+        }
+
+        meta->DataOffset = (long long)Group->Data.Length;
+        BufferAppend( &Group->Data, column->Pages.Data, column->Pages.Length );
+
+        column->Pages.Length = 0;
+        column->Dictionary.Length = 0;
+        column->Plain.Length = 0;
+        column->Entries = 0;
+        column->Stopped = 0;
+        column->UsedPlain = 0;
+        column->Rows = 0;
+        column->Nulls = 0;
+
+        if (column->Slots != NULL) {
+
+            memset( column->Slots, 0, column->SlotCount * sizeof( uint32_t ) );
+        }
+    }
+
+    BufferFree( &dictionaryPage );
+}
+
+//---------------------------------------------------------------------------
+//                      Reading
+//---------------------------------------------------------------------------
+
+static sqlite3 *
+ExportOpen (
+    unsigned Input
+    )
+{
+    sqlite3 *db = NULL;
+
+    if (sqlite3_open_v2( Export.Inputs[Input], &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not open %s: %s\n", Export.Inputs[Input], sqlite3_errmsg( db ) );
+        sqlite3_close( db );
+        return NULL;
+    }
+
+    return db;
+}
+
+static sqlite3_stmt *
+ExportPrepare (
+    sqlite3 *Db,
+    unsigned Input
+    )
+/*++
+
+Routine Description:
+
+    Prepares the query of a span of an input, selecting NULL for the
+    columns it does not have.
+
+--*/
+{
+    static const char *where =
+        " FROM MinifilterLog"
+        " WHERE LogID BETWEEN ?4 AND ?5"
+        "   AND PreOpTime >= ?1 AND PreOpTime < ?2 AND (?3 < 0 OR ProcessId = ?3)"
+        " ORDER BY LogID;";
+    EXPORT_BUFFER sql = { 0 };
+    sqlite3_stmt *stmt = NULL;
+    unsigned i;
+
+    BufferAppend( &sql, "SELECT ", 7 );
+
+    for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+        if (i != 0) {
+
+            BufferAppend( &sql, ", ", 2 );
+        }
+
+        if (i == EXPORT_FILE_NAME && Export.HasFiles[Input]) {
+
+            BufferAppend( &sql, ExportFileNameSql, sizeof( ExportFileNameSql ) - 1 );
+
+        } else if (Export.Present[Input][i]) {
+
+            BufferAppend( &sql, ExportColumns[i].Name, strlen( ExportColumns[i].Name ) );
+
+        } else {
+
+            BufferAppend( &sql, "NULL", 4 );
+        }
+    }
+
+    BufferAppend( &sql, where, strlen( where ) + 1 );
+
+    if (sqlite3_prepare_v2( Db, (const char *)sql.Data, -1, &stmt, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not read MinifilterLog of %s: %s\n", Export.Inputs[Input], sqlite3_errmsg( Db ) );
+        stmt = NULL;
+    }
+
+    BufferFree( &sql );
+
+    if (stmt != NULL) {
+
+        sqlite3_bind_int64( stmt, 1, Export.From );
+        sqlite3_bind_int64( stmt, 2, Export.To );
+        sqlite3_bind_int64( stmt, 3, Export.ProcessId );
+    }
+
+    return stmt;
+}
+
+static int
+ExportPlan (
+    void
+    )
+/*++
+
+Routine Description:
+
+    Finds the columns of every input and cuts the LogIDs of the rows to
+    export into spans of about GroupRows rows.  LogIDs are dense, so a
+    span is as wide as the selected rows are sparse.
+
+--*/
+{
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    long long count;
+    long long first;
+    long long last;
+    long long width;
+    unsigned input;
+    unsigned i;
+    int failed = 0;
+
+    for (input = 0; input < Export.InputCount && !failed; input++) {
+
+        db = ExportOpen( input );
+
+        if (db == NULL) {
+
+            return -1;
+        }
+
+        if (sqlite3_prepare_v2( db, "PRAGMA table_info(MinifilterLog);", -1, &stmt, NULL ) != SQLITE_OK) {
+
+            sqlite3_close( db );
+            return -1;
+        }
+
+        while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+            if (strcasecmp( (const char *)sqlite3_column_text( stmt, 1 ), "FileID" ) == 0) {
+
+                Export.HasFiles[input] = 1;
+            }
+
+            for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+                if (strcasecmp( (const char *)sqlite3_column_text( stmt, 1 ), ExportColumns[i].Name ) == 0) {
+
+                    Export.Present[input][i] = 1;
+                }
+            }
+        }
+
+        sqlite3_finalize( stmt );
+
+        if (!Export.Present[input][0] || !Export.Present[input][3]) {
+
+            fprintf( stderr, "%s has no MinifilterLog\n", Export.Inputs[input] );
+            sqlite3_close( db );
+            return -1;
+        }
+
+        if (Export.HasFiles[input]) {
+
+            if (sqlite3_prepare_v2( db, "SELECT FileID, Path FROM Files LIMIT 0;", -1, &stmt, NULL ) == SQLITE_OK) {
+
+                sqlite3_finalize( stmt );
+
+            } else {
+
+                Export.HasFiles[input] = 0;
+            }
+        }
+
+        if (sqlite3_prepare_v2( db,
+                                "SELECT COUNT(*), MIN(LogID), MAX(LogID) FROM MinifilterLog"
+                                " WHERE PreOpTime >= ?1 AND PreOpTime < ?2 AND (?3 < 0 OR ProcessId = ?3);",
+                                -1,
+                                &stmt,
+                                NULL ) != SQLITE_OK) {
+
+            fprintf( stderr, "Could not read MinifilterLog of %s: %s\n", Export.Inputs[input], sqlite3_errmsg( db ) );
+            sqlite3_close( db );
+            return -1;
+        }
+
+        sqlite3_bind_int64( stmt, 1, Export.From );
+        sqlite3_bind_int64( stmt, 2, Export.To );
+        sqlite3_bind_int64( stmt, 3, Export.ProcessId );
+
+        if (sqlite3_step( stmt ) == SQLITE_ROW && (count = sqlite3_column_int64( stmt, 0 )) > 0) {
+
+            first = sqlite3_column_int64( stmt, 1 );
+            last = sqlite3_column_int64( stmt, 2 );
+            width = (long long)((double)(last - first + 1) * Export.GroupRows / count) + 1;
+
+            while (first <= last) {
+
+                Export.Spans = ExportAlloc( Export.Spans, (Export.SpanCount + 1) * sizeof( EXPORT_SPAN ) );
+                Export.Spans[Export.SpanCount].Input = input;
+                Export.Spans[Export.SpanCount].First = first;
+                Export.Spans[Export.SpanCount].Last = (last - first >= width) ? first + width - 1 : last;
+                Export.SpanCount++;
+
+                first += width;
+            }
+        }
+
+        sqlite3_finalize( stmt );
+        sqlite3_close( db );
+    }
+
+    return 0;
+}
+
+static EXPORT_ROW_GROUP *
+ExportSpan (
+    EXPORT_WORKER *Worker,
+    EXPORT_SPAN *Span
+    )
+/*++
+
+Routine Description:
+
+    Reads and encodes the rows of a span as a row group.
+
+--*/
+{
+    EXPORT_ROW_GROUP *group;
+    unsigned i;
+    int rc;
+
+    if (Worker->Db == NULL || Worker->Input != Span->Input) {
+
+        sqlite3_finalize( Worker->Rows );
+        sqlite3_close( Worker->Db );
+
+        Worker->Rows = NULL;
+        Worker->Input = Span->Input;
+        Worker->Db = ExportOpen( Span->Input );
+
+        if (Worker->Db == NULL || (Worker->Rows = ExportPrepare( Worker->Db, Span->Input )) == NULL) {
+
+            return NULL;
+        }
+    }
+
+    group = ExportAlloc( NULL, sizeof( EXPORT_ROW_GROUP ) );
+    memset( group, 0, sizeof( EXPORT_ROW_GROUP ) );
+
+    sqlite3_bind_int64( Worker->Rows, 4, Span->First );
+    sqlite3_bind_int64( Worker->Rows, 5, Span->Last );
+
+    while ((rc = sqlite3_step( Worker->Rows )) == SQLITE_ROW) {
+
+        for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+            ExportValue( Worker, group, i, Worker->Rows );
+        }
+
+        group->Rows++;
+    }
+
+    sqlite3_reset( Worker->Rows );
+
+    if (rc != SQLITE_DONE) {
+
+        fprintf( stderr, "Reading MinifilterLog of %s failed: %s\n",
+                 Export.Inputs[Span->Input],
+                 sqlite3_errmsg( Worker->Db ) );
+        free( group );
+        return NULL;
+    }
+
+    ExportFinishGroup( Worker, group );
+
+    return group;
+}
+
+static void *
+ExportWork (
+    void *Context
+    )
+{
+    EXPORT_WORKER *worker = Context;
+    EXPORT_ROW_GROUP *group;
+    unsigned span;
+    unsigned i;
+
+    for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+        worker->Columns[i].Levels = ExportAlloc( NULL, EXPORT_PAGE_ROWS * sizeof( uint32_t ) );
+        worker->Columns[i].Values = ExportAlloc( NULL, EXPORT_PAGE_ROWS * sizeof( int64_t ) );
+        worker->Columns[i].Indices = ExportAlloc( NULL, EXPORT_PAGE_ROWS * sizeof( uint32_t ) );
+    }
+
+    for (;;) {
+
+        pthread_mutex_lock( &Export.Lock );
+
+        while (!Export.Failed &&
+               Export.NextSpan < Export.SpanCount &&
+               Export.NextSpan >= Export.NextWrite + 2 * Export.WorkerCount) {
+
+            pthread_cond_wait( &Export.Changed, &Export.Lock );
+        }
+
+        if (Export.Failed || Export.NextSpan == Export.SpanCount) {
+
+            pthread_mutex_unlock( &Export.Lock );
+            break;
+        }
+
+        span = Export.NextSpan++;
+        pthread_mutex_unlock( &Export.Lock );
+
+        group = ExportSpan( worker, &Export.Spans[span] );
+
+        pthread_mutex_lock( &Export.Lock );
+
+        if (group == NULL) {
+
+            Export.Failed = 1;
+
+        } else {
+
+            Export.Done[span] = group;
+        }
+
+        pthread_cond_broadcast( &Export.Changed );
+        pthread_mutex_unlock( &Export.Lock );
+    }
+
+    sqlite3_finalize( worker->Rows );
+    sqlite3_close( worker->Db );
+
+    for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+        free( worker->Columns[i].Levels );
+        free( worker->Columns[i].Values );
+        free( worker->Columns[i].Indices );
+        free( worker->Columns[i].Offsets );
+        free( worker->Columns[i].Hashes );
+        free( worker->Columns[i].Slots );
+        BufferFree( &worker->Columns[i].Plain );
+        BufferFree( &worker->Columns[i].Dictionary );
+        BufferFree( &worker->Columns[i].Pages );
+    }
+
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+//                      Writing
+//---------------------------------------------------------------------------
+
+static void
+ExportSchema (
+    THRIFT *Thrift
+    )
+{
+    unsigned i;
+
+    ThriftList( Thrift, 2, THRIFT_STRUCT, EXPORT_COLUMNS + 1 );
+
+    ThriftBegin( Thrift, 0 );
+    ThriftBinary( Thrift, 4, "schema", 6 );
+    ThriftI32( Thrift, 5, (int32_t)EXPORT_COLUMNS );
+    ThriftEnd( Thrift );
+
+    for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+        ThriftBegin( Thrift, 0 );
+
+        switch (ExportColumns[i].Kind) {
+
+            case ExportString:
+
+                ThriftI32( Thrift, 1, PARQUET_BYTE_ARRAY );
+                ThriftI32( Thrift, 3, PARQUET_OPTIONAL );
+                ThriftBinary( Thrift, 4, ExportColumns[i].Name, strlen( ExportColumns[i].Name ) );
+                ThriftI32( Thrift, 6, PARQUET_UTF8 );
+                ThriftBegin( Thrift, 10 );
+                ThriftBegin( Thrift, 1 );           // STRING
+                ThriftEnd( Thrift );
+                ThriftEnd( Thrift );
+                break;
+
+            case ExportTime:
+
+                ThriftI32( Thrift, 1, PARQUET_INT64 );
+                ThriftI32( Thrift, 3, PARQUET_OPTIONAL );
+                ThriftBinary( Thrift, 4, ExportColumns[i].Name, strlen( ExportColumns[i].Name ) );
+                ThriftI32( Thrift, 6, PARQUET_TIMESTAMP_MICROS );
+                ThriftBegin( Thrift, 10 );
+                ThriftBegin( Thrift, 8 );           // TIMESTAMP
+                ThriftBool( Thrift, 1, 1 );         // isAdjustedToUTC
+                ThriftBegin( Thrift, 2 );
+                ThriftBegin( Thrift, 2 );           // MICROS
+                ThriftEnd( Thrift );
+                ThriftEnd( Thrift );
+                ThriftEnd( Thrift );
+                ThriftEnd( Thrift );
+                break;
+
+            case ExportPointer:
+
+                ThriftI32( Thrift, 1, PARQUET_INT64 );
+                ThriftI32( Thrift, 3, PARQUET_OPTIONAL );
+                ThriftBinary( Thrift, 4, ExportColumns[i].Name, strlen( ExportColumns[i].Name ) );
+                ThriftI32( Thrift, 6, PARQUET_UINT_64 );
+                ThriftBegin( Thrift, 10 );
+                ThriftBegin( Thrift, 10 );          // INTEGER
+                ThriftField( Thrift, 1, THRIFT_BYTE );
+                BufferByte( Thrift->Out, 64 );
+                ThriftBool( Thrift, 2, 0 );
+                ThriftEnd( Thrift );
+                ThriftEnd( Thrift );
+                break;
+
+            default:
+
+                ThriftI32( Thrift, 1, (ExportColumns[i].Kind == ExportInt32) ? PARQUET_INT32 : PARQUET_INT64 );
+                ThriftI32( Thrift, 3, PARQUET_OPTIONAL );
+                ThriftBinary( Thrift, 4, ExportColumns[i].Name, strlen( ExportColumns[i].Name ) );
+                break;
+        }
+
+        ThriftEnd( Thrift );
+    }
+}
+
+static void
+ExportColumnMeta (
+    THRIFT *Thrift,
+    unsigned Index,
+    EXPORT_CHUNK_META *Meta,
+    long long Base
+    )
+{
+    EXPORT_KIND kind = ExportColumns[Index].Kind;
+    unsigned char bytes[8];
+    int width = (kind == ExportInt32) ? 4 : 8;
+    int encodings = 1 + Meta->Plain + Meta->Dictionary;
+    int i;
+
+    ThriftBegin( Thrift, 0 );
+    ThriftI64( Thrift, 2, Base + Meta->Offset );
+
+    ThriftBegin( Thrift, 3 );
+    ThriftI32( Thrift, 1, (kind == ExportString) ? PARQUET_BYTE_ARRAY :
+                          (kind == ExportInt32) ? PARQUET_INT32 : PARQUET_INT64 );
+
+    ThriftList( Thrift, 2, THRIFT_I32, (size_t)encodings );
+    ThriftZigzag( Thrift, PARQUET_RLE );
+
+    if (Meta->Plain) {
+
+        ThriftZigzag( Thrift, PARQUET_PLAIN );
+    }
+
+    if (Meta->Dictionary) {
+
+        ThriftZigzag( Thrift, PARQUET_RLE_DICTIONARY );
+    }
+
+    ThriftList( Thrift, 3, THRIFT_BINARY, 1 );
+    BufferVarint( Thrift->Out, strlen( ExportColumns[Index].Name ) );
+    BufferAppend( Thrift->Out, ExportColumns[Index].Name, strlen( ExportColumns[Index].Name ) );
+
+    ThriftI32( Thrift, 4, Export.Gzip ? PARQUET_GZIP : PARQUET_UNCOMPRESSED );
+    ThriftI64( Thrift, 5, Meta->Rows );
+    ThriftI64( Thrift, 6, Meta->Uncompressed );
+    ThriftI64( Thrift, 7, Meta->Compressed );
+    ThriftI64( Thrift, 9, Base + Meta->DataOffset );
+
+    if (Meta->Dictionary) {
+
+        ThriftI64( Thrift, 11, Base + Meta->DictionaryOffset );
+    }
+
+    ThriftBegin( Thrift, 12 );
+    ThriftI64( Thrift, 3, Meta->Nulls );
+
+    if (kind != ExportString && Meta->Nulls < Meta->Rows) {
+
+        for (i = 0; i < width; i++) bytes[i] = (unsigned char)((uint64_t)Meta->Max >> (8 * i));
+        ThriftBinary( Thrift, 5, bytes, (size_t)width );
+
+        for (i = 0; i < width; i++) bytes[i] = (unsigned char)((uint64_t)Meta->Min >> (8 * i));
+        ThriftBinary( Thrift, 6, bytes, (size_t)width );
+    }
+
+    ThriftEnd( Thrift );
+
+    ThriftEnd( Thrift );
+    ThriftEnd( Thrift );
+}
+
+static int
+ExportFooter (
+    FILE *File,
+    EXPORT_ROW_GROUP **Groups,
+    unsigned GroupCount,
+    long long Rows
+    )
+{
+    EXPORT_BUFFER footer = { 0 };
+    THRIFT thrift = { &footer, 0, { 0 } };
+    long long uncompressed;
+    long long compressed;
+    uint32_t length;
+    unsigned g;
+    unsigned i;
+    int result;
+
+    ThriftI32( &thrift, 1, 1 );
+    ExportSchema( &thrift );
+    ThriftI64( &thrift, 3, Rows );
+
+    ThriftList( &thrift, 4, THRIFT_STRUCT, GroupCount );
+
+    for (g = 0; g < GroupCount; g++) {
+
+        uncompressed = 0;
+        compressed = 0;
+
+        for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+            uncompressed += Groups[g]->Columns[i].Uncompressed;
+            compressed += Groups[g]->Columns[i].Compressed;
+        }
+
+        ThriftBegin( &thrift, 0 );
+        ThriftList( &thrift, 1, THRIFT_STRUCT, EXPORT_COLUMNS );
+
+        for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+            ExportColumnMeta( &thrift, i, &Groups[g]->Columns[i], Groups[g]->Offset );
+        }
+
+        ThriftI64( &thrift, 2, uncompressed );
+        ThriftI64( &thrift, 3, Groups[g]->Rows );
+        ThriftI64( &thrift, 5, Groups[g]->Offset );
+        ThriftI64( &thrift, 6, compressed );
+        ThriftField( &thrift, 7, THRIFT_I16 );
+        ThriftZigzag( &thrift, g );
+        ThriftEnd( &thrift );
+    }
+
+    ThriftBinary( &thrift, 6, "mspyExport", 10 );
+
+    //
+    //  Readers only trust min_value and max_value given the column order.
+    //
+
+    ThriftList( &thrift, 7, THRIFT_STRUCT, EXPORT_COLUMNS );
+
+    for (i = 0; i < EXPORT_COLUMNS; i++) {
+
+        ThriftBegin( &thrift, 0 );
+        ThriftBegin( &thrift, 1 );          // TYPE_ORDER
+        ThriftEnd( &thrift );
+        ThriftEnd( &thrift );
+    }
+
+    BufferByte( &footer, 0 );
+
+    length = (uint32_t)footer.Length;
+
+    result = (fwrite( footer.Data, 1, footer.Length, File ) == footer.Length &&
+              fwrite( &length, 4, 1, File ) == 1 &&
+              fwrite( "PAR1", 1, 4, File ) == 4) ? 0 : -1;
+
+    BufferFree( &footer );
+
+    return result;
+}
+
+static void
+ExportUsage (
+    void
+    )
+{
+    printf( "Usage: mspyExport [-f <from>] [-t <to>] [-p <pid>] [-g <rows>] [-j <workers>] [-z] <out.parquet> <log.db>...\n"
+            "\n"
+            "    <log.db> is the log database or a partition file, several are exported one after the other\n"
+            "    [-f <from>] [-t <to>] only exports rows with PreOpTime in [<from>, <to>), 100ns ticks\n"
+            "    [-p <pid>] only exports rows of process <pid>\n"
+            "    [-g <rows>] rows in a row group, %d by default\n"
+            "    [-j <workers>] encodes with <workers> threads, one a processor by default\n"
+            "    [-z] compresses pages with GZIP\n",
+            EXPORT_DEFAULT_ROWS );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    EXPORT_ROW_GROUP **groups = NULL;
+    unsigned groupCount = 0;
+    const char *output;
+    FILE *file;
+    long long rows = 0;
+    long long offset = 4;
+    long long start;
+    unsigned long long bytesRead = 0;
+    unsigned long long stopped = 0;
+    double seconds;
+    struct stat status;
+    long processors;
+    unsigned w;
+    int option;
+
+    Export.From = 0;
+    Export.To = 0x7FFFFFFFFFFFFFFFLL;
+    Export.ProcessId = -1;
+    Export.GroupRows = EXPORT_DEFAULT_ROWS;
+
+    processors = sysconf( _SC_NPROCESSORS_ONLN );
+    Export.WorkerCount = (processors < 1) ? 1 : (processors > EXPORT_MAX_WORKERS) ? EXPORT_MAX_WORKERS : (unsigned)processors;
+
+    while ((option = getopt( argc, argv, "f:t:p:g:j:z" )) != -1) {
+
+        switch (option) {
+
+            case 'f':
+                Export.From = strtoll( optarg, NULL, 0 );
+                break;
+
+            case 't':
+                Export.To = strtoll( optarg, NULL, 0 );
+                break;
+
+            case 'p':
+                Export.ProcessId = strtoll( optarg, NULL, 0 );
+                break;
+
+            case 'g':
+                Export.GroupRows = strtoll( optarg, NULL, 0 );
+                break;
+
+            case 'j':
+                Export.WorkerCount = (unsigned)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'z':
+                Export.Gzip = 1;
+                break;
+
+            default:
+                ExportUsage();
+                return 2;
+        }
+    }
+
+    if (argc - optind < 2 || argc - optind - 1 > EXPORT_MAX_INPUTS ||
+        Export.GroupRows < 1 || Export.WorkerCount < 1 || Export.WorkerCount > EXPORT_MAX_WORKERS) {
+
+        ExportUsage();
+        return 2;
+    }
+
+    output = argv[optind];
+
+    for (Export.InputCount = 0; optind + 1 + (int)Export.InputCount < argc; Export.InputCount++) {
+
+        Export.Inputs[Export.InputCount] = argv[optind + 1 + Export.InputCount];
+    }
+
+    start = ExportNow();
+
+    if (ExportPlan() != 0) {
+
+        return 1;
+    }
+
+    file = fopen( output, "wb" );
+
+    if (file == NULL) {
+
+        fprintf( stderr, "Could not create %s: %s\n", output, strerror( errno ) );
+        return 1;
+    }
+
+    fwrite( "PAR1", 1, 4, file );
+
+    pthread_mutex_init( &Export.Lock, NULL );
+    pthread_cond_init( &Export.Changed, NULL );
+    Export.Done = ExportAlloc( NULL, (Export.SpanCount + 1) * sizeof( EXPORT_ROW_GROUP * ) );
+    memset( Export.Done, 0, (Export.SpanCount + 1) * sizeof( EXPORT_ROW_GROUP * ) );
+
+    for (w = 0; w < Export.WorkerCount; w++) {
+
+        if (pthread_create( &Export.Workers[w].Thread, NULL, ExportWork, &Export.Workers[w] ) != 0) {
+
+            fprintf( stderr, "Could not start worker %u\n", w );
+            return 1;
+        }
+    }
+
+    //
+    //  Write the row groups in order as they are finished.  Only their
+    //  description is kept for the footer.
+    //
+
+    pthread_mutex_lock( &Export.Lock );
+
+    while (Export.NextWrite < Export.SpanCount && !Export.Failed) {
+
+        EXPORT_ROW_GROUP *group = Export.Done[Export.NextWrite];
+
+        if (group == NULL) {
+
+            pthread_cond_wait( &Export.Changed, &Export.Lock );
+            continue;
+        }
+
+        Export.Done[Export.NextWrite] = NULL;
+        pthread_mutex_unlock( &Export.Lock );
+
+        if (group->Rows != 0) {
+
+            if (fwrite( group->Data.Data, 1, group->Data.Length, file ) != group->Data.Length) {
+
+                fprintf( stderr, "Could not write %s: %s\n", output, strerror( errno ) );
+                pthread_mutex_lock( &Export.Lock );
+                Export.Failed = 1;
+                free( group->Data.Data );
+                free( group );
+                continue;
+            }
+
+            group->Offset = offset;
+            offset += (long long)group->Data.Length;
+            rows += group->Rows;
+
+            BufferFree( &group->Data );
+            groups = ExportAlloc( groups, (groupCount + 1) * sizeof( EXPORT_ROW_GROUP * ) );
+            groups[groupCount++] = group;
+
+        } else {
+
+            BufferFree( &group->Data );
+            free( group );
+        }
+
+        pthread_mutex_lock( &Export.Lock );
+        Export.NextWrite++;
+        pthread_cond_broadcast( &Export.Changed );
+    }
+
+    pthread_cond_broadcast( &Export.Changed );
+    pthread_mutex_unlock( &Export.Lock );
+
+    for (w = 0; w < Export.WorkerCount; w++) {
+
+        pthread_join( Export.Workers[w].Thread, NULL );
+        bytesRead += Export.Workers[w].BytesRead;
+        stopped += Export.Workers[w].Stopped;
+    }
+
+    if (Export.Failed || ExportFooter( file, groups, groupCount, rows ) != 0 || fclose( file ) != 0) {
+
+        fprintf( stderr, "Export failed, %s removed\n", output );
+        unlink( output );
+        return 1;
+    }
+
+    seconds = (ExportNow() - start) / 1e9;
+
+    if (stat( output, &status ) != 0) {
+
+        status.st_size = 0;
+    }
+
+    printf( "Exported %lld rows in %u row groups from %u inputs in %.3f s with %u workers: %.0f rows/s\n",
+            rows,
+            groupCount,
+            Export.InputCount,
+            seconds,
+            Export.WorkerCount,
+            seconds > 0 ? rows / seconds : 0 );
+    printf( "Read %.1f MB of column data, %.1f MB/s, wrote %.1f MB, %.1f MB/s%s\n",
+            bytesRead / 1048576.0,
+            seconds > 0 ? bytesRead / 1048576.0 / seconds : 0,
+            status.st_size / 1048576.0,
+            seconds > 0 ? status.st_size / 1048576.0 / seconds : 0,
+            Export.Gzip ? ", GZIP" : "" );
+
+    if (stopped != 0) {
+
+        printf( "%llu column chunks outgrew their dictionary and were partly stored plain\n", stopped );
+    }
+
+    for (w = 0; w < groupCount; w++) {
+
+        free( groups[w] );
+    }
+
+    free( groups );
+    free( Export.Done );
+    free( Export.Spans );
+
+    return 0;
+}
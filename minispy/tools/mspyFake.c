@@ -0,0 +1,1315 @@
+/*++
+
+Module Name:
+
+    mspyFake.c
+
+Abstract:
+
+    A stand-in for minispy.sys, so the user mode client can be run end to
+    end, for throughput, latency and soak tests, without the driver.
+
+    It listens on a local (AF_UNIX) socket and answers the messages the
+    client sends with FilterSendMessage, framed as minispy.h describes,
+    with what the filter would answer.  GetMiniSpyLog fills the buffer
+    with as many whole records as fit and fails with ERROR_NO_MORE_ITEMS
+    when there are none, or ERROR_INSUFFICIENT_BUFFER when not even the
+    next one fits.  GetMiniSpyVersion, SetMiniSpyClientFilter and
+    GetMiniSpyClientStats behave as the filter's do.  SetMiniSpyRules is
+    accepted and counted, the rules are not enforced.  The client connects
+    with "minispy /u <socket path>".
+
+    Records go through the same shared record buffer as the filter's,
+    spyRing.h, as large as the filter's by default: a client that falls
+    behind loses the oldest records and sees them in its drop counter.
+    They come from one of two sources:
+
+        synthetic   Processes opening, reading, writing, cleaning up and
+                    closing files, every process reported with a process
+                    record first.
+
+        replay      The rows of MinifilterLog in a log database or a
+                    partition file, in the order they were logged.  Minor
+                    functions and rule matches are not logged in a form
+                    that maps back and are left 0, the client applies its
+                    own rules again.  Process records are made up from
+                    ProcessFilePath before the first operation of each
+                    process.
+
+    Records are pushed into the buffer at the given rate, or as fast as
+    the client takes them.  The time a record waits in the buffer before
+    the client takes it is its delivery latency.  Every time a client
+    disconnects the throughput, the delivery latency and the counters of
+    the connection are printed.
+
+    Built on its own, for instance:
+
+        gcc -O2 -o mspyFake mspyFake.c -lsqlite3
+
+    The records are laid out as the x64 client expects them, so it has to
+    be built for a 64 bit target.  Windows programs can connect to sockets
+    in WSL by path.
+
+    The client itself also builds for Linux against ushim, from every
+    module of user/, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -I../user -o minispy ../user/mspy*.c -lsqlite3 -lm
+
+    Run from here it reads its schema from ../user, see FindResource in
+    ushim/windows.h, and writes the log database and service log under
+    their Windows names in the current directory.  It has no filter
+    manager, so /a only turns logging on and /d and /l find no volumes.
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+//
+//  The Windows types minispy.h and spyRing.h are written with, as x64
+//  Windows lays them out.
+//
+
+typedef uint8_t UCHAR;
+typedef char CCHAR;
+typedef uint16_t USHORT;
+typedef uint16_t WCHAR;
+typedef int32_t LONG;
+typedef int INT;
+typedef uint32_t ULONG;
+typedef uint64_t ULONGLONG, *PULONGLONG;
+typedef uint64_t ULONG_PTR;
+typedef int BOOLEAN;
+typedef void VOID;
+typedef void *PVOID;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        uint32_t LowPart;
+        int32_t HighPart;
+    };
+    int64_t QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY;
+
+#define TRUE                            1
+#define FALSE                           0
+#define FIELD_OFFSET(Type, Field)       offsetof( Type, Field )
+#define __inline                        static inline
+#define _Return_type_success_(Expr)
+#define _In_
+#define _Out_
+#define _Inout_
+
+#include "../inc/minispy.h"
+#include "../inc/spyRing.h"
+
+_Static_assert( sizeof( PVOID ) == 8, "mspyFake serves the x64 client and must be built for a 64 bit target" );
+
+//
+//  What FilterSendMessage returns for the filter's NTSTATUS.
+//
+
+#define FAKE_S_OK                           0
+#define FAKE_HRESULT_FROM_WIN32(Error)      ((LONG)(0x80070000 | (Error)))
+#define FAKE_ERROR_INVALID_PARAMETER        87
+#define FAKE_ERROR_INSUFFICIENT_BUFFER      122
+#define FAKE_ERROR_NO_MORE_ITEMS            259
+
+//
+//  The parts of the WDK headers the records are built with.
+//
+
+#define IRP_MJ_CREATE                       0x00
+#define IRP_MJ_CLOSE                        0x02
+#define IRP_MJ_READ                         0x03
+#define IRP_MJ_WRITE                        0x04
+#define IRP_MJ_CLEANUP                      0x12
+
+#define IRP_NOCACHE                         0x00000001
+#define IRP_PAGING_IO                       0x00000002
+#define IRP_SYNCHRONOUS_API                 0x00000004
+#define IRP_SYNCHRONOUS_PAGING_IO           0x00000040
+#define IRP_CREATE_OPERATION                0x00000080
+#define IRP_READ_OPERATION                  0x00000100
+#define IRP_WRITE_OPERATION                 0x00000200
+#define IRP_CLOSE_OPERATION                 0x00000400
+
+#define FLT_CALLBACK_DATA_IRP_OPERATION         0x00000001
+#define FLT_CALLBACK_DATA_FAST_IO_OPERATION     0x00000002
+#define FLT_CALLBACK_DATA_FS_FILTER_OPERATION   0x00000004
+
+#define FAKE_STATUS_OBJECT_NAME_NOT_FOUND   ((LONG)0xC0000034)
+#define FAKE_FILE_OPENED                    1
+#define FAKE_FILE_OPEN_IF                   3
+#define FAKE_FILE_NON_DIRECTORY_FILE        0x00000040
+
+#define FAKE_EPOCH_DIFF                     116444736000000000LL
+
+#define FAKE_DEFAULT_PROCESSES              16
+#define FAKE_DEFAULT_FILES                  10000
+#define FAKE_MAX_PROCESSES                  4096
+#define FAKE_MAX_INPUT                      (1024 * 1024)
+#define FAKE_BUCKETS                        48          // log2 of nanoseconds
+#define FAKE_PIDS                           65536       // processes seen in a replay, a power of two
+
+//
+//  The longest name that fits a record the filter could send, in WCHARs
+//  without the terminating null.
+//
+
+#define FAKE_MAX_NAME       ((MAX_LOG_RECORD_LENGTH - sizeof( LOG_RECORD )) / sizeof( WCHAR ) - 1)
+
+//
+//  Major function names as the client logs them.
+//
+
+static const struct {
+
+    const char *Name;
+    UCHAR Major;
+
+} FakeMajors[] = {
+
+    { "IRP_MJ_CREATE",                      0x00 },
+    { "IRP_MJ_CREATE_NAMED_PIPE",           0x01 },
+    { "IRP_MJ_CLOSE",                       0x02 },
+    { "IRP_MJ_READ",                        0x03 },
+    { "IRP_MJ_WRITE",                       0x04 },
+    { "IRP_MJ_QUERY_INFORMATION",           0x05 },
+    { "IRP_MJ_SET_INFORMATION",             0x06 },
+    { "IRP_MJ_QUERY_EA",                    0x07 },
+    { "IRP_MJ_SET_EA",                      0x08 },
+    { "IRP_MJ_FLUSH_BUFFERS",               0x09 },
+    { "IRP_MJ_QUERY_VOLUME_INFORMATION",    0x0a },
+    { "IRP_MJ_SET_VOLUME_INFORMATION",      0x0b },
+    { "IRP_MJ_DIRECTORY_CONTROL",           0x0c },
+    { "IRP_MJ_FILE_SYSTEM_CONTROL",         0x0d },
+    { "IRP_MJ_DEVICE_CONTROL",              0x0e },
+    { "IRP_MJ_INTERNAL_DEVICE_CONTROL",     0x0f },
+    { "IRP_MJ_SHUTDOWN",                    0x10 },
+    { "IRP_MJ_LOCK_CONTROL",                0x11 },
+    { "IRP_MJ_CLEANUP",                     0x12 },
+    { "IRP_MJ_CREATE_MAILSLOT",             0x13 },
+    { "IRP_MJ_QUERY_SECURITY",              0x14 },
+    { "IRP_MJ_SET_SECURITY",                0x15 },
+    { "IRP_MJ_POWER",                       0x16 },
+    { "IRP_MJ_SYSTEM_CONTROL",              0x17 },
+    { "IRP_MJ_DEVICE_CHANGE",               0x18 },
+    { "IRP_MJ_QUERY_QUOTA",                 0x19 },
+    { "IRP_MJ_SET_QUOTA",                   0x1a },
+    { "IRP_MJ_PNP",                         0x1b },
+    { "IRP_MJ_ACQUIRE_FOR_SECTION_SYNC",    IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION },
+    { "IRP_MJ_RELEASE_FOR_SECTION_SYNC",    IRP_MJ_RELEASE_FOR_SECTION_SYNCHRONIZATION },
+    { "IRP_MJ_ACQUIRE_FOR_MOD_WRITE",       IRP_MJ_ACQUIRE_FOR_MOD_WRITE },
+    { "IRP_MJ_RELEASE_FOR_MOD_WRITE",       IRP_MJ_RELEASE_FOR_MOD_WRITE },
+    { "IRP_MJ_ACQUIRE_FOR_CC_FLUSH",        IRP_MJ_ACQUIRE_FOR_CC_FLUSH },
+    { "IRP_MJ_RELEASE_FOR_CC_FLUSH",        IRP_MJ_RELEASE_FOR_CC_FLUSH },
+    { "IRP_MJ_NOTIFY_STREAM_FO_CREATION",   IRP_MJ_NOTIFY_STREAM_FO_CREATION },
+    { "IRP_MJ_FAST_IO_CHECK_IF_POSSIBLE",   IRP_MJ_FAST_IO_CHECK_IF_POSSIBLE },
+    { "IRP_MJ_NETWORK_QUERY_OPEN",          IRP_MJ_NETWORK_QUERY_OPEN },
+    { "IRP_MJ_MDL_READ",                    IRP_MJ_MDL_READ },
+    { "IRP_MJ_MDL_READ_COMPLETE",           IRP_MJ_MDL_READ_COMPLETE },
+    { "IRP_MJ_PREPARE_MDL_WRITE",           IRP_MJ_PREPARE_MDL_WRITE },
+    { "IRP_MJ_MDL_WRITE_COMPLETE",          IRP_MJ_MDL_WRITE_COMPLETE },
+    { "IRP_MJ_VOLUME_MOUNT",                IRP_MJ_VOLUME_MOUNT },
+    { "IRP_MJ_VOLUME_DISMOUNT",             IRP_MJ_VOLUME_DISMOUNT },
+    { "IRP_MJ_TRANSACTION_NOTIFY",          IRP_MJ_TRANSACTION_NOTIFY },
+};
+
+//
+//  A file a synthetic thread has open goes through these, one record each.
+//
+
+typedef enum _FAKE_STEP {
+
+    FakeStepCreate,
+    FakeStepRead,
+    FakeStepWrite,
+    FakeStepCleanup,
+    FakeStepClose,
+    FakeSteps
+
+} FAKE_STEP;
+
+typedef struct _FAKE_STATS {
+
+    unsigned long long Requests;
+    unsigned long long Records;
+    unsigned long long Bytes;
+    unsigned long long Empty;
+    unsigned long long TooSmall;
+    unsigned long long Invalid;
+    unsigned long long Rules;
+    unsigned long long Latency[FAKE_BUCKETS];
+    long long LatencyMax;
+
+} FAKE_STATS;
+
+typedef struct _FAKE_STATE {
+
+    //
+    //  Source
+    //
+
+    sqlite3 *Db;
+    sqlite3_stmt *Rows;
+    int Cycle;                      // restart the replay at its end
+    int Exhausted;
+
+    unsigned long long Limit;       // records, 0 for no limit
+    unsigned long long Produced;
+    double Rate;                    // records a second, 0 as fast as taken
+    long long RateStart;            // monotonic ns
+
+    unsigned Processes;
+    unsigned Files;
+    unsigned long long Random;
+    unsigned ProcessesReported;
+
+    //
+    //  The synthetic file open
+    //
+
+    FAKE_STEP Step;
+    unsigned Process;
+    unsigned Thread;
+    unsigned File;
+    ULONG_PTR FileObject;
+
+    //
+    //  Processes a replay has reported, by id
+    //
+
+    ULONG_PTR *Pids;
+
+    //
+    //  The shared record buffer and the one client
+    //
+
+    SPY_RING Ring;
+    PSPY_RING_SLOT Slots;
+    long long *Pushed;              // monotonic ns a slot was pushed at
+    SPY_RING_CURSOR Cursor;
+    ULONG Sequence;
+
+    union {
+        LOG_RECORD Record;
+        PVOID Align[MAX_LOG_RECORD_LENGTH / sizeof( PVOID )];
+    } Next;
+
+    FAKE_STATS Stats;
+
+} FAKE_STATE;
+
+static FAKE_STATE Fake;
+
+static volatile sig_atomic_t FakeStop;
+
+static long long
+FakeNow (
+    void
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static long long
+FakeSystemTime (
+    void
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_REALTIME, &now );
+    return FAKE_EPOCH_DIFF + (long long)now.tv_sec * 10000000 + now.tv_nsec / 100;
+}
+
+static unsigned long long
+FakeRandom (
+    void
+    )
+{
+    //
+    //  splitmix64
+    //
+
+    unsigned long long z = (Fake.Random += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static int
+FakeBucket (
+    long long Nanoseconds
+    )
+{
+    int bucket = 0;
+
+    while (Nanoseconds > 1 && bucket < FAKE_BUCKETS - 1) {
+
+        Nanoseconds >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static void
+FakeSetName (
+    PLOG_RECORD LogRecord,
+    const char *Name
+    )
+/*++
+
+Routine Description:
+
+    Sets the name of a record from UTF-8, truncated to what the filter
+    could send, and its length to match.
+
+--*/
+{
+    const unsigned char *p = (const unsigned char *)Name;
+    unsigned long codePoint;
+    size_t length = 0;
+    int more;
+
+    while (*p != '\0' && length < FAKE_MAX_NAME) {
+
+        if (*p < 0x80) {
+
+            codePoint = *p++;
+            more = 0;
+
+        } else if ((*p & 0xE0) == 0xC0) {
+
+            codePoint = *p++ & 0x1F;
+            more = 1;
+
+        } else if ((*p & 0xF0) == 0xE0) {
+
+            codePoint = *p++ & 0x0F;
+            more = 2;
+
+        } else {
+
+            codePoint = *p++ & 0x07;
+            more = 3;
+        }
+
+        while (more-- > 0 && (*p & 0xC0) == 0x80) {
+
+            codePoint = (codePoint << 6) | (*p++ & 0x3F);
+        }
+
+        if (codePoint >= 0x10000) {
+
+            if (length + 2 > FAKE_MAX_NAME) {
+
+                break;
+            }
+
+            codePoint -= 0x10000;
+            LogRecord->Name[length++] = (WCHAR)(0xD800 + (codePoint >> 10));
+            LogRecord->Name[length++] = (WCHAR)(0xDC00 + (codePoint & 0x3FF));
+
+        } else {
+
+            LogRecord->Name[length++] = (WCHAR)codePoint;
+        }
+    }
+
+    LogRecord->Name[length] = 0;
+    LogRecord->Length = (ULONG)ROUND_TO_SIZE( sizeof( LOG_RECORD ) + (length + 1) * sizeof( WCHAR ),
+                                              sizeof( PVOID ) );
+}
+
+static void
+FakeProcessRecord (
+    PLOG_RECORD LogRecord,
+    ULONG_PTR ProcessId,
+    long long CreateTime,
+    const char *ImagePath
+    )
+{
+    memset( LogRecord, 0, sizeof( LOG_RECORD ) );
+
+    LogRecord->RecordType = RECORD_TYPE_PROCESS;
+    LogRecord->Data.ProcessId = ProcessId;
+    LogRecord->Data.OriginatingTime.QuadPart = CreateTime;
+    LogRecord->Data.CallbackMinorId = PROCESS_RECORD_CREATE;
+    LogRecord->Data.Information = 4;
+
+    FakeSetName( LogRecord, ImagePath );
+}
+
+static int
+FakeSynthetic (
+    PLOG_RECORD LogRecord
+    )
+/*++
+
+Routine Description:
+
+    Builds the next synthetic record.  Every process is reported first,
+    then each record is the next step of the file one thread has open, or
+    opens a new one.
+
+--*/
+{
+    PRECORD_DATA data = &LogRecord->Data;
+    long long now = FakeSystemTime();
+    char name[128];
+
+    if (Fake.ProcessesReported < Fake.Processes) {
+
+        snprintf( name, sizeof( name ), "\\??\\C:\\Fake\\process%04u.exe", Fake.ProcessesReported );
+        FakeProcessRecord( LogRecord, 1000 + 4 * Fake.ProcessesReported, now, name );
+        Fake.ProcessesReported++;
+        return 0;
+    }
+
+    if (Fake.Step == FakeStepCreate) {
+
+        Fake.Process = (unsigned)(FakeRandom() % Fake.Processes);
+        Fake.Thread = (unsigned)(FakeRandom() % 4);
+        Fake.File = (unsigned)(FakeRandom() % Fake.Files);
+        Fake.FileObject = 0xFFFF800000000000ULL + (FakeRandom() & 0xFFFFFFF0ULL);
+    }
+
+    memset( LogRecord, 0, sizeof( LOG_RECORD ) );
+
+    data->OriginatingTime.QuadPart = now;
+    data->CompletionTime.QuadPart = now + 20 + (long long)(FakeRandom() % 400);
+    data->DeviceObject = 0xFFFF800010000000ULL;
+    data->FileObject = Fake.FileObject;
+    data->ProcessId = 1000 + 4 * Fake.Process;
+    data->ThreadId = 2000 + 4 * (Fake.Process * 4 + Fake.Thread);
+    data->Flags = FLT_CALLBACK_DATA_IRP_OPERATION;
+    data->RequestorMode = 1;
+
+    switch (Fake.Step) {
+
+        case FakeStepCreate:
+
+            data->CallbackMajorId = IRP_MJ_CREATE;
+            data->IrpFlags = IRP_CREATE_OPERATION | IRP_SYNCHRONOUS_API;
+            data->Arg2 = (PVOID)(ULONG_PTR)((FAKE_FILE_OPEN_IF << 24) | FAKE_FILE_NON_DIRECTORY_FILE);
+
+            if (FakeRandom() % 100 == 0) {
+
+                data->Status = FAKE_STATUS_OBJECT_NAME_NOT_FOUND;
+                Fake.Step = FakeStepCreate;
+                break;
+            }
+
+            data->Information = FAKE_FILE_OPENED;
+            Fake.Step = FakeStepRead;
+            break;
+
+        case FakeStepRead:
+        case FakeStepWrite:
+
+            data->CallbackMajorId = (Fake.Step == FakeStepRead) ? IRP_MJ_READ : IRP_MJ_WRITE;
+            data->IrpFlags = ((Fake.Step == FakeStepRead) ? IRP_READ_OPERATION : IRP_WRITE_OPERATION) |
+                             IRP_SYNCHRONOUS_API;
+            data->Arg1 = (PVOID)(ULONG_PTR)4096;
+            data->Arg3 = (PVOID)(ULONG_PTR)((FakeRandom() % 256) * 4096);
+            data->Information = 4096;
+            Fake.Step++;
+            break;
+
+        case FakeStepCleanup:
+
+            data->CallbackMajorId = IRP_MJ_CLEANUP;
+            data->IrpFlags = IRP_SYNCHRONOUS_API;
+            Fake.Step = FakeStepClose;
+            break;
+
+        default:
+
+            data->CallbackMajorId = IRP_MJ_CLOSE;
+            data->IrpFlags = IRP_CLOSE_OPERATION | IRP_SYNCHRONOUS_API;
+            Fake.Step = FakeStepCreate;
+            break;
+    }
+
+    snprintf( name,
+              sizeof( name ),
+              "\\Device\\HarddiskVolume3\\Fake\\dir%03u\\file%06u.dat",
+              Fake.File % 1000,
+              Fake.File );
+
+    FakeSetName( LogRecord, name );
+    return 0;
+}
+
+static int
+FakeReplay (
+    PLOG_RECORD LogRecord
+    )
+/*++
+
+Routine Description:
+
+    Builds the next record from the log database, or a process record for
+    the process of the next row if it was not reported yet.
+
+Return Value:
+
+    0, or -1 at the end of the replay.
+
+--*/
+{
+    static int pending;
+    PRECORD_DATA data = &LogRecord->Data;
+    const char *text;
+    ULONG_PTR processId;
+    unsigned slot;
+    size_t i;
+    int rc;
+
+    if (!pending) {
+
+        rc = sqlite3_step( Fake.Rows );
+
+        if (rc != SQLITE_ROW && Fake.Cycle) {
+
+            sqlite3_reset( Fake.Rows );
+            rc = sqlite3_step( Fake.Rows );
+        }
+
+        if (rc != SQLITE_ROW) {
+
+            return -1;
+        }
+    }
+
+    pending = 0;
+
+    //
+    //  Report a process before its first operation, from the image path
+    //  the client resolved for it.
+    //
+
+    processId = (ULONG_PTR)sqlite3_column_int64( Fake.Rows, 3 );
+    text = (const char *)sqlite3_column_text( Fake.Rows, 4 );
+
+    if (text != NULL && text[0] != '<') {
+
+        for (slot = (unsigned)(processId * 0x9E3779B1u) & (FAKE_PIDS - 1);
+             Fake.Pids[slot] != 0 && Fake.Pids[slot] != processId + 1;
+             slot = (slot + 1) & (FAKE_PIDS - 1)) {
+        }
+
+        if (Fake.Pids[slot] == 0) {
+
+            char imagePath[MAX_LOG_RECORD_LENGTH];
+
+            Fake.Pids[slot] = processId + 1;
+            snprintf( imagePath, sizeof( imagePath ), "\\??\\%s", text );
+            FakeProcessRecord( LogRecord, processId, sqlite3_column_int64( Fake.Rows, 1 ) - 1, imagePath );
+            pending = 1;
+            return 0;
+        }
+    }
+
+    memset( LogRecord, 0, sizeof( LOG_RECORD ) );
+
+    text = (const char *)sqlite3_column_text( Fake.Rows, 0 );
+
+    if (text != NULL) {
+
+        data->Flags = (strcmp( text, "IRP" ) == 0) ? FLT_CALLBACK_DATA_IRP_OPERATION :
+                      (strcmp( text, "FIO" ) == 0) ? FLT_CALLBACK_DATA_FAST_IO_OPERATION :
+                      (strcmp( text, "FSF" ) == 0) ? FLT_CALLBACK_DATA_FS_FILTER_OPERATION : 0;
+    }
+
+    data->OriginatingTime.QuadPart = sqlite3_column_int64( Fake.Rows, 1 );
+    data->CompletionTime.QuadPart = sqlite3_column_int64( Fake.Rows, 2 );
+    data->ProcessId = processId;
+    data->ThreadId = (ULONG_PTR)sqlite3_column_int64( Fake.Rows, 5 );
+
+    text = (const char *)sqlite3_column_text( Fake.Rows, 6 );
+
+    for (i = 0; text != NULL && i < sizeof( FakeMajors ) / sizeof( FakeMajors[0] ); i++) {
+
+        if (strcmp( text, FakeMajors[i].Name ) == 0) {
+
+            data->CallbackMajorId = FakeMajors[i].Major;
+            break;
+        }
+    }
+
+    //
+    //  IrpFlags as FormatIrpFlags writes them, "NPSICRWX" with '-' for
+    //  the flags not set.
+    //
+
+    text = (const char *)sqlite3_column_text( Fake.Rows, 7 );
+
+    if (text != NULL && strlen( text ) >= 8) {
+
+        if (text[0] != '-') data->IrpFlags |= IRP_NOCACHE;
+        if (text[1] != '-') data->IrpFlags |= IRP_PAGING_IO;
+        if (text[2] != '-') data->IrpFlags |= IRP_SYNCHRONOUS_API;
+        if (text[3] != '-') data->IrpFlags |= IRP_SYNCHRONOUS_PAGING_IO;
+        if (text[4] != '-') data->IrpFlags |= IRP_CREATE_OPERATION;
+        if (text[5] != '-') data->IrpFlags |= IRP_READ_OPERATION;
+        if (text[6] != '-') data->IrpFlags |= IRP_WRITE_OPERATION;
+        if (text[7] != '-') data->IrpFlags |= IRP_CLOSE_OPERATION;
+    }
+
+    //
+    //  Pointers are logged as hexadecimal text.
+    //
+
+    text = (const char *)sqlite3_column_text( Fake.Rows, 8 );
+    data->DeviceObject = (text != NULL) ? strtoull( text, NULL, 16 ) : 0;
+    text = (const char *)sqlite3_column_text( Fake.Rows, 9 );
+    data->FileObject = (text != NULL) ? strtoull( text, NULL, 16 ) : 0;
+    text = (const char *)sqlite3_column_text( Fake.Rows, 10 );
+    data->Transaction = (text != NULL) ? strtoull( text, NULL, 16 ) : 0;
+    text = (const char *)sqlite3_column_text( Fake.Rows, 11 );
+    data->Information = (text != NULL) ? strtoull( text, NULL, 16 ) : 0;
+
+    data->Arg1 = (PVOID)(ULONG_PTR)sqlite3_column_int64( Fake.Rows, 12 );
+    data->Arg2 = (PVOID)(ULONG_PTR)sqlite3_column_int64( Fake.Rows, 13 );
+    data->Arg3 = (PVOID)(ULONG_PTR)sqlite3_column_int64( Fake.Rows, 14 );
+    data->Arg4 = (PVOID)(ULONG_PTR)sqlite3_column_int64( Fake.Rows, 15 );
+    data->Arg5 = (PVOID)(ULONG_PTR)sqlite3_column_int64( Fake.Rows, 16 );
+    data->Arg6.QuadPart = sqlite3_column_int64( Fake.Rows, 17 );
+
+    text = (const char *)sqlite3_column_text( Fake.Rows, 19 );
+    data->RequestorMode = (text != NULL && strcmp( text, "User" ) == 0) ? 1 : 0;
+    data->Status = (LONG)sqlite3_column_int64( Fake.Rows, 20 );
+
+    text = (const char *)sqlite3_column_text( Fake.Rows, 18 );
+    FakeSetName( LogRecord, (text != NULL) ? text : "" );
+
+    return 0;
+}
+
+static void
+FakeProduce (
+    void
+    )
+/*++
+
+Routine Description:
+
+    Pushes the records due by now into the shared record buffer, and at
+    most as many as fit the buffer beyond what the client has read when
+    going as fast as the client takes them.
+
+--*/
+{
+    PLOG_RECORD logRecord = &Fake.Next.Record;
+    unsigned long long due;
+    unsigned long long count;
+    unsigned long long held;
+    long long now = FakeNow();
+    ULONGLONG sequence;
+
+    if (Fake.Rate > 0) {
+
+        due = (unsigned long long)((now - Fake.RateStart) / 1e9 * Fake.Rate);
+        count = (due > Fake.Produced) ? due - Fake.Produced : 0;
+
+    } else {
+
+        held = Fake.Ring.Head - Fake.Cursor.Next;
+        count = (held < Fake.Ring.SlotCount) ? Fake.Ring.SlotCount - held : 0;
+    }
+
+    while (count-- > 0 && !Fake.Exhausted) {
+
+        if (Fake.Limit != 0 && Fake.Produced >= Fake.Limit) {
+
+            Fake.Exhausted = 1;
+            break;
+        }
+
+        if (((Fake.Db != NULL) ? FakeReplay( logRecord ) : FakeSynthetic( logRecord )) != 0) {
+
+            Fake.Exhausted = 1;
+            break;
+        }
+
+        logRecord->SequenceNumber = ++Fake.Sequence;
+
+        sequence = SpyRingPush( &Fake.Ring, logRecord );
+        Fake.Pushed[sequence & Fake.Ring.SlotMask] = now;
+        Fake.Produced++;
+    }
+}
+
+static LONG
+FakeGetLog (
+    unsigned char *OutputBuffer,
+    ULONG OutputBufferLength,
+    ULONG *ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    Copies as many records as fit into the output buffer, as SpyGetLog
+    does.
+
+--*/
+{
+    PLOG_RECORD logRecord;
+    ULONGLONG sequence;
+    ULONG bytesWritten = 0;
+    long long latency;
+    long long now;
+    int recordsAvailable = 0;
+
+    FakeProduce();
+
+    now = FakeNow();
+
+    while (OutputBufferLength > 0) {
+
+        logRecord = SpyRingCursorNext( &Fake.Ring, &Fake.Cursor, &sequence );
+
+        if (logRecord == NULL) {
+
+            break;
+        }
+
+        recordsAvailable = 1;
+
+        if (OutputBufferLength < logRecord->Length) {
+
+            SpyRingCursorRewind( &Fake.Cursor, sequence );
+            break;
+        }
+
+        memcpy( OutputBuffer + bytesWritten, logRecord, logRecord->Length );
+        bytesWritten += logRecord->Length;
+        OutputBufferLength -= logRecord->Length;
+
+        latency = now - Fake.Pushed[sequence & Fake.Ring.SlotMask];
+        Fake.Stats.Latency[FakeBucket( latency )]++;
+
+        if (latency > Fake.Stats.LatencyMax) {
+
+            Fake.Stats.LatencyMax = latency;
+        }
+
+        Fake.Stats.Records++;
+    }
+
+    *ReturnOutputBufferLength = bytesWritten;
+    Fake.Stats.Bytes += bytesWritten;
+
+    if (bytesWritten == 0 && recordsAvailable) {
+
+        Fake.Stats.TooSmall++;
+        return FAKE_HRESULT_FROM_WIN32( FAKE_ERROR_INSUFFICIENT_BUFFER );
+    }
+
+    if (bytesWritten == 0) {
+
+        Fake.Stats.Empty++;
+        return FAKE_HRESULT_FROM_WIN32( FAKE_ERROR_NO_MORE_ITEMS );
+    }
+
+    return FAKE_S_OK;
+}
+
+static LONG
+FakeMessage (
+    const unsigned char *InputBuffer,
+    ULONG InputBufferSize,
+    unsigned char *OutputBuffer,
+    ULONG OutputBufferSize,
+    ULONG *ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description:
+
+    Answers a message as SpyMessage does.
+
+--*/
+{
+    MINISPY_COMMAND command;
+    MINISPYVER version;
+    MINISPY_CLIENT_STATS stats;
+
+    *ReturnOutputBufferLength = 0;
+
+    if (InputBufferSize < FIELD_OFFSET( COMMAND_MESSAGE, Command ) + sizeof( MINISPY_COMMAND )) {
+
+        return FAKE_HRESULT_FROM_WIN32( FAKE_ERROR_INVALID_PARAMETER );
+    }
+
+    memcpy( &command, InputBuffer + FIELD_OFFSET( COMMAND_MESSAGE, Command ), sizeof( command ) );
+
+    switch (command) {
+
+        case GetMiniSpyLog:
+
+            if (OutputBufferSize == 0) {
+
+                break;
+            }
+
+            return FakeGetLog( OutputBuffer, OutputBufferSize, ReturnOutputBufferLength );
+
+        case GetMiniSpyVersion:
+
+            if (OutputBufferSize < sizeof( MINISPYVER )) {
+
+                break;
+            }
+
+            version.Major = MINISPY_MAJ_VERSION;
+            version.Minor = MINISPY_MIN_VERSION;
+            memcpy( OutputBuffer, &version, sizeof( version ) );
+            *ReturnOutputBufferLength = sizeof( MINISPYVER );
+            return FAKE_S_OK;
+
+        case SetMiniSpyClientFilter:
+
+            if (InputBufferSize < FIELD_OFFSET( COMMAND_MESSAGE, Data ) + sizeof( MINISPY_CLIENT_FILTER )) {
+
+                break;
+            }
+
+            memcpy( &Fake.Cursor.Filter,
+                    InputBuffer + FIELD_OFFSET( COMMAND_MESSAGE, Data ),
+                    sizeof( MINISPY_CLIENT_FILTER ) );
+            return FAKE_S_OK;
+
+        case GetMiniSpyClientStats:
+
+            if (OutputBufferSize < sizeof( MINISPY_CLIENT_STATS )) {
+
+                break;
+            }
+
+            SpyRingCursorStats( &Fake.Ring, &Fake.Cursor, &stats );
+            memcpy( OutputBuffer, &stats, sizeof( stats ) );
+            *ReturnOutputBufferLength = sizeof( MINISPY_CLIENT_STATS );
+            return FAKE_S_OK;
+
+        case SetMiniSpyRules:
+
+            if (InputBufferSize < FIELD_OFFSET( COMMAND_MESSAGE, Data )) {
+
+                break;
+            }
+
+            Fake.Stats.Rules++;
+            return FAKE_S_OK;
+
+        default:
+            break;
+    }
+
+    Fake.Stats.Invalid++;
+    return FAKE_HRESULT_FROM_WIN32( FAKE_ERROR_INVALID_PARAMETER );
+}
+
+static int
+FakeTransfer (
+    int Socket,
+    void *Buffer,
+    size_t Size,
+    int Receive
+    )
+{
+    ssize_t done;
+
+    while (Size > 0) {
+
+        done = Receive ? recv( Socket, Buffer, Size, 0 ) : send( Socket, Buffer, Size, MSG_NOSIGNAL );
+
+        if (done < 0 && errno == EINTR && !FakeStop) {
+
+            continue;
+        }
+
+        if (done <= 0) {
+
+            return -1;
+        }
+
+        Buffer = (char *)Buffer + done;
+        Size -= (size_t)done;
+    }
+
+    return 0;
+}
+
+static void
+FakeServe (
+    int Socket
+    )
+/*++
+
+Routine Description:
+
+    Answers the messages of one client until it disconnects.
+
+--*/
+{
+    static unsigned char input[FAKE_MAX_INPUT];
+    static PVOID output[FAKE_MAX_INPUT / sizeof( PVOID )];
+    MINISPY_LOCAL_REQUEST request;
+    MINISPY_LOCAL_REPLY reply;
+
+    while (!FakeStop) {
+
+        if (FakeTransfer( Socket, &request, sizeof( request ), 1 ) != 0) {
+
+            return;
+        }
+
+        if (request.InputSize > sizeof( input ) || request.OutputSize > sizeof( output )) {
+
+            fprintf( stderr, "Message too large, %u bytes in, %u out\n", request.InputSize, request.OutputSize );
+            return;
+        }
+
+        if (FakeTransfer( Socket, input, request.InputSize, 1 ) != 0) {
+
+            return;
+        }
+
+        Fake.Stats.Requests++;
+
+        reply.Status = FakeMessage( input,
+                                    request.InputSize,
+                                    (unsigned char *)output,
+                                    request.OutputSize,
+                                    &reply.BytesReturned );
+
+        if (FakeTransfer( Socket, &reply, sizeof( reply ), 0 ) != 0 ||
+            FakeTransfer( Socket, output, reply.BytesReturned, 0 ) != 0) {
+
+            return;
+        }
+    }
+}
+
+static double
+FakePercentile (
+    double Fraction
+    )
+{
+    unsigned long long target = (unsigned long long)(Fake.Stats.Records * Fraction);
+    unsigned long long seen = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < FAKE_BUCKETS; bucket++) {
+
+        seen += Fake.Stats.Latency[bucket];
+
+        if (seen > target) {
+
+            break;
+        }
+    }
+
+    return (double)(1ULL << bucket) / 1000.0;
+}
+
+static void
+FakeReport (
+    double Seconds
+    )
+{
+    MINISPY_CLIENT_STATS stats;
+
+    SpyRingCursorStats( &Fake.Ring, &Fake.Cursor, &stats );
+
+    printf( "Connection:  %.3f s, %llu messages, %llu rule sets received and not enforced\n",
+            Seconds,
+            Fake.Stats.Requests,
+            Fake.Stats.Rules );
+    printf( "Records:     %llu delivered, %.0f/s, %.1f MB/s, %.1f a message\n",
+            Fake.Stats.Records,
+            Seconds > 0 ? Fake.Stats.Records / Seconds : 0,
+            Seconds > 0 ? Fake.Stats.Bytes / Seconds / 1048576 : 0,
+            Fake.Stats.Requests > Fake.Stats.Empty ?
+                (double)Fake.Stats.Records / (Fake.Stats.Requests - Fake.Stats.Empty) : 0 );
+    printf( "             %llu dropped, %llu filtered, %llu produced%s\n",
+            (unsigned long long)stats.Dropped,
+            (unsigned long long)stats.Filtered,
+            Fake.Produced,
+            Fake.Exhausted ? ", source exhausted" : "" );
+    printf( "Replies:     %llu no more entries, %llu buffer too small, %llu invalid\n",
+            Fake.Stats.Empty,
+            Fake.Stats.TooSmall,
+            Fake.Stats.Invalid );
+
+    if (Fake.Stats.Records != 0) {
+
+        printf( "Latency:     p50 <%.1f us, p99 <%.1f us, p99.9 <%.1f us, max %.1f us in the buffer\n",
+                FakePercentile( 0.5 ),
+                FakePercentile( 0.99 ),
+                FakePercentile( 0.999 ),
+                Fake.Stats.LatencyMax / 1000.0 );
+    }
+
+    fflush( stdout );
+}
+
+static int
+FakeOpenReplay (
+    const char *Database
+    )
+{
+    static const char *columns =
+        "SELECT OprType, PreOpTime, PostOpTime, ProcessId, ProcessFilePath, ThreadId, MajorOp, IrpFlags,"
+        " DeviceObj, FileObj, FileTransaction, Information, Arg1, Arg2, Arg3, Arg4, Arg5, Arg6,"
+        " %s, RequestorMode, %s"
+        " FROM MinifilterLog ORDER BY LogID;";
+    static const char *variants[][2] = {
+        { "COALESCE((SELECT Path FROM Files WHERE Files.FileID = MinifilterLog.FileID), OpFileName)", "StatusCode" },
+        { "OpFileName", "StatusCode" },
+        { "OpFileName", "0" }
+    };
+    unsigned variant;
+    char sql[1024];
+
+    if (sqlite3_open_v2( Database, &Fake.Db, SQLITE_OPEN_READONLY, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not open %s: %s\n", Database, sqlite3_errmsg( Fake.Db ) );
+        return -1;
+    }
+
+    //
+    //  Logs written before the Files table keep the name in every row.
+    //  Logs written before StatusCode was added replay as successes.
+    //
+
+    for (variant = 0; variant < sizeof( variants ) / sizeof( variants[0] ) && Fake.Rows == NULL; variant++) {
+
+        snprintf( sql, sizeof( sql ), columns, variants[variant][0], variants[variant][1] );
+        sqlite3_prepare_v2( Fake.Db, sql, -1, &Fake.Rows, NULL );
+    }
+
+    if (Fake.Rows == NULL) {
+
+        fprintf( stderr, "Could not read MinifilterLog: %s\n", sqlite3_errmsg( Fake.Db ) );
+        return -1;
+    }
+
+    Fake.Pids = calloc( FAKE_PIDS, sizeof( ULONG_PTR ) );
+
+    return (Fake.Pids != NULL) ? 0 : -1;
+}
+
+static void
+FakeInterrupt (
+    int Signal
+    )
+{
+    (void)Signal;
+    FakeStop = 1;
+}
+
+static void
+FakeUsage (
+    void
+    )
+{
+    printf( "Usage: mspyFake [-r <rate>] [-n <records>] [-p <processes>] [-f <files>] [-s <seed>]\n"
+            "                [-d <log.db> [-c]] [-k <records>] <socket path>\n"
+            "\n"
+            "    <socket path> is where the client connects, minispy /u <socket path>\n"
+            "    [-r <rate>] records a second, 0 as fast as the client takes them (default)\n"
+            "    [-n <records>] stops after <records> records, 0 never (default)\n"
+            "    [-p <processes>] [-f <files>] synthetic processes and files, %u and %u by default\n"
+            "    [-s <seed>] seeds the synthetic records\n"
+            "    [-d <log.db>] replays MinifilterLog of a log database or partition file instead\n"
+            "    [-c] starts the replay over at its end\n"
+            "    [-k <records>] holds <records> records for the client, %u by default as the filter\n",
+            FAKE_DEFAULT_PROCESSES,
+            FAKE_DEFAULT_FILES,
+            4096 );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    struct sockaddr_un address;
+    struct sigaction action;
+    const char *database = NULL;
+    unsigned long ringRecords = 4096;
+    unsigned long slotCount;
+    long long start;
+    int listener;
+    int client;
+    int option;
+
+    Fake.Processes = FAKE_DEFAULT_PROCESSES;
+    Fake.Files = FAKE_DEFAULT_FILES;
+    Fake.Random = 1;
+
+    while ((option = getopt( argc, argv, "r:n:p:f:s:d:ck:" )) != -1) {
+
+        switch (option) {
+
+            case 'r':
+                Fake.Rate = atof( optarg );
+                break;
+
+            case 'n':
+                Fake.Limit = strtoull( optarg, NULL, 0 );
+                break;
+
+            case 'p':
+                Fake.Processes = (unsigned)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'f':
+                Fake.Files = (unsigned)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 's':
+                Fake.Random = strtoull( optarg, NULL, 0 );
+                break;
+
+            case 'd':
+                database = optarg;
+                break;
+
+            case 'c':
+                Fake.Cycle = 1;
+                break;
+
+            case 'k':
+                ringRecords = strtoul( optarg, NULL, 0 );
+                break;
+
+            default:
+                FakeUsage();
+                return 2;
+        }
+    }
+
+    if (optind + 1 != argc || Fake.Rate < 0 ||
+        Fake.Processes == 0 || Fake.Processes > FAKE_MAX_PROCESSES || Fake.Files == 0 ||
+        ringRecords < 2 || ringRecords > (1UL << 24) ||
+        strlen( argv[optind] ) >= sizeof( address.sun_path )) {
+
+        FakeUsage();
+        return 2;
+    }
+
+    if (database != NULL && FakeOpenReplay( database ) != 0) {
+
+        return 1;
+    }
+
+    slotCount = SpyRingSlotsFor( (ULONG)ringRecords );
+    Fake.Slots = malloc( slotCount * sizeof( SPY_RING_SLOT ) );
+    Fake.Pushed = calloc( slotCount, sizeof( long long ) );
+
+    if (Fake.Slots == NULL || Fake.Pushed == NULL) {
+
+        fprintf( stderr, "Out of memory\n" );
+        return 1;
+    }
+
+    SpyRingInitialize( &Fake.Ring, Fake.Slots, (ULONG)slotCount );
+
+    listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+    memset( &address, 0, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+    strcpy( address.sun_path, argv[optind] );
+    unlink( address.sun_path );
+
+    if (listener < 0 ||
+        bind( listener, (struct sockaddr *)&address, sizeof( address ) ) != 0 ||
+        listen( listener, 1 ) != 0) {
+
+        fprintf( stderr, "Could not listen on %s: %s\n", address.sun_path, strerror( errno ) );
+        return 1;
+    }
+
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = FakeInterrupt;
+    sigaction( SIGINT, &action, NULL );
+    sigaction( SIGTERM, &action, NULL );
+
+    printf( "Serving %s records on %s, %lu records held\n",
+            (database != NULL) ? database : "synthetic",
+            address.sun_path,
+            slotCount );
+    fflush( stdout );
+
+    //
+    //  One client at a time, each reading on from where the last one
+    //  stopped, as a client that reconnects to the filter does not.
+    //
+
+    while (!FakeStop) {
+
+        client = accept( listener, NULL, NULL );
+
+        if (client < 0) {
+
+            continue;
+        }
+
+        memset( &Fake.Stats, 0, sizeof( Fake.Stats ) );
+        memset( &Fake.Cursor, 0, sizeof( Fake.Cursor ) );
+        Fake.Cursor.Next = Fake.Ring.Head;
+
+        start = FakeNow();
+
+        if (Fake.RateStart == 0) {
+
+            Fake.RateStart = start;
+        }
+
+        FakeServe( client );
+        close( client );
+
+        FakeReport( (FakeNow() - start) / 1e9 );
+    }
+
+    close( listener );
+    unlink( address.sun_path );
+
+    sqlite3_finalize( Fake.Rows );
+    sqlite3_close( Fake.Db );
+
+    return 0;
+}
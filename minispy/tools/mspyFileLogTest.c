@@ -0,0 +1,459 @@
+/*++
+
+Module Name:
+
+    mspyFileLogTest.c
+
+Abstract:
+
+    Stresses the service log's lock free queue, user/mspyFileLog.c, in a
+    Linux program built against ushim.  Producer threads post lines with
+    FileLogPost as fast as WriteToLogAnsi can, or in bursts with -b, while
+    the module's own flusher drains the queue into the log file and
+    rotates it.
+
+    Every line names its producer and its number among that producer's
+    lines, and the rest of it is filled from both, so a line that was torn
+    or mixed with another is seen.  Once the producers are done and the
+    flusher has stopped, the log and its rotated copies are read back,
+    oldest first, and checked:
+
+        every line is intact;
+
+        each producer's lines come in the order it posted them, none
+        twice;
+
+        the lines found, plus those the flusher reported dropped, are the
+        lines posted, unless rotation already deleted some.
+
+    At the end it prints how long a post took, the lines that were
+    dropped because the queue was full, the queue's high water mark and
+    the rate the flusher wrote at.  It returns 1 when a check fails.
+
+    The log is written to a new directory in /tmp unless -o names one.
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspyFileLogTest mspyFileLogTest.c -lsqlite3
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ushim/ushimLog.c"
+
+//
+//  The module writes to USER_LOG_FILE, moved into the test's directory,
+//  short enough for the rotated names to fit in MAX_PATH.
+//
+
+static char BenchLogFile[MAX_PATH - 8];
+
+#undef USER_LOG_FILE
+#define USER_LOG_FILE BenchLogFile
+
+#include "../user/mspyFileLog.c"
+#include "mspyBench.h"
+
+#define BENCH_MAX_PRODUCERS     64
+#define BENCH_MIN_LINE          32
+
+typedef struct _BENCH_PRODUCER {
+
+    pthread_t Thread;
+    ULONG Index;
+
+    long long Nanoseconds;
+    long long Slowest;
+
+    //
+    //  Filled in when the log is read back.
+    //
+
+    long long Found;
+    long long Next;
+
+} __attribute__(( aligned( 64 ) )) BENCH_PRODUCER, *PBENCH_PRODUCER;
+
+typedef struct _BENCH_STATE {
+
+    ULONG Producers;
+    ULONG Lines;                // per producer
+    ULONG LineLength;
+    ULONG Burst;
+
+    volatile int Go;
+
+    BENCH_PRODUCER Producer[BENCH_MAX_PRODUCERS];
+
+    long long Torn;
+    long long OutOfOrder;
+    long long Reported;         // lines the flusher said it dropped
+    long long Found;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static char
+BenchFill (
+    _In_ ULONG Producer,
+    _In_ long long Sequence,
+    _In_ ULONG Offset
+    )
+{
+    return (char)('a' + (Producer * 31 + (ULONG)(Sequence * 7) + Offset) % 26);
+}
+
+static ULONG
+BenchLine (
+    _In_ ULONG Producer,
+    _In_ long long Sequence,
+    _Out_writes_(FILELOG_LINE_SIZE) char *Line
+    )
+/*++
+
+Routine Description:
+
+    Makes the line Producer posts as its Sequence'th, LineLength bytes
+    with the line break.
+
+--*/
+{
+    ULONG length = (ULONG)snprintf( Line, FILELOG_LINE_SIZE, "P%02u %010lld ", Producer, Sequence );
+    ULONG offset;
+
+    for (offset = length; offset < Bench.LineLength - 1; offset++) {
+
+        Line[offset] = BenchFill( Producer, Sequence, offset );
+    }
+
+    Line[Bench.LineLength - 1] = '\n';
+    return Bench.LineLength;
+}
+
+static void *
+BenchProduce (
+    void *Parameter
+    )
+{
+    PBENCH_PRODUCER producer = Parameter;
+    char line[FILELOG_LINE_SIZE];
+    long long start;
+    long long took;
+    ULONG length;
+    ULONG sequence;
+
+    while (!Bench.Go) {
+
+        sched_yield();
+    }
+
+    for (sequence = 0; sequence < Bench.Lines; sequence++) {
+
+        length = BenchLine( producer->Index, sequence, line );
+
+        start = BenchNow();
+        FileLogPost( line, length );
+        took = BenchNow() - start;
+
+        producer->Nanoseconds += took;
+
+        if (took > producer->Slowest) {
+
+            producer->Slowest = took;
+        }
+
+        if (Bench.Burst != 0 && (sequence + 1) % Bench.Burst == 0) {
+
+            Sleep( 1 );
+        }
+    }
+
+    return NULL;
+}
+
+static VOID
+BenchCheckLine (
+    _In_ const char *Line,
+    _In_ size_t Length
+    )
+/*++
+
+Routine Description:
+
+    Checks one line read back from the log.
+
+--*/
+{
+    char expected[FILELOG_LINE_SIZE];
+    PBENCH_PRODUCER producer;
+    unsigned int index;
+    long long sequence;
+    long long dropped;
+
+    if (Length > 11 && Line[0] == '[' && sscanf( Line + 11, "%lld line(s) dropped", &dropped ) == 1) {
+
+        Bench.Reported += dropped;
+        return;
+    }
+
+    if (sscanf( Line, "P%02u %010lld ", &index, &sequence ) != 2 ||
+        index == 0 || index > Bench.Producers ||
+        sequence < 0 || sequence >= Bench.Lines ||
+        Length != Bench.LineLength) {
+
+        Bench.Torn++;
+        return;
+    }
+
+    BenchLine( index, sequence, expected );
+
+    if (memcmp( Line, expected, Length ) != 0) {
+
+        Bench.Torn++;
+        return;
+    }
+
+    producer = &Bench.Producer[index - 1];
+
+    if (sequence < producer->Next) {
+
+        Bench.OutOfOrder++;
+    }
+
+    producer->Next = sequence + 1;
+    producer->Found++;
+    Bench.Found++;
+}
+
+static VOID
+BenchReadBack (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Reads the rotated files, oldest first, then the current one.
+
+--*/
+{
+    char name[MAX_PATH + 8];
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    FILE *file;
+    int index;
+
+    for (index = FILELOG_KEEP; index >= 0; index--) {
+
+        if (index == 0) {
+
+            snprintf( name, sizeof( name ), "%s", USER_LOG_FILE );
+
+        } else {
+
+            snprintf( name, sizeof( name ), "%s.%d", USER_LOG_FILE, index );
+        }
+
+        file = fopen( name, "r" );
+
+        if (file == NULL) {
+
+            continue;
+        }
+
+        while ((length = getline( &line, &size, file )) > 0) {
+
+            BenchCheckLine( line, (size_t)length );
+        }
+
+        fclose( file );
+    }
+
+    free( line );
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: mspyFileLogTest [-t producers] [-n lines] [-l length] [-b burst] [-o dir]\n"
+             "  -t  producer threads (default 4, at most %d)\n"
+             "  -n  lines each producer posts (default 50000)\n"
+             "  -l  bytes a line takes with its line break (default 80, %d to %d)\n"
+             "  -b  sleep 1 ms after every burst of this many lines (default 0, never)\n"
+             "  -o  directory for the log (default a new one in /tmp)\n",
+             BENCH_MAX_PRODUCERS,
+             BENCH_MIN_LINE,
+             FILELOG_LINE_SIZE );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    char directory[MAX_PATH] = "/tmp/mspyFileLogTest.XXXXXX";
+    const char *output = NULL;
+    long long nanoseconds = 0;
+    long long slowest = 0;
+    long long posted;
+    long long start;
+    double seconds;
+    BOOLEAN complete;
+    BOOLEAN failed;
+    ULONG p;
+    int option;
+
+    Bench.Producers = 4;
+    Bench.Lines = 50000;
+    Bench.LineLength = 80;
+
+    while ((option = getopt( argc, argv, "t:n:l:b:o:" )) != -1) {
+
+        switch (option) {
+
+            case 't':
+                Bench.Producers = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'n':
+                Bench.Lines = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'l':
+                Bench.LineLength = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'b':
+                Bench.Burst = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc ||
+        Bench.Producers == 0 || Bench.Producers > BENCH_MAX_PRODUCERS ||
+        Bench.Lines == 0 ||
+        Bench.LineLength < BENCH_MIN_LINE || Bench.LineLength > FILELOG_LINE_SIZE) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    if (output == NULL) {
+
+        if (mkdtemp( directory ) == NULL) {
+
+            perror( "mkdtemp" );
+            return 1;
+        }
+
+        output = directory;
+    }
+
+    snprintf( BenchLogFile, sizeof( BenchLogFile ), "%s/service.log", output );
+
+    if (!FileLogStart()) {
+
+        fprintf( stderr, "FileLogStart failed for %s\n", BenchLogFile );
+        return 1;
+    }
+
+    for (p = 0; p < Bench.Producers; p++) {
+
+        Bench.Producer[p].Index = p + 1;
+
+        if (pthread_create( &Bench.Producer[p].Thread, NULL, BenchProduce, &Bench.Producer[p] ) != 0) {
+
+            fprintf( stderr, "Could not start producer %u\n", p );
+            return 1;
+        }
+    }
+
+    start = BenchNow();
+    Bench.Go = 1;
+
+    for (p = 0; p < Bench.Producers; p++) {
+
+        pthread_join( Bench.Producer[p].Thread, NULL );
+
+        nanoseconds += Bench.Producer[p].Nanoseconds;
+        slowest = max( slowest, Bench.Producer[p].Slowest );
+    }
+
+    //
+    //  As the client stops it, once nothing else logs.
+    //
+
+    FileLogStop();
+    seconds = (BenchNow() - start) / 1e9;
+
+    BenchReadBack();
+
+    posted = (long long)Bench.Producers * Bench.Lines;
+    complete = FileLogState.Rotations <= FILELOG_KEEP;
+
+    printf( "Producers:        %u threads, %u lines of %u bytes each%s\n",
+            Bench.Producers,
+            Bench.Lines,
+            Bench.LineLength,
+            Bench.Burst ? ", in bursts" : "" );
+    printf( "Post:             %.0f ns mean, %.1f us slowest\n",
+            (double)nanoseconds / posted,
+            slowest / 1e3 );
+    printf( "Queued:           %lld of %lld lines, %lld dropped (%.2f%%), high water %lld of %u\n",
+            (long long)FileLogState.Lines,
+            posted,
+            (long long)FileLogState.Dropped,
+            100.0 * FileLogState.Dropped / posted,
+            (long long)FileLogState.HighWater,
+            FILELOG_SLOTS );
+    printf( "Written:          %.1f MB in %.2f s, %.0f lines a second, %lld rotations, %lld write errors\n",
+            FileLogState.Bytes / 1048576.0,
+            seconds,
+            FileLogState.Lines / seconds,
+            (long long)FileLogState.Rotations,
+            (long long)FileLogState.WriteErrors );
+    printf( "Read back:        %lld lines, %lld reported dropped, %lld torn, %lld out of order%s\n",
+            Bench.Found,
+            Bench.Reported,
+            Bench.Torn,
+            Bench.OutOfOrder,
+            complete ? "" : ", older lines were rotated away" );
+
+    failed = Bench.Torn != 0 ||
+             Bench.OutOfOrder != 0 ||
+             FileLogState.WriteErrors != 0 ||
+             FileLogState.Lines + FileLogState.Dropped != posted;
+
+    if (complete && (Bench.Found != FileLogState.Lines || Bench.Reported != FileLogState.Dropped)) {
+
+        printf( "Lost:             %lld queued lines and %lld drop reports are not in the log\n",
+                FileLogState.Lines - Bench.Found,
+                FileLogState.Dropped - Bench.Reported );
+        failed = TRUE;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,836 @@
+/*++
+
+Module Name:
+
+    mspyFilesBench.c
+
+Abstract:
+
+    Measures what storing file names once in Files, user/mspyFiles.c,
+    changes about MinifilterLog, in a Linux program against the types in
+    ushim/windows.h.
+
+    The same operations are logged into three databases made from the
+    client's own create.sql, files.sql and index.sql:
+
+        before      every row holds its name in OpFileName, indexed on
+                    OpFileName COLLATE NOCASE, as the writer logged before
+                    Files existed.
+
+        after       every row refers to its name by FileID, found through
+                    FilesLookup as the writer does now.
+
+        migrated    a copy of before run through files_migrate.sql, which
+                    must give every row the same name it had.
+
+    Rows are inserted with the writer's own statement, in batches of one
+    transaction each, on a connection in WAL mode with synchronous NORMAL
+    like the writer's.  Every column is bound much as DatabaseDump binds
+    it, so the names are the part that differs.  The files an operation
+    goes to are drawn from a fixed working set, skewed so a few files get
+    most of the operations, as they do on a real system.
+
+    For each database it prints the rows inserted a second, its size once
+    checkpointed, the bytes a row takes, and how long it takes to count
+    the operations by file, the summary rebuild's query, and to count
+    the operations below one directory, through the name index.
+
+    It returns 1 when the migrated names do not match.
+
+    Built on its own, for instance:
+
+        gcc -O2 -Iushim -o mspyFilesBench mspyFilesBench.c -lsqlite3
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../user/mspyFiles.c"
+#include "mspyBench.h"
+
+#define BENCH_PATH_SIZE     512
+
+typedef enum _BENCH_MODE {
+
+    BenchBefore,
+    BenchAfter,
+    BenchMigrated,
+    BenchModes
+
+} BENCH_MODE;
+
+static const char *BenchModeNames[BenchModes] = { "before", "after", "migrated" };
+
+//
+//  Queries each database is measured with.  Before, the summary rebuild
+//  counted by name and directories were matched on the OpFileName index.
+//
+
+static const char *BenchGroupSql[BenchModes] = {
+
+    "SELECT COALESCE(OpFileName, ''), COUNT(*) FROM MinifilterLog GROUP BY 1;",
+
+    "SELECT COALESCE(f.Path, r.OpFileName, ''), SUM(r.c) FROM "
+    "    (SELECT FileID, NULL OpFileName, COUNT(*) c FROM MinifilterLog WHERE FileID IS NOT NULL GROUP BY 1 "
+    "     UNION ALL "
+    "     SELECT NULL, OpFileName, COUNT(*) FROM MinifilterLog WHERE FileID IS NULL GROUP BY 2) r "
+    "    LEFT JOIN Files f ON f.FileID = r.FileID GROUP BY 1;",
+
+    "SELECT COALESCE(f.Path, r.OpFileName, ''), SUM(r.c) FROM "
+    "    (SELECT FileID, NULL OpFileName, COUNT(*) c FROM MinifilterLog WHERE FileID IS NOT NULL GROUP BY 1 "
+    "     UNION ALL "
+    "     SELECT NULL, OpFileName, COUNT(*) FROM MinifilterLog WHERE FileID IS NULL GROUP BY 2) r "
+    "    LEFT JOIN Files f ON f.FileID = r.FileID GROUP BY 1;"
+};
+
+static const char *BenchDirectorySql[BenchModes] = {
+
+    "SELECT COUNT(*) FROM MinifilterLog WHERE OpFileName LIKE ?1;",
+
+    "SELECT COUNT(*) FROM MinifilterLog WHERE FileID IN (SELECT FileID FROM Files WHERE Path LIKE ?1);",
+
+    "SELECT COUNT(*) FROM MinifilterLog WHERE FileID IN (SELECT FileID FROM Files WHERE Path LIKE ?1);"
+};
+
+static const char BenchDirectory[] = "\\Device\\HarddiskVolume3\\Users\\user03\\%";
+
+typedef struct _BENCH_RESULT {
+
+    double InsertSeconds;
+    double MigrateSeconds;
+    long long Bytes;
+    double GroupSeconds;
+    long long Groups;
+    double DirectorySeconds;
+    long long DirectoryRows;
+    unsigned long long Digest;
+
+} BENCH_RESULT;
+
+typedef struct _BENCH_STATE {
+
+    unsigned long long Rows;
+    ULONG FileCount;
+    ULONG Batch;
+    const char *SqlDirectory;
+    const char *OutDirectory;
+
+    //
+    //  The working set, and the file of every operation
+    //
+
+    char **Paths;
+    ULONG *Lengths;
+    ULONG *Picks;
+
+    BENCH_RESULT Results[BenchModes];
+    char Files[BenchModes][BENCH_PATH_SIZE];
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static int
+BenchExecFile (
+    sqlite3 *Db,
+    const char *Name
+    )
+/*++
+
+Routine Description:
+
+    Runs one of the client's .sql files, as ExecEmbeddedSQL runs it from
+    the resources.
+
+--*/
+{
+    char path[BENCH_PATH_SIZE];
+    char *text;
+    char *message = NULL;
+    FILE *file;
+    long size;
+    int rc;
+
+    snprintf( path, sizeof( path ), "%s/%s", Bench.SqlDirectory, Name );
+    file = fopen( path, "rb" );
+
+    if (file == NULL) {
+
+        fprintf( stderr, "Could not open %s\n", path );
+        return -1;
+    }
+
+    fseek( file, 0, SEEK_END );
+    size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    text = malloc( size + 1 );
+
+    if (text == NULL || fread( text, 1, size, file ) != (size_t)size) {
+
+        fprintf( stderr, "Could not read %s\n", path );
+        fclose( file );
+        free( text );
+        return -1;
+    }
+
+    fclose( file );
+    text[size] = '\0';
+
+    rc = sqlite3_exec( Db, text, NULL, NULL, &message );
+
+    if (rc != SQLITE_OK) {
+
+        fprintf( stderr, "%s: %s\n", Name, message ? message : sqlite3_errstr( rc ) );
+    }
+
+    sqlite3_free( message );
+    free( text );
+
+    return (rc == SQLITE_OK) ? 0 : -1;
+}
+
+static void
+BenchRemove (
+    const char *Path
+    )
+{
+    char path[BENCH_PATH_SIZE + 8];
+
+    unlink( Path );
+    snprintf( path, sizeof( path ), "%s-wal", Path );
+    unlink( path );
+    snprintf( path, sizeof( path ), "%s-shm", Path );
+    unlink( path );
+}
+
+static sqlite3 *
+BenchOpen (
+    const char *Path
+    )
+{
+    sqlite3 *db = NULL;
+
+    if (sqlite3_open( Path, &db ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not open %s: %s\n", Path, sqlite3_errmsg( db ) );
+        sqlite3_close( db );
+        return NULL;
+    }
+
+    sqlite3_exec( db, "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;", NULL, NULL, NULL );
+
+    return db;
+}
+
+static long long
+BenchClose (
+    sqlite3 *Db,
+    const char *Path
+    )
+/*++
+
+Routine Description:
+
+    Checkpoints and closes a database.
+
+Return Value:
+
+    Its size in bytes.
+
+--*/
+{
+    struct stat status;
+
+    sqlite3_exec( Db, "PRAGMA wal_checkpoint(TRUNCATE);", NULL, NULL, NULL );
+    sqlite3_close( Db );
+
+    return (stat( Path, &status ) == 0) ? (long long)status.st_size : -1;
+}
+
+static int
+BenchCopy (
+    const char *From,
+    const char *To
+    )
+{
+    char buffer[65536];
+    FILE *in;
+    FILE *out;
+    size_t length;
+    int rc = 0;
+
+    in = fopen( From, "rb" );
+    out = fopen( To, "wb" );
+
+    if (in == NULL || out == NULL) {
+
+        rc = -1;
+    }
+
+    while (rc == 0 && (length = fread( buffer, 1, sizeof( buffer ), in )) != 0) {
+
+        if (fwrite( buffer, 1, length, out ) != length) {
+
+            rc = -1;
+        }
+    }
+
+    if (in != NULL) {
+
+        fclose( in );
+    }
+
+    if (out != NULL && fclose( out ) != 0) {
+
+        rc = -1;
+    }
+
+    return rc;
+}
+
+static int
+BenchBuild (
+    void
+    )
+/*++
+
+Routine Description:
+
+    Makes up the working set of files, then picks the file of every
+    operation.  Squaring a uniform pick twice gives the first few files
+    most of the operations and leaves a long tail touched now and then.
+
+--*/
+{
+    static const char *const users[] = { "user01", "user02", "user03", "user04", "Administrator", "Public" };
+    static const char *const directories[] = {
+        "AppData\\Local\\Microsoft\\Windows\\INetCache\\IE",
+        "AppData\\Local\\Microsoft\\Edge\\User Data\\Default\\Cache\\Cache_Data",
+        "AppData\\Roaming\\Microsoft\\Windows\\Recent",
+        "AppData\\Local\\Temp",
+        "Documents\\Projects\\Quarterly Reports",
+        "Downloads" };
+    static const char *const extensions[] = { "tmp", "dat", "log", "docx", "json", "lnk" };
+    char path[BENCH_PATH_SIZE];
+    unsigned long long pick;
+    ULONG index;
+    int length;
+
+    Bench.Paths = calloc( Bench.FileCount, sizeof( char * ) );
+    Bench.Lengths = calloc( Bench.FileCount, sizeof( ULONG ) );
+    Bench.Picks = malloc( Bench.Rows * sizeof( ULONG ) );
+
+    if (Bench.Paths == NULL || Bench.Lengths == NULL || Bench.Picks == NULL) {
+
+        return -1;
+    }
+
+    for (index = 0; index < Bench.FileCount; index++) {
+
+        length = snprintf( path, sizeof( path ),
+                           "\\Device\\HarddiskVolume3\\Users\\%s\\%s\\%08X\\file%06u.%s",
+                           users[BenchRandom32() % 6],
+                           directories[BenchRandom32() % 6],
+                           BenchRandom32() & 0xFFFF0FFF,
+                           index,
+                           extensions[BenchRandom32() % 6] );
+
+        Bench.Paths[index] = strdup( path );
+        Bench.Lengths[index] = (ULONG)length;
+
+        if (Bench.Paths[index] == NULL) {
+
+            return -1;
+        }
+    }
+
+    for (pick = 0; pick < Bench.Rows; pick++) {
+
+        unsigned long long uniform = BenchRandom32();
+
+        uniform = uniform * uniform >> 32;
+        uniform = uniform * uniform >> 32;
+        Bench.Picks[pick] = (ULONG)(uniform * Bench.FileCount >> 32);
+    }
+
+    return 0;
+}
+
+static int
+BenchInsert (
+    sqlite3 *Db,
+    BENCH_MODE Mode,
+    BENCH_RESULT *Result
+    )
+/*++
+
+Routine Description:
+
+    Logs every operation into a database, the way DatabaseDump does.
+
+--*/
+{
+    static const char *images[] = {
+        "C:\\Windows\\System32\\svchost.exe",
+        "C:\\Program Files (x86)\\Microsoft\\Edge\\Application\\msedge.exe",
+        "C:\\Windows\\explorer.exe",
+        "C:\\Windows\\System32\\SearchIndexer.exe" };
+    static const char *majors[] = { "IRP_MJ_CREATE", "IRP_MJ_READ", "IRP_MJ_WRITE", "IRP_MJ_QUERY_INFORMATION",
+                                    "IRP_MJ_SET_INFORMATION", "IRP_MJ_CLEANUP", "IRP_MJ_CLOSE" };
+    const char *sql = "INSERT INTO MinifilterLog (SeqNum, OprType, PreOpTime, PostOpTime, ProcessId, ProcessFilePath, ThreadId, MajorOp, MinorOp, IrpFlags, DeviceObj, FileObj, FileTransaction, OpStatus, Information, Arg1, Arg2, Arg3, Arg4, Arg5, Arg6, OpFileName, RequestorMode, RuleID, RuleAction, StatusCode, ByteOffset, ByteLength, InfoClass, ControlCode, FileID) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    sqlite3_stmt *stmt = NULL;
+    unsigned long long row;
+    long long time = 133500000000000000LL;
+    long long start;
+    sqlite3_int64 fileId;
+    char pointer[32];
+    ULONG file;
+    ULONG major;
+
+    if (sqlite3_prepare_v2( Db, sql, -1, &stmt, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not prepare the insert: %s\n", sqlite3_errmsg( Db ) );
+        return -1;
+    }
+
+    if (Mode == BenchAfter && !FilesPrepare( Db )) {
+
+        fprintf( stderr, "Could not prepare the Files lookups: %s\n", sqlite3_errmsg( Db ) );
+        sqlite3_finalize( stmt );
+        return -1;
+    }
+
+    BenchCommon.Random = 88172645463325252ULL;
+    start = BenchNow();
+
+    for (row = 0; row < Bench.Rows; row++) {
+
+        if (row % Bench.Batch == 0) {
+
+            sqlite3_exec( Db, "BEGIN;", NULL, NULL, NULL );
+        }
+
+        file = Bench.Picks[row];
+        major = BenchRandom32() % 7;
+        time += 1 + BenchRandom32() % 2000;
+
+        sqlite3_bind_int64( stmt, 1, (sqlite3_int64)row );
+        sqlite3_bind_text( stmt, 2, "IRP", -1, SQLITE_TRANSIENT );
+        sqlite3_bind_int64( stmt, 3, time );
+        sqlite3_bind_int64( stmt, 4, time + BenchRandom32() % 500 );
+        sqlite3_bind_int64( stmt, 5, 4 * (1 + file % 64) );
+        sqlite3_bind_text( stmt, 6, images[file % 4], -1, SQLITE_TRANSIENT );
+        sqlite3_bind_int64( stmt, 7, 4 * (64 + file % 512) );
+        sqlite3_bind_text( stmt, 8, majors[major], -1, SQLITE_TRANSIENT );
+        sqlite3_bind_text( stmt, 9, "", -1, SQLITE_TRANSIENT );
+        sqlite3_bind_text( stmt, 10, "00000060", -1, SQLITE_TRANSIENT );
+        sqlite3_bind_text( stmt, 11, "FFFFB30C5A1E3030", -1, SQLITE_TRANSIENT );
+        snprintf( pointer, sizeof( pointer ), "FFFFB30C%08X", 0x7A4E0000 + file * 0x150 );
+        sqlite3_bind_text( stmt, 12, pointer, -1, SQLITE_TRANSIENT );
+        sqlite3_bind_text( stmt, 13, "0000000000000000", -1, SQLITE_TRANSIENT );
+        sqlite3_bind_text( stmt, 14, "STATUS_SUCCESS", -1, SQLITE_TRANSIENT );
+        snprintf( pointer, sizeof( pointer ), "%016X", BenchRandom32() % 65536 );
+        sqlite3_bind_text( stmt, 15, pointer, -1, SQLITE_TRANSIENT );
+        sqlite3_bind_int64( stmt, 16, BenchRandom32() );
+        sqlite3_bind_int64( stmt, 17, 0 );
+        sqlite3_bind_int64( stmt, 18, BenchRandom32() % 1048576 );
+        sqlite3_bind_int64( stmt, 19, 0 );
+        sqlite3_bind_int64( stmt, 20, 0 );
+        sqlite3_bind_int64( stmt, 21, 0 );
+        sqlite3_bind_text( stmt, 23, "User", -1, SQLITE_TRANSIENT );
+        sqlite3_bind_int64( stmt, 26, 0 );
+
+        if (major == 1 || major == 2) {
+
+            sqlite3_bind_int64( stmt, 27, BenchRandom32() % 1048576 * 4096 );
+            sqlite3_bind_int64( stmt, 28, 4096 );
+        }
+
+        fileId = (Mode == BenchAfter) ? FilesLookup( Bench.Paths[file], Bench.Lengths[file] ) : 0;
+
+        if (fileId != 0) {
+
+            sqlite3_bind_int64( stmt, 31, fileId );
+
+        } else {
+
+            sqlite3_bind_text( stmt, 22, Bench.Paths[file], (int)Bench.Lengths[file], SQLITE_TRANSIENT );
+        }
+
+        if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+            fprintf( stderr, "Insert failed: %s\n", sqlite3_errmsg( Db ) );
+            break;
+        }
+
+        sqlite3_reset( stmt );
+        sqlite3_clear_bindings( stmt );
+
+        if (row % Bench.Batch == Bench.Batch - 1 || row == Bench.Rows - 1) {
+
+            sqlite3_exec( Db, "COMMIT;", NULL, NULL, NULL );
+        }
+    }
+
+    Result->InsertSeconds = (BenchNow() - start) / 1e9;
+
+    sqlite3_finalize( stmt );
+
+    if (Mode == BenchAfter) {
+
+        printf( "    FilesLookup: %llu lookups, %llu read from Files, %llu added, %llu resets\n",
+                (unsigned long long)Files.Stats.Lookups,
+                (unsigned long long)Files.Stats.Reads,
+                (unsigned long long)Files.Stats.Added,
+                (unsigned long long)Files.Stats.Resets );
+
+        FilesFinalize();
+    }
+
+    return (row == Bench.Rows) ? 0 : -1;
+}
+
+static double
+BenchQuery (
+    sqlite3 *Db,
+    const char *Sql,
+    const char *Parameter,
+    long long *Rows
+    )
+/*++
+
+Routine Description:
+
+    Runs a query to the end three times.
+
+Return Value:
+
+    The fastest run in seconds, and the rows of the first row's first
+    column, or the number of rows when there are several.
+
+--*/
+{
+    sqlite3_stmt *stmt = NULL;
+    double best = 0;
+    long long start;
+    long long count;
+    double seconds;
+    int run;
+
+    if (sqlite3_prepare_v2( Db, Sql, -1, &stmt, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not prepare %s: %s\n", Sql, sqlite3_errmsg( Db ) );
+        return -1;
+    }
+
+    for (run = 0; run < 3; run++) {
+
+        if (Parameter != NULL) {
+
+            sqlite3_bind_text( stmt, 1, Parameter, -1, SQLITE_STATIC );
+        }
+
+        start = BenchNow();
+        count = 0;
+
+        while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+            count = (Parameter != NULL) ? sqlite3_column_int64( stmt, 0 ) : count + 1;
+        }
+
+        seconds = (BenchNow() - start) / 1e9;
+        sqlite3_reset( stmt );
+
+        if (run == 0 || seconds < best) {
+
+            best = seconds;
+        }
+    }
+
+    sqlite3_finalize( stmt );
+    *Rows = count;
+
+    return best;
+}
+
+static unsigned long long
+BenchDigest (
+    sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Hashes the name of every row, in LogID order, however it is stored.
+
+--*/
+{
+    sqlite3_stmt *stmt = NULL;
+    unsigned long long digest = 14695981039346656037ULL;
+    const unsigned char *name;
+    int length;
+    int index;
+
+    if (sqlite3_prepare_v2( Db,
+                            "SELECT COALESCE((SELECT Path FROM Files WHERE Files.FileID = MinifilterLog.FileID), OpFileName)"
+                            " FROM MinifilterLog ORDER BY LogID;",
+                            -1,
+                            &stmt,
+                            NULL ) != SQLITE_OK) {
+
+        return 0;
+    }
+
+    while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        name = sqlite3_column_text( stmt, 0 );
+        length = sqlite3_column_bytes( stmt, 0 );
+
+        for (index = 0; index < length; index++) {
+
+            digest = (digest ^ name[index]) * 1099511628211ULL;
+        }
+
+        digest = (digest ^ 0xFF) * 1099511628211ULL;
+    }
+
+    sqlite3_finalize( stmt );
+
+    return digest;
+}
+
+static void
+BenchMeasure (
+    sqlite3 *Db,
+    BENCH_MODE Mode
+    )
+{
+    BENCH_RESULT *result = &Bench.Results[Mode];
+
+    result->GroupSeconds = BenchQuery( Db, BenchGroupSql[Mode], NULL, &result->Groups );
+    result->DirectorySeconds = BenchQuery( Db, BenchDirectorySql[Mode], BenchDirectory, &result->DirectoryRows );
+    result->Digest = BenchDigest( Db );
+}
+
+static int
+BenchCreate (
+    BENCH_MODE Mode
+    )
+{
+    sqlite3 *db;
+
+    BenchRemove( Bench.Files[Mode] );
+    db = BenchOpen( Bench.Files[Mode] );
+
+    if (db == NULL) {
+
+        return -1;
+    }
+
+    //
+    //  As InitializeDatabaseFile and DatabaseOpenLog lay a new database
+    //  out, with the index on names the writer used to create
+    //
+
+    if (BenchExecFile( db, "create.sql" ) != 0 ||
+        BenchExecFile( db, "files.sql" ) != 0 ||
+        BenchExecFile( db, "index.sql" ) != 0 ||
+        (Mode == BenchBefore &&
+         sqlite3_exec( db,
+                       "CREATE INDEX Index_MinifilterLog_FileName ON MinifilterLog (OpFileName COLLATE NOCASE);",
+                       NULL, NULL, NULL ) != SQLITE_OK)) {
+
+        sqlite3_close( db );
+        return -1;
+    }
+
+    if (BenchInsert( db, Mode, &Bench.Results[Mode] ) != 0) {
+
+        sqlite3_close( db );
+        return -1;
+    }
+
+    BenchMeasure( db, Mode );
+    Bench.Results[Mode].Bytes = BenchClose( db, Bench.Files[Mode] );
+
+    return 0;
+}
+
+static int
+BenchMigrate (
+    void
+    )
+{
+    BENCH_RESULT *result = &Bench.Results[BenchMigrated];
+    sqlite3 *db;
+    long long start;
+
+    BenchRemove( Bench.Files[BenchMigrated] );
+
+    if (BenchCopy( Bench.Files[BenchBefore], Bench.Files[BenchMigrated] ) != 0) {
+
+        fprintf( stderr, "Could not copy %s\n", Bench.Files[BenchBefore] );
+        return -1;
+    }
+
+    db = BenchOpen( Bench.Files[BenchMigrated] );
+
+    if (db == NULL) {
+
+        return -1;
+    }
+
+    start = BenchNow();
+
+    if (BenchExecFile( db, "files_migrate.sql" ) != 0) {
+
+        sqlite3_close( db );
+        return -1;
+    }
+
+    result->MigrateSeconds = (BenchNow() - start) / 1e9;
+
+    BenchMeasure( db, BenchMigrated );
+    result->Bytes = BenchClose( db, Bench.Files[BenchMigrated] );
+
+    return 0;
+}
+
+static void
+BenchUsage (
+    void
+    )
+{
+    printf( "Usage: mspyFilesBench [-n <operations>] [-f <files>] [-b <batch>] [-s <sql directory>] [-o <directory>]\n"
+            "\n"
+            "    [-n <operations>] operations logged, 1000000 by default\n"
+            "    [-f <files>] files in the working set, 20000 by default\n"
+            "    [-b <batch>] operations a transaction, 1000 by default\n"
+            "    [-s <sql directory>] where create.sql and the others are, ../user by default\n"
+            "    [-o <directory>] where the databases are written, /tmp by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    BENCH_RESULT *result;
+    int option;
+    int mode;
+
+    Bench.Rows = 1000000;
+    Bench.FileCount = 20000;
+    Bench.Batch = 1000;
+    Bench.SqlDirectory = "../user";
+    Bench.OutDirectory = "/tmp";
+
+    while ((option = getopt( argc, argv, "n:f:b:s:o:" )) != -1) {
+
+        switch (option) {
+
+            case 'n':
+                Bench.Rows = strtoull( optarg, NULL, 0 );
+                break;
+
+            case 'f':
+                Bench.FileCount = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'b':
+                Bench.Batch = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 's':
+                Bench.SqlDirectory = optarg;
+                break;
+
+            case 'o':
+                Bench.OutDirectory = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (Bench.Rows == 0 || Bench.FileCount == 0 || Bench.Batch == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    for (mode = 0; mode < BenchModes; mode++) {
+
+        snprintf( Bench.Files[mode], BENCH_PATH_SIZE, "%s/mspyFilesBench-%s.db", Bench.OutDirectory, BenchModeNames[mode] );
+    }
+
+    if (BenchBuild() != 0) {
+
+        fprintf( stderr, "Out of memory\n" );
+        return 2;
+    }
+
+    printf( "Logging %llu operations on %u files, %u a transaction:\n", Bench.Rows, Bench.FileCount, Bench.Batch );
+
+    if (BenchCreate( BenchBefore ) != 0 || BenchCreate( BenchAfter ) != 0 || BenchMigrate() != 0) {
+
+        return 2;
+    }
+
+    printf( "\n    %-10s %12s %10s %7s %12s %12s\n", "", "rows/s", "MB", "B/row", "by file ms", "by dir ms" );
+
+    for (mode = 0; mode < BenchModes; mode++) {
+
+        result = &Bench.Results[mode];
+
+        if (mode == BenchMigrated) {
+
+            printf( "    %-10s %12s", BenchModeNames[mode], "" );
+
+        } else {
+
+            printf( "    %-10s %12.0f", BenchModeNames[mode], Bench.Rows / result->InsertSeconds );
+        }
+
+        printf( " %10.1f %7.1f %12.1f %12.2f\n",
+                result->Bytes / 1048576.0,
+                (double)result->Bytes / Bench.Rows,
+                result->GroupSeconds * 1000,
+                result->DirectorySeconds * 1000 );
+    }
+
+    printf( "\n    Migration took %.2f s.  %lld, %lld and %lld files counted, %lld, %lld and %lld operations below %s\n",
+            Bench.Results[BenchMigrated].MigrateSeconds,
+            Bench.Results[BenchBefore].Groups,
+            Bench.Results[BenchAfter].Groups,
+            Bench.Results[BenchMigrated].Groups,
+            Bench.Results[BenchBefore].DirectoryRows,
+            Bench.Results[BenchAfter].DirectoryRows,
+            Bench.Results[BenchMigrated].DirectoryRows,
+            BenchDirectory );
+
+    if (Bench.Results[BenchMigrated].Digest != Bench.Results[BenchBefore].Digest ||
+        Bench.Results[BenchAfter].Digest != Bench.Results[BenchBefore].Digest) {
+
+        printf( "    Names differ between the databases\n" );
+        return 1;
+    }
+
+    printf( "    Every row has the same name in all three\n" );
+
+    return 0;
+}
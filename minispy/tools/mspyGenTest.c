@@ -0,0 +1,1325 @@
+/*++
+
+Module Name:
+
+    mspyGenTest.c
+
+Abstract:
+
+    Checks and measures the synthetic workload generator, user/mspyGen.c,
+    in a Linux program against ushim.
+
+    mspyGen.c is included rather than linked, with user/mspyArgs.c to
+    read the arguments of the records back.  Buffers are generated with
+    GenSample for a number of configurations, and every buffer is walked
+    as RetrieveLogRecords walks what GetMiniSpyLog returns:
+
+        every record starts PVOID aligned where the one before ends, is
+        sizeof(LOG_RECORD) plus its null terminated name rounded up to
+        PVOID long, no longer than MAX_LOG_RECORD_LENGTH, and the records
+        fill the bytes returned exactly, leaving less than
+        MAX_LOG_RECORD_LENGTH of the buffer unused;
+
+        sequence numbers follow on across buffers, every process is
+        reported once with a create record before its first operation,
+        and every operation comes from a thread of its process;
+
+        each thread opens a file, issues operations on the file object
+        of that open and on the path it opened, cleans up and closes, and
+        no two opens share a file object;
+
+        names are laid out as the filter names files, are as long as
+        asked, and a path always has the same name;
+
+        the arguments ArgsDecode reads, the statuses and the times are
+        those of the major function.
+
+    Then the frequencies: paths opened and processes issuing operations
+    against the Zipf law with the configured exponents, major functions
+    picked on an open file against their weights, by chi-square with
+    bins of at least 5 expected, and failures against the configured
+    percentage.  A z over 5 fails.  Generating again with the same seed
+    must give the same bytes, another seed other bytes.
+
+    GenStart and GenFill are run on a simulated clock: records must come
+    evenly spaced on the rate from the start, exactly as many as are due,
+    none when none is due; a pipeline too slow for the rate must find
+    the records it has not taken still due, with their times, and
+    GenStop must stop them.  GenSetOption and GenStart must refuse what
+    is out of range.
+
+    It prints the records and MB a second GenSample and GenFill generate.
+    mspyPerfBench measures the pipeline fed by the generator.
+
+    It returns 1 when a check fails.
+
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspyGenTest mspyGenTest.c -lsqlite3 -lm
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../user/mspyArgs.c"
+#include "../user/mspyGen.c"
+#include "mspyBench.h"
+
+#define BENCH_START             132000000000000000LL
+#define BENCH_BUFFERS           1024
+#define BENCH_MAX_Z             5.0
+#define BENCH_FIXED_NAME        51          // a name with no directory and a 4 character extension
+
+typedef struct _BENCH_THREAD {
+
+    ULONG State;
+    ULONG Path;
+    ULONG_PTR FileObject;
+
+} BENCH_THREAD, *PBENCH_THREAD;
+
+//
+//  What walking the records of one configuration found.
+//
+
+typedef struct _BENCH_WALK {
+
+    GEN_CONFIG Config;
+    const char *Name;
+
+    ULONG Sequence;
+    ULONG ProcessRecords;
+    BOOLEAN Reported[GEN_MAX_PROCESSES];
+    PBENCH_THREAD Threads;
+
+    ULONGLONG *NameHashes;          // by path rank, 0 until seen
+    ULONG *PathCounts;              // opens by path rank
+    ULONG ProcessCounts[GEN_MAX_PROCESSES];
+    ULONG Picks[GEN_MAJORS];        // majors picked on an open file, create as cleanup
+
+    ULONG_PTR *FileObjects;
+    ULONG Opens;
+    ULONG OpensSize;
+
+    ULONG Operations;
+    ULONG Eligible;                 // operations that may fail
+    ULONG Failed;
+
+    LONGLONG LastTime;
+
+} BENCH_WALK, *PBENCH_WALK;
+
+typedef struct _BENCH_STATE {
+
+    PVOID Buffers;
+    DWORD Bytes[BENCH_BUFFERS];
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static VOID
+BenchExpect (
+    _In_ BOOLEAN Holds,
+    _In_z_ const char *Check,
+    _In_ PBENCH_WALK Walk,
+    _In_ const LOG_RECORD *Record
+    )
+{
+    char detail[160];
+
+    BenchCommon.Checks++;
+
+    if (!Holds) {
+
+        snprintf( detail, sizeof( detail ), "%s, record %u, type %u, major %u, length %u",
+                  Walk->Name, (unsigned)Record->SequenceNumber, (unsigned)Record->RecordType,
+                  (unsigned)Record->Data.CallbackMajorId, (unsigned)Record->Length );
+        BenchFail( Check, detail );
+    }
+}
+
+static BOOLEAN
+BenchIn (
+    _In_ ULONG Value,
+    _In_reads_(Count) const ULONG *Values,
+    _In_ ULONG Count
+    )
+{
+    while (Count-- != 0) {
+
+        if (Values[Count] == Value) {
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static BOOLEAN
+BenchNameLaidOut (
+    _In_reads_(NameLength) const WCHAR *Name,
+    _In_ ULONG NameLength,
+    _In_ const WCHAR *File
+    )
+/*++
+
+Routine Description:
+
+    Checks a name is laid out as the filter would name a file under a
+    profile, \Device\HarddiskVolume3\Users\userNN\dXXXX\...\File, NN
+    00 to 15 and XXXX 0000 to ffff in steps of 0x111.
+
+--*/
+{
+    static const char prefix[] = "\\Device\\HarddiskVolume3\\Users\\user";
+    const WCHAR *next;
+    ULONG value;
+    ULONG index;
+
+    if (NameLength < sizeof( prefix ) - 1 + 3) {
+
+        return FALSE;
+    }
+
+    for (index = 0; index < sizeof( prefix ) - 1; index++) {
+
+        if (Name[index] != (WCHAR)prefix[index]) {
+
+            return FALSE;
+        }
+    }
+
+    next = Name + index;
+
+    if (next[0] < L'0' || next[0] > L'9' || next[1] < L'0' || next[1] > L'9' ||
+        (next[0] - L'0') * 10 + (next[1] - L'0') > 15 || next[2] != L'\\') {
+
+        return FALSE;
+    }
+
+    for (next += 3; next < File; next += 6) {
+
+        if (File - next < 6 || next[0] != L'd' || next[5] != L'\\') {
+
+            return FALSE;
+        }
+
+        for (index = 1, value = 0; index <= 4; index++) {
+
+            if (next[index] >= L'0' && next[index] <= L'9') {
+
+                value = value * 16 + (next[index] - L'0');
+
+            } else if (next[index] >= L'a' && next[index] <= L'f') {
+
+                value = value * 16 + (next[index] - L'a' + 10);
+
+            } else {
+
+                return FALSE;
+            }
+        }
+
+        if (value % 0x111 != 0) {
+
+            return FALSE;
+        }
+    }
+
+    return (next == File);
+}
+
+static int
+BenchCompareFileObjects (
+    _In_ const void *A,
+    _In_ const void *B
+    )
+{
+    ULONG_PTR a = *(const ULONG_PTR *)A;
+    ULONG_PTR b = *(const ULONG_PTR *)B;
+
+    return (a < b) ? -1 : (a > b);
+}
+
+static VOID
+BenchCheckOperation (
+    _Inout_ PBENCH_WALK Walk,
+    _In_ const LOG_RECORD *Record,
+    _In_ ULONG NameLength
+    )
+{
+    const RECORD_DATA *data = &Record->Data;
+    PBENCH_THREAD thread;
+    RECORD_ARGS args;
+    const WCHAR *file;
+    ULONGLONG hash = 14695981039346656037ULL;
+    ULONG processIndex;
+    ULONG threadIndex;
+    ULONG path = 0;
+    ULONG index;
+    UCHAR major = data->CallbackMajorId;
+    BOOLEAN failed = (data->Status != 0);
+
+    processIndex = (ULONG)((data->ProcessId - 0x1000) / 4);
+    threadIndex = (ULONG)((data->ThreadId - 0x10000) / 4);
+
+    BenchExpect( data->ProcessId >= 0x1000 && processIndex < Walk->Config.Processes && Walk->Reported[processIndex] &&
+                 data->ThreadId >= 0x10000 && threadIndex / Walk->Config.Threads == processIndex,
+                 "operations from a thread of a reported process", Walk, Record );
+
+    if (BenchCommon.Failures != 0 && !(processIndex < Walk->Config.Processes && threadIndex / Walk->Config.Threads == processIndex)) {
+
+        return;
+    }
+
+    Walk->Operations++;
+    Walk->ProcessCounts[processIndex]++;
+
+    //
+    //  The rank is in the file name, fXXXXXXXX.
+    //
+
+    for (file = Record->Name + NameLength; file > Record->Name && file[-1] != L'\\'; file--);
+
+    for (index = 1; index <= 8; index++) {
+
+        path = path * 16 + (ULONG)((file[index] <= L'9') ? file[index] - L'0' : file[index] - L'a' + 10);
+    }
+
+    BenchExpect( file[0] == L'f' && path >= 1 && path <= Walk->Config.Paths, "names carry their path", Walk, Record );
+    BenchExpect( BenchNameLaidOut( Record->Name, NameLength, file ), "names laid out as the filter's", Walk, Record );
+
+    if (path < 1 || path > Walk->Config.Paths) {
+
+        return;
+    }
+
+    for (index = 0; index < NameLength; index++) {
+
+        hash = (hash ^ Record->Name[index]) * 1099511628211ULL;
+    }
+
+    BenchExpect( Walk->NameHashes[path] == 0 || Walk->NameHashes[path] == hash, "a path keeps its name", Walk, Record );
+    Walk->NameHashes[path] = hash;
+
+    BenchExpect( (Walk->Config.NameMin >= BENCH_FIXED_NAME) ?
+                     (NameLength >= Walk->Config.NameMin && NameLength <= Walk->Config.NameMax) :
+                     (NameLength <= max( Walk->Config.NameMax, BENCH_FIXED_NAME )),
+                 "names as long as asked", Walk, Record );
+
+    BenchExpect( data->CompletionTime.QuadPart > data->OriginatingTime.QuadPart &&
+                 data->OriginatingTime.QuadPart > Walk->LastTime,
+                 "times in order", Walk, Record );
+    Walk->LastTime = data->OriginatingTime.QuadPart;
+
+    //
+    //  A session a thread at a time: create, operations, cleanup, close.
+    //
+
+    thread = &Walk->Threads[threadIndex];
+
+    if (thread->State == GEN_FILE_NONE) {
+
+        BenchExpect( major == IRP_MJ_CREATE, "a thread opens a file first", Walk, Record );
+
+        Walk->PathCounts[path]++;
+
+        if (!failed) {
+
+            thread->State = GEN_FILE_OPEN;
+            thread->Path = path;
+            thread->FileObject = data->FileObject;
+
+            if (Walk->Opens == Walk->OpensSize) {
+
+                Walk->OpensSize = max( 1 << 16, Walk->OpensSize * 2 );
+                Walk->FileObjects = realloc( Walk->FileObjects, Walk->OpensSize * sizeof( ULONG_PTR ) );
+
+                if (Walk->FileObjects == NULL) {
+
+                    printf( "Could not allocate the file objects\n" );
+                    exit( 2 );
+                }
+            }
+
+            Walk->FileObjects[Walk->Opens++] = data->FileObject;
+        }
+
+    } else if (thread->State == GEN_FILE_OPEN) {
+
+        BenchExpect( major != IRP_MJ_CREATE && major != IRP_MJ_CLOSE && major < GEN_MAJORS,
+                     "an open file gets operations or a cleanup", Walk, Record );
+        BenchExpect( data->FileObject == thread->FileObject && path == thread->Path,
+                     "operations on the file object and path opened", Walk, Record );
+
+        if (major < GEN_MAJORS) {
+
+            Walk->Picks[major]++;
+        }
+
+        if (major == IRP_MJ_CLEANUP) {
+
+            thread->State = GEN_FILE_CLEANED_UP;
+        }
+
+    } else {
+
+        BenchExpect( major == IRP_MJ_CLOSE && data->FileObject == thread->FileObject,
+                     "a cleaned up file is closed", Walk, Record );
+        thread->State = GEN_FILE_NONE;
+    }
+
+    if (major != IRP_MJ_CLEANUP && major != IRP_MJ_CLOSE) {
+
+        Walk->Eligible++;
+        Walk->Failed += failed;
+
+    } else {
+
+        BenchExpect( !failed, "cleanups and closes succeed", Walk, Record );
+    }
+
+    //
+    //  The arguments as the pipeline will read them.
+    //
+
+    ArgsDecode( (PRECORD_DATA)data, &args );
+
+    switch (major) {
+
+    case IRP_MJ_READ:
+    case IRP_MJ_WRITE:
+
+        BenchExpect( args.Valid == (ARGS_OFFSET | ARGS_LENGTH) &&
+                     args.Length >= 0x1000 && args.Length <= 0x10000 && (args.Length & (args.Length - 1)) == 0 &&
+                     args.Offset >= 0 && (args.Offset & 0xFFF) == 0 &&
+                     data->Information == (failed ? 0 : args.Length) &&
+                     FlagOn( data->IrpFlags, (major == IRP_MJ_READ) ? IRP_READ_OPERATION : IRP_WRITE_OPERATION ),
+                     "reads and writes of pages", Walk, Record );
+        break;
+
+    case IRP_MJ_QUERY_INFORMATION:
+
+        BenchExpect( args.Valid == (ARGS_LENGTH | ARGS_INFO_CLASS) &&
+                     BenchIn( args.InfoClass, GenQueryClasses, ARRAYSIZE( GenQueryClasses ) ),
+                     "queries of a known class", Walk, Record );
+        break;
+
+    case IRP_MJ_SET_INFORMATION:
+
+        BenchExpect( args.Valid == (ARGS_LENGTH | ARGS_INFO_CLASS) &&
+                     BenchIn( args.InfoClass, GenSetClasses, ARRAYSIZE( GenSetClasses ) ),
+                     "sets of a known class", Walk, Record );
+        break;
+
+    case IRP_MJ_DIRECTORY_CONTROL:
+
+        BenchExpect( data->CallbackMinorId == IRP_MN_QUERY_DIRECTORY &&
+                     args.Valid == (ARGS_LENGTH | ARGS_INFO_CLASS) && args.Length == 0x1000 &&
+                     data->Information <= 0x1000,
+                     "directory queries", Walk, Record );
+        break;
+
+    case IRP_MJ_FILE_SYSTEM_CONTROL:
+
+        BenchExpect( args.Valid == ARGS_CONTROL_CODE &&
+                     BenchIn( args.ControlCode, GenControlCodes, ARRAYSIZE( GenControlCodes ) ),
+                     "FSCTLs of a known code", Walk, Record );
+        break;
+
+    case IRP_MJ_LOCK_CONTROL:
+
+        BenchExpect( args.Valid == (ARGS_OFFSET | ARGS_LENGTH) && args.Length == 0x1000 && (args.Offset & 0xFFF) == 0,
+                     "locks of a page", Walk, Record );
+        break;
+
+    case IRP_MJ_CREATE:
+
+        BenchExpect( FlagOn( data->IrpFlags, IRP_CREATE_OPERATION ) &&
+                     (failed ? data->Status == GEN_STATUS_OBJECT_NAME_NOT_FOUND : data->Information == GEN_FILE_OPENED),
+                     "creates open or fail as not found", Walk, Record );
+        break;
+    }
+}
+
+static VOID
+BenchCheckBuffer (
+    _Inout_ PBENCH_WALK Walk,
+    _In_reads_bytes_(Bytes) PVOID Buffer,
+    _In_ DWORD Bytes,
+    _In_ DWORD BufferSize,
+    _In_ BOOLEAN Full
+    )
+/*++
+
+Routine Description:
+
+    Walks a buffer as RetrieveLogRecords does and checks every record.
+    Full is TRUE when more records were due than the buffer took.
+
+--*/
+{
+    const LOG_RECORD *record;
+    ULONG nameLength;
+    ULONG processIndex;
+    DWORD used = 0;
+
+    BenchCommon.Checks++;
+
+    if (Bytes > BufferSize || (Full && BufferSize - Bytes >= MAX_LOG_RECORD_LENGTH)) {
+
+        BenchFail( "buffers filled", Walk->Name );
+        return;
+    }
+
+    while (used < Bytes) {
+
+        record = (const LOG_RECORD *)Add2Ptr( Buffer, used );
+
+        BenchCommon.Checks++;
+
+        if (record->Length < sizeof( LOG_RECORD ) + sizeof( WCHAR ) ||
+            record->Length > MAX_LOG_RECORD_LENGTH ||
+            used + record->Length > Bytes) {
+
+            BenchExpect( FALSE, "records within the buffer", Walk, record );
+            return;
+        }
+
+        for (nameLength = 0;
+             (sizeof( LOG_RECORD ) + (nameLength + 1) * sizeof( WCHAR )) <= record->Length && record->Name[nameLength] != UNICODE_NULL;
+             nameLength++);
+
+        BenchExpect( record->Length == ROUND_TO_SIZE( sizeof( LOG_RECORD ) + (nameLength + 1) * sizeof( WCHAR ), sizeof( PVOID ) ) &&
+                     (record->Length % sizeof( PVOID )) == 0,
+                     "records as long as their name rounded up to PVOID", Walk, record );
+
+        BenchExpect( record->SequenceNumber == Walk->Sequence + 1, "sequence numbers follow on", Walk, record );
+        Walk->Sequence = record->SequenceNumber;
+
+        if (record->RecordType == RECORD_TYPE_PROCESS) {
+
+            processIndex = (ULONG)((record->Data.ProcessId - 0x1000) / 4);
+
+            BenchExpect( record->SequenceNumber == Walk->ProcessRecords + 1 && processIndex < Walk->Config.Processes &&
+                         !Walk->Reported[processIndex] && record->Data.CallbackMinorId == PROCESS_RECORD_CREATE &&
+                         record->Data.OriginatingTime.QuadPart < BENCH_START,
+                         "processes reported once, before operations", Walk, record );
+
+            if (processIndex < Walk->Config.Processes) {
+
+                Walk->Reported[processIndex] = TRUE;
+                Walk->ProcessRecords++;
+            }
+
+        } else {
+
+            BenchExpect( record->RecordType == RECORD_TYPE_NORMAL && Walk->ProcessRecords == Walk->Config.Processes,
+                         "operations after every process", Walk, record );
+
+            BenchCheckOperation( Walk, record, nameLength );
+        }
+
+        used += record->Length;
+    }
+}
+
+static double
+BenchChiSquare (
+    _In_ PBENCH_WALK Walk,
+    _In_z_ const char *What,
+    _In_reads_(Count) const ULONG *Observed,
+    _In_reads_(Count) const double *Probability,
+    _In_ ULONG Count
+    )
+/*++
+
+Routine Description:
+
+    Compares counts with their probabilities, in bins of at least 5
+    expected.
+
+Return Value:
+
+    The z of the chi-square statistic, by Wilson and Hilferty.
+
+--*/
+{
+    ULONGLONG total = 0;
+    double expected = 0;
+    double observed = 0;
+    double chi = 0;
+    double z;
+    double df;
+    ULONG bins = 0;
+    ULONG index;
+    char detail[160];
+
+    for (index = 0; index < Count; index++) {
+
+        total += Observed[index];
+    }
+
+    for (index = 0; index < Count; index++) {
+
+        expected += Probability[index] * total;
+        observed += Observed[index];
+
+        if (expected >= 5 || index == Count - 1) {
+
+            if (expected > 0) {
+
+                chi += (observed - expected) * (observed - expected) / expected;
+                bins++;
+
+            } else if (observed > 0) {
+
+                chi = INFINITY;
+            }
+
+            expected = 0;
+            observed = 0;
+        }
+    }
+
+    df = (bins > 1) ? bins - 1 : 1;
+    z = (pow( chi / df, 1.0 / 3.0 ) - (1 - 2 / (9 * df))) / sqrt( 2 / (9 * df) );
+
+    BenchCommon.Checks++;
+
+    if (!(z <= BENCH_MAX_Z)) {
+
+        snprintf( detail, sizeof( detail ), "%s, %s: chi-square %.1f over %u bins, z %.1f",
+                  Walk->Name, What, chi, bins, z );
+        BenchFail( "frequencies as configured", detail );
+    }
+
+    return z;
+}
+
+static VOID
+BenchZipf (
+    _In_ ULONG Count,
+    _In_ ULONG Skew,
+    _Out_writes_(Count) double *Probability
+    )
+{
+    double sum = 0;
+    ULONG index;
+
+    for (index = 0; index < Count; index++) {
+
+        Probability[index] = pow( index + 1, -(Skew / 100.0) );
+        sum += Probability[index];
+    }
+
+    for (index = 0; index < Count; index++) {
+
+        Probability[index] /= sum;
+    }
+}
+
+static VOID
+BenchCheckConfig (
+    _In_z_ const char *Name,
+    _In_z_ const char *Options,
+    _In_ ULONG Records
+    )
+/*++
+
+Routine Description:
+
+    Generates at least Records operations with the default configuration
+    changed by Options, space separated, and checks them.
+
+--*/
+{
+    static BENCH_WALK walk;
+    GEN_CONFIG config;
+    double *probability;
+    ULONG observed[GEN_MAJORS];
+    double weights[GEN_MAJORS];
+    char options[256];
+    char detail[200];
+    char *option;
+    char *next;
+    ULONG failedPercent;
+    ULONG majors = 0;
+    ULONG major;
+    ULONG index;
+    ULONG opens = 0;
+    double zPaths;
+    double zProcesses;
+    double zMajors = 0;
+    double zFailed;
+    double rate;
+
+    GenDefaultConfig( &config );
+    config.Rate = 0;
+    config.Seed = 0x5EEDULL;
+
+    snprintf( options, sizeof( options ), "%s", Options );
+
+    for (option = strtok_r( options, " ", &next ); option != NULL; option = strtok_r( NULL, " ", &next )) {
+
+        if (!GenSetOption( &config, option )) {
+
+            BenchFail( "options of the configurations taken", option );
+            return;
+        }
+    }
+
+    free( walk.Threads );
+    free( walk.NameHashes );
+    free( walk.PathCounts );
+    free( walk.FileObjects );
+    memset( &walk, 0, sizeof( walk ) );
+
+    walk.Config = config;
+    walk.Name = Name;
+    walk.LastTime = BENCH_START - 1;
+    walk.Threads = calloc( (SIZE_T)config.Processes * config.Threads, sizeof( BENCH_THREAD ) );
+    walk.NameHashes = calloc( (SIZE_T)config.Paths + 1, sizeof( ULONGLONG ) );
+    walk.PathCounts = calloc( (SIZE_T)config.Paths + 1, sizeof( ULONG ) );
+
+    if (walk.Threads == NULL || walk.NameHashes == NULL || walk.PathCounts == NULL) {
+
+        printf( "Could not allocate the walk\n" );
+        exit( 2 );
+    }
+
+    //
+    //  Every GenSample runs a generator of its own from the start, so
+    //  each call is walked as a stream of its own, with another seed.
+    //  The frequencies add up over the calls.
+    //
+
+    while (walk.Operations < Records) {
+
+        if (!GenSample( &config, BENCH_START, Bench.Buffers, BUFFER_SIZE, BENCH_BUFFERS, Bench.Bytes )) {
+
+            BenchFail( "configurations accepted", Name );
+            return;
+        }
+
+        walk.Config.Seed = config.Seed;
+        walk.Sequence = 0;
+        walk.ProcessRecords = 0;
+        walk.Opens = 0;
+        walk.LastTime = BENCH_START - 1;
+        memset( walk.Reported, 0, sizeof( walk.Reported ) );
+        memset( walk.Threads, 0, (SIZE_T)config.Processes * config.Threads * sizeof( BENCH_THREAD ) );
+        memset( walk.NameHashes, 0, ((SIZE_T)config.Paths + 1) * sizeof( ULONGLONG ) );
+
+        for (index = 0; index < BENCH_BUFFERS; index++) {
+
+            BenchCheckBuffer( &walk, Add2Ptr( Bench.Buffers, (SIZE_T)index * BUFFER_SIZE ), Bench.Bytes[index], BUFFER_SIZE, TRUE );
+        }
+
+        //
+        //  No two opens share a file object.
+        //
+
+        qsort( walk.FileObjects, walk.Opens, sizeof( ULONG_PTR ), BenchCompareFileObjects );
+
+        for (index = 1; index < walk.Opens; index++) {
+
+            if (walk.FileObjects[index] == walk.FileObjects[index - 1]) {
+
+                break;
+            }
+        }
+
+        BenchCommon.Checks++;
+
+        if (index < walk.Opens) {
+
+            BenchFail( "a file object an open", Name );
+        }
+
+        opens += walk.Opens;
+        config.Seed = GenMix( config.Seed );
+    }
+
+    //
+    //  Paths, processes and majors against the configuration.
+    //
+
+    probability = malloc( (max( config.Paths, config.Processes ) + 1) * sizeof( double ) );
+
+    if (probability == NULL) {
+
+        printf( "Could not allocate the probabilities\n" );
+        exit( 2 );
+    }
+
+    BenchZipf( config.Paths, config.Skew, probability );
+    zPaths = BenchChiSquare( &walk, "paths", walk.PathCounts + 1, probability, config.Paths );
+
+    BenchZipf( config.Processes, config.ProcessSkew, probability );
+    zProcesses = BenchChiSquare( &walk, "processes", walk.ProcessCounts, probability, config.Processes );
+
+    free( probability );
+
+    for (major = 0; major < GEN_MAJORS; major++) {
+
+        if (major == IRP_MJ_CREATE || major == IRP_MJ_CLOSE) {
+
+            BenchCommon.Checks++;
+
+            if (walk.Picks[major] != 0) {
+
+                BenchFail( "majors picked on an open file", Name );
+            }
+
+            continue;
+        }
+
+        weights[majors] = (major == IRP_MJ_CLEANUP) ? config.Weights[IRP_MJ_CREATE] : config.Weights[major];
+
+        if (weights[majors] == 0) {
+
+            BenchCommon.Checks++;
+
+            if (walk.Picks[major] != 0) {
+
+                snprintf( detail, sizeof( detail ), "%s: major %u weighs nothing, picked %u times", Name, major, walk.Picks[major] );
+                BenchFail( "majors weighing nothing not issued", detail );
+            }
+
+            continue;
+        }
+
+        observed[majors++] = walk.Picks[major];
+    }
+
+    if (config.Failures < 100) {
+
+        double total = 0;
+
+        for (index = 0; index < majors; index++) {
+
+            total += weights[index];
+        }
+
+        for (index = 0; index < majors; index++) {
+
+            weights[index] /= total;
+        }
+
+        zMajors = BenchChiSquare( &walk, "majors", observed, weights, majors );
+    }
+
+    rate = config.Failures / 100.0;
+    zFailed = (rate == 0 || rate == 1) ?
+                  ((walk.Failed == (ULONG)(rate * walk.Eligible)) ? 0 : INFINITY) :
+                  fabs( walk.Failed - rate * walk.Eligible ) / sqrt( walk.Eligible * rate * (1 - rate) );
+
+    BenchCommon.Checks++;
+
+    if (!(zFailed <= BENCH_MAX_Z)) {
+
+        snprintf( detail, sizeof( detail ), "%s: %u of %u failed, %u%% asked", Name, walk.Failed, walk.Eligible, config.Failures );
+        BenchFail( "failures as configured", detail );
+    }
+
+    failedPercent = (walk.Eligible != 0) ? (ULONG)(100.0 * walk.Failed / walk.Eligible + 0.5) : 0;
+
+    printf( "    %-10s %8u operations, %7u opens, %2u%% failed; z of paths %5.1f, processes %5.1f, majors %5.1f, failures %4.1f\n",
+            Name, walk.Operations, opens, failedPercent, zPaths, zProcesses, zMajors, zFailed );
+}
+
+static VOID
+BenchCheckSeed (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    The same seed must give the same bytes, another seed other bytes.
+
+--*/
+{
+    GEN_CONFIG config;
+    PVOID again;
+    DWORD bytes[4];
+    DWORD bytesAgain[4];
+    ULONG index;
+
+    again = malloc( 4 * BUFFER_SIZE );
+
+    if (again == NULL) {
+
+        printf( "Could not allocate the buffers\n" );
+        exit( 2 );
+    }
+
+    GenDefaultConfig( &config );
+    config.Seed = 42;
+
+    GenSample( &config, BENCH_START, Bench.Buffers, BUFFER_SIZE, 4, bytes );
+    GenSample( &config, BENCH_START, again, BUFFER_SIZE, 4, bytesAgain );
+
+    BenchCommon.Checks++;
+
+    if (memcmp( bytes, bytesAgain, sizeof( bytes ) ) != 0) {
+
+        BenchFail( "same seed, same records", "they differ" );
+
+    } else {
+
+        for (index = 0; index < 4; index++) {
+
+            if (memcmp( Add2Ptr( Bench.Buffers, (SIZE_T)index * BUFFER_SIZE ), Add2Ptr( again, (SIZE_T)index * BUFFER_SIZE ), bytes[index] ) != 0) {
+
+                BenchFail( "same seed, same records", "they differ" );
+                break;
+            }
+        }
+    }
+
+    config.Seed = 43;
+    GenSample( &config, BENCH_START, again, BUFFER_SIZE, 4, bytesAgain );
+
+    BenchCommon.Checks++;
+
+    if (bytes[0] == bytesAgain[0] && memcmp( Bench.Buffers, again, bytes[0] ) == 0) {
+
+        BenchFail( "another seed, other records", "they are the same" );
+    }
+
+    free( again );
+}
+
+static VOID
+BenchCheckRate (
+    _In_ ULONG Rate,
+    _In_ ULONG Seconds
+    )
+/*++
+
+Routine Description:
+
+    Runs the logging thread's generator on a simulated clock, taken at
+    random intervals of up to 50 ms, and for a tenth of the run not at
+    all, as a pipeline that stalls.  Records must be spaced on the rate
+    from the start, as many as are due at every fill, and the ones due
+    during the stall must come after it with their times.
+
+--*/
+{
+    static BENCH_WALK walk;
+    GEN_CONFIG config;
+    HRESULT result;
+    LONGLONG now = BENCH_START;
+    LONGLONG end = BENCH_START + (LONGLONG)Seconds * 10000000;
+    LONGLONG time;
+    ULONGLONG random = 0x5EEDULL;
+    ULONGLONG due;
+    ULONGLONG taken = 0;
+    DWORD bytes;
+    DWORD used;
+    const LOG_RECORD *record;
+    char detail[200];
+    ULONG fills = 0;
+    ULONG empty = 0;
+    ULONG mostBehind = 0;
+    BOOLEAN full;
+
+    GenDefaultConfig( &config );
+    config.Rate = Rate;
+    config.Seed = 7;
+
+    free( walk.Threads );
+    free( walk.NameHashes );
+    free( walk.PathCounts );
+    free( walk.FileObjects );
+    memset( &walk, 0, sizeof( walk ) );
+
+    walk.Config = config;
+    walk.Name = "rate";
+    walk.LastTime = BENCH_START - 1;
+    walk.Threads = calloc( (SIZE_T)config.Processes * config.Threads, sizeof( BENCH_THREAD ) );
+    walk.NameHashes = calloc( (SIZE_T)config.Paths + 1, sizeof( ULONGLONG ) );
+    walk.PathCounts = calloc( (SIZE_T)config.Paths + 1, sizeof( ULONG ) );
+
+    if (walk.Threads == NULL || walk.NameHashes == NULL || walk.PathCounts == NULL || !GenStart( &config, now )) {
+
+        printf( "Could not start the generator\n" );
+        exit( 2 );
+    }
+
+    while (now < end) {
+
+        //
+        //  Everything due is taken before the clock moves on.
+        //
+
+        do {
+
+            result = GenFill( Bench.Buffers, BUFFER_SIZE, &bytes, now );
+            fills++;
+
+            due = (ULONGLONG)(now - BENCH_START) * Rate / 10000000;
+            mostBehind = max( mostBehind, (ULONG)Gen.State.Behind );
+
+            BenchCommon.Checks++;
+
+            if ((result == S_OK) != (bytes != 0) || (bytes == 0 && result != HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS ))) {
+
+                BenchFail( "records or ERROR_NO_MORE_ITEMS", "GenFill returned something else" );
+            }
+
+            if (bytes == 0) {
+
+                empty++;
+                break;
+            }
+
+            for (used = 0; used < bytes; used += record->Length) {
+
+                record = (const LOG_RECORD *)Add2Ptr( Bench.Buffers, used );
+
+                if (record->RecordType == RECORD_TYPE_NORMAL) {
+
+                    time = BENCH_START + (LONGLONG)(taken * 10000000 / Rate);
+                    taken++;
+
+                    BenchCommon.Checks++;
+
+                    if (record->Data.OriginatingTime.QuadPart != time || time > now) {
+
+                        snprintf( detail, sizeof( detail ), "record %llu at %lld, due at %lld, taken at %lld",
+                                  (unsigned long long)taken, (long long)(record->Data.OriginatingTime.QuadPart - BENCH_START),
+                                  (long long)(time - BENCH_START), (long long)(now - BENCH_START) );
+                        BenchFail( "records spaced on the rate", detail );
+                    }
+                }
+            }
+
+            full = (taken < due);
+            BenchCheckBuffer( &walk, Bench.Buffers, bytes, BUFFER_SIZE, full );
+
+            BenchCommon.Checks++;
+
+            if (Gen.State.Behind != due - taken) {
+
+                snprintf( detail, sizeof( detail ), "%llu due, %llu taken, %llu said behind",
+                          (unsigned long long)due, (unsigned long long)taken, (unsigned long long)Gen.State.Behind );
+                BenchFail( "records not taken still due", detail );
+            }
+
+        } while (full);
+
+        BenchCommon.Checks++;
+
+        if (taken != due) {
+
+            snprintf( detail, sizeof( detail ), "%llu due, %llu taken", (unsigned long long)due, (unsigned long long)taken );
+            BenchFail( "as many records as are due", detail );
+        }
+
+        //
+        //  Stalled for a tenth of the run, half way.
+        //
+
+        if (now - BENCH_START < (end - BENCH_START) / 2 && now - BENCH_START + 500000 >= (end - BENCH_START) / 2) {
+
+            now += (end - BENCH_START) / 10;
+
+        } else {
+
+            //
+            //  A quarter of the steps are shorter than a record apart, so
+            //  fills find nothing due as well.
+            //
+
+            random = GenMix( random + 1 );
+            now += 1 + (LONGLONG)(random % (((random >> 60) % 4 == 0) ? 10000000 / Rate : 500000));
+        }
+    }
+
+    GenStop();
+
+    BenchCommon.Checks++;
+
+    if (GenActive() || GenFill( Bench.Buffers, BUFFER_SIZE, &bytes, now + 10000000 ) != HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS ) || bytes != 0) {
+
+        BenchFail( "GenStop stops", "records after GenStop" );
+    }
+
+    printf( "    %u records/s for %u s: %llu records in %u fills, %u with none due, %u behind at most after the stall\n",
+            Rate, Seconds, (unsigned long long)taken, fills, empty, mostBehind );
+}
+
+static VOID
+BenchCheckOptions (
+    VOID
+    )
+{
+    static const struct {
+        const char *Option;
+        BOOLEAN Taken;
+    } options[] = {
+        { "rate=5000", TRUE },
+        { "rate=0", TRUE },
+        { "rate", FALSE },
+        { "rate=12x", FALSE },
+        { "rate=", FALSE },
+        { "processes=4096", TRUE },
+        { "processes=4097", FALSE },
+        { "processes=0", FALSE },
+        { "threads=64", TRUE },
+        { "threads=65", FALSE },
+        { "paths=1", TRUE },
+        { "paths=0", FALSE },
+        { "skew=150", TRUE },
+        { "pskew=0", TRUE },
+        { "fail=100", TRUE },
+        { "fail=101", FALSE },
+        { "names=56-160", TRUE },
+        { "names=160-56", FALSE },
+        { "names=56", FALSE },
+        { "names=10-5000", FALSE },
+        { "seed=0x123456789abc", TRUE },
+        { "READ=7", TRUE },
+        { "lock=0", TRUE },
+        { "cleanup=1", FALSE },
+        { "close=1", FALSE },
+        { "bogus=1", FALSE },
+    };
+    GEN_CONFIG config;
+    GEN_CONFIG before;
+    char detail[100];
+    ULONG index;
+
+    for (index = 0; index < ARRAYSIZE( options ); index++) {
+
+        GenDefaultConfig( &config );
+
+        BenchCommon.Checks++;
+
+        if (GenSetOption( &config, options[index].Option ) != options[index].Taken) {
+
+            snprintf( detail, sizeof( detail ), "%s %s", options[index].Option, options[index].Taken ? "refused" : "taken" );
+            BenchFail( "options in range taken, others refused", detail );
+        }
+    }
+
+    //
+    //  A configuration refused leaves the generator running as it was.
+    //
+
+    GenDefaultConfig( &before );
+    GenStart( &before, BENCH_START );
+
+    GenDefaultConfig( &config );
+    config.Weights[IRP_MJ_CREATE] = 0;
+
+    BenchCommon.Checks++;
+
+    if (GenStart( &config, BENCH_START ) || !GenActive() || Gen.State.Config.Weights[IRP_MJ_CREATE] == 0) {
+
+        BenchFail( "GenStart refuses what cannot open a file", "taken" );
+    }
+
+    GenStop();
+}
+
+static VOID
+BenchMeasure (
+    _In_ ULONG Rounds
+    )
+{
+    GEN_CONFIG config;
+    ULONGLONG bytes = 0;
+    ULONGLONG records = 0;
+    ULONG round;
+    ULONG index;
+    DWORD filled;
+    long long start;
+    double seconds;
+
+    GenDefaultConfig( &config );
+    config.Seed = 1;
+
+    start = BenchNow();
+
+    for (round = 0; round < Rounds; round++) {
+
+        GenSample( &config, BENCH_START, Bench.Buffers, BUFFER_SIZE, BENCH_BUFFERS, Bench.Bytes );
+
+        for (index = 0; index < BENCH_BUFFERS; index++) {
+
+            bytes += Bench.Bytes[index];
+        }
+    }
+
+    seconds = (BenchNow() - start) / 1e9;
+
+    //
+    //  Records of the default mix average the same length, counted on the
+    //  last round.
+    //
+
+    for (index = 0; index < BENCH_BUFFERS; index++) {
+
+        for (filled = 0; filled < Bench.Bytes[index]; filled += ((PLOG_RECORD)Add2Ptr( Bench.Buffers, (SIZE_T)index * BUFFER_SIZE + filled ))->Length) {
+
+            records++;
+        }
+    }
+
+    records *= Rounds;
+
+    printf( "GenSample: %.2f M records/s, %.0f MB/s, %.0f bytes a record\n",
+            records / seconds / 1e6, bytes / seconds / 1e6, (double)bytes / records );
+
+    config.Rate = 0;
+    GenStart( &config, BENCH_START );
+
+    bytes = 0;
+    start = BenchNow();
+
+    for (round = 0; round < Rounds * BENCH_BUFFERS; round++) {
+
+        GenFill( Bench.Buffers, BUFFER_SIZE, &filled, BENCH_START );
+        bytes += filled;
+    }
+
+    seconds = (BenchNow() - start) / 1e9;
+
+    printf( "GenFill:   %.2f M records/s, %.0f MB/s, as fast as they are taken\n",
+            Gen.State.Records / seconds / 1e6, bytes / seconds / 1e6 );
+
+    GenStop();
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    printf( "Usage: mspyGenTest [-n <records>] [-r <records a second>] [-d <seconds>] [-m <rounds>]\n"
+            "\n"
+            "    [-n <records>] operations checked for each configuration, 500000 by default\n"
+            "    [-r <records a second>] rate the generator is run at, 200000 by default\n"
+            "    [-d <seconds>] simulated seconds it is run for, 60 by default\n"
+            "    [-m <rounds>] rounds of %u buffers measured, 8 by default\n",
+            BENCH_BUFFERS );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    static const struct {
+        const char *Name;
+        const char *Options;
+    } configs[] = {
+        { "default", "" },
+        { "uniform", "skew=0 pskew=0 paths=2000" },
+        { "skewed", "skew=150 pskew=120 paths=1000 processes=200" },
+        { "flat", "skew=50 paths=100000 processes=4096 threads=64" },
+        { "one path", "paths=1 processes=1 threads=1" },
+        { "writes", "read=0 write=60 query=0 set=10 create=2 lock=5" },
+        { "names", "names=200-200 paths=5000" },
+        { "longest", "names=32000-32000 paths=100" },
+        { "short", "names=0-10 paths=5000" },
+        { "no fail", "fail=0" },
+        { "all fail", "fail=100" },
+        { "fail 37", "fail=37" },
+    };
+    char options[64];
+    ULONG records = 500000;
+    ULONG rate = 200000;
+    ULONG seconds = 60;
+    ULONG rounds = 8;
+    ULONG index;
+    int option;
+
+    while ((option = getopt( argc, argv, "n:r:d:m:" )) != -1) {
+
+        switch (option) {
+
+            case 'n':
+                records = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'r':
+                rate = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'd':
+                seconds = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'm':
+                rounds = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || records == 0 || rate == 0 || seconds == 0 || rounds == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    Bench.Buffers = malloc( (SIZE_T)BENCH_BUFFERS * BUFFER_SIZE );
+
+    if (Bench.Buffers == NULL) {
+
+        printf( "Could not allocate the buffers\n" );
+        return 2;
+    }
+
+    printf( "Configurations, records walked as RetrieveLogRecords walks them:\n" );
+
+    for (index = 0; index < ARRAYSIZE( configs ); index++) {
+
+        //
+        //  The longest names fit a record the filter could send.
+        //
+
+        if (strcmp( configs[index].Name, "longest" ) == 0) {
+
+            snprintf( options, sizeof( options ), "names=%u-%u paths=100", (unsigned)GEN_MAX_NAME, (unsigned)GEN_MAX_NAME );
+            BenchCheckConfig( configs[index].Name, options, records / 20 );
+            continue;
+        }
+
+        BenchCheckConfig( configs[index].Name, configs[index].Options, records );
+    }
+
+    BenchCheckSeed();
+    BenchCheckOptions();
+
+    printf( "The logging thread's generator on a simulated clock:\n" );
+    BenchCheckRate( rate, seconds );
+
+    BenchMeasure( rounds );
+
+    free( Bench.Buffers );
+
+    return BenchSummary();
+}
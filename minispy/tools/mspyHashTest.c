@@ -0,0 +1,1110 @@
+/*++
+
+Module Name:
+
+    mspyHashTest.c
+
+Abstract:
+
+    Checks and measures the client's file hashing service,
+    user/mspyHash.c, in a Linux program against ushim, on files it writes
+    in a directory of its own.
+
+    mspyHash.c is included rather than linked, so its SHA-256 can be
+    checked on its own and its counters read.  The checks:
+
+        the digest of the FIPS 180-2 examples, whole and fed a byte at a
+        time, and of random buffers of every length up to a few blocks,
+        whole against split at random points;
+
+        changes that keep the size and last write time of a file, made
+        right after it was hashed: a rewrite, and a swap of two files by
+        renames.  The file must be read again, while one last written
+        long ago and invalidated without a change must not be;
+
+        the cache against a model of the files: lookups of a few hot and
+        many cold files, with the case of their names changed at random,
+        while files are rewritten, half of the time at the same size,
+        swapped by renames and deleted, each followed by HashInvalidate
+        as the log writer calls it.  A digest handed out must be the one
+        of what the file holds since it was last invalidated, and once
+        the changes stop every file must settle to its digest, or to
+        HashUnavailable when it was deleted;
+
+        more files than the cache holds, read in passes: they must be
+        evicted, lookups made while the queue is full dropped, and the
+        files read last found ready with their digests.
+
+    The measurement hashes large files from the page cache with 1, 2, 4
+    and up to -t threads, and prints MB/s of wall time and a thread,
+    next to the SHA-256 of a buffer in memory.
+
+    It returns 1 when a check fails.
+
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspyHashTest mspyHashTest.c -lsqlite3
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "ushim/ushimLog.c"
+#include "../user/mspyHash.c"
+#include "mspyBench.h"
+
+#define BENCH_NAME_SIZE         16
+#define BENCH_HOT_FILES         10          // percent of the files
+#define BENCH_SAME_SIZE         4096
+#define BENCH_LARGE_FILE        (4 * 1024 * 1024)
+#define BENCH_MEASURE_FILE      (16 * 1024 * 1024)
+#define BENCH_SETTLE_SECONDS    30
+
+typedef struct _BENCH_FILE {
+
+    char Name[BENCH_NAME_SIZE];
+    BOOLEAN Exists;
+    ULONG Size;
+    UCHAR Digest[HASH_DIGEST_SIZE];
+
+} BENCH_FILE, *PBENCH_FILE;
+
+typedef struct _BENCH_STATE {
+
+    PUCHAR Buffer;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static VOID
+BenchFill (
+    _Out_writes_bytes_(Length) PUCHAR Buffer,
+    _In_ ULONG Length
+    )
+{
+    unsigned long long value;
+    ULONG index;
+
+    for (index = 0; index + sizeof( value ) <= Length; index += sizeof( value )) {
+
+        value = BenchRandom();
+        memcpy( Buffer + index, &value, sizeof( value ) );
+    }
+
+    for (; index < Length; index++) {
+
+        Buffer[index] = (UCHAR)BenchRandom();
+    }
+}
+
+static VOID
+BenchDigest (
+    _In_reads_bytes_(Length) const UCHAR *Buffer,
+    _In_ ULONG Length,
+    _Out_writes_(HASH_DIGEST_SIZE) PUCHAR Digest
+    )
+{
+    HASH_SHA256 sha;
+
+    HashSha256Init( &sha );
+    HashSha256Update( &sha, Buffer, Length );
+    HashSha256Final( &sha, Digest );
+}
+
+static BOOLEAN
+BenchParseDigest (
+    _In_z_ const char *Hex,
+    _Out_writes_(HASH_DIGEST_SIZE) PUCHAR Digest
+    )
+{
+    unsigned int byte;
+    ULONG index;
+
+    for (index = 0; index < HASH_DIGEST_SIZE; index++) {
+
+        if (sscanf( Hex + 2 * index, "%2x", &byte ) != 1) {
+
+            return FALSE;
+        }
+
+        Digest[index] = (UCHAR)byte;
+    }
+
+    return TRUE;
+}
+
+static VOID
+BenchCheckSha256 (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Checks HashSha256 on the examples of FIPS 180-2, whole and a byte at
+    a time, and on random buffers whole against split at two random
+    points.
+
+--*/
+{
+    static const struct {
+
+        const char *Message;
+        ULONG Repeat;
+        const char *Digest;
+
+    } examples[] = {
+
+        { "", 1,
+          "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+        { "abc", 1,
+          "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+        { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+          "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+        { "a", 1000000,
+          "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+    };
+
+    UCHAR expected[HASH_DIGEST_SIZE];
+    UCHAR whole[HASH_DIGEST_SIZE];
+    UCHAR split[HASH_DIGEST_SIZE];
+    UCHAR buffer[1024];
+    HASH_SHA256 sha;
+    char detail[64];
+    ULONG example;
+    ULONG length;
+    ULONG repeat;
+    ULONG first;
+    ULONG second;
+    ULONG round;
+    const char *byte;
+
+    for (example = 0; example < ARRAYSIZE( examples ); example++) {
+
+        BenchParseDigest( examples[example].Digest, expected );
+        length = (ULONG)strlen( examples[example].Message );
+
+        HashSha256Init( &sha );
+
+        for (repeat = 0; repeat < examples[example].Repeat; repeat++) {
+
+            HashSha256Update( &sha, (const UCHAR *)examples[example].Message, length );
+        }
+
+        HashSha256Final( &sha, whole );
+
+        HashSha256Init( &sha );
+
+        for (repeat = 0; repeat < examples[example].Repeat; repeat++) {
+
+            for (byte = examples[example].Message; *byte != '\0'; byte++) {
+
+                HashSha256Update( &sha, (const UCHAR *)byte, 1 );
+            }
+        }
+
+        HashSha256Final( &sha, split );
+
+        snprintf( detail, sizeof( detail ), "FIPS 180-2 example %u", example + 1 );
+
+        BenchCommon.Checks += 2;
+
+        if (memcmp( whole, expected, HASH_DIGEST_SIZE ) != 0) {
+
+            BenchFail( "SHA-256 of a whole message", detail );
+        }
+
+        if (memcmp( split, expected, HASH_DIGEST_SIZE ) != 0) {
+
+            BenchFail( "SHA-256 fed a byte at a time", detail );
+        }
+    }
+
+    for (length = 0; length <= sizeof( buffer ); length++) {
+
+        BenchFill( buffer, length );
+        BenchDigest( buffer, length, whole );
+
+        for (round = 0; round < 4; round++) {
+
+            first = BenchBelow( length + 1 );
+            second = first + BenchBelow( length - first + 1 );
+
+            HashSha256Init( &sha );
+            HashSha256Update( &sha, buffer, first );
+            HashSha256Update( &sha, buffer + first, second - first );
+            HashSha256Update( &sha, buffer + second, length - second );
+            HashSha256Final( &sha, split );
+
+            BenchCommon.Checks++;
+
+            if (memcmp( whole, split, HASH_DIGEST_SIZE ) != 0) {
+
+                snprintf( detail, sizeof( detail ), "%u bytes split at %u and %u", length, first, second );
+                BenchFail( "SHA-256 of a split buffer", detail );
+            }
+        }
+    }
+}
+
+static BOOLEAN
+BenchWriteFile (
+    _Inout_ PBENCH_FILE File,
+    _In_ ULONG Size
+    )
+/*++
+
+Routine Description:
+
+    Writes Size random bytes over the file and remembers their digest.
+
+--*/
+{
+    FILE *file = fopen( File->Name, "wb" );
+    BOOLEAN written;
+
+    if (file == NULL) {
+
+        perror( File->Name );
+        return FALSE;
+    }
+
+    BenchFill( Bench.Buffer, Size );
+    written = (fwrite( Bench.Buffer, 1, Size, file ) == Size);
+    written = (fclose( file ) == 0) && written;
+
+    if (!written) {
+
+        perror( File->Name );
+        return FALSE;
+    }
+
+    File->Exists = TRUE;
+    File->Size = Size;
+    BenchDigest( Bench.Buffer, Size, File->Digest );
+
+    return TRUE;
+}
+
+static VOID
+BenchWideName (
+    _In_ PBENCH_FILE File,
+    _In_ BOOLEAN Recase,
+    _Out_writes_(BENCH_NAME_SIZE) PWCHAR Name
+    )
+/*++
+
+Routine Description:
+
+    The name of a file the way the filter would report it, with the case
+    of a random half of its letters changed when Recase is set.  Names
+    are written upcased, the case the service opens them in.
+
+--*/
+{
+    ULONG index;
+
+    for (index = 0; File->Name[index] != '\0'; index++) {
+
+        Name[index] = (WCHAR)File->Name[index];
+
+        if (Recase &&
+            Name[index] >= L'A' && Name[index] <= L'Z' &&
+            BenchBelow( 2 ) == 0) {
+
+            Name[index] += L'a' - L'A';
+        }
+    }
+
+    Name[index] = UNICODE_NULL;
+}
+
+static HASH_RESULT
+BenchLookup (
+    _In_ PBENCH_FILE File
+    )
+/*++
+
+Routine Description:
+
+    Looks the file up, checking a digest handed out against the model.
+
+--*/
+{
+    UCHAR digest[HASH_DIGEST_SIZE];
+    WCHAR name[BENCH_NAME_SIZE];
+    HASH_RESULT result;
+
+    BenchWideName( File, TRUE, name );
+    result = HashLookup( name, digest );
+
+    if (result == HashReady) {
+
+        BenchCommon.Checks++;
+
+        if (!File->Exists) {
+
+            BenchFail( "digest of a deleted file", File->Name );
+
+        } else if (memcmp( digest, File->Digest, HASH_DIGEST_SIZE ) != 0) {
+
+            BenchFail( "digest of what the file held before", File->Name );
+        }
+    }
+
+    return result;
+}
+
+static VOID
+BenchInvalidate (
+    _In_ PBENCH_FILE File
+    )
+{
+    WCHAR name[BENCH_NAME_SIZE];
+
+    BenchWideName( File, TRUE, name );
+    HashInvalidate( name );
+}
+
+static ULONG
+BenchQueued (
+    VOID
+    )
+{
+    ULONG queued;
+
+    AcquireSRWLockShared( &HashService.Lock );
+    queued = HashService.QueueCount;
+    ReleaseSRWLockShared( &HashService.Lock );
+
+    return queued;
+}
+
+static BOOLEAN
+BenchSettle (
+    _In_reads_(Count) PBENCH_FILE Files,
+    _In_ ULONG Count
+    )
+/*++
+
+Routine Description:
+
+    Looks every file up until each one that exists is ready and each one
+    that was deleted is unavailable, or BENCH_SETTLE_SECONDS pass.
+
+Return Value:
+
+    TRUE if the files settled.
+
+--*/
+{
+    long long deadline = BenchNow() + BENCH_SETTLE_SECONDS * 1000000000LL;
+    HASH_RESULT result;
+    ULONG unsettled;
+    ULONG index;
+    char detail[64];
+
+    for (;;) {
+
+        unsettled = 0;
+
+        for (index = 0; index < Count; index++) {
+
+            result = BenchLookup( &Files[index] );
+
+            if (result == HashPending ||
+                (result == HashReady) != Files[index].Exists) {
+
+                unsettled++;
+            }
+        }
+
+        if (unsettled == 0) {
+
+            return TRUE;
+        }
+
+        if (BenchNow() > deadline) {
+
+            snprintf( detail, sizeof( detail ), "%u of %u files", unsettled, Count );
+            BenchFail( "files never settled", detail );
+            return FALSE;
+        }
+
+        usleep( 1000 );
+    }
+}
+
+static VOID
+BenchCheckCache (
+    _In_ ULONG FileCount,
+    _In_ ULONG Operations,
+    _In_ ULONG Threads
+    )
+/*++
+
+Routine Description:
+
+    Runs lookups against the model while files change, then lets them
+    settle.  Most lookups go to the hot tenth of the files.
+
+--*/
+{
+    PBENCH_FILE files = calloc( FileCount, sizeof( BENCH_FILE ) );
+    PBENCH_FILE file;
+    PBENCH_FILE other;
+    BENCH_FILE swap;
+    ULONG counts[3] = { 0 };
+    ULONG rewrites = 0;
+    ULONG sameSize = 0;
+    ULONG renames = 0;
+    ULONG deletes = 0;
+    ULONG operation;
+    ULONG index;
+    ULONG size;
+    ULONG hot = max( FileCount * BENCH_HOT_FILES / 100, 1 );
+
+    if (files == NULL) {
+
+        return;
+    }
+
+    //
+    //  A quarter of the files have the same size, so a rewrite or a swap
+    //  can leave a file with the size and last write time it had.
+    //
+
+    for (index = 0; index < FileCount; index++) {
+
+        file = &files[index];
+        snprintf( file->Name, sizeof( file->Name ), "F%05u.BIN", index );
+
+        size = (BenchBelow( 4 ) == 0) ? BENCH_SAME_SIZE :
+               (BenchBelow( 50 ) == 0) ? BenchBelow( BENCH_LARGE_FILE ) :
+                                         BenchBelow( 65536 );
+
+        if (!BenchWriteFile( file, size )) {
+
+            goto Exit;
+        }
+    }
+
+    if (!HashStart( Threads )) {
+
+        printf( "Could not start the hash service\n" );
+        goto Exit;
+    }
+
+    for (operation = 0; operation < Operations; operation++) {
+
+        file = &files[(BenchBelow( 5 ) != 0) ? BenchBelow( hot ) : BenchBelow( FileCount )];
+        index = BenchBelow( 1000 );
+
+        if (index < 15) {
+
+            if (BenchBelow( 2 ) == 0 && file->Exists) {
+
+                size = file->Size;
+                sameSize++;
+
+            } else {
+
+                size = (BenchBelow( 2 ) == 0) ? BENCH_SAME_SIZE : BenchBelow( 65536 );
+            }
+
+            if (!BenchWriteFile( file, size )) {
+
+                HashStop();
+                goto Exit;
+            }
+
+            BenchInvalidate( file );
+            rewrites++;
+
+        } else if (index < 20) {
+
+            other = &files[BenchBelow( FileCount )];
+
+            if (other == file || !file->Exists || !other->Exists) {
+
+                continue;
+            }
+
+            if (rename( file->Name, "SWAP.TMP" ) != 0 ||
+                rename( other->Name, file->Name ) != 0 ||
+                rename( "SWAP.TMP", other->Name ) != 0) {
+
+                perror( "rename" );
+                HashStop();
+                goto Exit;
+            }
+
+            swap = *file;
+            memcpy( file->Digest, other->Digest, HASH_DIGEST_SIZE );
+            file->Size = other->Size;
+            memcpy( other->Digest, swap.Digest, HASH_DIGEST_SIZE );
+            other->Size = swap.Size;
+
+            BenchInvalidate( file );
+            BenchInvalidate( other );
+            renames++;
+
+        } else if (index < 22) {
+
+            if (!file->Exists) {
+
+                continue;
+            }
+
+            unlink( file->Name );
+            file->Exists = FALSE;
+            BenchInvalidate( file );
+            deletes++;
+
+        } else {
+
+            counts[BenchLookup( file )]++;
+        }
+    }
+
+    printf( "Cache: %u files, %u changes while looking them up\n", FileCount, Operations );
+    printf( "    %u rewrites, %u of them at the same size, %u swaps, %u deletes\n",
+            rewrites,
+            sameSize,
+            renames,
+            deletes );
+    printf( "    Lookups: %u ready, %u pending, %u unavailable\n",
+            counts[HashReady],
+            counts[HashPending],
+            counts[HashUnavailable] );
+
+    BenchSettle( files, FileCount );
+
+    HashPrintStats();
+    HashStop();
+
+Exit:
+
+    for (index = 0; index < FileCount; index++) {
+
+        unlink( files[index].Name );
+    }
+
+    free( files );
+}
+
+static BOOLEAN
+BenchSetLastWrite (
+    _In_ PBENCH_FILE File,
+    _In_ const struct timespec *LastWrite
+    )
+{
+    struct timespec times[2] = { *LastWrite, *LastWrite };
+
+    if (utimensat( AT_FDCWD, File->Name, times, 0 ) != 0) {
+
+        perror( File->Name );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN
+BenchWaitReady (
+    _In_ PBENCH_FILE File
+    )
+{
+    long long deadline = BenchNow() + BENCH_SETTLE_SECONDS * 1000000000LL;
+
+    while (BenchLookup( File ) != HashReady) {
+
+        if (BenchNow() > deadline) {
+
+            BenchFail( "file never hashed", File->Name );
+            return FALSE;
+        }
+
+        sched_yield();
+    }
+
+    return TRUE;
+}
+
+static VOID
+BenchCheckQuickChanges (
+    _In_ ULONG Count,
+    _In_ ULONG Threads
+    )
+/*++
+
+Routine Description:
+
+    Changes files right after they were hashed without changing their
+    size or last write time, in turn: a rewrite at the same size, and a
+    swap by renames of two files of the same size written at the same
+    time.  Every third round a file last written an hour ago is
+    invalidated without a change, and must be taken as unchanged without
+    being read.
+
+    Linux stamps writes to the nanosecond once the time was looked at, so
+    the last write time is set back as a file system with a coarse clock
+    would leave it.  NTFS moves it at the clock tick.
+
+--*/
+{
+    struct timespec lastWrite;
+    BENCH_FILE files[2];
+    BENCH_FILE swap;
+    ULONG unchanged = 0;
+    ULONG round;
+    ULONG index;
+    char detail[64];
+
+    memset( files, 0, sizeof( files ) );
+
+    if (!HashStart( Threads )) {
+
+        printf( "Could not start the hash service\n" );
+        return;
+    }
+
+    for (round = 0; round < Count; round++) {
+
+        clock_gettime( CLOCK_REALTIME, &lastWrite );
+
+        if (round % 3 == 2) {
+
+            lastWrite.tv_sec -= 3600;
+        }
+
+        for (index = 0; index < 2; index++) {
+
+            snprintf( files[index].Name, sizeof( files[index].Name ), "Q%05u.BIN", 2 * round + index );
+
+            if (!BenchWriteFile( &files[index], BENCH_SAME_SIZE ) ||
+                !BenchSetLastWrite( &files[index], &lastWrite )) {
+
+                goto Exit;
+            }
+        }
+
+        if (!BenchWaitReady( &files[0] ) || !BenchWaitReady( &files[1] )) {
+
+            goto Exit;
+        }
+
+        if (round % 3 == 0) {
+
+            if (!BenchWriteFile( &files[0], BENCH_SAME_SIZE ) ||
+                !BenchSetLastWrite( &files[0], &lastWrite )) {
+
+                goto Exit;
+            }
+
+            BenchInvalidate( &files[0] );
+
+        } else if (round % 3 == 1) {
+
+            if (rename( files[0].Name, "SWAP.TMP" ) != 0 ||
+                rename( files[1].Name, files[0].Name ) != 0 ||
+                rename( "SWAP.TMP", files[1].Name ) != 0) {
+
+                perror( "rename" );
+                goto Exit;
+            }
+
+            swap = files[0];
+            memcpy( files[0].Digest, files[1].Digest, HASH_DIGEST_SIZE );
+            memcpy( files[1].Digest, swap.Digest, HASH_DIGEST_SIZE );
+
+            BenchInvalidate( &files[0] );
+            BenchInvalidate( &files[1] );
+
+        } else {
+
+            BenchInvalidate( &files[0] );
+            unchanged++;
+        }
+
+        BenchWaitReady( &files[0] );
+        BenchWaitReady( &files[1] );
+
+        unlink( files[0].Name );
+        unlink( files[1].Name );
+    }
+
+    printf( "Quick changes: %u rewrites and %u swaps right after hashing, %u unchanged files\n",
+            (Count + 2) / 3,
+            (Count + 1) / 3,
+            unchanged );
+    HashPrintStats();
+
+    BenchCommon.Checks++;
+
+    if (HashService.Stats.Revalidated != unchanged) {
+
+        snprintf( detail,
+                  sizeof( detail ),
+                  "%llu of %u",
+                  (unsigned long long)HashService.Stats.Revalidated,
+                  unchanged );
+        BenchFail( "unchanged files taken without reading them", detail );
+    }
+
+Exit:
+
+    HashStop();
+    unlink( files[0].Name );
+    unlink( files[1].Name );
+}
+
+static VOID
+BenchCheckEviction (
+    _In_ ULONG FileCount,
+    _In_ ULONG Threads
+    )
+/*++
+
+Routine Description:
+
+    Reads more files than the cache holds in three passes.  A lookup
+    dropped because the queue is full is made again once the workers
+    have taken half of it.  The files read last must then be ready with
+    their digests.
+
+--*/
+{
+    PBENCH_FILE files = calloc( FileCount, sizeof( BENCH_FILE ) );
+    ULONG counts[3] = { 0 };
+    HASH_RESULT result;
+    ULONG index;
+    ULONG pass;
+    char detail[96];
+
+    if (files == NULL) {
+
+        return;
+    }
+
+    for (index = 0; index < FileCount; index++) {
+
+        snprintf( files[index].Name, sizeof( files[index].Name ), "E%05u.BIN", index );
+
+        if (!BenchWriteFile( &files[index], 1024 )) {
+
+            goto Exit;
+        }
+    }
+
+    if (!HashStart( Threads )) {
+
+        printf( "Could not start the hash service\n" );
+        goto Exit;
+    }
+
+    for (pass = 0; pass < 3; pass++) {
+
+        for (index = 0; index < FileCount; index++) {
+
+            while ((result = BenchLookup( &files[index] )) == HashUnavailable) {
+
+                counts[HashUnavailable]++;
+
+                while (BenchQueued() > HASH_QUEUE_LENGTH / 2) {
+
+                    usleep( 1000 );
+                }
+            }
+
+            counts[result]++;
+        }
+
+        while (BenchQueued() != 0) {
+
+            usleep( 1000 );
+        }
+    }
+
+    printf( "Eviction: %u files in a cache of %u, 3 passes\n", FileCount, HASH_CACHE_ENTRIES );
+    printf( "    Lookups: %u ready, %u pending, %u unavailable\n",
+            counts[HashReady],
+            counts[HashPending],
+            counts[HashUnavailable] );
+
+    BenchSettle( files + FileCount - min( FileCount, HASH_CACHE_ENTRIES / 4 ),
+                 min( FileCount, HASH_CACHE_ENTRIES / 4 ) );
+
+    HashPrintStats();
+
+    if (FileCount > HASH_CACHE_ENTRIES) {
+
+        BenchCommon.Checks++;
+
+        if (HashService.Stats.Evicted < FileCount - HASH_CACHE_ENTRIES) {
+
+            snprintf( detail,
+                      sizeof( detail ),
+                      "%llu evicted of %u files",
+                      (unsigned long long)HashService.Stats.Evicted,
+                      FileCount );
+            BenchFail( "files evicted", detail );
+        }
+    }
+
+    if (FileCount > HASH_QUEUE_LENGTH) {
+
+        BenchCommon.Checks++;
+
+        if (HashService.Stats.Dropped == 0) {
+
+            BenchFail( "lookups dropped with the queue full", "none" );
+        }
+    }
+
+    HashStop();
+
+Exit:
+
+    for (index = 0; index < FileCount; index++) {
+
+        unlink( files[index].Name );
+    }
+
+    free( files );
+}
+
+static VOID
+BenchMeasure (
+    _In_ ULONG Megabytes,
+    _In_ ULONG MostThreads
+    )
+/*++
+
+Routine Description:
+
+    Hashes Megabytes in files of BENCH_MEASURE_FILE bytes with more and
+    more threads, each time with an empty cache.
+
+--*/
+{
+    ULONG count = max( Megabytes / (BENCH_MEASURE_FILE / (1024 * 1024)), 1 );
+    PBENCH_FILE files = calloc( count, sizeof( BENCH_FILE ) );
+    UCHAR digest[HASH_DIGEST_SIZE];
+    double seconds;
+    double megabytes = (double)count * BENCH_MEASURE_FILE / (1024 * 1024);
+    long long start;
+    ULONG threads;
+    ULONG ready;
+    ULONG index;
+
+    if (files == NULL) {
+
+        return;
+    }
+
+    for (index = 0; index < count; index++) {
+
+        snprintf( files[index].Name, sizeof( files[index].Name ), "M%05u.BIN", index );
+
+        if (!BenchWriteFile( &files[index], BENCH_MEASURE_FILE )) {
+
+            goto Exit;
+        }
+    }
+
+    start = BenchNow();
+    BenchDigest( Bench.Buffer, BENCH_MEASURE_FILE, digest );
+    seconds = (BenchNow() - start) / 1e9;
+
+    printf( "Hashing %.0f MB in files of %u MB from the page cache:\n",
+            megabytes,
+            BENCH_MEASURE_FILE / (1024 * 1024) );
+    printf( "    %-10s %12s %14s\n", "Threads", "MB/s", "MB/s a thread" );
+    printf( "    %-10s %12.1f %14s\n", "memory", BENCH_MEASURE_FILE / (1024.0 * 1024.0) / seconds, "" );
+
+    for (threads = 1; threads <= MostThreads; threads *= 2) {
+
+        if (!HashStart( threads )) {
+
+            printf( "Could not start the hash service\n" );
+            break;
+        }
+
+        start = BenchNow();
+
+        do {
+
+            ready = 0;
+
+            for (index = 0; index < count; index++) {
+
+                ready += (BenchLookup( &files[index] ) == HashReady);
+            }
+
+            if (ready != count) {
+
+                usleep( 1000 );
+            }
+
+        } while (ready != count);
+
+        seconds = (BenchNow() - start) / 1e9;
+
+        printf( "    %-10u %12.1f %14.1f\n",
+                (unsigned)HashService.ThreadCount,
+                megabytes / seconds,
+                HashService.Stats.BytesHashed / (1024.0 * 1024.0) /
+                    ((double)HashService.Stats.HashTicks / HashService.Frequency.QuadPart) );
+
+        HashStop();
+    }
+
+Exit:
+
+    for (index = 0; index < count; index++) {
+
+        unlink( files[index].Name );
+    }
+
+    free( files );
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    printf( "Usage: mspyHashTest [-q <changes>] [-f <files>] [-c <changes>] [-e <files>] [-m <MB>] [-t <threads>] [-o <directory>]\n"
+            "\n"
+            "    [-q <changes>] changes right after a file was hashed, 2000 by default\n"
+            "    [-f <files>] files the cache is checked with, 4000 by default\n"
+            "    [-c <changes>] lookups and changes made to them, 400000 by default\n"
+            "    [-e <files>] files read past the cache, 20000 by default, 0 to skip\n"
+            "    [-m <MB>] MB hashed in the measurement, 256 by default, 0 to skip\n"
+            "    [-t <threads>] most hashing threads, 4 by default\n"
+            "    [-o <directory>] where the files are written, a new directory in /tmp by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    char directory[] = "/tmp/mspyHashTest.XXXXXX";
+    const char *output = NULL;
+    ULONG quick = 2000;
+    ULONG fileCount = 4000;
+    ULONG operations = 400000;
+    ULONG evicted = 20000;
+    ULONG megabytes = 256;
+    ULONG threads = 4;
+    int option;
+
+    while ((option = getopt( argc, argv, "q:f:c:e:m:t:o:" )) != -1) {
+
+        switch (option) {
+
+            case 'q':
+                quick = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'f':
+                fileCount = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'c':
+                operations = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'e':
+                evicted = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'm':
+                megabytes = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 't':
+                threads = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || fileCount == 0 || fileCount > 100000 || evicted > 100000 ||
+        threads == 0 || threads > HASH_MAX_THREADS) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    if (output == NULL) {
+
+        if (mkdtemp( directory ) == NULL) {
+
+            perror( "mkdtemp" );
+            return 2;
+        }
+
+        output = directory;
+    }
+
+    //
+    //  The service upcases the names it opens, so the files are named
+    //  relative to the directory, in capitals.
+    //
+
+    Bench.Buffer = malloc( max( BENCH_LARGE_FILE, BENCH_MEASURE_FILE ) );
+
+    if (Bench.Buffer == NULL || chdir( output ) != 0) {
+
+        perror( output );
+        return 2;
+    }
+
+    BenchCheckSha256();
+    BenchCheckQuickChanges( quick, threads );
+    BenchCheckCache( fileCount, operations, threads );
+
+    if (evicted != 0) {
+
+        BenchCheckEviction( evicted, threads );
+    }
+
+    if (megabytes != 0) {
+
+        BenchMeasure( megabytes, threads );
+    }
+
+    if (output == directory) {
+
+        rmdir( directory );
+    }
+
+    free( Bench.Buffer );
+
+    return BenchSummary();
+}
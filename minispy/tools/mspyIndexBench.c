@@ -0,0 +1,1028 @@
+/*++
+
+Module Name:
+
+    mspyIndexBench.c
+
+Abstract:
+
+    Measures what the indexes on MinifilterLog in user/index.sql buy the
+    queries they are for, and what each of them costs the log writer, in
+    a Linux program against the types in ushim/windows.h.
+
+    A database is made from the client's own create.sql and files.sql and
+    filled with -n operations, without the indexes of index.sql.  Rows are
+    inserted with the writer's own statement, in batches of one
+    transaction each, on a connection in WAL mode with synchronous NORMAL
+    like the writer's.  The files an operation goes to, and the process
+    that does it, are drawn skewed so a few of them get most of the
+    operations, and a few in a hundred operations fail or end in a
+    warning.
+
+    The queries each index is meant for, as index.sql lists them, are then
+    run against the table without indexes.  Each index of index.sql is
+    built on its own, -a more operations are logged with it in place and
+    it is dropped again; the same is done with no index and with all of
+    them.  The operations appended are deleted each time, so every
+    measurement sees the same table.  Last, with every index built, the
+    queries run again and must return what they did without indexes.
+
+    It prints, for each index, how long it took to build, its size, and
+    the rows a second the writer logs with it in place against none, and
+    for each query how long it took before and after, with the plan
+    SQLite chose after.  The time windows the queries look at are fixed
+    in seconds of log, so they find about as many rows whatever the size
+    of the table, as they would on a real system.
+
+    It returns 1 when a query returns something else with the indexes.
+
+    Built on its own, for instance:
+
+        gcc -O2 -Iushim -o mspyIndexBench mspyIndexBench.c -lsqlite3
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include <windows.h>
+#include "mspyBench.h"
+
+#define BENCH_PATH_SIZE         512
+#define BENCH_MAX_INDEXES       16
+#define BENCH_NAME_SIZE         64
+#define BENCH_PLAN_SIZE         256
+#define BENCH_PROCESSES         64
+
+//
+//  Log time is in 100 ns units, as PreOpTime is.
+//
+
+#define BENCH_SECOND            10000000LL
+#define BENCH_FIRST_TIME        133500000000000000LL
+
+//
+//  StatusCodes, signed as the writer stores them: two errors and a
+//  warning, which is not a failure.
+//
+
+#define BENCH_NOT_FOUND         ((LONG)0xC0000034)
+#define BENCH_ACCESS_DENIED     ((LONG)0xC0000022)
+#define BENCH_NO_MORE_FILES     ((LONG)0x80000006)
+
+typedef enum _BENCH_QUERY_KIND {
+
+    BenchQueryWindow,
+    BenchQueryProcess,
+    BenchQueryFiles,
+    BenchQueryDurations,
+    BenchQueryWrites,
+    BenchQueryErrors,
+    BenchQueries
+
+} BENCH_QUERY_KIND;
+
+//
+//  The queries index.sql lists for its indexes.  ?1 and ?2 are the start
+//  and end of a window of log time, ?3 a process.
+//
+
+static const struct {
+
+    const char *Name;
+    const char *Sql;
+
+} BenchQuerySql[BenchQueries] = {
+
+    { "time window",
+      "SELECT COUNT(*), SUM(PostOpTime - PreOpTime) FROM MinifilterLog WHERE PreOpTime BETWEEN ?1 AND ?2;" },
+
+    { "process timeline",
+      "SELECT COUNT(*), MAX(PreOpTime) FROM MinifilterLog WHERE ProcessId = ?3 AND PreOpTime >= ?1;" },
+
+    { "directory",
+      "SELECT COUNT(*) FROM MinifilterLog WHERE FileID IN "
+      "(SELECT FileID FROM Files WHERE Path LIKE '\\Device\\HarddiskVolume3\\Users\\user03\\%');" },
+
+    { "durations by op",
+      "SELECT * FROM View_OpDurationSummary;" },
+
+    { "file writes",
+      "SELECT COUNT(*), SUM(DurationNano) FROM View_FileWriteTiming;" },
+
+    { "errors since",
+      "SELECT ProcessId, StatusCode, COUNT(*) FROM MinifilterLog "
+      "WHERE StatusCode BETWEEN -1073741824 AND -1 AND PreOpTime >= ?1 GROUP BY 1, 2;" },
+};
+
+typedef struct _BENCH_QUERY {
+
+    double Before;
+    double After;
+    unsigned long long BeforeDigest;
+    unsigned long long AfterDigest;
+    long long Rows;
+    char Plan[BENCH_PLAN_SIZE];
+
+} BENCH_QUERY;
+
+typedef struct _BENCH_INDEX {
+
+    char Name[BENCH_NAME_SIZE];
+    char *Sql;
+    double BuildSeconds;
+    long long Bytes;
+    double AppendSeconds;
+
+} BENCH_INDEX;
+
+typedef struct _BENCH_STATE {
+
+    unsigned long long Rows;
+    ULONG Append;
+    ULONG FileCount;
+    ULONG Batch;
+    const char *SqlDirectory;
+    const char *OutDirectory;
+    char File[BENCH_PATH_SIZE];
+
+    //
+    //  Where the log ends, and the next operation's number and time.
+    //
+
+    long long LastTime;
+    long long LastLogId;
+    unsigned long long NextRow;
+    long long NextTime;
+
+    double FillSeconds;
+    double NoIndexSeconds;
+    double AllSeconds;
+    double AllBuildSeconds;
+    long long AllBytes;
+
+    BENCH_INDEX Indexes[BENCH_MAX_INDEXES];
+    ULONG IndexCount;
+
+    BENCH_QUERY Queries[BenchQueries];
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static ULONG
+BenchSkewed (
+    ULONG Count
+    )
+{
+    unsigned long long uniform = BenchRandom32();
+
+    //
+    //  Squaring a uniform pick twice gives the first few most of the
+    //  picks and leaves a long tail picked now and then.
+    //
+
+    uniform = uniform * uniform >> 32;
+    uniform = uniform * uniform >> 32;
+
+    return (ULONG)(uniform * Count >> 32);
+}
+
+static char *
+BenchReadFile (
+    const char *Name
+    )
+{
+    char path[BENCH_PATH_SIZE];
+    char *text;
+    FILE *file;
+    long size;
+
+    snprintf( path, sizeof( path ), "%s/%s", Bench.SqlDirectory, Name );
+    file = fopen( path, "rb" );
+
+    if (file == NULL) {
+
+        fprintf( stderr, "Could not open %s\n", path );
+        return NULL;
+    }
+
+    fseek( file, 0, SEEK_END );
+    size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    text = malloc( size + 1 );
+
+    if (text == NULL || fread( text, 1, size, file ) != (size_t)size) {
+
+        fprintf( stderr, "Could not read %s\n", path );
+        fclose( file );
+        free( text );
+        return NULL;
+    }
+
+    fclose( file );
+    text[size] = '\0';
+
+    return text;
+}
+
+static int
+BenchExec (
+    sqlite3 *Db,
+    const char *Sql
+    )
+{
+    char *message = NULL;
+    int rc;
+
+    rc = sqlite3_exec( Db, Sql, NULL, NULL, &message );
+
+    if (rc != SQLITE_OK) {
+
+        fprintf( stderr, "%s\n    %s\n", message ? message : sqlite3_errstr( rc ), Sql );
+    }
+
+    sqlite3_free( message );
+
+    return (rc == SQLITE_OK) ? 0 : -1;
+}
+
+static int
+BenchExecFile (
+    sqlite3 *Db,
+    const char *Name
+    )
+/*++
+
+Routine Description:
+
+    Runs one of the client's .sql files, as ExecEmbeddedSQL runs it from
+    the resources.
+
+--*/
+{
+    char *text = BenchReadFile( Name );
+    int rc;
+
+    if (text == NULL) {
+
+        return -1;
+    }
+
+    rc = BenchExec( Db, text );
+    free( text );
+
+    return rc;
+}
+
+static int
+BenchLoadIndexes (
+    sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Splits index.sql into its statements and keeps those that create an
+    index, with the names of the indexes.
+
+--*/
+{
+    char *text = BenchReadFile( "index.sql" );
+    const char *next;
+    const char *tail;
+    const char *sql;
+    sqlite3_stmt *stmt;
+    BENCH_INDEX *index;
+
+    if (text == NULL) {
+
+        return -1;
+    }
+
+    for (next = text; *next != '\0'; next = tail) {
+
+        stmt = NULL;
+
+        if (sqlite3_prepare_v2( Db, next, -1, &stmt, &tail ) != SQLITE_OK) {
+
+            fprintf( stderr, "index.sql: %s\n", sqlite3_errmsg( Db ) );
+            free( text );
+            return -1;
+        }
+
+        if (stmt == NULL) {
+
+            break;
+        }
+
+        //
+        //  The statement's text starts with the comments above it.
+        //
+
+        sql = strstr( sqlite3_sql( stmt ), "CREATE INDEX" );
+        index = &Bench.Indexes[Bench.IndexCount];
+
+        if (sql == NULL && strstr( sqlite3_sql( stmt ), "DROP INDEX" ) != NULL) {
+
+            //
+            //  Drops an index of older databases, nothing to measure.
+            //
+
+            sqlite3_finalize( stmt );
+            continue;
+        }
+
+        if (Bench.IndexCount == BENCH_MAX_INDEXES ||
+            sql == NULL ||
+            sscanf( sql, "CREATE INDEX IF NOT EXISTS %63s", index->Name ) != 1) {
+
+            fprintf( stderr, "index.sql: not an index this knows\n    %s\n", sqlite3_sql( stmt ) );
+            sqlite3_finalize( stmt );
+            free( text );
+            return -1;
+        }
+
+        index->Sql = strdup( sql );
+        Bench.IndexCount++;
+
+        sqlite3_finalize( stmt );
+    }
+
+    free( text );
+
+    return 0;
+}
+
+static void
+BenchRemove (
+    const char *Path
+    )
+{
+    char path[BENCH_PATH_SIZE + 8];
+
+    unlink( Path );
+    snprintf( path, sizeof( path ), "%s-wal", Path );
+    unlink( path );
+    snprintf( path, sizeof( path ), "%s-shm", Path );
+    unlink( path );
+}
+
+static long long
+BenchUsedBytes (
+    sqlite3 *Db
+    )
+{
+    sqlite3_stmt *stmt = NULL;
+    long long bytes = -1;
+
+    if (sqlite3_prepare_v2( Db,
+                            "SELECT (page_count - freelist_count) * page_size FROM pragma_page_count, pragma_freelist_count, pragma_page_size;",
+                            -1,
+                            &stmt,
+                            NULL ) == SQLITE_OK &&
+        sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        bytes = sqlite3_column_int64( stmt, 0 );
+    }
+
+    sqlite3_finalize( stmt );
+
+    return bytes;
+}
+
+static int
+BenchFiles (
+    sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Fills Files with the working set, FileID 1 to FileCount, as
+    FilesLookup would have added them.
+
+--*/
+{
+    static const char *const users[] = { "user01", "user02", "user03", "user04", "Administrator", "Public" };
+    static const char *const directories[] = {
+        "AppData\\Local\\Microsoft\\Windows\\INetCache\\IE",
+        "AppData\\Local\\Microsoft\\Edge\\User Data\\Default\\Cache\\Cache_Data",
+        "AppData\\Roaming\\Microsoft\\Windows\\Recent",
+        "AppData\\Local\\Temp",
+        "Documents\\Projects\\Quarterly Reports",
+        "Downloads" };
+    static const char *const extensions[] = { "tmp", "dat", "log", "docx", "json", "lnk" };
+    char path[BENCH_PATH_SIZE];
+    sqlite3_stmt *stmt = NULL;
+    ULONG index;
+    int rc = 0;
+
+    if (sqlite3_prepare_v2( Db, "INSERT INTO Files (FileID, Path) VALUES (?, ?);", -1, &stmt, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not prepare the Files insert: %s\n", sqlite3_errmsg( Db ) );
+        return -1;
+    }
+
+    sqlite3_exec( Db, "BEGIN;", NULL, NULL, NULL );
+
+    for (index = 0; index < Bench.FileCount && rc == 0; index++) {
+
+        snprintf( path, sizeof( path ),
+                  "\\Device\\HarddiskVolume3\\Users\\%s\\%s\\%08X\\file%06u.%s",
+                  users[BenchRandom32() % 6],
+                  directories[BenchRandom32() % 6],
+                  BenchRandom32() & 0xFFFF0FFF,
+                  index,
+                  extensions[BenchRandom32() % 6] );
+
+        sqlite3_bind_int64( stmt, 1, index + 1 );
+        sqlite3_bind_text( stmt, 2, path, -1, SQLITE_TRANSIENT );
+
+        if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+            fprintf( stderr, "Files insert failed: %s\n", sqlite3_errmsg( Db ) );
+            rc = -1;
+        }
+
+        sqlite3_reset( stmt );
+    }
+
+    sqlite3_exec( Db, "COMMIT;", NULL, NULL, NULL );
+    sqlite3_finalize( stmt );
+
+    return rc;
+}
+
+static int
+BenchInsert (
+    sqlite3 *Db,
+    unsigned long long Count,
+    double *Seconds
+    )
+/*++
+
+Routine Description:
+
+    Logs Count more operations, the way DatabaseDump does, following on
+    from the last ones.
+
+--*/
+{
+    static const char *const images[] = {
+        "C:\\Windows\\System32\\svchost.exe",
+        "C:\\Program Files (x86)\\Microsoft\\Edge\\Application\\msedge.exe",
+        "C:\\Windows\\explorer.exe",
+        "C:\\Windows\\System32\\SearchIndexer.exe" };
+    static const char *const majors[] = { "IRP_MJ_CREATE", "IRP_MJ_READ", "IRP_MJ_WRITE", "IRP_MJ_QUERY_INFORMATION",
+                                          "IRP_MJ_SET_INFORMATION", "IRP_MJ_CLEANUP", "IRP_MJ_CLOSE" };
+    const char *sql = "INSERT INTO MinifilterLog (SeqNum, OprType, PreOpTime, PostOpTime, ProcessId, ProcessFilePath, ThreadId, MajorOp, MinorOp, IrpFlags, DeviceObj, FileObj, FileTransaction, OpStatus, Information, Arg1, Arg2, Arg3, Arg4, Arg5, Arg6, OpFileName, RequestorMode, RuleID, RuleAction, StatusCode, ByteOffset, ByteLength, InfoClass, ControlCode, FileID) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    sqlite3_stmt *stmt = NULL;
+    unsigned long long row;
+    long long start;
+    char pointer[32];
+    ULONG process;
+    ULONG file;
+    ULONG major;
+    ULONG failure;
+    LONG status;
+
+    if (sqlite3_prepare_v2( Db, sql, -1, &stmt, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not prepare the insert: %s\n", sqlite3_errmsg( Db ) );
+        return -1;
+    }
+
+    start = BenchNow();
+
+    for (row = 0; row < Count; row++) {
+
+        if (row % Bench.Batch == 0) {
+
+            sqlite3_exec( Db, "BEGIN;", NULL, NULL, NULL );
+        }
+
+        file = BenchSkewed( Bench.FileCount );
+        process = BenchSkewed( BENCH_PROCESSES );
+        major = BenchRandom32() % 7;
+        failure = BenchRandom32() % 100;
+        status = (failure == 0) ? BENCH_ACCESS_DENIED :
+                 (failure < 3) ? BENCH_NOT_FOUND :
+                 (failure < 5) ? BENCH_NO_MORE_FILES : 0;
+        Bench.NextTime += 1 + BenchRandom32() % 2000;
+
+        sqlite3_bind_int64( stmt, 1, (sqlite3_int64)Bench.NextRow++ );
+        sqlite3_bind_text( stmt, 2, "IRP", -1, SQLITE_STATIC );
+        sqlite3_bind_int64( stmt, 3, Bench.NextTime );
+        sqlite3_bind_int64( stmt, 4, Bench.NextTime + BenchRandom32() % 500 );
+        sqlite3_bind_int64( stmt, 5, 4 * (1 + process) );
+        sqlite3_bind_text( stmt, 6, images[process % 4], -1, SQLITE_STATIC );
+        sqlite3_bind_int64( stmt, 7, 4 * (BENCH_PROCESSES + process * 8 + BenchRandom32() % 8) );
+        sqlite3_bind_text( stmt, 8, majors[major], -1, SQLITE_STATIC );
+        sqlite3_bind_text( stmt, 9, "", -1, SQLITE_STATIC );
+        sqlite3_bind_text( stmt, 10, "00000060", -1, SQLITE_STATIC );
+        sqlite3_bind_text( stmt, 11, "FFFFB30C5A1E3030", -1, SQLITE_STATIC );
+        snprintf( pointer, sizeof( pointer ), "FFFFB30C%08X", 0x7A4E0000 + file * 0x150 );
+        sqlite3_bind_text( stmt, 12, pointer, -1, SQLITE_TRANSIENT );
+        sqlite3_bind_text( stmt, 13, "0000000000000000", -1, SQLITE_STATIC );
+        sqlite3_bind_text( stmt, 14, (status == BENCH_ACCESS_DENIED) ? "STATUS_ACCESS_DENIED" :
+                                     (status == BENCH_NOT_FOUND) ? "STATUS_OBJECT_NAME_NOT_FOUND" :
+                                     (status == BENCH_NO_MORE_FILES) ? "STATUS_NO_MORE_FILES" : "STATUS_SUCCESS",
+                           -1,
+                           SQLITE_STATIC );
+        snprintf( pointer, sizeof( pointer ), "%016X", BenchRandom32() % 65536 );
+        sqlite3_bind_text( stmt, 15, pointer, -1, SQLITE_TRANSIENT );
+        sqlite3_bind_int64( stmt, 16, BenchRandom32() );
+        sqlite3_bind_int64( stmt, 17, 0 );
+        sqlite3_bind_int64( stmt, 18, BenchRandom32() % 1048576 );
+        sqlite3_bind_int64( stmt, 19, 0 );
+        sqlite3_bind_int64( stmt, 20, 0 );
+        sqlite3_bind_int64( stmt, 21, 0 );
+        sqlite3_bind_text( stmt, 23, "User", -1, SQLITE_STATIC );
+        sqlite3_bind_int64( stmt, 26, status );
+
+        if (major == 1 || major == 2) {
+
+            sqlite3_bind_int64( stmt, 27, BenchRandom32() % 1048576 * 4096 );
+            sqlite3_bind_int64( stmt, 28, 4096 );
+        }
+
+        sqlite3_bind_int64( stmt, 31, file + 1 );
+
+        if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+            fprintf( stderr, "Insert failed: %s\n", sqlite3_errmsg( Db ) );
+            break;
+        }
+
+        sqlite3_reset( stmt );
+        sqlite3_clear_bindings( stmt );
+
+        if (row % Bench.Batch == Bench.Batch - 1 || row == Count - 1) {
+
+            sqlite3_exec( Db, "COMMIT;", NULL, NULL, NULL );
+        }
+    }
+
+    *Seconds = (BenchNow() - start) / 1e9;
+
+    sqlite3_finalize( stmt );
+
+    return (row == Count) ? 0 : -1;
+}
+
+static int
+BenchAppend (
+    sqlite3 *Db,
+    double *Seconds
+    )
+/*++
+
+Routine Description:
+
+    Logs Append more operations at the end of the log, with whatever
+    indexes are in place, and deletes them again by LogID, which needs no
+    index.  Every append logs the same operations.
+
+--*/
+{
+    unsigned long long random = BenchCommon.Random;
+    unsigned long long row = Bench.NextRow;
+    long long time = Bench.NextTime;
+    char sql[128];
+    int rc;
+
+    rc = BenchInsert( Db, Bench.Append, Seconds );
+
+    snprintf( sql, sizeof( sql ), "DELETE FROM MinifilterLog WHERE LogID > %lld;", Bench.LastLogId );
+
+    if (BenchExec( Db, sql ) != 0) {
+
+        rc = -1;
+    }
+
+    sqlite3_exec( Db, "PRAGMA wal_checkpoint(TRUNCATE);", NULL, NULL, NULL );
+
+    BenchCommon.Random = random;
+    Bench.NextRow = row;
+    Bench.NextTime = time;
+
+    return rc;
+}
+
+static double
+BenchQuery (
+    sqlite3 *Db,
+    BENCH_QUERY_KIND Kind,
+    unsigned long long *Digest,
+    long long *Rows
+    )
+/*++
+
+Routine Description:
+
+    Runs a query to the end three times.
+
+Return Value:
+
+    The fastest run in seconds, a digest of what the query returned and
+    the rows it returned.
+
+--*/
+{
+    sqlite3_stmt *stmt = NULL;
+    unsigned long long digest = 0;
+    const unsigned char *text;
+    double best = 0;
+    double seconds;
+    long long start;
+    long long count;
+    int column;
+    int length;
+    int index;
+    int run;
+
+    if (sqlite3_prepare_v2( Db, BenchQuerySql[Kind].Sql, -1, &stmt, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not prepare %s: %s\n", BenchQuerySql[Kind].Sql, sqlite3_errmsg( Db ) );
+        return -1;
+    }
+
+    //
+    //  A second of log for the window, the last ten seconds of it for a
+    //  process and for failures.  The process is one of the busier ones,
+    //  though not the busiest.
+    //
+
+    if (Kind == BenchQueryWindow) {
+
+        sqlite3_bind_int64( stmt, 1, (BENCH_FIRST_TIME + Bench.LastTime) / 2 );
+        sqlite3_bind_int64( stmt, 2, (BENCH_FIRST_TIME + Bench.LastTime) / 2 + BENCH_SECOND );
+
+    } else if (sqlite3_bind_parameter_count( stmt ) > 0) {
+
+        sqlite3_bind_int64( stmt, 1, Bench.LastTime - 10 * BENCH_SECOND );
+    }
+
+    if (sqlite3_bind_parameter_count( stmt ) >= 3) {
+
+        sqlite3_bind_int64( stmt, 3, 4 * 8 );
+    }
+
+    for (run = 0; run < 3; run++) {
+
+        start = BenchNow();
+        digest = 14695981039346656037ULL;
+        count = 0;
+
+        while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+            for (column = 0; column < sqlite3_column_count( stmt ); column++) {
+
+                text = sqlite3_column_text( stmt, column );
+                length = sqlite3_column_bytes( stmt, column );
+
+                for (index = 0; index < length; index++) {
+
+                    digest = (digest ^ text[index]) * 1099511628211ULL;
+                }
+
+                digest = (digest ^ 0xFF) * 1099511628211ULL;
+            }
+
+            count++;
+        }
+
+        seconds = (BenchNow() - start) / 1e9;
+        sqlite3_reset( stmt );
+
+        if (run == 0 || seconds < best) {
+
+            best = seconds;
+        }
+    }
+
+    sqlite3_finalize( stmt );
+    *Digest = digest;
+    *Rows = count;
+
+    return best;
+}
+
+static void
+BenchPlan (
+    sqlite3 *Db,
+    BENCH_QUERY_KIND Kind,
+    char *Plan,
+    size_t Size
+    )
+{
+    char sql[1024];
+    sqlite3_stmt *stmt = NULL;
+    size_t used = 0;
+
+    Plan[0] = '\0';
+    snprintf( sql, sizeof( sql ), "EXPLAIN QUERY PLAN %s", BenchQuerySql[Kind].Sql );
+
+    if (sqlite3_prepare_v2( Db, sql, -1, &stmt, NULL ) != SQLITE_OK) {
+
+        return;
+    }
+
+    while (sqlite3_step( stmt ) == SQLITE_ROW && used < Size) {
+
+        used += snprintf( Plan + used, Size - used, "%s%s", used ? "; " : "", sqlite3_column_text( stmt, 3 ) );
+    }
+
+    sqlite3_finalize( stmt );
+}
+
+static int
+BenchRun (
+    void
+    )
+{
+    BENCH_INDEX *index;
+    BENCH_QUERY *query;
+    sqlite3 *db = NULL;
+    char sql[BENCH_NAME_SIZE + 32];
+    long long start;
+    long long bytes;
+    ULONG kind;
+    ULONG i;
+
+    BenchRemove( Bench.File );
+
+    if (sqlite3_open( Bench.File, &db ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not open %s: %s\n", Bench.File, sqlite3_errmsg( db ) );
+        sqlite3_close( db );
+        return -1;
+    }
+
+    sqlite3_exec( db, "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;", NULL, NULL, NULL );
+
+    //
+    //  As InitializeDatabaseFile and DatabaseOpenLog lay a new database
+    //  out, but for index.sql
+    //
+
+    if (BenchExecFile( db, "create.sql" ) != 0 ||
+        BenchExecFile( db, "files.sql" ) != 0 ||
+        BenchLoadIndexes( db ) != 0 ||
+        BenchFiles( db ) != 0) {
+
+        goto Failed;
+    }
+
+    Bench.NextTime = BENCH_FIRST_TIME;
+
+    printf( "Logging %llu operations on %u files, %u a transaction, without the indexes of index.sql\n",
+            Bench.Rows,
+            Bench.FileCount,
+            Bench.Batch );
+    fflush( stdout );
+
+    if (BenchInsert( db, Bench.Rows, &Bench.FillSeconds ) != 0) {
+
+        goto Failed;
+    }
+
+    Bench.LastTime = Bench.NextTime;
+    Bench.LastLogId = sqlite3_last_insert_rowid( db );
+    sqlite3_exec( db, "PRAGMA wal_checkpoint(TRUNCATE);", NULL, NULL, NULL );
+
+    printf( "    %.0f rows/s, %.1f MB\n", Bench.Rows / Bench.FillSeconds, BenchUsedBytes( db ) / 1048576.0 );
+    fflush( stdout );
+
+    for (kind = 0; kind < BenchQueries; kind++) {
+
+        query = &Bench.Queries[kind];
+        query->Before = BenchQuery( db, kind, &query->BeforeDigest, &query->Rows );
+    }
+
+    if (BenchAppend( db, &Bench.NoIndexSeconds ) != 0) {
+
+        goto Failed;
+    }
+
+    //
+    //  Each index on its own.
+    //
+
+    for (i = 0; i < Bench.IndexCount; i++) {
+
+        index = &Bench.Indexes[i];
+
+        bytes = BenchUsedBytes( db );
+        start = BenchNow();
+
+        if (BenchExec( db, index->Sql ) != 0) {
+
+            goto Failed;
+        }
+
+        index->BuildSeconds = (BenchNow() - start) / 1e9;
+        index->Bytes = BenchUsedBytes( db ) - bytes;
+
+        if (BenchAppend( db, &index->AppendSeconds ) != 0) {
+
+            goto Failed;
+        }
+
+        snprintf( sql, sizeof( sql ), "DROP INDEX %s;", index->Name );
+
+        if (BenchExec( db, sql ) != 0) {
+
+            goto Failed;
+        }
+
+        printf( "    %-36s built in %.2f s\n", index->Name, index->BuildSeconds );
+        fflush( stdout );
+    }
+
+    //
+    //  And all of them, as the writer runs.
+    //
+
+    bytes = BenchUsedBytes( db );
+    start = BenchNow();
+
+    if (BenchExecFile( db, "index.sql" ) != 0) {
+
+        goto Failed;
+    }
+
+    Bench.AllBuildSeconds = (BenchNow() - start) / 1e9;
+    Bench.AllBytes = BenchUsedBytes( db ) - bytes;
+
+    if (BenchAppend( db, &Bench.AllSeconds ) != 0) {
+
+        goto Failed;
+    }
+
+    for (kind = 0; kind < BenchQueries; kind++) {
+
+        query = &Bench.Queries[kind];
+        query->After = BenchQuery( db, kind, &query->AfterDigest, &query->Rows );
+        BenchPlan( db, kind, query->Plan, sizeof( query->Plan ) );
+    }
+
+    sqlite3_close( db );
+    BenchRemove( Bench.File );
+
+    return 0;
+
+Failed:
+
+    sqlite3_close( db );
+    BenchRemove( Bench.File );
+
+    return -1;
+}
+
+static void
+BenchUsage (
+    void
+    )
+{
+    printf( "Usage: mspyIndexBench [-n <operations>] [-a <operations>] [-f <files>] [-b <batch>] [-s <sql directory>] [-o <directory>]\n"
+            "\n"
+            "    [-n <operations>] operations in the log, 1000000 by default\n"
+            "    [-a <operations>] operations logged with each index in place, 100000 by default\n"
+            "    [-f <files>] files in the working set, 20000 by default\n"
+            "    [-b <batch>] operations a transaction, 1000 by default\n"
+            "    [-s <sql directory>] where create.sql and the others are, ../user by default\n"
+            "    [-o <directory>] where the database is written, /tmp by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    BENCH_INDEX *index;
+    BENCH_QUERY *query;
+    double baseline;
+    double rate;
+    BOOLEAN differ = FALSE;
+    ULONG kind;
+    ULONG i;
+    int option;
+
+    Bench.Rows = 1000000;
+    Bench.Append = 100000;
+    Bench.FileCount = 20000;
+    Bench.Batch = 1000;
+    Bench.SqlDirectory = "../user";
+    Bench.OutDirectory = "/tmp";
+
+    while ((option = getopt( argc, argv, "n:a:f:b:s:o:" )) != -1) {
+
+        switch (option) {
+
+            case 'n':
+                Bench.Rows = strtoull( optarg, NULL, 0 );
+                break;
+
+            case 'a':
+                Bench.Append = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'f':
+                Bench.FileCount = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'b':
+                Bench.Batch = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 's':
+                Bench.SqlDirectory = optarg;
+                break;
+
+            case 'o':
+                Bench.OutDirectory = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || Bench.Rows == 0 || Bench.Append == 0 || Bench.FileCount == 0 || Bench.Batch == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    snprintf( Bench.File, sizeof( Bench.File ), "%s/mspyIndexBench.db", Bench.OutDirectory );
+    if (BenchRun() != 0) {
+
+        return 2;
+    }
+
+    baseline = Bench.Append / Bench.NoIndexSeconds;
+
+    printf( "\n    Logging %u more operations with each index of index.sql in place:\n\n", Bench.Append );
+    printf( "    %-36s %10s %8s %12s %8s\n", "", "build s", "MB", "rows/s", "cost" );
+    printf( "    %-36s %10s %8s %12.0f\n", "none", "", "", baseline );
+
+    for (i = 0; i < Bench.IndexCount; i++) {
+
+        index = &Bench.Indexes[i];
+        rate = Bench.Append / index->AppendSeconds;
+
+        printf( "    %-36s %10.2f %8.1f %12.0f %7.1f%%\n",
+                index->Name,
+                index->BuildSeconds,
+                index->Bytes / 1048576.0,
+                rate,
+                100.0 * (baseline - rate) / baseline );
+    }
+
+    rate = Bench.Append / Bench.AllSeconds;
+
+    printf( "    %-36s %10.2f %8.1f %12.0f %7.1f%%\n",
+            "all",
+            Bench.AllBuildSeconds,
+            Bench.AllBytes / 1048576.0,
+            rate,
+            100.0 * (baseline - rate) / baseline );
+
+    printf( "\n    Queries, fastest of three:\n\n" );
+    printf( "    %-18s %8s %12s %12s %9s\n", "", "rows", "before ms", "after ms", "speedup" );
+
+    for (kind = 0; kind < BenchQueries; kind++) {
+
+        query = &Bench.Queries[kind];
+
+        printf( "    %-18s %8lld %12.2f %12.2f %8.1fx\n",
+                BenchQuerySql[kind].Name,
+                query->Rows,
+                query->Before * 1000,
+                query->After * 1000,
+                query->After > 0 ? query->Before / query->After : 0.0 );
+        printf( "        %s\n", query->Plan );
+
+        if (query->AfterDigest != query->BeforeDigest) {
+
+            printf( "        returned something else with the indexes\n" );
+            differ = TRUE;
+        }
+    }
+
+    return differ ? 1 : 0;
+}
@@ -0,0 +1,1652 @@
+/*++
+
+Module Name:
+
+    mspyMassModTest.c
+
+Abstract:
+
+    Checks the mass modification detector, user/mspyMassMod.c, for
+    accuracy on synthetic traces and measures it, in a Linux program
+    against ushim.
+
+    mspyMassMod.c is included rather than linked.  Four checks run:
+
+        The distinct file estimate of one process, for 1 to 200000 files
+        written within a pane, must stay within 5 standard errors of the
+        HyperLogLog, 1.04 / sqrt(MASSMOD_REGISTERS), with the error over
+        the trials no more than 1.5 standard errors.  Names written again,
+        or in another case, must not change it.
+
+        A random trace of a few dozen processes writing, renaming,
+        deleting and doing other work, some of it failing, paging or a
+        little out of order, with idle gaps and process ids reused, is run
+        beside a plain model that keeps every counted operation in a
+        queue.  The write, rename and delete counts of the window and the
+        alerts they raise must match the model exactly, the estimate must
+        stay within 5 standard errors of the exact number of distinct
+        files, and each process's union must be the maximum of its panes'
+        registers.
+
+        A trace of a few hundred ordinary processes, editors saving
+        documents, loggers, builds, sync clients, the cache manager's
+        paging writes and a scanner whose writes are denied, with
+        ransomware of three kinds and wipers started among them under the
+        default thresholds.  Every attacker must be caught by the time it
+        has gone through 1 + 5 standard errors of the threshold in files,
+        and alert at most once a window after that; no ordinary process
+        may alert, nor an attacker working more slowly than the thresholds,
+        nor the process that takes an attacker's id after it exits.
+
+        More processes than MASSMOD_MAX_PROCESSES at once must leave the
+        rest unfollowed, and a window later only the processes still
+        active may be held.  A process is dropped exactly a window after
+        its last operation, and panes moving on by a whole window in less
+        time must leave nothing of the old ones.
+
+    It prints the estimate's error, how soon each kind of attacker was
+    caught, and the ns MassModAdd takes a record.
+
+    It returns 1 when a check fails.
+
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspyMassModTest mspyMassModTest.c -lsqlite3 -lm
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ushim/ushimLog.c"
+#include "../user/mspyMassMod.c"
+#include "mspyBench.h"
+
+#define BENCH_TEXT_SIZE         128
+#define BENCH_START             132000000000000000LL
+#define BENCH_SECOND            10000000LL
+#define BENCH_TICK              (BENCH_SECOND / 100)
+#define BENCH_ERROR             (1.04 / sqrt( MASSMOD_REGISTERS ))
+#define BENCH_MODEL_PROCESSES   40
+#define BENCH_MODEL_POOL        4096
+#define BENCH_POOL              (1 << 18)
+
+#define STATUS_ACCESS_DENIED_BENCH      0xC0000022
+#define STATUS_BUFFER_OVERFLOW_BENCH    0x80000005
+#define STATUS_REPARSE_BENCH            0x00000104
+
+#define FILE_BASIC_INFORMATION_BENCH    4
+
+//
+//  What the model keeps of an operation that counted.
+//
+
+#define MODEL_WRITE             0
+#define MODEL_RENAME            1
+#define MODEL_DELETE            2
+
+typedef struct _MODEL_EVENT {
+
+    LONGLONG Pane;
+    ULONG File;
+    ULONG Kind;
+
+} MODEL_EVENT, *PMODEL_EVENT;
+
+typedef struct _MODEL_PROCESS {
+
+    BOOLEAN Present;
+    ULONG Image;
+
+    LONGLONG Newest;
+    LONGLONG LastTime;
+    LONGLONG QuietUntil;
+
+    ULONG Window[3];
+
+    //
+    //  Operations of the window, oldest first.  They are queued in the
+    //  newest pane at the time, so panes never go down the queue.
+    //
+
+    PMODEL_EVENT Events;
+    ULONG Head;
+    ULONG Tail;
+    ULONG Size;
+
+} MODEL_PROCESS, *PMODEL_PROCESS;
+
+typedef struct _MODEL_STATE {
+
+    LONGLONG SweepPane;
+    ULONG Thresholds[3];
+
+    MODEL_PROCESS Processes[BENCH_MODEL_PROCESSES];
+
+    ULONG Generation;
+    ULONG Seen[BENCH_MODEL_PROCESSES * BENCH_MODEL_POOL];
+
+} MODEL_STATE;
+
+//
+//  A process of the detection trace.
+//
+
+typedef enum _BENCH_KIND {
+
+    BenchEditor,
+    BenchLogger,
+    BenchBuilder,
+    BenchSync,
+    BenchCache,
+    BenchScanner,
+    BenchAttacker,
+    BenchWiper,
+    BenchSlow,
+    BenchKinds
+
+} BENCH_KIND;
+
+static const char *BenchKindNames[BenchKinds] = {
+    "editor", "logger", "builder", "sync", "cache", "scanner", "attacker", "wiper", "slow"
+};
+
+static const char *BenchVariantNames[3] = {
+    "encrypting in place and renaming",
+    "writing a copy and deleting",
+    "renaming and encrypting"
+};
+
+typedef struct _BENCH_ACTOR {
+
+    BENCH_KIND Kind;
+    ULONG Variant;
+    ULONG_PTR ProcessId;
+    char Image[BENCH_TEXT_SIZE];
+
+    LONGLONG Start;
+    LONGLONG End;
+    LONGLONG NextBurst;
+    double Rate;                // units of work a second
+    double Credit;
+    ULONG Units;
+
+    ULONG Alerts;
+    LONGLONG FirstAlert;
+    ULONG UnitsAtAlert;
+
+} BENCH_ACTOR, *PBENCH_ACTOR;
+
+typedef struct _BENCH_STATE {
+
+    //
+    //  Names for the measurements, made beforehand.
+    //
+
+    WCHAR (*Pool)[64];
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+static MODEL_STATE Model;
+
+static VOID
+BenchWiden (
+    _In_z_ const char *Text,
+    _Out_ WCHAR *Name,
+    _In_ BOOLEAN MixCase
+    )
+/*++
+
+Routine Description:
+
+    Copies an ASCII name into a WCHAR one, swapping the case of some
+    letters when asked.
+
+--*/
+{
+    WCHAR ch;
+
+    do {
+
+        ch = (UCHAR)*Text;
+
+        if (MixCase && ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')) && BenchBelow( 4 ) == 0) {
+
+            ch ^= 0x20;
+        }
+
+        *Name++ = ch;
+
+    } while (*Text++ != '\0');
+}
+
+static VOID
+BenchReset (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Drops every process the detector follows and clears its counters.
+
+--*/
+{
+    MassModSweep( LLONG_MAX );
+    MassMod.SweepPane = 0;
+    MassMod.Alerts = 0;
+    MassMod.Untracked = 0;
+    MassMod.Peak = 0;
+}
+
+static PMASSMOD_PROCESS
+BenchEntry (
+    _In_ ULONG_PTR ProcessId
+    )
+{
+    PMASSMOD_PROCESS process;
+
+    for (process = MassMod.Buckets[MassModBucket( ProcessId )]; process != NULL; process = process->Next) {
+
+        if (process->ProcessId == ProcessId) {
+
+            return process;
+        }
+    }
+
+    return NULL;
+}
+
+static BOOLEAN
+BenchAdd (
+    _In_ LONGLONG Time,
+    _In_ ULONG_PTR ProcessId,
+    _In_ UCHAR MajorId,
+    _In_ ULONG InfoClass,
+    _In_ ULONG IrpFlags,
+    _In_ ULONG Status,
+    _In_z_ const WCHAR *Name,
+    _In_z_ const char *Image
+    )
+/*++
+
+Routine Description:
+
+    Runs one record through MassModAdd and returns whether it raised an
+    alert.
+
+--*/
+{
+    RECORD_DATA recordData;
+    LONG alerts = MassMod.Alerts;
+
+    memset( &recordData, 0, sizeof( recordData ) );
+
+    recordData.OriginatingTime.QuadPart = Time;
+    recordData.ProcessId = (FILE_ID)ProcessId;
+    recordData.CallbackMajorId = MajorId;
+    recordData.IrpFlags = IrpFlags;
+    recordData.Status = (NTSTATUS)Status;
+    recordData.Arg2 = (PVOID)(ULONG_PTR)InfoClass;
+
+    MassModAdd( &recordData, Name, Image );
+
+    return (MassMod.Alerts != alerts);
+}
+
+//
+//  Distinct file estimate.
+//
+
+static VOID
+BenchCheckEstimate (
+    _In_ ULONG Trials
+    )
+/*++
+
+Routine Description:
+
+    Writes N distinct files from one process within a pane, Trials times
+    for each N, and compares the estimate with N.
+
+--*/
+{
+    static const ULONG counts[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 50000, 200000 };
+    const char *image = "\\Device\\HarddiskVolume2\\Windows\\System32\\bench.exe";
+    LONGLONG time = BENCH_START;
+    PMASSMOD_PROCESS process;
+    char text[BENCH_TEXT_SIZE];
+    char detail[160];
+    WCHAR name[BENCH_TEXT_SIZE];
+    double error;
+    double bias;
+    double squares;
+    double worst;
+    ULONG estimate;
+    ULONG before;
+    ULONG count;
+    ULONG trial;
+    ULONG file;
+
+    BenchReset();
+    MassModSetThresholds( 0, 0, 0, 0 );
+
+    printf( "Distinct file estimate of one process, %u trials for each count, %.1f%% standard error:\n",
+            Trials, 100 * BENCH_ERROR );
+
+    for (count = 0; count < sizeof( counts ) / sizeof( counts[0] ); count++) {
+
+        bias = 0;
+        squares = 0;
+        worst = 0;
+
+        for (trial = 0; trial < Trials; trial++) {
+
+            //
+            //  Each trial starts on a new pane, a window after the last, so
+            //  the entry is dropped and made again.
+            //
+
+            time += MASSMOD_WINDOW + MASSMOD_PANE;
+            time -= time % MASSMOD_PANE;
+
+            for (file = 0; file < counts[count]; file++) {
+
+                snprintf( text, sizeof( text ), "\\Device\\HarddiskVolume2\\Users\\bench\\t%u-%u\\file%u.dat", count, trial, file );
+                BenchWiden( text, name, FALSE );
+                BenchAdd( time + file, 8, IRP_MJ_WRITE, 0, 0, 0, name, image );
+            }
+
+            process = BenchEntry( 8 );
+            estimate = (process != NULL) ? MassModEstimate( process ) : 0;
+            error = ((double)estimate - counts[count]) / counts[count];
+
+            bias += error;
+            squares += error * error;
+            worst = max( worst, fabs( error ) );
+
+            BenchCommon.Checks++;
+
+            if (fabs( (double)estimate - counts[count] ) > 5 * BENCH_ERROR * counts[count] + 1) {
+
+                snprintf( detail, sizeof( detail ), "%u files estimated at %u", counts[count], estimate );
+                BenchFail( "estimate within 5 standard errors", detail );
+            }
+
+            //
+            //  The same names again, some letters in the other case.
+            //
+
+            if (trial == 0 && counts[count] <= 10000) {
+
+                before = estimate;
+
+                for (file = 0; file < counts[count]; file++) {
+
+                    snprintf( text, sizeof( text ), "\\Device\\HarddiskVolume2\\Users\\bench\\t%u-%u\\file%u.dat", count, trial, file );
+                    BenchWiden( text, name, TRUE );
+                    BenchAdd( time + counts[count] + file, 8, IRP_MJ_WRITE, 0, 0, 0, name, image );
+                }
+
+                process = BenchEntry( 8 );
+                estimate = (process != NULL) ? MassModEstimate( process ) : 0;
+
+                BenchCommon.Checks++;
+
+                if (estimate != before) {
+
+                    snprintf( detail, sizeof( detail ), "%u files estimated at %u, then %u", counts[count], before, estimate );
+                    BenchFail( "names written again not counted", detail );
+                }
+            }
+        }
+
+        bias /= Trials;
+        squares = sqrt( squares / Trials );
+
+        printf( "    %6u files: %+6.2f%% mean error, %5.2f%% root mean square, %5.2f%% worst\n",
+                counts[count], 100 * bias, 100 * squares, 100 * worst );
+
+        BenchCommon.Checks++;
+
+        if (Trials >= 10 && squares > 1.5 * BENCH_ERROR) {
+
+            snprintf( detail, sizeof( detail ), "%u files, %.2f%% root mean square error", counts[count], 100 * squares );
+            BenchFail( "estimate error within 1.5 standard errors", detail );
+        }
+    }
+}
+
+//
+//  Window counts and alerts against a model.
+//
+
+static BOOLEAN
+ModelAdd (
+    _In_ LONGLONG Time,
+    _In_ ULONG Process,
+    _In_ ULONG Image,
+    _In_ UCHAR MajorId,
+    _In_ ULONG InfoClass,
+    _In_ ULONG IrpFlags,
+    _In_ ULONG Status,
+    _In_ ULONG File
+    )
+/*++
+
+Routine Description:
+
+    Counts a record as the detector is documented to, and returns whether
+    it should raise an alert.  The distinct files are left to
+    ModelDistinct.
+
+--*/
+{
+    PMODEL_PROCESS process = &Model.Processes[Process];
+    LONGLONG pane = Time / MASSMOD_PANE;
+    PMODEL_EVENT event;
+    ULONG kind;
+    ULONG index;
+
+    if (Status >= 0x80000000) {
+
+        return FALSE;
+    }
+
+    if (MajorId == IRP_MJ_WRITE && !(IrpFlags & IRP_PAGING_IO)) {
+
+        kind = MODEL_WRITE;
+
+    } else if (MajorId == IRP_MJ_SET_INFORMATION && (InfoClass == 10 || InfoClass == 65)) {
+
+        kind = MODEL_RENAME;
+
+    } else if (MajorId == IRP_MJ_SET_INFORMATION && (InfoClass == 13 || InfoClass == 64)) {
+
+        kind = MODEL_DELETE;
+
+    } else {
+
+        return FALSE;
+    }
+
+    //
+    //  A process is forgotten once a window has gone by since it last
+    //  counted, looked at whenever the record time enters another pane.
+    //
+
+    if (pane != Model.SweepPane) {
+
+        for (index = 0; index < BENCH_MODEL_PROCESSES; index++) {
+
+            if (Model.Processes[index].Present && Model.Processes[index].LastTime + MASSMOD_WINDOW <= Time) {
+
+                Model.Processes[index].Present = FALSE;
+            }
+        }
+
+        Model.SweepPane = pane;
+    }
+
+    if (!process->Present || process->Image != Image) {
+
+        process->Present = TRUE;
+        process->Image = Image;
+        process->Newest = pane;
+        process->LastTime = 0;
+        process->QuietUntil = 0;
+        process->Head = 0;
+        process->Tail = 0;
+        memset( process->Window, 0, sizeof( process->Window ) );
+    }
+
+    process->Newest = max( process->Newest, pane );
+    process->LastTime = max( process->LastTime, Time );
+
+    while (process->Head < process->Tail && process->Events[process->Head].Pane <= process->Newest - MASSMOD_PANES) {
+
+        process->Window[process->Events[process->Head].Kind]--;
+        process->Head++;
+    }
+
+    if (process->Tail == process->Size && process->Head != 0) {
+
+        memmove( process->Events, process->Events + process->Head, (process->Tail - process->Head) * sizeof( MODEL_EVENT ) );
+        process->Tail -= process->Head;
+        process->Head = 0;
+    }
+
+    if (process->Tail == process->Size) {
+
+        process->Size = max( 1024, process->Size * 2 );
+        process->Events = realloc( process->Events, process->Size * sizeof( MODEL_EVENT ) );
+
+        if (process->Events == NULL) {
+
+            printf( "Out of memory in the model\n" );
+            exit( 2 );
+        }
+    }
+
+    event = &process->Events[process->Tail++];
+    event->Pane = process->Newest;
+    event->File = File;
+    event->Kind = kind;
+    process->Window[kind]++;
+
+    if (Time < process->QuietUntil) {
+
+        return FALSE;
+    }
+
+    for (kind = 0; kind < 3; kind++) {
+
+        if (Model.Thresholds[kind] != 0 && process->Window[kind] >= Model.Thresholds[kind]) {
+
+            process->QuietUntil = Time + MASSMOD_WINDOW;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static ULONG
+ModelDistinct (
+    _In_ ULONG Process
+    )
+{
+    PMODEL_PROCESS process = &Model.Processes[Process];
+    PMODEL_EVENT event;
+    ULONG distinct = 0;
+    ULONG index;
+
+    Model.Generation++;
+
+    for (index = process->Head; index < process->Tail; index++) {
+
+        event = &process->Events[index];
+
+        if (event->Pane > process->Newest - MASSMOD_PANES &&
+            event->Kind != MODEL_DELETE &&
+            Model.Seen[event->File] != Model.Generation) {
+
+            Model.Seen[event->File] = Model.Generation;
+            distinct++;
+        }
+    }
+
+    return distinct;
+}
+
+static VOID
+BenchModelName (
+    _In_ ULONG Process,
+    _In_ ULONG Image,
+    _Out_writes_(BENCH_TEXT_SIZE) char *Text
+    )
+{
+    snprintf( Text, BENCH_TEXT_SIZE, "\\Device\\HarddiskVolume2\\Program Files\\app%u\\image%u.exe", Process, Image );
+}
+
+static VOID
+BenchCompare (
+    _In_ ULONG Process,
+    _Inout_ double *Squares,
+    _Inout_ ULONG *Within,
+    _Inout_ ULONG *Compared
+    )
+/*++
+
+Routine Description:
+
+    Compares what the detector holds for a process with the model.
+
+--*/
+{
+    PMODEL_PROCESS model = &Model.Processes[Process];
+    PMASSMOD_PROCESS process = BenchEntry( 1000 + 4 * Process );
+    char image[BENCH_TEXT_SIZE];
+    char detail[200];
+    double sum = 0;
+    double error;
+    ULONG zeros = 0;
+    ULONG distinct;
+    ULONG estimate;
+    ULONG index;
+    ULONG pane;
+    UCHAR value;
+
+    BenchCommon.Checks++;
+
+    if ((process != NULL) != model->Present) {
+
+        snprintf( detail, sizeof( detail ), "process %u %s", Process, model->Present ? "dropped" : "kept" );
+        BenchFail( "processes followed", detail );
+        return;
+    }
+
+    if (process == NULL) {
+
+        return;
+    }
+
+    BenchModelName( Process, model->Image, image );
+
+    BenchCommon.Checks++;
+
+    if (strcmp( process->ProcessFilePath, image ) != 0 ||
+        process->WindowWrites != model->Window[MODEL_WRITE] ||
+        process->WindowRenames != model->Window[MODEL_RENAME] ||
+        process->WindowDeletes != model->Window[MODEL_DELETE]) {
+
+        snprintf( detail, sizeof( detail ), "process %u has %u writes, %u renames, %u deletes, expected %u, %u, %u",
+                  Process,
+                  process->WindowWrites, process->WindowRenames, process->WindowDeletes,
+                  model->Window[MODEL_WRITE], model->Window[MODEL_RENAME], model->Window[MODEL_DELETE] );
+        BenchFail( "window counts", detail );
+    }
+
+    for (index = 0; index < MASSMOD_REGISTERS; index++) {
+
+        value = 0;
+
+        for (pane = 0; pane < MASSMOD_PANES; pane++) {
+
+            value = max( value, process->Registers[pane][index] );
+        }
+
+        if (value != process->Union[index]) {
+
+            break;
+        }
+
+        sum += ldexp( 1.0, -(int)value );
+        zeros += (value == 0);
+    }
+
+    BenchCommon.Checks++;
+
+    if (index != MASSMOD_REGISTERS || zeros != process->Zeros || fabs( sum - process->Sum ) > 1e-9) {
+
+        snprintf( detail, sizeof( detail ), "process %u, register %u of %u", Process, index, MASSMOD_REGISTERS );
+        BenchFail( "union of the panes", detail );
+    }
+
+    distinct = ModelDistinct( Process );
+    estimate = MassModEstimate( process );
+
+    BenchCommon.Checks++;
+
+    if (fabs( (double)estimate - distinct ) > 5 * BENCH_ERROR * distinct + 2) {
+
+        snprintf( detail, sizeof( detail ), "process %u, %u distinct files estimated at %u", Process, distinct, estimate );
+        BenchFail( "window estimate within 5 standard errors", detail );
+    }
+
+    if (distinct >= 50) {
+
+        error = ((double)estimate - distinct) / distinct;
+        *Squares += error * error;
+        *Within += (fabs( error ) <= BENCH_ERROR);
+        (*Compared)++;
+    }
+}
+
+static VOID
+BenchCheckModel (
+    _In_ ULONG Records
+    )
+/*++
+
+Routine Description:
+
+    Runs a random trace through the detector and the model.  Busier
+    processes come first, and process i picks its files from 4 << (i % 11)
+    names.
+
+--*/
+{
+    ULONG images[BENCH_MODEL_PROCESSES] = { 0 };
+    LONGLONG time = BENCH_START;
+    LONGLONG recordTime;
+    char image[BENCH_TEXT_SIZE];
+    char text[BENCH_TEXT_SIZE];
+    char detail[160];
+    WCHAR name[BENCH_TEXT_SIZE];
+    double squares = 0;
+    ULONG compared = 0;
+    ULONG within = 0;
+    ULONG alerts = 0;
+    ULONG process;
+    ULONG file;
+    ULONG roll;
+    ULONG status;
+    ULONG infoClass;
+    ULONG irpFlags;
+    ULONG index;
+    UCHAR majorId;
+    BOOLEAN raised;
+    BOOLEAN expected;
+
+    BenchReset();
+
+    Model.Thresholds[MODEL_WRITE] = 1000;
+    Model.Thresholds[MODEL_RENAME] = 200;
+    Model.Thresholds[MODEL_DELETE] = 150;
+    MassModSetThresholds( 0, Model.Thresholds[MODEL_WRITE], Model.Thresholds[MODEL_RENAME], Model.Thresholds[MODEL_DELETE] );
+
+    for (index = 0; index < Records; index++) {
+
+        //
+        //  About 10000 records a second, now and then nothing for up to
+        //  three windows, and one in 20 records up to half a pane late.
+        //
+
+        if (BenchBelow( 50000 ) == 0) {
+
+            time += BenchBelow( 3 * MASSMOD_WINDOW );
+        }
+
+        time += BenchBelow( 2000 );
+        recordTime = (BenchBelow( 20 ) == 0) ? time - BenchBelow( MASSMOD_PANE / 2 ) : time;
+
+        process = BenchBelow( BenchBelow( BENCH_MODEL_PROCESSES ) + 1 );
+
+        if (BenchBelow( 20000 ) == 0) {
+
+            images[process]++;
+        }
+
+        file = process * BENCH_MODEL_POOL + BenchBelow( 4 << (process % 11) );
+
+        roll = BenchBelow( 100 );
+        infoClass = 0;
+        irpFlags = 0;
+
+        if (roll < 45) {
+
+            majorId = IRP_MJ_WRITE;
+
+        } else if (roll < 55) {
+
+            majorId = IRP_MJ_WRITE;
+            irpFlags = IRP_PAGING_IO;
+
+        } else if (roll < 65) {
+
+            majorId = IRP_MJ_SET_INFORMATION;
+            infoClass = BenchBelow( 2 ) ? 10 : 65;
+
+        } else if (roll < 72) {
+
+            majorId = IRP_MJ_SET_INFORMATION;
+            infoClass = BenchBelow( 2 ) ? 13 : 64;
+
+        } else if (roll < 80) {
+
+            majorId = IRP_MJ_SET_INFORMATION;
+            infoClass = FILE_BASIC_INFORMATION_BENCH;
+
+        } else if (roll < 90) {
+
+            majorId = IRP_MJ_READ;
+
+        } else {
+
+            majorId = IRP_MJ_CREATE;
+        }
+
+        roll = BenchBelow( 100 );
+        status = (roll < 4) ? STATUS_ACCESS_DENIED_BENCH :
+                 (roll < 8) ? STATUS_BUFFER_OVERFLOW_BENCH :
+                 (roll < 12) ? STATUS_REPARSE_BENCH : 0;
+
+        BenchModelName( process, images[process], image );
+        snprintf( text, sizeof( text ), "\\Device\\HarddiskVolume2\\Users\\bench\\p%u\\file%u.dat", process, file );
+        BenchWiden( text, name, TRUE );
+
+        raised = BenchAdd( recordTime, 1000 + 4 * process, majorId, infoClass, irpFlags, status, name, image );
+        expected = ModelAdd( recordTime, process, images[process], majorId, infoClass, irpFlags, status, file );
+
+        alerts += expected;
+
+        BenchCommon.Checks++;
+
+        if (raised != expected) {
+
+            snprintf( detail, sizeof( detail ), "record %u of process %u %s", index, process, raised ? "raised one" : "did not" );
+            BenchFail( "alerts as the model raises them", detail );
+        }
+
+        if (index % 64 == 0) {
+
+            BenchCompare( process, &squares, &within, &compared );
+        }
+    }
+
+    printf( "Random trace of %u records from %u processes:\n", Records, BENCH_MODEL_PROCESSES );
+    printf( "    %u alerts raised where the model raises them\n", alerts );
+    printf( "    estimate of 50 or more files %.2f%% root mean square error, %.0f%% within one standard error, over %u comparisons\n",
+            compared ? 100 * sqrt( squares / compared ) : 0.0,
+            compared ? 100.0 * within / compared : 0.0,
+            compared );
+
+    BenchCommon.Checks++;
+
+    if (alerts == 0 || compared == 0) {
+
+        BenchFail( "random trace", "no alert or estimate to compare" );
+    }
+
+    for (process = 0; process < BENCH_MODEL_PROCESSES; process++) {
+
+        free( Model.Processes[process].Events );
+    }
+}
+
+//
+//  Detection.
+//
+
+static VOID
+BenchAct (
+    _Inout_ PBENCH_ACTOR Actor,
+    _In_ ULONG Index,
+    _In_ LONGLONG Time
+    )
+/*++
+
+Routine Description:
+
+    Issues the records of one unit of an actor's work: a document saved,
+    a line logged, a file built or fetched, a file encrypted or wiped.
+
+--*/
+{
+    const char *volume = "\\Device\\HarddiskVolume2";
+    char text[BENCH_TEXT_SIZE];
+    char other[BENCH_TEXT_SIZE];
+    WCHAR name[BENCH_TEXT_SIZE];
+    WCHAR otherName[BENCH_TEXT_SIZE];
+    ULONG unit = Actor->Units;
+    BOOLEAN raised = FALSE;
+    ULONG index;
+
+    switch (Actor->Kind) {
+
+        case BenchEditor:
+
+            //
+            //  Saved through a temporary file: written, the document
+            //  renamed to a backup, the temporary renamed to the document
+            //  and the backup deleted.
+            //
+
+            index = BenchBelow( 5 );
+            snprintf( text, sizeof( text ), "%s\\Users\\user%u\\Documents\\~WRL%04u.tmp", volume, Index, unit % 10000 );
+            snprintf( other, sizeof( other ), "%s\\Users\\user%u\\Documents\\report%u.docx", volume, Index, index );
+            BenchWiden( text, name, FALSE );
+            BenchWiden( other, otherName, FALSE );
+
+            raised |= BenchAdd( Time, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, name, Actor->Image );
+            raised |= BenchAdd( Time + 1, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, name, Actor->Image );
+            raised |= BenchAdd( Time + 2, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, name, Actor->Image );
+            raised |= BenchAdd( Time + 3, Actor->ProcessId, IRP_MJ_SET_INFORMATION, 10, 0, 0, otherName, Actor->Image );
+            raised |= BenchAdd( Time + 4, Actor->ProcessId, IRP_MJ_SET_INFORMATION, 10, 0, 0, name, Actor->Image );
+            raised |= BenchAdd( Time + 5, Actor->ProcessId, IRP_MJ_SET_INFORMATION, 13, 0, 0, otherName, Actor->Image );
+            raised |= BenchAdd( Time + 6, Actor->ProcessId, IRP_MJ_WRITE, 0, IRP_PAGING_IO, 0, otherName, Actor->Image );
+            break;
+
+        case BenchLogger:
+
+            snprintf( text, sizeof( text ), "%s\\ProgramData\\service%u\\log%u.txt", volume, Index, BenchBelow( 3 ) );
+            BenchWiden( text, name, FALSE );
+            raised |= BenchAdd( Time, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, name, Actor->Image );
+            break;
+
+        case BenchBuilder:
+
+            //
+            //  60 objects a build, and every other one a temporary file
+            //  deleted.
+            //
+
+            snprintf( text, sizeof( text ), "%s\\src\\project%u\\obj\\unit%u.obj", volume, Index, unit % 60 );
+            BenchWiden( text, name, FALSE );
+            raised |= BenchAdd( Time, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, name, Actor->Image );
+
+            if (unit % 2 == 0) {
+
+                snprintf( text, sizeof( text ), "%s\\Users\\build\\AppData\\Local\\Temp\\cc%u.tmp", volume, unit % 60 );
+                BenchWiden( text, name, FALSE );
+                raised |= BenchAdd( Time + 1, Actor->ProcessId, IRP_MJ_SET_INFORMATION, 13, 0, 0, name, Actor->Image );
+            }
+
+            break;
+
+        case BenchSync:
+
+            snprintf( text, sizeof( text ), "%s\\Users\\user%u\\OneDrive\\photo%u.jpg.partial", volume, Index, unit );
+            snprintf( other, sizeof( other ), "%s\\Users\\user%u\\OneDrive\\photo%u.jpg", volume, Index, unit );
+            BenchWiden( text, name, FALSE );
+            BenchWiden( other, otherName, FALSE );
+
+            for (index = 0; index < 4; index++) {
+
+                raised |= BenchAdd( Time + index, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, name, Actor->Image );
+            }
+
+            raised |= BenchAdd( Time + 4, Actor->ProcessId, IRP_MJ_SET_INFORMATION, 65, 0, 0, name, Actor->Image );
+            break;
+
+        case BenchCache:
+
+            snprintf( text, sizeof( text ), "%s\\Users\\user%u\\AppData\\cache\\%u.bin", volume, BenchBelow( 300 ), BenchBelow( 100000 ) );
+            BenchWiden( text, name, FALSE );
+            raised |= BenchAdd( Time, Actor->ProcessId, IRP_MJ_WRITE, 0, IRP_PAGING_IO, 0, name, Actor->Image );
+            break;
+
+        case BenchScanner:
+
+            snprintf( text, sizeof( text ), "%s\\Windows\\System32\\drivers\\file%u.sys", volume, unit );
+            BenchWiden( text, name, FALSE );
+            raised |= BenchAdd( Time, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, STATUS_ACCESS_DENIED_BENCH, name, Actor->Image );
+            break;
+
+        case BenchAttacker:
+        case BenchSlow:
+
+            snprintf( text, sizeof( text ), "%s\\Users\\victim%u\\Documents\\doc%06u.docx", volume, Index, unit );
+            snprintf( other, sizeof( other ), "%s\\Users\\victim%u\\Documents\\doc%06u.docx.locked", volume, Index, unit );
+            BenchWiden( text, name, FALSE );
+            BenchWiden( other, otherName, FALSE );
+
+            raised |= BenchAdd( Time, Actor->ProcessId, IRP_MJ_READ, 0, 0, 0, name, Actor->Image );
+
+            if (Actor->Variant == 0) {
+
+                raised |= BenchAdd( Time + 1, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, name, Actor->Image );
+                raised |= BenchAdd( Time + 2, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, name, Actor->Image );
+                raised |= BenchAdd( Time + 3, Actor->ProcessId, IRP_MJ_SET_INFORMATION, 10, 0, 0, name, Actor->Image );
+
+            } else if (Actor->Variant == 1) {
+
+                raised |= BenchAdd( Time + 1, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, otherName, Actor->Image );
+                raised |= BenchAdd( Time + 2, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, otherName, Actor->Image );
+                raised |= BenchAdd( Time + 3, Actor->ProcessId, IRP_MJ_SET_INFORMATION, 64, 0, 0, name, Actor->Image );
+
+            } else {
+
+                raised |= BenchAdd( Time + 1, Actor->ProcessId, IRP_MJ_SET_INFORMATION, 65, 0, 0, name, Actor->Image );
+                raised |= BenchAdd( Time + 2, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, otherName, Actor->Image );
+                raised |= BenchAdd( Time + 3, Actor->ProcessId, IRP_MJ_WRITE, 0, 0, 0, otherName, Actor->Image );
+            }
+
+            break;
+
+        case BenchWiper:
+
+            snprintf( text, sizeof( text ), "%s\\Users\\victim%u\\Pictures\\img%06u.jpg", volume, Index, unit );
+            BenchWiden( text, name, FALSE );
+            raised |= BenchAdd( Time, Actor->ProcessId, IRP_MJ_SET_INFORMATION, 13, 0, 0, name, Actor->Image );
+            break;
+
+        default:
+            break;
+    }
+
+    Actor->Units++;
+
+    if (raised) {
+
+        if (Actor->Alerts == 0) {
+
+            Actor->FirstAlert = Time;
+            Actor->UnitsAtAlert = Actor->Units;
+        }
+
+        Actor->Alerts++;
+    }
+}
+
+static VOID
+BenchCheckDetection (
+    _In_ ULONG Seconds,
+    _In_ ULONG Ordinary,
+    _In_ ULONG Attackers
+    )
+/*++
+
+Routine Description:
+
+    Runs ordinary processes and attackers together for Seconds under the
+    default thresholds.  Every attacker is followed, once it exits, by an
+    editor that takes over its process id.
+
+--*/
+{
+    const LONGLONG start = BENCH_START - BENCH_START % MASSMOD_PANE + BENCH_SECOND / 3;
+    const LONGLONG end = start + Seconds * BENCH_SECOND;
+    ULONG actorCount = Ordinary + 2 * Attackers + 4;
+    PBENCH_ACTOR actors = calloc( actorCount, sizeof( BENCH_ACTOR ) );
+    PBENCH_ACTOR actor;
+    LONGLONG tick;
+    char detail[200];
+    double delay[3][3];
+    ULONG files[3][3];
+    ULONG caught[3] = { 0 };
+    ULONG falseAlerts = 0;
+    ULONG counting = 0;
+    ULONG variant;
+    ULONG index;
+    ULONG roll;
+    WCHAR name[8] = { L'x', 0 };
+
+    if (actors == NULL) {
+
+        printf( "Could not allocate %u processes\n", actorCount );
+        exit( 2 );
+    }
+
+    BenchReset();
+    MassModSetThresholds( MASSMOD_DEFAULT_FILES, MASSMOD_DEFAULT_WRITES, MASSMOD_DEFAULT_RENAMES, MASSMOD_DEFAULT_DELETES );
+
+    for (variant = 0; variant < 3; variant++) {
+
+        delay[variant][0] = 1e30;
+        delay[variant][1] = 0;
+        delay[variant][2] = 0;
+        files[variant][0] = 0xFFFFFFFF;
+        files[variant][1] = 0;
+        files[variant][2] = 0;
+    }
+
+    for (index = 0; index < actorCount; index++) {
+
+        actor = &actors[index];
+        actor->ProcessId = 2000 + 4 * index;
+        actor->Start = start;
+        actor->End = end;
+
+        if (index < Ordinary) {
+
+            roll = index % 20;
+            actor->Kind = (roll < 11) ? BenchEditor :
+                          (roll < 14) ? BenchLogger :
+                          (roll < 16) ? BenchBuilder : BenchSync;
+
+            actor->Rate = (actor->Kind == BenchEditor) ? 1.0 / (20 + BenchBelow( 40 )) :
+                          (actor->Kind == BenchLogger) ? 100 + BenchBelow( 400 ) :
+                          (actor->Kind == BenchBuilder) ? 12 : 1.0 / 3;
+
+            actor->NextBurst = start + BenchBelow( 60 ) * BENCH_SECOND;
+
+        } else if (index < Ordinary + Attackers) {
+
+            //
+            //  Attackers of each kind in turn, every fourth one a wiper,
+            //  each at 15 to 150 files a second for 20 to 60 seconds.
+            //
+
+            roll = index - Ordinary;
+            actor->Kind = (roll % 4 == 3) ? BenchWiper : BenchAttacker;
+            actor->Variant = (actor->Kind == BenchWiper) ? 0 : roll % 3;
+            actor->Rate = 15 + BenchBelow( 136 );
+            actor->Start = start + (30 + BenchBelow( Seconds - 120 )) * BENCH_SECOND;
+            actor->End = actor->Start + (20 + BenchBelow( 41 )) * BENCH_SECOND;
+
+            if (actor->Kind == BenchWiper) {
+
+                actor->Rate = 50;
+                actor->End = actor->Start + 10 * BENCH_SECOND;
+            }
+
+            //
+            //  The editor that follows it, a second after it exits.
+            //
+
+            actors[index + Attackers].Kind = BenchEditor;
+            actors[index + Attackers].ProcessId = actor->ProcessId;
+            actors[index + Attackers].Rate = 1;
+            actors[index + Attackers].Start = actor->End + BENCH_SECOND;
+            actors[index + Attackers].End = end;
+
+        } else if (index < Ordinary + 2 * Attackers) {
+
+            continue;
+
+        } else if (index < Ordinary + 2 * Attackers + 2) {
+
+            //
+            //  Ransomware that stays below every threshold, 2 files a
+            //  second.
+            //
+
+            actor->Kind = BenchSlow;
+            actor->Variant = index % 3;
+            actor->Rate = 2;
+            actor->Start = start + 10 * BENCH_SECOND;
+            actor->End = actor->Start + 120 * BENCH_SECOND;
+
+        } else if (index < Ordinary + 2 * Attackers + 3) {
+
+            actor->Kind = BenchCache;
+            actor->ProcessId = 4;
+            actor->Rate = 2000;
+
+        } else {
+
+            actor->Kind = BenchScanner;
+            actor->Rate = 300;
+        }
+    }
+
+    for (index = 0; index < actorCount; index++) {
+
+        actor = &actors[index];
+        snprintf( actor->Image, sizeof( actor->Image ), "\\Device\\HarddiskVolume2\\Program Files\\%s%u\\%s.exe",
+                  BenchKindNames[actor->Kind], index, BenchKindNames[actor->Kind] );
+        counting += (actor->Kind != BenchCache && actor->Kind != BenchScanner);
+    }
+
+    for (tick = start; tick < end; tick += BENCH_TICK) {
+
+        for (index = 0; index < actorCount; index++) {
+
+            actor = &actors[index];
+
+            if (tick < actor->Start || tick >= actor->End) {
+
+                continue;
+            }
+
+            if (actor->Kind == BenchBuilder) {
+
+                if (tick >= actor->NextBurst + 5 * BENCH_SECOND) {
+
+                    actor->NextBurst += (60 + BenchBelow( 61 )) * BENCH_SECOND;
+                    actor->Units = 0;
+                }
+
+                if (tick < actor->NextBurst) {
+
+                    continue;
+                }
+            }
+
+            actor->Credit += actor->Rate * BENCH_TICK / BENCH_SECOND;
+
+            while (actor->Credit >= 1) {
+
+                actor->Credit -= 1;
+                BenchAct( actor, index, tick + BenchBelow( BENCH_TICK - 8 ) );
+            }
+        }
+    }
+
+    printf( "Detection over %u seconds, %u ordinary processes, %u attackers, default thresholds:\n",
+            Seconds, Ordinary, Attackers );
+
+    for (index = 0; index < actorCount; index++) {
+
+        actor = &actors[index];
+
+        if (actor->Kind != BenchAttacker && actor->Kind != BenchWiper) {
+
+            BenchCommon.Checks++;
+
+            if (actor->Alerts != 0) {
+
+                falseAlerts += actor->Alerts;
+                snprintf( detail, sizeof( detail ), "%s %u raised %u", BenchKindNames[actor->Kind], index, actor->Alerts );
+                BenchFail( "no alert from ordinary or slow processes", detail );
+            }
+
+            continue;
+        }
+
+        BenchCommon.Checks += 3;
+
+        if (actor->Alerts == 0) {
+
+            snprintf( detail, sizeof( detail ), "%s %u at %.0f files a second", BenchKindNames[actor->Kind], index, actor->Rate );
+            BenchFail( "every attacker caught", detail );
+            continue;
+        }
+
+        if (actor->UnitsAtAlert > (ULONG)(MASSMOD_DEFAULT_FILES * (1 + 5 * BENCH_ERROR)) + 1) {
+
+            snprintf( detail, sizeof( detail ), "%s %u caught after %u files", BenchKindNames[actor->Kind], index, actor->UnitsAtAlert );
+            BenchFail( "attacker caught within the threshold", detail );
+        }
+
+        if (actor->Alerts > (ULONG)((actor->End - actor->FirstAlert) / MASSMOD_WINDOW) + 1) {
+
+            snprintf( detail, sizeof( detail ), "%s %u raised %u", BenchKindNames[actor->Kind], index, actor->Alerts );
+            BenchFail( "one alert a window", detail );
+        }
+    }
+
+    //
+    //  Caught after how long and how many files, per kind: minimum, mean
+    //  and maximum.
+    //
+
+    for (index = 0; index < actorCount; index++) {
+
+        actor = &actors[index];
+
+        if (actor->Kind != BenchAttacker || actor->Alerts == 0) {
+
+            continue;
+        }
+
+        variant = actor->Variant;
+
+        caught[variant]++;
+        delay[variant][0] = min( delay[variant][0], (double)(actor->FirstAlert - actor->Start) / BENCH_SECOND );
+        delay[variant][1] += (double)(actor->FirstAlert - actor->Start) / BENCH_SECOND;
+        delay[variant][2] = max( delay[variant][2], (double)(actor->FirstAlert - actor->Start) / BENCH_SECOND );
+        files[variant][0] = min( files[variant][0], actor->UnitsAtAlert );
+        files[variant][1] += actor->UnitsAtAlert;
+        files[variant][2] = max( files[variant][2], actor->UnitsAtAlert );
+    }
+
+    for (variant = 0; variant < 3; variant++) {
+
+        if (caught[variant] == 0) {
+
+            continue;
+        }
+
+        printf( "    %-34s caught after %.1f / %.1f / %.1f s, %u / %u / %u files\n",
+                BenchVariantNames[variant],
+                delay[variant][0], delay[variant][1] / caught[variant], delay[variant][2],
+                files[variant][0], files[variant][1] / caught[variant], files[variant][2] );
+    }
+
+    for (index = Ordinary; index < Ordinary + Attackers; index++) {
+
+        actor = &actors[index];
+
+        if (actor->Kind == BenchWiper && actor->Alerts != 0) {
+
+            printf( "    %-34s caught after %.1f s, %u files\n",
+                    "wiper deleting", (double)(actor->FirstAlert - actor->Start) / BENCH_SECOND, actor->UnitsAtAlert );
+            break;
+        }
+    }
+
+    printf( "    %u false alerts, %ld processes followed at most, %u bytes each\n",
+            falseAlerts, MassMod.Peak, (unsigned)sizeof( MASSMOD_PROCESS ) );
+
+    //
+    //  Memory follows the processes still at work.
+    //
+
+    BenchCommon.Checks++;
+
+    if (MassMod.Peak > (LONG)counting || MassMod.Untracked != 0) {
+
+        snprintf( detail, sizeof( detail ), "%ld followed at most, %ld not followed, of %u processes", MassMod.Peak, MassMod.Untracked, counting );
+        BenchFail( "processes followed", detail );
+    }
+
+    BenchAdd( end + 2 * MASSMOD_WINDOW, 8, IRP_MJ_WRITE, 0, 0, 0, name, "idle" );
+
+    BenchCommon.Checks++;
+
+    if (MassMod.Count != 1) {
+
+        snprintf( detail, sizeof( detail ), "%ld processes followed after two idle windows", MassMod.Count );
+        BenchFail( "processes dropped", detail );
+    }
+
+    free( actors );
+}
+
+static VOID
+BenchCheckBounded (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Starts MASSMOD_MAX_PROCESSES + 1000 processes within a pane.
+
+--*/
+{
+    LONGLONG time = BENCH_START + 1000 * MASSMOD_WINDOW;
+    char detail[160];
+    WCHAR name[8] = { L'x', 0 };
+    ULONG index;
+
+    BenchReset();
+    MassModSetThresholds( 0, 0, 0, 0 );
+
+    for (index = 0; index < MASSMOD_MAX_PROCESSES + 1000; index++) {
+
+        BenchAdd( time + index, 1000 + 4 * index, IRP_MJ_WRITE, 0, 0, 0, name, "bench.exe" );
+    }
+
+    BenchCommon.Checks++;
+
+    if (MassMod.Count != MASSMOD_MAX_PROCESSES || MassMod.Peak != MASSMOD_MAX_PROCESSES || MassMod.Untracked != 1000) {
+
+        snprintf( detail, sizeof( detail ), "%ld followed, %ld at most, %ld not followed", MassMod.Count, MassMod.Peak, MassMod.Untracked );
+        BenchFail( "processes past the limit not followed", detail );
+    }
+
+    //
+    //  A window later the first 10 go on, and one past the limit starts.
+    //
+
+    time += MASSMOD_WINDOW + MASSMOD_PANE;
+
+    for (index = 0; index < 10; index++) {
+
+        BenchAdd( time + index, 1000 + 4 * index, IRP_MJ_WRITE, 0, 0, 0, name, "bench.exe" );
+    }
+
+    BenchAdd( time + index, 1000 + 4 * (MASSMOD_MAX_PROCESSES + 500), IRP_MJ_WRITE, 0, 0, 0, name, "bench.exe" );
+
+    BenchCommon.Checks++;
+
+    if (MassMod.Count != 11 || BenchEntry( 1000 + 4 * (MASSMOD_MAX_PROCESSES + 500) ) == NULL) {
+
+        snprintf( detail, sizeof( detail ), "%ld followed a window later, expected 11", MassMod.Count );
+        BenchFail( "idle processes dropped", detail );
+    }
+}
+
+static VOID
+BenchCheckEdges (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Checks the edges the random trace seldom lands on: a process dropped
+    exactly a window after its last operation, and the newest pane
+    moving on by exactly MASSMOD_PANES in less than a window.
+
+--*/
+{
+    LONGLONG pane = (BENCH_START + 3000 * MASSMOD_WINDOW) / MASSMOD_PANE;
+    LONGLONG time = pane * MASSMOD_PANE + 5;
+    PMASSMOD_PROCESS process;
+    char detail[160];
+    WCHAR name[8] = { L'a', 0 };
+    WCHAR otherName[8] = { L'b', 0 };
+
+    BenchReset();
+    MassModSetThresholds( 0, 0, 0, 0 );
+
+    BenchAdd( time, 1000, IRP_MJ_WRITE, 0, 0, 0, name, "bench.exe" );
+    BenchAdd( time + MASSMOD_WINDOW - 1, 1004, IRP_MJ_WRITE, 0, 0, 0, name, "bench.exe" );
+
+    BenchCommon.Checks++;
+
+    if (MassMod.Count != 2) {
+
+        snprintf( detail, sizeof( detail ), "%ld followed 1 before a window, expected 2", MassMod.Count );
+        BenchFail( "process kept until a window has gone by", detail );
+    }
+
+    BenchReset();
+
+    BenchAdd( time, 1000, IRP_MJ_WRITE, 0, 0, 0, name, "bench.exe" );
+    BenchAdd( time + MASSMOD_WINDOW, 1004, IRP_MJ_WRITE, 0, 0, 0, name, "bench.exe" );
+
+    BenchCommon.Checks++;
+
+    if (MassMod.Count != 1) {
+
+        snprintf( detail, sizeof( detail ), "%ld followed a window later, expected 1", MassMod.Count );
+        BenchFail( "process dropped once a window has gone by", detail );
+    }
+
+    //
+    //  Written at the end of a pane and again at the start of the pane
+    //  MASSMOD_PANES on, 8 seconds later: only the second write and file
+    //  are left in the window.
+    //
+
+    BenchReset();
+
+    time = pane * MASSMOD_PANE;
+    BenchAdd( time + MASSMOD_PANE - 1, 1000, IRP_MJ_WRITE, 0, 0, 0, name, "bench.exe" );
+    BenchAdd( time + MASSMOD_PANES * MASSMOD_PANE, 1000, IRP_MJ_WRITE, 0, 0, 0, otherName, "bench.exe" );
+
+    process = BenchEntry( 1000 );
+
+    BenchCommon.Checks++;
+
+    if (process == NULL || process->WindowWrites != 1 || MassModEstimate( process ) != 1) {
+
+        snprintf( detail, sizeof( detail ), "%u writes and %u files left, expected 1 and 1",
+                  process ? process->WindowWrites : 0, process ? MassModEstimate( process ) : 0 );
+        BenchFail( "panes cleared moving on by a whole window", detail );
+    }
+}
+
+//
+//  Measurements.
+//
+
+static double
+BenchMeasureOne (
+    _In_ ULONG Records,
+    _In_ ULONG Processes,
+    _In_ ULONG Files,
+    _In_ UCHAR MajorId
+    )
+/*++
+
+Routine Description:
+
+    Returns the ns MassModAdd takes a record, with Processes in turn
+    writing names picked from Files, 20 us of record time apart, so a pane
+    moves on every 100000 records.
+
+--*/
+{
+    LONGLONG time = BENCH_START + 2000 * MASSMOD_WINDOW;
+    char images[16][BENCH_TEXT_SIZE];
+    RECORD_DATA recordData;
+    long long start;
+    ULONG process = 0;
+    ULONG index;
+
+    BenchReset();
+
+    for (index = 0; index < 16; index++) {
+
+        snprintf( images[index], BENCH_TEXT_SIZE, "\\Device\\HarddiskVolume2\\Program Files\\app%u\\app.exe", index );
+    }
+
+    memset( &recordData, 0, sizeof( recordData ) );
+    recordData.CallbackMajorId = MajorId;
+
+    start = BenchNow();
+
+    for (index = 0; index < Records; index++) {
+
+        recordData.OriginatingTime.QuadPart = time + index * 200LL;
+        recordData.ProcessId = (FILE_ID)(1000 + 4 * process);
+
+        MassModAdd( &recordData,
+                    Bench.Pool[(index * 2654435761U) % Files],
+                    images[process % 16] );
+
+        if (++process == Processes) {
+
+            process = 0;
+        }
+    }
+
+    return (double)(BenchNow() - start) / Records;
+}
+
+static double
+BenchMeasureHash (
+    _In_ ULONG Records
+    )
+/*++
+
+Routine Description:
+
+    Returns the ns hashing a name takes, picked from the names as
+    BenchMeasureOne picks them.
+
+--*/
+{
+    volatile ULONGLONG sink = 0;
+    long long start;
+    ULONG index;
+
+    start = BenchNow();
+
+    for (index = 0; index < Records; index++) {
+
+        sink += MassModHashName( Bench.Pool[(index * 2654435761U) % BENCH_POOL] );
+    }
+
+    return (double)(BenchNow() - start) / Records;
+}
+
+static VOID
+BenchMeasure (
+    _In_ ULONG Records
+    )
+{
+    char text[BENCH_TEXT_SIZE];
+    ULONG index;
+
+    Bench.Pool = malloc( BENCH_POOL * sizeof( Bench.Pool[0] ) );
+
+    if (Bench.Pool == NULL) {
+
+        printf( "Could not allocate the names\n" );
+        exit( 2 );
+    }
+
+    for (index = 0; index < BENCH_POOL; index++) {
+
+        snprintf( text, sizeof( text ), "\\Device\\HarddiskVolume2\\Users\\b\\d%u\\f%u.dat", index % 512, index );
+        BenchWiden( text, Bench.Pool[index], FALSE );
+    }
+
+    //
+    //  The estimate is taken for every record when no alert can be
+    //  raised, the dearest case.
+    //
+
+    MassModSetThresholds( 0x7FFFFFFF, 0, 0x7FFFFFFF, 0x7FFFFFFF );
+
+    printf( "MassModAdd over %u records, estimate taken on every record:\n", Records );
+    printf( "    %.0f ns a write, one process over 64 files\n", BenchMeasureOne( Records, 1, 64, IRP_MJ_WRITE ) );
+    printf( "    %.0f ns a write, one process over %u files\n", BenchMeasureOne( Records, 1, BENCH_POOL, IRP_MJ_WRITE ), BENCH_POOL );
+    printf( "    %.0f ns a write, 1000 processes over %u files\n", BenchMeasureOne( Records, 1000, BENCH_POOL, IRP_MJ_WRITE ), BENCH_POOL );
+    printf( "    %.0f ns a write, %u processes over %u files\n",
+            BenchMeasureOne( Records, MASSMOD_MAX_PROCESSES, BENCH_POOL, IRP_MJ_WRITE ), MASSMOD_MAX_PROCESSES, BENCH_POOL );
+    printf( "    %.0f ns a read, which is not counted\n", BenchMeasureOne( Records, 1000, BENCH_POOL, IRP_MJ_READ ) );
+    printf( "    %.0f ns of a write over %u files is reading and hashing its name\n", BenchMeasureHash( Records ), BENCH_POOL );
+
+    BenchReset();
+    free( Bench.Pool );
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    printf( "Usage: mspyMassModTest [-t <trials>] [-n <records>] [-d <seconds>] [-p <processes>] [-a <attackers>] [-m <records>]\n"
+            "\n"
+            "    [-t <trials>] trials of the estimate for each count, 20 by default\n"
+            "    [-n <records>] records in the random trace, 1000000 by default\n"
+            "    [-d <seconds>] length of the detection trace, 600 by default\n"
+            "    [-p <processes>] ordinary processes in it, 300 by default\n"
+            "    [-a <attackers>] attackers in it, 24 by default\n"
+            "    [-m <records>] records measured, 5000000 by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    ULONG trials = 20;
+    ULONG records = 1000000;
+    ULONG seconds = 600;
+    ULONG ordinary = 300;
+    ULONG attackers = 24;
+    ULONG measured = 5000000;
+    int option;
+
+    while ((option = getopt( argc, argv, "t:n:d:p:a:m:" )) != -1) {
+
+        switch (option) {
+
+            case 't':
+                trials = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'n':
+                records = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'd':
+                seconds = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'p':
+                ordinary = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'a':
+                attackers = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'm':
+                measured = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || trials == 0 || records < 100000 || seconds < 180 ||
+        ordinary + 2 * attackers + 4 > MASSMOD_MAX_PROCESSES || measured == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    BenchCheckEstimate( trials );
+    BenchCheckModel( records );
+    BenchCheckDetection( seconds, ordinary, attackers );
+    BenchCheckBounded();
+    BenchCheckEdges();
+    BenchMeasure( measured );
+
+    return BenchSummary();
+}
@@ -0,0 +1,873 @@
+/*++
+
+Module Name:
+
+    mspyPartitionTest.c
+
+Abstract:
+
+    Checks the time partitioning and retention of the log database,
+    user/mspyPartition.c, through the client's own writer in a Linux
+    program built from the client's modules against ushim.
+
+    The window arithmetic and file names are checked first, against the C
+    library's gmtime, for times from 1601 on and around every month end and
+    leap day of a few centuries.
+
+    Then a run of hours of operations is logged through DatabaseDump and
+    DatabaseEndBatch as the logging thread logs them, partitioned hourly or
+    daily with a number of windows kept.  A few operations in every window
+    started before it, as operations in flight when the window rolls do;
+    the writer never goes back to an older partition, so they land in the
+    newer one.  The test keeps its own account of the partition every
+    operation must have been written to, and at the end checks:
+
+        the partition files on disk are those of the windows kept, with
+        nothing left of the removed ones, and the catalog names exactly
+        those files;
+
+        every catalog entry has the rows, first and last times and first
+        and last sequences of its file;
+
+        PartitionAttach over ranges of every size, inside, across and
+        outside what was kept, attaches the partitions overlapping the
+        range, and AllLog returns the operations of the range those
+        partitions hold, the late ones included; a range holding more
+        partitions than SQLite attaches fails.
+
+    It prints the rate rows were written at and the time each range took to
+    attach and count, and returns 1 when a check fails.
+
+    The database and its partitions are written to a new directory in /tmp
+    unless -o names one, and the program works from there, so nothing lands
+    in a real log.  The schema is read from ../user unless -s names the
+    directory.
+
+    Built on its own with every client module but mspyUser.c, for
+    instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -I../user -o mspyPartitionTest mspyPartitionTest.c $(ls ../user/mspy*.c | grep -v mspyUser.c) -lsqlite3 -lm
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <windows.h>
+#include <sqlite3.h>
+#include "mspyLog.h"
+#include "mspyPartition.h"
+#include "mspyBench.h"
+
+#define BENCH_TICKS_PER_SECOND  10000000LL
+#define BENCH_TICKS_PER_MINUTE  (60 * BENCH_TICKS_PER_SECOND)
+#define BENCH_TICKS_PER_HOUR    (60 * BENCH_TICKS_PER_MINUTE)
+
+//
+//  Seconds from 1601-01-01, where PreOpTime counts from, to 1970-01-01.
+//
+
+#define BENCH_SECONDS_TO_1970   11644473600LL
+
+//
+//  2024-02-28 22:00 UTC, so the run crosses a leap day and a month end.
+//
+
+#define BENCH_DEFAULT_START     133536312000000000LL
+
+//
+//  Rows DatabaseEndBatch commits at once, about a full buffer of records.
+//
+
+#define BENCH_BATCH             250
+
+typedef struct _BENCH_OPERATION {
+
+    LONGLONG Time;
+    LONGLONG Window;        // window of the partition it was written to
+
+} BENCH_OPERATION, *PBENCH_OPERATION;
+
+typedef struct _BENCH_STATE {
+
+    PARTITION_WINDOW Window;
+    ULONG Windows;
+    ULONG PerWindow;
+    ULONG Keep;
+    LONGLONG Start;
+
+    char Directory[MAX_PATH];
+    char Database[MAX_PATH];
+    char Base[MAX_PATH];
+
+    PBENCH_OPERATION Operations;
+    ULONG OperationCount;
+
+    //
+    //  Window the writer has open, in the test's account.
+    //
+
+    LONGLONG OpenWindow;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static void
+BenchCheckName (
+    _In_ PARTITION_WINDOW Window,
+    _In_ LONGLONG Time
+    )
+/*++
+
+Routine Description:
+
+    Compares the window start and file name the module gives Time with
+    those worked out from gmtime.
+
+--*/
+{
+    LONGLONG length = (Window == PartitionHourly) ? BENCH_TICKS_PER_HOUR : 24 * BENCH_TICKS_PER_HOUR;
+    LONGLONG start = PartitionWindowStart( Window, Time );
+    time_t seconds;
+    struct tm civil;
+    char expected[64];
+    char actual[64];
+
+    BenchCommon.Checks++;
+
+    if (start > Time || Time - start >= length || start % length != 0) {
+
+        BenchFailFormat( "window", "window of %lld starts at %lld", (long long)Time, (long long)start );
+        return;
+    }
+
+    seconds = (time_t)(start / BENCH_TICKS_PER_SECOND - BENCH_SECONDS_TO_1970);
+
+    if (gmtime_r( &seconds, &civil ) == NULL) {
+
+        return;
+    }
+
+    if (Window == PartitionHourly) {
+
+        snprintf( expected, sizeof( expected ), "b-%04d%02d%02d-%02d.db",
+                  civil.tm_year + 1900, civil.tm_mon + 1, civil.tm_mday, civil.tm_hour );
+
+    } else {
+
+        snprintf( expected, sizeof( expected ), "b-%04d%02d%02d.db",
+                  civil.tm_year + 1900, civil.tm_mon + 1, civil.tm_mday );
+    }
+
+    if (PartitionFileName( "b", Window, start, actual, sizeof( actual ) ) != 0 ||
+        strcmp( actual, expected ) != 0) {
+
+        BenchFailFormat( "window name", "window at %lld is named %s, expected %s", (long long)start, actual, expected );
+    }
+}
+
+static void
+BenchCheckNames (
+    void
+    )
+{
+    LONGLONG time;
+    LONGLONG day;
+    ULONG index;
+    int year;
+    int month;
+    struct tm civil;
+    char small[8];
+
+    //
+    //  Random times from 1601 to 2400
+    //
+
+    for (index = 0; index < 200000; index++) {
+
+        time = (LONGLONG)(BenchRandom() % (252000000000000000ULL));
+
+        BenchCheckName( PartitionHourly, time );
+        BenchCheckName( PartitionDaily, time );
+    }
+
+    //
+    //  Either side of midnight at the end of every month of 1890 to 2110,
+    //  which covers 1900 and 2100, not leap years, and 2000, one
+    //
+
+    for (year = 1890; year <= 2110; year++) {
+
+        for (month = 0; month < 12; month++) {
+
+            memset( &civil, 0, sizeof( civil ) );
+            civil.tm_year = year - 1900;
+            civil.tm_mon = month;
+            civil.tm_mday = 1;
+
+            day = ((LONGLONG)timegm( &civil ) + BENCH_SECONDS_TO_1970) * BENCH_TICKS_PER_SECOND;
+
+            BenchCheckName( PartitionHourly, day - 1 );
+            BenchCheckName( PartitionHourly, day );
+            BenchCheckName( PartitionDaily, day - 1 );
+            BenchCheckName( PartitionDaily, day );
+        }
+    }
+
+    //
+    //  A name that does not fit is refused
+    //
+
+    BenchCommon.Checks++;
+
+    if (PartitionFileName( "base", PartitionHourly, BENCH_DEFAULT_START, small, sizeof( small ) ) == 0) {
+
+        BenchFail( "window name", "a partition name longer than its buffer was accepted" );
+    }
+
+    printf( "Checked %u window starts and names, %u failed\n", BenchCommon.Checks, BenchCommon.Failures );
+}
+
+static BOOLEAN
+BenchLog (
+    void
+    )
+/*++
+
+Routine Description:
+
+    Logs Bench.PerWindow operations in every one of Bench.Windows windows,
+    in batches as the logging thread does.
+
+--*/
+{
+    LONGLONG length = PartitionWindowLength( Bench.Window );
+    LONGLONG windowStart;
+    LONGLONG window;
+    LONGLONG written;
+    RECORD_DATA data;
+    WCHAR name[64];
+    PBENCH_OPERATION operation;
+    long long start;
+    ULONG index;
+    ULONG count;
+    ULONG batch = 0;
+    int characters;
+    int unit;
+    char text[64];
+
+    Bench.OperationCount = Bench.Windows * Bench.PerWindow;
+    Bench.Operations = calloc( Bench.OperationCount, sizeof( BENCH_OPERATION ) );
+
+    if (Bench.Operations == NULL) {
+
+        printf( "Out of memory\n" );
+        return FALSE;
+    }
+
+    DatabaseSetPartitioning( Bench.Window, Bench.Keep );
+
+    start = BenchNow();
+
+    for (window = 0, index = 0; window < Bench.Windows; window++) {
+
+        windowStart = PartitionWindowStart( Bench.Window, Bench.Start ) + window * length;
+
+        for (count = 0; count < Bench.PerWindow; count++, index++) {
+
+            operation = &Bench.Operations[index];
+            operation->Time = windowStart + (LONGLONG)count * (length / Bench.PerWindow);
+
+            //
+            //  One in fifty of the first tenth of a window started up to a
+            //  minute before it, never the first of the window, which rolls
+            //
+            if (count != 0 && count < Bench.PerWindow / 10 && BenchRandom32() % 50 == 0) {
+
+                operation->Time = windowStart - 1 - BenchRandom32() % BENCH_TICKS_PER_MINUTE;
+            }
+
+            written = PartitionWindowStart( Bench.Window, operation->Time );
+
+            if (index == 0 || written > Bench.OpenWindow) {
+
+                Bench.OpenWindow = written;
+            }
+
+            operation->Window = Bench.OpenWindow;
+
+            memset( &data, 0, sizeof( data ) );
+            data.OriginatingTime.QuadPart = operation->Time;
+            data.CompletionTime.QuadPart = operation->Time + 1000;
+            data.ProcessId = 4;
+            data.ThreadId = 8;
+            data.Flags = FLT_CALLBACK_DATA_IRP_OPERATION;
+            data.CallbackMajorId = IRP_MJ_WRITE;
+            data.Arg6.QuadPart = index;
+
+            characters = snprintf( text, sizeof( text ), "\\Device\\HarddiskVolume1\\w%lld\\f%u.dat", (long long)window, count % 100 );
+
+            for (unit = 0; unit <= characters; unit++) {
+
+                name[unit] = (WCHAR)text[unit];
+            }
+
+            DatabaseDump( index + 1, name, &data );
+
+            if (++batch == BENCH_BATCH) {
+
+                DatabaseEndBatch();
+                batch = 0;
+            }
+        }
+
+        DatabaseEndBatch();
+        batch = 0;
+    }
+
+    DatabaseEndSessions();
+    DatabaseCloseLog();
+
+    printf( "Logged %u operations in %u %s windows, keeping %u: %.0f rows/s\n",
+            Bench.OperationCount,
+            Bench.Windows,
+            (Bench.Window == PartitionHourly) ? "hourly" : "daily",
+            Bench.Keep,
+            Bench.OperationCount / ((BenchNow() - start) / 1e9) );
+
+    return TRUE;
+}
+
+static BOOLEAN
+BenchKept (
+    _In_ LONGLONG Window
+    )
+{
+    LONGLONG length = PartitionWindowLength( Bench.Window );
+
+    return Bench.Keep == 0 || Window > Bench.OpenWindow - (LONGLONG)Bench.Keep * length;
+}
+
+static void
+BenchCheckFiles (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Checks the partition files on disk and the catalog against the windows
+    that should have been kept, and every catalog entry against its file.
+
+--*/
+{
+    LONGLONG length = PartitionWindowLength( Bench.Window );
+    LONGLONG first = PartitionWindowStart( Bench.Window, Bench.Start );
+    LONGLONG window;
+    sqlite3_stmt *stmt = NULL;
+    sqlite3_stmt *count = NULL;
+    sqlite3 *partition = NULL;
+    struct dirent *entry;
+    DIR *directory;
+    char name[MAX_PATH + 64];
+    char *suffix;
+    char *base;
+    ULONG expectedFiles = 0;
+    ULONG files = 0;
+    ULONG entries = 0;
+    ULONG index;
+    LONGLONG rows;
+    LONGLONG firstTime;
+    LONGLONG lastTime;
+    LONGLONG firstSeq;
+    LONGLONG lastSeq;
+
+    //
+    //  On disk: the kept windows' files and nothing else of the log's
+    //
+
+    for (window = first; window <= Bench.OpenWindow; window += length) {
+
+        if (BenchKept( window )) {
+
+            expectedFiles++;
+
+            if (PartitionFileName( Bench.Base, Bench.Window, window, name, sizeof( name ) ) != 0 ||
+                access( name, F_OK ) != 0) {
+
+                BenchFailFormat( "retention", "the partition of a kept window, %s, is missing", name );
+            }
+        }
+    }
+
+    base = strrchr( Bench.Base, '/' ) + 1;
+    directory = opendir( Bench.Directory );
+
+    while (directory != NULL && (entry = readdir( directory )) != NULL) {
+
+        if (strncmp( entry->d_name, base, strlen( base ) ) != 0 || entry->d_name[strlen( base )] != '-') {
+
+            continue;
+        }
+
+        //
+        //  A journal file must belong to a partition still there
+        //
+
+        suffix = strrchr( entry->d_name, '-' );
+
+        if (strcmp( suffix, "-wal" ) == 0 || strcmp( suffix, "-shm" ) == 0 || strcmp( suffix, "-journal" ) == 0) {
+
+            snprintf( name, sizeof( name ), "%.*s", (int)(suffix - entry->d_name), entry->d_name );
+
+            if (access( name, F_OK ) != 0) {
+
+                BenchFailFormat( "retention", "%s was left behind by a removed partition", entry->d_name );
+            }
+
+            continue;
+        }
+
+        files++;
+    }
+
+    if (directory != NULL) {
+
+        closedir( directory );
+    }
+
+    BenchCommon.Checks++;
+
+    if (files != expectedFiles) {
+
+        BenchFailFormat( "retention", "%u partition files on disk, %u windows kept", files, expectedFiles );
+    }
+
+    //
+    //  The catalog: one entry a file, each matching its file
+    //
+
+    if (sqlite3_prepare_v2( Db,
+                            "SELECT FileName, WindowStart, Rows, FirstTime, LastTime, FirstSeq, LastSeq"
+                            " FROM Partitions ORDER BY WindowStart;",
+                            -1, &stmt, NULL ) != SQLITE_OK) {
+
+        BenchFailFormat( "catalog", "no catalog: %s", sqlite3_errmsg( Db ) );
+        return;
+    }
+
+    while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        entries++;
+        BenchCommon.Checks++;
+        window = sqlite3_column_int64( stmt, 1 );
+
+        if (!BenchKept( window ) || window < first || window > Bench.OpenWindow) {
+
+            BenchFailFormat( "catalog", "the catalog still lists %s", (const char *)sqlite3_column_text( stmt, 0 ) );
+            continue;
+        }
+
+        PartitionFileName( Bench.Base, Bench.Window, window, name, sizeof( name ) );
+
+        if (strcmp( name, (const char *)sqlite3_column_text( stmt, 0 ) ) != 0) {
+
+            BenchFailFormat( "catalog", "the catalog names the window at %lld %s", (long long)window, (const char *)sqlite3_column_text( stmt, 0 ) );
+            continue;
+        }
+
+        rows = 0;
+        firstTime = firstSeq = LLONG_MAX;
+        lastTime = lastSeq = 0;
+
+        for (index = 0; index < Bench.OperationCount; index++) {
+
+            if (Bench.Operations[index].Window == window) {
+
+                rows++;
+                firstTime = min( firstTime, Bench.Operations[index].Time );
+                lastTime = max( lastTime, Bench.Operations[index].Time );
+                firstSeq = min( firstSeq, (LONGLONG)index + 1 );
+                lastSeq = max( lastSeq, (LONGLONG)index + 1 );
+            }
+        }
+
+        if (sqlite3_column_int64( stmt, 2 ) != rows ||
+            sqlite3_column_int64( stmt, 3 ) != firstTime ||
+            sqlite3_column_int64( stmt, 4 ) != lastTime ||
+            sqlite3_column_int64( stmt, 5 ) != firstSeq ||
+            sqlite3_column_int64( stmt, 6 ) != lastSeq) {
+
+            BenchFailFormat( "catalog", "the catalog has %lld rows from %lld to %lld, seq %lld to %lld in %s, expected %lld from %lld to %lld, seq %lld to %lld",
+                       sqlite3_column_int64( stmt, 2 ),
+                       sqlite3_column_int64( stmt, 3 ),
+                       sqlite3_column_int64( stmt, 4 ),
+                       sqlite3_column_int64( stmt, 5 ),
+                       sqlite3_column_int64( stmt, 6 ),
+                       name,
+                       (long long)rows,
+                       (long long)firstTime,
+                       (long long)lastTime,
+                       (long long)firstSeq,
+                       (long long)lastSeq );
+        }
+
+        //
+        //  And the file holds what its entry says
+        //
+
+        if (sqlite3_open_v2( name, &partition, SQLITE_OPEN_READONLY, NULL ) != SQLITE_OK ||
+            sqlite3_prepare_v2( partition,
+                                "SELECT COUNT(*), MIN(PreOpTime), MAX(PreOpTime), MIN(SeqNum), MAX(SeqNum) FROM MinifilterLog;",
+                                -1, &count, NULL ) != SQLITE_OK ||
+            sqlite3_step( count ) != SQLITE_ROW) {
+
+            BenchFailFormat( "partition", "could not count %s: %s", name, sqlite3_errmsg( partition ) );
+
+        } else if (sqlite3_column_int64( count, 0 ) != rows ||
+                   sqlite3_column_int64( count, 1 ) != firstTime ||
+                   sqlite3_column_int64( count, 2 ) != lastTime ||
+                   sqlite3_column_int64( count, 3 ) != firstSeq ||
+                   sqlite3_column_int64( count, 4 ) != lastSeq) {
+
+            BenchFailFormat( "partition", "%s holds %lld rows from %lld to %lld, expected %lld from %lld to %lld",
+                       name,
+                       sqlite3_column_int64( count, 0 ),
+                       sqlite3_column_int64( count, 1 ),
+                       sqlite3_column_int64( count, 2 ),
+                       (long long)rows,
+                       (long long)firstTime,
+                       (long long)lastTime );
+        }
+
+        sqlite3_finalize( count );
+        sqlite3_close( partition );
+        count = NULL;
+        partition = NULL;
+    }
+
+    sqlite3_finalize( stmt );
+
+    BenchCommon.Checks++;
+
+    if (entries != expectedFiles) {
+
+        BenchFailFormat( "catalog", "%u catalog entries, %u windows kept", entries, expectedFiles );
+    }
+
+    printf( "Checked %u partitions on disk and in the catalog\n", files );
+}
+
+static void
+BenchCheckRange (
+    _In_ sqlite3 *Db,
+    _In_ LONGLONG From,
+    _In_ LONGLONG To
+    )
+/*++
+
+Routine Description:
+
+    Attaches the partitions of [From, To) and counts AllLog over the range,
+    which must give the operations of the range that were kept.
+
+--*/
+{
+    LONGLONG length = PartitionWindowLength( Bench.Window );
+    LONGLONG first = PartitionWindowStart( Bench.Window, Bench.Start );
+    LONGLONG window;
+    LONGLONG earliest;
+    sqlite3_stmt *stmt = NULL;
+    long long start;
+    long long rows = -1;
+    long long expectedRows = 0;
+    int expectedAttached = 0;
+    int limit;
+    int attached;
+    ULONG index;
+
+    //
+    //  A partition overlaps the range when its window or any row in it
+    //  does.  Windows that never got a row are still registered.  A range
+    //  holding more than SQLite can attach, raised as far as it goes,
+    //  fails with nothing counted.
+    //
+
+    sqlite3_limit( Db, SQLITE_LIMIT_ATTACHED, INT_MAX );
+    limit = sqlite3_limit( Db, SQLITE_LIMIT_ATTACHED, -1 );
+
+    for (window = first; window <= Bench.OpenWindow; window += length) {
+
+        if (!BenchKept( window )) {
+
+            continue;
+        }
+
+        earliest = window;
+
+        for (index = 0; index < Bench.OperationCount; index++) {
+
+            if (Bench.Operations[index].Window == window) {
+
+                earliest = min( earliest, Bench.Operations[index].Time );
+            }
+        }
+
+        if (earliest >= To || window + length <= From) {
+
+            continue;
+        }
+
+        expectedAttached++;
+
+        for (index = 0; index < Bench.OperationCount; index++) {
+
+            if (Bench.Operations[index].Window == window &&
+                Bench.Operations[index].Time >= From &&
+                Bench.Operations[index].Time < To) {
+
+                expectedRows++;
+            }
+        }
+    }
+
+    if (expectedAttached > limit) {
+
+        expectedAttached = -1;
+        expectedRows = -1;
+    }
+
+    start = BenchNow();
+    attached = PartitionAttach( Db, From, To );
+
+    if (attached >= 0 &&
+        sqlite3_prepare_v2( Db,
+                            "SELECT COUNT(*) FROM AllLog WHERE PreOpTime >= ?1 AND PreOpTime < ?2;",
+                            -1, &stmt, NULL ) == SQLITE_OK) {
+
+        sqlite3_bind_int64( stmt, 1, From );
+        sqlite3_bind_int64( stmt, 2, To );
+
+        if (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+            rows = sqlite3_column_int64( stmt, 0 );
+        }
+    }
+
+    sqlite3_finalize( stmt );
+
+    printf( "    %+8.2f h to %+8.2f h   %3d attached %8lld rows %9.2f ms\n",
+            (double)(From - first) / BENCH_TICKS_PER_HOUR,
+            (double)(To - first) / BENCH_TICKS_PER_HOUR,
+            attached,
+            rows,
+            (BenchNow() - start) / 1e6 );
+
+    //
+    //  Detach for the next range, AllLog goes with them
+    //
+
+    for (index = 0; (int)index < attached; index++) {
+
+        char detach[32];
+
+        snprintf( detach, sizeof( detach ), "DETACH DATABASE " PARTITION_SCHEMA_PREFIX "%u;", index );
+        sqlite3_exec( Db, detach, NULL, NULL, NULL );
+    }
+
+    BenchCommon.Checks++;
+
+    if (attached != expectedAttached || rows != expectedRows) {
+
+        BenchFailFormat( "range", "the range attached %d partitions and counted %lld rows, expected %d and %lld",
+                   attached,
+                   rows,
+                   expectedAttached,
+                   expectedRows );
+    }
+}
+
+static void
+BenchCheckRanges (
+    _In_ sqlite3 *Db
+    )
+{
+    LONGLONG length = PartitionWindowLength( Bench.Window );
+    LONGLONG first = PartitionWindowStart( Bench.Window, Bench.Start );
+    LONGLONG last = Bench.OpenWindow + length;
+    LONGLONG kept = max( first, Bench.OpenWindow - (LONGLONG)(Bench.Keep ? Bench.Keep - 1 : Bench.Windows) * length );
+    LONGLONG from;
+    ULONG index;
+
+    printf( "Ranges, from the first window logged:\n" );
+
+    //
+    //  Everything, what was kept, only what was removed, the newest
+    //  window, and the minute before the oldest kept one, where only the
+    //  late operations it holds are left
+    //
+
+    BenchCheckRange( Db, first, last );
+    BenchCheckRange( Db, kept, last );
+    BenchCheckRange( Db, first, kept - length );
+    BenchCheckRange( Db, Bench.OpenWindow, last );
+    BenchCheckRange( Db, kept - BENCH_TICKS_PER_MINUTE, kept );
+    BenchCheckRange( Db, kept - BENCH_TICKS_PER_MINUTE, kept + BENCH_TICKS_PER_MINUTE );
+
+    //
+    //  And random ones
+    //
+
+    for (index = 0; index < 20; index++) {
+
+        from = first + (LONGLONG)(BenchRandom() % (ULONGLONG)(last - first));
+
+        BenchCheckRange( Db, from, from + 1 + (LONGLONG)(BenchRandom() % (ULONGLONG)(3 * length)) );
+    }
+}
+
+static void
+BenchUsage (
+    void
+    )
+{
+    printf( "Usage: mspyPartitionTest [-d] [-w <windows>] [-n <operations>] [-k <keep>] [-s <sqldir>] [-o <dir>]\n"
+            "\n"
+            "    [-d] partitions daily rather than hourly\n"
+            "    [-w <windows>] windows logged, 72 by default\n"
+            "    [-n <operations>] operations logged in each window, 1000 by default\n"
+            "    [-k <keep>] windows kept, 24 by default, 0 keeps them all\n"
+            "    [-s <sqldir>] directory of the client's .sql files, ../user by default\n"
+            "    [-o <dir>] directory for the databases, a new one in /tmp by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    const char *sql = "../user";
+    const char *output = NULL;
+    char resources[MAX_PATH];
+    sqlite3 *db = NULL;
+    int option;
+
+    Bench.Window = PartitionHourly;
+    Bench.Windows = 72;
+    Bench.PerWindow = 1000;
+    Bench.Keep = 24;
+    Bench.Start = BENCH_DEFAULT_START;
+    while ((option = getopt( argc, argv, "dw:n:k:s:o:" )) != -1) {
+
+        switch (option) {
+
+            case 'd':
+                Bench.Window = PartitionDaily;
+                break;
+
+            case 'w':
+                Bench.Windows = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'n':
+                Bench.PerWindow = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'k':
+                Bench.Keep = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 's':
+                sql = optarg;
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || Bench.Windows == 0 || Bench.PerWindow < 10) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    BenchCheckNames();
+
+    //
+    //  The service log's name is fixed, so the program works from the
+    //  scratch directory and the schema directory is resolved first.
+    //
+
+    if (realpath( sql, resources ) == NULL) {
+
+        fprintf( stderr, "No schema directory %s\n", sql );
+        return 2;
+    }
+
+    setenv( "USHIM_RESOURCES", resources, 1 );
+
+    if (output == NULL) {
+
+        strcpy( Bench.Directory, "/tmp/mspyPartitionTest.XXXXXX" );
+
+        if (mkdtemp( Bench.Directory ) == NULL) {
+
+            perror( "mkdtemp" );
+            return 1;
+        }
+
+    } else if (realpath( output, Bench.Directory ) == NULL) {
+
+        perror( output );
+        return 2;
+    }
+
+    if (chdir( Bench.Directory ) != 0) {
+
+        perror( Bench.Directory );
+        return 1;
+    }
+
+    snprintf( Bench.Database, sizeof( Bench.Database ), "%s/log.db", Bench.Directory );
+    snprintf( Bench.Base, sizeof( Bench.Base ), "%s/log", Bench.Directory );
+    DatabaseSetLocation( Bench.Database, Bench.Base );
+
+    if (!BenchLog()) {
+
+        return 1;
+    }
+
+    if (sqlite3_open( Bench.Database, &db ) != SQLITE_OK) {
+
+        printf( "Could not open %s\n", Bench.Database );
+        return 1;
+    }
+
+    BenchCheckFiles( db );
+    BenchCheckRanges( db );
+
+    sqlite3_close( db );
+    free( Bench.Operations );
+
+    printf( "Partitions in %s\n", Bench.Directory );
+
+    return BenchSummary();
+}
@@ -0,0 +1,862 @@
+/*++
+
+Module Name:
+
+    mspyPerfBench.c
+
+Abstract:
+
+    Benchmarks what the client's logging thread does for every record, in
+    a Linux program built from the client's own modules against ushim:
+    walking the buffers GetMiniSpyLog returns, naming the major and minor
+    functions, formatting the IrpFlags, the status and the pointers,
+    converting and binding the name, DatabaseDump end to end through
+    ProcessLogBuffer, and raising alerts with and without the alert
+    thread.
+
+    The records come from the generator, user/mspyGen.c, with a fixed
+    seed, so two runs of the same build see the same corpus.  Each
+    benchmark calls the same routines the logging thread calls, over
+    every record of the corpus, and prints the time per operation,
+    allocations per operation and, where rows are written, rows a second.
+    With -r the results are also appended to a CSV file, one row per
+    benchmark, to compare builds.
+
+    The log database, its partitions and the service log are written to a
+    new directory in /tmp unless -o names one, and the program works from
+    there, so nothing lands in a real log.  The schema is read from the
+    files mspyUser.rc names, in ../user unless -s names the directory.
+
+    Allocations are counted by wrapping the C library's malloc, calloc
+    and realloc, which SQLite allocates with as well.  Every thread is
+    counted, so the alert, checkpoint and service log threads add to the
+    counts now and then.
+
+    NtStatusToString has no message table to look the status up in here,
+    see FormatMessageA in ushim/windows.h, so the status benchmark only
+    measures the fallback that formats the code.
+
+    Built on its own with every client module but mspyUser.c, for
+    instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -I../user -o mspyPerfBench mspyPerfBench.c $(ls ../user/mspy*.c | grep -v mspyUser.c) -lsqlite3 -lm
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <windows.h>
+#include <sqlite3.h>
+#include "mspyLog.h"
+#include "mspyAlert.h"
+#include "mspyFileLog.h"
+#include "mspyGen.h"
+#include "mspyUtf.h"
+#include "mspyWal.h"
+#include "mspyBench.h"
+
+#define BENCH_DEFAULT_RECORDS   100000
+#define BENCH_SEED              0x6d73707950657266ULL
+
+//
+//  Routines that take a few nanoseconds are run over the corpus this many
+//  times, so the timer's resolution does not show.
+//
+
+#define BENCH_PASSES            10
+
+//
+//  Alerts written without the alert thread open the database each, only
+//  this many are written.
+//
+
+#define BENCH_DIRECT_ALERTS     200
+
+typedef struct _BENCH_CORPUS {
+
+    //
+    //  BufferCount buffers of BUFFER_SIZE bytes as GetMiniSpyLog fills
+    //  them, Filled[i] bytes of the i'th used.
+    //
+
+    PCHAR Buffers;
+    PDWORD Filled;
+    ULONG BufferCount;
+
+    //
+    //  Every record, and the operation records among them in order.
+    //
+
+    ULONG RecordCount;
+    PLOG_RECORD *Operations;
+    ULONG OperationCount;
+
+} BENCH_CORPUS, *PBENCH_CORPUS;
+
+typedef struct _BENCH_RESULT {
+
+    const char *Name;
+    ULONGLONG Operations;
+    ULONGLONG Rows;
+    long long Nanoseconds;
+    LONG Allocations;
+
+    long long Start;
+    LONG StartAllocations;
+
+} BENCH_RESULT, *PBENCH_RESULT;
+
+typedef VOID
+(*BENCH_ROUTINE) (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    );
+
+typedef struct _BENCH_STATE {
+
+    ULONG Records;
+    const char *Results;
+
+    BENCH_CORPUS Corpus;
+
+    volatile LONG Allocations;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+//
+//  Results of routines whose output is not otherwise used end up here, so
+//  the compiler cannot drop the calls.
+//
+
+static volatile ULONG_PTR BenchSink;
+
+//
+//  Every allocation of the process goes through these, counted and passed
+//  on to the C library's own.
+//
+
+extern void *__libc_malloc( size_t Size );
+extern void *__libc_calloc( size_t Count, size_t Size );
+extern void *__libc_realloc( void *Block, size_t Size );
+
+void *
+malloc (
+    size_t Size
+    )
+{
+    InterlockedIncrement( &Bench.Allocations );
+    return __libc_malloc( Size );
+}
+
+void *
+calloc (
+    size_t Count,
+    size_t Size
+    )
+{
+    InterlockedIncrement( &Bench.Allocations );
+    return __libc_calloc( Count, Size );
+}
+
+void *
+realloc (
+    void *Block,
+    size_t Size
+    )
+{
+    InterlockedIncrement( &Bench.Allocations );
+    return __libc_realloc( Block, Size );
+}
+
+static VOID
+BenchBegin (
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    Result->StartAllocations = Bench.Allocations;
+    Result->Start = BenchNow();
+}
+
+static VOID
+BenchEnd (
+    _Inout_ PBENCH_RESULT Result,
+    _In_ ULONGLONG Operations,
+    _In_ ULONGLONG Rows
+    )
+{
+    Result->Nanoseconds = BenchNow() - Result->Start;
+    Result->Operations = Operations;
+    Result->Rows = Rows;
+    Result->Allocations = Bench.Allocations - Result->StartAllocations;
+}
+
+static VOID
+BenchWalk (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    PLOG_RECORD logRecord;
+    ULONGLONG count = 0;
+    ULONG_PTR sum = 0;
+    ULONG pass;
+    ULONG index;
+    DWORD used;
+
+    BenchBegin( Result );
+
+    for (pass = 0; pass < BENCH_PASSES; pass++) {
+
+        for (index = 0; index < Corpus->BufferCount; index++) {
+
+            used = 0;
+
+            while ((logRecord = NextLogRecord( Corpus->Buffers + (SIZE_T)index * BUFFER_SIZE,
+                                               Corpus->Filled[index],
+                                               &used )) != NULL) {
+
+                sum += logRecord->SequenceNumber;
+                count++;
+            }
+        }
+    }
+
+    BenchEnd( Result, count, 0 );
+    BenchSink = sum;
+}
+
+static VOID
+BenchIrpCode (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    PRECORD_DATA recordData;
+    const CHAR *majorString;
+    const CHAR *minorString;
+    ULONG_PTR sum = 0;
+    ULONG pass;
+    ULONG index;
+
+    BenchBegin( Result );
+
+    for (pass = 0; pass < BENCH_PASSES; pass++) {
+
+        for (index = 0; index < Corpus->OperationCount; index++) {
+
+            recordData = &Corpus->Operations[index]->Data;
+
+            PrintIrpCode( recordData->CallbackMajorId,
+                          recordData->CallbackMinorId,
+                          &majorString,
+                          &minorString );
+
+            sum += (ULONG_PTR)majorString ^ (ULONG_PTR)minorString;
+        }
+    }
+
+    BenchEnd( Result, (ULONGLONG)BENCH_PASSES * Corpus->OperationCount, 0 );
+    BenchSink = sum;
+}
+
+static VOID
+BenchIrpFlags (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    char flagString[9];
+    ULONG_PTR sum = 0;
+    ULONG pass;
+    ULONG index;
+
+    BenchBegin( Result );
+
+    for (pass = 0; pass < BENCH_PASSES; pass++) {
+
+        for (index = 0; index < Corpus->OperationCount; index++) {
+
+            FormatIrpFlags( &Corpus->Operations[index]->Data, flagString );
+            sum += flagString[0] + flagString[7];
+        }
+    }
+
+    BenchEnd( Result, (ULONGLONG)BENCH_PASSES * Corpus->OperationCount, 0 );
+    BenchSink = sum;
+}
+
+static VOID
+BenchStatus (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    char statusString[256];
+    ULONG_PTR sum = 0;
+    ULONG index;
+
+    BenchBegin( Result );
+
+    for (index = 0; index < Corpus->OperationCount; index++) {
+
+        NtStatusToString( Corpus->Operations[index]->Data.Status, statusString, sizeof( statusString ) );
+        sum += statusString[0];
+    }
+
+    BenchEnd( Result, Corpus->OperationCount, 0 );
+    BenchSink = sum;
+}
+
+static VOID
+BenchPointers (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    PRECORD_DATA recordData;
+    char pointerString[32];
+    ULONG_PTR sum = 0;
+    ULONG pass;
+    ULONG index;
+
+    //
+    //  The four pointers of a row, as DatabaseDump formats them.
+    //
+
+    BenchBegin( Result );
+
+    for (pass = 0; pass < BENCH_PASSES; pass++) {
+
+        for (index = 0; index < Corpus->OperationCount; index++) {
+
+            recordData = &Corpus->Operations[index]->Data;
+
+            sprintf_s( pointerString, sizeof( pointerString ), "%p", (void *)recordData->DeviceObject );
+            sum += pointerString[0];
+            sprintf_s( pointerString, sizeof( pointerString ), "%p", (void *)recordData->FileObject );
+            sum += pointerString[0];
+            sprintf_s( pointerString, sizeof( pointerString ), "%p", (void *)recordData->Transaction );
+            sum += pointerString[0];
+            sprintf_s( pointerString, sizeof( pointerString ), "%p", (void *)recordData->Information );
+            sum += pointerString[0];
+        }
+    }
+
+    BenchEnd( Result, (ULONGLONG)BENCH_PASSES * Corpus->OperationCount, 0 );
+    BenchSink = sum;
+}
+
+static VOID
+BenchBindName (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    char name[UTF8_NAME_SIZE( MAX_NAME_SPACE / sizeof( WCHAR ) )];
+    ULONG length;
+    ULONG index;
+
+    //
+    //  Into a table of the name alone in memory, so only the conversion
+    //  to UTF-8 and the insert are measured, not the disk.
+    //
+
+    if (sqlite3_open( ":memory:", &db ) != SQLITE_OK ||
+        sqlite3_exec( db, "CREATE TABLE Names (Name TEXT);", NULL, NULL, NULL ) != SQLITE_OK ||
+        sqlite3_prepare_v2( db, "INSERT INTO Names (Name) VALUES (?);", -1, &stmt, NULL ) != SQLITE_OK) {
+
+        printf( "    Could not create the name table: %s\n", sqlite3_errmsg( db ) );
+        goto Cleanup;
+    }
+
+    BenchBegin( Result );
+
+    sqlite3_exec( db, "BEGIN;", NULL, NULL, NULL );
+
+    for (index = 0; index < Corpus->OperationCount; index++) {
+
+        length = Utf16ToUtf8( Corpus->Operations[index]->Name,
+                              (ULONG)wcslen( Corpus->Operations[index]->Name ),
+                              name,
+                              sizeof( name ) );
+        sqlite3_bind_text( stmt, 1, name, (int)length, SQLITE_TRANSIENT );
+        sqlite3_step( stmt );
+        sqlite3_reset( stmt );
+    }
+
+    sqlite3_exec( db, "COMMIT;", NULL, NULL, NULL );
+
+    BenchEnd( Result, Corpus->OperationCount, Corpus->OperationCount );
+
+Cleanup:
+
+    sqlite3_finalize( stmt );
+    sqlite3_close( db );
+}
+
+static VOID
+BenchDump (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    LOG_CONTEXT context;
+    ULONG index;
+
+    //
+    //  Every buffer as the logging thread logs it, process records,
+    //  rules, summaries and the commit of each buffer included.  The first
+    //  buffer also creates the log database.
+    //
+
+    memset( &context, 0, sizeof( context ) );
+    context.LogToFile = TRUE;
+
+    BenchBegin( Result );
+
+    for (index = 0; index < Corpus->BufferCount; index++) {
+
+        ProcessLogBuffer( &context, Corpus->Buffers + (SIZE_T)index * BUFFER_SIZE, Corpus->Filled[index] );
+    }
+
+    BenchEnd( Result, Corpus->RecordCount, Corpus->OperationCount );
+
+    DatabaseEndSessions();
+    DatabaseCloseLog();
+}
+
+static VOID
+BenchAlertQueued (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    ULONG index;
+
+    //
+    //  What raising an alert costs the thread raising it.  Nearly all of
+    //  these are over the rate limit and only counted.
+    //
+
+    BenchBegin( Result );
+
+    for (index = 0; index < Corpus->OperationCount; index++) {
+
+        WriteAlertToDatabase( "Benchmark alert %u", (unsigned)index );
+    }
+
+    BenchEnd( Result, Corpus->OperationCount, 0 );
+}
+
+static VOID
+BenchAlertDirect (
+    _In_ PBENCH_CORPUS Corpus,
+    _Inout_ PBENCH_RESULT Result
+    )
+{
+    ULONG count = min( Corpus->OperationCount, BENCH_DIRECT_ALERTS );
+    ULONG index;
+
+    //
+    //  Without the alert thread every alert is written where it is
+    //  raised, as before AlertStart and after AlertStop.  This runs last,
+    //  the thread is not started again.
+    //
+
+    AlertStop();
+
+    BenchBegin( Result );
+
+    for (index = 0; index < count; index++) {
+
+        WriteAlertToDatabase( "Benchmark direct alert %u", (unsigned)index );
+    }
+
+    BenchEnd( Result, count, count );
+}
+
+static const struct {
+
+    const char *Name;
+    BENCH_ROUTINE Run;
+
+} BenchRoutines[] = {
+
+    { "walk",           BenchWalk },
+    { "irp_code",       BenchIrpCode },
+    { "irp_flags",      BenchIrpFlags },
+    { "status",         BenchStatus },
+    { "pointer",        BenchPointers },
+    { "bind_name",      BenchBindName },
+    { "dump",           BenchDump },
+    { "alert_queued",   BenchAlertQueued },
+    { "alert_direct",   BenchAlertDirect },
+};
+
+static BOOLEAN
+BenchBuildCorpus (
+    _In_ ULONG Records,
+    _Out_ PBENCH_CORPUS Corpus
+    )
+/*++
+
+Routine Description:
+
+    Generates about Records records with the generator's default
+    configuration and BENCH_SEED.
+
+Arguments:
+
+    Records - How many records to generate.
+
+    Corpus - Receives the buffers and records.
+
+Return Value:
+
+    FALSE if memory could not be had.
+
+--*/
+{
+    GEN_CONFIG config;
+    FILETIME now;
+    PLOG_RECORD logRecord;
+    ULONG perBuffer;
+    ULONG index;
+    DWORD used;
+
+    memset( Corpus, 0, sizeof( BENCH_CORPUS ) );
+
+    GenDefaultConfig( &config );
+    config.Seed = BENCH_SEED;
+
+    //
+    //  Buffers enough for Records records of the average name length.
+    //
+
+    perBuffer = BUFFER_SIZE / (ULONG)ROUND_TO_SIZE( sizeof( LOG_RECORD ) + ((config.NameMin + config.NameMax) / 2 + 1) * sizeof( WCHAR ),
+                                                    sizeof( PVOID ) );
+    Corpus->BufferCount = (Records + perBuffer - 1) / perBuffer;
+
+    Corpus->Buffers = malloc( (SIZE_T)Corpus->BufferCount * BUFFER_SIZE );
+    Corpus->Filled = malloc( Corpus->BufferCount * sizeof( DWORD ) );
+
+    if (Corpus->Buffers == NULL || Corpus->Filled == NULL) {
+
+        return FALSE;
+    }
+
+    GetSystemTimeAsFileTime( &now );
+
+    if (!GenSample( &config,
+                    ((LONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime,
+                    Corpus->Buffers,
+                    BUFFER_SIZE,
+                    Corpus->BufferCount,
+                    Corpus->Filled )) {
+
+        return FALSE;
+    }
+
+    for (index = 0; index < Corpus->BufferCount; index++) {
+
+        used = 0;
+
+        while (NextLogRecord( Corpus->Buffers + (SIZE_T)index * BUFFER_SIZE, Corpus->Filled[index], &used ) != NULL) {
+
+            Corpus->RecordCount++;
+        }
+    }
+
+    Corpus->Operations = malloc( Corpus->RecordCount * sizeof( PLOG_RECORD ) );
+
+    if (Corpus->Operations == NULL) {
+
+        return FALSE;
+    }
+
+    for (index = 0; index < Corpus->BufferCount; index++) {
+
+        used = 0;
+
+        while ((logRecord = NextLogRecord( Corpus->Buffers + (SIZE_T)index * BUFFER_SIZE, Corpus->Filled[index], &used )) != NULL) {
+
+            if (!FlagOn( logRecord->RecordType, RECORD_TYPE_PROCESS )) {
+
+                Corpus->Operations[Corpus->OperationCount++] = logRecord;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+static VOID
+BenchWriteResults (
+    _In_z_ const char *Path,
+    _In_reads_(Count) PBENCH_RESULT Results,
+    _In_ ULONG Count
+    )
+{
+    char stamp[32];
+    time_t now = time( NULL );
+    FILE *file;
+    ULONG index;
+
+    file = fopen( Path, "a" );
+
+    if (file == NULL) {
+
+        printf( "    Could not open %s for the results\n", Path );
+        return;
+    }
+
+    if (ftell( file ) == 0) {
+
+        fprintf( file, "version,build,time,records,seed,benchmark,operations,ns_per_op,allocs_per_op,rows_per_sec\n" );
+    }
+
+    strftime( stamp, sizeof( stamp ), "%Y-%m-%d %H:%M:%S", localtime( &now ) );
+
+    for (index = 0; index < Count; index++) {
+
+        if (Results[index].Operations == 0) {
+
+            continue;
+        }
+
+        fprintf( file,
+                 "%d.%d,%s %s,%s,%u,0x%llx,%s,%llu,%.1f,%.3f,",
+                 MINISPY_MAJ_VERSION,
+                 MINISPY_MIN_VERSION,
+                 __DATE__,
+                 __TIME__,
+                 stamp,
+                 (unsigned)Bench.Corpus.RecordCount,
+                 BENCH_SEED,
+                 Results[index].Name,
+                 (unsigned long long)Results[index].Operations,
+                 (double)Results[index].Nanoseconds / Results[index].Operations,
+                 (double)Results[index].Allocations / Results[index].Operations );
+
+        if (Results[index].Rows != 0 && Results[index].Nanoseconds > 0) {
+
+            fprintf( file, "%.0f", Results[index].Rows * 1e9 / Results[index].Nanoseconds );
+        }
+
+        fprintf( file, "\n" );
+    }
+
+    fclose( file );
+
+    printf( "    Results appended to %s\n", Path );
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: mspyPerfBench [-n records] [-r results] [-s sqldir] [-o dir]\n"
+             "  -n  records generated to benchmark with (default %d)\n"
+             "  -r  CSV file a row per benchmark is appended to (default none)\n"
+             "  -s  directory of mspyUser.rc and the schema it names (default ../user)\n"
+             "  -o  directory for the log database and service log (default a new one in /tmp)\n",
+             BENCH_DEFAULT_RECORDS );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    char directory[MAX_PATH] = "/tmp/mspyPerfBench.XXXXXX";
+    char resources[MAX_PATH];
+    char started[MAX_PATH];
+    char results[2 * MAX_PATH];
+    BENCH_RESULT result[ARRAYSIZE( BenchRoutines )];
+    const char *output = NULL;
+    const char *sql = "../user";
+    long long start;
+    ULONG index;
+    int option;
+
+    Bench.Records = BENCH_DEFAULT_RECORDS;
+
+    while ((option = getopt( argc, argv, "n:r:s:o:" )) != -1) {
+
+        switch (option) {
+
+            case 'n':
+                Bench.Records = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'r':
+                Bench.Results = optarg;
+                break;
+
+            case 's':
+                sql = optarg;
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || Bench.Records == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    //
+    //  The service log's name is fixed, so the program works from the
+    //  scratch directory and paths given relative to where it was started
+    //  are resolved first.
+    //
+
+    if (realpath( sql, resources ) == NULL) {
+
+        fprintf( stderr, "No schema directory %s\n", sql );
+        return 2;
+    }
+
+    setenv( "USHIM_RESOURCES", resources, 1 );
+
+    if (Bench.Results != NULL) {
+
+        if (Bench.Results[0] == '/' || getcwd( started, sizeof( started ) ) == NULL) {
+
+            snprintf( results, sizeof( results ), "%s", Bench.Results );
+
+        } else {
+
+            snprintf( results, sizeof( results ), "%s/%s", started, Bench.Results );
+        }
+
+        Bench.Results = results;
+    }
+
+    if (output == NULL) {
+
+        if (mkdtemp( directory ) == NULL) {
+
+            perror( "mkdtemp" );
+            return 1;
+        }
+
+        output = directory;
+    }
+
+    if (chdir( output ) != 0) {
+
+        perror( output );
+        return 1;
+    }
+
+    DatabaseSetLocation( "log-benchmark.db", "log-benchmark" );
+
+    //
+    //  As the client starts the threads logging depends on.
+    //
+
+    if (!FileLogStart()) {
+
+        printf( "Could not start the service log flusher, lines are written as they are logged\n" );
+    }
+
+    if (!AlertStart()) {
+
+        printf( "Could not start the alert thread, alerts are written as they are raised\n" );
+    }
+
+    if (!WalStart()) {
+
+        printf( "Could not start the checkpoint thread, SQLite will checkpoint on commit\n" );
+    }
+
+    start = BenchNow();
+
+    if (!BenchBuildCorpus( Bench.Records, &Bench.Corpus )) {
+
+        printf( "Could not generate the records to benchmark with\n" );
+        return 1;
+    }
+
+    printf( "    Corpus:      %u records, %u operations in %u buffers, generated in %.3f ms\n",
+            (unsigned)Bench.Corpus.RecordCount,
+            (unsigned)Bench.Corpus.OperationCount,
+            (unsigned)Bench.Corpus.BufferCount,
+            (BenchNow() - start) / 1e6 );
+    printf( "    Database:    %s/%s\n", output, DATABASE_FILE_LOCATION );
+
+    memset( result, 0, sizeof( result ) );
+
+    printf( "    %-14s %12s %12s %12s %12s\n", "Benchmark", "Operations", "ns/op", "allocs/op", "rows/s" );
+
+    for (index = 0; index < ARRAYSIZE( BenchRoutines ); index++) {
+
+        result[index].Name = BenchRoutines[index].Name;
+
+        BenchRoutines[index].Run( &Bench.Corpus, &result[index] );
+
+        if (result[index].Operations == 0) {
+
+            printf( "    %-14s %12s\n", result[index].Name, "failed" );
+            continue;
+        }
+
+        printf( "    %-14s %12llu %12.1f %12.3f ",
+                result[index].Name,
+                (unsigned long long)result[index].Operations,
+                (double)result[index].Nanoseconds / result[index].Operations,
+                (double)result[index].Allocations / result[index].Operations );
+
+        if (result[index].Rows != 0 && result[index].Nanoseconds > 0) {
+
+            printf( "%12.0f\n", result[index].Rows * 1e9 / result[index].Nanoseconds );
+
+        } else {
+
+            printf( "%12s\n", "-" );
+        }
+    }
+
+    if (Bench.Results != NULL) {
+
+        BenchWriteResults( Bench.Results, result, ARRAYSIZE( BenchRoutines ) );
+    }
+
+    WalStop();
+    FileLogStop();
+
+    for (index = 0; index < ARRAYSIZE( BenchRoutines ); index++) {
+
+        if (result[index].Operations == 0) {
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
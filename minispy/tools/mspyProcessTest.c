@@ -0,0 +1,1035 @@
+/*++
+
+Module Name:
+
+    mspyProcessTest.c
+
+Abstract:
+
+    Checks and measures the process table and the attribution of
+    operations to processes, user/mspyProcess.c, in a Linux program
+    against ushim.
+
+    mspyProcess.c is included rather than linked.  A world of processes
+    is generated first: processes running before the filter started,
+    never reported, then processes created and exiting over -d seconds,
+    most of them short lived, with their ids drawn from a small pool so
+    ids are reused within seconds.  Some processes cannot be opened.  The
+    filter's create and exit records for them are dropped now and then,
+    and their operations reach the writer late: most within milliseconds,
+    some by up to 30 seconds, a few by more than PROCESS_TABLE_LINGER.
+
+    The records are run through the table in the order they arrive, with
+    ProcessTableAttribute asking a query that answers, as OpenProcess
+    would at that moment, with the process that has the id then.  Every
+    operation must be attributed to the process that issued it or to
+    none, never to another, unless neither its create nor the exit of
+    the process before it with the id was seen.  The operations of a
+    process the filter reported must be attributed until
+    PROCESS_TABLE_LINGER after it exits, to the entry the filter
+    reported.  The query must only be asked about processes the filter
+    did not report, and about one it answered for only
+    PROCESS_TABLE_RECHECK later.  Every row of Processes must belong to a
+    process of the world, with its parent, image and exit as reported,
+    and once the table sweeps long after the end only processes still
+    running, or whose exit was never seen, may be held.
+
+    It prints how operations were attributed and how often the query was
+    asked, and the ns ProcessTableAttribute takes with tables of
+    increasing size.
+
+    It returns 1 when a check fails.
+
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspyProcessTest mspyProcessTest.c -lsqlite3
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ushim/ushimLog.c"
+#include "../user/mspyProcess.c"
+#include "mspyBench.h"
+
+#define BENCH_TEXT_SIZE         96
+#define BENCH_START             132000000000000000LL
+#define BENCH_SECOND            10000000LL
+#define BENCH_MS                10000LL
+#define BENCH_PIDS              512
+#define BENCH_EARLY             150
+#define BENCH_NONE              0xFFFFFFFF
+#define BENCH_RUNNING           LLONG_MAX
+#define BENCH_MEASURE_PIDS      65536
+
+//
+//  Kinds of record, in the order records arriving at once are taken.
+//
+
+#define BENCH_CREATE            0
+#define BENCH_EXIT              1
+#define BENCH_OPERATION         2
+
+typedef struct _WORLD_PROCESS {
+
+    ULONG_PTR ProcessId;
+    LONGLONG CreateTime;
+    LONGLONG ExitTime;              // BENCH_RUNNING if it outlives the trace
+    NTSTATUS ExitStatus;
+
+    ULONG_PTR ParentProcessId;
+    LONGLONG ParentCreateTime;
+
+    ULONG NextSamePid;              // the next process with its id
+    LONGLONG AskedTime;             // operation last asked about it for
+
+    BOOLEAN Early;                  // running before the filter
+    BOOLEAN Closed;                 // cannot be opened
+    BOOLEAN CreateReported;
+    BOOLEAN ExitReported;
+    BOOLEAN CreateSeen;             // its create record went through
+    BOOLEAN ExitSeen;               // its exit record went through
+
+} WORLD_PROCESS, *PWORLD_PROCESS;
+
+typedef struct _BENCH_EVENT {
+
+    LONGLONG Arrival;
+    LONGLONG Time;
+    ULONG Process;
+    ULONG Kind;
+
+} BENCH_EVENT, *PBENCH_EVENT;
+
+typedef struct _BENCH_STATE {
+
+    PWORLD_PROCESS Processes;
+    ULONG ProcessCount;
+    ULONG ProcessSize;
+
+    ULONG FirstSamePid[BENCH_PIDS];
+    ULONG LastSamePid[BENCH_PIDS];
+
+    PBENCH_EVENT Events;
+    ULONG EventCount;
+    ULONG EventSize;
+
+    LONGLONG End;
+
+    //
+    //  When the record being run arrived, what the query sees as now, and
+    //  when its operation started.
+    //
+
+    LONGLONG Now;
+    LONGLONG Time;
+    ULONG Queries;
+    ULONG Unanswered;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static VOID
+BenchImage (
+    _In_ ULONG Process,
+    _Out_writes_(BENCH_TEXT_SIZE) char *ImagePath,
+    _Out_writes_(BENCH_TEXT_SIZE) WCHAR *NativeImagePath
+    )
+{
+    char native[BENCH_TEXT_SIZE];
+    ULONG index;
+
+    snprintf( ImagePath, BENCH_TEXT_SIZE, "C:\\Program Files\\app%u\\app%u.exe", Process % 97, Process );
+    snprintf( native, sizeof( native ), "\\Device\\HarddiskVolume2\\Program Files\\app%u\\app%u.exe", Process % 97, Process );
+
+    for (index = 0; index == 0 || native[index - 1] != '\0'; index++) {
+
+        NativeImagePath[index] = (UCHAR)native[index];
+    }
+}
+
+static PWORLD_PROCESS
+BenchFind (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG CreateTime
+    )
+{
+    ULONG index;
+
+    for (index = Bench.FirstSamePid[ProcessId / 4 - 1]; index != BENCH_NONE; index = Bench.Processes[index].NextSamePid) {
+
+        if (Bench.Processes[index].CreateTime == CreateTime) {
+
+            return &Bench.Processes[index];
+        }
+    }
+
+    return NULL;
+}
+
+static BOOLEAN
+BenchQuery (
+    _In_ ULONG_PTR ProcessId,
+    _Out_ PLONGLONG CreateTime,
+    _Out_writes_z_(MAX_PATH) char *ImagePath,
+    _Out_writes_z_(MAX_PATH) WCHAR *NativeImagePath
+    )
+/*++
+
+Routine Description:
+
+    Stands in for OpenProcess: answers with the process that has the id
+    when the record arrived, unless it cannot be opened.
+
+--*/
+{
+    PWORLD_PROCESS process;
+    PPROCESS_ENTRY entry;
+    ULONG index;
+
+    Bench.Queries++;
+
+    entry = ProcessTableFind( ProcessId, Bench.Time );
+    BenchCommon.Checks++;
+
+    if (entry != NULL && (!entry->Queried || entry->CheckedTime + PROCESS_TABLE_RECHECK > Bench.Time)) {
+
+        BenchFail( "processes asked about only when not known",
+                   entry->Queried ? "asked again within PROCESS_TABLE_RECHECK" : "asked about a process the filter reported" );
+    }
+
+    for (index = Bench.FirstSamePid[ProcessId / 4 - 1]; index != BENCH_NONE; index = process->NextSamePid) {
+
+        process = &Bench.Processes[index];
+
+        if (process->CreateTime <= Bench.Now && Bench.Now < process->ExitTime) {
+
+            if (process->Closed) {
+
+                Bench.Unanswered++;
+                return FALSE;
+            }
+
+            //
+            //  Looked up before, the table must know when.
+            //
+
+            for (entry = ProcessTableChain( ProcessId ); entry != NULL; entry = entry->Next) {
+
+                if (entry->ProcessId == ProcessId && entry->CreateTime == process->CreateTime && entry->Queried) {
+
+                    BenchCommon.Checks++;
+
+                    if (entry->CheckedTime != process->AskedTime) {
+
+                        BenchFail( "processes asked about only when not known", "when it was last asked about is lost" );
+                    }
+                }
+            }
+
+            process->AskedTime = Bench.Time;
+            *CreateTime = process->CreateTime;
+            BenchImage( index, ImagePath, NativeImagePath );
+            return TRUE;
+        }
+    }
+
+    Bench.Unanswered++;
+    return FALSE;
+}
+
+static VOID
+BenchEmit (
+    _In_ LONGLONG Arrival,
+    _In_ LONGLONG Time,
+    _In_ ULONG Process,
+    _In_ ULONG Kind
+    )
+{
+    PBENCH_EVENT event;
+
+    if (Bench.EventCount == Bench.EventSize) {
+
+        Bench.EventSize = max( 1 << 16, Bench.EventSize * 2 );
+        Bench.Events = realloc( Bench.Events, Bench.EventSize * sizeof( BENCH_EVENT ) );
+
+        if (Bench.Events == NULL) {
+
+            printf( "Could not allocate the trace\n" );
+            exit( 2 );
+        }
+    }
+
+    event = &Bench.Events[Bench.EventCount++];
+    event->Arrival = Arrival;
+    event->Time = Time;
+    event->Process = Process;
+    event->Kind = Kind;
+}
+
+static int
+BenchCompareEvents (
+    _In_ const void *A,
+    _In_ const void *B
+    )
+{
+    const BENCH_EVENT *a = A;
+    const BENCH_EVENT *b = B;
+
+    if (a->Arrival != b->Arrival) {
+
+        return (a->Arrival < b->Arrival) ? -1 : 1;
+    }
+
+    return (int)a->Kind - (int)b->Kind;
+}
+
+static ULONG
+BenchAddProcess (
+    _In_ LONGLONG CreateTime,
+    _In_ LONGLONG ExitTime,
+    _In_ ULONG Pid,
+    _In_ ULONG Parent,
+    _In_ BOOLEAN Early
+    )
+{
+    PWORLD_PROCESS process;
+    ULONG index = Bench.ProcessCount;
+
+    if (Bench.ProcessCount == Bench.ProcessSize) {
+
+        Bench.ProcessSize = max( 1024, Bench.ProcessSize * 2 );
+        Bench.Processes = realloc( Bench.Processes, Bench.ProcessSize * sizeof( WORLD_PROCESS ) );
+
+        if (Bench.Processes == NULL) {
+
+            printf( "Could not allocate the processes\n" );
+            exit( 2 );
+        }
+    }
+
+    process = &Bench.Processes[Bench.ProcessCount++];
+    memset( process, 0, sizeof( *process ) );
+
+    process->ProcessId = 4 * (Pid + 1);
+    process->CreateTime = CreateTime;
+    process->ExitTime = ExitTime;
+    process->ExitStatus = (NTSTATUS)BenchBelow( 3 );
+    process->NextSamePid = BENCH_NONE;
+    process->Early = Early;
+    process->Closed = (BenchBelow( 50 ) == 0);
+    process->CreateReported = !Early && BenchBelow( 100 ) != 0;
+    process->ExitReported = (ExitTime != BENCH_RUNNING) && BenchBelow( 100 ) != 0;
+
+    if (Parent != BENCH_NONE) {
+
+        process->ParentProcessId = Bench.Processes[Parent].ProcessId;
+        process->ParentCreateTime = Bench.Processes[Parent].CreateTime;
+    }
+
+    if (Bench.FirstSamePid[Pid] == BENCH_NONE) {
+
+        Bench.FirstSamePid[Pid] = index;
+
+    } else {
+
+        Bench.Processes[Bench.LastSamePid[Pid]].NextSamePid = index;
+    }
+
+    Bench.LastSamePid[Pid] = index;
+
+    return index;
+}
+
+static VOID
+BenchGenerate (
+    _In_ ULONG Seconds,
+    _In_ ULONG Rate
+    )
+/*++
+
+Routine Description:
+
+    Makes the world and the records the writer gets of it.  A new
+    process takes a free id at random from BENCH_PIDS, so ids come back
+    soon after their process exits.
+
+--*/
+{
+    ULONG running[BENCH_PIDS];
+    ULONG runningCount = 0;
+    LONGLONG time = BENCH_START;
+    LONGLONG lifetime;
+    LONGLONG from;
+    LONGLONG to;
+    LONGLONG delay;
+    PWORLD_PROCESS process;
+    ULONG operations;
+    ULONG index;
+    ULONG slot;
+    ULONG pid;
+    ULONG roll;
+    BOOLEAN used[BENCH_PIDS] = { 0 };
+
+    Bench.End = BENCH_START + Seconds * BENCH_SECOND;
+
+    for (pid = 0; pid < BENCH_PIDS; pid++) {
+
+        Bench.FirstSamePid[pid] = BENCH_NONE;
+    }
+
+    while (time < Bench.End) {
+
+        //
+        //  Free the ids of the processes gone by now.
+        //
+
+        for (slot = 0; slot < runningCount; ) {
+
+            process = &Bench.Processes[running[slot]];
+
+            if (process->ExitTime <= time) {
+
+                used[process->ProcessId / 4 - 1] = FALSE;
+                running[slot] = running[--runningCount];
+
+            } else {
+
+                slot++;
+            }
+        }
+
+        if (runningCount >= BENCH_PIDS * 3 / 4) {
+
+            time += BENCH_SECOND / Rate;
+            continue;
+        }
+
+        do {
+
+            pid = BenchBelow( BENCH_PIDS );
+
+        } while (used[pid]);
+
+        roll = BenchBelow( 1000 );
+
+        lifetime = (roll < 700) ? 10 * BENCH_MS + BenchBelow( 3000 ) * BENCH_MS :
+                   (roll < 995) ? 3 * BENCH_SECOND + (LONGLONG)BenchBelow( 60 ) * BENCH_SECOND : 0;
+
+        if (Bench.ProcessCount < BENCH_EARLY) {
+
+            //
+            //  Running before the filter, some of them for good.
+            //
+
+            index = BenchAddProcess( BENCH_START - 1 - (LONGLONG)BenchBelow( 3600 ) * BENCH_SECOND,
+                                     (BenchBelow( 3 ) == 0) ? BENCH_RUNNING : BENCH_START + (LONGLONG)BenchBelow( Seconds ) * BENCH_SECOND,
+                                     pid,
+                                     BENCH_NONE,
+                                     TRUE );
+
+        } else {
+
+            index = BenchAddProcess( time,
+                                     (lifetime == 0) ? BENCH_RUNNING : time + lifetime,
+                                     pid,
+                                     running[BenchBelow( runningCount )],
+                                     FALSE );
+
+            time += BenchBelow( (ULONG)(2 * BENCH_SECOND / Rate) ) + 1;
+        }
+
+        used[pid] = TRUE;
+        running[runningCount++] = index;
+    }
+
+    //
+    //  The records, each arriving when the writer gets it.
+    //
+
+    for (index = 0; index < Bench.ProcessCount; index++) {
+
+        process = &Bench.Processes[index];
+
+        if (process->CreateReported) {
+
+            BenchEmit( process->CreateTime + BenchBelow( (ULONG)BENCH_MS ), process->CreateTime, index, BENCH_CREATE );
+        }
+
+        if (process->ExitReported) {
+
+            BenchEmit( process->ExitTime + BenchBelow( (ULONG)BENCH_MS ), process->ExitTime, index, BENCH_EXIT );
+        }
+
+        from = max( process->CreateTime, BENCH_START );
+        to = min( process->ExitTime, Bench.End );
+
+        if (to <= from) {
+
+            continue;
+        }
+
+        operations = (ULONG)min( 300, 1 + (to - from) / (BENCH_SECOND / 2) );
+
+        while (operations-- != 0) {
+
+            //
+            //  The first, opening the image, comes as the process is created.
+            //
+
+            time = (operations == 0 && !process->Early) ? from : from + (LONGLONG)(BenchRandom() % (ULONGLONG)(to - from));
+            roll = BenchBelow( 1000 );
+
+            delay = (roll < 960) ? BenchBelow( 20 ) * BENCH_MS :
+                    (roll < 995) ? (LONGLONG)(1 + BenchBelow( 30 )) * BENCH_SECOND :
+                                   PROCESS_TABLE_LINGER + (LONGLONG)(1 + BenchBelow( 60 )) * BENCH_SECOND;
+
+            BenchEmit( time + delay, time, index, BENCH_OPERATION );
+        }
+    }
+
+    qsort( Bench.Events, Bench.EventCount, sizeof( BENCH_EVENT ), BenchCompareEvents );
+}
+
+static VOID
+BenchRun (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Runs the records through the table in the order they arrive and
+    checks every attribution.
+
+--*/
+{
+    PBENCH_EVENT event;
+    PWORLD_PROCESS process;
+    PPROCESS_ENTRY entry;
+    char imagePath[BENCH_TEXT_SIZE];
+    WCHAR nativePath[BENCH_TEXT_SIZE];
+    char detail[200];
+    PWORLD_PROCESS other;
+    ULONG counts[5] = { 0 };
+    ULONG lateCounts[2] = { 0 };
+    ULONG operations = 0;
+    ULONG queries;
+    ULONG peak = 0;
+    ULONG index;
+    BOOLEAN must;
+    long long start;
+    double elapsed;
+
+    start = BenchNow();
+
+    for (index = 0; index < Bench.EventCount; index++) {
+
+        event = &Bench.Events[index];
+        process = &Bench.Processes[event->Process];
+        Bench.Now = event->Arrival;
+
+        if (event->Kind == BENCH_CREATE) {
+
+            BenchImage( event->Process, imagePath, nativePath );
+            ProcessTableCreate( process->ProcessId,
+                                process->CreateTime,
+                                process->ParentProcessId,
+                                process->ParentCreateTime,
+                                4 * (event->Process + 1),
+                                imagePath,
+                                nativePath,
+                                FALSE,
+                                event->Time );
+
+            process->CreateSeen = TRUE;
+            peak = max( peak, ProcessTable.Stats.Entries );
+            continue;
+        }
+
+        if (event->Kind == BENCH_EXIT) {
+
+            ProcessTableExit( process->ProcessId, process->CreateTime, process->ExitTime, process->ExitStatus );
+            process->ExitSeen = TRUE;
+            continue;
+        }
+
+        operations++;
+        Bench.Time = event->Time;
+        queries = Bench.Queries;
+        entry = ProcessTableAttribute( process->ProcessId, event->Time, BenchQuery );
+
+        //
+        //  Attributed while the filter's entry must still be there: it
+        //  was reported, and the operation arrived less than
+        //  PROCESS_TABLE_LINGER after the process exited.
+        //
+
+        must = process->CreateSeen &&
+               (process->ExitTime == BENCH_RUNNING || event->Arrival < process->ExitTime + PROCESS_TABLE_LINGER);
+
+        BenchCommon.Checks++;
+
+        if (entry != NULL && entry->CreateTime != process->CreateTime) {
+
+            //
+            //  Without the create of this one nor the exit of the one
+            //  before, nothing tells them apart but the query, which is
+            //  not asked about reported processes nor more often than
+            //  PROCESS_TABLE_RECHECK, and cannot open every process.
+            //
+
+            other = BenchFind( entry->ProcessId, entry->CreateTime );
+
+            if (other != NULL && other->CreateTime < process->CreateTime && !other->ExitSeen && !process->CreateSeen &&
+                (!entry->Queried || entry->CheckedTime + PROCESS_TABLE_RECHECK > event->Time || queries != Bench.Queries)) {
+
+                counts[3]++;
+                continue;
+            }
+
+            counts[4]++;
+            snprintf( detail, sizeof( detail ), "an operation of process %u created at %lld, %lld late, went to the one created at %lld",
+                      (unsigned)process->ProcessId,
+                      (long long)(process->CreateTime - BENCH_START),
+                      (long long)(event->Arrival - event->Time),
+                      (long long)(entry->CreateTime - BENCH_START) );
+            BenchFail( "operation attributed to its process or none", detail );
+            continue;
+        }
+
+        if (entry == NULL) {
+
+            counts[2]++;
+            lateCounts[event->Arrival - event->Time >= PROCESS_TABLE_LINGER]++;
+
+            if (must) {
+
+                snprintf( detail, sizeof( detail ), "process %u created at %lld, %lld late",
+                          (unsigned)process->ProcessId,
+                          (long long)(process->CreateTime - BENCH_START),
+                          (long long)(event->Arrival - event->Time) );
+                BenchFail( "operations of reported processes attributed", detail );
+            }
+
+            continue;
+        }
+
+        counts[process->CreateReported ? 0 : 1]++;
+
+        BenchCommon.Checks++;
+
+        if (entry->Queried && entry->CheckedTime + PROCESS_TABLE_RECHECK <= event->Time && queries == Bench.Queries) {
+
+            snprintf( detail, sizeof( detail ), "process %u created at %lld, checked at %lld, operation at %lld",
+                      (unsigned)process->ProcessId,
+                      (long long)(process->CreateTime - BENCH_START),
+                      (long long)(entry->CheckedTime - BENCH_START),
+                      (long long)(event->Time - BENCH_START) );
+            BenchFail( "looked up processes checked again", detail );
+        }
+
+        if (process->CreateSeen) {
+
+            BenchCommon.Checks++;
+
+            if (entry->Queried || entry->ParentProcessId != process->ParentProcessId) {
+
+                snprintf( detail, sizeof( detail ), "process %u created at %lld %s",
+                          (unsigned)process->ProcessId,
+                          (long long)(process->CreateTime - BENCH_START),
+                          entry->Queried ? "was looked up" : "has another parent" );
+                BenchFail( "reported process kept as reported", detail );
+            }
+        }
+    }
+
+    elapsed = (double)(BenchNow() - start);
+
+    printf( "%u processes over %lld seconds, %u of them before the filter, %u records:\n",
+            Bench.ProcessCount, (long long)((Bench.End - BENCH_START) / BENCH_SECOND), BENCH_EARLY, Bench.EventCount );
+    printf( "    %u operations: %u to reported processes, %u to processes looked up, %u to none (%u of them more than %lld s late),\n"
+            "    %u to an earlier process when neither its exit nor the next create was seen, %u wrong\n",
+            operations, counts[0], counts[1], counts[2], lateCounts[1],
+            (long long)(PROCESS_TABLE_LINGER / BENCH_SECOND), counts[3], counts[4] );
+    printf( "    %u queries, %.2f for 1000 operations, %u of them unanswered; %u entries at most\n",
+            Bench.Queries, 1000.0 * Bench.Queries / operations, Bench.Unanswered, peak );
+    printf( "    %.0f ns a record, queries included\n", elapsed / Bench.EventCount );
+}
+
+static VOID
+BenchCheckRows (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Checks every row of Processes against the world.
+
+--*/
+{
+    PWORLD_PROCESS process;
+    sqlite3_stmt *stmt = NULL;
+    char imagePath[BENCH_TEXT_SIZE];
+    WCHAR nativePath[BENCH_TEXT_SIZE];
+    char detail[200];
+    const char *source;
+    const char *image;
+    ULONG reported = 0;
+    ULONG filterRows = 0;
+    ULONG rows = 0;
+    ULONG index;
+    BOOLEAN fromFilter;
+
+    for (index = 0; index < Bench.ProcessCount; index++) {
+
+        reported += Bench.Processes[index].CreateReported;
+    }
+
+    sqlite3_prepare_v2( Db,
+                        "SELECT ProcessId, CreateTime, ExitTime, ExitStatus, ParentProcessId, ParentCreateTime, ImagePath, Source FROM Processes;",
+                        -1, &stmt, NULL );
+
+    while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        rows++;
+        process = BenchFind( (ULONG_PTR)sqlite3_column_int64( stmt, 0 ), sqlite3_column_int64( stmt, 1 ) );
+
+        BenchCommon.Checks++;
+
+        if (process == NULL) {
+
+            snprintf( detail, sizeof( detail ), "process %lld created at %lld",
+                      (long long)sqlite3_column_int64( stmt, 0 ),
+                      (long long)(sqlite3_column_int64( stmt, 1 ) - BENCH_START) );
+            BenchFail( "rows for processes that ran", detail );
+            continue;
+        }
+
+        source = (const char *)sqlite3_column_text( stmt, 7 );
+        image = (const char *)sqlite3_column_text( stmt, 6 );
+        fromFilter = (source != NULL && strcmp( source, "Filter" ) == 0);
+        filterRows += fromFilter;
+
+        BenchImage( (ULONG)(process - Bench.Processes), imagePath, nativePath );
+
+        BenchCommon.Checks++;
+
+        if (fromFilter != process->CreateReported ||
+            (image != NULL && strcmp( image, imagePath ) != 0) ||
+            (fromFilter && image == NULL) ||
+            (fromFilter && (sqlite3_column_int64( stmt, 4 ) != (sqlite3_int64)process->ParentProcessId ||
+                            (process->ParentCreateTime != 0) != (sqlite3_column_type( stmt, 5 ) != SQLITE_NULL)))) {
+
+            snprintf( detail, sizeof( detail ), "process %u created at %lld: source %s, image %s",
+                      (unsigned)process->ProcessId, (long long)(process->CreateTime - BENCH_START),
+                      source ? source : "NULL", image ? image : "NULL" );
+            BenchFail( "rows as reported", detail );
+        }
+
+        //
+        //  An exit seen is written as seen.  One not seen is taken from the
+        //  next process with the id, which came later.
+        //
+
+        BenchCommon.Checks++;
+
+        if (process->ExitReported ?
+                (sqlite3_column_int64( stmt, 2 ) != process->ExitTime ||
+                 sqlite3_column_int64( stmt, 3 ) != process->ExitStatus) :
+                (sqlite3_column_type( stmt, 2 ) != SQLITE_NULL && sqlite3_column_int64( stmt, 2 ) < process->ExitTime)) {
+
+            snprintf( detail, sizeof( detail ), "process %u created at %lld exited at %lld, row says %lld",
+                      (unsigned)process->ProcessId, (long long)(process->CreateTime - BENCH_START),
+                      (long long)(process->ExitTime - BENCH_START),
+                      (long long)(sqlite3_column_int64( stmt, 2 ) - BENCH_START) );
+            BenchFail( "exit times", detail );
+        }
+    }
+
+    sqlite3_finalize( stmt );
+
+    printf( "    %u rows in Processes, %u of them from the filter\n", rows, filterRows );
+
+    BenchCommon.Checks++;
+
+    if (filterRows != reported) {
+
+        snprintf( detail, sizeof( detail ), "%u rows from the filter, %u processes reported", filterRows, reported );
+        BenchFail( "a row for every reported process", detail );
+    }
+}
+
+static VOID
+BenchCheckSwept (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Sweeps long after every exit, when only processes still running or
+    whose exit was never learnt may be left.
+
+--*/
+{
+    PPROCESS_ENTRY entry;
+    PWORLD_PROCESS process;
+    char detail[200];
+    ULONG bound = 0;
+    ULONG left = 0;
+    ULONG bucket;
+    ULONG index;
+
+    for (index = 0; index < Bench.ProcessCount; index++) {
+
+        process = &Bench.Processes[index];
+        bound += (process->ExitTime == BENCH_RUNNING || !process->ExitReported);
+    }
+
+    ProcessTableSweep( LLONG_MAX - PROCESS_TABLE_LINGER );
+
+    for (bucket = 0; bucket < ProcessTable.BucketCount; bucket++) {
+
+        for (entry = ProcessTable.Buckets[bucket]; entry != NULL; entry = entry->Next) {
+
+            left++;
+            process = BenchFind( entry->ProcessId, entry->CreateTime );
+
+            BenchCommon.Checks++;
+
+            if (entry->ExitTime != 0 || process == NULL ||
+                (process->ExitTime != BENCH_RUNNING && process->ExitReported)) {
+
+                snprintf( detail, sizeof( detail ), "process %u created at %lld",
+                          (unsigned)entry->ProcessId, (long long)(entry->CreateTime - BENCH_START) );
+                BenchFail( "exited processes dropped", detail );
+            }
+        }
+    }
+
+    printf( "    %u entries left after the sweep, of %u running or with no exit seen\n", left, bound );
+
+    BenchCommon.Checks++;
+
+    if (left != ProcessTable.Stats.Entries || left > bound) {
+
+        snprintf( detail, sizeof( detail ), "%u entries left, %u counted, at most %u expected", left, ProcessTable.Stats.Entries, bound );
+        BenchFail( "entries counted", detail );
+    }
+}
+
+static BOOLEAN
+BenchNeverQuery (
+    _In_ ULONG_PTR ProcessId,
+    _Out_ PLONGLONG CreateTime,
+    _Out_writes_z_(MAX_PATH) char *ImagePath,
+    _Out_writes_z_(MAX_PATH) WCHAR *NativeImagePath
+    )
+{
+    UNREFERENCED_PARAMETER( ProcessId );
+    UNREFERENCED_PARAMETER( CreateTime );
+    UNREFERENCED_PARAMETER( ImagePath );
+    UNREFERENCED_PARAMETER( NativeImagePath );
+
+    Bench.Queries++;
+    return FALSE;
+}
+
+static VOID
+BenchEmpty (
+    VOID
+    )
+{
+    PPROCESS_ENTRY entry;
+    ULONG bucket;
+
+    for (bucket = 0; bucket < ProcessTable.BucketCount; bucket++) {
+
+        while ((entry = ProcessTable.Buckets[bucket]) != NULL) {
+
+            ProcessTable.Buckets[bucket] = entry->Next;
+            ProcessTableFree( entry );
+        }
+    }
+}
+
+static VOID
+BenchMeasure (
+    _In_ ULONG Lookups
+    )
+/*++
+
+Routine Description:
+
+    Measures ProcessTableAttribute with tables of 1000 to 100000 reported
+    processes, all still lingering, over ids reused as often as the table
+    is larger than BENCH_MEASURE_PIDS, and checks the table grew to hold
+    them a bucket each at most.
+
+--*/
+{
+    static const ULONG sizes[] = { 1000, 10000, 100000 };
+    const LONGLONG time = BENCH_START + 1000 * PROCESS_TABLE_LINGER;
+    char imagePath[BENCH_TEXT_SIZE];
+    WCHAR nativePath[BENCH_TEXT_SIZE];
+    PPROCESS_ENTRY entry;
+    long long start;
+    double createNs;
+    ULONG found;
+    ULONG size;
+    ULONG index;
+    ULONG pid;
+
+    printf( "ProcessTableAttribute over %u lookups:\n", Lookups );
+
+    for (size = 0; size < sizeof( sizes ) / sizeof( sizes[0] ); size++) {
+
+        BenchEmpty();
+        ProcessTable.LastSweep = time;
+
+        BenchImage( 0, imagePath, nativePath );
+
+        start = BenchNow();
+
+        for (index = 0; index < sizes[size]; index++) {
+
+            //
+            //  Ids go round BENCH_MEASURE_PIDS of them, so the largest
+            //  table holds more processes for some ids.
+            //
+
+            pid = 4 * (index % BENCH_MEASURE_PIDS + 1);
+            ProcessTableCreate( pid, time + index, 8, 0, 12, imagePath, nativePath, FALSE, time + index );
+        }
+
+        createNs = (double)(BenchNow() - start) / sizes[size];
+
+        found = 0;
+        Bench.Queries = 0;
+        start = BenchNow();
+
+        for (index = 0; index < Lookups; index++) {
+
+            pid = (index * 2654435761U) % sizes[size];
+            entry = ProcessTableAttribute( 4 * (pid % BENCH_MEASURE_PIDS + 1), time + pid + 1, BenchNeverQuery );
+            found += (entry != NULL && entry->CreateTime == time + pid);
+        }
+
+        printf( "    %6u processes in %6u buckets: %.0f ns a lookup, %.0f ns a create, %u of %u found, %u queries\n",
+                sizes[size], ProcessTable.BucketCount, (double)(BenchNow() - start) / Lookups, createNs, found, Lookups, Bench.Queries );
+
+        BenchCommon.Checks++;
+
+        if (found != Lookups || Bench.Queries != 0) {
+
+            BenchFail( "lookups in the measured table", "not every process found from the table alone" );
+        }
+
+        BenchCommon.Checks++;
+
+        if (ProcessTable.Stats.Entries > ProcessTable.BucketCount) {
+
+            BenchFail( "table growth", "more processes than buckets" );
+        }
+    }
+
+    BenchEmpty();
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    printf( "Usage: mspyProcessTest [-d <seconds>] [-r <processes a second>] [-m <lookups>] [-s <sql directory>]\n"
+            "\n"
+            "    [-d <seconds>] length of the trace, 1800 by default\n"
+            "    [-r <processes a second>] processes created a second, 10 by default\n"
+            "    [-m <lookups>] lookups measured, 5000000 by default\n"
+            "    [-s <sql directory>] where process.sql is, ../user by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    sqlite3 *db = NULL;
+    ULONG seconds = 1800;
+    ULONG rate = 10;
+    ULONG lookups = 5000000;
+    int option;
+
+    while ((option = getopt( argc, argv, "d:r:m:s:" )) != -1) {
+
+        switch (option) {
+
+            case 'd':
+                seconds = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'r':
+                rate = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'm':
+                lookups = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 's':
+                UshimSqlDirectory = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || seconds < 300 || rate == 0 || rate > 1000 || lookups == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    if (sqlite3_open( ":memory:", &db ) != SQLITE_OK ||
+        ExecEmbeddedSQL( db, L"PROCESS_SQL" ) != SQLITE_OK ||
+        !ProcessTablePrepare( db )) {
+
+        printf( "Could not create the schema from %s\n", UshimSqlDirectory );
+        sqlite3_close( db );
+        return 2;
+    }
+
+    BenchGenerate( seconds, rate );
+
+    sqlite3_exec( db, "BEGIN;", NULL, NULL, NULL );
+    BenchRun();
+    sqlite3_exec( db, "COMMIT;", NULL, NULL, NULL );
+
+    BenchCheckRows( db );
+    BenchCheckSwept();
+
+    ProcessTableFinalize();
+    BenchMeasure( lookups );
+
+    sqlite3_close( db );
+    free( Bench.Events );
+    free( Bench.Processes );
+
+    return BenchSummary();
+}
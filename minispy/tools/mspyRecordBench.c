@@ -0,0 +1,849 @@
+/*++
+
+Module Name:
+
+    mspyRecordBench.c
+
+Abstract:
+
+    Runs the filter's record allocation and output ring code,
+    filter/mspyRecord.c, in a Linux program against the primitives in
+    kshim/fltKernel.h, to measure what can not be measured in the kernel.
+
+    Producer threads stand in for the filter's operation callbacks: each
+    takes records with SpyNewRecord and hands them to SpyLog, keeping a
+    number of them allocated meanwhile the way operations in flight
+    between their pre and post callbacks do.  Consumer threads stand in for
+    clients, reading with SpyGetLog into a buffer as large as the client's
+    and waiting as long as the client does when there is nothing to read.
+    There is one client by default; with several, each reads the shared
+    ring through its own cursor, and several threads may read through the
+    same client, as threads of one process sharing a port do.
+
+    At the end it prints:
+
+        the rate records were logged and delivered at;
+
+        the records lost, because SpyNewRecord found the allocation budget
+        (MaxRecordsToAllocate) spent and the static out of memory record
+        in use, the records logged in the static record, and the records
+        overwritten in the ring before the consumer read them;
+
+        the most records allocated at once, and by how much that overshot
+        the budget, which SpyAllocateBuffer's unlocked check allows;
+
+        how often the ring's spin lock was found held, and for how long;
+
+        how long records waited in the ring before the consumer took them;
+
+        the records the consumers found out of order or damaged, and the
+        clients whose delivered, dropped and filtered counts do not add up
+        to the records logged, all of which should be none.
+
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -Wno-unknown-pragmas -Ikshim -I../inc -o mspyRecordBench mspyRecordBench.c ../filter/mspyRecord.c
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "../filter/mspyKern.h"
+
+#define BENCH_MAX_PRODUCERS         256
+#define BENCH_MAX_CLIENTS           16
+#define BENCH_MAX_READERS           16          // per client
+#define BENCH_MAX_IN_FLIGHT         1024
+#define BENCH_BUCKETS               48          // log2 of nanoseconds
+
+//
+//  The client's buffer and how long it waits when there is nothing to
+//  read, BUFFER_SIZE, POLL_INTERVAL_MIN and POLL_INTERVAL in user/mspyLog.
+//  The wait doubles from the shortest to the longest while there is
+//  nothing to read.
+//
+
+#define BENCH_DEFAULT_BUFFER        (64 * 1024)
+#define BENCH_POLL_MIN              1           // milliseconds
+#define BENCH_DEFAULT_POLL          200         // milliseconds
+
+//
+//  Defined in minispy.c in the filter.
+//
+
+MINISPY_DATA MiniSpyData;
+
+typedef struct _BENCH_PRODUCER {
+
+    pthread_t Thread;
+    ULONG Index;
+
+    unsigned long long Logged;
+    unsigned long long Lost;
+    unsigned long long Static;
+    LONG PeakAllocated;
+
+    //
+    //  The records of the operations in flight, NULL for those that got
+    //  none, used round robin.
+    //
+
+    PRECORD_LIST InFlight[BENCH_MAX_IN_FLIGHT];
+
+} __attribute__(( aligned( 64 ) )) BENCH_PRODUCER, *PBENCH_PRODUCER;
+
+typedef struct _BENCH_CLIENT {
+
+    SPY_CLIENT Client;
+    MINISPY_CLIENT_STATS Stats;
+
+    //
+    //  The ring's head when the client attached, its cursor must account
+    //  for every record logged from there on.
+    //
+
+    ULONGLONG Start;
+
+} BENCH_CLIENT, *PBENCH_CLIENT;
+
+typedef struct _BENCH_READER {
+
+    pthread_t Thread;
+    PBENCH_CLIENT Client;
+
+    unsigned long long Delivered;
+    unsigned long long Bytes;
+    unsigned long long Reads;
+    unsigned long long Empty;
+    unsigned long long TooSmall;
+    unsigned long long Damaged;
+    unsigned long long OutOfOrder;
+    unsigned long long StaticDelivered;
+    unsigned long long Latency[BENCH_BUCKETS];
+    long long LatencyMax;
+
+    //
+    //  Readers of one client split its records between them, each must
+    //  still see every producer's records in order.
+    //
+
+    ULONG_PTR LastSerial[BENCH_MAX_PRODUCERS + 1];
+
+} __attribute__(( aligned( 64 ) )) BENCH_READER, *PBENCH_READER;
+
+typedef struct _BENCH_STATE {
+
+    ULONG Producers;
+    ULONG InFlight;
+    double Seconds;
+
+    //
+    //  Operations a second over all producers, 0 for as fast as they go,
+    //  and when they started.
+    //
+
+    double Rate;
+    long long Start;
+    ULONG PollMilliseconds;
+    ULONG BufferSize;
+
+    volatile int Stop;
+    volatile int Drain;
+
+    BENCH_PRODUCER *Producer;
+
+    //
+    //  Consumers
+    //
+
+    ULONG Clients;
+    ULONG Readers;
+    volatile ULONG Attached;
+
+    BENCH_CLIENT Client[BENCH_MAX_CLIENTS];
+    BENCH_READER *Reader;
+
+    //
+    //  Totals over the readers, and the clients whose counts are off.
+    //
+
+    unsigned long long Delivered;
+    unsigned long long Bytes;
+    unsigned long long Reads;
+    unsigned long long Empty;
+    unsigned long long TooSmall;
+    unsigned long long Damaged;
+    unsigned long long OutOfOrder;
+    unsigned long long StaticDelivered;
+    unsigned long long Latency[BENCH_BUCKETS];
+    long long LatencyMax;
+    ULONG Unaccounted;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static int
+BenchBucket (
+    long long Nanoseconds
+    )
+{
+    int bucket = 0;
+
+    while (Nanoseconds > 1 && bucket < BENCH_BUCKETS - 1) {
+
+        Nanoseconds >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static ULONG
+BenchName (
+    ULONG Producer,
+    PWCHAR Name
+    )
+/*++
+
+Routine Description:
+
+    The file name a producer puts in its records, so the consumer can tell
+    a record is whole.
+
+--*/
+{
+    char text[64];
+    ULONG length;
+    ULONG i;
+
+    length = (ULONG)snprintf( text, sizeof( text ), "\\Device\\HarddiskVolume3\\Bench\\producer%03u.dat", Producer );
+
+    for (i = 0; i <= length; i++) {
+
+        Name[i] = (WCHAR)text[i];
+    }
+
+    return length;
+}
+
+static VOID
+BenchComplete (
+    PBENCH_PRODUCER Producer,
+    PRECORD_LIST Record
+    )
+/*++
+
+Routine Description:
+
+    Completes an operation, as the post operation callback does, and logs
+    its record if it got one.
+
+--*/
+{
+    if (Record == NULL) {
+
+        return;
+    }
+
+    if (FlagOn( Record->LogRecord.RecordType, RECORD_TYPE_FLAG_STATIC )) {
+
+        Producer->Static++;
+    }
+
+    Record->LogRecord.Data.CompletionTime.QuadPart = KshimNow();
+
+    SpyLog( Record );
+    Producer->Logged++;
+}
+
+static void *
+BenchProduce (
+    void *Context
+    )
+/*++
+
+Routine Description:
+
+    Starts operations one after the other, each completing once InFlight
+    later ones have started.  An operation that gets no record still
+    takes its turn, as it does in the filter.  With a rate the producer
+    sleeps whenever it gets ahead of its share of it.
+
+--*/
+{
+    PBENCH_PRODUCER producer = Context;
+    PRECORD_LIST record;
+    PLOG_RECORD logRecord;
+    ULONG_PTR serial = 0;
+    ULONG next = 0;
+    ULONG i;
+    ULONG length;
+    LONG allocated;
+    unsigned long long started = 0;
+    long long due;
+
+    while (!Bench.Stop) {
+
+        if (Bench.Rate != 0 && (++started & 63) == 0) {
+
+            due = Bench.Start + (long long)(started * 1e9 * Bench.Producers / Bench.Rate);
+
+            while (due > KshimNow() && !Bench.Stop) {
+
+                usleep( 1000 );
+            }
+        }
+
+        BenchComplete( producer, producer->InFlight[next] );
+
+        record = SpyNewRecord();
+        producer->InFlight[next] = record;
+        next = (next + 1) % Bench.InFlight;
+
+        if (record == NULL) {
+
+            producer->Lost++;
+            continue;
+        }
+
+        allocated = MiniSpyData.RecordsAllocated;
+
+        if (allocated > producer->PeakAllocated) {
+
+            producer->PeakAllocated = allocated;
+        }
+
+        //
+        //  What the pre operation callback fills in, and a name the way
+        //  SpySetRecordName sets it.
+        //
+
+        logRecord = &record->LogRecord;
+        logRecord->Data.OriginatingTime.QuadPart = KshimNow();
+        logRecord->Data.ProcessId = producer->Index;
+        logRecord->Data.ThreadId = ++serial;
+        logRecord->Data.CallbackMajorId = 0x03;     // IRP_MJ_READ
+        logRecord->Data.Flags = 0x00000001;         // FLT_CALLBACK_DATA_IRP_OPERATION
+
+        length = BenchName( producer->Index, logRecord->Name );
+        logRecord->Length += ROUND_TO_SIZE( (length + 1) * sizeof( WCHAR ), sizeof( PVOID ) );
+    }
+
+    for (i = 0; i < Bench.InFlight; i++) {
+
+        BenchComplete( producer, producer->InFlight[(next + i) % Bench.InFlight] );
+    }
+
+    return NULL;
+}
+
+static VOID
+BenchCheck (
+    PBENCH_READER Reader,
+    PLOG_RECORD LogRecord,
+    long long Now
+    )
+/*++
+
+Routine Description:
+
+    Checks a record a consumer read is whole and in order, and counts how
+    long it waited in the ring.
+
+--*/
+{
+    WCHAR name[64];
+    ULONG_PTR producer = LogRecord->Data.ProcessId;
+    ULONG length;
+    long long latency;
+
+    if (FlagOn( LogRecord->RecordType, RECORD_TYPE_FLAG_STATIC )) {
+
+        Reader->StaticDelivered++;
+    }
+
+    if (producer == 0 || producer > Bench.Producers) {
+
+        Reader->Damaged++;
+        return;
+    }
+
+    length = BenchName( (ULONG)producer, name );
+
+    if (LogRecord->Length != sizeof( LOG_RECORD ) + ROUND_TO_SIZE( (length + 1) * sizeof( WCHAR ), sizeof( PVOID ) ) ||
+        memcmp( LogRecord->Name, name, (length + 1) * sizeof( WCHAR ) ) != 0) {
+
+        Reader->Damaged++;
+        return;
+    }
+
+    //
+    //  Each producer logs its records in the order it numbered them, the
+    //  ring may drop some but must not reorder them.
+    //
+
+    if (LogRecord->Data.ThreadId <= Reader->LastSerial[producer]) {
+
+        Reader->OutOfOrder++;
+    }
+
+    Reader->LastSerial[producer] = LogRecord->Data.ThreadId;
+
+    latency = Now - LogRecord->Data.CompletionTime.QuadPart;
+    Reader->Latency[BenchBucket( latency )]++;
+
+    if (latency > Reader->LatencyMax) {
+
+        Reader->LatencyMax = latency;
+    }
+}
+
+static void *
+BenchConsume (
+    void *Context
+    )
+{
+    PBENCH_READER reader = Context;
+    PSPY_CLIENT client = &reader->Client->Client;
+    PUCHAR buffer;
+    PLOG_RECORD logRecord;
+    ULONG bytesReturned;
+    ULONG offset;
+    NTSTATUS status;
+    long long now;
+    ULONG wait = min( BENCH_POLL_MIN, Bench.PollMilliseconds );
+
+    buffer = aligned_alloc( sizeof( PVOID ), Bench.BufferSize );
+
+    if (buffer == NULL) {
+
+        fprintf( stderr, "Out of memory\n" );
+        exit( 1 );
+    }
+
+    for (;;) {
+
+        status = SpyGetLog( client, buffer, Bench.BufferSize, &bytesReturned );
+        reader->Reads++;
+
+        if (status == STATUS_BUFFER_TOO_SMALL) {
+
+            reader->TooSmall++;
+            break;
+        }
+
+        if (!NT_SUCCESS( status ) || status == STATUS_NO_MORE_ENTRIES) {
+
+            reader->Empty++;
+
+            if (Bench.Drain) {
+
+                break;
+            }
+
+            usleep( wait * 1000 );
+            wait = min( wait * 2, Bench.PollMilliseconds );
+            continue;
+        }
+
+        wait = min( BENCH_POLL_MIN, Bench.PollMilliseconds );
+
+        now = KshimNow();
+
+        for (offset = 0; offset < bytesReturned; offset += logRecord->Length) {
+
+            logRecord = (PLOG_RECORD)(buffer + offset);
+            BenchCheck( reader, logRecord, now );
+            reader->Delivered++;
+        }
+
+        reader->Bytes += bytesReturned;
+    }
+
+    free( buffer );
+    return NULL;
+}
+
+static VOID
+BenchTotal (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Adds up the readers, and checks every client's cursor accounts for
+    each record logged since it attached: delivered, dropped or filtered.
+
+--*/
+{
+    PBENCH_READER reader;
+    PBENCH_CLIENT client;
+    ULONG r;
+    ULONG c;
+    int bucket;
+
+    for (r = 0; r < Bench.Clients * Bench.Readers; r++) {
+
+        reader = &Bench.Reader[r];
+
+        Bench.Delivered += reader->Delivered;
+        Bench.Bytes += reader->Bytes;
+        Bench.Reads += reader->Reads;
+        Bench.Empty += reader->Empty;
+        Bench.TooSmall += reader->TooSmall;
+        Bench.Damaged += reader->Damaged;
+        Bench.OutOfOrder += reader->OutOfOrder;
+        Bench.StaticDelivered += reader->StaticDelivered;
+        Bench.LatencyMax = max( Bench.LatencyMax, reader->LatencyMax );
+
+        for (bucket = 0; bucket < BENCH_BUCKETS; bucket++) {
+
+            Bench.Latency[bucket] += reader->Latency[bucket];
+        }
+    }
+
+    for (c = 0; c < Bench.Clients; c++) {
+
+        client = &Bench.Client[c];
+        SpyQueryClientStats( &client->Client, &client->Stats );
+
+        if (client->Stats.Delivered + client->Stats.Dropped + client->Stats.Filtered !=
+            client->Stats.HeadSequence - client->Start) {
+
+            Bench.Unaccounted++;
+        }
+    }
+}
+
+static double
+BenchPercentile (
+    double Fraction
+    )
+{
+    unsigned long long target = (unsigned long long)(Bench.Delivered * Fraction);
+    unsigned long long seen = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < BENCH_BUCKETS; bucket++) {
+
+        seen += Bench.Latency[bucket];
+
+        if (seen > target) {
+
+            break;
+        }
+    }
+
+    return (double)(1ULL << bucket) / 1000.0;
+}
+
+static void
+BenchReport (
+    double Seconds
+    )
+{
+    PKSPIN_LOCK lock = &MiniSpyData.OutputBufferLock;
+    unsigned long long logged = 0;
+    unsigned long long lost = 0;
+    unsigned long long staticRecords = 0;
+    unsigned long long dropped = 0;
+    LONG peak = 0;
+    ULONG p;
+    ULONG c;
+
+    for (p = 0; p < Bench.Producers; p++) {
+
+        logged += Bench.Producer[p].Logged;
+        lost += Bench.Producer[p].Lost;
+        staticRecords += Bench.Producer[p].Static;
+        peak = max( peak, Bench.Producer[p].PeakAllocated );
+    }
+
+    for (c = 0; c < Bench.Clients; c++) {
+
+        dropped += Bench.Client[c].Stats.Dropped;
+    }
+
+    printf( "Producers:   %u threads, %u records in flight each, %.3f s\n",
+            Bench.Producers,
+            Bench.InFlight,
+            Seconds );
+    printf( "Logged:      %llu records, %.0f/s, %llu of them in the static record\n",
+            logged,
+            logged / Seconds,
+            staticRecords );
+    printf( "Lost:        %llu operations got no record (%.2f%%), %llu allocation failures injected\n",
+            lost,
+            (logged + lost) ? 100.0 * lost / (logged + lost) : 0,
+            (unsigned long long)MiniSpyData.FreeBufferList.Failures );
+    printf( "Budget:      %d records, at most %d allocated at once, %d over\n",
+            MiniSpyData.MaxRecordsToAllocate,
+            peak,
+            max( peak - MiniSpyData.MaxRecordsToAllocate, 0 ) );
+    printf( "Ring:        %u records, %llu dropped before they were read (%.2f%%)\n",
+            MiniSpyData.OutputRing.SlotCount,
+            dropped,
+            logged ? 100.0 * dropped / logged / Bench.Clients : 0 );
+    printf( "Consumers:   %u clients, %u threads each\n",
+            Bench.Clients,
+            Bench.Readers );
+    printf( "             %llu records, %.0f/s, %.1f MB/s, %llu reads, %llu empty, %llu too small\n",
+            Bench.Delivered,
+            Bench.Delivered / Seconds,
+            Bench.Bytes / Seconds / 1048576,
+            Bench.Reads,
+            Bench.Empty,
+            Bench.TooSmall );
+    printf( "             %llu from the static record, %llu damaged, %llu out of order, %u clients miscounted\n",
+            Bench.StaticDelivered,
+            Bench.Damaged,
+            Bench.OutOfOrder,
+            Bench.Unaccounted );
+    printf( "Lock:        %llu acquisitions, %llu found it held (%.2f%%), %.1f ms waited, %.0f ns a wait\n",
+            lock->Acquisitions,
+            lock->Contended,
+            lock->Acquisitions ? 100.0 * lock->Contended / lock->Acquisitions : 0,
+            lock->WaitNanoseconds / 1e6,
+            lock->Contended ? (double)lock->WaitNanoseconds / lock->Contended : 0 );
+
+    if (Bench.Delivered != 0) {
+
+        printf( "Latency:     p50 <%.1f us, p99 <%.1f us, p99.9 <%.1f us, max %.1f us in the ring\n",
+                BenchPercentile( 0.5 ),
+                BenchPercentile( 0.99 ),
+                BenchPercentile( 0.999 ),
+                Bench.LatencyMax / 1000.0 );
+    }
+
+    //
+    //  A rate the consumers do not keep up with says little about the
+    //  ring or the consumers, only that records were overwritten.
+    //
+
+    if (logged != 0 && 100.0 * dropped / logged / Bench.Clients > 1.0) {
+
+        printf( "\nWarning:     %.2f%% of the records were overwritten before they were read, the\n"
+                "             consumers did not keep up with %.0f records/s.  Use -l to log at a\n"
+                "             rate they can sustain, or -p 0 to take out the client's wait.\n",
+                100.0 * dropped / logged / Bench.Clients,
+                logged / Seconds );
+    }
+}
+
+static void
+BenchUsage (
+    void
+    )
+{
+    printf( "Usage: mspyRecordBench [-t <producers>] [-d <seconds>] [-h <records>] [-l <records/s>] [-m <records>]\n"
+            "                       [-k <records>] [-c <clients>] [-r <readers>] [-p <milliseconds>] [-b <bytes>] [-x <n>]\n"
+            "\n"
+            "    [-t <producers>] producer threads, 4 by default\n"
+            "    [-d <seconds>] how long to produce, 5 by default\n"
+            "    [-h <records>] records each producer holds before logging, 1 by default\n"
+            "    [-l <records/s>] operations a second over all producers, as fast as they go by default\n"
+            "    [-m <records>] the allocation budget, MaxRecords, %u by default\n"
+            "    [-k <records>] the ring, RingRecords, %u by default\n"
+            "    [-c <clients>] clients reading the ring, 1 by default\n"
+            "    [-r <readers>] threads reading through each client, 1 by default\n"
+            "    [-p <milliseconds>] the consumer's longest wait when there is nothing to read, %u by default\n"
+            "    [-b <bytes>] the consumer's buffer, %u by default\n"
+            "    [-x <n>] fails one buffer allocation in <n>\n",
+            DEFAULT_MAX_RECORDS_TO_ALLOCATE,
+            DEFAULT_RING_RECORDS,
+            BENCH_DEFAULT_POLL,
+            BENCH_DEFAULT_BUFFER );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    long long start;
+    double seconds;
+    ULONG failEvery = 0;
+    ULONG p;
+    ULONG c;
+    ULONG r;
+    int option;
+
+    //
+    //  As DriverEntry sets it up.
+    //
+
+    MiniSpyData.LogSequenceNumber = 0;
+    MiniSpyData.MaxRecordsToAllocate = DEFAULT_MAX_RECORDS_TO_ALLOCATE;
+    MiniSpyData.RecordsAllocated = 0;
+    MiniSpyData.RingRecords = DEFAULT_RING_RECORDS;
+
+    Bench.Producers = 4;
+    Bench.InFlight = 1;
+    Bench.Seconds = 5;
+    Bench.PollMilliseconds = BENCH_DEFAULT_POLL;
+    Bench.BufferSize = BENCH_DEFAULT_BUFFER;
+    Bench.Clients = 1;
+    Bench.Readers = 1;
+
+    while ((option = getopt( argc, argv, "t:d:h:l:m:k:c:r:p:b:x:" )) != -1) {
+
+        switch (option) {
+
+            case 't':
+                Bench.Producers = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'd':
+                Bench.Seconds = atof( optarg );
+                break;
+
+            case 'h':
+                Bench.InFlight = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'l':
+                Bench.Rate = atof( optarg );
+                break;
+
+            case 'm':
+                MiniSpyData.MaxRecordsToAllocate = (LONG)strtol( optarg, NULL, 0 );
+                break;
+
+            case 'k':
+                MiniSpyData.RingRecords = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'c':
+                Bench.Clients = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'r':
+                Bench.Readers = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'p':
+                Bench.PollMilliseconds = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'b':
+                Bench.BufferSize = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'x':
+                failEvery = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc ||
+        Bench.Producers == 0 || Bench.Producers > BENCH_MAX_PRODUCERS ||
+        Bench.InFlight == 0 || Bench.InFlight > BENCH_MAX_IN_FLIGHT ||
+        Bench.Clients == 0 || Bench.Clients > BENCH_MAX_CLIENTS ||
+        Bench.Readers == 0 || Bench.Readers > BENCH_MAX_READERS ||
+        Bench.Seconds <= 0 || Bench.Rate < 0 || MiniSpyData.MaxRecordsToAllocate < 0 ||
+        Bench.BufferSize < sizeof( PVOID ) || Bench.BufferSize % sizeof( PVOID ) != 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    KeInitializeSpinLock( &MiniSpyData.OutputBufferLock );
+
+    ExInitializeNPagedLookasideList( &MiniSpyData.FreeBufferList,
+                                     NULL,
+                                     NULL,
+                                     POOL_NX_ALLOCATION,
+                                     RECORD_SIZE,
+                                     SPY_TAG,
+                                     0 );
+
+    MiniSpyData.FreeBufferList.FailEvery = failEvery;
+
+    Bench.Producer = aligned_alloc( 64, Bench.Producers * sizeof( BENCH_PRODUCER ) );
+    Bench.Reader = aligned_alloc( 64, Bench.Clients * Bench.Readers * sizeof( BENCH_READER ) );
+
+    if (Bench.Producer == NULL || Bench.Reader == NULL || !NT_SUCCESS( SpyAllocateOutputRing() )) {
+
+        fprintf( stderr, "Out of memory\n" );
+        return 1;
+    }
+
+    memset( Bench.Producer, 0, Bench.Producers * sizeof( BENCH_PRODUCER ) );
+    memset( Bench.Reader, 0, Bench.Clients * Bench.Readers * sizeof( BENCH_READER ) );
+
+    //
+    //  As SpyConnect sets up each client, before the first record.
+    //
+
+    for (c = 0; c < Bench.Clients; c++) {
+
+        ExInitializeRundownProtection( &Bench.Client[c].Client.Rundown );
+        ExInitializeFastMutex( &Bench.Client[c].Client.ReadLock );
+        SpyAttachClient( &Bench.Client[c].Client );
+        Bench.Client[c].Start = Bench.Client[c].Client.Cursor.Next;
+
+        for (r = 0; r < Bench.Readers; r++) {
+
+            Bench.Reader[c * Bench.Readers + r].Client = &Bench.Client[c];
+
+            if (pthread_create( &Bench.Reader[c * Bench.Readers + r].Thread, NULL, BenchConsume, &Bench.Reader[c * Bench.Readers + r] ) != 0) {
+
+                fprintf( stderr, "Could not start a consumer\n" );
+                return 1;
+            }
+        }
+    }
+
+    start = KshimNow();
+    Bench.Start = start;
+
+    for (p = 0; p < Bench.Producers; p++) {
+
+        Bench.Producer[p].Index = p + 1;
+
+        if (pthread_create( &Bench.Producer[p].Thread, NULL, BenchProduce, &Bench.Producer[p] ) != 0) {
+
+            fprintf( stderr, "Could not start producer %u\n", p );
+            return 1;
+        }
+    }
+
+    usleep( (useconds_t)(Bench.Seconds * 1e6) );
+    Bench.Stop = 1;
+
+    for (p = 0; p < Bench.Producers; p++) {
+
+        pthread_join( Bench.Producer[p].Thread, NULL );
+    }
+
+    seconds = (KshimNow() - start) / 1e9;
+
+    Bench.Drain = 1;
+
+    for (r = 0; r < Bench.Clients * Bench.Readers; r++) {
+
+        pthread_join( Bench.Reader[r].Thread, NULL );
+    }
+
+    BenchTotal();
+    BenchReport( seconds );
+
+    SpyFreeOutputRing();
+    free( Bench.Producer );
+    free( Bench.Reader );
+
+    return (Bench.Damaged == 0 && Bench.OutOfOrder == 0 && Bench.Unaccounted == 0) ? 0 : 1;
+}
@@ -0,0 +1,595 @@
+/*++
+
+Module Name:
+
+    mspyReloadTest.c
+
+Abstract:
+
+    Hammers the rule reload, user/mspyReload.c, in a Linux program built
+    against ushim: matcher threads evaluate paths through ReloadAcquire,
+    RulesMatch and ReloadRelease as the log writer does, as fast as they
+    can, while the Rules table is rewritten in a loop by a connection of
+    its own, as the dashboard would.
+
+    Every rewrite replaces the rules with a new generation: rule i of
+    generation g is the location \Device\HarddiskVolume1\Gen<g>\Dir<i>
+    with action (g + i) % 3.  A matcher tells the generation of the rules
+    it holds from their first and last strings, which must agree, then
+    checks that a path below Dir<i> of that generation matches exactly
+    rule i with its action, and that the same path in the next generation
+    matches nothing.  Holding rules that were freed shows up as a
+    mismatch or, built with -fsanitize=address, as a use after free.
+
+    The reload thread polls the database every RELOAD_POLL_INTERVAL; the
+    writer wakes it after each commit unless -w is given, so the loop runs
+    at the compile rate, and waits for each generation to be published
+    before writing the next.
+
+    At the end it prints the reloads done, the compile and publish times
+    the module measured, the time from commit to publish, and the matches
+    done and how long each took.  It returns 1 when a matcher saw a wrong
+    match or rules of two generations, when a reload failed or when a
+    reader count is left over.
+
+    Run from the tools directory, the schema is read from ../user.  Built
+    on its own, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspyReloadTest mspyReloadTest.c -lsqlite3
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ushim/ushimLog.c"
+#include "../user/mspyRules.c"
+#include "../user/mspyReload.c"
+#include "mspyBench.h"
+
+#define BENCH_MAX_MATCHERS      64
+#define BENCH_PATH_SIZE         128
+#define BENCH_PREFIX            "\\Device\\HarddiskVolume1\\Gen"
+
+typedef struct _BENCH_MATCHER {
+
+    pthread_t Thread;
+    unsigned long long Random;
+
+    unsigned long long Matches;
+    unsigned long long Empty;
+    unsigned long long Wrong;
+    unsigned long long Torn;
+
+} __attribute__(( aligned( 64 ) )) BENCH_MATCHER, *PBENCH_MATCHER;
+
+typedef struct _BENCH_STATE {
+
+    ULONG Matchers;
+    ULONG Rules;
+    ULONG Generations;
+    BOOLEAN NoWake;
+    char Directory[MAX_PATH];
+    char Database[MAX_PATH + 16];
+
+    //
+    //  RuleID of rule 0 of every generation, set before the generation
+    //  commits.  Published is the last generation the reload thread
+    //  published, with the time it did.
+    //
+
+    LONGLONG *FirstRuleId;
+    volatile LONG Published;
+    long long *PublishTime;
+
+    volatile int Stop;
+
+    BENCH_MATCHER Matcher[BENCH_MAX_MATCHERS];
+
+    unsigned long long CompileSum;
+    ULONG CompileMax;
+    unsigned long long PublishSum;
+    ULONG PublishMax;
+    long long *Latency;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static VOID
+BenchPath (
+    _In_ ULONG Generation,
+    _In_ ULONG Rule,
+    _In_ ULONG File,
+    _Out_writes_(BENCH_PATH_SIZE) PWCHAR Path
+    )
+/*++
+
+Routine Description:
+
+    Makes the path of a file below rule Rule of Generation, in a case the
+    rule was not written in.
+
+--*/
+{
+    char path[BENCH_PATH_SIZE];
+    int length;
+    int index;
+
+    length = snprintf( path, sizeof( path ), "\\DEVICE\\harddiskvolume1\\gen%u\\DIR%u\\file%u.txt", Generation, Rule, File );
+
+    for (index = 0; index <= length; index++) {
+
+        Path[index] = (WCHAR)path[index];
+    }
+}
+
+static LONG
+BenchGeneration (
+    _In_ PCWSTR Text
+    )
+/*++
+
+Routine Description:
+
+    Reads the generation out of an upcased rule string, -1 if it is not
+    one the writer made.
+
+--*/
+{
+    static const char prefix[] = BENCH_PREFIX;
+    LONG generation = 0;
+    size_t index;
+
+    for (index = 0; index < sizeof( prefix ) - 1; index++) {
+
+        if (Text[index] != RuleUpcase( (WCHAR)prefix[index] )) {
+
+            return -1;
+        }
+    }
+
+    Text += index;
+
+    if (*Text < '0' || *Text > '9') {
+
+        return -1;
+    }
+
+    for (; *Text >= '0' && *Text <= '9'; Text++) {
+
+        generation = generation * 10 + (*Text - '0');
+    }
+
+    return generation;
+}
+
+static LONG
+BenchSetGeneration (
+    _In_ PRULE_SET RuleSet
+    )
+{
+    LONG first;
+
+    if (RuleSet->StringCount == 0) {
+
+        return 0;
+    }
+
+    first = BenchGeneration( RuleSet->Strings[0] );
+
+    return (first == BenchGeneration( RuleSet->Strings[RuleSet->StringCount - 1] )) ? first : -1;
+}
+
+static VOID
+BenchNotify (
+    _In_ PRULE_SET RuleSet,
+    _In_opt_ PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Called by the module on the reload thread once a set is published.
+
+--*/
+{
+    LONG generation = BenchSetGeneration( RuleSet );
+
+    UNREFERENCED_PARAMETER( Context );
+
+    if (generation > 0 && (ULONG)generation <= Bench.Generations) {
+
+        Bench.PublishTime[generation] = BenchNow();
+        InterlockedExchange( &Bench.Published, generation );
+    }
+}
+
+static void *
+BenchMatch (
+    void *Parameter
+    )
+/*++
+
+Routine Description:
+
+    One matcher thread: evaluates a record at a time on whatever rules are
+    published and checks the outcome against the generation they hold.
+
+--*/
+{
+    PBENCH_MATCHER matcher = Parameter;
+    WCHAR path[BENCH_PATH_SIZE];
+    RULE_INPUT input = { 0 };
+    PRULE_SET ruleSet;
+    RULE_REF match;
+    LONG generation;
+    ULONG slot;
+    ULONG rule;
+
+    input.FileName = path;
+
+    while (!Bench.Stop) {
+
+        ruleSet = ReloadAcquire( &slot );
+
+        if (ruleSet == NULL || ruleSet->StringCount == 0) {
+
+            ReloadRelease( slot );
+            matcher->Empty++;
+            continue;
+        }
+
+        generation = BenchSetGeneration( ruleSet );
+
+        if (generation <= 0 || ruleSet->StringCount != Bench.Rules) {
+
+            ReloadRelease( slot );
+            matcher->Torn++;
+            continue;
+        }
+
+        rule = (ULONG)(BenchNext( &matcher->Random ) % Bench.Rules);
+
+        BenchPath( (ULONG)generation, rule, (ULONG)BenchNext( &matcher->Random ) % 1000, path );
+        match = RulesMatch( ruleSet, &input );
+
+        if (match.RuleId != Bench.FirstRuleId[generation] + rule ||
+            match.Action != (LONG)((generation + rule) % 3)) {
+
+            matcher->Wrong++;
+        }
+
+        BenchPath( (ULONG)generation + 1, rule, 0, path );
+        match = RulesMatch( ruleSet, &input );
+
+        if (match.RuleId != 0) {
+
+            matcher->Wrong++;
+        }
+
+        ReloadRelease( slot );
+        matcher->Matches += 2;
+    }
+
+    return NULL;
+}
+
+static BOOLEAN
+BenchWrite (
+    _In_ sqlite3 *Db,
+    _In_ ULONG Generation
+    )
+/*++
+
+Routine Description:
+
+    Replaces every rule with those of Generation in one transaction.
+
+--*/
+{
+    char text[BENCH_PATH_SIZE];
+    sqlite3_stmt *stmt = NULL;
+    ULONG rule;
+
+    if (sqlite3_exec( Db, "BEGIN IMMEDIATE; DELETE FROM Rules;", NULL, NULL, NULL ) != SQLITE_OK ||
+        sqlite3_prepare_v2( Db,
+                            "INSERT INTO Rules (Active, Deleted, Action, RuleType, RuleTarget, RuleString)"
+                            " VALUES (1, 0, ?1, ?2, ?3, ?4);",
+                            -1, &stmt, NULL ) != SQLITE_OK) {
+
+        goto Fail;
+    }
+
+    for (rule = 0; rule < Bench.Rules; rule++) {
+
+        snprintf( text, sizeof( text ), BENCH_PREFIX "%u\\Dir%u", Generation, rule );
+
+        sqlite3_bind_int( stmt, 1, (int)((Generation + rule) % 3) );
+        sqlite3_bind_int( stmt, 2, RULE_TYPE_LOCATION );
+        sqlite3_bind_int( stmt, 3, RULE_TARGET_FILE );
+        sqlite3_bind_text( stmt, 4, text, -1, SQLITE_TRANSIENT );
+
+        if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+            goto Fail;
+        }
+
+        if (rule == 0) {
+
+            Bench.FirstRuleId[Generation] = sqlite3_last_insert_rowid( Db );
+        }
+
+        sqlite3_reset( stmt );
+    }
+
+    sqlite3_finalize( stmt );
+    return sqlite3_exec( Db, "COMMIT;", NULL, NULL, NULL ) == SQLITE_OK;
+
+Fail:
+
+    fprintf( stderr, "Could not write generation %u: %s\n", Generation, sqlite3_errmsg( Db ) );
+    sqlite3_finalize( stmt );
+    sqlite3_exec( Db, "ROLLBACK;", NULL, NULL, NULL );
+    return FALSE;
+}
+
+static int
+BenchCompareLatency (
+    const void *Left,
+    const void *Right
+    )
+{
+    long long left = *(const long long *)Left;
+    long long right = *(const long long *)Right;
+
+    return (left > right) - (left < right);
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: mspyReloadTest [-t matchers] [-n rules] [-g generations] [-w] [-s sqldir] [-o dir]\n"
+             "  -t  matcher threads (default 4, at most %d)\n"
+             "  -n  location rules in every generation (default 1000)\n"
+             "  -g  generations the writer publishes (default 200)\n"
+             "  -w  leave the reload thread to its %u ms poll instead of waking it\n"
+             "  -s  directory of the client's .sql files (default ../user)\n"
+             "  -o  directory for the database (default a new one in /tmp)\n",
+             BENCH_MAX_MATCHERS,
+             RELOAD_POLL_INTERVAL );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    unsigned long long matches = 0;
+    unsigned long long empty = 0;
+    unsigned long long wrong = 0;
+    unsigned long long torn = 0;
+    const char *directory = NULL;
+    sqlite3 *db = NULL;
+    long long start;
+    long long commit;
+    double seconds;
+    ULONG generation;
+    ULONG published = 0;
+    ULONG failures;
+    ULONG m;
+    int option;
+
+    Bench.Matchers = 4;
+    Bench.Rules = 1000;
+    Bench.Generations = 200;
+
+    while ((option = getopt( argc, argv, "t:n:g:ws:o:" )) != -1) {
+
+        switch (option) {
+
+            case 't':
+                Bench.Matchers = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'n':
+                Bench.Rules = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'g':
+                Bench.Generations = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'w':
+                Bench.NoWake = TRUE;
+                break;
+
+            case 's':
+                UshimSqlDirectory = optarg;
+                break;
+
+            case 'o':
+                directory = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc ||
+        Bench.Matchers == 0 || Bench.Matchers > BENCH_MAX_MATCHERS ||
+        Bench.Rules == 0 || Bench.Generations == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    if (directory == NULL) {
+
+        strcpy( Bench.Directory, "/tmp/mspyReloadTest.XXXXXX" );
+
+        if (mkdtemp( Bench.Directory ) == NULL) {
+
+            perror( "mkdtemp" );
+            return 1;
+        }
+
+        directory = Bench.Directory;
+    }
+
+    snprintf( Bench.Database, sizeof( Bench.Database ), "%s/log.db", directory );
+    unlink( Bench.Database );
+    DatabaseSetLocation( Bench.Database, Bench.Database );
+
+    Bench.FirstRuleId = calloc( Bench.Generations + 2, sizeof( LONGLONG ) );
+    Bench.PublishTime = calloc( Bench.Generations + 2, sizeof( long long ) );
+    Bench.Latency = calloc( Bench.Generations + 1, sizeof( long long ) );
+
+    if (Bench.FirstRuleId == NULL || Bench.PublishTime == NULL || Bench.Latency == NULL) {
+
+        fprintf( stderr, "Out of memory\n" );
+        return 1;
+    }
+
+    //
+    //  As the client starts it, before the writer.
+    //
+
+    if (!ReloadStart( BenchNotify, NULL )) {
+
+        fprintf( stderr, "ReloadStart failed for %s\n", DATABASE_FILE_LOCATION );
+        return 1;
+    }
+
+    if (sqlite3_open( DATABASE_FILE_LOCATION, &db ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not open %s\n", DATABASE_FILE_LOCATION );
+        return 1;
+    }
+
+    sqlite3_busy_timeout( db, 5000 );
+
+    for (m = 0; m < Bench.Matchers; m++) {
+
+        Bench.Matcher[m].Random = 0x9E3779B97F4A7C15ULL * (m + 1);
+
+        if (pthread_create( &Bench.Matcher[m].Thread, NULL, BenchMatch, &Bench.Matcher[m] ) != 0) {
+
+            fprintf( stderr, "Could not start matcher %u\n", m );
+            return 1;
+        }
+    }
+
+    start = BenchNow();
+
+    for (generation = 1; generation <= Bench.Generations; generation++) {
+
+        if (!BenchWrite( db, generation )) {
+
+            break;
+        }
+
+        commit = BenchNow();
+
+        if (!Bench.NoWake) {
+
+            SetEvent( ReloadState.Wake );
+        }
+
+        while ((ULONG)Bench.Published < generation) {
+
+            if (BenchNow() - commit > 10 * 1000000000LL) {
+
+                fprintf( stderr, "Generation %u was not published within 10 s\n", generation );
+                goto Done;
+            }
+
+            Sleep( Bench.NoWake ? 10 : 0 );
+        }
+
+        Bench.Latency[published++] = Bench.PublishTime[generation] - commit;
+
+        AcquireSRWLockShared( &ReloadState.Lock );
+
+        Bench.CompileSum += ReloadState.CompileMicroseconds;
+        Bench.PublishSum += ReloadState.PublishMicroseconds;
+        Bench.CompileMax = ReloadState.CompileMaxMicroseconds;
+        Bench.PublishMax = ReloadState.PublishMaxMicroseconds;
+
+        ReleaseSRWLockShared( &ReloadState.Lock );
+    }
+
+Done:
+
+    seconds = (BenchNow() - start) / 1e9;
+    Bench.Stop = 1;
+
+    for (m = 0; m < Bench.Matchers; m++) {
+
+        pthread_join( Bench.Matcher[m].Thread, NULL );
+
+        matches += Bench.Matcher[m].Matches;
+        empty += Bench.Matcher[m].Empty;
+        wrong += Bench.Matcher[m].Wrong;
+        torn += Bench.Matcher[m].Torn;
+    }
+
+    failures = (ULONG)ReloadState.Failures;
+
+    printf( "Matchers:         %u threads, %u rules a generation, the reload thread %s\n",
+            Bench.Matchers,
+            Bench.Rules,
+            Bench.NoWake ? "polling" : "woken on commit" );
+    printf( "Reloads:          %u of %u generations published in %.2f s, %u failed\n",
+            published,
+            Bench.Generations,
+            seconds,
+            failures );
+
+    if (published > 0) {
+
+        qsort( Bench.Latency, published, sizeof( long long ), BenchCompareLatency );
+
+        printf( "Compile (us):     mean %.0f  max %u\n", (double)Bench.CompileSum / published, Bench.CompileMax );
+        printf( "Publish (us):     mean %.0f  max %u\n", (double)Bench.PublishSum / published, Bench.PublishMax );
+        printf( "Commit to use:    p50 %.2f ms  p99 %.2f ms  max %.2f ms\n",
+                Bench.Latency[published / 2] / 1e6,
+                Bench.Latency[(published * 99) / 100] / 1e6,
+                Bench.Latency[published - 1] / 1e6 );
+    }
+
+    printf( "Matches:          %llu, %.0f a second, %.0f ns each across the threads\n",
+            matches,
+            matches / seconds,
+            matches ? seconds * 1e9 / matches : 0.0 );
+    printf( "Acquired no rules %llu times, rules of two generations %llu times\n", empty, torn );
+    printf( "Wrong matches:    %llu\n", wrong );
+    printf( "Readers left:     %d %d\n", ReloadState.Readers[0], ReloadState.Readers[1] );
+
+    failures += (ULONG)(wrong + torn);
+    failures += (ReloadState.Readers[0] != 0 || ReloadState.Readers[1] != 0) ? 1 : 0;
+    failures += (published != Bench.Generations) ? 1 : 0;
+
+    sqlite3_close( db );
+    ReloadStop();
+
+    free( Bench.FirstRuleId );
+    free( Bench.PublishTime );
+    free( Bench.Latency );
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,1497 @@
+/*++
+
+Module Name:
+
+    mspyReplay.c
+
+Abstract:
+
+    Replays the file operations captured in a log database against a
+    directory tree on Linux, to measure storage and caching changes with
+    real access patterns.
+
+    The operations are read from MinifilterLog in the main log database or
+    in any partition file.  Creates, reads, writes, renames, deletes,
+    cleanups and closes are mapped onto open, pread, pwrite, rename,
+    unlink and close under the sandbox directory, each volume in a
+    directory of its own:
+
+        \Device\HarddiskVolume3\Users\a.txt  ->  <sandbox>/harddiskvolume3/users/a.txt
+
+    Names are folded to lower case, as Windows compares them.
+
+    Before the replay the sandbox is populated with the files and
+    directories the trace shows existed before it started, as sparse
+    files as long as the furthest byte read from them, so reads return
+    the same byte counts without the original data.
+
+    Every thread of the trace is replayed in order by one worker, workers
+    run concurrently.  An operation on a handle waits for the earlier
+    operations on that handle, wherever they ran, and creates, renames and
+    deletes wait for the earlier ones on their path.  That cannot deadlock
+    since an operation only ever waits on operations that come before it
+    in the trace.  Operations are started as fast as possible, or at their
+    original times scaled by a speed factor.
+
+    What the trace does not capture is approximated and the difference
+    shows as divergence: the target of a rename is not logged so files
+    are renamed to "<name>~<seq>", the desired access is not logged so
+    files are opened for read and write, and paging I/O, which repeats
+    cached I/O, is left out unless asked for.
+
+    At the end it prints the achieved operation rate, the latency of each
+    kind of operation next to its latency in the trace, how late timed
+    operations started, and how many operations ended differently than in
+    the trace.
+
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -o mspyReplay mspyReplay.c -lsqlite3
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#define REPLAY_MAX_WORKERS      256
+#define REPLAY_DEFAULT_WORKERS  16
+#define REPLAY_BUCKETS          48          // log2 of nanoseconds
+#define REPLAY_PATH_SIZE        4096
+#define REPLAY_THREAD_MASK      65535       // threads in a trace, less one
+
+//
+//  Create.Options as the filter logs it in Arg2: the disposition in the
+//  top byte, the create options below.
+//
+
+#define FILE_SUPERSEDE          0
+#define FILE_OPEN               1
+#define FILE_CREATE             2
+#define FILE_OPEN_IF            3
+#define FILE_OVERWRITE          4
+#define FILE_OVERWRITE_IF       5
+
+#define FILE_DIRECTORY_FILE     0x00000001
+#define FILE_DELETE_ON_CLOSE    0x00001000
+
+//
+//  IoStatus.Information of a successful create.
+//
+
+#define FILE_CREATED            2
+
+//
+//  SET_INFORMATION classes that are replayed.
+//
+
+#define FileRenameInformation           10
+#define FileDispositionInformation      13
+#define FileDispositionInformationEx    64
+#define FileRenameInformationEx         65
+
+typedef enum _REPLAY_KIND {
+
+    ReplayCreate,
+    ReplayRead,
+    ReplayWrite,
+    ReplayRename,
+    ReplayDelete,
+    ReplayCleanup,
+    ReplayClose,
+    ReplayKinds
+
+} REPLAY_KIND;
+
+static const char *ReplayKindNames[ReplayKinds] = {
+    "Create", "Read", "Write", "Rename", "Delete", "Cleanup", "Close"
+};
+
+typedef struct _REPLAY_OP {
+
+    long long Time;                 // PreOpTime, 100ns
+    long long TraceLatency;         // PostOpTime - PreOpTime, 100ns
+    long long Seq;
+
+    long long Offset;
+    long long Length;
+    long long Transferred;          // Information in the trace
+
+    unsigned Options;               // Create.Options of a create
+    unsigned Session;
+    unsigned Prior;                 // Operations of the session to wait for
+    unsigned PathPrior;             // Namespace operations on the path to wait for
+
+    unsigned char Kind;
+    unsigned char TraceFailed;
+    unsigned char PathOp;
+
+} REPLAY_OP, *PREPLAY_OP;
+
+//
+//  One handle, from its create to its close, or from its first operation
+//  when the trace started with it already open.
+//
+
+typedef struct _REPLAY_SESSION {
+
+    struct _REPLAY_PATH *File;
+    char *Path;
+    int Fd;
+    int Implicit;                   // No create in the trace, opened on first use
+    int Directory;
+    int DeletePending;
+    unsigned Completed;
+
+} REPLAY_SESSION, *PREPLAY_SESSION;
+
+//
+//  Everything the trace shows about one path before the replay.
+//
+
+typedef struct _REPLAY_PATH {
+
+    struct _REPLAY_PATH *Next;
+    char *Path;
+    int Seen;
+    int Existed;
+    int Directory;
+    long long Size;
+
+    //
+    //  Creates, renames and deleting cleanups on the path, in the trace
+    //  and replayed so far.
+    //
+
+    unsigned Ops;
+    unsigned Completed;
+
+} REPLAY_PATH, *PREPLAY_PATH;
+
+typedef struct _REPLAY_STATS {
+
+    unsigned long long Ops[ReplayKinds];
+    unsigned long long Latency[ReplayKinds][REPLAY_BUCKETS];
+    unsigned long long Lag[REPLAY_BUCKETS];
+    unsigned long long StatusDiffer[ReplayKinds];
+    unsigned long long BytesDiffer[ReplayKinds];
+    unsigned long long NoHandle[ReplayKinds];
+    unsigned long long Bytes;
+
+} REPLAY_STATS, *PREPLAY_STATS;
+
+typedef struct _REPLAY_WORKER {
+
+    pthread_t Thread;
+    char *Buffer;
+    size_t BufferSize;
+    unsigned *Ops;
+    unsigned Count;
+    unsigned Capacity;
+    REPLAY_STATS Stats;
+
+} REPLAY_WORKER, *PREPLAY_WORKER;
+
+typedef struct _REPLAY_STATE {
+
+    const char *Sandbox;
+    double Speed;                   // 0 as fast as possible
+    int Paging;
+
+    PREPLAY_OP Ops;
+    unsigned OpCount;
+    unsigned OpCapacity;
+
+    PREPLAY_SESSION Sessions;
+    unsigned SessionCount;
+    unsigned SessionCapacity;
+
+    PREPLAY_PATH Paths[65536];
+
+    REPLAY_WORKER Workers[REPLAY_MAX_WORKERS];
+    unsigned WorkerCount;
+
+    unsigned long long TraceLatency[ReplayKinds][REPLAY_BUCKETS];
+
+    long long TraceStart;
+    struct timespec ReplayStart;
+
+    pthread_mutex_t Lock;
+    pthread_cond_t Progress;
+
+} REPLAY_STATE;
+
+static REPLAY_STATE Replay;
+
+static void *
+ReplayAlloc (
+    void *Block,
+    size_t Size
+    )
+{
+    void *block = realloc( Block, Size );
+
+    if (block == NULL) {
+
+        fprintf( stderr, "Out of memory\n" );
+        exit( 1 );
+    }
+
+    return block;
+}
+
+static unsigned
+ReplayHash (
+    const char *String
+    )
+{
+    unsigned hash = 2166136261u;
+
+    while (*String != '\0') {
+
+        hash = (hash ^ (unsigned char)*String++) * 16777619u;
+    }
+
+    return hash;
+}
+
+static int
+ReplayBucket (
+    long long Nanoseconds
+    )
+{
+    int bucket = 0;
+
+    while (Nanoseconds > 1 && bucket < REPLAY_BUCKETS - 1) {
+
+        Nanoseconds >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static long long
+ReplayNow (
+    void
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static PREPLAY_PATH
+ReplayLookupPath (
+    const char *Path
+    )
+/*++
+
+Routine Description:
+
+    Finds or adds a path.  The returned Path string is shared by every
+    session on it.
+
+--*/
+{
+    unsigned bucket = ReplayHash( Path ) & (sizeof( Replay.Paths ) / sizeof( Replay.Paths[0] ) - 1);
+    PREPLAY_PATH path;
+
+    for (path = Replay.Paths[bucket]; path != NULL; path = path->Next) {
+
+        if (strcmp( path->Path, Path ) == 0) {
+
+            return path;
+        }
+    }
+
+    path = ReplayAlloc( NULL, sizeof( REPLAY_PATH ) );
+    memset( path, 0, sizeof( REPLAY_PATH ) );
+    path->Path = strdup( Path );
+    path->Next = Replay.Paths[bucket];
+    Replay.Paths[bucket] = path;
+
+    return path;
+}
+
+static int
+ReplayMapPath (
+    const char *Name,
+    char *Path,
+    size_t Size
+    )
+/*++
+
+Routine Description:
+
+    Maps a name as the filter logged it under the sandbox.
+
+Return Value:
+
+    0 if the name maps to a file, -1 if it is empty or too long.
+
+--*/
+{
+    size_t length;
+    size_t i;
+
+    if (strncmp( Name, "\\Device\\", 8 ) == 0) {
+
+        Name += 8;
+
+    } else if (Name[0] == '\\') {
+
+        Name++;
+    }
+
+    length = strlen( Replay.Sandbox );
+
+    if (Name[0] == '\0' || length + 1 + strlen( Name ) + 1 > Size) {
+
+        return -1;
+    }
+
+    memcpy( Path, Replay.Sandbox, length );
+    Path[length++] = '/';
+
+    for (i = 0; Name[i] != '\0'; i++) {
+
+        char c = Name[i];
+
+        Path[length++] = (c == '\\') ? '/' :
+                         (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+    }
+
+    //
+    //  The volume root itself, "\Device\HarddiskVolume3\".
+    //
+
+    while (length > 1 && Path[length - 1] == '/') {
+
+        length--;
+    }
+
+    Path[length] = '\0';
+    return 0;
+}
+
+static int
+ReplayKindOf (
+    const char *MajorOp,
+    long long InfoClass,
+    REPLAY_KIND *Kind
+    )
+{
+    if (strcmp( MajorOp, "IRP_MJ_CREATE" ) == 0) {
+
+        *Kind = ReplayCreate;
+
+    } else if (strcmp( MajorOp, "IRP_MJ_READ" ) == 0) {
+
+        *Kind = ReplayRead;
+
+    } else if (strcmp( MajorOp, "IRP_MJ_WRITE" ) == 0) {
+
+        *Kind = ReplayWrite;
+
+    } else if (strcmp( MajorOp, "IRP_MJ_CLEANUP" ) == 0) {
+
+        *Kind = ReplayCleanup;
+
+    } else if (strcmp( MajorOp, "IRP_MJ_CLOSE" ) == 0) {
+
+        *Kind = ReplayClose;
+
+    } else if (strcmp( MajorOp, "IRP_MJ_SET_INFORMATION" ) == 0 &&
+               (InfoClass == FileRenameInformation || InfoClass == FileRenameInformationEx)) {
+
+        *Kind = ReplayRename;
+
+    } else if (strcmp( MajorOp, "IRP_MJ_SET_INFORMATION" ) == 0 &&
+               (InfoClass == FileDispositionInformation || InfoClass == FileDispositionInformationEx)) {
+
+        *Kind = ReplayDelete;
+
+    } else {
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static unsigned
+ReplayNewSession (
+    PREPLAY_PATH Path,
+    int Implicit
+    )
+{
+    PREPLAY_SESSION session;
+
+    if (Replay.SessionCount == Replay.SessionCapacity) {
+
+        Replay.SessionCapacity = Replay.SessionCapacity ? Replay.SessionCapacity * 2 : 1024;
+        Replay.Sessions = ReplayAlloc( Replay.Sessions, Replay.SessionCapacity * sizeof( REPLAY_SESSION ) );
+    }
+
+    session = &Replay.Sessions[Replay.SessionCount];
+    memset( session, 0, sizeof( REPLAY_SESSION ) );
+    session->File = Path;
+    session->Path = Path->Path;
+    session->Fd = -1;
+    session->Implicit = Implicit;
+
+    return Replay.SessionCount++;
+}
+
+//
+//  Open handles while loading, FileObj to session.  File objects are
+//  reused once closed, so an entry only lasts until the close.
+//
+
+typedef struct _REPLAY_HANDLE {
+
+    struct _REPLAY_HANDLE *Next;
+    char *FileObject;
+    unsigned Session;
+    unsigned Ops;
+    int Deleting;
+
+} REPLAY_HANDLE, *PREPLAY_HANDLE;
+
+static PREPLAY_HANDLE ReplayHandles[65536];
+
+static PREPLAY_HANDLE *
+ReplayFindHandle (
+    const char *FileObject
+    )
+{
+    PREPLAY_HANDLE *link = &ReplayHandles[ReplayHash( FileObject ) & 65535];
+
+    while (*link != NULL && strcmp( (*link)->FileObject, FileObject ) != 0) {
+
+        link = &(*link)->Next;
+    }
+
+    return link;
+}
+
+static int
+ReplayLoad (
+    const char *Database,
+    long long From,
+    long long To,
+    long long ProcessId
+    )
+/*++
+
+Routine Description:
+
+    Reads the operations to replay, in trace order, ties the operations
+    of a handle together and notes which paths existed before the trace.
+
+--*/
+{
+    static const char *columns =
+        "SELECT SeqNum, PreOpTime, PostOpTime, ThreadId, MajorOp, IrpFlags, FileObj, %s,"
+        " Information, StatusCode, Arg2, %s"
+        " FROM MinifilterLog"
+        " WHERE OprType IN ('IRP', 'FIO')"
+        "   AND MajorOp IN ('IRP_MJ_CREATE', 'IRP_MJ_READ', 'IRP_MJ_WRITE', 'IRP_MJ_SET_INFORMATION',"
+        "                   'IRP_MJ_CLEANUP', 'IRP_MJ_CLOSE')"
+        "   AND PreOpTime >= ?1 AND PreOpTime < ?2 AND (?3 < 0 OR ProcessId = ?3)"
+        " ORDER BY PreOpTime, SeqNum;";
+    static const char *variants[][2] = {
+        { "COALESCE((SELECT Path FROM Files WHERE Files.FileID = MinifilterLog.FileID), OpFileName)",
+          "ByteOffset, ByteLength, InfoClass" },
+        { "OpFileName", "ByteOffset, ByteLength, InfoClass" },
+        { "OpFileName", "Arg3, Arg1 & 0xFFFFFFFF, Arg2 & 0xFFFFFFFF" }
+    };
+    unsigned variant;
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    char sql[1024];
+    char path[REPLAY_PATH_SIZE];
+    struct { unsigned long long ThreadId; unsigned Worker; } *threads;
+    unsigned threadCount = 0;
+    unsigned long long skipped = 0;
+    int rc;
+
+    threads = ReplayAlloc( NULL, (REPLAY_THREAD_MASK + 1) * sizeof( threads[0] ) );
+    memset( threads, 0, (REPLAY_THREAD_MASK + 1) * sizeof( threads[0] ) );
+
+    if (sqlite3_open_v2( Database, &db, SQLITE_OPEN_READONLY, NULL ) != SQLITE_OK) {
+
+        fprintf( stderr, "Could not open %s: %s\n", Database, sqlite3_errmsg( db ) );
+        sqlite3_close( db );
+        free( threads );
+        return -1;
+    }
+
+    //
+    //  Logs written before the Files table keep the name in every row.
+    //  Logs written before the arguments were decoded only have the raw
+    //  arguments, where reads and writes on x64 keep the length in Arg1
+    //  and the offset in Arg3.
+    //
+
+    for (variant = 0; variant < sizeof( variants ) / sizeof( variants[0] ) && stmt == NULL; variant++) {
+
+        snprintf( sql, sizeof( sql ), columns, variants[variant][0], variants[variant][1] );
+        sqlite3_prepare_v2( db, sql, -1, &stmt, NULL );
+    }
+
+    if (stmt == NULL) {
+
+        fprintf( stderr, "Could not read MinifilterLog: %s\n", sqlite3_errmsg( db ) );
+        sqlite3_close( db );
+        free( threads );
+        return -1;
+    }
+
+    sqlite3_bind_int64( stmt, 1, From );
+    sqlite3_bind_int64( stmt, 2, To );
+    sqlite3_bind_int64( stmt, 3, ProcessId );
+
+    while ((rc = sqlite3_step( stmt )) == SQLITE_ROW) {
+
+        const char *majorOp = (const char *)sqlite3_column_text( stmt, 4 );
+        const char *irpFlags = (const char *)sqlite3_column_text( stmt, 5 );
+        const char *fileObject = (const char *)sqlite3_column_text( stmt, 6 );
+        const char *name = (const char *)sqlite3_column_text( stmt, 7 );
+        const char *information = (const char *)sqlite3_column_text( stmt, 8 );
+        unsigned long long threadId = (unsigned long long)sqlite3_column_int64( stmt, 3 );
+        PREPLAY_HANDLE *link;
+        PREPLAY_HANDLE handle;
+        PREPLAY_PATH replayPath;
+        PREPLAY_OP op;
+        REPLAY_KIND kind;
+        unsigned thread;
+
+        if (majorOp == NULL || fileObject == NULL || name == NULL ||
+            ReplayKindOf( majorOp, sqlite3_column_int64( stmt, 13 ), &kind ) != 0) {
+
+            continue;
+        }
+
+        if (!Replay.Paging && irpFlags != NULL && strlen( irpFlags ) > 1 && irpFlags[1] == 'P') {
+
+            skipped++;
+            continue;
+        }
+
+        if (ReplayMapPath( name, path, sizeof( path ) ) != 0) {
+
+            skipped++;
+            continue;
+        }
+
+        if (Replay.OpCount == Replay.OpCapacity) {
+
+            Replay.OpCapacity = Replay.OpCapacity ? Replay.OpCapacity * 2 : 65536;
+            Replay.Ops = ReplayAlloc( Replay.Ops, Replay.OpCapacity * sizeof( REPLAY_OP ) );
+        }
+
+        op = &Replay.Ops[Replay.OpCount];
+        memset( op, 0, sizeof( REPLAY_OP ) );
+        op->Kind = (unsigned char)kind;
+        op->Seq = sqlite3_column_int64( stmt, 0 );
+        op->Time = sqlite3_column_int64( stmt, 1 );
+        op->TraceLatency = sqlite3_column_int64( stmt, 2 ) - op->Time;
+        op->Transferred = (information != NULL) ? (long long)strtoull( information, NULL, 16 ) : 0;
+        op->TraceFailed = sqlite3_column_type( stmt, 9 ) != SQLITE_NULL && sqlite3_column_int64( stmt, 9 ) < 0;
+        op->Options = (unsigned)sqlite3_column_int64( stmt, 10 );
+        op->Offset = sqlite3_column_int64( stmt, 11 );
+        op->Length = sqlite3_column_int64( stmt, 12 );
+
+        if (op->TraceLatency > 0) {
+
+            Replay.TraceLatency[kind][ReplayBucket( op->TraceLatency * 100 )]++;
+        }
+
+        replayPath = ReplayLookupPath( path );
+        link = ReplayFindHandle( fileObject );
+        handle = *link;
+
+        //
+        //  A create starts a new handle even if the file object's close
+        //  was not seen.  A failed create never had one.
+        //
+
+        if (kind == ReplayCreate) {
+
+            if (!replayPath->Seen) {
+
+                replayPath->Seen = 1;
+                replayPath->Existed = !op->TraceFailed && op->Transferred != FILE_CREATED;
+                replayPath->Directory = (op->Options & FILE_DIRECTORY_FILE) != 0;
+            }
+
+            //
+            //  A failed create never had a handle, it is replayed on its
+            //  own to see whether it fails here too.
+            //
+
+            if (op->TraceFailed) {
+
+                op->Session = ReplayNewSession( replayPath, 0 );
+                Replay.Sessions[op->Session].Directory = (op->Options & FILE_DIRECTORY_FILE) != 0;
+                op->PathOp = 1;
+                op->PathPrior = replayPath->Ops++;
+                goto Assign;
+            }
+
+            if (handle == NULL) {
+
+                handle = ReplayAlloc( NULL, sizeof( REPLAY_HANDLE ) );
+                handle->FileObject = strdup( fileObject );
+                handle->Next = NULL;
+                *link = handle;
+            }
+
+            handle->Session = ReplayNewSession( replayPath, 0 );
+            handle->Ops = 0;
+            handle->Deleting = (op->Options & FILE_DELETE_ON_CLOSE) != 0;
+            Replay.Sessions[handle->Session].Directory = (op->Options & FILE_DIRECTORY_FILE) != 0;
+
+        } else if (handle == NULL) {
+
+            //
+            //  Opened before the trace.  Cleanups and closes of those are
+            //  nothing to replay, mostly stream file objects of the cache.
+            //
+
+            if (kind == ReplayCleanup || kind == ReplayClose) {
+
+                skipped++;
+                continue;
+            }
+
+            if (!replayPath->Seen) {
+
+                replayPath->Seen = 1;
+                replayPath->Existed = 1;
+            }
+
+            handle = ReplayAlloc( NULL, sizeof( REPLAY_HANDLE ) );
+            handle->FileObject = strdup( fileObject );
+            handle->Next = NULL;
+            handle->Session = ReplayNewSession( replayPath, 1 );
+            handle->Ops = 0;
+            handle->Deleting = 0;
+            *link = handle;
+        }
+
+        //
+        //  Reads show how long a file that existed must be.
+        //
+
+        if (kind == ReplayRead && !op->TraceFailed && replayPath->Existed &&
+            op->Offset >= 0 && op->Offset + op->Transferred > replayPath->Size) {
+
+            replayPath->Size = op->Offset + op->Transferred;
+        }
+
+        //
+        //  The create, or the first operation of a handle opened before
+        //  the trace, opens it and everything else waits for it.  Cleanups and closes wait for everything
+        //  before them so the descriptor outlives its last use.
+        //
+
+        op->Session = handle->Session;
+        op->Prior = (handle->Ops == 0) ? 0 :
+                    (kind == ReplayCleanup || kind == ReplayClose) ? handle->Ops : 1;
+        handle->Ops++;
+
+        //
+        //  Handles on the same path are replayed by different workers, so
+        //  whatever changes what the path names is kept in trace order:
+        //  creates, renames, and cleanups that delete.
+        //
+
+        if (kind == ReplayDelete) {
+
+            handle->Deleting = 1;
+        }
+
+        if (kind == ReplayCreate || kind == ReplayRename || (kind == ReplayCleanup && handle->Deleting)) {
+
+            op->PathOp = 1;
+            op->PathPrior = replayPath->Ops++;
+        }
+
+        if (kind == ReplayClose) {
+
+            *link = handle->Next;
+            free( handle->FileObject );
+            free( handle );
+        }
+
+Assign:
+
+        //
+        //  Threads are dealt out to the workers as they first appear.
+        //
+
+        for (thread = (unsigned)(threadId >> 2) & REPLAY_THREAD_MASK;
+             threads[thread].Worker != 0 && threads[thread].ThreadId != threadId;
+             thread = (thread + 1) & REPLAY_THREAD_MASK) {
+        }
+
+        if (threads[thread].Worker == 0) {
+
+            if (threadCount == REPLAY_THREAD_MASK) {
+
+                fprintf( stderr, "More than %d threads in the trace\n", REPLAY_THREAD_MASK );
+                break;
+            }
+
+            threads[thread].ThreadId = threadId;
+            threads[thread].Worker = threadCount % Replay.WorkerCount + 1;
+            threadCount++;
+        }
+
+        {
+            PREPLAY_WORKER worker = &Replay.Workers[threads[thread].Worker - 1];
+
+            if (worker->Count == worker->Capacity) {
+
+                worker->Capacity = worker->Capacity ? worker->Capacity * 2 : 4096;
+                worker->Ops = ReplayAlloc( worker->Ops, worker->Capacity * sizeof( unsigned ) );
+            }
+
+            worker->Ops[worker->Count++] = Replay.OpCount;
+        }
+
+        Replay.OpCount++;
+    }
+
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+
+        fprintf( stderr, "Reading MinifilterLog failed: %s\n", sqlite3_errmsg( db ) );
+    }
+
+    sqlite3_finalize( stmt );
+    sqlite3_close( db );
+
+    if (Replay.OpCount != 0) {
+
+        Replay.TraceStart = Replay.Ops[0].Time;
+    }
+
+    if (threadCount < Replay.WorkerCount) {
+
+        Replay.WorkerCount = (threadCount != 0) ? threadCount : 1;
+    }
+
+    printf( "Loaded %u operations on %u handles from %u threads, %llu left out\n",
+            Replay.OpCount,
+            Replay.SessionCount,
+            threadCount,
+            skipped );
+
+    free( threads );
+
+    return (rc == SQLITE_DONE || rc == SQLITE_ROW) ? 0 : -1;
+}
+
+static int
+ReplayMakeParents (
+    char *Path
+    )
+{
+    char *slash;
+
+    for (slash = strchr( Path + strlen( Replay.Sandbox ) + 1, '/'); slash != NULL; slash = strchr( slash + 1, '/' )) {
+
+        *slash = '\0';
+
+        if (mkdir( Path, 0755 ) != 0 && errno != EEXIST) {
+
+            *slash = '/';
+            return -1;
+        }
+
+        *slash = '/';
+    }
+
+    return 0;
+}
+
+static void
+ReplayPopulate (
+    void
+    )
+/*++
+
+Routine Description:
+
+    Creates every directory the trace names, and every file that existed
+    before the trace as a sparse file of the length its reads need.
+
+--*/
+{
+    unsigned long long files = 0;
+    unsigned long long directories = 0;
+    unsigned long long failed = 0;
+    unsigned bucket;
+    PREPLAY_PATH path;
+    int fd;
+
+    //
+    //  Parents first, a path some other path is under is a directory
+    //  even if it was never opened as one.
+    //
+
+    for (bucket = 0; bucket < sizeof( Replay.Paths ) / sizeof( Replay.Paths[0] ); bucket++) {
+
+        for (path = Replay.Paths[bucket]; path != NULL; path = path->Next) {
+
+            if (ReplayMakeParents( path->Path ) != 0) {
+
+                failed++;
+            }
+        }
+    }
+
+    for (bucket = 0; bucket < sizeof( Replay.Paths ) / sizeof( Replay.Paths[0] ); bucket++) {
+
+        for (path = Replay.Paths[bucket]; path != NULL; path = path->Next) {
+
+            if (!path->Existed) {
+
+                continue;
+            }
+
+            if (path->Directory) {
+
+                if (mkdir( path->Path, 0755 ) != 0 && errno != EEXIST) {
+
+                    failed++;
+
+                } else {
+
+                    directories++;
+                }
+
+                continue;
+            }
+
+            fd = open( path->Path, O_WRONLY | O_CREAT, 0644 );
+
+            if (fd < 0 && errno == EISDIR) {
+
+                directories++;
+                continue;
+            }
+
+            if (fd < 0 || ftruncate( fd, path->Size ) != 0) {
+
+                failed++;
+
+            } else {
+
+                files++;
+            }
+
+            if (fd >= 0) {
+
+                close( fd );
+            }
+        }
+    }
+
+    printf( "Populated %llu files and %llu directories", files, directories );
+
+    if (failed != 0) {
+
+        printf( ", %llu failed", failed );
+    }
+
+    printf( "\n" );
+}
+
+static int
+ReplayOpen (
+    PREPLAY_SESSION Session,
+    unsigned Options
+    )
+{
+    unsigned disposition = Options >> 24;
+    int flags = O_RDWR | O_CLOEXEC;
+    int fd;
+
+    if (Session->Directory) {
+
+        if (disposition == FILE_CREATE || disposition == FILE_OPEN_IF) {
+
+            if (mkdir( Session->Path, 0755 ) != 0 && (errno != EEXIST || disposition == FILE_CREATE)) {
+
+                return -1;
+            }
+        }
+
+        return open( Session->Path, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    }
+
+    switch (disposition) {
+
+        case FILE_SUPERSEDE:
+        case FILE_OVERWRITE_IF:
+            flags |= O_CREAT | O_TRUNC;
+            break;
+
+        case FILE_CREATE:
+            flags |= O_CREAT | O_EXCL;
+            break;
+
+        case FILE_OPEN_IF:
+            flags |= O_CREAT;
+            break;
+
+        case FILE_OVERWRITE:
+            flags |= O_TRUNC;
+            break;
+
+        default:
+            break;
+    }
+
+    fd = open( Session->Path, flags, 0644 );
+
+    //
+    //  The desired access is not logged, directories opened without
+    //  FILE_DIRECTORY_FILE and read only files open for reading.
+    //
+
+    if (fd < 0 && (errno == EISDIR || errno == EACCES)) {
+
+        fd = open( Session->Path, (flags & ~(O_RDWR | O_TRUNC)) | O_RDONLY, 0644 );
+    }
+
+    return fd;
+}
+
+static int
+ReplayExecute (
+    PREPLAY_OP Op,
+    PREPLAY_SESSION Session,
+    char *Buffer,
+    long long *Bytes
+    )
+/*++
+
+Routine Description:
+
+    Carries out one operation.
+
+Return Value:
+
+    0 if it succeeded, -1 if it failed, 1 if there was no handle to do it
+    on because its create failed.
+
+--*/
+{
+    char target[REPLAY_PATH_SIZE];
+    ssize_t done;
+    struct stat status;
+    long long offset = Op->Offset;
+
+    *Bytes = 0;
+
+    if (Op->Kind != ReplayCreate && Session->Fd < 0 && Session->Implicit) {
+
+        Session->Fd = ReplayOpen( Session, FILE_OPEN_IF << 24 );
+    }
+
+    if (Op->Kind != ReplayCreate && Session->Fd < 0) {
+
+        return 1;
+    }
+
+    switch (Op->Kind) {
+
+        case ReplayCreate:
+
+            Session->Fd = ReplayOpen( Session, Op->Options );
+
+            if (Session->Fd >= 0 && Op->TraceFailed) {
+
+                close( Session->Fd );
+                Session->Fd = -1;
+                return 0;
+            }
+
+            if (Session->Fd >= 0 && (Op->Options & FILE_DELETE_ON_CLOSE) != 0) {
+
+                Session->DeletePending = 1;
+            }
+
+            return (Session->Fd >= 0) ? 0 : -1;
+
+        case ReplayRead:
+        case ReplayWrite:
+
+            if (Op->Length <= 0) {
+
+                return 0;
+            }
+
+            //
+            //  FILE_WRITE_TO_END_OF_FILE and friends, negative offsets,
+            //  append.
+            //
+
+            if (offset < 0) {
+
+                offset = (Op->Kind == ReplayWrite && fstat( Session->Fd, &status ) == 0) ? status.st_size : 0;
+            }
+
+            if (Op->Kind == ReplayRead) {
+
+                done = pread( Session->Fd, Buffer, (size_t)Op->Length, offset );
+
+            } else {
+
+                done = pwrite( Session->Fd, Buffer, (size_t)Op->Length, offset );
+            }
+
+            if (done < 0) {
+
+                return -1;
+            }
+
+            *Bytes = done;
+            return 0;
+
+        case ReplayRename:
+
+            snprintf( target, sizeof( target ), "%s~%lld", Session->Path, Op->Seq );
+            return rename( Session->Path, target );
+
+        case ReplayDelete:
+
+            Session->DeletePending = 1;
+            return 0;
+
+        case ReplayCleanup:
+
+            //
+            //  Windows deletes a file when the last handle is cleaned up
+            //  with the delete pending.
+            //
+
+            if (Session->DeletePending) {
+
+                Session->DeletePending = 0;
+                return Session->Directory ? rmdir( Session->Path ) : unlink( Session->Path );
+            }
+
+            return 0;
+
+        case ReplayClose:
+
+            close( Session->Fd );
+            Session->Fd = -1;
+            return 0;
+    }
+
+    return 0;
+}
+
+static void *
+ReplayWorker (
+    void *Context
+    )
+{
+    PREPLAY_WORKER worker = Context;
+    long long replayStart = (long long)Replay.ReplayStart.tv_sec * 1000000000 + Replay.ReplayStart.tv_nsec;
+    unsigned i;
+
+    for (i = 0; i < worker->Count; i++) {
+
+        PREPLAY_OP op = &Replay.Ops[worker->Ops[i]];
+        PREPLAY_SESSION session = &Replay.Sessions[op->Session];
+        long long bytes;
+        long long start;
+        long long end;
+        int result;
+
+        //
+        //  Keep to the trace's timing, scaled.
+        //
+
+        if (Replay.Speed > 0) {
+
+            long long due = replayStart + (long long)((double)(op->Time - Replay.TraceStart) * 100 / Replay.Speed);
+            struct timespec wake = { (time_t)(due / 1000000000), (long)(due % 1000000000) };
+
+            while (clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL ) == EINTR) {
+            }
+
+            worker->Stats.Lag[ReplayBucket( ReplayNow() - due )]++;
+        }
+
+        //
+        //  Wait for the earlier operations on the handle.
+        //
+
+        if (op->Prior != 0) {
+
+            pthread_mutex_lock( &Replay.Lock );
+
+            while (session->Completed < op->Prior) {
+
+                pthread_cond_wait( &Replay.Progress, &Replay.Lock );
+            }
+
+            pthread_mutex_unlock( &Replay.Lock );
+        }
+
+        if (op->PathOp && op->PathPrior != 0) {
+
+            pthread_mutex_lock( &Replay.Lock );
+
+            while (session->File->Completed < op->PathPrior) {
+
+                pthread_cond_wait( &Replay.Progress, &Replay.Lock );
+            }
+
+            pthread_mutex_unlock( &Replay.Lock );
+        }
+
+        //
+        //  Written data is a fixed pattern, the trace does not have it.
+        //
+
+        if (op->Length > 0 && (size_t)op->Length > worker->BufferSize) {
+
+            worker->BufferSize = (size_t)op->Length;
+            worker->Buffer = ReplayAlloc( worker->Buffer, worker->BufferSize );
+            memset( worker->Buffer, 0x5A, worker->BufferSize );
+        }
+
+        start = ReplayNow();
+        result = ReplayExecute( op, session, worker->Buffer, &bytes );
+        end = ReplayNow();
+
+        worker->Stats.Ops[op->Kind]++;
+        worker->Stats.Latency[op->Kind][ReplayBucket( end - start )]++;
+        worker->Stats.Bytes += bytes;
+
+        if (result > 0) {
+
+            worker->Stats.NoHandle[op->Kind]++;
+
+        } else if ((result != 0) != op->TraceFailed) {
+
+            worker->Stats.StatusDiffer[op->Kind]++;
+
+        } else if (result == 0 && (op->Kind == ReplayRead || op->Kind == ReplayWrite) && bytes != op->Transferred) {
+
+            worker->Stats.BytesDiffer[op->Kind]++;
+        }
+
+        pthread_mutex_lock( &Replay.Lock );
+        session->Completed++;
+
+        if (op->PathOp) {
+
+            session->File->Completed++;
+        }
+
+        pthread_cond_broadcast( &Replay.Progress );
+        pthread_mutex_unlock( &Replay.Lock );
+    }
+
+    return NULL;
+}
+
+static long long
+ReplayPercentile (
+    const unsigned long long *Buckets,
+    unsigned long long Total,
+    double Fraction
+    )
+{
+    unsigned long long seen = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < REPLAY_BUCKETS; bucket++) {
+
+        seen += Buckets[bucket];
+
+        if (Total != 0 && (double)seen >= Fraction * (double)Total) {
+
+            return 1LL << bucket;
+        }
+    }
+
+    return 0;
+}
+
+static void
+ReplayPrintLatency (
+    const char *Label,
+    const unsigned long long *Buckets
+    )
+{
+    unsigned long long total = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < REPLAY_BUCKETS; bucket++) {
+
+        total += Buckets[bucket];
+    }
+
+    if (total == 0) {
+
+        printf( "    %-16s           -\n", Label );
+        return;
+    }
+
+    //
+    //  Buckets are powers of two, each percentile is the bucket's top.
+    //
+
+    printf( "    %-16s %10llu   p50 <%9.1f us   p90 <%9.1f us   p99 <%9.1f us   max <%9.1f us\n",
+            Label,
+            total,
+            ReplayPercentile( Buckets, total, 0.50 ) * 2 / 1000.0,
+            ReplayPercentile( Buckets, total, 0.90 ) * 2 / 1000.0,
+            ReplayPercentile( Buckets, total, 0.99 ) * 2 / 1000.0,
+            ReplayPercentile( Buckets, total, 1.00 ) * 2 / 1000.0 );
+}
+
+static void
+ReplayReport (
+    double Seconds
+    )
+{
+    REPLAY_STATS total;
+    unsigned long long ops = 0;
+    unsigned long long differ = 0;
+    char label[32];
+    unsigned w;
+    int kind;
+    int bucket;
+
+    memset( &total, 0, sizeof( total ) );
+
+    for (w = 0; w < Replay.WorkerCount; w++) {
+
+        PREPLAY_STATS stats = &Replay.Workers[w].Stats;
+
+        for (kind = 0; kind < ReplayKinds; kind++) {
+
+            total.Ops[kind] += stats->Ops[kind];
+            total.StatusDiffer[kind] += stats->StatusDiffer[kind];
+            total.BytesDiffer[kind] += stats->BytesDiffer[kind];
+            total.NoHandle[kind] += stats->NoHandle[kind];
+
+            for (bucket = 0; bucket < REPLAY_BUCKETS; bucket++) {
+
+                total.Latency[kind][bucket] += stats->Latency[kind][bucket];
+            }
+        }
+
+        for (bucket = 0; bucket < REPLAY_BUCKETS; bucket++) {
+
+            total.Lag[bucket] += stats->Lag[bucket];
+        }
+
+        total.Bytes += stats->Bytes;
+    }
+
+    for (kind = 0; kind < ReplayKinds; kind++) {
+
+        ops += total.Ops[kind];
+        differ += total.StatusDiffer[kind] + total.BytesDiffer[kind] + total.NoHandle[kind];
+    }
+
+    printf( "\nReplayed %llu operations in %.3f s with %u workers: %.0f IOPS, %.1f MB/s\n",
+            ops,
+            Seconds,
+            Replay.WorkerCount,
+            (Seconds > 0) ? ops / Seconds : 0,
+            (Seconds > 0) ? total.Bytes / Seconds / 1e6 : 0 );
+
+    if (Replay.OpCount != 0) {
+
+        printf( "Trace spanned %.3f s\n",
+                (Replay.Ops[Replay.OpCount - 1].Time - Replay.TraceStart) / 1e7 );
+    }
+
+    printf( "\nLatency             ops\n" );
+
+    for (kind = 0; kind < ReplayKinds; kind++) {
+
+        snprintf( label, sizeof( label ), "%s", ReplayKindNames[kind] );
+        ReplayPrintLatency( label, total.Latency[kind] );
+        snprintf( label, sizeof( label ), "  in the trace" );
+        ReplayPrintLatency( label, Replay.TraceLatency[kind] );
+    }
+
+    if (Replay.Speed > 0) {
+
+        printf( "\nStarted late\n" );
+        ReplayPrintLatency( "Any", total.Lag );
+    }
+
+    printf( "\nDiverged from the trace: %llu of %llu (%.2f%%)\n",
+            differ,
+            ops,
+            ops ? 100.0 * differ / ops : 0 );
+    printf( "    %-10s %14s %14s %14s\n", "", "Status", "Bytes", "No handle" );
+
+    for (kind = 0; kind < ReplayKinds; kind++) {
+
+        printf( "    %-10s %14llu %14llu %14llu\n",
+                ReplayKindNames[kind],
+                total.StatusDiffer[kind],
+                total.BytesDiffer[kind],
+                total.NoHandle[kind] );
+    }
+}
+
+static void
+ReplayUsage (
+    void
+    )
+{
+    printf( "Usage: mspyReplay [-s <speed>] [-j <workers>] [-f <from>] [-t <to>] [-p <pid>] [-P] <log.db> <sandbox>\n"
+            "\n"
+            "    <log.db> is the log database or a partition file\n"
+            "    <sandbox> is the directory the files are created in, populated before the replay\n"
+            "    [-s <speed>] 0 replays as fast as possible (default), 1 at the original pace, 10 ten times faster\n"
+            "    [-j <workers>] replays with at most <workers> threads, %d by default\n"
+            "    [-f <from>] [-t <to>] only replays operations with PreOpTime in [<from>, <to>), 100ns ticks\n"
+            "    [-p <pid>] only replays operations of process <pid>\n"
+            "    [-P] also replays paging I/O\n",
+            REPLAY_DEFAULT_WORKERS );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    long long from = 0;
+    long long to = 0x7FFFFFFFFFFFFFFFLL;
+    long long processId = -1;
+    struct timespec end;
+    struct rlimit files;
+    double seconds;
+    unsigned w;
+    int option;
+
+    Replay.Speed = 0;
+    Replay.WorkerCount = REPLAY_DEFAULT_WORKERS;
+
+    while ((option = getopt( argc, argv, "s:j:f:t:p:P" )) != -1) {
+
+        switch (option) {
+
+            case 's':
+                Replay.Speed = atof( optarg );
+                break;
+
+            case 'j':
+                Replay.WorkerCount = (unsigned)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'f':
+                from = strtoll( optarg, NULL, 0 );
+                break;
+
+            case 't':
+                to = strtoll( optarg, NULL, 0 );
+                break;
+
+            case 'p':
+                processId = strtoll( optarg, NULL, 0 );
+                break;
+
+            case 'P':
+                Replay.Paging = 1;
+                break;
+
+            default:
+                ReplayUsage();
+                return 2;
+        }
+    }
+
+    if (optind + 2 != argc || Replay.Speed < 0 ||
+        Replay.WorkerCount == 0 || Replay.WorkerCount > REPLAY_MAX_WORKERS) {
+
+        ReplayUsage();
+        return 2;
+    }
+
+    Replay.Sandbox = argv[optind + 1];
+
+    if (mkdir( Replay.Sandbox, 0755 ) != 0 && errno != EEXIST) {
+
+        fprintf( stderr, "Could not create %s: %s\n", Replay.Sandbox, strerror( errno ) );
+        return 1;
+    }
+
+    //
+    //  Every handle open at once in the trace is a descriptor here.
+    //
+
+    if (getrlimit( RLIMIT_NOFILE, &files ) == 0) {
+
+        files.rlim_cur = files.rlim_max;
+        setrlimit( RLIMIT_NOFILE, &files );
+    }
+
+    if (ReplayLoad( argv[optind], from, to, processId ) != 0) {
+
+        return 1;
+    }
+
+    ReplayPopulate();
+
+    pthread_mutex_init( &Replay.Lock, NULL );
+    pthread_cond_init( &Replay.Progress, NULL );
+
+    clock_gettime( CLOCK_MONOTONIC, &Replay.ReplayStart );
+
+    for (w = 0; w < Replay.WorkerCount; w++) {
+
+        if (pthread_create( &Replay.Workers[w].Thread, NULL, ReplayWorker, &Replay.Workers[w] ) != 0) {
+
+            fprintf( stderr, "Could not start worker %u\n", w );
+            return 1;
+        }
+    }
+
+    for (w = 0; w < Replay.WorkerCount; w++) {
+
+        pthread_join( Replay.Workers[w].Thread, NULL );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    seconds = (end.tv_sec - Replay.ReplayStart.tv_sec) + (end.tv_nsec - Replay.ReplayStart.tv_nsec) / 1e9;
+
+    ReplayReport( seconds );
+
+    return 0;
+}
@@ -0,0 +1,742 @@
+/*++
+
+Module Name:
+
+    mspyRingTest.c
+
+Abstract:
+
+    Checks and measures the shared record buffer the filter serves its
+    clients from, inc/spyRing.h, in a Linux program against the types in
+    ushim/windows.h.
+
+    The checks push records into a small ring and read them through several
+    cursors at once, at random: bursts of records, reads of a few records
+    by one client, a record put back with SpyRingCursorRewind as SpyGetLog
+    does when it does not fit, a whole read put back as SpyGetLog does when
+    the copy to the caller faults, a new filter, and a client replaced by a
+    new one attached at the head as SpyAttachClient does.  Every record
+    read is compared with what was pushed at its sequence, and every
+    cursor with a plain model of one written here over the records pushed:
+    what it should return next, and its delivered, dropped and filtered
+    counts.  Each client must account for every record pushed while it was
+    attached, whatever the others did.
+
+    The measurements push records of a typical size into a ring of the
+    filter's default size while a number of clients keep up with it, and
+    print ns a record pushed and ns a record read.
+
+    It returns 1 when a check fails.
+
+    Built on its own, for instance:
+
+        gcc -O2 -Wno-unknown-pragmas -Iushim -I../inc -o mspyRingTest mspyRingTest.c
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <windows.h>
+
+#include "minispy.h"
+#include "spyRing.h"
+#include "mspyBench.h"
+
+#define BENCH_MAX_CLIENTS       16
+#define BENCH_CHECK_SLOTS       64
+#define BENCH_PROCESSES         8
+
+//
+//  What the checks remember of every record pushed, indexed by sequence
+//  modulo the slots of the ring checked, since nothing older can be read.
+//
+
+typedef struct _BENCH_PUSHED {
+
+    ULONG Length;
+    ULONG RecordType;
+    FILE_ID ProcessId;
+    UCHAR Major;
+
+} BENCH_PUSHED, *PBENCH_PUSHED;
+
+typedef struct _BENCH_MODEL {
+
+    ULONGLONG Next;
+    ULONGLONG Delivered;
+    ULONGLONG Dropped;
+    ULONGLONG Filtered;
+
+    //
+    //  Sequence the client attached at, the records it must account for
+    //  run from here to the head.
+    //
+
+    ULONGLONG Attached;
+
+} BENCH_MODEL, *PBENCH_MODEL;
+
+typedef struct _BENCH_STATE {
+
+    ULONG Clients;
+    ULONG Steps;
+    ULONG Records;
+    ULONG SlotCount;
+    int ChecksOnly;
+
+    BENCH_PUSHED Pushed[BENCH_CHECK_SLOTS];
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static ULONG
+BenchFill (
+    _Out_ PLOG_RECORD LogRecord,
+    _In_ ULONGLONG Sequence,
+    _In_ ULONG RecordType,
+    _In_ FILE_ID ProcessId,
+    _In_ UCHAR Major,
+    _In_ ULONG NameLength
+    )
+/*++
+
+Routine Description:
+
+    Makes a record whose every name character is derived from Sequence, so
+    a record read back can be told apart from its neighbours and from a
+    record half overwritten.  Lengths are rounded to a PVOID as
+    SpyNewRecord rounds them.
+
+--*/
+{
+    ULONG length;
+    ULONG index;
+
+    length = FIELD_OFFSET( LOG_RECORD, Name ) + (NameLength + 1) * sizeof( WCHAR );
+    length = (length + sizeof( PVOID ) - 1) & ~(ULONG)(sizeof( PVOID ) - 1);
+
+    memset( LogRecord, 0, FIELD_OFFSET( LOG_RECORD, Name ) );
+
+    LogRecord->Length = length;
+    LogRecord->SequenceNumber = (ULONG)Sequence;
+    LogRecord->RecordType = RecordType;
+    LogRecord->Data.ProcessId = ProcessId;
+    LogRecord->Data.CallbackMajorId = Major;
+    LogRecord->Data.OriginatingTime.QuadPart = (LONGLONG)Sequence;
+
+    for (index = 0; index < NameLength; index++) {
+
+        LogRecord->Name[index] = (WCHAR)('A' + (Sequence + index) % 26);
+    }
+
+    LogRecord->Name[NameLength] = UNICODE_NULL;
+
+    return length;
+}
+
+static BOOLEAN
+BenchMatches (
+    _In_ PMINISPY_CLIENT_FILTER Filter,
+    _In_ PBENCH_PUSHED Pushed
+    )
+/*++
+
+Routine Description:
+
+    What a client filter should let through, written from its description
+    in minispy.h rather than from SpyRingFilterMatch.
+
+--*/
+{
+    BOOLEAN anyMajor = FALSE;
+    ULONG index;
+
+    if (Pushed->RecordType & (RECORD_TYPE_FLAG_OUT_OF_MEMORY | RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE | RECORD_TYPE_PROCESS)) {
+
+        return TRUE;
+    }
+
+    if (Filter->ProcessId != 0 && Filter->ProcessId != Pushed->ProcessId) {
+
+        return FALSE;
+    }
+
+    for (index = 0; index < MINISPY_MAJOR_MASK_ULONGS; index++) {
+
+        if (Filter->MajorFunctionMask[index] != 0) {
+
+            anyMajor = TRUE;
+        }
+    }
+
+    return !anyMajor || (Filter->MajorFunctionMask[Pushed->Major >> 5] >> (Pushed->Major & 31)) & 1;
+}
+
+static void
+BenchRandomFilter (
+    _Out_ PMINISPY_CLIENT_FILTER Filter
+    )
+{
+    ULONG count;
+
+    memset( Filter, 0, sizeof( *Filter ) );
+
+    if (BenchRandom32() % 2 == 0) {
+
+        Filter->ProcessId = 1 + BenchRandom32() % BENCH_PROCESSES;
+    }
+
+    if (BenchRandom32() % 2 == 0) {
+
+        for (count = 1 + BenchRandom32() % 3; count > 0; count--) {
+
+            Filter->MajorFunctionMask[0] |= 1UL << (BenchRandom32() % 16);
+        }
+    }
+}
+
+static void
+BenchPush (
+    _Inout_ PSPY_RING Ring,
+    _Out_ PLOG_RECORD LogRecord
+    )
+{
+    PBENCH_PUSHED pushed;
+    ULONGLONG sequence = Ring->Head;
+    ULONG random = BenchRandom32();
+    ULONG maxName;
+
+    pushed = &Bench.Pushed[sequence % BENCH_CHECK_SLOTS];
+    pushed->RecordType = RECORD_TYPE_NORMAL;
+
+    if (random % 100 == 0) {
+
+        pushed->RecordType = RECORD_TYPE_PROCESS;
+
+    } else if (random % 200 == 1) {
+
+        pushed->RecordType = RECORD_TYPE_NORMAL | RECORD_TYPE_FLAG_OUT_OF_MEMORY | RECORD_TYPE_FLAG_STATIC;
+    }
+
+    pushed->ProcessId = 1 + BenchRandom32() % BENCH_PROCESSES;
+    pushed->Major = (UCHAR)(BenchRandom32() % 16);
+
+    //
+    //  Names of every length up to the longest a record holds
+    //
+
+    maxName = (MAX_LOG_RECORD_LENGTH - FIELD_OFFSET( LOG_RECORD, Name )) / sizeof( WCHAR ) - 1;
+    pushed->Length = BenchFill( LogRecord,
+                                sequence,
+                                pushed->RecordType,
+                                pushed->ProcessId,
+                                pushed->Major,
+                                (BenchRandom32() % 4 == 0) ? BenchRandom32() % (maxName + 1) : BenchRandom32() % 64 );
+
+    if (SpyRingPush( Ring, LogRecord ) != sequence) {
+
+        BenchFailFormat( "push", "record pushed at %llu was not given that sequence", (unsigned long long)sequence );
+    }
+}
+
+static void
+BenchModelNext (
+    _In_ PSPY_RING Ring,
+    _Inout_ PBENCH_MODEL Model,
+    _In_ PMINISPY_CLIENT_FILTER Filter,
+    _Out_ PULONGLONG Sequence
+    )
+/*++
+
+Routine Description:
+
+    The sequence the client should be handed next, 0 if none, advancing
+    the model past it.
+
+--*/
+{
+    ULONGLONG oldest = (Ring->Head > Ring->SlotCount) ? Ring->Head - Ring->SlotCount : 1;
+
+    *Sequence = 0;
+
+    if (Model->Next < oldest) {
+
+        Model->Dropped += oldest - Model->Next;
+        Model->Next = oldest;
+    }
+
+    for (; Model->Next < Ring->Head; Model->Next++) {
+
+        if (BenchMatches( Filter, &Bench.Pushed[Model->Next % BENCH_CHECK_SLOTS] )) {
+
+            *Sequence = Model->Next++;
+            Model->Delivered++;
+            return;
+        }
+
+        Model->Filtered++;
+    }
+}
+
+static void
+BenchCheckRead (
+    _In_ ULONG Client,
+    _In_ PLOG_RECORD LogRecord,
+    _In_ ULONGLONG Sequence,
+    _In_ ULONGLONG Expected
+    )
+{
+    PBENCH_PUSHED pushed;
+    ULONG index;
+    ULONG nameLength;
+
+    BenchCommon.Checks++;
+
+    if (Sequence != Expected) {
+
+        BenchFailFormat( "sequence", "client %u was handed sequence %llu, expected %llu", Client, (unsigned long long)Sequence, (unsigned long long)Expected );
+        return;
+    }
+
+    if (LogRecord == NULL) {
+
+        return;
+    }
+
+    pushed = &Bench.Pushed[Sequence % BENCH_CHECK_SLOTS];
+
+    if (LogRecord->Length != pushed->Length ||
+        LogRecord->SequenceNumber != (ULONG)Sequence ||
+        LogRecord->RecordType != pushed->RecordType ||
+        LogRecord->Data.ProcessId != pushed->ProcessId ||
+        LogRecord->Data.CallbackMajorId != pushed->Major ||
+        LogRecord->Data.OriginatingTime.QuadPart != (LONGLONG)Sequence) {
+
+        BenchFailFormat( "record", "client %u read a record at %llu that is not the one pushed there", Client, (unsigned long long)Sequence );
+        return;
+    }
+
+    nameLength = (pushed->Length - FIELD_OFFSET( LOG_RECORD, Name )) / sizeof( WCHAR );
+
+    for (index = 0; index < nameLength && LogRecord->Name[index] != UNICODE_NULL; index++) {
+
+        if (LogRecord->Name[index] != (WCHAR)('A' + (Sequence + index) % 26)) {
+
+            BenchFailFormat( "name", "client %u read a damaged name at %llu, character %u", Client, (unsigned long long)Sequence, index );
+            return;
+        }
+    }
+}
+
+static void
+BenchCheckCounts (
+    _In_ PSPY_RING Ring,
+    _In_ ULONG Client,
+    _In_ PSPY_RING_CURSOR Cursor,
+    _In_ PBENCH_MODEL Model
+    )
+{
+    MINISPY_CLIENT_STATS stats;
+
+    SpyRingCursorStats( Ring, Cursor, &stats );
+
+    BenchCommon.Checks++;
+
+    if (stats.NextSequence != Model->Next ||
+        stats.Delivered != Model->Delivered ||
+        stats.Dropped != Model->Dropped ||
+        stats.Filtered != Model->Filtered ||
+        stats.HeadSequence != Ring->Head) {
+
+        BenchFailFormat( "counts", "client %u counts next %llu delivered %llu dropped %llu filtered %llu, expected %llu %llu %llu %llu",
+                   Client,
+                   (unsigned long long)stats.NextSequence,
+                   (unsigned long long)stats.Delivered,
+                   (unsigned long long)stats.Dropped,
+                   (unsigned long long)stats.Filtered,
+                   (unsigned long long)Model->Next,
+                   (unsigned long long)Model->Delivered,
+                   (unsigned long long)Model->Dropped,
+                   (unsigned long long)Model->Filtered );
+    }
+
+    //
+    //  Every record since the client attached is delivered, dropped,
+    //  filtered or still to be read.
+    //
+
+    if (stats.Delivered + stats.Dropped + stats.Filtered + (Ring->Head - stats.NextSequence) !=
+        Ring->Head - Model->Attached) {
+
+        BenchFailFormat( "accounting", "client %u does not account for the %llu records pushed since it attached",
+                   Client,
+                   (unsigned long long)(Ring->Head - Model->Attached) );
+    }
+}
+
+static void
+BenchCheck (
+    void
+    )
+/*++
+
+Routine Description:
+
+    Drives a ring of BENCH_CHECK_SLOTS slots and Bench.Clients cursors
+    through Bench.Steps random steps, comparing every read with the model.
+
+--*/
+{
+    SPY_RING ring;
+    PSPY_RING_SLOT slots;
+    SPY_RING_CURSOR cursors[BENCH_MAX_CLIENTS];
+    SPY_RING_CURSOR mark;
+    BENCH_MODEL models[BENCH_MAX_CLIENTS];
+    BENCH_MODEL modelMark;
+    PLOG_RECORD logRecord;
+    PLOG_RECORD record;
+    ULONGLONG sequence;
+    ULONGLONG expected;
+    ULONG client;
+    ULONG step;
+    ULONG count;
+    ULONG action;
+
+    slots = calloc( BENCH_CHECK_SLOTS, sizeof( SPY_RING_SLOT ) );
+    logRecord = calloc( 1, MAX_LOG_RECORD_LENGTH );
+
+    if (slots == NULL || logRecord == NULL) {
+
+        BenchFail( "setup", "out of memory" );
+        goto Exit;
+    }
+
+    SpyRingInitialize( &ring, slots, SpyRingSlotsFor( BENCH_CHECK_SLOTS ) );
+
+    //
+    //  An empty ring has nothing for anyone
+    //
+
+    memset( cursors, 0, sizeof( cursors ) );
+    memset( models, 0, sizeof( models ) );
+
+    for (client = 0; client < Bench.Clients; client++) {
+
+        cursors[client].Next = ring.Head;
+        models[client].Next = ring.Head;
+        models[client].Attached = ring.Head;
+
+        if (client % 2 == 1) {
+
+            BenchRandomFilter( &cursors[client].Filter );
+        }
+
+        BenchCheckRead( client, SpyRingCursorNext( &ring, &cursors[client], &sequence ), 0, 0 );
+        BenchCheckCounts( &ring, client, &cursors[client], &models[client] );
+    }
+
+    for (step = 0; step < Bench.Steps; step++) {
+
+        action = BenchRandom32() % 100;
+        client = BenchRandom32() % Bench.Clients;
+
+        if (action < 30) {
+
+            //
+            //  A burst, up to twice the ring
+            //
+
+            for (count = BenchRandom32() % (2 * BENCH_CHECK_SLOTS); count > 0; count--) {
+
+                BenchPush( &ring, logRecord );
+            }
+
+        } else if (action < 80) {
+
+            //
+            //  A read of a few records, the last sometimes put back because
+            //  it did not fit
+            //
+
+            for (count = 1 + BenchRandom32() % BENCH_CHECK_SLOTS; count > 0; count--) {
+
+                record = SpyRingCursorNext( &ring, &cursors[client], &sequence );
+                BenchModelNext( &ring, &models[client], &cursors[client].Filter, &expected );
+                BenchCheckRead( client, record, (record != NULL) ? sequence : 0, expected );
+
+                if (record == NULL) {
+
+                    break;
+                }
+
+                if (count == 1 && BenchRandom32() % 4 == 0) {
+
+                    SpyRingCursorRewind( &cursors[client], sequence );
+                    models[client].Next = sequence;
+                    models[client].Delivered--;
+                }
+            }
+
+        } else if (action < 88) {
+
+            //
+            //  A read whose copy out faulted, put back whole but for the
+            //  filter
+            //
+
+            mark = cursors[client];
+            modelMark = models[client];
+
+            for (count = 1 + BenchRandom32() % BENCH_CHECK_SLOTS; count > 0; count--) {
+
+                if (SpyRingCursorNext( &ring, &cursors[client], &sequence ) == NULL) {
+
+                    break;
+                }
+            }
+
+            mark.Filter = cursors[client].Filter;
+            cursors[client] = mark;
+            models[client] = modelMark;
+
+        } else if (action < 96) {
+
+            BenchRandomFilter( &cursors[client].Filter );
+
+        } else {
+
+            //
+            //  The client disconnects and another takes its place at the
+            //  head
+            //
+
+            memset( &cursors[client], 0, sizeof( cursors[client] ) );
+            memset( &models[client], 0, sizeof( models[client] ) );
+
+            cursors[client].Next = ring.Head;
+            models[client].Next = ring.Head;
+            models[client].Attached = ring.Head;
+
+            BenchRandomFilter( &cursors[client].Filter );
+        }
+
+        BenchCheckCounts( &ring, client, &cursors[client], &models[client] );
+
+        if (BenchCommon.Failures != 0) {
+
+            break;
+        }
+    }
+
+    //
+    //  Everyone catches up
+    //
+
+    for (client = 0; client < Bench.Clients; client++) {
+
+        do {
+
+            record = SpyRingCursorNext( &ring, &cursors[client], &sequence );
+            BenchModelNext( &ring, &models[client], &cursors[client].Filter, &expected );
+            BenchCheckRead( client, record, (record != NULL) ? sequence : 0, expected );
+
+        } while (record != NULL && BenchCommon.Failures == 0);
+
+        BenchCheckCounts( &ring, client, &cursors[client], &models[client] );
+    }
+
+    printf( "Checked %u reads and counts of %u clients over %llu records in %u slots, %u failed\n",
+            BenchCommon.Checks,
+            Bench.Clients,
+            (unsigned long long)(ring.Head - 1),
+            ring.SlotCount,
+            BenchCommon.Failures );
+
+Exit:
+
+    free( logRecord );
+    free( slots );
+}
+
+static void
+BenchMeasure (
+    void
+    )
+/*++
+
+Routine Description:
+
+    Pushes Bench.Records records with names of 56 to 182 characters into
+    a ring of Bench.SlotCount slots, every client reading everything new
+    after every 64, and prints the cost of each side.
+
+--*/
+{
+    SPY_RING ring;
+    PSPY_RING_SLOT slots;
+    SPY_RING_CURSOR cursors[BENCH_MAX_CLIENTS];
+    PLOG_RECORD logRecords;
+    PLOG_RECORD record;
+    ULONGLONG sequence;
+    ULONGLONG checksum = 0;
+    ULONGLONG delivered = 0;
+    long long pushTime = 0;
+    long long readTime = 0;
+    long long start;
+    ULONG pushed;
+    ULONG batch;
+    ULONG client;
+
+    slots = calloc( Bench.SlotCount, sizeof( SPY_RING_SLOT ) );
+    logRecords = calloc( 64, MAX_LOG_RECORD_LENGTH );
+
+    if (slots == NULL || logRecords == NULL) {
+
+        printf( "Out of memory\n" );
+        goto Exit;
+    }
+
+    //
+    //  Made once, so only the push is timed
+    //
+
+    for (batch = 0; batch < 64; batch++) {
+
+        BenchFill( (PLOG_RECORD)((PUCHAR)logRecords + batch * MAX_LOG_RECORD_LENGTH), batch, RECORD_TYPE_NORMAL, 4, 4, 56 + batch * 2 );
+    }
+
+    SpyRingInitialize( &ring, slots, SpyRingSlotsFor( Bench.SlotCount ) );
+    memset( cursors, 0, sizeof( cursors ) );
+
+    for (client = 0; client < Bench.Clients; client++) {
+
+        cursors[client].Next = ring.Head;
+    }
+
+    for (pushed = 0; pushed < Bench.Records; pushed += 64) {
+
+        start = BenchNow();
+
+        for (batch = 0; batch < 64; batch++) {
+
+            SpyRingPush( &ring, (PLOG_RECORD)((PUCHAR)logRecords + batch * MAX_LOG_RECORD_LENGTH) );
+        }
+
+        pushTime += BenchNow() - start;
+        start = BenchNow();
+
+        for (client = 0; client < Bench.Clients; client++) {
+
+            while ((record = SpyRingCursorNext( &ring, &cursors[client], &sequence )) != NULL) {
+
+                checksum += record->Length;
+                delivered++;
+            }
+        }
+
+        readTime += BenchNow() - start;
+    }
+
+    printf( "%u records of %u to %u bytes through %u slots and %u clients:\n",
+            pushed,
+            logRecords->Length,
+            ((PLOG_RECORD)((PUCHAR)logRecords + 63 * MAX_LOG_RECORD_LENGTH))->Length,
+            ring.SlotCount,
+            Bench.Clients );
+    printf( "    push  %6.1f ns a record, %.1f M records/s\n", (double)pushTime / pushed, pushed / (pushTime / 1e3) );
+    printf( "    read  %6.1f ns a record a client, %llu delivered (checksum %llu)\n",
+            delivered ? (double)readTime / delivered : 0.0,
+            (unsigned long long)delivered,
+            (unsigned long long)checksum );
+
+Exit:
+
+    free( logRecords );
+    free( slots );
+}
+
+static void
+BenchUsage (
+    void
+    )
+{
+    printf( "Usage: mspyRingTest [-c] [-k <clients>] [-t <steps>] [-n <records>] [-r <slots>]\n"
+            "\n"
+            "    [-c] only runs the checks\n"
+            "    [-k <clients>] clients reading the ring, 4 by default, at most %d\n"
+            "    [-t <steps>] random steps the checks take, 200000 by default\n"
+            "    [-n <records>] records the measurement pushes, 10000000 by default\n"
+            "    [-r <slots>] slots of the measured ring, 4096 by default as in the filter\n",
+            BENCH_MAX_CLIENTS );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    int option;
+
+    Bench.Clients = 4;
+    Bench.Steps = 200000;
+    Bench.Records = 10000000;
+    Bench.SlotCount = 4096;
+    while ((option = getopt( argc, argv, "ck:t:n:r:" )) != -1) {
+
+        switch (option) {
+
+            case 'c':
+                Bench.ChecksOnly = 1;
+                break;
+
+            case 'k':
+                Bench.Clients = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 't':
+                Bench.Steps = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'n':
+                Bench.Records = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'r':
+                Bench.SlotCount = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc ||
+        Bench.Clients == 0 || Bench.Clients > BENCH_MAX_CLIENTS ||
+        Bench.Steps == 0 || Bench.SlotCount < 2) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    BenchCheck();
+
+    if (Bench.ChecksOnly || BenchCommon.Failures != 0) {
+
+        return (BenchCommon.Failures != 0) ? 1 : 0;
+    }
+
+    BenchMeasure();
+
+    return 0;
+}
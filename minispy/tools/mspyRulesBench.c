@@ -0,0 +1,1341 @@
+/*++
+
+Module Name:
+
+    mspyRulesBench.c
+
+Abstract:
+
+    Checks and measures the rule compiler and matcher, user/mspyRules.c,
+    in a Linux program built against ushim.
+
+    A Rules table is filled with random rules of every type, target and
+    action, written the ways a user would write them: locations in any
+    case, with / or \ and trailing separators, extensions as "*.ext",
+    ".ext" or "ext", digests in upper or lower case.  Locations are built
+    from a small vocabulary so that rules nest and repeat, and a few rows
+    are inactive, deleted, of an unknown action or unable to match
+    anything.  RulesCompile reads the table back, and RulesMatch is then
+    compared with a plain matcher written here, which tries every rule in
+    turn, on random records:
+
+        paths below a location rule, in another case and with other
+        separators;
+
+        paths whose component only starts with a rule's, C:\Users\Bobby
+        next to a rule on C:\Users\Bob, which must not match;
+
+        paths no rule is on;
+
+        names with an extension of a rule, of none, with none at all, with
+        one too long for any rule, or followed by a :stream, some in a
+        directory with the extension of a rule;
+
+        the digest of a hash rule, a random one, or none.
+
+    The rules that block are then laid out for the filter with
+    RulesBuildFilterSet, and SpyRulesMatch, from inc/spyRules.h, is
+    compared with the plain matcher on the same kind of file names, each
+    followed in memory by more it must not read, as the names the filter
+    gets are not terminated: half are cut short anywhere, the others are
+    followed by another component.  Copies of the rule set cut short, or
+    with a few bytes changed in the header or one of its tables, must be
+    refused by SpyRulesValidate or, if taken, matched without reading
+    outside them; build with -fsanitize=address to check that.  The same
+    checks then run on -m rules, more blocking rules than the filter
+    takes, where it must get those before the first one dropped, in
+    RuleID order.
+
+    The measurements compile 10, 100, 1000 and 10000 rules, up to -m, and
+    match records like the above as fast as one thread can, printing the
+    time to compile, the records matched a second and ns a record, then
+    the ns the filter takes to match a file name against the blocking
+    rules, for records read from memory and already in cache.
+
+    It returns 1 when a check fails.
+
+    Run from the tools directory, the schema is read from ../user.  Built
+    on its own, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspyRulesBench mspyRulesBench.c -lsqlite3
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ushim/ushimLog.c"
+#include "../user/mspyRules.c"
+#include "mspyBench.h"
+
+#define BENCH_TEXT_SIZE         256
+#define BENCH_WORDS             1024
+#define BENCH_MAX_DEPTH         5
+#define BENCH_INPUTS            65536
+#define BENCH_LONG_EXTENSION    40
+
+typedef struct _BENCH_RULE {
+
+    LONG RuleId;
+    LONG Action;
+    LONG Type;
+    LONG Target;
+
+    //
+    //  Whether RulesCompile should take the rule, and the rule as the
+    //  plain matcher compares it: a location upcased with every separator
+    //  a single \, an upcased extension, or the digest.
+    //
+
+    BOOLEAN Applies;
+    char Written[BENCH_TEXT_SIZE];
+    char Text[BENCH_TEXT_SIZE];
+    UCHAR Digest[RULE_DIGEST_SIZE];
+
+} BENCH_RULE, *PBENCH_RULE;
+
+typedef struct _BENCH_INPUT {
+
+    WCHAR FileName[BENCH_TEXT_SIZE];
+    ULONG FileNameLength;
+    WCHAR ProcessPath[BENCH_TEXT_SIZE];
+    UCHAR FileDigest[RULE_DIGEST_SIZE];
+    UCHAR ProcessDigest[RULE_DIGEST_SIZE];
+    BOOLEAN HasFileDigest;
+    BOOLEAN HasProcessDigest;
+
+    RULE_INPUT Input;
+
+} BENCH_INPUT, *PBENCH_INPUT;
+
+typedef struct _BENCH_STATE {
+
+    char Words[BENCH_WORDS][12];
+
+    PBENCH_RULE Rules;
+    ULONG RuleCount;
+
+    //
+    //  When not 0, the plain matcher leaves out this rule and the ones
+    //  after it, as the filter gets the blocking rules before it.
+    //
+
+    LONG FirstDropped;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static char
+BenchUpcase (
+    _In_ char Char
+    )
+{
+    return (Char >= 'a' && Char <= 'z') ? (char)(Char - ('a' - 'A')) : Char;
+}
+
+static VOID
+BenchRecase (
+    _Inout_z_ char *Text
+    )
+/*++
+
+Routine Description:
+
+    Changes the case of a random half of the letters.
+
+--*/
+{
+    for (; *Text != '\0'; Text++) {
+
+        if (BenchBelow( 2 ) == 0) {
+
+            *Text = (*Text >= 'a' && *Text <= 'z') ? (char)(*Text - ('a' - 'A')) :
+                    (*Text >= 'A' && *Text <= 'Z') ? (char)(*Text + ('a' - 'A')) : *Text;
+        }
+    }
+}
+
+static VOID
+BenchAppend (
+    _Inout_z_ char *Text,
+    _In_z_ const char *More
+    )
+{
+    size_t length = strlen( Text );
+
+    snprintf( Text + length, BENCH_TEXT_SIZE - length, "%s", More );
+}
+
+static VOID
+BenchSeparator (
+    _Inout_z_ char *Text
+    )
+{
+    BenchAppend( Text, (BenchBelow( 8 ) == 0) ? "/" : "\\" );
+
+    if (BenchBelow( 16 ) == 0) {
+
+        BenchAppend( Text, "\\" );
+    }
+}
+
+static VOID
+BenchDirectory (
+    _Out_writes_z_(BENCH_TEXT_SIZE) char *Text,
+    _In_ ULONG Depth
+    )
+/*++
+
+Routine Description:
+
+    Makes a directory on one of three volumes, Depth components below the
+    volume, from the vocabulary.
+
+--*/
+{
+    char volume[48];
+    ULONG index;
+
+    snprintf( volume, sizeof( volume ), "\\Device\\HarddiskVolume%u", 1 + BenchBelow( 3 ) );
+    strcpy( Text, volume );
+
+    for (index = 0; index < Depth; index++) {
+
+        BenchSeparator( Text );
+        BenchAppend( Text, Bench.Words[BenchBelow( BENCH_WORDS )] );
+    }
+}
+
+static VOID
+BenchExtension (
+    _Out_writes_z_(BENCH_TEXT_SIZE) char *Text
+    )
+{
+    ULONG length = 2 + BenchBelow( 4 );
+    ULONG index;
+
+    for (index = 0; index < length; index++) {
+
+        Text[index] = "abcdefghijklmnopqrstuvwxyz0123456789"[BenchBelow( 36 )];
+    }
+
+    Text[length] = '\0';
+}
+
+static VOID
+BenchNormalize (
+    _In_z_ const char *Path,
+    _Out_writes_z_(BENCH_TEXT_SIZE) char *Text
+    )
+/*++
+
+Routine Description:
+
+    Upcases a path and writes every run of separators as a single \,
+    without one at the end.
+
+--*/
+{
+    size_t length = 0;
+
+    for (; *Path != '\0' && length < BENCH_TEXT_SIZE - 2; Path++) {
+
+        if (*Path == '\\' || *Path == '/') {
+
+            continue;
+        }
+
+        if (length == 0 || Path[-1] == '\\' || Path[-1] == '/') {
+
+            Text[length++] = '\\';
+        }
+
+        Text[length++] = BenchUpcase( *Path );
+    }
+
+    Text[length] = '\0';
+}
+
+static VOID
+BenchFileExtension (
+    _In_z_ const char *Path,
+    _Out_writes_z_(BENCH_TEXT_SIZE) char *Extension
+    )
+/*++
+
+Routine Description:
+
+    The upcased extension of the last component, before any :stream,
+    empty if there is none or it is longer than a rule can be.
+
+--*/
+{
+    const char *name = Path;
+    const char *dot = NULL;
+    const char *scan;
+    size_t length = 0;
+
+    for (scan = Path; *scan != '\0'; scan++) {
+
+        if (*scan == '\\' || *scan == '/') {
+
+            name = scan + 1;
+        }
+    }
+
+    for (scan = name; *scan != '\0' && *scan != ':'; scan++) {
+
+        if (*scan == '.') {
+
+            dot = scan;
+        }
+    }
+
+    if (dot != NULL && scan - dot - 1 <= SPY_RULES_MAX_EXTENSION) {
+
+        for (dot++; dot < scan; dot++) {
+
+            Extension[length++] = BenchUpcase( *dot );
+        }
+    }
+
+    Extension[length] = '\0';
+}
+
+static VOID
+BenchRandomDigest (
+    _Out_writes_(RULE_DIGEST_SIZE) PUCHAR Digest
+    )
+{
+    ULONG index;
+
+    for (index = 0; index < RULE_DIGEST_SIZE; index++) {
+
+        Digest[index] = (UCHAR)BenchRandom();
+    }
+}
+
+static VOID
+BenchMakeRule (
+    _Out_ PBENCH_RULE Rule,
+    _In_ ULONG Made
+    )
+/*++
+
+Routine Description:
+
+    Makes one random rule and writes down how the plain matcher sees it.
+    One location rule in three goes below a location rule among the Made
+    already in Bench.Rules.
+
+--*/
+{
+    PBENCH_RULE parent = NULL;
+    static const char *prefixes[] = { "*.", ".", "" };
+    char extension[BENCH_TEXT_SIZE];
+    ULONG kind = BenchBelow( 100 );
+    ULONG index;
+
+    memset( Rule, 0, sizeof( BENCH_RULE ) );
+
+    Rule->Action = (LONG)BenchBelow( 3 );
+    Rule->Target = (BenchBelow( 4 ) == 0) ? RULE_TARGET_PROCESS : RULE_TARGET_FILE;
+    Rule->Applies = TRUE;
+
+    if (kind < 55) {
+
+        Rule->Type = RULE_TYPE_LOCATION;
+
+        if (Made != 0 && BenchBelow( 3 ) == 0) {
+
+            parent = &Bench.Rules[BenchBelow( Made )];
+        }
+
+        if (parent != NULL && parent->Type == RULE_TYPE_LOCATION && parent->Applies) {
+
+            BenchNormalize( parent->Written, Rule->Written );
+            BenchSeparator( Rule->Written );
+            BenchAppend( Rule->Written, Bench.Words[BenchBelow( BENCH_WORDS )] );
+
+        } else {
+
+            BenchDirectory( Rule->Written, 1 + BenchBelow( BENCH_MAX_DEPTH ) );
+        }
+
+        BenchNormalize( Rule->Written, Rule->Text );
+
+        if (BenchBelow( 4 ) == 0) {
+
+            BenchSeparator( Rule->Written );
+        }
+
+        BenchRecase( Rule->Written );
+
+    } else if (kind < 80) {
+
+        Rule->Type = RULE_TYPE_EXTENSION;
+        BenchExtension( extension );
+        snprintf( Rule->Written, BENCH_TEXT_SIZE, "%s%s", prefixes[BenchBelow( 3 )], extension );
+        BenchRecase( Rule->Written );
+
+        for (index = 0; extension[index] != '\0'; index++) {
+
+            Rule->Text[index] = BenchUpcase( extension[index] );
+        }
+
+    } else if (kind < 97) {
+
+        Rule->Type = RULE_TYPE_HASH;
+        BenchRandomDigest( Rule->Digest );
+
+        for (index = 0; index < RULE_DIGEST_SIZE; index++) {
+
+            snprintf( Rule->Written + index * 2, 3, "%02x", Rule->Digest[index] );
+        }
+
+        BenchRecase( Rule->Written );
+
+    } else {
+
+        //
+        //  Rows RulesCompile has to skip.
+        //
+
+        Rule->Applies = FALSE;
+
+        switch (BenchBelow( 4 )) {
+
+        case 0:
+            Rule->Type = RULE_TYPE_LOCATION;
+            strcpy( Rule->Written, "\\/\\" );
+            break;
+
+        case 1:
+            Rule->Type = RULE_TYPE_EXTENSION;
+            memset( Rule->Written, 'x', BENCH_LONG_EXTENSION );
+            break;
+
+        case 2:
+            Rule->Type = RULE_TYPE_HASH;
+            strcpy( Rule->Written, "not a digest" );
+            break;
+
+        default:
+            Rule->Type = RULE_TYPE_LOCATION;
+            BenchDirectory( Rule->Written, 2 );
+            Rule->Action = 7;
+            break;
+        }
+    }
+}
+
+static BOOLEAN
+BenchWriteRules (
+    _In_ sqlite3 *Db,
+    _In_ ULONG Count
+    )
+/*++
+
+Routine Description:
+
+    Replaces the Rules table with Count random rules, one in twenty of
+    them inactive or deleted.
+
+--*/
+{
+    sqlite3_stmt *stmt = NULL;
+    PBENCH_RULE rule;
+    ULONG inactive;
+    ULONG index;
+
+    free( Bench.Rules );
+    Bench.Rules = calloc( Count, sizeof( BENCH_RULE ) );
+    Bench.RuleCount = Count;
+
+    if (Bench.Rules == NULL ||
+        sqlite3_exec( Db, "BEGIN; DELETE FROM Rules;", NULL, NULL, NULL ) != SQLITE_OK ||
+        sqlite3_prepare_v2( Db,
+                            "INSERT INTO Rules (Active, Deleted, Action, RuleType, RuleTarget, RuleString)"
+                            " VALUES (?1, ?2, ?3, ?4, ?5, ?6);",
+                            -1, &stmt, NULL ) != SQLITE_OK) {
+
+        printf( "Could not write the rules: %s\n", sqlite3_errmsg( Db ) );
+        return FALSE;
+    }
+
+    for (index = 0; index < Count; index++) {
+
+        rule = &Bench.Rules[index];
+        BenchMakeRule( rule, index );
+
+        inactive = (BenchBelow( 20 ) == 0) ? 1 + BenchBelow( 2 ) : 0;
+        rule->Applies = rule->Applies && inactive == 0;
+
+        sqlite3_bind_int( stmt, 1, inactive != 1 );
+        sqlite3_bind_int( stmt, 2, inactive == 2 );
+        sqlite3_bind_int( stmt, 3, rule->Action );
+        sqlite3_bind_int( stmt, 4, rule->Type );
+        sqlite3_bind_int( stmt, 5, rule->Target );
+        sqlite3_bind_text( stmt, 6, rule->Written, -1, SQLITE_STATIC );
+
+        if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+            printf( "Could not write rule %u: %s\n", index, sqlite3_errmsg( Db ) );
+            sqlite3_finalize( stmt );
+            return FALSE;
+        }
+
+        rule->RuleId = (LONG)sqlite3_last_insert_rowid( Db );
+        sqlite3_reset( stmt );
+    }
+
+    sqlite3_finalize( stmt );
+
+    return sqlite3_exec( Db, "COMMIT;", NULL, NULL, NULL ) == SQLITE_OK;
+}
+
+static VOID
+BenchMakePath (
+    _In_ LONG Target,
+    _Out_writes_z_(BENCH_TEXT_SIZE) char *Path
+    )
+/*++
+
+Routine Description:
+
+    Makes a path: below a location rule of Target, next to one, or
+    anywhere, sometimes through a directory with an extension, ending in a
+    name with some extension or none.
+
+--*/
+{
+    char extension[BENCH_TEXT_SIZE];
+    PBENCH_RULE rule = NULL;
+    ULONG kind = BenchBelow( 10 );
+    ULONG tries;
+    ULONG depth;
+    ULONG index;
+
+    for (tries = 0; kind < 3 && tries < 64; tries++) {
+
+        rule = &Bench.Rules[BenchBelow( Bench.RuleCount )];
+
+        if (rule->Type == RULE_TYPE_LOCATION && rule->Applies && rule->Target == Target) {
+
+            break;
+        }
+
+        rule = NULL;
+    }
+
+    if (rule != NULL) {
+
+        strcpy( Path, rule->Written );
+        BenchRecase( Path );
+
+        if (kind == 2) {
+
+            //
+            //  A component the rule's last one is only the start of.
+            //
+
+            while (Path[0] != '\0' && (Path[strlen( Path ) - 1] == '\\' || Path[strlen( Path ) - 1] == '/')) {
+
+                Path[strlen( Path ) - 1] = '\0';
+            }
+
+            BenchAppend( Path, "by" );
+        }
+
+        depth = BenchBelow( 3 );
+
+    } else {
+
+        BenchDirectory( Path, 1 + BenchBelow( BENCH_MAX_DEPTH ) );
+        depth = 0;
+    }
+
+    for (index = 0; index < depth; index++) {
+
+        BenchSeparator( Path );
+        BenchAppend( Path, Bench.Words[BenchBelow( BENCH_WORDS )] );
+    }
+
+    //
+    //  A directory with the extension of a rule, which is not the name's.
+    //
+
+    if (BenchBelow( 4 ) == 0) {
+
+        for (tries = 0; tries < 64; tries++) {
+
+            rule = &Bench.Rules[BenchBelow( Bench.RuleCount )];
+
+            if (rule->Type == RULE_TYPE_EXTENSION && rule->Applies) {
+
+                BenchSeparator( Path );
+                BenchAppend( Path, Bench.Words[BenchBelow( BENCH_WORDS )] );
+                BenchAppend( Path, "." );
+                BenchAppend( Path, rule->Text );
+                break;
+            }
+        }
+    }
+
+    BenchSeparator( Path );
+    BenchAppend( Path, "file" );
+
+    switch (BenchBelow( 10 )) {
+
+    case 0:
+    case 1:
+        break;
+
+    case 2:
+        memset( extension, 'x', BENCH_LONG_EXTENSION );
+        extension[BENCH_LONG_EXTENSION] = '\0';
+        BenchAppend( Path, "." );
+        BenchAppend( Path, extension );
+        break;
+
+    case 3:
+    case 4:
+    case 5:
+    case 6:
+    case 7:
+    case 8:
+        BenchExtension( extension );
+        BenchAppend( Path, "." );
+        BenchAppend( Path, extension );
+        break;
+
+    default:
+        for (tries = 0; tries < 64; tries++) {
+
+            rule = &Bench.Rules[BenchBelow( Bench.RuleCount )];
+
+            if (rule->Type == RULE_TYPE_EXTENSION && rule->Applies) {
+
+                BenchAppend( Path, ".tar." );
+                BenchAppend( Path, rule->Text );
+                break;
+            }
+        }
+        break;
+    }
+
+    if (BenchBelow( 16 ) == 0) {
+
+        BenchAppend( Path, ":Zone.Identifier" );
+    }
+
+    BenchRecase( Path );
+}
+
+static VOID
+BenchMakeDigest (
+    _In_ LONG Target,
+    _Out_writes_(RULE_DIGEST_SIZE) PUCHAR Digest
+    )
+{
+    PBENCH_RULE rule;
+    ULONG tries = (BenchBelow( 5 ) == 0) ? 0 : 64;
+
+    //
+    //  One in five is the digest of a rule, if one comes up.
+    //
+
+    for (; tries < 64; tries++) {
+
+        rule = &Bench.Rules[BenchBelow( Bench.RuleCount )];
+
+        if (rule->Type == RULE_TYPE_HASH && rule->Applies && rule->Target == Target) {
+
+            memcpy( Digest, rule->Digest, RULE_DIGEST_SIZE );
+            return;
+        }
+    }
+
+    BenchRandomDigest( Digest );
+}
+
+static VOID
+BenchMakeInput (
+    _Out_ PBENCH_INPUT Input,
+    _Out_writes_z_(BENCH_TEXT_SIZE) char *FileName,
+    _Out_writes_z_(BENCH_TEXT_SIZE) char *ProcessPath
+    )
+{
+    size_t index;
+
+    memset( Input, 0, sizeof( BENCH_INPUT ) );
+
+    BenchMakePath( RULE_TARGET_FILE, FileName );
+    BenchMakePath( RULE_TARGET_PROCESS, ProcessPath );
+
+    for (index = 0; FileName[index] != '\0'; index++) {
+
+        Input->FileName[index] = (WCHAR)FileName[index];
+    }
+
+    Input->FileNameLength = (ULONG)index;
+
+    for (index = 0; ProcessPath[index] != '\0'; index++) {
+
+        Input->ProcessPath[index] = (WCHAR)ProcessPath[index];
+    }
+
+    Input->HasFileDigest = (BenchBelow( 3 ) != 0);
+    Input->HasProcessDigest = (BenchBelow( 3 ) != 0);
+
+    if (Input->HasFileDigest) {
+
+        BenchMakeDigest( RULE_TARGET_FILE, Input->FileDigest );
+    }
+
+    if (Input->HasProcessDigest) {
+
+        BenchMakeDigest( RULE_TARGET_PROCESS, Input->ProcessDigest );
+    }
+
+    Input->Input.FileName = Input->FileName;
+    Input->Input.ProcessPath = Input->ProcessPath;
+    Input->Input.FileDigest = Input->HasFileDigest ? Input->FileDigest : NULL;
+    Input->Input.ProcessDigest = Input->HasProcessDigest ? Input->ProcessDigest : NULL;
+}
+
+static VOID
+BenchPrefer (
+    _Inout_ PRULE_REF Best,
+    _In_ PBENCH_RULE Rule
+    )
+{
+    if (Best->RuleId == 0 ||
+        Rule->Action > Best->Action ||
+        (Rule->Action == Best->Action && Rule->RuleId < Best->RuleId)) {
+
+        Best->RuleId = Rule->RuleId;
+        Best->Action = Rule->Action;
+    }
+}
+
+static RULE_REF
+BenchModelMatch (
+    _In_z_ const char *Path,
+    _In_opt_ const UCHAR *Digest,
+    _In_ LONG Target,
+    _In_ LONG MinAction
+    )
+/*++
+
+Routine Description:
+
+    The plain matcher: every rule of Target with at least MinAction, in
+    turn.
+
+--*/
+{
+    char normalized[BENCH_TEXT_SIZE];
+    char extension[BENCH_TEXT_SIZE];
+    RULE_REF best = { 0, 0 };
+    PBENCH_RULE rule;
+    size_t length;
+    ULONG index;
+
+    BenchNormalize( Path, normalized );
+    BenchFileExtension( Path, extension );
+
+    for (index = 0; index < Bench.RuleCount; index++) {
+
+        rule = &Bench.Rules[index];
+
+        if (!rule->Applies || rule->Target != Target || rule->Action < MinAction) {
+
+            continue;
+        }
+
+        if (Bench.FirstDropped != 0 && rule->RuleId >= Bench.FirstDropped) {
+
+            continue;
+        }
+
+        switch (rule->Type) {
+
+        case RULE_TYPE_LOCATION:
+            length = strlen( rule->Text );
+
+            if (strncmp( normalized, rule->Text, length ) == 0 &&
+                (normalized[length] == '\\' || normalized[length] == '\0')) {
+
+                BenchPrefer( &best, rule );
+            }
+            break;
+
+        case RULE_TYPE_EXTENSION:
+            if (strcmp( extension, rule->Text ) == 0) {
+
+                BenchPrefer( &best, rule );
+            }
+            break;
+
+        case RULE_TYPE_HASH:
+            if (Digest != NULL && memcmp( Digest, rule->Digest, RULE_DIGEST_SIZE ) == 0) {
+
+                BenchPrefer( &best, rule );
+            }
+            break;
+        }
+    }
+
+    return best;
+}
+
+static PRULE_SET
+BenchCompile (
+    _In_ sqlite3 *Db
+    )
+{
+    PRULE_SET ruleSet = RulesCompile( Db, "main" );
+    char detail[128];
+    ULONG expected = 0;
+    ULONG index;
+
+    if (ruleSet == NULL) {
+
+        BenchFail( "compile", "RulesCompile returned NULL" );
+        return NULL;
+    }
+
+    for (index = 0; index < Bench.RuleCount; index++) {
+
+        expected += Bench.Rules[index].Applies;
+    }
+
+    if (ruleSet->Process.RuleCount + ruleSet->File.RuleCount != expected) {
+
+        snprintf( detail, sizeof( detail ), "%u rules compiled, %u expected",
+                  ruleSet->Process.RuleCount + ruleSet->File.RuleCount, expected );
+        BenchFail( "compile", detail );
+    }
+
+    return ruleSet;
+}
+
+static VOID
+BenchCheckFilter (
+    _In_ PRULE_SET RuleSet,
+    _In_ ULONG Checks,
+    _In_ ULONG Damaged
+    )
+/*++
+
+Routine Description:
+
+    Lays the rules that block out for the filter as the client does and
+    compares SpyRulesMatch with the plain matcher on Checks random file
+    names, each followed in memory by more it must not read, as the
+    filter's names are not terminated: half of them are cut short
+    anywhere with the rest of the name after them, the others are followed
+    by another component.  Then damages Damaged copies of the rule set, in
+    the header or one of its tables, and matches names with every copy
+    SpyRulesValidate takes, which must stay inside the copy.
+
+--*/
+{
+    static const WCHAR beyond[] = L"\\X.EXE";
+    char fileName[BENCH_TEXT_SIZE];
+    char processPath[BENCH_TEXT_SIZE];
+    char detail[BENCH_TEXT_SIZE * 2];
+    WCHAR name[BENCH_TEXT_SIZE + ARRAYSIZE( beyond )];
+    PSPY_RULES_HEADER filter;
+    PSPY_RULES_HEADER copy;
+    BENCH_INPUT input;
+    RULE_REF expected;
+    RULE_REF match;
+    ULONG accepted = 0;
+    ULONG regionStart[5];
+    ULONG regionSize[5];
+    ULONG region;
+    ULONG length;
+    ULONG size;
+    ULONG index;
+    ULONG flips;
+    ULONG count;
+
+    filter = RulesBuildFilterSet( RuleSet );
+
+    if (filter == NULL) {
+
+        BenchFail( "filter", "RulesBuildFilterSet returned NULL" );
+        return;
+    }
+
+    if (!SpyRulesValidate( filter, filter->Size )) {
+
+        BenchFail( "filter", "SpyRulesValidate refused the rule set the client built" );
+        free( filter );
+        return;
+    }
+
+    //
+    //  What the filter gets when the rules cannot be laid out.
+    //
+
+    BenchCommon.Checks++;
+
+    if (!SpyRulesValidate( RulesEmptyFilterSet(), RulesEmptyFilterSet()->Size ) ||
+        SpyRulesMatch( RulesEmptyFilterSet(), beyond, ARRAYSIZE( beyond ) - 1 ).RuleId != 0) {
+
+        BenchFail( "filter", "the empty rule set is refused or matches" );
+    }
+
+    Bench.FirstDropped = (RuleSet->BlockingDropped != 0) ? RuleSet->BlockingFirstDropped : 0;
+
+    for (index = 0; index < Checks; index++) {
+
+        BenchMakeInput( &input, fileName, processPath );
+
+        memcpy( name, input.FileName, input.FileNameLength * sizeof( WCHAR ) );
+        memcpy( name + input.FileNameLength, beyond, sizeof( beyond ) );
+
+        length = input.FileNameLength;
+
+        if (BenchBelow( 2 ) == 0 && length > 1) {
+
+            length = 1 + BenchBelow( length - 1 );
+            fileName[length] = '\0';
+        }
+
+        expected = BenchModelMatch( fileName, NULL, RULE_TARGET_FILE, RULE_ACTION_BLOCK );
+        match = SpyRulesMatch( filter, name, length );
+
+        BenchCommon.Checks++;
+
+        if (match.RuleId != expected.RuleId || match.Action != expected.Action) {
+
+            snprintf( detail, sizeof( detail ), "%s matched rule %d action %d in the filter, expected rule %d action %d",
+                      fileName, match.RuleId, match.Action, expected.RuleId, expected.Action );
+            BenchFail( "filter match", detail );
+        }
+    }
+
+    regionStart[0] = 0;
+    regionSize[0] = sizeof( SPY_RULES_HEADER );
+    regionStart[1] = filter->NodeOffset;
+    regionSize[1] = filter->NodeCount * sizeof( SPY_RULE_REF );
+    regionStart[2] = filter->EdgeOffset;
+    regionSize[2] = (filter->EdgeMask + 1) * sizeof( SPY_RULE_EDGE );
+    regionStart[3] = filter->ExtensionOffset;
+    regionSize[3] = (filter->ExtensionMask + 1) * sizeof( SPY_RULE_EXTENSION );
+    regionStart[4] = filter->TextOffset;
+    regionSize[4] = max( filter->TextLength * (ULONG)sizeof( WCHAR ), 1 );
+
+    for (index = 0; index < Damaged; index++) {
+
+        //
+        //  Cut short, or a few bytes changed in the header or one of the
+        //  tables.
+        //
+
+        size = (BenchBelow( 4 ) == 0) ? BenchBelow( filter->Size ) : filter->Size;
+        copy = malloc( size ? size : 1 );
+
+        if (copy == NULL) {
+
+            break;
+        }
+
+        memcpy( copy, filter, size );
+
+        if (size == filter->Size) {
+
+            region = BenchBelow( ARRAYSIZE( regionStart ) );
+
+            for (flips = 1 + BenchBelow( 4 ); flips > 0; flips--) {
+
+                ((PUCHAR)copy)[regionStart[region] + BenchBelow( regionSize[region] )] ^= (UCHAR)(1 + BenchBelow( 255 ));
+            }
+        }
+
+        BenchCommon.Checks++;
+
+        if (SpyRulesValidate( copy, size )) {
+
+            if (size != filter->Size) {
+
+                BenchFail( "filter validate", "a rule set cut short was taken" );
+            }
+
+            accepted++;
+
+            for (count = 0; count < 32; count++) {
+
+                BenchMakeInput( &input, fileName, processPath );
+                SpyRulesMatch( copy, input.FileName, input.FileNameLength );
+            }
+        }
+
+        free( copy );
+    }
+
+    Bench.FirstDropped = 0;
+
+    printf( "Filter:       %u blocking rules in %u bytes, %u dropped, %u names, %u damaged copies of which %u were taken\n",
+            filter->RuleCount, filter->Size, RuleSet->BlockingDropped, Checks, Damaged, accepted );
+
+    free( filter );
+}
+
+static VOID
+BenchCheck (
+    _In_ sqlite3 *Db,
+    _In_ ULONG Rules,
+    _In_ ULONG Checks,
+    _In_ ULONG Damaged
+    )
+/*++
+
+Routine Description:
+
+    Compiles Rules random rules and compares RulesMatch with the plain
+    matcher on Checks random records, then checks the filter's copy of
+    them, see BenchCheckFilter.
+
+--*/
+{
+    char fileName[BENCH_TEXT_SIZE];
+    char processPath[BENCH_TEXT_SIZE];
+    char detail[BENCH_TEXT_SIZE * 3];
+    BENCH_INPUT input;
+    PRULE_SET ruleSet;
+    RULE_REF expected;
+    RULE_REF match;
+    ULONG matched = 0;
+    ULONG index;
+
+    if (!BenchWriteRules( Db, Rules )) {
+
+        BenchFail( "rules", "could not be written" );
+        return;
+    }
+
+    ruleSet = BenchCompile( Db );
+
+    if (ruleSet == NULL) {
+
+        return;
+    }
+
+    for (index = 0; index < Checks; index++) {
+
+        BenchMakeInput( &input, fileName, processPath );
+
+        expected = SpyRulesStronger( BenchModelMatch( fileName, input.Input.FileDigest, RULE_TARGET_FILE, RULE_ACTION_IGNORE ),
+                                     BenchModelMatch( processPath, input.Input.ProcessDigest, RULE_TARGET_PROCESS, RULE_ACTION_IGNORE ) );
+        match = RulesMatch( ruleSet, &input.Input );
+
+        BenchCommon.Checks++;
+        matched += (expected.RuleId != 0);
+
+        if (match.RuleId != expected.RuleId || match.Action != expected.Action) {
+
+            snprintf( detail, sizeof( detail ), "%s from %s matched rule %d action %d, expected rule %d action %d",
+                      fileName, processPath, match.RuleId, match.Action, expected.RuleId, expected.Action );
+            BenchFail( "match", detail );
+        }
+    }
+
+    printf( "Matching:     %u rules, %u records, %u of them matched a rule\n", Rules, Checks, matched );
+
+    BenchCheckFilter( ruleSet, Checks, Damaged );
+
+    RulesFree( ruleSet );
+}
+
+static VOID
+BenchMeasure (
+    _In_ sqlite3 *Db,
+    _In_ ULONG Rules,
+    _In_ double Seconds
+    )
+{
+    char fileName[BENCH_TEXT_SIZE];
+    char processPath[BENCH_TEXT_SIZE];
+    PBENCH_INPUT inputs;
+    PRULE_SET ruleSet;
+    PSPY_RULES_HEADER filter;
+    RULE_REF match;
+    unsigned long long matches = 0;
+    unsigned long long matched = 0;
+    long long start;
+    long long elapsed;
+    long long compile;
+    double cold;
+    double percent;
+    ULONG index;
+
+    inputs = malloc( BENCH_INPUTS * sizeof( BENCH_INPUT ) );
+
+    if (inputs == NULL || !BenchWriteRules( Db, Rules )) {
+
+        free( inputs );
+        BenchFail( "measure", "could not set up" );
+        return;
+    }
+
+    start = BenchNow();
+    ruleSet = RulesCompile( Db, "main" );
+    compile = BenchNow() - start;
+
+    if (ruleSet == NULL) {
+
+        free( inputs );
+        BenchFail( "measure", "RulesCompile returned NULL" );
+        return;
+    }
+
+    for (index = 0; index < BENCH_INPUTS; index++) {
+
+        BenchMakeInput( &inputs[index], fileName, processPath );
+    }
+
+    start = BenchNow();
+
+    do {
+
+        for (index = 0; index < BENCH_INPUTS; index++) {
+
+            match = RulesMatch( ruleSet, &inputs[index].Input );
+            matched += (match.RuleId != 0);
+        }
+
+        matches += BENCH_INPUTS;
+        elapsed = BenchNow() - start;
+
+    } while (elapsed < Seconds * 1e9);
+
+    cold = (double)elapsed / matches;
+    percent = 100.0 * matched / matches;
+
+    //
+    //  The inputs above are far larger than the caches, most of that time
+    //  goes to reading each record from memory.  The log writer matches a
+    //  record it has just parsed, and the filter a name that was just built
+    //  by FltGetFileNameInformation, so also measure a few records matched
+    //  over and over.
+    //
+
+    matches = 0;
+    start = BenchNow();
+
+    do {
+
+        for (index = 0; index < BENCH_INPUTS; index++) {
+
+            match = RulesMatch( ruleSet, &inputs[index % 64].Input );
+            matched += (match.RuleId != 0);
+        }
+
+        matches += BENCH_INPUTS;
+        elapsed = BenchNow() - start;
+
+    } while (elapsed < Seconds * 1e9);
+
+    printf( "    %6u rules  compile %8.2f ms  %6.2f M records/s, %6.2f in cache  %6.1f ns each, %6.1f in cache  %4.1f%% matched\n",
+            Rules,
+            compile / 1e6,
+            1e3 / cold,
+            matches * 1e3 / elapsed,
+            cold,
+            (double)elapsed / matches,
+            percent );
+
+    //
+    //  What the filter does with the same file names.
+    //
+
+    filter = RulesBuildFilterSet( ruleSet );
+
+    if (filter == NULL) {
+
+        printf( "                   the blocking rules could not be laid out for the filter\n" );
+
+    } else {
+
+        matches = 0;
+        matched = 0;
+        start = BenchNow();
+
+        do {
+
+            for (index = 0; index < BENCH_INPUTS; index++) {
+
+                match = SpyRulesMatch( filter, inputs[index].FileName, inputs[index].FileNameLength );
+                matched += (match.RuleId != 0);
+            }
+
+            matches += BENCH_INPUTS;
+            elapsed = BenchNow() - start;
+
+        } while (elapsed < Seconds * 1e9);
+
+        cold = (double)elapsed / matches;
+        percent = 100.0 * matched / matches;
+
+        matches = 0;
+        start = BenchNow();
+
+        do {
+
+            for (index = 0; index < BENCH_INPUTS; index++) {
+
+                match = SpyRulesMatch( filter, inputs[index % 64].FileName, inputs[index % 64].FileNameLength );
+                matched += (match.RuleId != 0);
+            }
+
+            matches += BENCH_INPUTS;
+            elapsed = BenchNow() - start;
+
+        } while (elapsed < Seconds * 1e9);
+
+        printf( "                   filter, %5u blocking rules in %6u bytes, %5u dropped: %6.1f ns a file name, %6.1f in cache  %4.1f%% blocked\n",
+                filter->RuleCount,
+                filter->Size,
+                ruleSet->BlockingDropped,
+                cold,
+                (double)elapsed / matches,
+                percent );
+
+        free( filter );
+    }
+
+    RulesFree( ruleSet );
+    free( inputs );
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    printf( "Usage: mspyRulesBench [-n <rules>] [-c <records>] [-d <copies>] [-m <rules>] [-t <seconds>] [-s <sql directory>]\n"
+            "\n"
+            "    [-n <rules>] rules the matcher is checked with, 2000 by default\n"
+            "    [-c <records>] records checked, 50000 by default\n"
+            "    [-d <copies>] damaged copies of the filter's rule set validated, 20000 by default\n"
+            "    [-m <rules>] most rules measured, 10000 by default, 0 to skip\n"
+            "    [-t <seconds>] time matching is measured for with each rule count, 1 by default\n"
+            "    [-s <sql directory>] where create.sql is, ../user by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    sqlite3 *db = NULL;
+    ULONG rules = 2000;
+    ULONG checks = 50000;
+    ULONG most = 10000;
+    ULONG damaged = 20000;
+    double seconds = 1;
+    ULONG count;
+    ULONG index;
+    ULONG length;
+    int option;
+
+    while ((option = getopt( argc, argv, "n:c:d:m:t:s:" )) != -1) {
+
+        switch (option) {
+
+            case 'n':
+                rules = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'c':
+                checks = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'd':
+                damaged = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'm':
+                most = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 't':
+                seconds = atof( optarg );
+                break;
+
+            case 's':
+                UshimSqlDirectory = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || rules == 0 || seconds <= 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    for (index = 0; index < BENCH_WORDS; index++) {
+
+        length = 3 + BenchBelow( 8 );
+        Bench.Words[index][length] = '\0';
+
+        while (length-- > 0) {
+
+            Bench.Words[index][length] = (char)('a' + BenchBelow( 26 ));
+        }
+    }
+
+    if (sqlite3_open( ":memory:", &db ) != SQLITE_OK ||
+        ExecEmbeddedSQL( db, L"CREATE_SQL" ) != SQLITE_OK) {
+
+        printf( "Could not create the schema from %s\n", UshimSqlDirectory );
+        sqlite3_close( db );
+        return 2;
+    }
+
+    BenchCheck( db, rules, checks, damaged );
+
+    //
+    //  Fewer records, the plain matcher tries every rule on each.
+    //
+
+    if (most > rules) {
+
+        BenchCheck( db, most, checks / 10, damaged / 10 );
+    }
+
+    if (most != 0) {
+
+        printf( "Matching a file name, process path and both digests:\n" );
+
+        for (count = 10; count <= most; count *= 10) {
+
+            BenchMeasure( db, count, seconds );
+        }
+    }
+
+    sqlite3_close( db );
+    free( Bench.Rules );
+
+    return BenchSummary();
+}
@@ -0,0 +1,888 @@
+/*++
+
+Module Name:
+
+    mspySessionTest.c
+
+Abstract:
+
+    Checks and measures the handle session stage, user/mspySession.c, in
+    a Linux program against ushim, on synthetic traces.
+
+    mspySession.c is included rather than linked.  A trace is generated
+    first: threads of a few processes open handles, read, write and query
+    through them, then clean up and close them, with FileObjects reused
+    once closed as pool memory is.  Some creates fail, some creates and
+    closes are dropped as the filter drops records when its buffers are
+    full, some reads and writes are paging I/O, and some operations fail
+    or end with a warning.  Every so often nothing happens for longer
+    than SESSION_IDLE_TIMEOUT, or a handle goes on exactly that long
+    after its last record, and once a process opens more handles than
+    SESSION_MAX_OPEN without touching them again.
+
+    The trace is run through SessionAdd into HandleSessions, reopening
+    the insert partway as the writer does when it moves to a new
+    database, and through a plain model written here: one session per
+    FileObject in a table as large as needed, that ends the least
+    recently used one when SESSION_MAX_OPEN are open.  Every row must
+    match, field by field, with every reason a session ends seen.
+
+    The measurements run the trace again with the inserts off and on and
+    print ns a record, and the records a session row stands for.
+
+    It returns 1 when a check fails.
+
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspySessionTest mspySessionTest.c -lsqlite3
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ushim/ushimLog.c"
+#include "../user/mspySession.c"
+#include "mspyBench.h"
+
+#define BENCH_PROCESSES         32
+#define BENCH_NAMES             20000
+#define BENCH_SLOTS             65536
+#define BENCH_LEAKED            (SESSION_MAX_OPEN + 4000)
+#define BENCH_TEXT_SIZE         96
+#define BENCH_FILE_OBJECT(s)    (0xFFFFA00000000000ULL + (ULONGLONG)(s) * 0x160)
+
+#define STATUS_END_OF_FILE_BENCH        0xC0000011
+#define STATUS_ACCESS_DENIED_BENCH      0xC0000022
+#define STATUS_BUFFER_OVERFLOW_BENCH    0x80000005
+
+//
+//  A record of the trace, expanded into RECORD_DATA as it is replayed.
+//
+
+typedef struct _BENCH_EVENT {
+
+    LONGLONG Time;
+    ULONG Slot;
+    USHORT Process;
+    UCHAR MajorId;
+    UCHAR Paging;
+    ULONG Name;
+    ULONG Status;
+    ULONG Information;
+
+} BENCH_EVENT, *PBENCH_EVENT;
+
+//
+//  A handle of the generator.
+//
+
+typedef struct _BENCH_HANDLE {
+
+    ULONG Slot;
+    USHORT Process;
+    BOOLEAN CleanedUp;
+    ULONG Name;
+    ULONG OpsLeft;
+
+} BENCH_HANDLE, *PBENCH_HANDLE;
+
+//
+//  A session of the model, one per FileObject slot.
+//
+
+typedef struct _MODEL_SESSION {
+
+    BOOLEAN Open;
+    BOOLEAN CreateSeen;
+    BOOLEAN CleanupSeen;
+    ULONG Position;         // in Model.OpenSlots
+    USHORT Process;
+    ULONG Name;
+
+    LONGLONG OpenTime;
+    LONGLONG CleanupTime;
+    LONGLONG LastTime;
+    ULONGLONG Touched;      // event number of the last record applied
+
+    ULONGLONG Reads;
+    ULONGLONG Writes;
+    ULONGLONG OtherOps;
+    ULONGLONG Errors;
+    ULONGLONG BytesRead;
+    ULONGLONG BytesWritten;
+
+} MODEL_SESSION, *PMODEL_SESSION;
+
+typedef struct _BENCH_STATE {
+
+    char Names[BENCH_NAMES][BENCH_TEXT_SIZE];
+    char Processes[BENCH_PROCESSES][BENCH_TEXT_SIZE];
+
+    PBENCH_EVENT Events;
+    ULONG EventCount;
+    BOOLEAN ExactNext;
+
+} BENCH_STATE;
+
+typedef struct _MODEL_STATE {
+
+    MODEL_SESSION Sessions[BENCH_SLOTS];
+    ULONG OpenSlots[BENCH_SLOTS];
+    ULONG OpenCount;
+
+    //
+    //  No open session was last used before this time.
+    //
+
+    LONGLONG OldestBound;
+
+    sqlite3_stmt *Insert;
+
+} MODEL_STATE;
+
+static BENCH_STATE Bench;
+static MODEL_STATE Model;
+
+//---------------------------------------------------------------------------
+//  Trace
+//---------------------------------------------------------------------------
+
+static VOID
+BenchEmit (
+    _Inout_ LONGLONG *Time,
+    _In_ ULONG Slot,
+    _In_ USHORT Process,
+    _In_ ULONG Name,
+    _In_ UCHAR MajorId,
+    _In_ UCHAR Paging,
+    _In_ ULONG Status,
+    _In_ ULONG Information
+    )
+{
+    PBENCH_EVENT event = &Bench.Events[Bench.EventCount++];
+
+    //
+    //  Times move on by at least a tick, so no two records share one.
+    //
+
+    *Time += Bench.ExactNext ? 1 : 1 + BenchBelow( 20000 );
+    Bench.ExactNext = FALSE;
+
+    event->Time = *Time;
+    event->Slot = Slot;
+    event->Process = Process;
+    event->MajorId = MajorId;
+    event->Paging = Paging;
+    event->Name = Name;
+    event->Status = Status;
+    event->Information = Information;
+}
+
+static VOID
+BenchEmitOperation (
+    _Inout_ LONGLONG *Time,
+    _In_ PBENCH_HANDLE Handle
+    )
+/*++
+
+Routine Description:
+
+    Emits one operation through a handle: mostly reads and writes, a
+    tenth of them paging I/O, with a few failures and warnings.
+
+--*/
+{
+    static const UCHAR majors[] = {
+
+        IRP_MJ_READ, IRP_MJ_READ, IRP_MJ_READ, IRP_MJ_READ, IRP_MJ_READ, IRP_MJ_READ, IRP_MJ_READ,
+        IRP_MJ_WRITE, IRP_MJ_WRITE, IRP_MJ_WRITE, IRP_MJ_WRITE, IRP_MJ_WRITE,
+        IRP_MJ_QUERY_INFORMATION, IRP_MJ_QUERY_INFORMATION, IRP_MJ_QUERY_INFORMATION,
+        IRP_MJ_SET_INFORMATION, IRP_MJ_DIRECTORY_CONTROL, IRP_MJ_FILE_SYSTEM_CONTROL,
+        IRP_MJ_LOCK_CONTROL, IRP_MJ_FLUSH_BUFFERS
+    };
+
+    UCHAR major = majors[BenchBelow( ARRAYSIZE( majors ) )];
+    UCHAR paging = 0;
+    ULONG status = 0;
+    ULONG roll = BenchBelow( 100 );
+
+    if ((major == IRP_MJ_READ || major == IRP_MJ_WRITE) && BenchBelow( 10 ) == 0) {
+
+        paging = 1;
+    }
+
+    if (roll < 3) {
+
+        status = STATUS_ACCESS_DENIED_BENCH;
+
+    } else if (roll < 5 && major == IRP_MJ_READ) {
+
+        status = STATUS_END_OF_FILE_BENCH;
+
+    } else if (roll < 7) {
+
+        status = STATUS_BUFFER_OVERFLOW_BENCH;
+    }
+
+    //
+    //  Information is set on failures too, it must not be counted.
+    //
+
+    BenchEmit( Time, Handle->Slot, Handle->Process, Handle->Name, major, paging, status, BenchBelow( 65536 ) );
+}
+
+static BOOLEAN
+BenchGenerate (
+    _In_ ULONG Count,
+    _In_ ULONG Concurrent
+    )
+/*++
+
+Routine Description:
+
+    Generates a trace of about Count records with about Concurrent
+    handles open at once.
+
+--*/
+{
+    PBENCH_HANDLE handles;
+    PBENCH_HANDLE handle;
+    ULONG *freeSlots;
+    ULONG freeCount = 0;
+    ULONG live = 0;
+    ULONG slot;
+    ULONG index;
+    ULONG leaker;
+    BOOLEAN leaked = FALSE;
+    LONGLONG time = 132000000000000000LL;
+
+    Bench.Events = malloc( (Count + BENCH_LEAKED + 16) * sizeof( BENCH_EVENT ) );
+    handles = malloc( (Concurrent + BENCH_LEAKED + 1) * sizeof( BENCH_HANDLE ) );
+    freeSlots = malloc( BENCH_SLOTS * sizeof( ULONG ) );
+
+    if (Bench.Events == NULL || handles == NULL || freeSlots == NULL) {
+
+        free( handles );
+        free( freeSlots );
+        return FALSE;
+    }
+
+    for (slot = BENCH_SLOTS; slot-- > 0;) {
+
+        freeSlots[freeCount++] = slot;
+    }
+
+    Bench.EventCount = 0;
+
+    while (Bench.EventCount < Count) {
+
+        //
+        //  Once in a while nothing happens for longer than the idle
+        //  timeout, and once a process opens more handles than the table
+        //  holds and leaves them.
+        //
+
+        if (BenchBelow( 100000 ) == 0) {
+
+            time += SESSION_IDLE_TIMEOUT + BenchBelow( 1000000000 );
+
+        } else if (BenchBelow( 100000 ) == 0 && Bench.EventCount != 0) {
+
+            //
+            //  The handle of the last record goes on exactly the idle
+            //  timeout later, its session must not have ended.
+            //
+
+            for (index = 0; index < live; index++) {
+
+                handle = &handles[index];
+
+                if (handle->Slot == Bench.Events[Bench.EventCount - 1].Slot && handle->OpsLeft > 0) {
+
+                    time += SESSION_IDLE_TIMEOUT - 1;
+                    Bench.ExactNext = TRUE;
+
+                    BenchEmitOperation( &time, handle );
+                    handle->OpsLeft--;
+                    break;
+                }
+            }
+
+            continue;
+        }
+
+        if (!leaked && Bench.EventCount >= Count / 2) {
+
+            leaked = TRUE;
+            leaker = BenchBelow( BENCH_PROCESSES );
+
+            for (index = 0; index < BENCH_LEAKED && freeCount > 0; index++) {
+
+                handle = &handles[live++];
+                handle->Slot = freeSlots[--freeCount];
+                handle->Process = (USHORT)leaker;
+                handle->Name = BenchBelow( BENCH_NAMES );
+                handle->OpsLeft = 0;
+                handle->CleanedUp = FALSE;
+
+                BenchEmit( &time, handle->Slot, handle->Process, handle->Name, IRP_MJ_CREATE, 0, 0, 1 );
+            }
+        }
+
+        if (live == 0 || (live < Concurrent && BenchBelow( 8 ) == 0)) {
+
+            if (freeCount == 0) {
+
+                continue;
+            }
+
+            handle = &handles[live];
+            handle->Slot = freeSlots[--freeCount];
+            handle->Process = (USHORT)BenchBelow( BENCH_PROCESSES );
+            handle->Name = BenchBelow( BENCH_NAMES );
+            handle->OpsLeft = BenchBelow( 24 );
+            handle->CleanedUp = FALSE;
+
+            if (BenchBelow( 20 ) == 0) {
+
+                //
+                //  A failed create, the FileObject is freed at once.
+                //
+
+                BenchEmit( &time, handle->Slot, handle->Process, handle->Name, IRP_MJ_CREATE, 0, STATUS_ACCESS_DENIED_BENCH, 0 );
+                freeSlots[freeCount++] = handle->Slot;
+                continue;
+            }
+
+            if (BenchBelow( 100 ) != 0) {
+
+                BenchEmit( &time, handle->Slot, handle->Process, handle->Name, IRP_MJ_CREATE, 0, 0, 1 );
+            }
+
+            live++;
+            continue;
+        }
+
+        index = BenchBelow( live );
+        handle = &handles[index];
+
+        if (handle->OpsLeft > 0) {
+
+            BenchEmitOperation( &time, handle );
+            handle->OpsLeft--;
+
+        } else if (!handle->CleanedUp) {
+
+            BenchEmit( &time, handle->Slot, handle->Process, handle->Name, IRP_MJ_CLEANUP, 0, 0, 0 );
+            handle->CleanedUp = TRUE;
+
+        } else {
+
+            //
+            //  The close, dropped now and then.  The FileObject is freed
+            //  either way.
+            //
+
+            if (BenchBelow( 50 ) != 0) {
+
+                BenchEmit( &time, handle->Slot, handle->Process, handle->Name, IRP_MJ_CLOSE, 0, 0, 0 );
+            }
+
+            freeSlots[freeCount++] = handle->Slot;
+            handles[index] = handles[--live];
+        }
+    }
+
+    free( handles );
+    free( freeSlots );
+    return TRUE;
+}
+
+static VOID
+BenchExpand (
+    _In_ PBENCH_EVENT Event,
+    _Out_ PRECORD_DATA RecordData
+    )
+{
+    memset( RecordData, 0, sizeof( *RecordData ) );
+
+    RecordData->OriginatingTime.QuadPart = Event->Time;
+    RecordData->CompletionTime.QuadPart = Event->Time + 10;
+    RecordData->FileObject = (FILE_ID)BENCH_FILE_OBJECT( Event->Slot );
+    RecordData->ProcessId = (FILE_ID)(ULONG_PTR)(1000 + 4 * Event->Process);
+    RecordData->ThreadId = (FILE_ID)(ULONG_PTR)(2000 + 4 * Event->Process);
+    RecordData->Information = Event->Information;
+    RecordData->Status = (NTSTATUS)Event->Status;
+    RecordData->IrpFlags = Event->Paging ? IRP_PAGING_IO : 0;
+    RecordData->CallbackMajorId = Event->MajorId;
+}
+
+//---------------------------------------------------------------------------
+//  Model
+//---------------------------------------------------------------------------
+
+static VOID
+ModelEnd (
+    _In_ ULONG Slot,
+    _In_z_ const char *Reason,
+    _In_ LONGLONG CloseTime
+    )
+{
+    PMODEL_SESSION session = &Model.Sessions[Slot];
+    sqlite3_stmt *stmt = Model.Insert;
+    char fileObject[32];
+    ULONG last;
+
+    sprintf_s( fileObject, sizeof( fileObject ), "%p", (void*)(ULONG_PTR)BENCH_FILE_OBJECT( Slot ) );
+
+    sqlite3_bind_text( stmt, 1, fileObject, -1, SQLITE_TRANSIENT );
+    sqlite3_bind_int64( stmt, 2, 1000 + 4 * session->Process );
+    sqlite3_bind_text( stmt, 3, Bench.Processes[session->Process], -1, SQLITE_STATIC );
+    sqlite3_bind_text( stmt, 4, Bench.Names[session->Name], -1, SQLITE_STATIC );
+    sqlite3_bind_int64( stmt, 5, session->OpenTime );
+
+    if (session->CleanupSeen) {
+
+        sqlite3_bind_int64( stmt, 6, session->CleanupTime );
+
+    } else {
+
+        sqlite3_bind_null( stmt, 6 );
+    }
+
+    sqlite3_bind_int64( stmt, 7, CloseTime );
+    sqlite3_bind_int64( stmt, 8, CloseTime - session->OpenTime );
+    sqlite3_bind_int( stmt, 9, session->CreateSeen );
+    sqlite3_bind_text( stmt, 10, Reason, -1, SQLITE_STATIC );
+    sqlite3_bind_int64( stmt, 11, (sqlite3_int64)session->Reads );
+    sqlite3_bind_int64( stmt, 12, (sqlite3_int64)session->Writes );
+    sqlite3_bind_int64( stmt, 13, (sqlite3_int64)session->OtherOps );
+    sqlite3_bind_int64( stmt, 14, (sqlite3_int64)session->BytesRead );
+    sqlite3_bind_int64( stmt, 15, (sqlite3_int64)session->BytesWritten );
+    sqlite3_bind_int64( stmt, 16, (sqlite3_int64)session->Errors );
+
+    sqlite3_step( stmt );
+    sqlite3_reset( stmt );
+
+    last = Model.OpenSlots[--Model.OpenCount];
+    Model.OpenSlots[session->Position] = last;
+    Model.Sessions[last].Position = session->Position;
+
+    memset( session, 0, sizeof( *session ) );
+}
+
+static ULONG
+ModelLeastRecent (
+    VOID
+    )
+{
+    ULONG best = Model.OpenSlots[0];
+    ULONG index;
+
+    for (index = 1; index < Model.OpenCount; index++) {
+
+        if (Model.Sessions[Model.OpenSlots[index]].Touched < Model.Sessions[best].Touched) {
+
+            best = Model.OpenSlots[index];
+        }
+    }
+
+    return best;
+}
+
+static VOID
+ModelBegin (
+    _In_ PBENCH_EVENT Event,
+    _In_ ULONGLONG Number,
+    _In_ BOOLEAN CreateSeen
+    )
+{
+    PMODEL_SESSION session = &Model.Sessions[Event->Slot];
+    ULONG oldest;
+
+    if (Model.OpenCount == SESSION_MAX_OPEN) {
+
+        oldest = ModelLeastRecent();
+        ModelEnd( oldest, "Evicted", Model.Sessions[oldest].LastTime );
+    }
+
+    session->Open = TRUE;
+    session->CreateSeen = CreateSeen;
+    session->Process = Event->Process;
+    session->Name = Event->Name;
+    session->OpenTime = Event->Time;
+    session->LastTime = Event->Time;
+    session->Touched = Number;
+    session->Position = Model.OpenCount;
+
+    Model.OpenSlots[Model.OpenCount++] = Event->Slot;
+}
+
+static VOID
+ModelAdd (
+    _In_ PBENCH_EVENT Event,
+    _In_ ULONGLONG Number
+    )
+/*++
+
+Routine Description:
+
+    What SessionAdd should do with a record, written plainly.  Times in a
+    trace only go forward, so the least recently used session is also the
+    one with the oldest LastTime.
+
+--*/
+{
+    PMODEL_SESSION session = &Model.Sessions[Event->Slot];
+    BOOLEAN failed = (Event->Status >= 0xC0000000);
+    ULONG oldest;
+
+    while (Model.OpenCount != 0 && Model.OldestBound + SESSION_IDLE_TIMEOUT < Event->Time) {
+
+        oldest = ModelLeastRecent();
+
+        if (Model.Sessions[oldest].LastTime + SESSION_IDLE_TIMEOUT >= Event->Time) {
+
+            Model.OldestBound = Model.Sessions[oldest].LastTime;
+            break;
+        }
+
+        ModelEnd( oldest, "Idle", Model.Sessions[oldest].LastTime );
+    }
+
+    if (Model.OpenCount == 0) {
+
+        Model.OldestBound = Event->Time;
+    }
+
+    if (Event->MajorId == IRP_MJ_CREATE) {
+
+        if (failed) {
+
+            return;
+        }
+
+        if (session->Open) {
+
+            ModelEnd( Event->Slot, "Reused", session->LastTime );
+        }
+
+        ModelBegin( Event, Number, TRUE );
+        return;
+    }
+
+    if (!session->Open) {
+
+        if (Event->MajorId == IRP_MJ_CLOSE) {
+
+            return;
+        }
+
+        ModelBegin( Event, Number, FALSE );
+    }
+
+    session->LastTime = Event->Time;
+    session->Touched = Number;
+
+    if (failed) {
+
+        session->Errors++;
+    }
+
+    if (Event->MajorId == IRP_MJ_READ && !Event->Paging) {
+
+        session->Reads++;
+        session->BytesRead += failed ? 0 : Event->Information;
+
+    } else if (Event->MajorId == IRP_MJ_WRITE && !Event->Paging) {
+
+        session->Writes++;
+        session->BytesWritten += failed ? 0 : Event->Information;
+
+    } else if (Event->MajorId == IRP_MJ_CLOSE) {
+
+        ModelEnd( Event->Slot, "Close", Event->Time );
+
+    } else {
+
+        if (Event->MajorId == IRP_MJ_CLEANUP) {
+
+            session->CleanupSeen = TRUE;
+            session->CleanupTime = Event->Time;
+        }
+
+        session->OtherOps++;
+    }
+}
+
+//---------------------------------------------------------------------------
+//  Checks and measurements
+//---------------------------------------------------------------------------
+
+static ULONG
+BenchCount (
+    _In_ sqlite3 *Db,
+    _In_z_ const char *Sql
+    )
+{
+    sqlite3_stmt *stmt;
+    ULONG count = MAXULONG;
+
+    if (sqlite3_prepare_v2( Db, Sql, -1, &stmt, NULL ) == SQLITE_OK &&
+        sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        count = (ULONG)sqlite3_column_int64( stmt, 0 );
+    }
+
+    sqlite3_finalize( stmt );
+    return count;
+}
+
+static VOID
+BenchReplay (
+    _In_ ULONG From,
+    _In_ ULONG To
+    )
+{
+    RECORD_DATA recordData;
+    PBENCH_EVENT event;
+    ULONG index;
+
+    for (index = From; index < To; index++) {
+
+        event = &Bench.Events[index];
+        BenchExpand( event, &recordData );
+        SessionAdd( &recordData, Bench.Names[event->Name], Bench.Processes[event->Process] );
+    }
+}
+
+static VOID
+BenchCheck (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Replays the trace through SessionAdd and the model and compares the
+    rows each wrote.
+
+--*/
+{
+    static const char *reasons[] = { "Close", "Idle", "Evicted", "Reused", "Open" };
+    static const char *columns =
+        "FileObj, ProcessId, ProcessFilePath, OpFileName, OpenTime, CleanupTime, CloseTime, Duration,"
+        " CreateSeen, EndReason, Reads, Writes, OtherOps, BytesRead, BytesWritten, Errors";
+
+    char sql[1024];
+    char detail[128];
+    ULONG index;
+    ULONG count;
+    ULONG missing;
+    ULONG extra;
+    ULONG rows;
+
+    sqlite3_exec( Db,
+                  "CREATE TEMP TABLE Expected AS SELECT * FROM HandleSessions WHERE 0;"
+                  " BEGIN;",
+                  NULL, NULL, NULL );
+
+    snprintf( sql, sizeof( sql ), "INSERT INTO Expected (%s) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);", columns );
+
+    if (sqlite3_prepare_v2( Db, sql, -1, &Model.Insert, NULL ) != SQLITE_OK ||
+        !SessionPrepare( Db )) {
+
+        BenchFail( "prepare", sqlite3_errmsg( Db ) );
+        return;
+    }
+
+    //
+    //  The writer prepares the insert again on every connection it moves
+    //  to, the sessions carry over.
+    //
+
+    BenchReplay( 0, Bench.EventCount / 3 );
+    SessionFinalize();
+    SessionPrepare( Db );
+    BenchReplay( Bench.EventCount / 3, Bench.EventCount );
+    SessionEndAll();
+    SessionFinalize();
+
+    for (index = 0; index < Bench.EventCount; index++) {
+
+        ModelAdd( &Bench.Events[index], index + 1 );
+    }
+
+    while (Model.OpenCount != 0) {
+
+        count = ModelLeastRecent();
+        ModelEnd( count, "Open", Model.Sessions[count].LastTime );
+    }
+
+    sqlite3_finalize( Model.Insert );
+    Model.Insert = NULL;
+    sqlite3_exec( Db, "COMMIT;", NULL, NULL, NULL );
+
+    rows = BenchCount( Db, "SELECT COUNT(*) FROM HandleSessions;" );
+    count = BenchCount( Db, "SELECT COUNT(*) FROM Expected;" );
+
+    snprintf( sql, sizeof( sql ), "SELECT COUNT(*) FROM (SELECT %s FROM Expected EXCEPT SELECT %s FROM HandleSessions);", columns, columns );
+    missing = BenchCount( Db, sql );
+    snprintf( sql, sizeof( sql ), "SELECT COUNT(*) FROM (SELECT %s FROM HandleSessions EXCEPT SELECT %s FROM Expected);", columns, columns );
+    extra = BenchCount( Db, sql );
+
+    printf( "Checked %u records against the model: %u sessions, %u expected\n", Bench.EventCount, rows, count );
+
+    BenchCommon.Checks += count;
+
+    if (rows != count || missing != 0 || extra != 0) {
+
+        snprintf( detail, sizeof( detail ), "%u rows, %u expected, %u missing or wrong, %u not expected", rows, count, missing, extra );
+        BenchFail( "sessions written", detail );
+    }
+
+    for (index = 0; index < ARRAYSIZE( reasons ); index++) {
+
+        snprintf( sql, sizeof( sql ), "SELECT COUNT(*) FROM HandleSessions WHERE EndReason = '%s';", reasons[index] );
+        count = BenchCount( Db, sql );
+
+        printf( "    %-8s %u\n", reasons[index], count );
+
+        BenchCommon.Checks++;
+
+        if (count == 0 || count == MAXULONG) {
+
+            BenchFail( "sessions ending with every reason", reasons[index] );
+        }
+    }
+
+    sqlite3_exec( Db, "DROP TABLE Expected; DELETE FROM HandleSessions;", NULL, NULL, NULL );
+}
+
+static VOID
+BenchMeasure (
+    _In_ sqlite3 *Db
+    )
+{
+    long long start;
+    double stateOnly;
+    double withRows;
+    ULONG rows;
+
+    start = BenchNow();
+    BenchReplay( 0, Bench.EventCount );
+    SessionEndAll();
+    stateOnly = (double)(BenchNow() - start) / Bench.EventCount;
+
+    SessionPrepare( Db );
+    sqlite3_exec( Db, "BEGIN;", NULL, NULL, NULL );
+
+    start = BenchNow();
+    BenchReplay( 0, Bench.EventCount );
+    SessionEndAll();
+    sqlite3_exec( Db, "COMMIT;", NULL, NULL, NULL );
+    withRows = (double)(BenchNow() - start) / Bench.EventCount;
+
+    SessionFinalize();
+
+    rows = BenchCount( Db, "SELECT COUNT(*) FROM HandleSessions;" );
+
+    printf( "Replaying %u records:\n", Bench.EventCount );
+    printf( "    %.0f ns a record following sessions, %.0f ns with the rows written\n", stateOnly, withRows );
+    printf( "    %u session rows, one for %.1f records\n", rows, rows ? (double)Bench.EventCount / rows : 0.0 );
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    printf( "Usage: mspySessionTest [-n <records>] [-c <handles>] [-s <sql directory>]\n"
+            "\n"
+            "    [-n <records>] records in the trace, 2000000 by default\n"
+            "    [-c <handles>] handles open at once, 2000 by default\n"
+            "    [-s <sql directory>] where session.sql is, ../user by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    sqlite3 *db = NULL;
+    ULONG records = 2000000;
+    ULONG concurrent = 2000;
+    ULONG index;
+    int option;
+
+    while ((option = getopt( argc, argv, "n:c:s:" )) != -1) {
+
+        switch (option) {
+
+            case 'n':
+                records = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'c':
+                concurrent = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 's':
+                UshimSqlDirectory = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || records < 1000 || concurrent == 0 || concurrent > BENCH_SLOTS - BENCH_LEAKED - 1) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    for (index = 0; index < BENCH_PROCESSES; index++) {
+
+        snprintf( Bench.Processes[index], BENCH_TEXT_SIZE, "\\Device\\HarddiskVolume2\\Windows\\System32\\app%u.exe", index );
+    }
+
+    for (index = 0; index < BENCH_NAMES; index++) {
+
+        snprintf( Bench.Names[index], BENCH_TEXT_SIZE, "\\Device\\HarddiskVolume2\\Users\\bench\\dir%u\\file%05u.dat", index % 97, index );
+    }
+
+    if (sqlite3_open( ":memory:", &db ) != SQLITE_OK ||
+        ExecEmbeddedSQL( db, L"SESSION_SQL" ) != SQLITE_OK) {
+
+        printf( "Could not create the schema from %s\n", UshimSqlDirectory );
+        sqlite3_close( db );
+        return 2;
+    }
+
+    if (!BenchGenerate( records, concurrent )) {
+
+        printf( "Could not allocate a trace of %u records\n", records );
+        sqlite3_close( db );
+        return 2;
+    }
+
+    BenchCheck( db );
+    BenchMeasure( db );
+
+    sqlite3_close( db );
+    free( Bench.Events );
+
+    return BenchSummary();
+}
@@ -0,0 +1,748 @@
+/*++
+
+Module Name:
+
+    mspyTopKTest.c
+
+Abstract:
+
+    Checks the accuracy of the busiest process and file rankings,
+    user/mspyTopK.c, and measures them, in a Linux program against ushim.
+
+    mspyTopK.c is included rather than linked.  Windows of records are
+    generated with processes and files picked by Zipf rank, reads and
+    writes moving random byte counts, some of them failing, and latencies
+    with a long tail, some not seen.  Each record goes through TopKAdd
+    while the exact weight of every process and file is counted here, and
+    the TopTalkers rows of each window are checked against the exact
+    weights as Space-Saving promises:
+
+        WindowTotal is the sum of the metric over the window;
+
+        Value is never under the true weight, and Value - Error never
+        over it;
+
+        ranks run from 1 by Value, and a key left out of the top weighs
+        no more than the last Value reported or, when it was not held at
+        all, 1/TOPK_COUNTERS of the total.
+
+    File names longer than TOPK_KEY_SIZE bytes, with multibyte characters
+    around the cut, must share a counter and be cut at a character, in
+    the rows and in the shorter names kept for /k.
+
+    It prints, for each ranking and Zipf exponent, how many of the true
+    top TOPK_REPORT were reported and the mean error of their Value, and
+    the ns TopKAdd takes a record.
+
+    It returns 1 when a check fails.
+
+    Built on its own, for instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -o mspyTopKTest mspyTopKTest.c -lsqlite3 -lm
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ushim/ushimLog.c"
+#include "../user/mspyTopK.c"
+#include "mspyBench.h"
+
+#define BENCH_PROCESSES         500
+#define BENCH_FILES             20000
+#define BENCH_TEXT_SIZE         96
+#define BENCH_FIRST_WINDOW      (132000000000000000LL - 132000000000000000LL % TOPK_WINDOW)
+
+typedef struct _BENCH_STATE {
+
+    char Processes[BENCH_PROCESSES][BENCH_TEXT_SIZE];
+    char Files[BENCH_FILES][BENCH_TEXT_SIZE];
+
+    double *ProcessCdf;
+    double *FileCdf;
+
+    //
+    //  Exact weights of the window being generated.
+    //
+
+    ULONGLONG ProcessWeight[TopKMetrics][BENCH_PROCESSES];
+    ULONGLONG FileWeight[TopKMetrics][BENCH_FILES];
+    ULONGLONG Total[TopKKinds][TopKMetrics];
+
+    //
+    //  Accuracy over every window checked, per ranking.
+    //
+
+    ULONG Windows;
+    ULONG TopFound[TopKKinds][TopKMetrics];
+    ULONG TopExpected[TopKKinds][TopKMetrics];
+    double RelativeError[TopKKinds][TopKMetrics];
+    ULONG Reported[TopKKinds][TopKMetrics];
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static VOID
+BenchZipf (
+    _Out_writes_(Count) double *Cdf,
+    _In_ ULONG Count,
+    _In_ double Exponent
+    )
+{
+    double sum = 0;
+    ULONG rank;
+
+    for (rank = 0; rank < Count; rank++) {
+
+        sum += 1.0 / pow( rank + 1, Exponent );
+        Cdf[rank] = sum;
+    }
+
+    for (rank = 0; rank < Count; rank++) {
+
+        Cdf[rank] /= sum;
+    }
+}
+
+static ULONG
+BenchPick (
+    _In_reads_(Count) const double *Cdf,
+    _In_ ULONG Count
+    )
+{
+    double u = (BenchRandom() >> 11) * (1.0 / 9007199254740992.0);
+    ULONG low = 0;
+    ULONG high = Count - 1;
+    ULONG middle;
+
+    while (low < high) {
+
+        middle = (low + high) / 2;
+
+        if (Cdf[middle] < u) {
+
+            low = middle + 1;
+
+        } else {
+
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static VOID
+BenchRecord (
+    _In_ LONGLONG Time,
+    _Out_ PRECORD_DATA RecordData,
+    _Out_ PULONG Process,
+    _Out_ PULONG File
+    )
+/*++
+
+Routine Description:
+
+    Makes one record.  Ranks are spread over the ids, so the busiest are
+    not the first ones.
+
+--*/
+{
+    ULONG roll = BenchBelow( 100 );
+
+    *Process = (BenchPick( Bench.ProcessCdf, BENCH_PROCESSES ) * 7919) % BENCH_PROCESSES;
+    *File = (BenchPick( Bench.FileCdf, BENCH_FILES ) * 7919) % BENCH_FILES;
+
+    memset( RecordData, 0, sizeof( *RecordData ) );
+
+    RecordData->OriginatingTime.QuadPart = Time;
+    RecordData->ProcessId = (FILE_ID)(ULONG_PTR)(1000 + 4 * *Process);
+    RecordData->CallbackMajorId = (roll < 40) ? IRP_MJ_READ :
+                                  (roll < 65) ? IRP_MJ_WRITE :
+                                  (roll < 85) ? IRP_MJ_QUERY_INFORMATION : IRP_MJ_CREATE;
+    RecordData->Status = (BenchBelow( 30 ) == 0) ? (NTSTATUS)0xC0000022 :
+                         (BenchBelow( 30 ) == 0) ? (NTSTATUS)0x80000005 : 0;
+    RecordData->Information = BenchBelow( 4 ) ? BenchBelow( 65536 ) : BenchBelow( 1 << 24 );
+
+    //
+    //  Latency: mostly tens of microseconds, now and then milliseconds,
+    //  and none when the completion was not seen.
+    //
+
+    if (BenchBelow( 20 ) != 0) {
+
+        RecordData->CompletionTime.QuadPart = Time + 1 + BenchBelow( 500 ) *
+                                              ((BenchBelow( 50 ) == 0) ? 100 : 1);
+    }
+}
+
+static VOID
+BenchCount (
+    _In_ PRECORD_DATA RecordData,
+    _In_ ULONG Process,
+    _In_ ULONG File
+    )
+/*++
+
+Routine Description:
+
+    Counts the exact weights of a record.
+
+--*/
+{
+    LONGLONG time = RecordData->OriginatingTime.QuadPart;
+    ULONGLONG weights[TopKMetrics];
+    ULONG metric;
+
+    weights[TopKOps] = 1;
+    weights[TopKBytes] = ((RecordData->CallbackMajorId == IRP_MJ_READ || RecordData->CallbackMajorId == IRP_MJ_WRITE) &&
+                          (ULONG)RecordData->Status < 0xC0000000) ? RecordData->Information : 0;
+    weights[TopKLatency] = (RecordData->CompletionTime.QuadPart != 0) ? RecordData->CompletionTime.QuadPart - time : 0;
+
+    for (metric = 0; metric < TopKMetrics; metric++) {
+
+        Bench.ProcessWeight[metric][Process] += weights[metric];
+        Bench.FileWeight[metric][File] += weights[metric];
+        Bench.Total[TopKProcess][metric] += weights[metric];
+        Bench.Total[TopKFile][metric] += weights[metric];
+    }
+}
+
+static int
+BenchCompareDescending (
+    _In_ const void *A,
+    _In_ const void *B
+    )
+{
+    ULONGLONG a = *(const ULONGLONG *)A;
+    ULONGLONG b = *(const ULONGLONG *)B;
+
+    return (a < b) ? 1 : (a > b) ? -1 : 0;
+}
+
+static BOOLEAN
+BenchKeyOf (
+    _In_ TOPK_KIND Kind,
+    _In_ sqlite3_stmt *Row,
+    _Out_ PULONG Key
+    )
+{
+    const char *name = (const char *)sqlite3_column_text( Row, 2 );
+    ULONG index;
+
+    if (Kind == TopKProcess) {
+
+        index = (ULONG)((sqlite3_column_int64( Row, 1 ) - 1000) / 4);
+
+        if (index >= BENCH_PROCESSES || strcmp( name, Bench.Processes[index] ) != 0) {
+
+            return FALSE;
+        }
+
+    } else {
+
+        name = strstr( name, "file" );
+
+        if (name == NULL || sscanf( name, "file%u.dat", &index ) != 1 || index >= BENCH_FILES) {
+
+            return FALSE;
+        }
+    }
+
+    *Key = index;
+    return TRUE;
+}
+
+static VOID
+BenchCheckRanking (
+    _In_ sqlite3 *Db,
+    _In_ LONGLONG WindowStart,
+    _In_ TOPK_KIND Kind,
+    _In_ TOPK_METRIC Metric
+    )
+/*++
+
+Routine Description:
+
+    Checks the rows of one ranking of a window against the exact weights.
+
+--*/
+{
+    ULONG keys = (Kind == TopKProcess) ? BENCH_PROCESSES : BENCH_FILES;
+    const ULONGLONG *exact = (Kind == TopKProcess) ? Bench.ProcessWeight[Metric] : Bench.FileWeight[Metric];
+    static ULONGLONG sorted[BENCH_FILES];
+    BOOLEAN reported[BENCH_FILES];
+    ULONGLONG value;
+    ULONGLONG error;
+    ULONGLONG last = MAXULONGLONG;
+    ULONGLONG bound;
+    ULONGLONG tenth;
+    sqlite3_stmt *stmt;
+    ULONG rows = 0;
+    ULONG key;
+    ULONG index;
+    char detail[160];
+
+    memset( reported, 0, sizeof( reported ) );
+
+    sqlite3_prepare_v2( Db,
+                        "SELECT Rank, ProcessId, Name, Value, Error, WindowTotal FROM TopTalkers"
+                        " WHERE WindowStart = ? AND Kind = ? AND Metric = ? ORDER BY Rank;",
+                        -1, &stmt, NULL );
+    sqlite3_bind_int64( stmt, 1, WindowStart );
+    sqlite3_bind_text( stmt, 2, TopKKindNames[Kind], -1, SQLITE_STATIC );
+    sqlite3_bind_text( stmt, 3, TopKMetricNames[Metric], -1, SQLITE_STATIC );
+
+    snprintf( detail, sizeof( detail ), "%s by %s", TopKKindNames[Kind], TopKMetricNames[Metric] );
+
+    while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        value = (ULONGLONG)sqlite3_column_int64( stmt, 3 );
+        error = (ULONGLONG)sqlite3_column_int64( stmt, 4 );
+        rows++;
+
+        BenchCommon.Checks += 4;
+
+        if (sqlite3_column_int( stmt, 0 ) != (int)rows || value > last) {
+
+            BenchFail( "ranks in order of Value", detail );
+        }
+
+        if ((ULONGLONG)sqlite3_column_int64( stmt, 5 ) != Bench.Total[Kind][Metric]) {
+
+            BenchFail( "WindowTotal", detail );
+        }
+
+        if (!BenchKeyOf( Kind, stmt, &key )) {
+
+            BenchFail( "name of a ranked key", detail );
+            continue;
+        }
+
+        if (value < exact[key] || value - error > exact[key]) {
+
+            snprintf( detail + strlen( detail ), 64, ", key %u: %llu +%llu for %llu",
+                      key, (unsigned long long)value, (unsigned long long)error, (unsigned long long)exact[key] );
+            BenchFail( "Value - Error <= true weight <= Value", detail );
+        }
+
+        reported[key] = TRUE;
+        last = value;
+
+        Bench.RelativeError[Kind][Metric] += exact[key] ? (double)(value - exact[key]) / exact[key] : 0;
+        Bench.Reported[Kind][Metric]++;
+    }
+
+    sqlite3_finalize( stmt );
+
+    //
+    //  A key left out weighs no more than the last reported, if it was
+    //  held, or than the smallest counter, which is at most the total
+    //  over the counters.
+    //
+
+    bound = max( rows == TOPK_REPORT ? last : 0, Bench.Total[Kind][Metric] / TOPK_COUNTERS );
+
+    for (index = 0; index < keys; index++) {
+
+        if (!reported[index] && exact[index] > bound) {
+
+            BenchCommon.Checks++;
+            snprintf( detail + strlen( detail ), 64, ", key %u of %llu left out",
+                      index, (unsigned long long)exact[index] );
+            BenchFail( "heavy keys reported", detail );
+            break;
+        }
+    }
+
+    //
+    //  How many of the true top TOPK_REPORT were reported: the keys that
+    //  weigh more than the TOPK_REPORT-th heaviest, which no tie can push
+    //  out.
+    //
+
+    memcpy( sorted, exact, keys * sizeof( ULONGLONG ) );
+    qsort( sorted, keys, sizeof( ULONGLONG ), BenchCompareDescending );
+    tenth = sorted[TOPK_REPORT - 1];
+
+    for (index = 0; index < keys; index++) {
+
+        if (exact[index] > tenth) {
+
+            Bench.TopExpected[Kind][Metric]++;
+            Bench.TopFound[Kind][Metric] += reported[index];
+        }
+    }
+
+    BenchCommon.Checks++;
+
+    if (rows == 0 && Bench.Total[Kind][Metric] != 0) {
+
+        BenchFail( "a ranking written", detail );
+    }
+}
+
+static VOID
+BenchCheckWindow (
+    _In_ sqlite3 *Db,
+    _In_ LONGLONG WindowStart
+    )
+{
+    ULONG kind;
+    ULONG metric;
+
+    for (kind = 0; kind < TopKKinds; kind++) {
+
+        for (metric = 0; metric < TopKMetrics; metric++) {
+
+            BenchCheckRanking( Db, WindowStart, kind, metric );
+        }
+    }
+
+    memset( Bench.ProcessWeight, 0, sizeof( Bench.ProcessWeight ) );
+    memset( Bench.FileWeight, 0, sizeof( Bench.FileWeight ) );
+    memset( Bench.Total, 0, sizeof( Bench.Total ) );
+    Bench.Windows++;
+}
+
+static VOID
+BenchRun (
+    _In_ sqlite3 *Db,
+    _In_ double Exponent,
+    _In_ ULONG Windows,
+    _In_ ULONG PerWindow
+    )
+/*++
+
+Routine Description:
+
+    Runs Windows windows of PerWindow records through TopKAdd, checking
+    each window once the first record of the next one wrote it out.
+
+--*/
+{
+    static LONGLONG windowStart = BENCH_FIRST_WINDOW;
+    RECORD_DATA recordData;
+    LONGLONG spacing = TOPK_WINDOW / PerWindow;
+    LONGLONG time;
+    ULONG window;
+    ULONG record;
+    ULONG process;
+    ULONG file;
+
+    BenchZipf( Bench.ProcessCdf, BENCH_PROCESSES, Exponent );
+    BenchZipf( Bench.FileCdf, BENCH_FILES, Exponent );
+
+    memset( Bench.TopFound, 0, sizeof( Bench.TopFound ) );
+    memset( Bench.TopExpected, 0, sizeof( Bench.TopExpected ) );
+    memset( Bench.RelativeError, 0, sizeof( Bench.RelativeError ) );
+    memset( Bench.Reported, 0, sizeof( Bench.Reported ) );
+
+    for (window = 0; window < Windows; window++) {
+
+        for (record = 0; record < PerWindow; record++) {
+
+            time = windowStart + record * spacing + BenchBelow( (ULONG)spacing );
+
+            BenchRecord( time, &recordData, &process, &file );
+            TopKAdd( &recordData, Bench.Files[file], Bench.Processes[process] );
+
+            //
+            //  The first record of a window wrote out the last one.
+            //
+
+            if (record == 0 && window != 0) {
+
+                BenchCheckWindow( Db, windowStart - TOPK_WINDOW );
+                sqlite3_exec( Db, "DELETE FROM TopTalkers;", NULL, NULL, NULL );
+            }
+
+            BenchCount( &recordData, process, file );
+        }
+
+        windowStart += TOPK_WINDOW;
+    }
+
+    TopKEndWindow();
+    BenchCheckWindow( Db, windowStart - TOPK_WINDOW );
+    sqlite3_exec( Db, "DELETE FROM TopTalkers;", NULL, NULL, NULL );
+}
+
+static VOID
+BenchPrintAccuracy (
+    _In_ double Exponent
+    )
+{
+    ULONG kind;
+    ULONG metric;
+
+    printf( "Zipf exponent %.2f, %u processes and %u files:\n", Exponent, BENCH_PROCESSES, BENCH_FILES );
+
+    for (kind = 0; kind < TopKKinds; kind++) {
+
+        for (metric = 0; metric < TopKMetrics; metric++) {
+
+            printf( "    %-8s by %-8s %5.1f%% of the true top %u reported, Value %.3f%% over on average\n",
+                    TopKKindNames[kind],
+                    TopKMetricNames[metric],
+                    Bench.TopExpected[kind][metric] ? Bench.TopFound[kind][metric] * 100.0 / Bench.TopExpected[kind][metric] : 100.0,
+                    TOPK_REPORT,
+                    Bench.Reported[kind][metric] ? Bench.RelativeError[kind][metric] * 100 / Bench.Reported[kind][metric] : 0.0 );
+        }
+    }
+}
+
+static VOID
+BenchCheckLongNames (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Counts three names that only differ past TOPK_KEY_SIZE bytes, with a
+    3 byte character across the cut, in a window of their own.  A 2 byte
+    character also sits across the cut of the name kept for /k.
+
+--*/
+{
+    static LONGLONG windowStart = BENCH_FIRST_WINDOW - 100 * TOPK_WINDOW;
+    RECORD_DATA recordData;
+    char names[3][TOPK_KEY_SIZE + 64];
+    const char *text;
+    sqlite3_stmt *stmt;
+    ULONG index;
+    ULONG length;
+
+    for (index = 0; index < 3; index++) {
+
+        memset( names[index], 'a', TOPK_KEY_SIZE - 1 );
+
+        //
+        //  U+4E2D takes bytes TOPK_KEY_SIZE - 1 to TOPK_KEY_SIZE + 1.
+        //
+
+        memcpy( names[index] + TOPK_KEY_SIZE - 1, "\xE4\xB8\xAD", 3 );
+
+        //
+        //  U+00E9 takes bytes TOPK_NAME_SIZE - 2 and TOPK_NAME_SIZE - 1.
+        //
+
+        memcpy( names[index] + TOPK_NAME_SIZE - 2, "\xC3\xA9", 2 );
+        snprintf( names[index] + TOPK_KEY_SIZE + 2, 62, "tail%u", index );
+    }
+
+    for (index = 0; index < 30; index++) {
+
+        memset( &recordData, 0, sizeof( recordData ) );
+        recordData.OriginatingTime.QuadPart = windowStart + index;
+        recordData.CallbackMajorId = IRP_MJ_QUERY_INFORMATION;
+        TopKAdd( &recordData, names[index % 3], "long" );
+    }
+
+    TopKEndWindow();
+
+    sqlite3_prepare_v2( Db,
+                        "SELECT Name, Value FROM TopTalkers WHERE Kind = 'File' AND Metric = 'Ops';",
+                        -1, &stmt, NULL );
+
+    BenchCommon.Checks += 2;
+
+    if (sqlite3_step( stmt ) != SQLITE_ROW ||
+        sqlite3_column_int64( stmt, 1 ) != 30 ||
+        sqlite3_step( stmt ) != SQLITE_DONE) {
+
+        BenchFail( "long names sharing a counter", "not one row of 30" );
+
+    } else {
+
+        sqlite3_reset( stmt );
+        sqlite3_step( stmt );
+        text = (const char *)sqlite3_column_text( stmt, 0 );
+        length = (ULONG)sqlite3_column_bytes( stmt, 0 );
+
+        if (length != TOPK_KEY_SIZE - 1 || memcmp( text, names[0], length ) != 0) {
+
+            BenchFail( "long name cut at a character", "wrong length or bytes" );
+        }
+    }
+
+    sqlite3_finalize( stmt );
+    sqlite3_exec( Db, "DELETE FROM TopTalkers;", NULL, NULL, NULL );
+
+    BenchCommon.Checks++;
+
+    if (strlen( TopK.Reported.Entries[TopKFile][TopKOps][0].Name ) != TOPK_NAME_SIZE - 2 ||
+        memcmp( TopK.Reported.Entries[TopKFile][TopKOps][0].Name, names[0], TOPK_NAME_SIZE - 2 ) != 0) {
+
+        BenchFail( "long name cut at a character for /k", "wrong length or bytes" );
+    }
+}
+
+static VOID
+BenchMeasure (
+    _In_ double Exponent,
+    _In_ ULONG Records
+    )
+{
+    PRECORD_DATA records = malloc( Records * sizeof( RECORD_DATA ) );
+    PULONG processes = malloc( Records * sizeof( ULONG ) );
+    PULONG files = malloc( Records * sizeof( ULONG ) );
+    LONGLONG time = BENCH_FIRST_WINDOW + 1000 * TOPK_WINDOW;
+    long long start;
+    ULONG index;
+
+    if (records == NULL || processes == NULL || files == NULL) {
+
+        free( records );
+        free( processes );
+        free( files );
+        return;
+    }
+
+    BenchZipf( Bench.ProcessCdf, BENCH_PROCESSES, Exponent );
+    BenchZipf( Bench.FileCdf, BENCH_FILES, Exponent );
+
+    for (index = 0; index < Records; index++) {
+
+        time += 1 + BenchBelow( 1000 );
+        BenchRecord( time, &records[index], &processes[index], &files[index] );
+    }
+
+    start = BenchNow();
+
+    for (index = 0; index < Records; index++) {
+
+        TopKAdd( &records[index], Bench.Files[files[index]], Bench.Processes[processes[index]] );
+    }
+
+    TopKEndWindow();
+
+    printf( "    Exponent %.2f: %.0f ns a record\n", Exponent, (double)(BenchNow() - start) / Records );
+
+    free( records );
+    free( processes );
+    free( files );
+}
+
+static void
+BenchUsage (
+    VOID
+    )
+{
+    printf( "Usage: mspyTopKTest [-w <windows>] [-r <records>] [-m <records>] [-s <sql directory>]\n"
+            "\n"
+            "    [-w <windows>] windows checked for each exponent, 10 by default\n"
+            "    [-r <records>] records a window, 100000 by default\n"
+            "    [-m <records>] records measured for each exponent, 2000000 by default, 0 to skip\n"
+            "    [-s <sql directory>] where topk.sql is, ../user by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    static const double exponents[] = { 0.8, 1.0, 1.2, 1.5 };
+    sqlite3 *db = NULL;
+    ULONG windows = 10;
+    ULONG perWindow = 100000;
+    ULONG measured = 2000000;
+    ULONG index;
+    int option;
+
+    while ((option = getopt( argc, argv, "w:r:m:s:" )) != -1) {
+
+        switch (option) {
+
+            case 'w':
+                windows = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'r':
+                perWindow = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'm':
+                measured = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 's':
+                UshimSqlDirectory = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || windows == 0 || perWindow < 100 || perWindow > TOPK_WINDOW / 10) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    Bench.ProcessCdf = malloc( BENCH_PROCESSES * sizeof( double ) );
+    Bench.FileCdf = malloc( BENCH_FILES * sizeof( double ) );
+
+    for (index = 0; index < BENCH_PROCESSES; index++) {
+
+        snprintf( Bench.Processes[index], BENCH_TEXT_SIZE, "\\Device\\HarddiskVolume2\\Program Files\\app%u.exe", index );
+    }
+
+    for (index = 0; index < BENCH_FILES; index++) {
+
+        snprintf( Bench.Files[index], BENCH_TEXT_SIZE, "\\Device\\HarddiskVolume2\\Users\\bench\\dir%u\\file%u.dat", index % 97, index );
+    }
+
+    if (Bench.ProcessCdf == NULL || Bench.FileCdf == NULL ||
+        sqlite3_open( ":memory:", &db ) != SQLITE_OK ||
+        ExecEmbeddedSQL( db, L"TOPK_SQL" ) != SQLITE_OK ||
+        !TopKPrepare( db )) {
+
+        printf( "Could not create the schema from %s\n", UshimSqlDirectory );
+        sqlite3_close( db );
+        return 2;
+    }
+
+    BenchCheckLongNames( db );
+
+    for (index = 0; index < ARRAYSIZE( exponents ); index++) {
+
+        BenchRun( db, exponents[index], windows, perWindow );
+        BenchPrintAccuracy( exponents[index] );
+    }
+
+    if (measured != 0) {
+
+        TopKFinalize();
+        printf( "Counting in all six rankings, %u records for each exponent:\n", measured );
+
+        for (index = 0; index < ARRAYSIZE( exponents ); index++) {
+
+            BenchMeasure( exponents[index], measured );
+        }
+    }
+
+    printf( "%u windows\n", Bench.Windows );
+
+    TopKFinalize();
+    sqlite3_close( db );
+    free( Bench.ProcessCdf );
+    free( Bench.FileCdf );
+
+    return BenchSummary();
+}
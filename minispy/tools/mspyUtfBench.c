@@ -0,0 +1,609 @@
+/*++
+
+Module Name:
+
+    mspyUtfBench.c
+
+Abstract:
+
+    Checks and measures the client's UTF-16 to UTF-8 conversion,
+    user/mspyUtf.c, in a Linux program against the types in
+    ushim/windows.h.
+
+    mspyUtf.c is included rather than linked, so every way it converts
+    ASCII can be run on its own: unit at a time, 4 units in a word, SSE2
+    and, when the processor has it, AVX2.
+
+    The checks compare Utf16ToUtf8 on every path with a plain converter
+    written here:
+
+        every UTF-16 unit, at every position of an ASCII string long
+        enough to cross a block of every path;
+
+        every surrogate pair;
+
+        random strings of ASCII, 2 and 3 byte characters, surrogate pairs
+        and lone surrogates, converted into buffers of every size up to
+        the whole, which must receive the longest run of whole characters
+        that fits, terminated.
+
+    The measurements convert sets of file names, mostly ASCII, with some
+    accented Latin, mostly Chinese, and with emoji, as fast as each path
+    can, and print MB/s of UTF-16 read and ns a name, next to the plain
+    converter.
+
+    It returns 1 when a check fails.
+
+    Built on its own, for instance:
+
+        gcc -O2 -Iushim -o mspyUtfBench mspyUtfBench.c
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../user/mspyUtf.c"
+#include "mspyBench.h"
+
+#define BENCH_MAX_UNITS     600
+#define BENCH_MAX_BYTES     UTF8_NAME_SIZE( BENCH_MAX_UNITS )
+
+typedef struct _BENCH_PATH {
+
+    const char *Name;
+    UTF_ASCII_RUN Run;
+
+} BENCH_PATH;
+
+typedef struct _BENCH_NAMES {
+
+    const char *Name;
+    WCHAR *Units;
+    ULONG *Offsets;
+    ULONG *Lengths;
+    ULONG Count;
+    unsigned long long Bytes;
+
+} BENCH_NAMES;
+
+typedef struct _BENCH_STATE {
+
+    BENCH_PATH Paths[4];
+    int PathCount;
+
+    double Seconds;
+    ULONG NameCount;
+    int ChecksOnly;
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static ULONG
+BenchAsciiNone (
+    const WCHAR *Source,
+    ULONG Length,
+    UCHAR *Destination
+    )
+{
+    (void)Source;
+    (void)Length;
+    (void)Destination;
+
+    return 0;
+}
+
+static ULONG
+BenchReference (
+    const WCHAR *Source,
+    ULONG Length,
+    UCHAR *Destination,
+    ULONG *Ends
+    )
+/*++
+
+Routine Description:
+
+    Converts one unit or pair at a time, recording where each character
+    ends, so the expected result of a short buffer can be found.
+
+Return Value:
+
+    The characters converted.  Ends[i] is the bytes of the first i + 1.
+
+--*/
+{
+    ULONG used = 0;
+    ULONG count = 0;
+    ULONG index;
+    ULONG ch;
+
+    for (index = 0; index < Length; index++) {
+
+        ch = Source[index];
+
+        if (ch >= 0xD800 && ch <= 0xDBFF && index + 1 < Length &&
+            Source[index + 1] >= 0xDC00 && Source[index + 1] <= 0xDFFF) {
+
+            ch = 0x10000 + ((ch - 0xD800) << 10) + (Source[++index] - 0xDC00);
+
+        } else if (ch >= 0xD800 && ch <= 0xDFFF) {
+
+            ch = 0xFFFD;
+        }
+
+        if (ch < 0x80) {
+
+            Destination[used++] = (UCHAR)ch;
+
+        } else if (ch < 0x800) {
+
+            Destination[used++] = (UCHAR)(0xC0 | (ch >> 6));
+            Destination[used++] = (UCHAR)(0x80 | (ch & 0x3F));
+
+        } else if (ch < 0x10000) {
+
+            Destination[used++] = (UCHAR)(0xE0 | (ch >> 12));
+            Destination[used++] = (UCHAR)(0x80 | ((ch >> 6) & 0x3F));
+            Destination[used++] = (UCHAR)(0x80 | (ch & 0x3F));
+
+        } else {
+
+            Destination[used++] = (UCHAR)(0xF0 | (ch >> 18));
+            Destination[used++] = (UCHAR)(0x80 | ((ch >> 12) & 0x3F));
+            Destination[used++] = (UCHAR)(0x80 | ((ch >> 6) & 0x3F));
+            Destination[used++] = (UCHAR)(0x80 | (ch & 0x3F));
+        }
+
+        if (Ends != NULL) {
+
+            Ends[count] = used;
+        }
+
+        count++;
+    }
+
+    if (Ends == NULL) {
+
+        return used;
+    }
+
+    return count;
+}
+
+static void
+BenchCompare (
+    const BENCH_PATH *Path,
+    const WCHAR *Source,
+    ULONG Length,
+    ULONG Size
+    )
+/*++
+
+Routine Description:
+
+    Converts Source into a buffer of Size bytes on one path and checks the
+    result against the plain converter.
+
+--*/
+{
+    UCHAR expected[BENCH_MAX_BYTES];
+    ULONG ends[BENCH_MAX_UNITS];
+    char actual[BENCH_MAX_BYTES + 16];
+    ULONG characters;
+    ULONG fits = 0;
+    ULONG used;
+    ULONG index;
+
+    characters = BenchReference( Source, Length, expected, ends );
+
+    for (index = 0; index < characters && ends[index] + 1 <= Size; index++) {
+
+        fits = ends[index];
+    }
+
+    memset( actual, 0x5A, sizeof( actual ) );
+    UtfAsciiRun = Path->Run;
+    used = Utf16ToUtf8( Source, Length, actual, Size );
+
+    BenchCommon.Checks++;
+
+    if (used == fits && memcmp( actual, expected, fits ) == 0 &&
+        (Size == 0 || actual[used] == '\0') &&
+        (ULONG)(actual[Size] & 0xFF) == 0x5A) {
+
+        return;
+    }
+
+    if (BenchCommon.Failures++ < BENCH_MAX_FAILURES) {
+
+        printf( "FAILED %s: %u units into %u bytes gave %u bytes, expected %u:",
+                Path->Name, Length, Size, used, fits );
+
+        for (index = 0; index < Length && index < 40; index++) {
+
+            printf( " %04X", Source[index] );
+        }
+
+        printf( "%s\n", (Length > 40) ? " ..." : "" );
+    }
+}
+
+static void
+BenchCheck (
+    void
+    )
+{
+    WCHAR source[BENCH_MAX_UNITS];
+    ULONG length;
+    ULONG position;
+    ULONG unit;
+    ULONG size;
+    ULONG index;
+    int path;
+    int round;
+
+    for (path = 0; path < Bench.PathCount; path++) {
+
+        //
+        //  Every unit at every position of 80 units of ASCII
+        //
+
+        for (unit = 0; unit <= 0xFFFF; unit++) {
+
+            for (position = 0; position < 80; position += (unit < 0x100) ? 1 : 7) {
+
+                for (index = 0; index < 80; index++) {
+
+                    source[index] = (WCHAR)('a' + index % 26);
+                }
+
+                source[position] = (WCHAR)unit;
+                BenchCompare( &Bench.Paths[path], source, 80, BENCH_MAX_BYTES );
+            }
+        }
+
+        //
+        //  Every surrogate pair, behind 33 units of ASCII
+        //
+
+        for (unit = 0; unit < 33; unit++) {
+
+            source[unit] = '\\';
+        }
+
+        for (unit = 0xD800; unit <= 0xDBFF; unit++) {
+
+            for (index = 0xDC00; index <= 0xDFFF; index++) {
+
+                source[33] = (WCHAR)unit;
+                source[34] = (WCHAR)index;
+                source[35] = 'x';
+                BenchCompare( &Bench.Paths[path], source, 36, BENCH_MAX_BYTES );
+            }
+        }
+
+        //
+        //  Random strings into every buffer size
+        //
+
+        BenchCommon.Random = 88172645463325252ULL;
+
+        for (round = 0; round < 20000; round++) {
+
+            length = BenchRandom32() % 200;
+
+            for (index = 0; index < length; index++) {
+
+                unit = BenchRandom32() % 100;
+
+                source[index] = (unit < 70) ? (WCHAR)(0x20 + BenchRandom32() % 0x60) :
+                                (unit < 80) ? (WCHAR)(0x80 + BenchRandom32() % 0x780) :
+                                (unit < 90) ? (WCHAR)(0x800 + BenchRandom32() % 0xD000) :
+                                (unit < 97) ? (WCHAR)(0xD800 + BenchRandom32() % 0x400) :
+                                              (WCHAR)(0xDC00 + BenchRandom32() % 0x400);
+
+                if (unit >= 90 && unit < 96 && index + 1 < length) {
+
+                    source[++index] = (WCHAR)(0xDC00 + BenchRandom32() % 0x400);
+                }
+            }
+
+            for (size = 0; size <= length * 3 + 1; size++) {
+
+                BenchCompare( &Bench.Paths[path], source, length, size );
+            }
+        }
+    }
+
+    printf( "Checked %u conversions on %d paths: %u failed\n",
+            BenchCommon.Checks,
+            Bench.PathCount,
+            BenchCommon.Failures );
+}
+
+static void
+BenchAppend (
+    BENCH_NAMES *Names,
+    ULONG *Length,
+    const char *Text
+    )
+/*++
+
+Routine Description:
+
+    Appends UTF-8 text to the name being built, as UTF-16.
+
+--*/
+{
+    const UCHAR *text = (const UCHAR *)Text;
+    ULONG ch;
+
+    while (*text != '\0') {
+
+        if (*text < 0x80) {
+
+            ch = *text++;
+
+        } else if (*text < 0xE0) {
+
+            ch = ((text[0] & 0x1F) << 6) | (text[1] & 0x3F);
+            text += 2;
+
+        } else if (*text < 0xF0) {
+
+            ch = ((text[0] & 0x0F) << 12) | ((text[1] & 0x3F) << 6) | (text[2] & 0x3F);
+            text += 3;
+
+        } else {
+
+            ch = ((text[0] & 0x07) << 18) | ((text[1] & 0x3F) << 12) | ((text[2] & 0x3F) << 6) | (text[3] & 0x3F);
+            text += 4;
+        }
+
+        if (ch >= 0x10000) {
+
+            Names->Units[Names->Offsets[Names->Count] + (*Length)++] = (WCHAR)(0xD800 + ((ch - 0x10000) >> 10));
+            ch = 0xDC00 + ((ch - 0x10000) & 0x3FF);
+        }
+
+        Names->Units[Names->Offsets[Names->Count] + (*Length)++] = (WCHAR)ch;
+    }
+}
+
+static void
+BenchBuild (
+    BENCH_NAMES *Names,
+    const char *Name,
+    const char *const *Directories,
+    ULONG DirectoryCount,
+    const char *const *Files,
+    ULONG FileCount
+    )
+/*++
+
+Routine Description:
+
+    Builds a set of file names the way the filter logs them, a volume
+    device followed by directories and a file.
+
+--*/
+{
+    char number[32];
+    ULONG length;
+    ULONG depth;
+    ULONG index;
+
+    Names->Name = Name;
+    Names->Units = malloc( (size_t)Bench.NameCount * BENCH_MAX_UNITS * sizeof( WCHAR ) );
+    Names->Offsets = malloc( Bench.NameCount * sizeof( ULONG ) );
+    Names->Lengths = malloc( Bench.NameCount * sizeof( ULONG ) );
+
+    if (Names->Units == NULL || Names->Offsets == NULL || Names->Lengths == NULL) {
+
+        fprintf( stderr, "Out of memory\n" );
+        exit( 1 );
+    }
+
+    Names->Count = 0;
+    Names->Bytes = 0;
+
+    for (index = 0; index < Bench.NameCount; index++) {
+
+        Names->Offsets[index] = (index == 0) ? 0 : Names->Offsets[index - 1] + Names->Lengths[index - 1];
+        length = 0;
+
+        BenchAppend( Names, &length, "\\Device\\HarddiskVolume3" );
+
+        for (depth = 1 + BenchRandom32() % 6; depth > 0; depth--) {
+
+            BenchAppend( Names, &length, "\\" );
+            BenchAppend( Names, &length, Directories[BenchRandom32() % DirectoryCount] );
+        }
+
+        BenchAppend( Names, &length, "\\" );
+        BenchAppend( Names, &length, Files[BenchRandom32() % FileCount] );
+        sprintf( number, "%u", BenchRandom32() % 1000 );
+        BenchAppend( Names, &length, number );
+        BenchAppend( Names, &length, ".dat" );
+
+        Names->Lengths[index] = length;
+        Names->Bytes += length * sizeof( WCHAR );
+        Names->Count++;
+    }
+}
+
+static void
+BenchMeasure (
+    BENCH_NAMES *Names
+    )
+{
+    static char output[BENCH_MAX_BYTES];
+    unsigned long long names;
+    unsigned long long sink = 0;
+    long long start;
+    long long elapsed;
+    ULONG index;
+    int path;
+
+    for (path = -1; path < Bench.PathCount; path++) {
+
+        names = 0;
+        start = BenchNow();
+
+        do {
+
+            for (index = 0; index < Names->Count; index++) {
+
+                if (path < 0) {
+
+                    sink += BenchReference( Names->Units + Names->Offsets[index],
+                                            Names->Lengths[index],
+                                            (UCHAR *)output,
+                                            NULL );
+
+                } else {
+
+                    UtfAsciiRun = Bench.Paths[path].Run;
+                    sink += Utf16ToUtf8( Names->Units + Names->Offsets[index],
+                                         Names->Lengths[index],
+                                         output,
+                                         sizeof( output ) );
+                }
+            }
+
+            names += Names->Count;
+            elapsed = BenchNow() - start;
+
+        } while (elapsed < Bench.Seconds * 1e9);
+
+        printf( "  %-10s %-8s %8.0f MB/s %8.1f ns a name\n",
+                Names->Name,
+                (path < 0) ? "plain" : Bench.Paths[path].Name,
+                (double)Names->Bytes * (names / Names->Count) / 1048576.0 / (elapsed / 1e9),
+                (double)elapsed / names );
+    }
+
+    if (sink == 0) {
+
+        printf( "Nothing was converted\n" );
+    }
+}
+
+static void
+BenchUsage (
+    void
+    )
+{
+    printf( "Usage: mspyUtfBench [-c] [-s <seconds>] [-n <names>]\n"
+            "\n"
+            "    [-c] only runs the checks\n"
+            "    [-s <seconds>] measures every path on every set this long, 0.5 by default\n"
+            "    [-n <names>] names in a set, 4096 by default\n" );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    static const char *const asciiDirectories[] = {
+        "Windows", "System32", "Users", "Administrator", "AppData", "Local", "Temp",
+        "Program Files", "Microsoft", "Edge", "User Data", "Default", "Cache", "WinSxS" };
+    static const char *const asciiFiles[] = { "ntdll", "kernel32", "data_", "f_", "index", "log" };
+    static const char *const latinDirectories[] = {
+        "Users", "José", "Documents", "Résumés", "Bücher", "Übersicht", "Projects", "Année 2024" };
+    static const char *const latinFiles[] = { "Lebenslauf", "Café menu ", "notes", "Prévisions " };
+    static const char *const chineseDirectories[] = { "用户", "文档", "报告", "项目资料", "下载" };
+    static const char *const chineseFiles[] = { "年度报告", "会议记录", "照片" };
+    static const char *const emojiDirectories[] = { "Users", "Pictures", "📷 Camera", "Holiday 🌴" };
+    static const char *const emojiFiles[] = { "IMG_", "🎉 party ", "😀" };
+    BENCH_NAMES names[4];
+    int option;
+    int set;
+
+    Bench.Seconds = 0.5;
+    Bench.NameCount = 4096;
+
+    while ((option = getopt( argc, argv, "cs:n:" )) != -1) {
+
+        switch (option) {
+
+            case 'c':
+                Bench.ChecksOnly = 1;
+                break;
+
+            case 's':
+                Bench.Seconds = atof( optarg );
+                break;
+
+            case 'n':
+                Bench.NameCount = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (Bench.NameCount == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    Bench.Paths[Bench.PathCount].Name = "unit";
+    Bench.Paths[Bench.PathCount++].Run = BenchAsciiNone;
+    Bench.Paths[Bench.PathCount].Name = "word";
+    Bench.Paths[Bench.PathCount++].Run = UtfAsciiWord;
+
+#ifdef UTF_X64
+    Bench.Paths[Bench.PathCount].Name = "sse2";
+    Bench.Paths[Bench.PathCount++].Run = UtfAsciiSse2;
+
+    if (UtfHaveAvx2()) {
+
+        Bench.Paths[Bench.PathCount].Name = "avx2";
+        Bench.Paths[Bench.PathCount++].Run = UtfAsciiAvx2;
+
+    } else {
+
+        printf( "No AVX2, its path is neither checked nor measured\n" );
+    }
+#endif
+
+    BenchCheck();
+
+    if (Bench.ChecksOnly || BenchCommon.Failures != 0) {
+
+        return (BenchCommon.Failures != 0) ? 1 : 0;
+    }
+
+    BenchBuild( &names[0], "ascii", asciiDirectories, 14, asciiFiles, 6 );
+    BenchBuild( &names[1], "latin", latinDirectories, 8, latinFiles, 4 );
+    BenchBuild( &names[2], "chinese", chineseDirectories, 5, chineseFiles, 3 );
+    BenchBuild( &names[3], "emoji", emojiDirectories, 4, emojiFiles, 3 );
+
+    printf( "Converting %u names a set, %.1f s each:\n", Bench.NameCount, Bench.Seconds );
+
+    for (set = 0; set < 4; set++) {
+
+        BenchMeasure( &names[set] );
+        free( names[set].Units );
+        free( names[set].Offsets );
+        free( names[set].Lengths );
+    }
+
+    return 0;
+}
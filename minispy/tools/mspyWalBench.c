@@ -0,0 +1,664 @@
+/*++
+
+Module Name:
+
+    mspyWalBench.c
+
+Abstract:
+
+    Measures sustained ingest into the log database while dashboards read
+    it, in a Linux program built from the client's own modules against
+    ushim: the write ahead log and its checkpoint thread, user/mspyWal.c,
+    against SQLite checkpointing on commit, and with no readers against
+    several.
+
+    A writer thread logs buffers from the generator, user/mspyGen.c,
+    through ProcessLogBuffer as the logging thread does, one commit a
+    buffer, for as long as a run lasts.  Reader threads, each on a
+    connection of its own as the dashboard would be, run in a loop:
+
+        the totals from View_TotalOperations next to COUNT(*) of
+        MinifilterLog in one read transaction, which must agree since the
+        writer commits the summaries with the rows;
+
+        View_OperationBreakdown;
+
+        the operations of the last ten seconds logged, through
+        Index_MinifilterLog_Time;
+
+        the ten busiest processes from View_ProcessOpCounts.
+
+    Every run prints the rows written a second, the time to log and commit
+    a buffer at the 50th, 90th and 99th percentile and the longest, the
+    largest the WAL file got, the queries read a second with their 50th and
+    99th percentile, and the queries that found the database busy, and then
+    the module's own metrics as /m shows them.  It returns 1 when a reader
+    saw totals that did not agree with the rows, or a query failed.
+
+    The databases are written to a new directory in /tmp unless -o names
+    one, and the program works from there, so nothing lands in a real log.
+    The schema is read from ../user unless -s names the directory.
+
+    Built on its own with every client module but mspyUser.c, for
+    instance:
+
+        gcc -O2 -pthread -fshort-wchar -Wno-unknown-pragmas -Iushim -I../inc -I../user -o mspyWalBench mspyWalBench.c $(ls ../user/mspy*.c | grep -v mspyUser.c) -lsqlite3 -lm
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <windows.h>
+#include <sqlite3.h>
+#include "mspyLog.h"
+#include "mspyAlert.h"
+#include "mspyFileLog.h"
+#include "mspyGen.h"
+#include "mspyWal.h"
+#include "mspyBench.h"
+
+#define BENCH_MAX_READERS       32
+#define BENCH_MAX_SAMPLES       (1 << 20)
+#define BENCH_SEED              0x6d73707957616c00ULL
+#define BENCH_QUERIES           4
+
+typedef struct _BENCH_READER {
+
+    pthread_t Thread;
+    ULONG Index;
+
+    ULONG *Latency;         // microseconds
+    ULONG Samples;
+    ULONGLONG Queries;
+    ULONGLONG Busy;
+    ULONGLONG Failed;
+    ULONGLONG Inconsistent;
+
+} BENCH_READER, *PBENCH_READER;
+
+typedef struct _BENCH_RUN {
+
+    const char *Name;
+    BOOLEAN CheckpointThread;
+    ULONG Readers;
+
+} BENCH_RUN, *PBENCH_RUN;
+
+typedef struct _BENCH_STATE {
+
+    double Seconds;
+    ULONG Readers;
+    ULONG Records;
+
+    //
+    //  BufferCount buffers of BUFFER_SIZE bytes as GetMiniSpyLog fills
+    //  them, Filled[i] bytes of the i'th used, logged over and over.
+    //
+
+    PCHAR Buffers;
+    PDWORD Filled;
+    ULONG BufferCount;
+
+    char Database[MAX_PATH];
+    volatile int Started;
+    volatile int Stop;
+
+    ULONGLONG Rows;
+    ULONG *Batches;         // microseconds
+    ULONG BatchCount;
+
+    BENCH_READER Reader[BENCH_MAX_READERS];
+
+} BENCH_STATE;
+
+static BENCH_STATE Bench;
+
+static int
+BenchCompare (
+    const void *Left,
+    const void *Right
+    )
+{
+    ULONG left = *(const ULONG *)Left;
+    ULONG right = *(const ULONG *)Right;
+
+    return (left > right) - (left < right);
+}
+
+static BOOLEAN
+BenchBuildCorpus (
+    void
+    )
+/*++
+
+Routine Description:
+
+    Generates about Bench.Records records with the generator's default
+    configuration and BENCH_SEED, as mspyPerfBench does.
+
+--*/
+{
+    GEN_CONFIG config;
+    FILETIME now;
+    ULONG perBuffer;
+
+    GenDefaultConfig( &config );
+    config.Seed = BENCH_SEED;
+
+    perBuffer = BUFFER_SIZE / (ULONG)ROUND_TO_SIZE( sizeof( LOG_RECORD ) + ((config.NameMin + config.NameMax) / 2 + 1) * sizeof( WCHAR ),
+                                                    sizeof( PVOID ) );
+    Bench.BufferCount = (Bench.Records + perBuffer - 1) / perBuffer;
+
+    Bench.Buffers = malloc( (SIZE_T)Bench.BufferCount * BUFFER_SIZE );
+    Bench.Filled = malloc( Bench.BufferCount * sizeof( DWORD ) );
+
+    if (Bench.Buffers == NULL || Bench.Filled == NULL) {
+
+        return FALSE;
+    }
+
+    GetSystemTimeAsFileTime( &now );
+
+    return GenSample( &config,
+                      ((LONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime,
+                      Bench.Buffers,
+                      BUFFER_SIZE,
+                      Bench.BufferCount,
+                      Bench.Filled );
+}
+
+static void *
+BenchWrite (
+    void *Parameter
+    )
+/*++
+
+Routine Description:
+
+    The logging thread: logs the corpus a buffer at a time until told to
+    stop, timing every buffer from its first row to its commit.
+
+--*/
+{
+    LOG_CONTEXT context;
+    DWORD used;
+    long long start;
+    ULONG index = 0;
+
+    UNREFERENCED_PARAMETER( Parameter );
+
+    memset( &context, 0, sizeof( context ) );
+    context.LogToFile = TRUE;
+
+    while (!Bench.Stop) {
+
+        start = BenchNow();
+
+        ProcessLogBuffer( &context, Bench.Buffers + (SIZE_T)index * BUFFER_SIZE, Bench.Filled[index] );
+
+        if (Bench.BatchCount < BENCH_MAX_SAMPLES) {
+
+            Bench.Batches[Bench.BatchCount++] = (ULONG)((BenchNow() - start) / 1000);
+        }
+
+        used = 0;
+
+        while (NextLogRecord( Bench.Buffers + (SIZE_T)index * BUFFER_SIZE, Bench.Filled[index], &used ) != NULL) {
+
+            Bench.Rows++;
+        }
+
+        Bench.Started = 1;
+        index = (index + 1) % Bench.BufferCount;
+    }
+
+    DatabaseEndSessions();
+    DatabaseCloseLog();
+
+    return NULL;
+}
+
+static int
+BenchStep (
+    _In_ PBENCH_READER Reader,
+    _In_ sqlite3_stmt *Stmt,
+    _Out_opt_ sqlite3_int64 *Value
+    )
+{
+    int rc;
+
+    while ((rc = sqlite3_step( Stmt )) == SQLITE_ROW) {
+
+        if (Value != NULL) {
+
+            *Value = sqlite3_column_int64( Stmt, 0 );
+        }
+    }
+
+    sqlite3_reset( Stmt );
+
+    if (rc == SQLITE_BUSY) {
+
+        Reader->Busy++;
+
+    } else if (rc != SQLITE_DONE) {
+
+        Reader->Failed++;
+    }
+
+    return rc;
+}
+
+static void *
+BenchRead (
+    void *Parameter
+    )
+/*++
+
+Routine Description:
+
+    One dashboard: runs the queries in turn until told to stop.
+
+--*/
+{
+    static const char *queries[BENCH_QUERIES] = {
+        "SELECT TotalOperations FROM View_TotalOperations;",
+        "SELECT MajorOp, MinorOp, Count FROM View_OperationBreakdown;",
+        "SELECT COUNT(*) FROM MinifilterLog"
+        " WHERE PreOpTime >= (SELECT MAX(PreOpTime) FROM MinifilterLog) - 100000000;",
+        "SELECT * FROM View_ProcessOpCounts LIMIT 10;" };
+    PBENCH_READER reader = Parameter;
+    sqlite3_stmt *stmt[BENCH_QUERIES] = { NULL };
+    sqlite3_stmt *count = NULL;
+    sqlite3 *db = NULL;
+    sqlite3_int64 totals;
+    sqlite3_int64 rows;
+    long long start;
+    ULONG query;
+
+    if (sqlite3_open_v2( Bench.Database, &db, SQLITE_OPEN_READONLY, NULL ) != SQLITE_OK ||
+        sqlite3_prepare_v2( db, "SELECT COUNT(*) FROM MinifilterLog;", -1, &count, NULL ) != SQLITE_OK) {
+
+        reader->Failed++;
+        goto Exit;
+    }
+
+    sqlite3_busy_timeout( db, 5000 );
+
+    for (query = 0; query < BENCH_QUERIES; query++) {
+
+        if (sqlite3_prepare_v2( db, queries[query], -1, &stmt[query], NULL ) != SQLITE_OK) {
+
+            printf( "Could not prepare %s: %s\n", queries[query], sqlite3_errmsg( db ) );
+            reader->Failed++;
+            goto Exit;
+        }
+    }
+
+    for (query = reader->Index; !Bench.Stop; query = (query + 1) % BENCH_QUERIES) {
+
+        start = BenchNow();
+        totals = rows = -1;
+
+        if (query == 0) {
+
+            //
+            //  Both counts from one snapshot
+            //
+
+            if (sqlite3_exec( db, "BEGIN;", NULL, NULL, NULL ) != SQLITE_OK) {
+
+                reader->Failed++;
+                continue;
+            }
+
+            if (BenchStep( reader, stmt[0], &totals ) == SQLITE_DONE &&
+                BenchStep( reader, count, &rows ) == SQLITE_DONE &&
+                totals != rows) {
+
+                reader->Inconsistent++;
+            }
+
+            sqlite3_exec( db, "COMMIT;", NULL, NULL, NULL );
+
+        } else {
+
+            BenchStep( reader, stmt[query], NULL );
+        }
+
+        if (reader->Samples < BENCH_MAX_SAMPLES) {
+
+            reader->Latency[reader->Samples++] = (ULONG)((BenchNow() - start) / 1000);
+        }
+
+        reader->Queries++;
+    }
+
+Exit:
+
+    for (query = 0; query < BENCH_QUERIES; query++) {
+
+        sqlite3_finalize( stmt[query] );
+    }
+
+    sqlite3_finalize( count );
+    sqlite3_close( db );
+
+    return NULL;
+}
+
+static BOOLEAN
+BenchRun (
+    _In_ PBENCH_RUN Run,
+    _Out_ PULONGLONG Failures
+    )
+{
+    pthread_t writer;
+    struct stat status;
+    char wal[MAX_PATH + 8];
+    char base[64];
+    ULONG *latency;
+    ULONGLONG queries = 0;
+    ULONGLONG busy = 0;
+    ULONGLONG failed = 0;
+    ULONGLONG inconsistent = 0;
+    ULONGLONG walMax = 0;
+    ULONG samples = 0;
+    ULONG index;
+    long long start;
+    double seconds;
+
+    *Failures = 0;
+
+    snprintf( base, sizeof( base ), "wal-%s-%u", Run->CheckpointThread ? "thread" : "commit", Run->Readers );
+    snprintf( Bench.Database, sizeof( Bench.Database ), "%s.db", base );
+    snprintf( wal, sizeof( wal ), "%s-wal", Bench.Database );
+    DatabaseSetLocation( Bench.Database, base );
+
+    Bench.Started = 0;
+    Bench.Stop = 0;
+    Bench.Rows = 0;
+    Bench.BatchCount = 0;
+
+    if (Run->CheckpointThread && !WalStart()) {
+
+        printf( "Could not start the checkpoint thread\n" );
+        return FALSE;
+    }
+
+    if (pthread_create( &writer, NULL, BenchWrite, NULL ) != 0) {
+
+        WalStop();
+        return FALSE;
+    }
+
+    //
+    //  Readers open the database once the writer has made it
+    //
+
+    while (!Bench.Started) {
+
+        Sleep( 1 );
+    }
+
+    start = BenchNow();
+
+    for (index = 0; index < Run->Readers; index++) {
+
+        memset( &Bench.Reader[index], 0, sizeof( BENCH_READER ) );
+        Bench.Reader[index].Index = index;
+        Bench.Reader[index].Latency = malloc( BENCH_MAX_SAMPLES * sizeof( ULONG ) );
+
+        if (Bench.Reader[index].Latency == NULL ||
+            pthread_create( &Bench.Reader[index].Thread, NULL, BenchRead, &Bench.Reader[index] ) != 0) {
+
+            printf( "Could not start reader %u\n", index );
+            Bench.Stop = 1;
+            pthread_join( writer, NULL );
+            return FALSE;
+        }
+    }
+
+    //
+    //  The WAL is sampled as the writer and checkpoints change it
+    //
+
+    while ((seconds = (BenchNow() - start) / 1e9) < Bench.Seconds) {
+
+        if (stat( wal, &status ) == 0 && (ULONGLONG)status.st_size > walMax) {
+
+            walMax = (ULONGLONG)status.st_size;
+        }
+
+        Sleep( 10 );
+    }
+
+    Bench.Stop = 1;
+
+    for (index = 0; index < Run->Readers; index++) {
+
+        pthread_join( Bench.Reader[index].Thread, NULL );
+
+        queries += Bench.Reader[index].Queries;
+        busy += Bench.Reader[index].Busy;
+        failed += Bench.Reader[index].Failed;
+        inconsistent += Bench.Reader[index].Inconsistent;
+        samples += Bench.Reader[index].Samples;
+    }
+
+    pthread_join( writer, NULL );
+
+    qsort( Bench.Batches, Bench.BatchCount, sizeof( ULONG ), BenchCompare );
+
+    printf( "%s, %u readers:\n", Run->Name, Run->Readers );
+    printf( "    written      %10.0f rows/s in %u commits\n", Bench.Rows / seconds, Bench.BatchCount );
+
+    if (Bench.BatchCount != 0) {
+
+        printf( "    buffer (us)  p50 %u  p90 %u  p99 %u  max %u\n",
+                Bench.Batches[Bench.BatchCount / 2],
+                Bench.Batches[Bench.BatchCount * 9 / 10],
+                Bench.Batches[Bench.BatchCount * 99 / 100],
+                Bench.Batches[Bench.BatchCount - 1] );
+    }
+
+    printf( "    WAL          largest %llu KB\n", (unsigned long long)walMax / 1024 );
+
+    if (Run->Readers != 0) {
+
+        latency = malloc( (SIZE_T)samples * sizeof( ULONG ) );
+
+        if (latency != NULL && samples != 0) {
+
+            for (index = 0, samples = 0; index < Run->Readers; index++) {
+
+                memcpy( latency + samples, Bench.Reader[index].Latency, Bench.Reader[index].Samples * sizeof( ULONG ) );
+                samples += Bench.Reader[index].Samples;
+            }
+
+            qsort( latency, samples, sizeof( ULONG ), BenchCompare );
+
+            printf( "    read         %10.0f queries/s, p50 %u us  p99 %u us, %llu busy, %llu failed, %llu totals off\n",
+                    queries / seconds,
+                    latency[samples / 2],
+                    latency[(ULONGLONG)samples * 99 / 100],
+                    (unsigned long long)busy,
+                    (unsigned long long)failed,
+                    (unsigned long long)inconsistent );
+        }
+
+        free( latency );
+
+        for (index = 0; index < Run->Readers; index++) {
+
+            free( Bench.Reader[index].Latency );
+        }
+    }
+
+    WalPrintMetrics();
+    WalStop();
+
+    *Failures = failed + inconsistent;
+
+    return TRUE;
+}
+
+static void
+BenchUsage (
+    void
+    )
+{
+    printf( "Usage: mspyWalBench [-t <seconds>] [-r <readers>] [-n <records>] [-s <sql directory>] [-o <directory>]\n"
+            "\n"
+            "    [-t <seconds>] length of each run, 10 by default\n"
+            "    [-r <readers>] dashboards reading meanwhile, 4 by default, at most %d\n"
+            "    [-n <records>] records generated and logged over and over, 200000 by default\n"
+            "    [-s <sql directory>] where create.sql and the others are, ../user by default\n"
+            "    [-o <directory>] where the databases are written, a new directory in /tmp by default\n",
+            BENCH_MAX_READERS );
+}
+
+int
+main (
+    int argc,
+    char **argv
+    )
+{
+    BENCH_RUN runs[3] = {
+        { "Checkpoint thread", TRUE, 0 },
+        { "Checkpoint thread", TRUE, 0 },
+        { "Checkpoint on commit", FALSE, 0 } };
+    char directory[] = "/tmp/mspyWalBench.XXXXXX";
+    char resources[MAX_PATH];
+    const char *sql = "../user";
+    const char *output = NULL;
+    ULONGLONG failures;
+    ULONGLONG total = 0;
+    ULONG index;
+    int option;
+
+    Bench.Seconds = 10;
+    Bench.Readers = 4;
+    Bench.Records = 200000;
+
+    while ((option = getopt( argc, argv, "t:r:n:s:o:" )) != -1) {
+
+        switch (option) {
+
+            case 't':
+                Bench.Seconds = atof( optarg );
+                break;
+
+            case 'r':
+                Bench.Readers = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 'n':
+                Bench.Records = (ULONG)strtoul( optarg, NULL, 0 );
+                break;
+
+            case 's':
+                sql = optarg;
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                BenchUsage();
+                return 2;
+        }
+    }
+
+    if (optind != argc || Bench.Seconds <= 0 || Bench.Readers > BENCH_MAX_READERS || Bench.Records == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    runs[1].Readers = Bench.Readers;
+    runs[2].Readers = Bench.Readers;
+
+    //
+    //  The service log's name is fixed, so the program works from the
+    //  scratch directory and the schema directory is resolved first.
+    //
+
+    if (realpath( sql, resources ) == NULL) {
+
+        fprintf( stderr, "No schema directory %s\n", sql );
+        return 2;
+    }
+
+    setenv( "USHIM_RESOURCES", resources, 1 );
+
+    if (output == NULL) {
+
+        if (mkdtemp( directory ) == NULL) {
+
+            perror( "mkdtemp" );
+            return 1;
+        }
+
+        output = directory;
+    }
+
+    if (chdir( output ) != 0) {
+
+        perror( output );
+        return 1;
+    }
+
+    Bench.Batches = malloc( BENCH_MAX_SAMPLES * sizeof( ULONG ) );
+
+    if (Bench.Batches == NULL || !BenchBuildCorpus()) {
+
+        printf( "Could not generate the records to log\n" );
+        return 1;
+    }
+
+    if (!FileLogStart()) {
+
+        printf( "Could not start the service log flusher, lines are written as they are logged\n" );
+    }
+
+    if (!AlertStart()) {
+
+        printf( "Could not start the alert thread, alerts are written as they are raised\n" );
+    }
+
+    printf( "Logging %u buffers of records over and over for %.1f s a run, in %s\n\n", Bench.BufferCount, Bench.Seconds, output );
+
+    for (index = 0; index < ARRAYSIZE( runs ); index++) {
+
+        if (!BenchRun( &runs[index], &failures )) {
+
+            printf( "%s could not be run\n", runs[index].Name );
+            total++;
+        }
+
+        total += failures;
+        printf( "\n" );
+    }
+
+    AlertStop();
+    FileLogStop();
+
+    free( Bench.Batches );
+    free( Bench.Buffers );
+    free( Bench.Filled );
+
+    return (total == 0) ? 0 : 1;
+}
@@ -0,0 +1,5 @@
+//
+//  A stand-in for the WDK's DriverSpecs.h, see windows.h.
+//
+
+#define _Analysis_mode_(Mode)
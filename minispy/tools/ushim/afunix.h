@@ -0,0 +1,5 @@
+//
+//  A stand-in for the SDK's afunix.h, see windows.h.
+//
+
+#include <sys/un.h>
@@ -0,0 +1,223 @@
+//
+//  A stand-in for the WDK's fltUser.h, see windows.h.  There is no filter
+//  manager here: connecting to a filter's port, or attaching it, fails as
+//  it does when the filter is not loaded, and the client has to talk to a
+//  stand-in for the filter over a local socket instead, see mspyFake.c.
+//
+
+#ifndef __USHIM_FLTUSER_H__
+#define __USHIM_FLTUSER_H__
+
+#define ERROR_FLT_INSTANCE_NOT_FOUND    0x801F0010
+
+static inline HRESULT
+FilterConnectCommunicationPort (
+    LPCWSTR PortName,
+    DWORD Options,
+    const void *Context,
+    WORD ContextSize,
+    void *SecurityAttributes,
+    HANDLE *Port
+    )
+{
+    UNREFERENCED_PARAMETER( PortName );
+    UNREFERENCED_PARAMETER( Options );
+    UNREFERENCED_PARAMETER( Context );
+    UNREFERENCED_PARAMETER( ContextSize );
+    UNREFERENCED_PARAMETER( SecurityAttributes );
+
+    *Port = INVALID_HANDLE_VALUE;
+    return HRESULT_FROM_WIN32( ERROR_FILE_NOT_FOUND );
+}
+
+static inline HRESULT
+FilterSendMessage (
+    HANDLE Port,
+    LPVOID InBuffer,
+    DWORD InBufferSize,
+    LPVOID OutBuffer,
+    DWORD OutBufferSize,
+    LPDWORD BytesReturned
+    )
+{
+    UNREFERENCED_PARAMETER( Port );
+    UNREFERENCED_PARAMETER( InBuffer );
+    UNREFERENCED_PARAMETER( InBufferSize );
+    UNREFERENCED_PARAMETER( OutBuffer );
+    UNREFERENCED_PARAMETER( OutBufferSize );
+
+    *BytesReturned = 0;
+    return HRESULT_FROM_WIN32( ERROR_INVALID_HANDLE );
+}
+
+#define INSTANCE_NAME_MAX_CHARS         255
+
+typedef enum _INSTANCE_INFORMATION_CLASS {
+    InstanceBasicInformation,
+    InstancePartialInformation,
+    InstanceFullInformation,
+    InstanceAggregateStandardInformation
+} INSTANCE_INFORMATION_CLASS;
+
+typedef struct _INSTANCE_FULL_INFORMATION {
+    ULONG NextEntryOffset;
+    USHORT InstanceNameLength;
+    USHORT InstanceNameBufferOffset;
+    USHORT AltitudeLength;
+    USHORT AltitudeBufferOffset;
+    USHORT VolumeNameLength;
+    USHORT VolumeNameBufferOffset;
+    USHORT FilterNameLength;
+    USHORT FilterNameBufferOffset;
+} INSTANCE_FULL_INFORMATION, *PINSTANCE_FULL_INFORMATION;
+
+typedef enum _FILTER_VOLUME_INFORMATION_CLASS {
+    FilterVolumeBasicInformation,
+    FilterVolumeStandardInformation
+} FILTER_VOLUME_INFORMATION_CLASS;
+
+typedef struct _FILTER_VOLUME_BASIC_INFORMATION {
+    USHORT FilterVolumeNameLength;
+    WCHAR FilterVolumeName[1];
+} FILTER_VOLUME_BASIC_INFORMATION, *PFILTER_VOLUME_BASIC_INFORMATION;
+
+static inline HRESULT
+FilterAttach (
+    LPCWSTR FilterName,
+    LPCWSTR VolumeName,
+    LPCWSTR InstanceName,
+    DWORD CreatedInstanceNameLength,
+    LPWSTR CreatedInstanceName
+    )
+{
+    UNREFERENCED_PARAMETER( FilterName );
+    UNREFERENCED_PARAMETER( VolumeName );
+    UNREFERENCED_PARAMETER( InstanceName );
+    UNREFERENCED_PARAMETER( CreatedInstanceNameLength );
+    UNREFERENCED_PARAMETER( CreatedInstanceName );
+    return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+}
+
+static inline HRESULT
+FilterDetach (
+    LPCWSTR FilterName,
+    LPCWSTR VolumeName,
+    LPCWSTR InstanceName
+    )
+{
+    UNREFERENCED_PARAMETER( FilterName );
+    UNREFERENCED_PARAMETER( VolumeName );
+    UNREFERENCED_PARAMETER( InstanceName );
+    return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+}
+
+//
+//  No volumes, and so no instances on them.
+//
+
+static inline HRESULT
+FilterVolumeFindFirst (
+    FILTER_VOLUME_INFORMATION_CLASS InformationClass,
+    LPVOID Buffer,
+    DWORD BufferSize,
+    LPDWORD BytesReturned,
+    HANDLE *VolumeFind
+    )
+{
+    UNREFERENCED_PARAMETER( InformationClass );
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( BufferSize );
+
+    *BytesReturned = 0;
+    *VolumeFind = INVALID_HANDLE_VALUE;
+    return HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS );
+}
+
+static inline HRESULT
+FilterVolumeFindNext (
+    HANDLE VolumeFind,
+    FILTER_VOLUME_INFORMATION_CLASS InformationClass,
+    LPVOID Buffer,
+    DWORD BufferSize,
+    LPDWORD BytesReturned
+    )
+{
+    UNREFERENCED_PARAMETER( VolumeFind );
+    UNREFERENCED_PARAMETER( InformationClass );
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( BufferSize );
+
+    *BytesReturned = 0;
+    return HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS );
+}
+
+static inline HRESULT
+FilterVolumeFindClose (
+    HANDLE VolumeFind
+    )
+{
+    UNREFERENCED_PARAMETER( VolumeFind );
+    return S_OK;
+}
+
+static inline HRESULT
+FilterVolumeInstanceFindFirst (
+    LPCWSTR VolumeName,
+    INSTANCE_INFORMATION_CLASS InformationClass,
+    LPVOID Buffer,
+    DWORD BufferSize,
+    LPDWORD BytesReturned,
+    HANDLE *InstanceFind
+    )
+{
+    UNREFERENCED_PARAMETER( VolumeName );
+    UNREFERENCED_PARAMETER( InformationClass );
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( BufferSize );
+
+    *BytesReturned = 0;
+    *InstanceFind = INVALID_HANDLE_VALUE;
+    return HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS );
+}
+
+static inline HRESULT
+FilterVolumeInstanceFindNext (
+    HANDLE InstanceFind,
+    INSTANCE_INFORMATION_CLASS InformationClass,
+    LPVOID Buffer,
+    DWORD BufferSize,
+    LPDWORD BytesReturned
+    )
+{
+    UNREFERENCED_PARAMETER( InstanceFind );
+    UNREFERENCED_PARAMETER( InformationClass );
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( BufferSize );
+
+    *BytesReturned = 0;
+    return HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS );
+}
+
+static inline HRESULT
+FilterVolumeInstanceFindClose (
+    HANDLE InstanceFind
+    )
+{
+    UNREFERENCED_PARAMETER( InstanceFind );
+    return S_OK;
+}
+
+static inline HRESULT
+FilterGetDosName (
+    LPCWSTR VolumeName,
+    LPWSTR DosName,
+    DWORD DosNameBufferSize
+    )
+{
+    UNREFERENCED_PARAMETER( VolumeName );
+    UNREFERENCED_PARAMETER( DosName );
+    UNREFERENCED_PARAMETER( DosNameBufferSize );
+    return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+}
+
+#endif //__USHIM_FLTUSER_H__
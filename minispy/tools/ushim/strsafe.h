@@ -0,0 +1,32 @@
+//
+//  A stand-in for the SDK's strsafe.h, see windows.h.  Only what the
+//  client uses, for 16 bit strings.
+//
+
+#ifndef __USHIM_STRSAFE_H__
+#define __USHIM_STRSAFE_H__
+
+#define STRSAFE_E_INSUFFICIENT_BUFFER   ((HRESULT)0x8007007A)
+
+static inline HRESULT
+StringCchCatW (
+    LPWSTR Dest,
+    size_t Size,
+    LPCWSTR Src
+    )
+{
+    size_t length = UshimWcslen( Dest );
+    size_t add = UshimWcslen( Src );
+
+    if (length + add >= Size) {
+
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+
+    memcpy( Dest + length, Src, (add + 1) * sizeof( WCHAR ) );
+    return S_OK;
+}
+
+#define StringCchCat                StringCchCatW
+
+#endif //__USHIM_STRSAFE_H__
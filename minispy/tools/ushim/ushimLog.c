@@ -0,0 +1,209 @@
+/*++
+
+Module Name:
+
+    ushimLog.c
+
+Abstract:
+
+    Stands in for the parts of mspyLog.c the other client modules call, so
+    a module can be built into a Linux test without the writer, see
+    windows.h.
+
+    The embedded .sql files are read from UshimSqlDirectory, the client's
+    own user directory unless the test moves it: the resource named
+    RULES_SQL is rules.sql there.  Messages for the service log and the
+    alerts are counted, and only printed when UshimLogVerbose is set.
+
+Environment:
+
+    Linux user mode
+
+--*/
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "../../user/mspyLog.h"
+
+char DatabaseFileLocation[MAX_PATH] = "ushim.db";
+char DatabasePartitionBase[MAX_PATH] = "ushim";
+
+const char *UshimSqlDirectory = "../user";
+BOOLEAN UshimLogVerbose = FALSE;
+volatile LONG UshimLogMessages;
+volatile LONG UshimAlerts;
+
+VOID
+DatabaseSetLocation (
+    const char *Path,
+    const char *PartitionBase
+    )
+{
+    snprintf( DatabaseFileLocation, sizeof( DatabaseFileLocation ), "%s", Path );
+    snprintf( DatabasePartitionBase, sizeof( DatabasePartitionBase ), "%s", PartitionBase );
+}
+
+VOID
+WriteToLogAnsi (
+    const char *Message,
+    ...
+    )
+{
+    va_list args;
+
+    InterlockedIncrement( &UshimLogMessages );
+
+    if (UshimLogVerbose) {
+
+        va_start( args, Message );
+        printf( "log: " );
+        vprintf( Message, args );
+        printf( "\n" );
+        va_end( args );
+    }
+}
+
+VOID
+WriteAlertToDatabase (
+    const char *Message,
+    ...
+    )
+{
+    va_list args;
+
+    InterlockedIncrement( &UshimAlerts );
+
+    if (UshimLogVerbose) {
+
+        va_start( args, Message );
+        printf( "alert: " );
+        vprintf( Message, args );
+        printf( "\n" );
+        va_end( args );
+    }
+}
+
+int
+ExecEmbeddedSQL (
+    struct sqlite3 *Db,
+    LPCWSTR ResourceName
+    )
+/*++
+
+Routine Description:
+
+    Runs the .sql file a resource of mspyUser.rc names, CREATE_SQL is
+    create.sql.
+
+--*/
+{
+    char path[MAX_PATH];
+    char name[64];
+    char *errMsg = NULL;
+    char *text;
+    long size;
+    size_t index;
+    FILE *file;
+    int rc;
+
+    for (index = 0; ResourceName[index] != 0 && index < sizeof( name ) - 1; index++) {
+
+        name[index] = (char)tolower( ResourceName[index] );
+    }
+
+    name[index] = '\0';
+
+    if (index < 4 || strcmp( name + index - 4, "_sql" ) != 0) {
+
+        return SQLITE_ERROR;
+    }
+
+    name[index - 4] = '\0';
+    snprintf( path, sizeof( path ), "%s/%s.sql", UshimSqlDirectory, name );
+
+    file = fopen( path, "rb" );
+
+    if (file == NULL) {
+
+        fprintf( stderr, "Cannot open %s\n", path );
+        return SQLITE_ERROR;
+    }
+
+    fseek( file, 0, SEEK_END );
+    size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    text = malloc( size + 1 );
+
+    if (text == NULL || fread( text, 1, size, file ) != (size_t)size) {
+
+        free( text );
+        fclose( file );
+        return SQLITE_NOMEM;
+    }
+
+    text[size] = '\0';
+    fclose( file );
+
+    rc = sqlite3_exec( Db, text, NULL, NULL, &errMsg );
+
+    if (rc != SQLITE_OK) {
+
+        fprintf( stderr, "SQL error in %s: %s\n", path, errMsg ? errMsg : sqlite3_errstr( rc ) );
+    }
+
+    sqlite3_free( errMsg );
+    free( text );
+    return rc;
+}
+
+int
+InitializeDatabase (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Creates the log schema in DATABASE_FILE_LOCATION as InitializeDatabase
+    does, unless the file is already there.  The indexes are left to
+    whoever opens the log, as in the client.
+
+--*/
+{
+    static const char *resources[] = { "CREATE_SQL", "SUMMARY_SQL", "SESSION_SQL", "TOPK_SQL", "PROCESS_SQL", "FILES_SQL" };
+    WCHAR resource[32];
+    sqlite3 *db = NULL;
+    size_t index;
+    size_t next;
+    int rc = SQLITE_OK;
+
+    if (access( DATABASE_FILE_LOCATION, F_OK ) == 0) {
+
+        return 1;
+    }
+
+    if (sqlite3_open( DATABASE_FILE_LOCATION, &db ) != SQLITE_OK) {
+
+        sqlite3_close( db );
+        return 0;
+    }
+
+    for (index = 0; index < ARRAYSIZE( resources ) && rc == SQLITE_OK; index++) {
+
+        for (next = 0; resources[index][next] != '\0'; next++) {
+
+            resource[next] = (WCHAR)resources[index][next];
+        }
+
+        resource[next] = 0;
+        rc = ExecEmbeddedSQL( db, resource );
+    }
+
+    sqlite3_close( db );
+    return rc == SQLITE_OK;
+}
@@ -0,0 +1,1970 @@
+/*++
+
+Module Name:
+
+    windows.h
+
+Abstract:
+
+    A stand-in for the SDK's windows.h, with the types, annotations and
+    the few Win32 routines the client's modules use, so they can be built
+    into a Linux program and measured or tested there, see mspyUtfBench.c,
+    mspyFilesBench.c and mspyReloadTest.c.
+
+    The types are laid out as on 64 bit Windows: LONG and ULONG are 32
+    bits and WCHAR is 16 bits, which wchar_t is not here.  Modules with
+    L"" strings are built with -fshort-wchar so those are 16 bits too, and
+    the wide string routines they call are redone below for 16 bit
+    characters, as the C library's take 32.  printf's %S is taught the
+    same, see UshimPrintWide.
+
+    LONG and ULONG cannot be long here without growing every record the
+    client shares with the filter, so the printf family reads %lu and
+    %I64u as the Microsoft library does instead, see UshimFormat.
+    LONGLONG and ULONGLONG are long long, as __int64 is.
+
+    Threads, events and SRW locks are built on pthreads and stand for the
+    Windows ones as far as the modules use them: events are waited on one
+    at a time, WaitForMultipleObjects only waits for all of them, and
+    handles are closed by the thread that made them.
+
+    Files opened with CreateFileA or CreateFileW are plain descriptors.
+
+Environment:
+
+    Linux user mode
+
+--*/
+#ifndef __USHIM_WINDOWS_H__
+#define __USHIM_WINDOWS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <printf.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define VOID                        void
+#define CONST                       const
+#define TRUE                        1
+#define FALSE                       0
+
+typedef char                        CHAR, *PCHAR, *LPSTR;
+typedef const char                  *PCSTR, *LPCSTR;
+typedef unsigned char               UCHAR, *PUCHAR, BYTE, *PBYTE;
+typedef unsigned char               BOOLEAN, *PBOOLEAN;
+typedef char                        CCHAR;
+typedef uint16_t                    WCHAR, *PWCHAR, *PWSTR, *LPWSTR;
+typedef const uint16_t              *PCWSTR, *LPCWSTR;
+typedef int16_t                     SHORT;
+typedef uint16_t                    USHORT, *PUSHORT, WORD;
+typedef int                         INT, BOOL;
+typedef unsigned int                UINT;
+typedef int32_t                     LONG, *PLONG, HRESULT;
+typedef uint32_t                    ULONG, *PULONG, DWORD, *PDWORD, *LPDWORD;
+typedef unsigned long long          ULONGLONG, *PULONGLONG, ULONG64, DWORD64;
+typedef long long                   LONGLONG, *PLONGLONG, LONG64;
+typedef uintptr_t                   ULONG_PTR, *PULONG_PTR, SIZE_T, DWORD_PTR;
+typedef intptr_t                    LONG_PTR;
+typedef void                        *PVOID, *LPVOID;
+typedef void                        *HANDLE, *HMODULE, *HRSRC, *HGLOBAL;
+typedef long long                   INT64;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _FILETIME {
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+} FILETIME, *PFILETIME, *LPFILETIME;
+
+typedef struct _SYSTEMTIME {
+    WORD wYear;
+    WORD wMonth;
+    WORD wDayOfWeek;
+    WORD wDay;
+    WORD wHour;
+    WORD wMinute;
+    WORD wSecond;
+    WORD wMilliseconds;
+} SYSTEMTIME, *PSYSTEMTIME, *LPSYSTEMTIME;
+
+typedef struct _SYSTEM_INFO {
+    DWORD dwNumberOfProcessors;
+} SYSTEM_INFO, *LPSYSTEM_INFO;
+
+typedef struct _BY_HANDLE_FILE_INFORMATION {
+    DWORD dwFileAttributes;
+    FILETIME ftCreationTime;
+    FILETIME ftLastAccessTime;
+    FILETIME ftLastWriteTime;
+    DWORD dwVolumeSerialNumber;
+    DWORD nFileSizeHigh;
+    DWORD nFileSizeLow;
+    DWORD nNumberOfLinks;
+    DWORD nFileIndexHigh;
+    DWORD nFileIndexLow;
+} BY_HANDLE_FILE_INFORMATION, *LPBY_HANDLE_FILE_INFORMATION;
+
+typedef struct _GUID {
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR Data4[8];
+} GUID;
+
+typedef DWORD (*LPTHREAD_START_ROUTINE)( LPVOID Parameter );
+
+#define WINAPI
+#define CALLBACK
+#define __cdecl
+#define _cdecl
+#define __forceinline               inline __attribute__((always_inline))
+
+//
+//  Termination handlers as excpt.h spells them.  leave jumps to the
+//  handler, which always runs after the guarded block; there are no
+//  exceptions here to unwind it.  leave must not be used inside a loop
+//  or switch of the guarded block.
+//
+
+#define try                         do
+#define leave                       break
+#define finally                     while (0);
+
+//
+//  Every module using an __inline function gets its own copy, so the
+//  client's modules link together.  The compiler's intrinsics, which use
+//  the keyword themselves, are included above before it is redefined.
+//
+
+#define __inline                    static inline
+
+#define INFINITE                    0xFFFFFFFF
+#define MAX_PATH                    260
+#define MAXULONG                    ((ULONG)0xFFFFFFFF)
+#define MAXULONGLONG                ((ULONGLONG)~0ULL)
+#define MAXLONG                     ((LONG)0x7FFFFFFF)
+#define UNICODE_NULL                ((WCHAR)0)
+#define INVALID_HANDLE_VALUE        ((HANDLE)(LONG_PTR)-1)
+#define WAIT_OBJECT_0               0
+#define WAIT_TIMEOUT                258
+#define WAIT_FAILED                 0xFFFFFFFF
+#define S_OK                        0
+
+#define ERROR_FILE_NOT_FOUND        2
+#define ERROR_ACCESS_DENIED         5
+#define ERROR_INVALID_HANDLE        6
+#define ERROR_NOT_ENOUGH_MEMORY     8
+#define ERROR_NOT_SUPPORTED         50
+#define ERROR_INVALID_PARAMETER     87
+#define ERROR_NO_MORE_ITEMS         259
+#define ERROR_REVISION_MISMATCH     1306
+#define E_OUTOFMEMORY               ((HRESULT)0x8007000E)
+#define ERROR_BAD_PATHNAME          161
+#define ERROR_NOT_CONNECTED         2250
+#define E_FAIL                      ((HRESULT)0x80004005)
+#define HRESULT_FROM_WIN32(Error)   ((HRESULT)(Error) <= 0 ? (HRESULT)(Error) : (HRESULT)(((Error) & 0x0000FFFF) | 0x80070000))
+
+#define GENERIC_READ                0x80000000
+#define GENERIC_WRITE               0x40000000
+#define FILE_APPEND_DATA            0x00000004
+#define FILE_SHARE_READ             0x00000001
+#define FILE_SHARE_WRITE            0x00000002
+#define FILE_SHARE_DELETE           0x00000004
+#define CREATE_NEW                  1
+#define CREATE_ALWAYS               2
+#define OPEN_EXISTING               3
+#define OPEN_ALWAYS                 4
+#define FILE_ATTRIBUTE_DIRECTORY    0x00000010
+#define FILE_ATTRIBUTE_NORMAL       0x00000080
+#define FILE_FLAG_SEQUENTIAL_SCAN   0x08000000
+#define FILE_FLAG_BACKUP_SEMANTICS  0x02000000
+#define INVALID_FILE_ATTRIBUTES     ((DWORD)-1)
+#define MOVEFILE_REPLACE_EXISTING   0x00000001
+#define IO_REPARSE_TAG_MOUNT_POINT  0xA0000003L
+#define PROCESS_QUERY_LIMITED_INFORMATION 0x1000
+#define PROCESS_NAME_NATIVE         0x00000001
+#define FORMAT_MESSAGE_IGNORE_INSERTS 0x00000200
+#define FORMAT_MESSAGE_FROM_SYSTEM  0x00001000
+#define CP_ACP                      0
+#define CP_UTF8                     65001
+#define MB_ERR_INVALID_CHARS        0x00000008
+#define FORMAT_MESSAGE_FROM_HMODULE 0x00000800
+#define LOAD_LIBRARY_AS_DATAFILE    0x00000002
+#define RT_RCDATA                   ((LPCWSTR)(ULONG_PTR)10)
+#define MAKEWORD(Low, High)         ((WORD)(((BYTE)(Low)) | ((WORD)((BYTE)(High))) << 8))
+#define LOWORD(Value)               ((WORD)((ULONG_PTR)(Value) & 0xFFFF))
+#define HIWORD(Value)               ((WORD)(((ULONG_PTR)(Value) >> 16) & 0xFFFF))
+
+#define FIELD_OFFSET(Type, Field)   ((LONG)offsetof( Type, Field ))
+#define ARRAYSIZE(Array)            (sizeof( Array ) / sizeof( (Array)[0] ))
+#define _countof(Array)             ARRAYSIZE( Array )
+#define UNREFERENCED_PARAMETER(P)   ((void)(P))
+#define ZeroMemory(Dest, Length)    memset( (Dest), 0, (Length) )
+#define CopyMemory(Dest, Src, Length) memcpy( (Dest), (Src), (Length) )
+#define MoveMemory(Dest, Src, Length) memmove( (Dest), (Src), (Length) )
+#define SUCCEEDED(Status)           ((HRESULT)(Status) >= 0)
+#define FAILED(Status)              ((HRESULT)(Status) < 0)
+#define IS_ERROR(Status)            ((HRESULT)(Status) < 0)
+
+#ifndef min
+#define min(a, b)                   (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)                   (((a) > (b)) ? (a) : (b))
+#endif
+
+//
+//  Annotations are only read by the analyzer
+//
+
+#define _In_
+#define _In_opt_
+#define _In_z_
+#define _In_opt_z_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _Inout_z_
+#define _Printf_format_string_
+#define _Return_type_success_(Expr)
+#define _Analysis_assume_(Expr)
+#define _When_(Expr, Annotation)
+#define _Success_(Expr)
+#define _Must_inspect_result_
+#define _In_reads_(Size)
+#define _In_reads_opt_(Size)
+#define _In_reads_bytes_(Size)
+#define _In_reads_bytes_opt_(Size)
+#define _Out_writes_(Size)
+#define _Out_writes_opt_(Size)
+#define _Out_writes_z_(Size)
+#define _Out_writes_bytes_(Size)
+#define _Out_writes_bytes_opt_(Size)
+#define _Out_writes_to_(Size, Count)
+#define _Out_writes_bytes_to_(Size, Count)
+#define _Out_writes_bytes_to_opt_(Size, Count)
+#define _Outptr_
+#define _Outptr_opt_
+#define _Post_invalid_
+#define _Frees_ptr_
+#define _Frees_ptr_opt_
+#define _Inout_updates_(Size)
+#define _Inout_updates_bytes_(Size)
+#define _Field_size_(Size)
+#define _Field_size_bytes_(Size)
+#define _Field_size_opt_(Size)
+#define _Field_range_(Low, High)
+
+//
+//  C runtime names of the Microsoft library
+//
+
+#define sprintf_s                   snprintf
+#define vsprintf_s                  vsnprintf
+#define _stricmp                    strcasecmp
+#define _strnicmp                   strncasecmp
+#define _strdup                     strdup
+#define strtok_s                    strtok_r
+#define fopen_s(File, Name, Mode)   ((*(File) = fopen( (Name), (Mode) )) == NULL ? errno : 0)
+
+#define _strtoui64                  strtoull
+#define _strtoi64                   strtoll
+
+#define _TRUNCATE                   ((size_t)-1)
+
+static inline int
+strncpy_s (
+    char *Dest,
+    size_t Size,
+    const char *Src,
+    size_t Count
+    )
+{
+    size_t length = strnlen( Src, (Count == _TRUNCATE) ? Size - 1 : Count );
+
+    if (length >= Size) {
+
+        if (Size > 0) Dest[0] = '\0';
+        return ERANGE;
+    }
+
+    memcpy( Dest, Src, length );
+    Dest[length] = '\0';
+    return 0;
+}
+
+static inline int
+strcpy_s (
+    char *Dest,
+    size_t Size,
+    const char *Src
+    )
+{
+    size_t length = strlen( Src );
+
+    if (length >= Size) {
+
+        if (Size > 0) Dest[0] = '\0';
+        return ERANGE;
+    }
+
+    memcpy( Dest, Src, length + 1 );
+    return 0;
+}
+
+//
+//  Wide strings of 16 bit characters
+//
+
+static inline WCHAR
+UshimUpcase (
+    WCHAR Char
+    )
+{
+    return (Char >= 'a' && Char <= 'z') ? (WCHAR)(Char - 'a' + 'A') : Char;
+}
+
+static inline size_t
+UshimWcslen (
+    PCWSTR String
+    )
+{
+    size_t length = 0;
+
+    while (String[length] != 0) length++;
+    return length;
+}
+
+static inline int
+UshimWcsncmp (
+    PCWSTR Left,
+    PCWSTR Right,
+    size_t Count
+    )
+{
+    for (; Count > 0; Count--, Left++, Right++) {
+
+        if (*Left != *Right) return (*Left < *Right) ? -1 : 1;
+        if (*Left == 0) break;
+    }
+
+    return 0;
+}
+
+static inline int
+UshimWcsnicmp (
+    PCWSTR Left,
+    PCWSTR Right,
+    size_t Count
+    )
+{
+    for (; Count > 0; Count--, Left++, Right++) {
+
+        WCHAR left = UshimUpcase( *Left );
+        WCHAR right = UshimUpcase( *Right );
+
+        if (left != right) return (left < right) ? -1 : 1;
+        if (left == 0) break;
+    }
+
+    return 0;
+}
+
+static inline PWCHAR
+UshimWcsdup (
+    PCWSTR String
+    )
+{
+    size_t size = (UshimWcslen( String ) + 1) * sizeof( WCHAR );
+    PWCHAR copy = malloc( size );
+
+    if (copy != NULL) memcpy( copy, String, size );
+    return copy;
+}
+
+static inline int
+UshimWcscpy (
+    PWCHAR Dest,
+    size_t Size,
+    PCWSTR Src
+    )
+{
+    size_t length = UshimWcslen( Src );
+
+    if (length >= Size) {
+
+        if (Size > 0) Dest[0] = 0;
+        return ERANGE;
+    }
+
+    memcpy( Dest, Src, (length + 1) * sizeof( WCHAR ) );
+    return 0;
+}
+
+static inline int
+UshimWcscat (
+    PWCHAR Dest,
+    size_t Size,
+    PCWSTR Src
+    )
+{
+    size_t length = UshimWcslen( Dest );
+
+    return (length >= Size) ? ERANGE : UshimWcscpy( Dest + length, Size - length, Src );
+}
+
+#define wcslen(String)                  UshimWcslen( String )
+#define wcscmp(Left, Right)             UshimWcsncmp( (Left), (Right), (size_t)-1 )
+#define wcsncmp(Left, Right, Count)     UshimWcsncmp( (Left), (Right), (Count) )
+#define _wcsicmp(Left, Right)           UshimWcsnicmp( (Left), (Right), (size_t)-1 )
+#define _wcsnicmp(Left, Right, Count)   UshimWcsnicmp( (Left), (Right), (Count) )
+#define _wcsdup(String)                 UshimWcsdup( String )
+#define wcscpy_s(Dest, Size, Src)       UshimWcscpy( (Dest), (Size), (Src) )
+#define wcscat_s(Dest, Size, Src)       UshimWcscat( (Dest), (Size), (Src) )
+
+static inline LPWSTR
+CharUpperW (
+    LPWSTR String
+    )
+{
+    //
+    //  A character in the low word rather than a string, as the modules
+    //  call it.
+    //
+
+    if (((ULONG_PTR)String >> 16) == 0) {
+
+        return (LPWSTR)(ULONG_PTR)UshimUpcase( (WCHAR)(ULONG_PTR)String );
+    }
+
+    for (LPWSTR next = String; *next != 0; next++) *next = UshimUpcase( *next );
+    return String;
+}
+
+static inline DWORD
+CharUpperBuffW (
+    LPWSTR String,
+    DWORD Length
+    )
+{
+    for (DWORD index = 0; index < Length; index++) String[index] = UshimUpcase( String[index] );
+    return Length;
+}
+
+static inline DWORD
+QueryDosDeviceW (
+    LPCWSTR Device,
+    LPWSTR Target,
+    DWORD Size
+    )
+{
+    //
+    //  No drive letters here, rules keep the paths they were written with.
+    //
+
+    UNREFERENCED_PARAMETER( Device );
+    UNREFERENCED_PARAMETER( Target );
+    UNREFERENCED_PARAMETER( Size );
+    return 0;
+}
+
+static inline int
+MultiByteToWideChar (
+    UINT CodePage,
+    DWORD Flags,
+    LPCSTR Source,
+    int SourceLength,
+    LPWSTR Dest,
+    int DestLength
+    )
+{
+    int length = (SourceLength < 0) ? (int)strlen( Source ) + 1 : SourceLength;
+    int index;
+
+    //
+    //  Bytes stand for themselves, as in Latin 1.
+    //
+
+    UNREFERENCED_PARAMETER( CodePage );
+    UNREFERENCED_PARAMETER( Flags );
+
+    if (DestLength == 0) {
+
+        return length;
+    }
+
+    if (length > DestLength) {
+
+        return 0;
+    }
+
+    for (index = 0; index < length; index++) Dest[index] = (UCHAR)Source[index];
+    return length;
+}
+
+static inline int
+WideCharToMultiByte (
+    UINT CodePage,
+    DWORD Flags,
+    LPCWSTR Source,
+    int SourceLength,
+    LPSTR Dest,
+    int DestLength,
+    LPCSTR Default,
+    BOOL *UsedDefault
+    )
+{
+    int length = (SourceLength < 0) ? (int)UshimWcslen( Source ) + 1 : SourceLength;
+    int index;
+
+    UNREFERENCED_PARAMETER( CodePage );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Default );
+    UNREFERENCED_PARAMETER( UsedDefault );
+
+    if (DestLength == 0) {
+
+        return length;
+    }
+
+    if (length > DestLength) {
+
+        return 0;
+    }
+
+    for (index = 0; index < length; index++) Dest[index] = (Source[index] < 0x100) ? (char)Source[index] : '?';
+    return length;
+}
+
+static inline int
+swprintf_s (
+    LPWSTR Buffer,
+    size_t Size,
+    LPCWSTR Format,
+    ...
+    )
+{
+    //
+    //  The C library's wide printf takes 32 bit characters.  The client
+    //  only formats wide strings for drive letters, and none are mapped
+    //  here, see QueryDosDeviceW.
+    //
+
+    UNREFERENCED_PARAMETER( Format );
+
+    if (Size > 0) Buffer[0] = UNICODE_NULL;
+    return -1;
+}
+
+static inline DWORD
+FormatMessageA (
+    DWORD Flags,
+    const void *Source,
+    DWORD MessageId,
+    DWORD LanguageId,
+    LPSTR Buffer,
+    DWORD Size,
+    va_list *Arguments
+    )
+{
+    //
+    //  There is no message table, callers print the code instead.
+    //
+
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Source );
+    UNREFERENCED_PARAMETER( MessageId );
+    UNREFERENCED_PARAMETER( LanguageId );
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( Size );
+    UNREFERENCED_PARAMETER( Arguments );
+    return 0;
+}
+
+//
+//  Other processes cannot be opened, callers go without their image path
+//  and creation time as they do for a process that already exited.
+//
+
+static inline HANDLE
+OpenProcess (
+    DWORD Access,
+    BOOL Inherit,
+    DWORD ProcessId
+    )
+{
+    UNREFERENCED_PARAMETER( Access );
+    UNREFERENCED_PARAMETER( Inherit );
+    UNREFERENCED_PARAMETER( ProcessId );
+    return NULL;
+}
+
+static inline BOOL
+GetProcessTimes (
+    HANDLE Process,
+    LPFILETIME Creation,
+    LPFILETIME Exit,
+    LPFILETIME Kernel,
+    LPFILETIME User
+    )
+{
+    UNREFERENCED_PARAMETER( Process );
+    UNREFERENCED_PARAMETER( Creation );
+    UNREFERENCED_PARAMETER( Exit );
+    UNREFERENCED_PARAMETER( Kernel );
+    UNREFERENCED_PARAMETER( User );
+    return FALSE;
+}
+
+static inline BOOL
+QueryFullProcessImageNameA (
+    HANDLE Process,
+    DWORD Flags,
+    LPSTR Name,
+    PDWORD Size
+    )
+{
+    UNREFERENCED_PARAMETER( Process );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Name );
+    UNREFERENCED_PARAMETER( Size );
+    return FALSE;
+}
+
+static inline BOOL
+QueryFullProcessImageNameW (
+    HANDLE Process,
+    DWORD Flags,
+    LPWSTR Name,
+    PDWORD Size
+    )
+{
+    UNREFERENCED_PARAMETER( Process );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Name );
+    UNREFERENCED_PARAMETER( Size );
+    return FALSE;
+}
+
+static inline DWORD
+FormatMessageW (
+    DWORD Flags,
+    const void *Source,
+    DWORD MessageId,
+    DWORD LanguageId,
+    LPWSTR Buffer,
+    DWORD Size,
+    va_list *Arguments
+    )
+{
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Source );
+    UNREFERENCED_PARAMETER( MessageId );
+    UNREFERENCED_PARAMETER( LanguageId );
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( Size );
+    UNREFERENCED_PARAMETER( Arguments );
+    return 0;
+}
+
+#define FormatMessage               FormatMessageW
+
+//
+//  No system directory and no libraries to load messages from, callers
+//  print the code instead.
+//
+
+static inline UINT
+GetSystemDirectoryW (
+    LPWSTR Buffer,
+    UINT Size
+    )
+{
+    UNREFERENCED_PARAMETER( Buffer );
+    UNREFERENCED_PARAMETER( Size );
+    return 0;
+}
+
+#define GetSystemDirectory          GetSystemDirectoryW
+
+static inline HMODULE
+LoadLibraryExW (
+    LPCWSTR Name,
+    HANDLE File,
+    DWORD Flags
+    )
+{
+    UNREFERENCED_PARAMETER( Name );
+    UNREFERENCED_PARAMETER( File );
+    UNREFERENCED_PARAMETER( Flags );
+    return NULL;
+}
+
+static inline BOOL
+FreeLibrary (
+    HMODULE Module
+    )
+{
+    UNREFERENCED_PARAMETER( Module );
+    return TRUE;
+}
+
+static inline VOID
+ExitProcess (
+    UINT ExitCode
+    )
+{
+    exit( (int)ExitCode );
+}
+
+//
+//  Resources are the files mspyUser.rc names, read from the directory in
+//  USHIM_RESOURCES, ../user when it is not set.  A resource is read once
+//  and stays in memory, as a loaded module's would.
+//
+
+#define USHIM_MAX_RESOURCES         32
+
+typedef struct _USHIM_RESOURCE {
+    char Name[64];
+    char *Data;
+    DWORD Size;
+} USHIM_RESOURCE, *PUSHIM_RESOURCE;
+
+static USHIM_RESOURCE UshimResources[USHIM_MAX_RESOURCES];
+static pthread_mutex_t UshimResourceLock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline const char *
+UshimResourceDirectory (
+    VOID
+    )
+{
+    const char *directory = getenv( "USHIM_RESOURCES" );
+
+    return (directory != NULL) ? directory : "../user";
+}
+
+static inline BOOLEAN
+UshimResourceFile (
+    const char *Name,
+    char *File,
+    size_t Size
+    )
+/*++
+
+Routine Description:
+
+    Finds the line of mspyUser.rc that names the RCDATA resource Name and
+    makes the path of its file.
+
+--*/
+{
+    char line[512];
+    char *quote;
+    char *end;
+    size_t length = strlen( Name );
+    BOOLEAN found = FALSE;
+    FILE *rc;
+
+    snprintf( line, sizeof( line ), "%s/mspyUser.rc", UshimResourceDirectory() );
+    rc = fopen( line, "r" );
+
+    if (rc == NULL) {
+
+        return FALSE;
+    }
+
+    while (!found && fgets( line, sizeof( line ), rc ) != NULL) {
+
+        if (strncmp( line, Name, length ) != 0 || (line[length] != ' ' && line[length] != '\t') ||
+            strstr( line, "RCDATA" ) == NULL ||
+            (quote = strchr( line, '"' )) == NULL ||
+            (end = strchr( quote + 1, '"' )) == NULL) {
+
+            continue;
+        }
+
+        *end = '\0';
+        snprintf( File, Size, "%s/%s", UshimResourceDirectory(), quote + 1 );
+        found = TRUE;
+    }
+
+    fclose( rc );
+    return found;
+}
+
+static inline HMODULE
+GetModuleHandle (
+    const void *Name
+    )
+{
+    UNREFERENCED_PARAMETER( Name );
+    return (HMODULE)UshimResources;
+}
+
+static inline HRSRC
+FindResource (
+    HMODULE Module,
+    LPCWSTR Name,
+    LPCWSTR Type
+    )
+{
+    PUSHIM_RESOURCE resource = NULL;
+    char name[64];
+    char file[MAX_PATH + 64];
+    size_t index;
+    long size;
+    FILE *stream;
+
+    UNREFERENCED_PARAMETER( Module );
+
+    if (Type != RT_RCDATA) {
+
+        return NULL;
+    }
+
+    for (index = 0; Name[index] != 0 && index < sizeof( name ) - 1; index++) {
+
+        name[index] = (char)Name[index];
+    }
+
+    name[index] = '\0';
+
+    pthread_mutex_lock( &UshimResourceLock );
+
+    for (index = 0; index < USHIM_MAX_RESOURCES; index++) {
+
+        if (UshimResources[index].Data != NULL && strcmp( UshimResources[index].Name, name ) == 0) {
+
+            resource = &UshimResources[index];
+            goto Done;
+        }
+
+        if (UshimResources[index].Data == NULL) {
+
+            break;
+        }
+    }
+
+    if (index == USHIM_MAX_RESOURCES || !UshimResourceFile( name, file, sizeof( file ) )) {
+
+        goto Done;
+    }
+
+    stream = fopen( file, "rb" );
+
+    if (stream == NULL) {
+
+        goto Done;
+    }
+
+    fseek( stream, 0, SEEK_END );
+    size = ftell( stream );
+    fseek( stream, 0, SEEK_SET );
+
+    resource = &UshimResources[index];
+    resource->Data = malloc( size > 0 ? size : 1 );
+
+    if (resource->Data == NULL || fread( resource->Data, 1, size, stream ) != (size_t)size) {
+
+        free( resource->Data );
+        resource->Data = NULL;
+        resource = NULL;
+
+    } else {
+
+        snprintf( resource->Name, sizeof( resource->Name ), "%s", name );
+        resource->Size = (DWORD)size;
+    }
+
+    fclose( stream );
+
+Done:
+
+    pthread_mutex_unlock( &UshimResourceLock );
+    return resource;
+}
+
+static inline HGLOBAL
+LoadResource (
+    HMODULE Module,
+    HRSRC Resource
+    )
+{
+    UNREFERENCED_PARAMETER( Module );
+    return Resource;
+}
+
+static inline DWORD
+SizeofResource (
+    HMODULE Module,
+    HRSRC Resource
+    )
+{
+    UNREFERENCED_PARAMETER( Module );
+    return ((PUSHIM_RESOURCE)Resource)->Size;
+}
+
+static inline LPVOID
+LockResource (
+    HGLOBAL Resource
+    )
+{
+    return ((PUSHIM_RESOURCE)Resource)->Data;
+}
+
+//
+//  %S prints a 16 bit string, as on Windows.  Only characters below 128
+//  come out as themselves, which is all the modules log with it.
+//
+
+static int
+UshimPrintWide (
+    FILE *Stream,
+    const struct printf_info *Info,
+    const void *const *Args
+    )
+{
+    PCWSTR string = *(PCWSTR const *)Args[0];
+    int written = 0;
+
+    UNREFERENCED_PARAMETER( Info );
+
+    if (string == NULL) {
+
+        return fprintf( Stream, "(null)" );
+    }
+
+    for (; *string != 0; string++, written++) {
+
+        fputc( (*string < 0x80) ? (int)*string : '?', Stream );
+    }
+
+    return written;
+}
+
+static int
+UshimPrintWideInfo (
+    const struct printf_info *Info,
+    size_t Count,
+    int *Types,
+    int *Sizes
+    )
+{
+    UNREFERENCED_PARAMETER( Info );
+
+    if (Count > 0) {
+
+        Types[0] = PA_POINTER;
+        Sizes[0] = sizeof( PCWSTR );
+    }
+
+    return 1;
+}
+
+__attribute__((constructor)) static void
+UshimRegisterPrintf (
+    VOID
+    )
+{
+    register_printf_specifier( 'S', UshimPrintWide, UshimPrintWideInfo );
+}
+
+//
+//  The printf family as the Microsoft library has it: long is 32 bits, so
+//  an l in front of an integer conversion reads a LONG or ULONG, and I64
+//  reads a LONGLONG or ULONGLONG.  The format is copied with ll for I64
+//  and without the l, and handed to the C library.
+//
+
+#define USHIM_FORMAT_SIZE           256
+
+static inline const char *
+UshimFormat (
+    const char *Format,
+    char *Buffer,
+    size_t Size
+    )
+{
+    size_t length = strlen( Format ) + 1;
+    const char *from = Format;
+    char *copy;
+    char *to;
+
+    if (strpbrk( Format, "lI" ) == NULL) {
+
+        return Format;
+    }
+
+    copy = (length <= Size) ? Buffer : (char *)malloc( length );
+
+    if (copy == NULL) {
+
+        return Format;
+    }
+
+    for (to = copy; *from != '\0'; ) {
+
+        if ((*to++ = *from++) != '%') {
+
+            continue;
+        }
+
+        while (*from != '\0' && strchr( "-+ #'0123456789.*", *from ) != NULL) {
+
+            *to++ = *from++;
+        }
+
+        if (strncmp( from, "I64", 3 ) == 0) {
+
+            *to++ = 'l';
+            *to++ = 'l';
+            from += 3;
+
+        } else if (from[0] == 'l' && from[1] == 'l') {
+
+            *to++ = *from++;
+            *to++ = *from++;
+
+        } else if (from[0] == 'l' && from[1] != '\0' && strchr( "diouxX", from[1] ) != NULL) {
+
+            from++;
+
+        } else if (*from == '%') {
+
+            *to++ = *from++;
+        }
+    }
+
+    *to = '\0';
+    return copy;
+}
+
+static inline void
+UshimFormatDone (
+    const char *Format,
+    const char *Used,
+    char *Buffer
+    )
+{
+    if (Used != Format && Used != Buffer) {
+
+        free( (void *)Used );
+    }
+}
+
+static inline int
+UshimVfprintf (
+    FILE *Stream,
+    const char *Format,
+    va_list Args
+    )
+{
+    char buffer[USHIM_FORMAT_SIZE];
+    const char *format = UshimFormat( Format, buffer, sizeof( buffer ) );
+    int result = vfprintf( Stream, format, Args );
+
+    UshimFormatDone( Format, format, buffer );
+    return result;
+}
+
+static inline int
+UshimVsnprintf (
+    char *Dest,
+    size_t Size,
+    const char *Format,
+    va_list Args
+    )
+{
+    char buffer[USHIM_FORMAT_SIZE];
+    const char *format = UshimFormat( Format, buffer, sizeof( buffer ) );
+    int result = vsnprintf( Dest, Size, format, Args );
+
+    UshimFormatDone( Format, format, buffer );
+    return result;
+}
+
+static inline int
+UshimVsprintf (
+    char *Dest,
+    const char *Format,
+    va_list Args
+    )
+{
+    char buffer[USHIM_FORMAT_SIZE];
+    const char *format = UshimFormat( Format, buffer, sizeof( buffer ) );
+    int result = vsprintf( Dest, format, Args );
+
+    UshimFormatDone( Format, format, buffer );
+    return result;
+}
+
+static inline int
+UshimVprintf (
+    const char *Format,
+    va_list Args
+    )
+{
+    return UshimVfprintf( stdout, Format, Args );
+}
+
+static inline int
+UshimPrintf (
+    const char *Format,
+    ...
+    )
+{
+    va_list args;
+    int result;
+
+    va_start( args, Format );
+    result = UshimVfprintf( stdout, Format, args );
+    va_end( args );
+    return result;
+}
+
+static inline int
+UshimFprintf (
+    FILE *Stream,
+    const char *Format,
+    ...
+    )
+{
+    va_list args;
+    int result;
+
+    va_start( args, Format );
+    result = UshimVfprintf( Stream, Format, args );
+    va_end( args );
+    return result;
+}
+
+static inline int
+UshimSnprintf (
+    char *Dest,
+    size_t Size,
+    const char *Format,
+    ...
+    )
+{
+    va_list args;
+    int result;
+
+    va_start( args, Format );
+    result = UshimVsnprintf( Dest, Size, Format, args );
+    va_end( args );
+    return result;
+}
+
+static inline int
+UshimSprintf (
+    char *Dest,
+    const char *Format,
+    ...
+    )
+{
+    va_list args;
+    int result;
+
+    va_start( args, Format );
+    result = UshimVsprintf( Dest, Format, args );
+    va_end( args );
+    return result;
+}
+
+#define printf                      UshimPrintf
+#define fprintf                     UshimFprintf
+#define snprintf                    UshimSnprintf
+#define sprintf                     UshimSprintf
+#define vprintf                     UshimVprintf
+#define vfprintf                    UshimVfprintf
+#define vsnprintf                   UshimVsnprintf
+#define vsprintf                    UshimVsprintf
+
+//
+//  Interlocked operations, full barriers as on Windows
+//
+
+static inline LONG InterlockedIncrement( LONG volatile *Target ) { return __atomic_add_fetch( Target, 1, __ATOMIC_SEQ_CST ); }
+static inline LONG InterlockedDecrement( LONG volatile *Target ) { return __atomic_sub_fetch( Target, 1, __ATOMIC_SEQ_CST ); }
+static inline LONG InterlockedExchange( LONG volatile *Target, LONG Value ) { return __atomic_exchange_n( Target, Value, __ATOMIC_SEQ_CST ); }
+static inline LONG InterlockedExchangeAdd( LONG volatile *Target, LONG Value ) { return __atomic_fetch_add( Target, Value, __ATOMIC_SEQ_CST ); }
+static inline LONG InterlockedCompareExchange( LONG volatile *Target, LONG Value, LONG Comparand ) { return __sync_val_compare_and_swap( Target, Comparand, Value ); }
+
+static inline LONGLONG InterlockedIncrement64( LONGLONG volatile *Target ) { return __atomic_add_fetch( Target, 1, __ATOMIC_SEQ_CST ); }
+static inline LONGLONG InterlockedDecrement64( LONGLONG volatile *Target ) { return __atomic_sub_fetch( Target, 1, __ATOMIC_SEQ_CST ); }
+static inline LONGLONG InterlockedExchange64( LONGLONG volatile *Target, LONGLONG Value ) { return __atomic_exchange_n( Target, Value, __ATOMIC_SEQ_CST ); }
+static inline LONGLONG InterlockedExchangeAdd64( LONGLONG volatile *Target, LONGLONG Value ) { return __atomic_fetch_add( Target, Value, __ATOMIC_SEQ_CST ); }
+static inline LONGLONG InterlockedCompareExchange64( LONGLONG volatile *Target, LONGLONG Value, LONGLONG Comparand ) { return __sync_val_compare_and_swap( Target, Comparand, Value ); }
+
+static inline PVOID InterlockedExchangePointer( PVOID volatile *Target, PVOID Value ) { return __atomic_exchange_n( Target, Value, __ATOMIC_SEQ_CST ); }
+static inline PVOID InterlockedCompareExchangePointer( PVOID volatile *Target, PVOID Value, PVOID Comparand ) { return __sync_val_compare_and_swap( Target, Comparand, Value ); }
+
+#define MemoryBarrier()                                 __sync_synchronize()
+
+//
+//  SRW locks and condition variables.  A condition variable keeps a mutex
+//  of its own, taken before the SRW lock is let go, so a wake between the
+//  two is not lost.
+//
+
+typedef struct _SRWLOCK {
+    pthread_rwlock_t Lock;
+} SRWLOCK, *PSRWLOCK;
+
+typedef struct _CONDITION_VARIABLE {
+    pthread_mutex_t Mutex;
+    pthread_cond_t Cond;
+} CONDITION_VARIABLE, *PCONDITION_VARIABLE;
+
+#define SRWLOCK_INIT                { PTHREAD_RWLOCK_INITIALIZER }
+#define CONDITION_VARIABLE_INIT     { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+#define CONDITION_VARIABLE_LOCKMODE_SHARED  0x1
+
+#define InitializeSRWLock(SrwLock)          pthread_rwlock_init( &(SrwLock)->Lock, NULL )
+#define AcquireSRWLockExclusive(SrwLock)    pthread_rwlock_wrlock( &(SrwLock)->Lock )
+#define ReleaseSRWLockExclusive(SrwLock)    pthread_rwlock_unlock( &(SrwLock)->Lock )
+#define AcquireSRWLockShared(SrwLock)       pthread_rwlock_rdlock( &(SrwLock)->Lock )
+#define ReleaseSRWLockShared(SrwLock)       pthread_rwlock_unlock( &(SrwLock)->Lock )
+
+static inline VOID
+InitializeConditionVariable (
+    PCONDITION_VARIABLE Condition
+    )
+{
+    pthread_mutex_init( &Condition->Mutex, NULL );
+    pthread_cond_init( &Condition->Cond, NULL );
+}
+
+static inline void
+UshimDeadline (
+    DWORD Milliseconds,
+    struct timespec *Deadline
+    )
+{
+    clock_gettime( CLOCK_REALTIME, Deadline );
+    Deadline->tv_sec += Milliseconds / 1000;
+    Deadline->tv_nsec += (long)(Milliseconds % 1000) * 1000000;
+
+    if (Deadline->tv_nsec >= 1000000000) {
+
+        Deadline->tv_sec++;
+        Deadline->tv_nsec -= 1000000000;
+    }
+}
+
+static inline BOOL
+SleepConditionVariableSRW (
+    PCONDITION_VARIABLE Condition,
+    PSRWLOCK SrwLock,
+    DWORD Milliseconds,
+    ULONG Flags
+    )
+{
+    struct timespec deadline;
+    int status = 0;
+
+    pthread_mutex_lock( &Condition->Mutex );
+    pthread_rwlock_unlock( &SrwLock->Lock );
+
+    if (Milliseconds == INFINITE) {
+
+        pthread_cond_wait( &Condition->Cond, &Condition->Mutex );
+
+    } else {
+
+        UshimDeadline( Milliseconds, &deadline );
+        status = pthread_cond_timedwait( &Condition->Cond, &Condition->Mutex, &deadline );
+    }
+
+    pthread_mutex_unlock( &Condition->Mutex );
+
+    if (Flags & CONDITION_VARIABLE_LOCKMODE_SHARED) {
+
+        pthread_rwlock_rdlock( &SrwLock->Lock );
+
+    } else {
+
+        pthread_rwlock_wrlock( &SrwLock->Lock );
+    }
+
+    return status == 0;
+}
+
+static inline VOID
+WakeConditionVariable (
+    PCONDITION_VARIABLE Condition
+    )
+{
+    pthread_mutex_lock( &Condition->Mutex );
+    pthread_cond_signal( &Condition->Cond );
+    pthread_mutex_unlock( &Condition->Mutex );
+}
+
+static inline VOID
+WakeAllConditionVariable (
+    PCONDITION_VARIABLE Condition
+    )
+{
+    pthread_mutex_lock( &Condition->Mutex );
+    pthread_cond_broadcast( &Condition->Cond );
+    pthread_mutex_unlock( &Condition->Mutex );
+}
+
+//
+//  Handles: threads, events, semaphores and files
+//
+
+typedef enum _USHIM_KIND {
+    UshimThread,
+    UshimEvent,
+    UshimSemaphore,
+    UshimFile
+} USHIM_KIND;
+
+typedef struct _USHIM_HANDLE {
+
+    USHIM_KIND Kind;
+
+    //
+    //  Threads are signaled once they return, events while set and
+    //  semaphores while Count is not 0.
+    //
+
+    pthread_mutex_t Mutex;
+    pthread_cond_t Cond;
+    BOOLEAN Signaled;
+    BOOLEAN AutoReset;
+    LONG Count;
+
+    pthread_t Thread;
+    LPTHREAD_START_ROUTINE Routine;
+    LPVOID Parameter;
+
+    int Fd;
+
+} USHIM_HANDLE, *PUSHIM_HANDLE;
+
+static inline PUSHIM_HANDLE
+UshimAllocateHandle (
+    USHIM_KIND Kind
+    )
+{
+    PUSHIM_HANDLE handle = calloc( 1, sizeof( USHIM_HANDLE ) );
+
+    if (handle != NULL) {
+
+        handle->Kind = Kind;
+        handle->Fd = -1;
+        pthread_mutex_init( &handle->Mutex, NULL );
+        pthread_cond_init( &handle->Cond, NULL );
+    }
+
+    return handle;
+}
+
+static inline void
+UshimSignal (
+    PUSHIM_HANDLE Handle
+    )
+{
+    pthread_mutex_lock( &Handle->Mutex );
+    Handle->Signaled = TRUE;
+    pthread_cond_broadcast( &Handle->Cond );
+    pthread_mutex_unlock( &Handle->Mutex );
+}
+
+static void *
+UshimThreadStart (
+    void *Parameter
+    )
+{
+    PUSHIM_HANDLE handle = Parameter;
+
+    handle->Routine( handle->Parameter );
+    UshimSignal( handle );
+    return NULL;
+}
+
+static inline HANDLE
+CreateThread (
+    void *Attributes,
+    SIZE_T StackSize,
+    LPTHREAD_START_ROUTINE Routine,
+    LPVOID Parameter,
+    DWORD Flags,
+    LPDWORD ThreadId
+    )
+{
+    PUSHIM_HANDLE handle = UshimAllocateHandle( UshimThread );
+
+    UNREFERENCED_PARAMETER( Attributes );
+    UNREFERENCED_PARAMETER( StackSize );
+    UNREFERENCED_PARAMETER( Flags );
+
+    if (handle == NULL) {
+
+        return NULL;
+    }
+
+    handle->Routine = Routine;
+    handle->Parameter = Parameter;
+
+    if (pthread_create( &handle->Thread, NULL, UshimThreadStart, handle ) != 0) {
+
+        free( handle );
+        return NULL;
+    }
+
+    if (ThreadId != NULL) {
+
+        *ThreadId = (DWORD)(ULONG_PTR)handle;
+    }
+
+    return handle;
+}
+
+static inline HANDLE
+CreateEventA (
+    void *Attributes,
+    BOOL ManualReset,
+    BOOL InitialState,
+    LPCSTR Name
+    )
+{
+    PUSHIM_HANDLE handle = UshimAllocateHandle( UshimEvent );
+
+    UNREFERENCED_PARAMETER( Attributes );
+    UNREFERENCED_PARAMETER( Name );
+
+    if (handle != NULL) {
+
+        handle->AutoReset = !ManualReset;
+        handle->Signaled = (BOOLEAN)InitialState;
+    }
+
+    return handle;
+}
+
+#define CreateEvent(Attributes, ManualReset, InitialState, Name) \
+    CreateEventA( (Attributes), (ManualReset), (InitialState), NULL )
+#define CreateEventW CreateEvent
+
+static inline HANDLE
+CreateSemaphore (
+    void *Attributes,
+    LONG Initial,
+    LONG Maximum,
+    const void *Name
+    )
+{
+    PUSHIM_HANDLE handle = UshimAllocateHandle( UshimSemaphore );
+
+    UNREFERENCED_PARAMETER( Attributes );
+    UNREFERENCED_PARAMETER( Maximum );
+    UNREFERENCED_PARAMETER( Name );
+
+    if (handle != NULL) {
+
+        handle->Count = Initial;
+    }
+
+    return handle;
+}
+
+static inline BOOL
+SetEvent (
+    HANDLE Event
+    )
+{
+    UshimSignal( Event );
+    return TRUE;
+}
+
+static inline BOOL
+ResetEvent (
+    HANDLE Event
+    )
+{
+    PUSHIM_HANDLE handle = Event;
+
+    pthread_mutex_lock( &handle->Mutex );
+    handle->Signaled = FALSE;
+    pthread_mutex_unlock( &handle->Mutex );
+    return TRUE;
+}
+
+static inline BOOL
+ReleaseSemaphore (
+    HANDLE Semaphore,
+    LONG Count,
+    PLONG Previous
+    )
+{
+    PUSHIM_HANDLE handle = Semaphore;
+
+    pthread_mutex_lock( &handle->Mutex );
+
+    if (Previous != NULL) {
+
+        *Previous = handle->Count;
+    }
+
+    handle->Count += Count;
+    pthread_cond_broadcast( &handle->Cond );
+    pthread_mutex_unlock( &handle->Mutex );
+    return TRUE;
+}
+
+static inline DWORD
+WaitForSingleObject (
+    HANDLE Object,
+    DWORD Milliseconds
+    )
+{
+    PUSHIM_HANDLE handle = Object;
+    struct timespec deadline;
+    DWORD result = WAIT_OBJECT_0;
+
+    if (Milliseconds != INFINITE) {
+
+        UshimDeadline( Milliseconds, &deadline );
+    }
+
+    pthread_mutex_lock( &handle->Mutex );
+
+    for (;;) {
+
+        if (handle->Kind == UshimSemaphore ? handle->Count > 0 : handle->Signaled) {
+
+            break;
+        }
+
+        if (Milliseconds == INFINITE) {
+
+            pthread_cond_wait( &handle->Cond, &handle->Mutex );
+
+        } else if (Milliseconds == 0 ||
+                   pthread_cond_timedwait( &handle->Cond, &handle->Mutex, &deadline ) == ETIMEDOUT) {
+
+            result = WAIT_TIMEOUT;
+            break;
+        }
+    }
+
+    if (result == WAIT_OBJECT_0) {
+
+        if (handle->Kind == UshimSemaphore) {
+
+            handle->Count--;
+
+        } else if (handle->Kind == UshimEvent && handle->AutoReset) {
+
+            handle->Signaled = FALSE;
+        }
+    }
+
+    pthread_mutex_unlock( &handle->Mutex );
+    return result;
+}
+
+static inline DWORD
+WaitForMultipleObjects (
+    DWORD Count,
+    const HANDLE *Objects,
+    BOOL WaitAll,
+    DWORD Milliseconds
+    )
+{
+    DWORD index;
+
+    if (!WaitAll) {
+
+        return WAIT_FAILED;
+    }
+
+    for (index = 0; index < Count; index++) {
+
+        if (WaitForSingleObject( Objects[index], Milliseconds ) != WAIT_OBJECT_0) {
+
+            return WAIT_TIMEOUT;
+        }
+    }
+
+    return WAIT_OBJECT_0;
+}
+
+static inline BOOL
+CloseHandle (
+    HANDLE Object
+    )
+{
+    PUSHIM_HANDLE handle = Object;
+
+    if (handle == NULL || handle == INVALID_HANDLE_VALUE) {
+
+        return FALSE;
+    }
+
+    if (handle->Kind == UshimThread) {
+
+        pthread_join( handle->Thread, NULL );
+
+    } else if (handle->Kind == UshimFile) {
+
+        close( handle->Fd );
+    }
+
+    pthread_mutex_destroy( &handle->Mutex );
+    pthread_cond_destroy( &handle->Cond );
+    free( handle );
+    return TRUE;
+}
+
+//
+//  Time
+//
+
+static inline VOID
+Sleep (
+    DWORD Milliseconds
+    )
+{
+    struct timespec delay = { Milliseconds / 1000, (long)(Milliseconds % 1000) * 1000000 };
+
+    if (Milliseconds == 0) {
+
+        sched_yield();
+
+    } else {
+
+        nanosleep( &delay, NULL );
+    }
+}
+
+static inline ULONGLONG
+GetTickCount64 (
+    VOID
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (ULONGLONG)now.tv_sec * 1000 + (ULONGLONG)now.tv_nsec / 1000000;
+}
+
+static inline DWORD
+GetTickCount (
+    VOID
+    )
+{
+    return (DWORD)GetTickCount64();
+}
+
+static inline BOOL
+QueryPerformanceFrequency (
+    PLARGE_INTEGER Frequency
+    )
+{
+    Frequency->QuadPart = 1000000000;
+    return TRUE;
+}
+
+static inline BOOL
+QueryPerformanceCounter (
+    PLARGE_INTEGER Counter
+    )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    Counter->QuadPart = (LONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+    return TRUE;
+}
+
+static inline VOID
+GetSystemTimeAsFileTime (
+    LPFILETIME Time
+    )
+{
+    struct timespec now;
+    ULONGLONG ticks;
+
+    //
+    //  100ns units since 1601
+    //
+
+    clock_gettime( CLOCK_REALTIME, &now );
+    ticks = (ULONGLONG)now.tv_sec * 10000000 + (ULONGLONG)now.tv_nsec / 100 + 116444736000000000ULL;
+
+    Time->dwLowDateTime = (DWORD)ticks;
+    Time->dwHighDateTime = (DWORD)(ticks >> 32);
+}
+
+static inline VOID
+GetLocalTime (
+    LPSYSTEMTIME Time
+    )
+{
+    struct timespec now;
+    struct tm local;
+
+    clock_gettime( CLOCK_REALTIME, &now );
+    localtime_r( &now.tv_sec, &local );
+
+    Time->wYear = (WORD)(local.tm_year + 1900);
+    Time->wMonth = (WORD)(local.tm_mon + 1);
+    Time->wDayOfWeek = (WORD)local.tm_wday;
+    Time->wDay = (WORD)local.tm_mday;
+    Time->wHour = (WORD)local.tm_hour;
+    Time->wMinute = (WORD)local.tm_min;
+    Time->wSecond = (WORD)local.tm_sec;
+    Time->wMilliseconds = (WORD)(now.tv_nsec / 1000000);
+}
+
+static inline VOID
+GetSystemInfo (
+    LPSYSTEM_INFO Info
+    )
+{
+    long count = sysconf( _SC_NPROCESSORS_ONLN );
+
+    Info->dwNumberOfProcessors = (count > 0) ? (DWORD)count : 1;
+}
+
+static inline DWORD
+GetLastError (
+    VOID
+    )
+{
+    return (DWORD)errno;
+}
+
+//
+//  Files
+//
+
+static inline HANDLE
+CreateFileA (
+    LPCSTR Name,
+    DWORD Access,
+    DWORD Share,
+    void *Attributes,
+    DWORD Disposition,
+    DWORD Flags,
+    HANDLE Template
+    )
+{
+    PUSHIM_HANDLE handle;
+    int flags;
+    int fd;
+
+    UNREFERENCED_PARAMETER( Share );
+    UNREFERENCED_PARAMETER( Attributes );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Template );
+
+    flags = ((Access & (GENERIC_WRITE | FILE_APPEND_DATA)) == 0) ? O_RDONLY :
+            ((Access & GENERIC_READ) ? O_RDWR : O_WRONLY);
+
+    if (Access & FILE_APPEND_DATA) flags |= O_APPEND;
+
+    switch (Disposition) {
+    case CREATE_NEW:    flags |= O_CREAT | O_EXCL; break;
+    case CREATE_ALWAYS: flags |= O_CREAT | O_TRUNC; break;
+    case OPEN_ALWAYS:   flags |= O_CREAT; break;
+    default:            break;
+    }
+
+    fd = open( Name, flags | O_CLOEXEC, 0644 );
+
+    if (fd < 0) {
+
+        return INVALID_HANDLE_VALUE;
+    }
+
+    handle = UshimAllocateHandle( UshimFile );
+
+    if (handle == NULL) {
+
+        close( fd );
+        return INVALID_HANDLE_VALUE;
+    }
+
+    handle->Fd = fd;
+    return handle;
+}
+
+static inline HANDLE
+CreateFileW (
+    LPCWSTR Name,
+    DWORD Access,
+    DWORD Share,
+    void *Attributes,
+    DWORD Disposition,
+    DWORD Flags,
+    HANDLE Template
+    )
+{
+    char name[4 * MAX_PATH];
+    size_t index;
+
+    //
+    //  Test paths are ASCII
+    //
+
+    for (index = 0; Name[index] != 0 && index < sizeof( name ) - 1; index++) {
+
+        name[index] = (Name[index] < 0x80) ? (char)Name[index] : '?';
+    }
+
+    name[index] = '\0';
+    return CreateFileA( name, Access, Share, Attributes, Disposition, Flags, Template );
+}
+
+static inline BOOL
+ReadFile (
+    HANDLE File,
+    LPVOID Buffer,
+    DWORD Length,
+    LPDWORD Read,
+    void *Overlapped
+    )
+{
+    ssize_t done = read( ((PUSHIM_HANDLE)File)->Fd, Buffer, Length );
+
+    UNREFERENCED_PARAMETER( Overlapped );
+
+    *Read = (done > 0) ? (DWORD)done : 0;
+    return done >= 0;
+}
+
+static inline BOOL
+WriteFile (
+    HANDLE File,
+    const void *Buffer,
+    DWORD Length,
+    LPDWORD Written,
+    void *Overlapped
+    )
+{
+    ssize_t done = write( ((PUSHIM_HANDLE)File)->Fd, Buffer, Length );
+
+    UNREFERENCED_PARAMETER( Overlapped );
+
+    if (Written != NULL) {
+
+        *Written = (done > 0) ? (DWORD)done : 0;
+    }
+
+    return done == (ssize_t)Length;
+}
+
+static inline BOOL
+GetFileSizeEx (
+    HANDLE File,
+    PLARGE_INTEGER Size
+    )
+{
+    struct stat status;
+
+    if (fstat( ((PUSHIM_HANDLE)File)->Fd, &status ) != 0) {
+
+        return FALSE;
+    }
+
+    Size->QuadPart = status.st_size;
+    return TRUE;
+}
+
+static inline BOOL
+GetFileInformationByHandle (
+    HANDLE File,
+    LPBY_HANDLE_FILE_INFORMATION Info
+    )
+{
+    struct stat status;
+    ULONGLONG time;
+
+    if (fstat( ((PUSHIM_HANDLE)File)->Fd, &status ) != 0) {
+
+        return FALSE;
+    }
+
+    memset( Info, 0, sizeof( *Info ) );
+
+    time = (ULONGLONG)status.st_mtim.tv_sec * 10000000 + (ULONGLONG)status.st_mtim.tv_nsec / 100 + 116444736000000000ULL;
+
+    Info->ftLastWriteTime.dwLowDateTime = (DWORD)time;
+    Info->ftLastWriteTime.dwHighDateTime = (DWORD)(time >> 32);
+    Info->dwVolumeSerialNumber = (DWORD)status.st_dev;
+    Info->nFileSizeHigh = (DWORD)((ULONGLONG)status.st_size >> 32);
+    Info->nFileSizeLow = (DWORD)status.st_size;
+    Info->nNumberOfLinks = (DWORD)status.st_nlink;
+    Info->nFileIndexHigh = (DWORD)((ULONGLONG)status.st_ino >> 32);
+    Info->nFileIndexLow = (DWORD)status.st_ino;
+    return TRUE;
+}
+
+static inline BOOL
+MoveFileExA (
+    LPCSTR From,
+    LPCSTR To,
+    DWORD Flags
+    )
+{
+    UNREFERENCED_PARAMETER( Flags );
+    return rename( From, To ) == 0;
+}
+
+static inline BOOL
+DeleteFileA (
+    LPCSTR Name
+    )
+{
+    return unlink( Name ) == 0;
+}
+
+static inline DWORD
+GetFileAttributesA (
+    LPCSTR Name
+    )
+{
+    struct stat status;
+
+    if (stat( Name, &status ) != 0) {
+
+        return INVALID_FILE_ATTRIBUTES;
+    }
+
+    return S_ISDIR( status.st_mode ) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+}
+
+#endif //__USHIM_WINDOWS_H__
@@ -0,0 +1,4 @@
+//
+//  A stand-in for the SDK's winioctl.h, see windows.h.  The control codes
+//  mspyLog.c names are in minispy.h's own tables.
+//
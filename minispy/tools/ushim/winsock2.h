@@ -0,0 +1,27 @@
+//
+//  A stand-in for the SDK's winsock2.h, see windows.h.  Sockets are the
+//  C library's, there is nothing to start or clean up.
+//
+
+#ifndef __USHIM_WINSOCK2_H__
+#define __USHIM_WINSOCK2_H__
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+typedef int                         SOCKET;
+
+typedef struct _WSADATA {
+    unsigned short wVersion;
+} WSADATA, *LPWSADATA;
+
+#define INVALID_SOCKET              (-1)
+#define SOCKET_ERROR                (-1)
+
+#define closesocket(Socket)         close( Socket )
+#define WSAStartup(Version, Data)   ((void)(Version), (void)(Data), 0)
+#define WSACleanup()                ((void)0)
+#define WSAGetLastError()           errno
+
+#endif //__USHIM_WINSOCK2_H__
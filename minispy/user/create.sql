@@ -23,15 +23,22 @@ CREATE TABLE IF NOT EXISTS MinifilterLog (
     Arg4 INTEGER,                       -- 
     Arg5 INTEGER,                       -- 
     Arg6 TEXT,                        -- 
-    OpFileName TEXT,           -- The name of the file associated with the operation.
+    OpFileName TEXT,           -- The name of the file associated with the operation, for rows logged before FileID.
     RequestorMode TEXT,
     RuleID INTEGER,
     RuleAction INTEGER,
+    StatusCode INTEGER,             -- Raw NTSTATUS of the operation, signed.  Indexed for errors in index.sql.
+    ByteOffset INTEGER,             -- Arguments decoded by major function (mspyArgs.c), NULL where they do not apply:
+    ByteLength INTEGER,             --   the range of a read, write or lock, or the buffer length of a query or set.
+    InfoClass INTEGER,              --   FILE_INFORMATION_CLASS or FS_INFORMATION_CLASS of a query or set.
+    ControlCode INTEGER,            --   FSCTL or IOCTL code.
+    FileID INTEGER,                 -- The file associated with the operation, its name is in Files (files.sql).
     FOREIGN KEY (MajorOp) REFERENCES MajorIRPCodes(MajorIRPCodeID),
     FOREIGN KEY (MinorOp) REFERENCES MinorIRPCodes(MinorIRPCodeID),
     FOREIGN KEY (OprType) REFERENCES OperationTypes(OperationTypeID),
     FOREIGN KEY (IrpFlags) REFERENCES IRPFlags(IRPFlagID),
-    FOREIGN KEY (RuleID) REFERENCES Rules(RuleID)
+    FOREIGN KEY (RuleID) REFERENCES Rules(RuleID),
+    FOREIGN KEY (FileID) REFERENCES Files(FileID)
 );
 
 -- DROP TABLE IF EXISTS Alerts;
@@ -76,7 +83,13 @@ VALUES
     (22, 'OpFileName', 'Operation File Name', 'The name or path of the file being operated on.'),
     (23, 'RequestorMode', 'Requestor Mode', 'Indicates whether the request originated from User Mode or Kernel Mode.'),
     (24, 'RuleID', 'Rule ID', 'Reference to the rule that was triggered by this operation.'),
-    (25, 'RuleAction', 'Rule Action', 'Action taken (e.g., Allow, Block, Alert) as defined in the rule.');
+    (25, 'RuleAction', 'Rule Action', 'Action taken (e.g., Allow, Block, Alert) as defined in the rule.'),
+    (26, 'StatusCode', 'Status Code', 'Raw NTSTATUS value of the operation as a signed 32 bit number; errors are negative.'),
+    (27, 'ByteOffset', 'Byte Offset', 'Starting byte offset of a read, write or byte range lock. NULL where it does not apply.'),
+    (28, 'ByteLength', 'Byte Length', 'Bytes requested by a read, write or byte range lock, or the buffer length of a query or set. NULL where it does not apply.'),
+    (29, 'InfoClass', 'Information Class', 'FILE_INFORMATION_CLASS or FS_INFORMATION_CLASS of a query or set information operation.'),
+    (30, 'ControlCode', 'Control Code', 'FSCTL or IOCTL code of a file system or device control operation.'),
+    (31, 'FileID', 'File ID', 'Reference to the name of the file in Files. Rows logged before it existed hold the name in OpFileName instead.');
 
 
 -- DROP TABLE IF EXISTS OperationTypes;
@@ -298,10 +311,9 @@ CREATE TABLE IF NOT EXISTS RuleHistory (
 
 -- =================================================================== Views ===================================================================
 
--- Total Operations Count
-CREATE VIEW IF NOT EXISTS View_TotalOperations AS
-SELECT COUNT(*) AS TotalOperations
-FROM MinifilterLog;
+-- The operation, requestor mode, status, process and file counts are read
+-- from the Summary_* tables defined in summary.sql, which is applied every
+-- time the log writer opens the database.
 
 -- Total Alerts Count
 CREATE VIEW IF NOT EXISTS View_TotalAlerts AS
@@ -319,32 +331,6 @@ WHERE PreOpTime IS NOT NULL AND PostOpTime IS NOT NULL
 GROUP BY MajorOp;
 
 
--- Operation Breakdown (for Pie Chart)
-CREATE VIEW IF NOT EXISTS View_OperationBreakdown AS
-SELECT 
-    MajorOp,
-    MinorOp,
-    COUNT(*) AS Count
-FROM MinifilterLog
-GROUP BY MajorOp, MinorOp;
-
--- Kernel vs User Requested Operations (Bar Chart)
-CREATE VIEW IF NOT EXISTS View_RequestorModeCount AS
-SELECT 
-    RequestorMode,
-    COUNT(*) AS Count
-FROM MinifilterLog
-GROUP BY RequestorMode;
-
--- Operation Status Frequency (Ranked Table)
-CREATE VIEW IF NOT EXISTS View_OpStatusCount AS
-SELECT 
-    OpStatus,
-    COUNT(*) AS Count
-FROM MinifilterLog
-GROUP BY OpStatus
-ORDER BY Count DESC;
-
 -- Stacked Bar of Operation Type by Requestor Mode
 CREATE VIEW IF NOT EXISTS View_OpTypeByRequestor AS
 SELECT 
@@ -363,36 +349,6 @@ SELECT
 FROM MinifilterLog
 GROUP BY MajorOp, RequestorMode;
 
--- File Operation Counts (Tree + Table)
-CREATE VIEW IF NOT EXISTS View_FileOpCounts AS
-SELECT 
-    OpFileName,
-    COUNT(*) AS Count
-FROM MinifilterLog
-WHERE OpFileName IS NOT NULL
-GROUP BY OpFileName
-ORDER BY Count DESC;
-
--- File Write Operations Over Time
-CREATE VIEW IF NOT EXISTS View_FileWriteTiming AS
-SELECT 
-    OpFileName,
-    PreOpTime,
-    PostOpTime,
-    (PostOpTime - PreOpTime) AS DurationNano
-FROM MinifilterLog
-WHERE MajorOp IN ('IRP_MJ_WRITE', 'IRP_MJ_CREATE', 'IRP_MJ_SET_INFORMATION');
-
--- Process Operation Counts
-CREATE VIEW IF NOT EXISTS View_ProcessOpCounts AS
-SELECT 
-    ProcessId,
-    ProcessFilePath,
-    COUNT(*) AS Count
-FROM MinifilterLog
-GROUP BY ProcessId, ProcessFilePath
-ORDER BY Count DESC;
-
 -- Process Threads Tree
 CREATE VIEW IF NOT EXISTS View_ThreadBreakdown AS
 SELECT 
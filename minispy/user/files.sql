@@ -0,0 +1,39 @@
+-- Names of the files in MinifilterLog (mspyFiles.c).  Most operations go to
+-- a small working set of files, so each name is stored once here and rows
+-- refer to it by MinifilterLog.FileID.  This file is applied every time the
+-- writer opens the database, so every statement must be safe to run again.
+--
+-- Rows logged before FileID existed still hold their name in OpFileName,
+-- until files_migrate.sql moves them over, so read a row's name as
+-- COALESCE(Files.Path, MinifilterLog.OpFileName).
+
+CREATE TABLE IF NOT EXISTS Files (
+    FileID INTEGER PRIMARY KEY,
+    Path TEXT NOT NULL UNIQUE            -- As the filter reported it, UTF-8.  The writer matches it exactly.
+);
+
+-- Everything done to a file or below a directory.  Windows paths are case
+-- insensitive, and with the default case insensitive LIKE SQLite can only
+-- turn a prefix match into a range scan on a NOCASE index.  The rows are
+-- then found through Index_MinifilterLog_File.
+--   SELECT ... FROM MinifilterLog WHERE FileID IN
+--       (SELECT FileID FROM Files WHERE Path LIKE '\Device\HarddiskVolume3\Users\%')
+CREATE INDEX IF NOT EXISTS Index_Files_Path
+    ON Files (Path COLLATE NOCASE);
+
+-- =================================================================== Views ===================================================================
+
+-- File Write Operations Over Time
+-- The three operations are a large part of the log, so the view scans it;
+-- the unary + keeps SQLite from going through Index_MinifilterLog_MajorOpTime
+-- and looking each row up again, which is slower (tools/mspyIndexBench.c).
+DROP VIEW IF EXISTS View_FileWriteTiming;
+CREATE VIEW View_FileWriteTiming AS
+SELECT 
+    COALESCE(Files.Path, MinifilterLog.OpFileName) AS OpFileName,
+    PreOpTime,
+    PostOpTime,
+    (PostOpTime - PreOpTime) AS DurationNano
+FROM MinifilterLog
+LEFT JOIN Files ON Files.FileID = MinifilterLog.FileID
+WHERE +MajorOp IN ('IRP_MJ_WRITE', 'IRP_MJ_CREATE', 'IRP_MJ_SET_INFORMATION');
@@ -0,0 +1,28 @@
+-- Moves the file names of rows logged before the Files table existed into
+-- it, so every row refers to its file by FileID.  Not applied by the
+-- writer, run it by hand on a database or partition that is not being
+-- written to, after the writer has opened it once to add FileID and Files:
+--
+--   sqlite3 MinifilterLog.db ".read files_migrate.sql"
+--
+-- Rows are rewritten in place and the file is vacuumed at the end to give
+-- back the space the names took, which needs as much free disk space again
+-- as the database.  Running it again does nothing more.
+
+BEGIN;
+
+INSERT OR IGNORE INTO Files (Path)
+    SELECT DISTINCT OpFileName FROM MinifilterLog
+    WHERE FileID IS NULL AND OpFileName IS NOT NULL;
+
+UPDATE MinifilterLog
+    SET FileID = (SELECT FileID FROM Files WHERE Path = MinifilterLog.OpFileName),
+        OpFileName = NULL
+    WHERE FileID IS NULL AND OpFileName IS NOT NULL;
+
+-- Names are searched through Index_Files_Path now.
+DROP INDEX IF EXISTS Index_MinifilterLog_FileName;
+
+COMMIT;
+
+VACUUM;
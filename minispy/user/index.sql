@@ -0,0 +1,57 @@
+-- Indexes on MinifilterLog for the ways the log is actually queried.  This
+-- file is applied every time the log writer opens the database, so every
+-- statement must be safe to run again.  The first run against a large
+-- existing log builds each index once, which can take a while.
+--
+-- Every index costs a B-tree insert per logged operation, so only access
+-- paths the dashboard or an investigation really uses get one.  The
+-- queries each index is meant for are listed above it; check them with
+-- EXPLAIN QUERY PLAN after changing anything here, and tools/mspyIndexBench.c
+-- for what they cost and buy.
+
+-- Operations in a time window, optionally for one process.
+--   SELECT ... FROM MinifilterLog WHERE PreOpTime BETWEEN ? AND ?
+-- PreOpTime grows with LogID, so new rows go at the right edge of this
+-- index and it is the cheapest one to maintain.
+CREATE INDEX IF NOT EXISTS Index_MinifilterLog_Time
+    ON MinifilterLog (PreOpTime);
+
+-- Timeline of a single process.
+--   SELECT ... FROM MinifilterLog WHERE ProcessId = ? AND PreOpTime >= ?
+--   SELECT ... FROM MinifilterLog WHERE ProcessId = ? ORDER BY PreOpTime
+CREATE INDEX IF NOT EXISTS Index_MinifilterLog_ProcessTime
+    ON MinifilterLog (ProcessId, PreOpTime);
+
+-- Everything done to a file or below a directory.  Names are matched in
+-- Files, on Index_Files_Path (files.sql), and an integer is cheaper to
+-- index per row than the whole path.  Databases from before Files keep
+-- their index on OpFileName for the rows logged then, files_migrate.sql
+-- drops it.
+--   SELECT ... FROM MinifilterLog WHERE FileID IN
+--       (SELECT FileID FROM Files WHERE Path LIKE '\Device\HarddiskVolume3\Users\%')
+--   SELECT ... FROM MinifilterLog WHERE FileID = ?
+CREATE INDEX IF NOT EXISTS Index_MinifilterLog_File
+    ON MinifilterLog (FileID);
+
+-- Per operation breakdowns.  Covers View_OpDurationSummary, which then
+-- never reads the table itself, and single operations that are rare in
+-- the log.  View_FileWriteTiming does not use it: its three operations
+-- are too much of the log for going through an index to pay.
+--   SELECT MajorOp, AVG(PostOpTime - PreOpTime) ... GROUP BY MajorOp
+--   SELECT ... FROM MinifilterLog WHERE MajorOp = ? AND PreOpTime >= ?
+CREATE INDEX IF NOT EXISTS Index_MinifilterLog_MajorOpTime
+    ON MinifilterLog (MajorOp, PreOpTime, PostOpTime);
+
+-- Failed operations only.  StatusCode is the raw NTSTATUS as a signed
+-- 32 bit value, so the error severity statuses, 0xC0000000 to 0xFFFFFFFF,
+-- are -1073741824 to -1; warnings are below them.  Successful operations,
+-- which are nearly all of the log, are not in this index at all.  Queries
+-- must spell the range the same way for SQLite to use it.
+--   SELECT ... FROM MinifilterLog WHERE StatusCode BETWEEN -1073741824 AND -1 AND PreOpTime >= ?
+-- Index_MinifilterLog_Errors had the range wrong, holding warnings
+-- instead, and is replaced.
+DROP INDEX IF EXISTS Index_MinifilterLog_Errors;
+
+CREATE INDEX IF NOT EXISTS Index_MinifilterLog_Failures
+    ON MinifilterLog (PreOpTime, ProcessId, StatusCode)
+    WHERE StatusCode BETWEEN -1073741824 AND -1;
@@ -0,0 +1,512 @@
+/*++
+
+Module Name:
+
+    mspyAlert.c
+
+Abstract:
+
+    Queues alerts and writes them in batches over one connection.
+
+    WriteAlertToDatabase used to open the database, insert one row and
+    close it again on every call, on whatever thread raised the alert,
+    the log retrieval thread included.  A storm of alerts, such as one per
+    record the filter could not allocate, then slowed ingestion to the
+    speed of SQLite commits.
+
+    Now posting formats the alert and adds it to the pending queue under a
+    lock.  An alert identical to one already pending only bumps its count.
+    Every call site is rate limited with a token bucket keyed by its
+    format string, alerts over the limit are only counted.  The alert
+    thread swaps the queue out every ALERT_FLUSH_INTERVAL and writes it,
+    with the counts, in one transaction.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <sqlite3.h>
+#include "mspyLog.h"
+#include "mspyAlert.h"
+
+typedef struct _ALERT_ENTRY {
+
+    ULONG Hash;
+    ULONG Count;
+    char Timestamp[32];                 // of the first occurrence
+    char Message[ALERT_MESSAGE_SIZE];
+
+} ALERT_ENTRY, *PALERT_ENTRY;
+
+typedef struct _ALERT_SOURCE {
+
+    const char *Source;                 // NULL if the slot is free
+    ULONG Tokens;                       // in thousandths of an alert
+    ULONGLONG Refilled;                 // tick of the last refill
+    ULONG Suppressed;
+
+} ALERT_SOURCE, *PALERT_SOURCE;
+
+typedef struct _ALERT_STATE {
+
+    SRWLOCK Lock;
+    CONDITION_VARIABLE Wake;
+
+    HANDLE Thread;
+    BOOLEAN Running;                    // posts are queued, under Lock
+    BOOLEAN Stop;                       // under Lock
+
+    //
+    //  Alerts posted since the last write, under Lock.  The alert thread
+    //  swaps Pending and Writing, so only it touches Writing.
+    //
+
+    PALERT_ENTRY Pending;
+    ULONG PendingCount;
+    PALERT_ENTRY Writing;
+
+    ALERT_SOURCE Sources[ALERT_SOURCES];
+    ULONG Dropped;
+
+    sqlite3 *Db;
+    sqlite3_stmt *Insert;
+
+} ALERT_STATE, *PALERT_STATE;
+
+static ALERT_STATE AlertState;
+
+static ULONG
+AlertHash (
+    _In_z_ const char *Message
+    )
+{
+    ULONG hash = 2166136261UL;
+
+    while (*Message != '\0') {
+
+        hash = (hash ^ (UCHAR)*Message++) * 16777619UL;
+    }
+
+    return hash;
+}
+
+static VOID
+AlertTimestamp (
+    _Out_writes_(Size) char *Buffer,
+    _In_ size_t Size
+    )
+{
+    SYSTEMTIME localTime;
+
+    GetLocalTime( &localTime );
+
+    snprintf( Buffer, Size,
+              "%04d-%02d-%02d %02d:%02d:%02d.%03d",
+              localTime.wYear,
+              localTime.wMonth,
+              localTime.wDay,
+              localTime.wHour,
+              localTime.wMinute,
+              localTime.wSecond,
+              localTime.wMilliseconds );
+}
+
+static BOOLEAN
+AlertTakeToken (
+    _In_z_ const char *Source
+    )
+/*++
+
+Routine Description:
+
+    Takes one alert from the token bucket of a source.  Called with the
+    lock held.  When the table is full the last slot is shared by every
+    further source.
+
+Return Value:
+
+    FALSE if the source is over its rate and the alert must be suppressed.
+
+--*/
+{
+    PALERT_SOURCE source = NULL;
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG tokens;
+    ULONG index;
+
+    for (index = 0; index < ALERT_SOURCES; index++) {
+
+        source = &AlertState.Sources[index];
+
+        if (source->Source == Source) {
+
+            break;
+        }
+
+        if (source->Source == NULL) {
+
+            source->Source = Source;
+            source->Tokens = ALERT_SOURCE_BURST * 1000;
+            source->Refilled = now;
+            break;
+        }
+    }
+
+    tokens = source->Tokens + (now - source->Refilled) * ALERT_SOURCE_RATE;
+    source->Tokens = (ULONG)min( tokens, ALERT_SOURCE_BURST * 1000 );
+    source->Refilled = now;
+
+    if (source->Tokens < 1000) {
+
+        source->Suppressed++;
+        return FALSE;
+    }
+
+    source->Tokens -= 1000;
+    return TRUE;
+}
+
+BOOLEAN
+AlertPost (
+    _In_z_ const char *Source,
+    _In_z_ const char *Timestamp,
+    _In_z_ const char *Message
+    )
+/*++
+
+Routine Description:
+
+    Queues an alert for the alert thread.  Never waits for the database.
+
+Arguments:
+
+    Source - Identifies the call site for the rate limit, the format string
+        passed to WriteAlertToDatabase.  Must stay valid.
+
+    Timestamp - When the alert was raised.
+
+    Message - The formatted alert.
+
+Return Value:
+
+    FALSE if the alert thread is not running, the caller writes the alert
+    itself.  TRUE if the alert was queued, coalesced, suppressed or
+    dropped.
+
+--*/
+{
+    ULONG hash = AlertHash( Message );
+    PALERT_ENTRY entry;
+    ULONG index;
+
+    AcquireSRWLockExclusive( &AlertState.Lock );
+
+    if (!AlertState.Running) {
+
+        ReleaseSRWLockExclusive( &AlertState.Lock );
+        return FALSE;
+    }
+
+    //
+    //  A repeat of a pending alert costs nothing against the rate limit.
+    //
+
+    for (index = 0; index < AlertState.PendingCount; index++) {
+
+        entry = &AlertState.Pending[index];
+
+        if (entry->Hash == hash && strcmp( entry->Message, Message ) == 0) {
+
+            entry->Count++;
+            ReleaseSRWLockExclusive( &AlertState.Lock );
+            return TRUE;
+        }
+    }
+
+    if (AlertTakeToken( Source )) {
+
+        if (AlertState.PendingCount < ALERT_QUEUE_LENGTH) {
+
+            entry = &AlertState.Pending[AlertState.PendingCount++];
+            entry->Hash = hash;
+            entry->Count = 1;
+            strncpy_s( entry->Timestamp, sizeof( entry->Timestamp ), Timestamp, _TRUNCATE );
+            strncpy_s( entry->Message, sizeof( entry->Message ), Message, _TRUNCATE );
+
+        } else {
+
+            AlertState.Dropped++;
+        }
+    }
+
+    ReleaseSRWLockExclusive( &AlertState.Lock );
+    return TRUE;
+}
+
+static VOID
+AlertInsert (
+    _In_z_ const char *Timestamp,
+    _In_z_ const char *Message
+    )
+{
+    sqlite3_bind_text( AlertState.Insert, 1, Timestamp, -1, SQLITE_TRANSIENT );
+    sqlite3_bind_text( AlertState.Insert, 2, Message, -1, SQLITE_TRANSIENT );
+
+    if (sqlite3_step( AlertState.Insert ) != SQLITE_DONE) {
+
+        WriteToLogAnsi( "SQLite insert failed on Alert: %s", sqlite3_errmsg( AlertState.Db ) );
+    }
+
+    sqlite3_reset( AlertState.Insert );
+}
+
+static VOID
+AlertFlush (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Takes the pending alerts and the suppressed and dropped counts and
+    writes them in one transaction.  Called on the alert thread only.
+
+--*/
+{
+    const char *sources[ALERT_SOURCES];
+    ULONG suppressed[ALERT_SOURCES];
+    PALERT_ENTRY batch;
+    ULONG count;
+    ULONG sourceCount = 0;
+    ULONG dropped;
+    ULONG index;
+    char timestamp[32];
+    char message[ALERT_MESSAGE_SIZE + 64];
+
+    AcquireSRWLockExclusive( &AlertState.Lock );
+
+    batch = AlertState.Pending;
+    count = AlertState.PendingCount;
+    AlertState.Pending = AlertState.Writing;
+    AlertState.PendingCount = 0;
+    AlertState.Writing = batch;
+
+    for (index = 0; index < ALERT_SOURCES; index++) {
+
+        if (AlertState.Sources[index].Suppressed != 0) {
+
+            sources[sourceCount] = AlertState.Sources[index].Source;
+            suppressed[sourceCount++] = AlertState.Sources[index].Suppressed;
+            AlertState.Sources[index].Suppressed = 0;
+        }
+    }
+
+    dropped = AlertState.Dropped;
+    AlertState.Dropped = 0;
+
+    ReleaseSRWLockExclusive( &AlertState.Lock );
+
+    if (count == 0 && sourceCount == 0 && dropped == 0) {
+
+        return;
+    }
+
+    if (sqlite3_exec( AlertState.Db, "BEGIN;", NULL, NULL, NULL ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "Could not write %lu alert(s): %s", count, sqlite3_errmsg( AlertState.Db ) );
+        return;
+    }
+
+    for (index = 0; index < count; index++) {
+
+        if (batch[index].Count == 1) {
+
+            AlertInsert( batch[index].Timestamp, batch[index].Message );
+
+        } else {
+
+            snprintf( message, sizeof( message ), "%s (repeated %lu times)", batch[index].Message, batch[index].Count );
+            AlertInsert( batch[index].Timestamp, message );
+        }
+    }
+
+    AlertTimestamp( timestamp, sizeof( timestamp ) );
+
+    for (index = 0; index < sourceCount; index++) {
+
+        snprintf( message, sizeof( message ), "%lu alert(s) over the rate limit suppressed: %s", suppressed[index], sources[index] );
+        AlertInsert( timestamp, message );
+    }
+
+    if (dropped != 0) {
+
+        snprintf( message, sizeof( message ), "%lu alert(s) dropped, the alert queue was full", dropped );
+        AlertInsert( timestamp, message );
+    }
+
+    if (sqlite3_exec( AlertState.Db, "COMMIT;", NULL, NULL, NULL ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "SQLite commit failed on Alerts: %s", sqlite3_errmsg( AlertState.Db ) );
+        sqlite3_exec( AlertState.Db, "ROLLBACK;", NULL, NULL, NULL );
+    }
+}
+
+static DWORD WINAPI
+AlertThread (
+    _In_ LPVOID Parameter
+    )
+{
+    BOOLEAN stop = FALSE;
+
+    UNREFERENCED_PARAMETER( Parameter );
+
+    while (!stop) {
+
+        AcquireSRWLockExclusive( &AlertState.Lock );
+
+        if (!AlertState.Stop) {
+
+            SleepConditionVariableSRW( &AlertState.Wake, &AlertState.Lock, ALERT_FLUSH_INTERVAL, 0 );
+        }
+
+        stop = AlertState.Stop;
+
+        ReleaseSRWLockExclusive( &AlertState.Lock );
+
+        //
+        //  The last flush after a stop takes whatever was posted before
+        //  posting was turned off.
+        //
+
+        AlertFlush();
+    }
+
+    return 0;
+}
+
+BOOLEAN
+AlertStart (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Opens the connection alerts are written over and starts the alert
+    thread.  Until this succeeds WriteAlertToDatabase writes every alert
+    itself.
+
+Return Value:
+
+    TRUE if alerts are queued.
+
+--*/
+{
+    InitializeSRWLock( &AlertState.Lock );
+    InitializeConditionVariable( &AlertState.Wake );
+
+    if (!InitializeDatabase()) {
+
+        return FALSE;
+    }
+
+    AlertState.Pending = calloc( ALERT_QUEUE_LENGTH, sizeof( ALERT_ENTRY ) );
+    AlertState.Writing = calloc( ALERT_QUEUE_LENGTH, sizeof( ALERT_ENTRY ) );
+
+    if (AlertState.Pending == NULL || AlertState.Writing == NULL) {
+
+        goto Fail;
+    }
+
+    if (sqlite3_open( DATABASE_FILE_LOCATION, &AlertState.Db ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "Could not open %s for alerts: %s", DATABASE_FILE_LOCATION, sqlite3_errmsg( AlertState.Db ) );
+        goto Fail;
+    }
+
+    sqlite3_busy_timeout( AlertState.Db, 5000 );
+
+    if (sqlite3_prepare_v2( AlertState.Db,
+                            "INSERT INTO Alerts (Timestamp, AlertMessage) VALUES (?, ?);",
+                            -1,
+                            &AlertState.Insert,
+                            NULL ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "Failed to prepare alert insert: %s", sqlite3_errmsg( AlertState.Db ) );
+        goto Fail;
+    }
+
+    AlertState.Stop = FALSE;
+    AlertState.Running = TRUE;
+    AlertState.Thread = CreateThread( NULL, 0, AlertThread, NULL, 0, NULL );
+
+    if (AlertState.Thread == NULL) {
+
+        AlertState.Running = FALSE;
+        goto Fail;
+    }
+
+    return TRUE;
+
+Fail:
+
+    sqlite3_finalize( AlertState.Insert );
+    AlertState.Insert = NULL;
+    sqlite3_close( AlertState.Db );
+    AlertState.Db = NULL;
+    free( AlertState.Pending );
+    free( AlertState.Writing );
+    AlertState.Pending = NULL;
+    AlertState.Writing = NULL;
+    return FALSE;
+}
+
+VOID
+AlertStop (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Writes the alerts still queued and stops the alert thread.  Alerts
+    posted afterwards are written directly again.
+
+--*/
+{
+    if (AlertState.Thread == NULL) {
+
+        return;
+    }
+
+    AcquireSRWLockExclusive( &AlertState.Lock );
+
+    AlertState.Running = FALSE;
+    AlertState.Stop = TRUE;
+
+    ReleaseSRWLockExclusive( &AlertState.Lock );
+
+    WakeConditionVariable( &AlertState.Wake );
+    WaitForSingleObject( AlertState.Thread, INFINITE );
+
+    CloseHandle( AlertState.Thread );
+    AlertState.Thread = NULL;
+
+    sqlite3_finalize( AlertState.Insert );
+    AlertState.Insert = NULL;
+    sqlite3_close( AlertState.Db );
+    AlertState.Db = NULL;
+    free( AlertState.Pending );
+    free( AlertState.Writing );
+    AlertState.Pending = NULL;
+    AlertState.Writing = NULL;
+}
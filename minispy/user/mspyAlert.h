@@ -0,0 +1,67 @@
+/*++
+
+Module Name:
+
+    mspyAlert.h
+
+Abstract:
+
+    Writes the alerts posted by WriteAlertToDatabase from a thread of its
+    own, so posting an alert never opens the database or waits for a
+    commit.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYALERT_H__
+#define __MSPYALERT_H__
+
+#include <windows.h>
+
+#define ALERT_MESSAGE_SIZE      1024
+
+//
+//  Alerts are written in one transaction this often.  Identical alerts
+//  posted within one interval are written once with a count.
+//
+
+#define ALERT_FLUSH_INTERVAL    1000        // milliseconds
+
+//
+//  Distinct alerts held between two writes.  Past this further alerts are
+//  dropped and counted.
+//
+
+#define ALERT_QUEUE_LENGTH      256
+
+//
+//  Every call site of WriteAlertToDatabase is a source with its own rate
+//  limit: a burst of ALERT_SOURCE_BURST alerts, then ALERT_SOURCE_RATE a
+//  second.  Alerts over the limit are counted and the count written
+//  instead.
+//
+
+#define ALERT_SOURCES           64
+#define ALERT_SOURCE_RATE       5
+#define ALERT_SOURCE_BURST      20
+
+BOOLEAN
+AlertStart (
+    VOID
+    );
+
+VOID
+AlertStop (
+    VOID
+    );
+
+BOOLEAN
+AlertPost (
+    _In_z_ const char *Source,
+    _In_z_ const char *Timestamp,
+    _In_z_ const char *Message
+    );
+
+#endif //__MSPYALERT_H__
@@ -0,0 +1,232 @@
+/*++
+
+Module Name:
+
+    mspyArgs.c
+
+Abstract:
+
+    Decodes RECORD_DATA.Arg1..Arg6 by major function.
+
+    The filter copies Parameters.Others, the untyped view of the
+    FLT_PARAMETERS union, so the arguments are laid out as the member for
+    the record's major function is.  The six arguments are put back into
+    that shape and read through ARGS_PARAMETERS.
+
+    One decoder per major function, picked from ArgsDecoders.  Majors
+    without one leave every field invalid.
+
+    Nothing here calls the system.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyArgs.h"
+
+typedef VOID
+(*ARGS_DECODER) (
+    _In_ UCHAR MinorFunction,
+    _In_ PARGS_PARAMETERS Parameters,
+    _Inout_ PRECORD_ARGS Args
+    );
+
+static VOID
+ArgsDecodeReadWrite (
+    _In_ UCHAR MinorFunction,
+    _In_ PARGS_PARAMETERS Parameters,
+    _Inout_ PRECORD_ARGS Args
+    )
+{
+    //
+    //  Completing an MDL read or write only hands the MDL back.
+    //
+
+    if (FlagOn( MinorFunction, IRP_MN_COMPLETE )) {
+
+        return;
+    }
+
+    Args->Offset = Parameters->ReadWrite.ByteOffset.QuadPart;
+    Args->Length = (ULONG)Parameters->ReadWrite.Length;
+    Args->Valid = ARGS_OFFSET | ARGS_LENGTH;
+}
+
+static VOID
+ArgsDecodeInformation (
+    _In_ UCHAR MinorFunction,
+    _In_ PARGS_PARAMETERS Parameters,
+    _Inout_ PRECORD_ARGS Args
+    )
+{
+    UNREFERENCED_PARAMETER( MinorFunction );
+
+    Args->Length = (ULONG)Parameters->Information.Length;
+    Args->InfoClass = (ULONG)Parameters->Information.InformationClass;
+    Args->Valid = ARGS_LENGTH | ARGS_INFO_CLASS;
+}
+
+static VOID
+ArgsDecodeBuffer (
+    _In_ UCHAR MinorFunction,
+    _In_ PARGS_PARAMETERS Parameters,
+    _Inout_ PRECORD_ARGS Args
+    )
+{
+    UNREFERENCED_PARAMETER( MinorFunction );
+
+    Args->Length = (ULONG)Parameters->Buffer.Length;
+    Args->Valid = ARGS_LENGTH;
+}
+
+static VOID
+ArgsDecodeDirectoryControl (
+    _In_ UCHAR MinorFunction,
+    _In_ PARGS_PARAMETERS Parameters,
+    _Inout_ PRECORD_ARGS Args
+    )
+{
+    if (MinorFunction == IRP_MN_QUERY_DIRECTORY) {
+
+        Args->Length = (ULONG)Parameters->QueryDirectory.Length;
+        Args->InfoClass = (ULONG)Parameters->QueryDirectory.FileInformationClass;
+        Args->Valid = ARGS_LENGTH | ARGS_INFO_CLASS;
+
+    } else if (MinorFunction == IRP_MN_NOTIFY_CHANGE_DIRECTORY) {
+
+        ArgsDecodeBuffer( MinorFunction, Parameters, Args );
+    }
+}
+
+static VOID
+ArgsDecodeFileSystemControl (
+    _In_ UCHAR MinorFunction,
+    _In_ PARGS_PARAMETERS Parameters,
+    _Inout_ PRECORD_ARGS Args
+    )
+{
+    //
+    //  Mounts, verifies and file system loads carry objects, not a code.
+    //
+
+    if (MinorFunction != IRP_MN_USER_FS_REQUEST &&
+        MinorFunction != IRP_MN_KERNEL_CALL) {
+
+        return;
+    }
+
+    Args->ControlCode = (ULONG)Parameters->Control.ControlCode;
+    Args->Valid = ARGS_CONTROL_CODE;
+}
+
+static VOID
+ArgsDecodeDeviceControl (
+    _In_ UCHAR MinorFunction,
+    _In_ PARGS_PARAMETERS Parameters,
+    _Inout_ PRECORD_ARGS Args
+    )
+{
+    UNREFERENCED_PARAMETER( MinorFunction );
+
+    Args->ControlCode = (ULONG)Parameters->Control.ControlCode;
+    Args->Valid = ARGS_CONTROL_CODE;
+}
+
+static VOID
+ArgsDecodeLockControl (
+    _In_ UCHAR MinorFunction,
+    _In_ PARGS_PARAMETERS Parameters,
+    _Inout_ PRECORD_ARGS Args
+    )
+{
+    //
+    //  Only locking and unlocking a single range name one.
+    //
+
+    if (MinorFunction != IRP_MN_LOCK &&
+        MinorFunction != IRP_MN_UNLOCK_SINGLE) {
+
+        return;
+    }
+
+    Args->Offset = Parameters->LockControl.ByteOffset.QuadPart;
+    Args->Length = Parameters->LockControl.Length;
+    Args->Valid = ARGS_OFFSET | ARGS_LENGTH;
+}
+
+static const ARGS_DECODER ArgsDecoders[IRP_MJ_MAXIMUM_FUNCTION + 1] = {
+
+    NULL,                           // IRP_MJ_CREATE
+    NULL,                           // IRP_MJ_CREATE_NAMED_PIPE
+    NULL,                           // IRP_MJ_CLOSE
+    ArgsDecodeReadWrite,            // IRP_MJ_READ
+    ArgsDecodeReadWrite,            // IRP_MJ_WRITE
+    ArgsDecodeInformation,          // IRP_MJ_QUERY_INFORMATION
+    ArgsDecodeInformation,          // IRP_MJ_SET_INFORMATION
+    ArgsDecodeBuffer,               // IRP_MJ_QUERY_EA
+    ArgsDecodeBuffer,               // IRP_MJ_SET_EA
+    NULL,                           // IRP_MJ_FLUSH_BUFFERS
+    ArgsDecodeInformation,          // IRP_MJ_QUERY_VOLUME_INFORMATION
+    ArgsDecodeInformation,          // IRP_MJ_SET_VOLUME_INFORMATION
+    ArgsDecodeDirectoryControl,     // IRP_MJ_DIRECTORY_CONTROL
+    ArgsDecodeFileSystemControl,    // IRP_MJ_FILE_SYSTEM_CONTROL
+    ArgsDecodeDeviceControl,        // IRP_MJ_DEVICE_CONTROL
+    ArgsDecodeDeviceControl,        // IRP_MJ_INTERNAL_DEVICE_CONTROL
+    NULL,                           // IRP_MJ_SHUTDOWN
+    ArgsDecodeLockControl,          // IRP_MJ_LOCK_CONTROL
+};
+
+VOID
+ArgsDecode (
+    _In_ PRECORD_DATA RecordData,
+    _Out_ PRECORD_ARGS Args
+    )
+/*++
+
+Routine Description:
+
+    Decodes the arguments of an operation record.
+
+Arguments:
+
+    RecordData - The record.  The filter's own operations, with negative
+        major functions, and process records have nothing to decode.
+
+    Args - Receives the decoded arguments, Valid says which.
+
+--*/
+{
+    ARGS_PARAMETERS parameters;
+    ARGS_DECODER decoder;
+
+    memset( Args, 0, sizeof( RECORD_ARGS ) );
+
+    if (RecordData->CallbackMajorId > IRP_MJ_MAXIMUM_FUNCTION) {
+
+        return;
+    }
+
+    decoder = ArgsDecoders[RecordData->CallbackMajorId];
+
+    if (decoder == NULL) {
+
+        return;
+    }
+
+    parameters.Others.Argument1 = RecordData->Arg1;
+    parameters.Others.Argument2 = RecordData->Arg2;
+    parameters.Others.Argument3 = RecordData->Arg3;
+    parameters.Others.Argument4 = RecordData->Arg4;
+    parameters.Others.Argument5 = RecordData->Arg5;
+    parameters.Others.Argument6 = RecordData->Arg6;
+
+    decoder( RecordData->CallbackMinorId, &parameters, Args );
+}
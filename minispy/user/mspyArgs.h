@@ -0,0 +1,143 @@
+/*++
+
+Module Name:
+
+    mspyArgs.h
+
+Abstract:
+
+    Decodes the six raw arguments the filter copies out of
+    Parameters.Others into what they mean for the record's major function:
+    the byte range of reads, writes and locks, the information class of
+    queries and sets, and the control code of FSCTLs and IOCTLs.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYARGS_H__
+#define __MSPYARGS_H__
+
+#include <windows.h>
+#include "minispy.h"
+
+//
+//  Which fields of RECORD_ARGS a decoder filled in.
+//
+
+#define ARGS_OFFSET             0x00000001
+#define ARGS_LENGTH             0x00000002
+#define ARGS_INFO_CLASS         0x00000004
+#define ARGS_CONTROL_CODE       0x00000008
+
+//
+//  FLT_PARAMETERS members as far as they are decoded, laid out as
+//  fltKernel.h declares them for the 64 bit builds, x64 and ARM64, the
+//  client and filter are built for.  A ULONG declared POINTER_ALIGNMENT
+//  there takes a whole argument slot, it is declared ULONG_PTR here.  A
+//  32 bit build would need its own layouts: Read and Write carry a Flags
+//  ULONG after Key, sharing its slot on 64 bit but not on 32 bit.
+//
+
+typedef union _ARGS_PARAMETERS {
+
+    struct {
+        PVOID Argument1;
+        PVOID Argument2;
+        PVOID Argument3;
+        PVOID Argument4;
+        PVOID Argument5;
+        LARGE_INTEGER Argument6;
+    } Others;
+
+    //
+    //  Read and Write.
+    //
+
+    struct {
+        ULONG_PTR Length;
+        ULONG_PTR Key;
+        LARGE_INTEGER ByteOffset;
+    } ReadWrite;
+
+    //
+    //  QueryFileInformation, SetFileInformation, QueryVolumeInformation
+    //  and SetVolumeInformation.
+    //
+
+    struct {
+        ULONG_PTR Length;
+        ULONG_PTR InformationClass;
+    } Information;
+
+    struct {
+        ULONG_PTR Length;
+        PVOID FileName;
+        ULONG_PTR FileInformationClass;
+    } QueryDirectory;
+
+    //
+    //  QueryEa, SetEa and NotifyDirectory start with their buffer length.
+    //
+
+    struct {
+        ULONG_PTR Length;
+    } Buffer;
+
+    //
+    //  FileSystemControl.Common and DeviceIoControl.Common.
+    //
+
+    struct {
+        ULONG_PTR OutputBufferLength;
+        ULONG_PTR InputBufferLength;
+        ULONG_PTR ControlCode;
+    } Control;
+
+    //
+    //  The filter replaces the pointer to the length with its value.
+    //
+
+    struct {
+        ULONG_PTR Length;
+        ULONG_PTR Key;
+        LARGE_INTEGER ByteOffset;
+    } LockControl;
+
+} ARGS_PARAMETERS, *PARGS_PARAMETERS;
+
+typedef struct _RECORD_ARGS {
+
+    ULONG Valid;
+
+    //
+    //  Byte offset and length requested by a read, write or lock, or the
+    //  buffer length of a query or set.  What was actually transferred is
+    //  in RECORD_DATA.Information.
+    //
+
+    LONGLONG Offset;
+    ULONGLONG Length;
+
+    //
+    //  FILE_INFORMATION_CLASS or FS_INFORMATION_CLASS.
+    //
+
+    ULONG InfoClass;
+
+    //
+    //  FSCTL or IOCTL code.
+    //
+
+    ULONG ControlCode;
+
+} RECORD_ARGS, *PRECORD_ARGS;
+
+VOID
+ArgsDecode (
+    _In_ PRECORD_DATA RecordData,
+    _Out_ PRECORD_ARGS Args
+    );
+
+#endif //__MSPYARGS_H__
@@ -0,0 +1,1121 @@
+/*++
+
+Module Name:
+
+    mspyColStore.c
+
+Abstract:
+
+    In memory column store of the most recent log records.  The retrieval
+    thread appends every record it receives from MiniSpy.sys and the command
+    interpreter runs the same breakdowns as the dashboard views over it.
+
+    Each query only walks the columns it needs, one tight loop per column,
+    so the compiler can vectorize them and a scan of a million rows stays
+    in the low milliseconds.  The store never touches the database, so
+    queries do not compete with the writer for the database lock.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyColStore.h"
+
+#define COL_TOP_GROUPS      10
+#define COL_FLAG_BITS       21          // COL_STORE_BLOCK_ROWS fits
+#define TICKS_PER_SECOND    10000000LL
+
+static ULONG
+ColRoundUpPow2 (
+    _In_ ULONG Value
+    )
+{
+    ULONG result = 1;
+
+    while (result < Value && result < 0x80000000) {
+
+        result <<= 1;
+    }
+
+    return result;
+}
+
+static ULONG
+ColHashName (
+    _In_ PCWSTR Name
+    )
+/*++
+
+Routine Description:
+
+    FNV-1a over the UTF-16 code units of a file name.
+
+--*/
+{
+    ULONG hash = 2166136261UL;
+
+    while (*Name != UNICODE_NULL) {
+
+        hash ^= *Name++;
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+static ULONG
+ColHashUlong (
+    _In_ ULONG Value
+    )
+{
+    Value ^= Value >> 16;
+    Value *= 0x7feb352dUL;
+    Value ^= Value >> 15;
+    Value *= 0x846ca68bUL;
+    Value ^= Value >> 16;
+
+    return Value;
+}
+
+static BOOLEAN
+ColNameTableInitialize (
+    _Out_ PCOL_NAME_TABLE Table,
+    _In_ ULONG MaxNames
+    )
+{
+    ZeroMemory( Table, sizeof( COL_NAME_TABLE ) );
+
+    Table->MaxNames = MaxNames;
+    Table->SlotCount = ColRoundUpPow2( MaxNames * 2 );
+    Table->Slots = calloc( Table->SlotCount, sizeof( ULONG ) );
+    Table->Hashes = calloc( MaxNames, sizeof( ULONG ) );
+    Table->References = calloc( MaxNames, sizeof( ULONG ) );
+    Table->Free = calloc( MaxNames, sizeof( ULONG ) );
+    Table->Names = calloc( MaxNames, sizeof( PWCHAR ) );
+
+    if (Table->Slots == NULL ||
+        Table->Hashes == NULL ||
+        Table->References == NULL ||
+        Table->Free == NULL ||
+        Table->Names == NULL) {
+
+        return FALSE;
+    }
+
+    //
+    //  Id 0 stands for every name that did not fit.
+    //
+
+    Table->Names[COL_STORE_NAME_OVERFLOW] = _wcsdup( L"<other names>" );
+    Table->Count = 1;
+
+    return (Table->Names[COL_STORE_NAME_OVERFLOW] != NULL);
+}
+
+static VOID
+ColNameTableCleanup (
+    _Inout_ PCOL_NAME_TABLE Table
+    )
+{
+    ULONG id;
+
+    if (Table->Names != NULL) {
+
+        for (id = 0; id < Table->Count; id++) {
+
+            free( Table->Names[id] );
+        }
+    }
+
+    free( Table->Slots );
+    free( Table->Hashes );
+    free( Table->References );
+    free( Table->Free );
+    free( Table->Names );
+
+    ZeroMemory( Table, sizeof( COL_NAME_TABLE ) );
+}
+
+static ULONG
+ColNameTableIntern (
+    _Inout_ PCOL_NAME_TABLE Table,
+    _In_ PCWSTR Name
+    )
+/*++
+
+Routine Description:
+
+    Returns the id of a file name for one more row, adding the name if no
+    row in the store holds it.  A freed id is handed out before a new one.
+    The caller holds the store lock exclusively.
+
+Return Value:
+
+    The name id, or COL_STORE_NAME_OVERFLOW while MaxNames names are held.
+
+--*/
+{
+    ULONG hash = ColHashName( Name );
+    ULONG slot = hash & (Table->SlotCount - 1);
+    ULONG id;
+
+    while (Table->Slots[slot] != 0) {
+
+        id = Table->Slots[slot] - 1;
+
+        if (Table->Hashes[id] == hash && wcscmp( Table->Names[id], Name ) == 0) {
+
+            Table->References[id]++;
+            return id;
+        }
+
+        slot = (slot + 1) & (Table->SlotCount - 1);
+    }
+
+    if (Table->FreeCount != 0) {
+
+        id = Table->Free[Table->FreeCount - 1];
+
+    } else if (Table->Count < Table->MaxNames) {
+
+        id = Table->Count;
+
+    } else {
+
+        Table->Overflowed++;
+        return COL_STORE_NAME_OVERFLOW;
+    }
+
+    Table->Names[id] = _wcsdup( Name );
+
+    if (Table->Names[id] == NULL) {
+
+        Table->Overflowed++;
+        return COL_STORE_NAME_OVERFLOW;
+    }
+
+    if (id == Table->Count) {
+
+        Table->Count++;
+
+    } else {
+
+        Table->FreeCount--;
+    }
+
+    Table->Hashes[id] = hash;
+    Table->References[id] = 1;
+    Table->Slots[slot] = id + 1;
+
+    return id;
+}
+
+static VOID
+ColNameTableRelease (
+    _Inout_ PCOL_NAME_TABLE Table,
+    _In_ ULONG Id
+    )
+/*++
+
+Routine Description:
+
+    Drops the reference of a row the ring is overwriting.  Once no row
+    holds the name it is freed and its slot emptied by moving the entries
+    that probed past it back, so lookups never need tombstones.  The
+    caller holds the store lock exclusively.
+
+--*/
+{
+    ULONG mask = Table->SlotCount - 1;
+    ULONG slot;
+    ULONG next;
+    ULONG home;
+
+    if (Id == COL_STORE_NAME_OVERFLOW || --Table->References[Id] != 0) {
+
+        return;
+    }
+
+    slot = Table->Hashes[Id] & mask;
+
+    while (Table->Slots[slot] != Id + 1) {
+
+        slot = (slot + 1) & mask;
+    }
+
+    for (next = (slot + 1) & mask; Table->Slots[next] != 0; next = (next + 1) & mask) {
+
+        //
+        //  The entry at next may fill the hole unless its home slot lies
+        //  after the hole, in which case a lookup would never reach it
+        //  there.
+        //
+
+        home = Table->Hashes[Table->Slots[next] - 1] & mask;
+
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+
+            Table->Slots[slot] = Table->Slots[next];
+            slot = next;
+        }
+    }
+
+    Table->Slots[slot] = 0;
+
+    free( Table->Names[Id] );
+    Table->Names[Id] = NULL;
+    Table->Free[Table->FreeCount++] = Id;
+    Table->Evicted++;
+}
+
+BOOLEAN
+ColStoreInitialize (
+    _Out_ PCOL_STORE Store,
+    _In_ ULONG Events
+    )
+/*++
+
+Routine Description:
+
+    Allocates every column of the store.
+
+Arguments:
+
+    Store - The store to initialize.
+
+    Events - Minimum number of records to keep, rounded up to a power of two
+        and to at least one block.
+
+Return Value:
+
+    TRUE on success, FALSE if memory could not be allocated.
+
+--*/
+{
+    ULONG capacity = ColRoundUpPow2( max( Events, COL_STORE_BLOCK_ROWS ) );
+
+    ZeroMemory( Store, sizeof( COL_STORE ) );
+    InitializeSRWLock( &Store->Lock );
+
+    Store->Capacity = capacity;
+    Store->Mask = capacity - 1;
+
+    Store->BlockFirstTime = calloc( capacity / COL_STORE_BLOCK_ROWS, sizeof( LONGLONG ) );
+    Store->BlockLastTime = calloc( capacity / COL_STORE_BLOCK_ROWS, sizeof( LONGLONG ) );
+    Store->OriginatingTime = calloc( capacity, sizeof( LONGLONG ) );
+    Store->Duration = calloc( capacity, sizeof( LONGLONG ) );
+    Store->Completed = calloc( capacity, sizeof( UCHAR ) );
+    Store->ProcessId = calloc( capacity, sizeof( ULONG ) );
+    Store->ThreadId = calloc( capacity, sizeof( ULONG ) );
+    Store->Status = calloc( capacity, sizeof( ULONG ) );
+    Store->IrpFlags = calloc( capacity, sizeof( ULONG ) );
+    Store->NameId = calloc( capacity, sizeof( ULONG ) );
+    Store->MajorId = calloc( capacity, sizeof( UCHAR ) );
+    Store->MinorId = calloc( capacity, sizeof( UCHAR ) );
+    Store->RequestorMode = calloc( capacity, sizeof( UCHAR ) );
+
+    if (Store->BlockFirstTime == NULL ||
+        Store->BlockLastTime == NULL ||
+        Store->OriginatingTime == NULL ||
+        Store->Duration == NULL ||
+        Store->Completed == NULL ||
+        Store->ProcessId == NULL ||
+        Store->ThreadId == NULL ||
+        Store->Status == NULL ||
+        Store->IrpFlags == NULL ||
+        Store->NameId == NULL ||
+        Store->MajorId == NULL ||
+        Store->MinorId == NULL ||
+        Store->RequestorMode == NULL ||
+        !ColNameTableInitialize( &Store->Names, COL_STORE_MAX_NAMES )) {
+
+        ColStoreCleanup( Store );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+VOID
+ColStoreCleanup (
+    _Inout_ PCOL_STORE Store
+    )
+{
+    free( Store->BlockFirstTime );
+    free( Store->BlockLastTime );
+    free( Store->OriginatingTime );
+    free( Store->Duration );
+    free( Store->Completed );
+    free( Store->ProcessId );
+    free( Store->ThreadId );
+    free( Store->Status );
+    free( Store->IrpFlags );
+    free( Store->NameId );
+    free( Store->MajorId );
+    free( Store->MinorId );
+    free( Store->RequestorMode );
+
+    ColNameTableCleanup( &Store->Names );
+
+    Store->Capacity = 0;
+    Store->Appended = 0;
+}
+
+
+VOID
+ColStoreAppend (
+    _Inout_ PCOL_STORE Store,
+    _In_ PLOG_RECORD LogRecord
+    )
+/*++
+
+Routine Description:
+
+    Appends one log record, overwriting the oldest row when the store is
+    full, and freeing its file name if no other row holds it.  Out of
+    memory marker records carry no operation and are skipped.
+
+Arguments:
+
+    Store - The store to append to.
+
+    LogRecord - A record as returned by MiniSpy.sys.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PRECORD_DATA recordData = &LogRecord->Data;
+    LONGLONG time = recordData->OriginatingTime.QuadPart;
+    ULONG nameId;
+    ULONG block;
+    ULONG row;
+
+    if (Store->Capacity == 0 ||
+        FlagOn( LogRecord->RecordType, RECORD_TYPE_FLAG_OUT_OF_MEMORY |
+                                       RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE )) {
+
+        return;
+    }
+
+    AcquireSRWLockExclusive( &Store->Lock );
+
+    row = (ULONG)(Store->Appended & Store->Mask);
+
+    //
+    //  Intern before releasing the row's old name, so a name the new
+    //  record shares with the one it overwrites is not freed and added
+    //  back.
+    //
+
+    nameId = ColNameTableIntern( &Store->Names, LogRecord->Name );
+
+    if (Store->Appended >= Store->Capacity) {
+
+        ColNameTableRelease( &Store->Names, Store->NameId[row] );
+    }
+
+    //
+    //  While a block is being overwritten it holds rows of both laps, so
+    //  its bounds only widen; once its last row is written they become
+    //  those of the new rows alone.
+    //
+
+    block = row / COL_STORE_BLOCK_ROWS;
+
+    if (row % COL_STORE_BLOCK_ROWS == 0) {
+
+        Store->PendingFirstTime = time;
+        Store->PendingLastTime = time;
+
+        if (Store->Appended < Store->Capacity) {
+
+            Store->BlockFirstTime[block] = time;
+            Store->BlockLastTime[block] = time;
+        }
+
+    } else {
+
+        Store->PendingFirstTime = min( Store->PendingFirstTime, time );
+        Store->PendingLastTime = max( Store->PendingLastTime, time );
+    }
+
+    if (row % COL_STORE_BLOCK_ROWS == COL_STORE_BLOCK_ROWS - 1) {
+
+        Store->BlockFirstTime[block] = Store->PendingFirstTime;
+        Store->BlockLastTime[block] = Store->PendingLastTime;
+
+    } else {
+
+        Store->BlockFirstTime[block] = min( Store->BlockFirstTime[block], time );
+        Store->BlockLastTime[block] = max( Store->BlockLastTime[block], time );
+    }
+
+    //
+    //  Records completed without a post operation callback keep a zero
+    //  completion time and are left out of the duration figures, like
+    //  the NULL check in View_OpDurationSummary.
+    //
+
+    Store->OriginatingTime[row] = time;
+    Store->Completed[row] = (recordData->CompletionTime.QuadPart != 0);
+    Store->Duration[row] = Store->Completed[row] ? recordData->CompletionTime.QuadPart - time : 0;
+    Store->ProcessId[row] = (ULONG)recordData->ProcessId;
+    Store->ThreadId[row] = (ULONG)recordData->ThreadId;
+    Store->Status[row] = recordData->Status;
+    Store->IrpFlags[row] = recordData->IrpFlags;
+    Store->MajorId[row] = recordData->CallbackMajorId;
+    Store->MinorId[row] = recordData->CallbackMinorId;
+    Store->RequestorMode[row] = (recordData->RequestorMode != 0);
+    Store->NameId[row] = nameId;
+
+    Store->Appended++;
+
+    ReleaseSRWLockExclusive( &Store->Lock );
+}
+
+
+static ULONG
+ColStoreRows (
+    _In_ PCOL_STORE Store
+    )
+{
+    return (Store->Appended < Store->Capacity) ? (ULONG)Store->Appended : Store->Capacity;
+}
+
+
+//
+//  Operators over one block of columns.  The element wise ones are single
+//  loops without branches, which the compiler turns into vector code;
+//  ColAggregateByKey adds into a table by key, which cannot be, but no
+//  longer waits on a mispredicted branch per row.
+//
+
+static ULONG
+ColSelectSince (
+    _In_reads_(Rows) const LONGLONG *Time,
+    _In_ LONGLONG Since,
+    _In_ ULONG Rows,
+    _Out_writes_(Rows) PUCHAR Selected
+    )
+/*++
+
+Routine Description:
+
+    Marks the rows at or after Since.  System times are not negative, so
+    the difference cannot overflow and its sign bit says which side the
+    row is on, without the 64 bit compare SSE2 lacks.
+
+--*/
+{
+    ULONG count = 0;
+    ULONG row;
+
+    for (row = 0; row < Rows; row++) {
+
+        Selected[row] = (UCHAR)(~(ULONGLONG)(Time[row] - Since) >> 63);
+    }
+
+    for (row = 0; row < Rows; row++) {
+
+        count += Selected[row];
+    }
+
+    return count;
+}
+
+static VOID
+ColMaskValues (
+    _In_reads_(Rows) const UCHAR *Selected,
+    _In_reads_(Rows) const LONGLONG *Value,
+    _In_ ULONG Rows,
+    _Out_writes_(Rows) PLONGLONG Result
+    )
+{
+    ULONG row;
+
+    for (row = 0; row < Rows; row++) {
+
+        Result[row] = Value[row] & -(LONGLONG)Selected[row];
+    }
+}
+
+static VOID
+ColPackFlags (
+    _In_reads_(Rows) const UCHAR *Selected,
+    _In_reads_(Rows) const UCHAR *Kernel,
+    _In_reads_(Rows) const UCHAR *Completed,
+    _In_ ULONG Rows,
+    _Out_writes_(Rows) PULONGLONG Flags
+    )
+/*++
+
+Routine Description:
+
+    Packs whether each row counts, was requested by the kernel and was
+    completed into fields of COL_FLAG_BITS, so one addition counts all
+    three.
+
+--*/
+{
+    ULONG row;
+
+    for (row = 0; row < Rows; row++) {
+
+        Flags[row] = (ULONGLONG)Selected[row] |
+                     (ULONGLONG)(Selected[row] & Kernel[row]) << COL_FLAG_BITS |
+                     (ULONGLONG)(Selected[row] & Completed[row]) << (2 * COL_FLAG_BITS);
+    }
+}
+
+static VOID
+ColAggregateByKey (
+    _In_reads_(Rows) const UCHAR *Key,
+    _In_reads_(Rows) const ULONGLONG *Flags,
+    _In_reads_(Rows) const LONGLONG *Value,
+    _In_ ULONG Rows,
+    _Inout_updates_(256) PULONGLONG PackedCounts,
+    _Inout_updates_(256) PLONGLONG Sums,
+    _Inout_updates_(256) PLONGLONG Maxima
+    )
+/*++
+
+Routine Description:
+
+    Adds each row's packed flags and value into its key's entries and
+    raises its key's maximum.  Rows left out have no flags and a value of
+    0, which, with maxima starting at 0, changes nothing.
+
+--*/
+{
+    LONGLONG value;
+    ULONG row;
+    UCHAR key;
+
+    //
+    //  Read into locals first: the tables may alias the columns as far as
+    //  the compiler knows, and it would read them again after every store.
+    //
+
+    for (row = 0; row < Rows; row++) {
+
+        key = Key[row];
+        value = Value[row];
+
+        PackedCounts[key] += Flags[row];
+        Sums[key] += value;
+        Maxima[key] = max( Maxima[key], value );
+    }
+}
+
+
+ULONGLONG
+ColStoreGroupByMajor (
+    _In_ PCOL_STORE Store,
+    _In_ LONGLONG Since,
+    _Out_writes_(256) PCOL_MAJOR_SUMMARY Summary
+    )
+/*++
+
+Routine Description:
+
+    Computes the per operation counts, requestor mode split and duration
+    figures of View_OperationBreakdown, View_MajorOpByRequestor and
+    View_OpDurationSummary over the major, mode and duration columns.
+
+    The columns are taken a block at a time, and each step is one
+    operator over the block.  A block that ended before Since is skipped,
+    one that started at or after it is taken whole, and only for the
+    blocks across Since is the time column read, to pick the rows and
+    mask the durations of the others.  The flags of the rows are then
+    packed and added up by major function with the durations.
+
+Arguments:
+
+    Store - The store to scan.
+
+    Since - Only rows that started at or after this system time are counted,
+        0 counts every row.
+
+    Summary - Receives one entry per CallbackMajorId.
+
+Return Value:
+
+    Number of rows counted.
+
+--*/
+{
+    ULONGLONG packedCounts[256] = { 0 };
+    ULONGLONG counts[256] = { 0 };
+    ULONGLONG kernelCounts[256] = { 0 };
+    ULONGLONG completedCounts[256] = { 0 };
+    LONGLONG durationSums[256] = { 0 };
+    LONGLONG durationMaxima[256] = { 0 };
+    UCHAR everyRow[COL_STORE_BLOCK_ROWS];
+    UCHAR someRows[COL_STORE_BLOCK_ROWS];
+    ULONGLONG flags[COL_STORE_BLOCK_ROWS];
+    LONGLONG masked[COL_STORE_BLOCK_ROWS];
+    const UCHAR *selected;
+    const LONGLONG *durations;
+    ULONGLONG mask = (1ULL << COL_FLAG_BITS) - 1;
+    ULONGLONG total = 0;
+    ULONG rows;
+    ULONG first;
+    ULONG block;
+    ULONG major;
+
+    memset( everyRow, 1, sizeof( everyRow ) );
+
+    AcquireSRWLockShared( &Store->Lock );
+
+    rows = ColStoreRows( Store );
+
+    for (first = 0; first < rows; first += block) {
+
+        block = min( rows - first, COL_STORE_BLOCK_ROWS );
+
+        if (Store->BlockLastTime[first / COL_STORE_BLOCK_ROWS] < Since) {
+
+            continue;
+        }
+
+        if (Store->BlockFirstTime[first / COL_STORE_BLOCK_ROWS] >= Since) {
+
+            selected = everyRow;
+            durations = Store->Duration + first;
+
+        } else {
+
+            if (ColSelectSince( Store->OriginatingTime + first, Since, block, someRows ) == 0) {
+
+                continue;
+            }
+
+            ColMaskValues( someRows, Store->Duration + first, block, masked );
+
+            selected = someRows;
+            durations = masked;
+        }
+
+        ColPackFlags( selected, Store->RequestorMode + first, Store->Completed + first, block, flags );
+        ColAggregateByKey( Store->MajorId + first, flags, durations, block, packedCounts, durationSums, durationMaxima );
+
+        for (major = 0; major < 256; major++) {
+
+            if (packedCounts[major] != 0) {
+
+                counts[major] += packedCounts[major] & mask;
+                kernelCounts[major] += (packedCounts[major] >> COL_FLAG_BITS) & mask;
+                completedCounts[major] += packedCounts[major] >> (2 * COL_FLAG_BITS);
+                packedCounts[major] = 0;
+            }
+        }
+    }
+
+    ReleaseSRWLockShared( &Store->Lock );
+
+    for (major = 0; major < 256; major++) {
+
+        Summary[major].Count = counts[major];
+        Summary[major].KernelCount = kernelCounts[major];
+        Summary[major].UserCount = counts[major] - kernelCounts[major];
+        Summary[major].Completed = completedCounts[major];
+        Summary[major].DurationSum = durationSums[major];
+        Summary[major].DurationMax = durationMaxima[major];
+
+        total += counts[major];
+    }
+
+    return total;
+}
+
+static VOID
+ColInsertTop (
+    _Inout_updates_(GroupCount) PCOL_GROUP Groups,
+    _In_ ULONG GroupCount,
+    _Inout_ PULONG Used,
+    _In_ ULONG Key,
+    _In_ ULONGLONG Count
+    )
+/*++
+
+Routine Description:
+
+    Keeps Groups sorted by descending count while offering it one more
+    group.  GroupCount is small so an insertion is cheaper than a heap.
+
+--*/
+{
+    ULONG index = *Used;
+
+    if (index == GroupCount) {
+
+        if (Groups[GroupCount - 1].Count >= Count) {
+
+            return;
+        }
+
+        index--;
+
+    } else {
+
+        (*Used)++;
+    }
+
+    while (index > 0 && Groups[index - 1].Count < Count) {
+
+        Groups[index] = Groups[index - 1];
+        index--;
+    }
+
+    Groups[index].Key = Key;
+    Groups[index].Count = Count;
+}
+
+
+ULONG
+ColStoreTopGroups (
+    _In_ PCOL_STORE Store,
+    _In_ COL_GROUP_KEY GroupKey,
+    _In_ LONGLONG Since,
+    _Out_writes_to_(GroupCount, return) PCOL_GROUP Groups,
+    _In_ ULONG GroupCount
+    )
+/*++
+
+Routine Description:
+
+    Returns the most frequent processes, file names or status codes, the
+    breakdowns of View_ProcessOpCounts, View_FileOpCounts and
+    View_OpStatusCount.
+
+    Name ids are dense so file names are counted in a plain array indexed by
+    id.  Process ids and status codes are counted in a temporary open
+    addressing table sized for the number of rows scanned.
+
+Arguments:
+
+    Store - The store to scan.
+
+    GroupKey - Column to group by.
+
+    Since - Only rows that started at or after this system time are counted,
+        0 counts every row.
+
+    Groups - Receives the largest groups, by descending count.
+
+    GroupCount - Number of entries in Groups.
+
+Return Value:
+
+    Number of groups returned.
+
+--*/
+{
+    ULONG rows;
+    ULONG row;
+    ULONG used = 0;
+    ULONG slotCount;
+    ULONG slot;
+    ULONG key;
+    PULONG keyColumn;
+    PULONG keys = NULL;
+    PULONGLONG counts = NULL;
+
+    if (GroupCount == 0) {
+
+        return 0;
+    }
+
+    AcquireSRWLockShared( &Store->Lock );
+
+    rows = ColStoreRows( Store );
+
+    if (GroupKey == ColGroupByName) {
+
+        counts = calloc( Store->Names.Count, sizeof( ULONGLONG ) );
+
+        if (counts != NULL) {
+
+            for (row = 0; row < rows; row++) {
+
+                if (Store->OriginatingTime[row] >= Since) {
+
+                    counts[Store->NameId[row]]++;
+                }
+            }
+
+            for (key = 0; key < Store->Names.Count; key++) {
+
+                if (counts[key] != 0) {
+
+                    ColInsertTop( Groups, GroupCount, &used, key, counts[key] );
+                }
+            }
+        }
+
+    } else {
+
+        keyColumn = (GroupKey == ColGroupByProcess) ? Store->ProcessId : Store->Status;
+
+        slotCount = ColRoundUpPow2( max( rows, 1 ) * 2 );
+        keys = malloc( slotCount * sizeof( ULONG ) );
+        counts = calloc( slotCount, sizeof( ULONGLONG ) );
+
+        if (keys != NULL && counts != NULL) {
+
+            for (row = 0; row < rows; row++) {
+
+                if (Store->OriginatingTime[row] < Since) {
+
+                    continue;
+                }
+
+                key = keyColumn[row];
+                slot = ColHashUlong( key ) & (slotCount - 1);
+
+                while (counts[slot] != 0 && keys[slot] != key) {
+
+                    slot = (slot + 1) & (slotCount - 1);
+                }
+
+                keys[slot] = key;
+                counts[slot]++;
+            }
+
+            for (slot = 0; slot < slotCount; slot++) {
+
+                if (counts[slot] != 0) {
+
+                    ColInsertTop( Groups, GroupCount, &used, keys[slot], counts[slot] );
+                }
+            }
+        }
+    }
+
+    ReleaseSRWLockShared( &Store->Lock );
+
+    free( keys );
+    free( counts );
+
+    return used;
+}
+
+
+ULONG
+ColStoreName (
+    _In_ PCOL_STORE Store,
+    _In_ ULONG NameId,
+    _Out_writes_(NameCount) PWCHAR Name,
+    _In_ ULONG NameCount
+    )
+/*++
+
+Routine Description:
+
+    Copies the file name for an id.  Names are freed once the ring has
+    overwritten every row that held them, and the id handed to another
+    name, so the name is copied under the lock; an id looked up well after
+    the query that returned it may name a newer file.
+
+Arguments:
+
+    Store - The store the id came from.
+
+    NameId - A name id from ColStoreTopGroups.
+
+    Name - Receives the name, truncated to fit and always terminated.
+
+    NameCount - Number of characters Name holds.
+
+Return Value:
+
+    Number of characters copied, without the terminator, 0 if the id is
+    not in use.
+
+--*/
+{
+    PCWSTR source = NULL;
+    ULONG length = 0;
+
+    if (NameCount == 0) {
+
+        return 0;
+    }
+
+    AcquireSRWLockShared( &Store->Lock );
+
+    if (NameId < Store->Names.Count) {
+
+        source = Store->Names.Names[NameId];
+    }
+
+    while (source != NULL && source[length] != UNICODE_NULL && length < NameCount - 1) {
+
+        Name[length] = source[length];
+        length++;
+    }
+
+    ReleaseSRWLockShared( &Store->Lock );
+
+    Name[length] = UNICODE_NULL;
+
+    return length;
+}
+
+VOID
+ColStorePrintSummary (
+    _In_ PCOL_STORE Store,
+    _In_ ULONG Seconds
+    )
+/*++
+
+Routine Description:
+
+    Prints the live breakdowns for the /q command together with the time
+    each query took.
+
+Arguments:
+
+    Store - The store to query.
+
+    Seconds - Only include records from the last Seconds seconds, 0 for
+        every record held.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    COL_MAJOR_SUMMARY summary[256];
+    COL_GROUP groups[COL_TOP_GROUPS];
+    ULONGLONG total;
+    ULONGLONG userCount = 0;
+    ULONGLONG kernelCount = 0;
+    ULONG groupCount;
+    ULONG index;
+    LONGLONG since = 0;
+    FILETIME now;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    const CHAR *majorString;
+    const CHAR *minorString;
+    CHAR statusString[256];
+    WCHAR name[MAX_PATH];
+
+    if (Seconds != 0) {
+
+        GetSystemTimeAsFileTime( &now );
+        since = (((LONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime) -
+                (LONGLONG)Seconds * TICKS_PER_SECOND;
+    }
+
+    QueryPerformanceFrequency( &frequency );
+
+    //
+    //  Per operation and requestor mode
+    //
+
+    QueryPerformanceCounter( &start );
+    total = ColStoreGroupByMajor( Store, since, summary );
+    QueryPerformanceCounter( &end );
+
+    printf( "    %I64u operations held, %I64u in range (%.3f ms)\n",
+            min( Store->Appended, (ULONGLONG)Store->Capacity ),
+            total,
+            (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart );
+
+    for (index = 0; index < 256; index++) {
+
+        if (summary[index].Count == 0) {
+
+            continue;
+        }
+
+        userCount += summary[index].UserCount;
+        kernelCount += summary[index].KernelCount;
+
+        PrintIrpCode( (UCHAR)index, 0, &majorString, &minorString );
+
+        printf( "    %-34s %10I64u  avg %8I64d  max %10I64d\n",
+                majorString,
+                summary[index].Count,
+                summary[index].Completed ? summary[index].DurationSum / (LONGLONG)summary[index].Completed : 0,
+                summary[index].DurationMax );
+    }
+
+    printf( "    User %I64u, Kernel %I64u\n", userCount, kernelCount );
+
+    //
+    //  Top processes, files and status codes
+    //
+
+    QueryPerformanceCounter( &start );
+    groupCount = ColStoreTopGroups( Store, ColGroupByProcess, since, groups, COL_TOP_GROUPS );
+    QueryPerformanceCounter( &end );
+
+    printf( "    Top processes (%.3f ms)\n",
+            (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart );
+
+    for (index = 0; index < groupCount; index++) {
+
+        printf( "      %8lu %10I64u\n", groups[index].Key, groups[index].Count );
+    }
+
+    QueryPerformanceCounter( &start );
+    groupCount = ColStoreTopGroups( Store, ColGroupByName, since, groups, COL_TOP_GROUPS );
+    QueryPerformanceCounter( &end );
+
+    printf( "    Top files (%.3f ms)\n",
+            (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart );
+
+    for (index = 0; index < groupCount; index++) {
+
+        ColStoreName( Store, groups[index].Key, name, ARRAYSIZE( name ) );
+        printf( "      %10I64u %S\n", groups[index].Count, name );
+    }
+
+    AcquireSRWLockShared( &Store->Lock );
+
+    printf( "    %lu of %lu file names in use, %llu freed, %llu operations named %S\n",
+            Store->Names.Count - Store->Names.FreeCount - 1,
+            Store->Names.MaxNames - 1,
+            Store->Names.Evicted,
+            Store->Names.Overflowed,
+            Store->Names.Names[COL_STORE_NAME_OVERFLOW] );
+
+    ReleaseSRWLockShared( &Store->Lock );
+
+    QueryPerformanceCounter( &start );
+    groupCount = ColStoreTopGroups( Store, ColGroupByStatus, since, groups, COL_TOP_GROUPS );
+    QueryPerformanceCounter( &end );
+
+    printf( "    Top status codes (%.3f ms)\n",
+            (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart );
+
+    for (index = 0; index < groupCount; index++) {
+
+        NtStatusToString( groups[index].Key, statusString, sizeof( statusString ) );
+        printf( "      0x%08lx %10I64u %s", groups[index].Key, groups[index].Count, statusString );
+
+        if (strchr( statusString, '\n' ) == NULL) {
+
+            printf( "\n" );
+        }
+    }
+}
@@ -0,0 +1,178 @@
+/*++
+
+Module Name:
+
+    mspyColStore.h
+
+Abstract:
+
+    In memory store of the most recent log records, kept column by column so
+    the live breakdowns shown by the dashboard views (per operation, per
+    process, per file, requestor mode) can be computed without touching the
+    database.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYCOLSTORE_H__
+#define __MSPYCOLSTORE_H__
+
+#include <windows.h>
+#include "minispy.h"
+
+#define COL_STORE_DEFAULT_EVENTS    (1024 * 1024)   // ~41 MB
+#define COL_STORE_MAX_NAMES         (64 * 1024)
+#define COL_STORE_BLOCK_ROWS        1024
+
+//
+//  Name id given to every file name seen while the name table is full.
+//
+
+#define COL_STORE_NAME_OVERFLOW     0
+
+//
+//  Maps file names to small integer ids so the store keeps one ULONG per
+//  record instead of a string.  Each id counts the rows that hold it; when
+//  the ring overwrites the last of them the name is freed and its id is
+//  handed out again, so the table only ever holds the names of the
+//  records in the store.
+//
+
+typedef struct _COL_NAME_TABLE {
+
+    ULONG SlotCount;        // power of two, twice MaxNames
+    ULONG Count;            // ids ever handed out, including the overflow id
+    ULONG FreeCount;        // ids in Free
+    ULONG MaxNames;
+
+    ULONGLONG Evicted;      // names freed with their last row
+    ULONGLONG Overflowed;   // rows given COL_STORE_NAME_OVERFLOW
+
+    PULONG Slots;           // 0 means empty, otherwise id + 1
+    PULONG Hashes;          // indexed by id
+    PULONG References;      // indexed by id, rows holding it
+    PULONG Free;            // ids to hand out again, most recently freed last
+    PWCHAR *Names;          // indexed by id, NULL while the id is free
+
+} COL_NAME_TABLE, *PCOL_NAME_TABLE;
+
+//
+//  Struct of arrays ring.  Row N of every column describes the same record.
+//  The writer overwrites the oldest row once Capacity rows are held.
+//
+//  The rows are also taken in blocks of COL_STORE_BLOCK_ROWS, each with
+//  the earliest and latest OriginatingTime of the rows in it, so a query
+//  over a time range skips the blocks outside it and does not read the
+//  time column at all for the blocks wholly inside it.
+//
+
+typedef struct _COL_STORE {
+
+    SRWLOCK Lock;
+
+    ULONG Capacity;         // power of two, at least one block
+    ULONG Mask;
+    ULONGLONG Appended;     // rows ever appended
+
+    PLONGLONG BlockFirstTime;
+    PLONGLONG BlockLastTime;
+    LONGLONG PendingFirstTime;  // of the rows written to the current block
+    LONGLONG PendingLastTime;   // since the writer started on it
+
+    PLONGLONG OriginatingTime;
+    PLONGLONG Duration;     // 0 unless completed
+    PUCHAR Completed;       // 1 if there was a completion time
+    PULONG ProcessId;
+    PULONG ThreadId;
+    PULONG Status;
+    PULONG IrpFlags;
+    PULONG NameId;
+    PUCHAR MajorId;
+    PUCHAR MinorId;
+    PUCHAR RequestorMode;
+
+    COL_NAME_TABLE Names;
+
+} COL_STORE, *PCOL_STORE;
+
+//
+//  Per major function result of ColStoreGroupByMajor.  Durations are in
+//  100ns units like the PreOpTime/PostOpTime columns.
+//
+
+typedef struct _COL_MAJOR_SUMMARY {
+
+    ULONGLONG Count;
+    ULONGLONG UserCount;
+    ULONGLONG KernelCount;
+    ULONGLONG Completed;        // rows with a completion time
+    LONGLONG DurationSum;
+    LONGLONG DurationMax;
+
+} COL_MAJOR_SUMMARY, *PCOL_MAJOR_SUMMARY;
+
+typedef enum _COL_GROUP_KEY {
+
+    ColGroupByProcess,
+    ColGroupByName,
+    ColGroupByStatus
+
+} COL_GROUP_KEY;
+
+typedef struct _COL_GROUP {
+
+    ULONG Key;
+    ULONGLONG Count;
+
+} COL_GROUP, *PCOL_GROUP;
+
+BOOLEAN
+ColStoreInitialize (
+    _Out_ PCOL_STORE Store,
+    _In_ ULONG Events
+    );
+
+VOID
+ColStoreCleanup (
+    _Inout_ PCOL_STORE Store
+    );
+
+VOID
+ColStoreAppend (
+    _Inout_ PCOL_STORE Store,
+    _In_ PLOG_RECORD LogRecord
+    );
+
+ULONGLONG
+ColStoreGroupByMajor (
+    _In_ PCOL_STORE Store,
+    _In_ LONGLONG Since,
+    _Out_writes_(256) PCOL_MAJOR_SUMMARY Summary
+    );
+
+ULONG
+ColStoreTopGroups (
+    _In_ PCOL_STORE Store,
+    _In_ COL_GROUP_KEY GroupKey,
+    _In_ LONGLONG Since,
+    _Out_writes_to_(GroupCount, return) PCOL_GROUP Groups,
+    _In_ ULONG GroupCount
+    );
+
+ULONG
+ColStoreName (
+    _In_ PCOL_STORE Store,
+    _In_ ULONG NameId,
+    _Out_writes_(NameCount) PWCHAR Name,
+    _In_ ULONG NameCount
+    );
+
+VOID
+ColStorePrintSummary (
+    _In_ PCOL_STORE Store,
+    _In_ ULONG Seconds
+    );
+
+#endif //__MSPYCOLSTORE_H__
@@ -0,0 +1,521 @@
+/*++
+
+Module Name:
+
+    mspyFileLog.c
+
+Abstract:
+
+    Writes the service log from a flusher thread.
+
+    WriteToLogAnsi used to open USER_LOG_FILE, write one line and close it
+    again for every message.  It is what the log writer calls when a
+    SQLite statement fails, which is when the machine is already busy, and
+    every call then waited for two file system round trips.
+
+    Lines now go into a bounded multi producer queue, the one described by
+    Dmitry Vyukov: every slot carries a sequence number that tells
+    producers and the consumer whose turn it is, so posting is a compare
+    exchange on the enqueue position and two copies, and never waits.
+    When the queue is full the line is dropped and counted.  The flusher
+    thread drains the queue into a buffer, appends the buffer to the file
+    it keeps open and rotates the file when it grows too large.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyFileLog.h"
+
+#define FILELOG_MASK    (FILELOG_SLOTS - 1)
+
+typedef struct _FILELOG_SLOT {
+
+    //
+    //  Equal to the position a producer may fill the slot at, one past it
+    //  once the line is in and the flusher may take it.
+    //
+
+    volatile LONG Sequence;
+    ULONG Length;
+    char Text[FILELOG_LINE_SIZE];
+
+} FILELOG_SLOT, *PFILELOG_SLOT;
+
+typedef struct _FILELOG_STATE {
+
+    PFILELOG_SLOT Slots;
+    volatile LONG EnqueuePosition;
+    volatile LONG DequeuePosition;      // written by the flusher only
+
+    volatile BOOLEAN Running;
+    volatile BOOLEAN Stop;
+    HANDLE Thread;
+    HANDLE Wake;
+
+    //
+    //  Flusher only.
+    //
+
+    HANDLE File;
+    LONGLONG FileSize;
+    char *Buffer;
+    ULONG Buffered;
+    LONG DroppedReported;
+
+    //
+    //  Counters.
+    //
+
+    volatile LONG Dropped;
+    volatile LONG HighWater;
+    volatile LONGLONG Lines;
+    volatile LONGLONG Bytes;
+    volatile LONG Rotations;
+    volatile LONG WriteErrors;
+
+} FILELOG_STATE, *PFILELOG_STATE;
+
+static FILELOG_STATE FileLogState;
+
+BOOLEAN
+FileLogPost (
+    _In_reads_(Length) const char *Line,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Queues a line for the flusher.  Safe on any thread and never waits.
+
+Arguments:
+
+    Line - The line, with its line break.
+
+    Length - Length of Line in bytes, cut to FILELOG_LINE_SIZE.
+
+Return Value:
+
+    FALSE if the flusher is not running, the caller writes the line
+    itself.  TRUE if the line was queued or dropped.
+
+--*/
+{
+    PFILELOG_SLOT slot;
+    LONG position;
+    LONG difference;
+    LONG depth;
+
+    if (!FileLogState.Running) {
+
+        return FALSE;
+    }
+
+    position = FileLogState.EnqueuePosition;
+
+    for (;;) {
+
+        slot = &FileLogState.Slots[position & FILELOG_MASK];
+        difference = slot->Sequence - position;
+
+        if (difference == 0) {
+
+            //
+            //  Our turn, if no other producer claimed the position first.
+            //
+
+            if (InterlockedCompareExchange( &FileLogState.EnqueuePosition, position + 1, position ) == position) {
+
+                break;
+            }
+
+            position = FileLogState.EnqueuePosition;
+
+        } else if (difference < 0) {
+
+            //
+            //  The flusher has not emptied this slot since the last lap.
+            //
+
+            InterlockedIncrement( &FileLogState.Dropped );
+            return TRUE;
+
+        } else {
+
+            position = FileLogState.EnqueuePosition;
+        }
+    }
+
+    slot->Length = min( Length, FILELOG_LINE_SIZE );
+    memcpy( slot->Text, Line, slot->Length );
+
+    InterlockedExchange( &slot->Sequence, position + 1 );
+
+    //
+    //  Only wake the flusher early when the queue is filling up, otherwise
+    //  it comes round on its own.
+    //
+
+    depth = position + 1 - FileLogState.DequeuePosition;
+
+    if (depth > FileLogState.HighWater) {
+
+        FileLogState.HighWater = depth;
+    }
+
+    if ((position & (FILELOG_SLOTS / 4 - 1)) == 0) {
+
+        SetEvent( FileLogState.Wake );
+    }
+
+    return TRUE;
+}
+
+static VOID
+FileLogRotate (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Closes the file and shifts it and the old files one number up,
+    dropping the oldest.  The next write opens a new file.
+
+--*/
+{
+    char from[MAX_PATH];
+    char to[MAX_PATH];
+    ULONG index;
+
+    CloseHandle( FileLogState.File );
+    FileLogState.File = INVALID_HANDLE_VALUE;
+
+    for (index = FILELOG_KEEP; index > 0; index--) {
+
+        if (index == 1) {
+
+            strcpy_s( from, sizeof( from ), USER_LOG_FILE );
+
+        } else {
+
+            snprintf( from, sizeof( from ), "%s.%lu", USER_LOG_FILE, index - 1 );
+        }
+
+        snprintf( to, sizeof( to ), "%s.%lu", USER_LOG_FILE, index );
+        MoveFileExA( from, to, MOVEFILE_REPLACE_EXISTING );
+    }
+
+    InterlockedIncrement( &FileLogState.Rotations );
+}
+
+static BOOLEAN
+FileLogOpen (
+    VOID
+    )
+{
+    LARGE_INTEGER size;
+
+    FileLogState.File = CreateFileA( USER_LOG_FILE,
+                                     FILE_APPEND_DATA,
+                                     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                     NULL,
+                                     OPEN_ALWAYS,
+                                     FILE_ATTRIBUTE_NORMAL,
+                                     NULL );
+
+    if (FileLogState.File == INVALID_HANDLE_VALUE) {
+
+        return FALSE;
+    }
+
+    FileLogState.FileSize = GetFileSizeEx( FileLogState.File, &size ) ? size.QuadPart : 0;
+    return TRUE;
+}
+
+static VOID
+FileLogWrite (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Appends the buffer to the file, rotating it first if the buffer would
+    take it past FILELOG_MAX_BYTES.  If the file cannot be written the
+    buffer is discarded and counted, there is nowhere else to report it.
+
+--*/
+{
+    DWORD written;
+
+    if (FileLogState.Buffered == 0) {
+
+        return;
+    }
+
+    if (FileLogState.File != INVALID_HANDLE_VALUE &&
+        FileLogState.FileSize + FileLogState.Buffered > FILELOG_MAX_BYTES) {
+
+        FileLogRotate();
+    }
+
+    if (FileLogState.File == INVALID_HANDLE_VALUE) {
+
+        FileLogOpen();
+    }
+
+    if (FileLogState.File == INVALID_HANDLE_VALUE ||
+        !WriteFile( FileLogState.File, FileLogState.Buffer, FileLogState.Buffered, &written, NULL )) {
+
+        InterlockedIncrement( &FileLogState.WriteErrors );
+        written = 0;
+    }
+
+    FileLogState.FileSize += written;
+    FileLogState.Bytes += written;
+    FileLogState.Buffered = 0;
+}
+
+static VOID
+FileLogAppend (
+    _In_reads_(Length) const char *Text,
+    _In_ ULONG Length
+    )
+{
+    if (FileLogState.Buffered + Length > FILELOG_FLUSH_BYTES) {
+
+        FileLogWrite();
+    }
+
+    memcpy( FileLogState.Buffer + FileLogState.Buffered, Text, Length );
+    FileLogState.Buffered += Length;
+}
+
+static VOID
+FileLogDrain (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Moves every line posted so far into the buffer and writes it out.
+    Called on the flusher thread only.
+
+--*/
+{
+    PFILELOG_SLOT slot;
+    LONG position;
+    LONG dropped;
+    char line[128];
+    SYSTEMTIME time;
+
+    for (;;) {
+
+        position = FileLogState.DequeuePosition;
+        slot = &FileLogState.Slots[position & FILELOG_MASK];
+
+        if (slot->Sequence - (position + 1) < 0) {
+
+            break;
+        }
+
+        FileLogAppend( slot->Text, slot->Length );
+        FileLogState.Lines++;
+
+        //
+        //  Hand the slot to the producer one lap ahead.
+        //
+
+        InterlockedExchange( &slot->Sequence, position + FILELOG_SLOTS );
+        FileLogState.DequeuePosition = position + 1;
+    }
+
+    dropped = FileLogState.Dropped;
+
+    if (dropped != FileLogState.DroppedReported) {
+
+        GetLocalTime( &time );
+        FileLogAppend( line,
+                       (ULONG)snprintf( line, sizeof( line ),
+                                        "[%02d:%02d:%02d] %ld line(s) dropped, the log queue was full\n",
+                                        time.wHour, time.wMinute, time.wSecond,
+                                        dropped - FileLogState.DroppedReported ) );
+
+        FileLogState.DroppedReported = dropped;
+    }
+
+    FileLogWrite();
+}
+
+static DWORD WINAPI
+FileLogThread (
+    _In_ LPVOID Parameter
+    )
+{
+    BOOLEAN stop = FALSE;
+
+    UNREFERENCED_PARAMETER( Parameter );
+
+    while (!stop) {
+
+        WaitForSingleObject( FileLogState.Wake, FILELOG_FLUSH_INTERVAL );
+
+        //
+        //  Drain once more after the stop, posting is already off.
+        //
+
+        stop = FileLogState.Stop;
+        FileLogDrain();
+    }
+
+    return 0;
+}
+
+BOOLEAN
+FileLogStart (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Allocates the queue and starts the flusher.  Until this succeeds, and
+    again after FileLogStop, WriteToLogAnsi writes every line itself.
+
+Return Value:
+
+    TRUE if lines are queued.
+
+--*/
+{
+    LONG index;
+
+    FileLogState.Slots = malloc( FILELOG_SLOTS * sizeof( FILELOG_SLOT ) );
+    FileLogState.Buffer = malloc( FILELOG_FLUSH_BYTES );
+    FileLogState.Wake = CreateEvent( NULL, FALSE, FALSE, NULL );
+    FileLogState.File = INVALID_HANDLE_VALUE;
+
+    if (FileLogState.Slots == NULL || FileLogState.Buffer == NULL || FileLogState.Wake == NULL) {
+
+        goto Fail;
+    }
+
+    for (index = 0; index < FILELOG_SLOTS; index++) {
+
+        FileLogState.Slots[index].Sequence = index;
+    }
+
+    FileLogState.EnqueuePosition = 0;
+    FileLogState.DequeuePosition = 0;
+    FileLogState.Buffered = 0;
+    FileLogState.Stop = FALSE;
+
+    FileLogOpen();
+
+    FileLogState.Thread = CreateThread( NULL, 0, FileLogThread, NULL, 0, NULL );
+
+    if (FileLogState.Thread == NULL) {
+
+        goto Fail;
+    }
+
+    FileLogState.Running = TRUE;
+    return TRUE;
+
+Fail:
+
+    if (FileLogState.File != INVALID_HANDLE_VALUE) {
+
+        CloseHandle( FileLogState.File );
+        FileLogState.File = INVALID_HANDLE_VALUE;
+    }
+
+    if (FileLogState.Wake != NULL) {
+
+        CloseHandle( FileLogState.Wake );
+        FileLogState.Wake = NULL;
+    }
+
+    free( FileLogState.Slots );
+    free( FileLogState.Buffer );
+    FileLogState.Slots = NULL;
+    FileLogState.Buffer = NULL;
+    return FALSE;
+}
+
+VOID
+FileLogStop (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Writes out the queued lines and stops the flusher.  Call once every
+    other thread that logs has stopped, a line posted while this runs may
+    be lost.
+
+--*/
+{
+    if (FileLogState.Thread == NULL) {
+
+        return;
+    }
+
+    FileLogState.Running = FALSE;
+    FileLogState.Stop = TRUE;
+    SetEvent( FileLogState.Wake );
+
+    WaitForSingleObject( FileLogState.Thread, INFINITE );
+
+    CloseHandle( FileLogState.Thread );
+    CloseHandle( FileLogState.Wake );
+    FileLogState.Thread = NULL;
+    FileLogState.Wake = NULL;
+
+    if (FileLogState.File != INVALID_HANDLE_VALUE) {
+
+        CloseHandle( FileLogState.File );
+        FileLogState.File = INVALID_HANDLE_VALUE;
+    }
+
+    free( FileLogState.Slots );
+    free( FileLogState.Buffer );
+    FileLogState.Slots = NULL;
+    FileLogState.Buffer = NULL;
+}
+
+VOID
+FileLogPrintStats (
+    VOID
+    )
+{
+    if (FileLogState.Thread == NULL) {
+
+        printf( "    Service log:        written directly, the flusher is not running\n" );
+        return;
+    }
+
+    printf( "    Service log:        %I64d lines, %I64d KB written, %ld dropped, %ld write errors, %ld rotations\n",
+            FileLogState.Lines,
+            FileLogState.Bytes / 1024,
+            FileLogState.Dropped,
+            FileLogState.WriteErrors,
+            FileLogState.Rotations );
+    printf( "    Service log queue:  high water %ld of %u lines\n",
+            FileLogState.HighWater,
+            FILELOG_SLOTS );
+}
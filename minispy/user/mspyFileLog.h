@@ -0,0 +1,69 @@
+/*++
+
+Module Name:
+
+    mspyFileLog.h
+
+Abstract:
+
+    Buffered writer for the service log, USER_LOG_FILE.  WriteToLogAnsi
+    hands lines to a lock free queue and a flusher thread appends them to
+    the file, so logging never waits for the disk.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYFILELOG_H__
+#define __MSPYFILELOG_H__
+
+#include <windows.h>
+
+//
+//  The queue holds at most FILELOG_SLOTS lines of up to FILELOG_LINE_SIZE
+//  bytes, longer lines are cut.  Lines posted while it is full are dropped
+//  and counted.  FILELOG_SLOTS must be a power of two.
+//
+
+#define FILELOG_SLOTS           4096
+#define FILELOG_LINE_SIZE       512
+
+//
+//  The flusher writes whenever it has FILELOG_FLUSH_BYTES buffered and at
+//  least every FILELOG_FLUSH_INTERVAL.
+//
+
+#define FILELOG_FLUSH_BYTES     (64 * 1024)
+#define FILELOG_FLUSH_INTERVAL  250         // milliseconds
+
+//
+//  Past FILELOG_MAX_BYTES the file is renamed to .1, the previous .1 to .2
+//  and so on, keeping FILELOG_KEEP old files.
+//
+
+#define FILELOG_MAX_BYTES       (8 * 1024 * 1024)
+#define FILELOG_KEEP            3
+
+BOOLEAN
+FileLogStart (
+    VOID
+    );
+
+VOID
+FileLogStop (
+    VOID
+    );
+
+BOOLEAN
+FileLogPost (
+    _In_reads_(Length) const char *Line,
+    _In_ ULONG Length
+    );
+
+VOID
+FileLogPrintStats (
+    VOID
+    );
+
+#endif //__MSPYFILELOG_H__
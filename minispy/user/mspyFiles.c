@@ -0,0 +1,343 @@
+/*++
+
+Module Name:
+
+    mspyFiles.c
+
+Abstract:
+
+    Finds the FileID of a file name for the row the writer is about to
+    insert, adding the name to Files the first time it is seen.
+
+    Most operations go to a small working set of files, so the ids of the
+    names in use are kept in an open addressing table in memory, keyed by
+    the exact UTF-8 the filter reported, and a record costs a hash and a
+    compare.  Only a name missing from the table is looked up in Files,
+    and inserted there if it is new.  The text of the names is kept in one
+    block, and when the table or the block is full everything is dropped
+    at once and the working set is read back from Files as it comes.
+
+    Ids belong to the database of the writer's connection, so the table is
+    emptied whenever it changes, including for each partition.  Names are
+    added in the writer's current batch, so if the batch is rolled back
+    the table must be emptied with FilesForget as well.
+
+    Nothing here calls the system, so the table behaves the same whatever
+    it is built for.  Only the log writer thread calls in here, the
+    counters are read from the console.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyFiles.h"
+
+typedef struct _FILES_SLOT {
+
+    sqlite3_int64 FileId;       // 0 if the slot is free
+    ULONG Hash;
+    ULONG Length;
+    ULONG Text;                 // offset in FILES_STATE.Text
+
+} FILES_SLOT, *PFILES_SLOT;
+
+typedef struct _FILES_STATS {
+
+    ULONGLONG Lookups;
+    ULONGLONG Reads;            // looked up in Files
+    ULONGLONG Added;            // inserted into Files
+    ULONGLONG Failures;
+    ULONGLONG Resets;
+    ULONG Entries;
+
+} FILES_STATS;
+
+typedef struct _FILES_STATE {
+
+    PFILES_SLOT Slots;          // [FILES_CACHE_SLOTS]
+    char *Text;                 // [FILES_CACHE_TEXT]
+    ULONG TextUsed;
+
+    sqlite3_stmt *Select;
+    sqlite3_stmt *Insert;
+    sqlite3 *Db;
+
+    FILES_STATS Stats;
+
+} FILES_STATE;
+
+static FILES_STATE Files;
+
+static ULONG
+FilesHash (
+    _In_reads_(Length) const char *Path,
+    _In_ ULONG Length
+    )
+{
+    ULONG hash = 2166136261UL;
+    ULONG index;
+
+    for (index = 0; index < Length; index++) {
+
+        hash = (hash ^ (UCHAR)Path[index]) * 16777619UL;
+    }
+
+    return hash;
+}
+
+static VOID
+FilesClear (
+    VOID
+    )
+{
+    if (Files.Slots != NULL) {
+
+        memset( Files.Slots, 0, FILES_CACHE_SLOTS * sizeof( FILES_SLOT ) );
+    }
+
+    Files.TextUsed = 0;
+    Files.Stats.Entries = 0;
+}
+
+static sqlite3_int64
+FilesRead (
+    _In_reads_(Length) const char *Path,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Looks a name up in Files, inserting it if it is not there.
+
+Return Value:
+
+    Its FileID, or 0 if neither worked.
+
+--*/
+{
+    sqlite3_int64 fileId = 0;
+
+    Files.Stats.Reads++;
+
+    sqlite3_bind_text( Files.Select, 1, Path, (int)Length, SQLITE_STATIC );
+
+    if (sqlite3_step( Files.Select ) == SQLITE_ROW) {
+
+        fileId = sqlite3_column_int64( Files.Select, 0 );
+    }
+
+    sqlite3_reset( Files.Select );
+    sqlite3_clear_bindings( Files.Select );
+
+    if (fileId != 0) {
+
+        return fileId;
+    }
+
+    sqlite3_bind_text( Files.Insert, 1, Path, (int)Length, SQLITE_STATIC );
+
+    if (sqlite3_step( Files.Insert ) == SQLITE_DONE) {
+
+        fileId = sqlite3_last_insert_rowid( Files.Db );
+        Files.Stats.Added++;
+    }
+
+    sqlite3_reset( Files.Insert );
+    sqlite3_clear_bindings( Files.Insert );
+
+    return fileId;
+}
+
+BOOLEAN
+FilesPrepare (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Prepares the Files reads and writes on the writer's connection, and
+    empties the table, whose ids belonged to the previous one.
+
+Return Value:
+
+    TRUE if names can be looked up.  Otherwise sqlite3_errmsg( Db ) says
+    why, and FilesLookup always fails.
+
+--*/
+{
+    Files.Db = Db;
+    FilesClear();
+
+    if (Files.Slots == NULL) {
+
+        Files.Slots = calloc( FILES_CACHE_SLOTS, sizeof( FILES_SLOT ) );
+        Files.Text = malloc( FILES_CACHE_TEXT );
+
+        if (Files.Slots == NULL || Files.Text == NULL) {
+
+            FilesFinalize();
+            return FALSE;
+        }
+    }
+
+    if (sqlite3_prepare_v2( Db, "SELECT FileID FROM Files WHERE Path = ?;", -1, &Files.Select, NULL ) != SQLITE_OK ||
+        sqlite3_prepare_v2( Db, "INSERT INTO Files (Path) VALUES (?);", -1, &Files.Insert, NULL ) != SQLITE_OK) {
+
+        FilesFinalize();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+FilesFinalize (
+    VOID
+    )
+{
+    sqlite3_finalize( Files.Select );
+    Files.Select = NULL;
+    sqlite3_finalize( Files.Insert );
+    Files.Insert = NULL;
+    Files.Db = NULL;
+
+    free( Files.Slots );
+    Files.Slots = NULL;
+    free( Files.Text );
+    Files.Text = NULL;
+    FilesClear();
+}
+
+sqlite3_int64
+FilesLookup (
+    _In_reads_(Length) const char *Path,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Finds the FileID of a file name, adding it to Files if it is new.
+
+Arguments:
+
+    Path - The name in UTF-8, need not be terminated.
+
+    Length - Its length in bytes.
+
+Return Value:
+
+    The FileID, or 0 if the name could not be looked up or added.  The
+    caller stores the name itself then.
+
+--*/
+{
+    ULONG hash;
+    ULONG slot;
+    PFILES_SLOT entry;
+    sqlite3_int64 fileId;
+
+    if (Files.Insert == NULL) {
+
+        return 0;
+    }
+
+    Files.Stats.Lookups++;
+
+    hash = FilesHash( Path, Length );
+    slot = hash & (FILES_CACHE_SLOTS - 1);
+
+    while (Files.Slots[slot].FileId != 0) {
+
+        entry = &Files.Slots[slot];
+
+        if (entry->Hash == hash &&
+            entry->Length == Length &&
+            memcmp( Files.Text + entry->Text, Path, Length ) == 0) {
+
+            return entry->FileId;
+        }
+
+        slot = (slot + 1) & (FILES_CACHE_SLOTS - 1);
+    }
+
+    fileId = FilesRead( Path, Length );
+
+    if (fileId == 0) {
+
+        Files.Stats.Failures++;
+        return 0;
+    }
+
+    //
+    //  Names too long for the whole block are just not kept.
+    //
+
+    if (Length > FILES_CACHE_TEXT) {
+
+        return fileId;
+    }
+
+    if (Files.Stats.Entries >= FILES_CACHE_ENTRIES ||
+        Length > FILES_CACHE_TEXT - Files.TextUsed) {
+
+        FilesClear();
+        Files.Stats.Resets++;
+        slot = hash & (FILES_CACHE_SLOTS - 1);
+    }
+
+    entry = &Files.Slots[slot];
+    entry->FileId = fileId;
+    entry->Hash = hash;
+    entry->Length = Length;
+    entry->Text = Files.TextUsed;
+
+    memcpy( Files.Text + Files.TextUsed, Path, Length );
+    Files.TextUsed += Length;
+    Files.Stats.Entries++;
+
+    return fileId;
+}
+
+VOID
+FilesForget (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Empties the table after the writer's batch was rolled back, since the
+    names it added to Files are gone and their ids may be given out again.
+
+--*/
+{
+    FilesClear();
+}
+
+VOID
+FilesPrintStats (
+    VOID
+    )
+{
+    FILES_STATS stats = Files.Stats;
+
+    printf( "    Files:       %lu names in memory, %I64u lookups, %I64u read from Files, %I64u added, %I64u failed, %I64u resets\n",
+            stats.Entries,
+            stats.Lookups,
+            stats.Reads,
+            stats.Added,
+            stats.Failures,
+            stats.Resets );
+}
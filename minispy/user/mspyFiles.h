@@ -0,0 +1,60 @@
+/*++
+
+Module Name:
+
+    mspyFiles.h
+
+Abstract:
+
+    Ids of the file names in the Files table, which MinifilterLog refers
+    to instead of repeating the name in every row.  The ids of the names
+    in use are kept in memory, so the writer only reads Files for a name
+    it has not seen on this connection.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYFILES_H__
+#define __MSPYFILES_H__
+
+#include <windows.h>
+#include <sqlite3.h>
+
+//
+//  Names kept in memory, and room for their text.  When either runs out
+//  every name is dropped and the working set is read back from Files.
+//
+
+#define FILES_CACHE_ENTRIES     32768
+#define FILES_CACHE_SLOTS       (FILES_CACHE_ENTRIES * 2)       // power of two
+#define FILES_CACHE_TEXT        (4 * 1024 * 1024)
+
+BOOLEAN
+FilesPrepare (
+    _In_ sqlite3 *Db
+    );
+
+VOID
+FilesFinalize (
+    VOID
+    );
+
+sqlite3_int64
+FilesLookup (
+    _In_reads_(Length) const char *Path,
+    _In_ ULONG Length
+    );
+
+VOID
+FilesForget (
+    VOID
+    );
+
+VOID
+FilesPrintStats (
+    VOID
+    );
+
+#endif //__MSPYFILES_H__
@@ -0,0 +1,1400 @@
+/*++
+
+Module Name:
+
+    mspyGen.c
+
+Abstract:
+
+    Generates the records the filter would send, for load testing the
+    logging thread and everything it feeds without the filter or a
+    workload to watch.
+
+    GenFill fills a buffer with packed LOG_RECORDs exactly as
+    GetMiniSpyLog does: every record is as long as sizeof(LOG_RECORD) plus
+    its null terminated name rounded up to PVOID, no longer than
+    MAX_LOG_RECORD_LENGTH, and the next one starts where it ends.  It
+    returns ERROR_NO_MORE_ITEMS when no record is due yet, so the logging
+    thread polls it as it polls the filter.
+
+    Every generated process is reported with a RECORD_TYPE_PROCESS create
+    record first, so operations are attributed from the process table.
+    Each process has Threads threads and each thread has at most one file
+    open at a time: it opens a path, issues operations on it picked by
+    weight, then cleans up and closes it before opening the next, so the
+    operations of a file object form a session as they would from the
+    filter.  Paths and processes are picked by Zipf rank, with rejection
+    inversion sampling so neither costs memory per path.  The name of a
+    path is derived from its rank and the seed, so the same path always
+    has the same name and the most popular paths are spread over the tree.
+
+    Records are timed on the configured rate from the start, not on when
+    they are taken: if the pipeline falls behind, records keep their times
+    and GenPrintStats shows by how much it is behind.
+
+    Nothing here calls the system, the caller passes the time.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyArgs.h"
+#include "mspyGen.h"
+
+#define GEN_MAJORS              (IRP_MJ_MAXIMUM_FUNCTION + 1)
+
+//
+//  NTSTATUS values of failed operations and Information of creates.
+//
+
+#define GEN_STATUS_OBJECT_NAME_NOT_FOUND    ((NTSTATUS)0xC0000034L)
+#define GEN_STATUS_END_OF_FILE              ((NTSTATUS)0xC0000011L)
+#define GEN_STATUS_NO_MORE_FILES            ((NTSTATUS)0x80000006L)
+#define GEN_STATUS_ACCESS_DENIED            ((NTSTATUS)0xC0000022L)
+
+#define GEN_FILE_OPENED                     1
+#define GEN_FILE_OPEN_IF                    3
+#define GEN_FILE_NON_DIRECTORY_FILE         0x00000040
+
+#define GEN_USER_MODE                       1
+
+//
+//  The state of the file a thread has open.
+//
+
+#define GEN_FILE_NONE           0
+#define GEN_FILE_OPEN           1
+#define GEN_FILE_CLEANED_UP     2
+
+typedef struct _GEN_THREAD {
+
+    ULONG_PTR ThreadId;
+    ULONG State;
+    ULONG Path;                 // rank of the file, from 1
+    ULONG Opens;
+    ULONG_PTR FileObject;
+    LONGLONG Offset;
+
+} GEN_THREAD, *PGEN_THREAD;
+
+typedef struct _GEN_PROCESS {
+
+    ULONG_PTR ProcessId;
+    LONGLONG CreateTime;
+
+} GEN_PROCESS, *PGEN_PROCESS;
+
+//
+//  Zipf distribution over ranks 1..Count, sampled by rejection inversion
+//  (Hormann and Derflinger, 1996).
+//
+
+typedef struct _GEN_ZIPF {
+
+    ULONG Count;
+    double Exponent;
+    double IntegralFirst;       // H(1.5) - 1
+    double IntegralLast;        // H(Count + 0.5)
+    double Squeeze;
+
+} GEN_ZIPF, *PGEN_ZIPF;
+
+typedef struct _GEN_STATE {
+
+    GEN_CONFIG Config;
+    ULONGLONG Random;
+
+    GEN_ZIPF Paths;
+    GEN_ZIPF Processes;
+    ULONG WeightTotal;
+    ULONG Cumulative[GEN_MAJORS];
+
+    PGEN_PROCESS Process;
+    PGEN_THREAD Thread;
+    ULONG Reported;             // processes whose create record was sent
+
+    LONGLONG StartTime;
+    LONGLONG LastTime;          // of the newest record
+    ULONG Sequence;
+
+    //
+    //  Counters for /g.
+    //
+
+    ULONGLONG Records;          // operation records, process records aside
+    ULONGLONG Bytes;
+    ULONGLONG Buffers;
+    ULONGLONG Failed;
+    ULONGLONG Behind;           // records due but not yet taken, at the last fill
+    ULONGLONG MostBehind;
+    ULONGLONG Majors[GEN_MAJORS];
+
+} GEN_STATE, *PGEN_STATE;
+
+//
+//  The generator the logging thread reads.  The lock is held by GenFill
+//  while it fills a buffer and by GenStart and GenStop while they swap
+//  the state.  It starts zeroed, which is also what SRWLOCK_INIT is.
+//
+
+static struct {
+
+    SRWLOCK Lock;
+    volatile BOOLEAN Active;
+    GEN_STATE State;
+
+} Gen = { 0 };
+
+//
+//  Default mix of major functions, and the names /g takes for them.
+//
+
+typedef struct _GEN_MAJOR {
+
+    const char *Name;
+    UCHAR Major;
+    ULONG Weight;
+    LONG Latency;               // mean, in 100ns
+
+} GEN_MAJOR;
+
+static const GEN_MAJOR GenMajors[] = {
+
+    { "create",     IRP_MJ_CREATE,                      10, 300 },
+    { "read",       IRP_MJ_READ,                        40, 150 },
+    { "write",      IRP_MJ_WRITE,                       20, 250 },
+    { "query",      IRP_MJ_QUERY_INFORMATION,           15, 20 },
+    { "set",        IRP_MJ_SET_INFORMATION,             3,  60 },
+    { "flush",      IRP_MJ_FLUSH_BUFFERS,               1,  2000 },
+    { "volume",     IRP_MJ_QUERY_VOLUME_INFORMATION,    2,  20 },
+    { "dir",        IRP_MJ_DIRECTORY_CONTROL,           5,  200 },
+    { "fsctl",      IRP_MJ_FILE_SYSTEM_CONTROL,         2,  40 },
+    { "lock",       IRP_MJ_LOCK_CONTROL,                1,  20 },
+    { "cleanup",    IRP_MJ_CLEANUP,                     0,  40 },
+    { "close",      IRP_MJ_CLOSE,                       0,  10 },
+};
+
+static const char * const GenExtensions[] = {
+    "txt", "docx", "xlsx", "pdf", "jpg", "png", "dll", "exe", "log", "dat", "json", "tmp"
+};
+
+//
+//  Information classes of queries and sets, FSCTLs.
+//
+
+static const ULONG GenQueryClasses[] = { 4, 5, 18, 34 };        // basic, standard, all, network open
+static const ULONG GenSetClasses[] = { 4, 19, 20, 10, 13 };     // basic, allocation, end of file, rename, disposition
+static const ULONG GenControlCodes[] = { 0x000900a8, 0x000940cf, 0x00090073 };  // get reparse point, query allocated ranges, get retrieval pointers
+
+static ULONGLONG
+GenMix (
+    _In_ ULONGLONG Value
+    )
+{
+    //
+    //  splitmix64 finalizer.
+    //
+
+    Value ^= Value >> 30;
+    Value *= 0xBF58476D1CE4E5B9ULL;
+    Value ^= Value >> 27;
+    Value *= 0x94D049BB133111EBULL;
+    Value ^= Value >> 31;
+
+    return Value;
+}
+
+static ULONGLONG
+GenRandom (
+    _Inout_ PGEN_STATE State
+    )
+{
+    State->Random += 0x9E3779B97F4A7C15ULL;
+
+    return GenMix( State->Random );
+}
+
+static ULONG
+GenBelow (
+    _Inout_ PGEN_STATE State,
+    _In_ ULONG Bound
+    )
+{
+    return (ULONG)(((GenRandom( State ) >> 32) * Bound) >> 32);
+}
+
+static double
+GenUniform (
+    _Inout_ PGEN_STATE State
+    )
+/*++
+
+Routine Description:
+
+    Returns a number in (0, 1].
+
+--*/
+{
+    return ((GenRandom( State ) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static double
+GenLogRatio (
+    _In_ double X
+    )
+{
+    //
+    //  log(1 + x) / x, kept accurate as x goes to 0.
+    //
+
+    if (fabs( X ) > 1e-8) {
+
+        return log1p( X ) / X;
+    }
+
+    return 1.0 - X * (0.5 - X * (1.0 / 3.0 - 0.25 * X));
+}
+
+static double
+GenExpRatio (
+    _In_ double X
+    )
+{
+    //
+    //  (exp(x) - 1) / x, kept accurate as x goes to 0.
+    //
+
+    if (fabs( X ) > 1e-8) {
+
+        return expm1( X ) / X;
+    }
+
+    return 1.0 + X * 0.5 * (1.0 + X * (1.0 / 3.0) * (1.0 + 0.25 * X));
+}
+
+static double
+GenZipfIntegral (
+    _In_ PGEN_ZIPF Zipf,
+    _In_ double X
+    )
+{
+    //
+    //  H(x), the integral of x^-s, as (x^(1-s) - 1) / (1 - s) or log(x).
+    //
+
+    double logX = log( X );
+
+    return GenExpRatio( (1.0 - Zipf->Exponent) * logX ) * logX;
+}
+
+static double
+GenZipfInverse (
+    _In_ PGEN_ZIPF Zipf,
+    _In_ double X
+    )
+{
+    double t = X * (1.0 - Zipf->Exponent);
+
+    if (t < -1.0) {
+
+        t = -1.0;
+    }
+
+    return exp( GenLogRatio( t ) * X );
+}
+
+static VOID
+GenZipfInitialize (
+    _Out_ PGEN_ZIPF Zipf,
+    _In_ ULONG Count,
+    _In_ ULONG Skew
+    )
+{
+    Zipf->Count = Count;
+    Zipf->Exponent = Skew / 100.0;
+
+    if (Skew == 0) {
+
+        return;
+    }
+
+    Zipf->IntegralFirst = GenZipfIntegral( Zipf, 1.5 ) - 1.0;
+    Zipf->IntegralLast = GenZipfIntegral( Zipf, Count + 0.5 );
+    Zipf->Squeeze = 2.0 - GenZipfInverse( Zipf,
+                                          GenZipfIntegral( Zipf, 2.5 ) -
+                                          exp( -Zipf->Exponent * log( 2.0 ) ) );
+}
+
+static ULONG
+GenZipf (
+    _Inout_ PGEN_STATE State,
+    _In_ PGEN_ZIPF Zipf
+    )
+/*++
+
+Routine Description:
+
+    Picks a rank, 1 the most popular.
+
+--*/
+{
+    double u;
+    double x;
+    double k;
+
+    if (Zipf->Exponent == 0.0) {
+
+        return GenBelow( State, Zipf->Count ) + 1;
+    }
+
+    for (;;) {
+
+        u = Zipf->IntegralLast + GenUniform( State ) * (Zipf->IntegralFirst - Zipf->IntegralLast);
+        x = GenZipfInverse( Zipf, u );
+        k = floor( x + 0.5 );
+
+        if (k < 1.0) {
+
+            k = 1.0;
+
+        } else if (k > Zipf->Count) {
+
+            k = Zipf->Count;
+        }
+
+        if (k - x <= Zipf->Squeeze ||
+            u >= GenZipfIntegral( Zipf, k + 0.5 ) - exp( -Zipf->Exponent * log( k ) )) {
+
+            return (ULONG)k;
+        }
+    }
+}
+
+static ULONG
+GenAppend (
+    _Inout_updates_(GEN_MAX_NAME + 1) WCHAR *Name,
+    _In_ ULONG Length,
+    _In_z_ const char *Text
+    )
+{
+    while (*Text != 0 && Length < GEN_MAX_NAME) {
+
+        Name[Length++] = (WCHAR)*Text++;
+    }
+
+    Name[Length] = UNICODE_NULL;
+
+    return Length;
+}
+
+static ULONG
+GenAppendNumber (
+    _Inout_updates_(GEN_MAX_NAME + 1) WCHAR *Name,
+    _In_ ULONG Length,
+    _In_ ULONG Value,
+    _In_ ULONG Base,
+    _In_ ULONG Digits
+    )
+/*++
+
+Routine Description:
+
+    Appends Value with Digits digits, as %0<Digits>u or %0<Digits>x would.
+    Every record names its file, and sprintf made up most of the time
+    generating one took.
+
+--*/
+{
+    ULONG index;
+
+    if (Length + Digits > GEN_MAX_NAME) {
+
+        return Length;
+    }
+
+    for (index = Digits; index-- > 0; Value /= Base) {
+
+        Name[Length + index] = (WCHAR)"0123456789abcdef"[Value % Base];
+    }
+
+    Length += Digits;
+    Name[Length] = UNICODE_NULL;
+
+    return Length;
+}
+
+static ULONG
+GenPathName (
+    _In_ PGEN_STATE State,
+    _In_ ULONG Path,
+    _Out_writes_(GEN_MAX_NAME + 1) WCHAR *Name
+    )
+/*++
+
+Routine Description:
+
+    Builds the name of a path from its rank, as the filter names it:
+    \Device\HarddiskVolume3\Users\userNN\dXXXX\...\fXXXXXXXX....ext.
+    Its length is picked between NameMin and NameMax from the same hash,
+    but it is no shorter than its fixed parts, about 50 characters.
+
+Return Value:
+
+    Length of the name in characters.
+
+--*/
+{
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    ULONGLONG hash = GenMix( State->Config.Seed ^ Path );
+    ULONGLONG directory = hash;
+    const char *extension = GenExtensions[hash % ARRAYSIZE( GenExtensions )];
+    ULONG target;
+    ULONG length;
+    ULONG stem;
+    ULONG depth;
+
+    target = State->Config.NameMin + (ULONG)((hash >> 8) % (State->Config.NameMax - State->Config.NameMin + 1));
+
+    length = 0;
+    length = GenAppend( Name, length, "\\Device\\HarddiskVolume3\\Users\\" );
+
+    length = GenAppend( Name, length, "user" );
+    length = GenAppendNumber( Name, length, (ULONG)(hash >> 16) % 16, 10, 2 );
+    length = GenAppend( Name, length, "\\" );
+
+    //
+    //  Each level has 16 directories, so files share their parents.
+    //  Leave room for "f" and 8 digits, the dot and the extension.
+    //
+
+    stem = 1 + 8 + 1 + (ULONG)strlen( extension );
+
+    for (depth = 0; length + 6 + stem <= target && depth < 24; depth++) {
+
+        directory = GenMix( directory + depth );
+        length = GenAppend( Name, length, "d" );
+        length = GenAppendNumber( Name, length, (ULONG)(directory % 16) * 0x111, 16, 4 );
+        length = GenAppend( Name, length, "\\" );
+    }
+
+    length = GenAppend( Name, length, "f" );
+    length = GenAppendNumber( Name, length, Path, 16, 8 );
+
+    //
+    //  Pad the file name up to the length picked.
+    //
+
+    while (length + 1 + strlen( extension ) < target && length < GEN_MAX_NAME) {
+
+        hash = GenMix( hash );
+        Name[length++] = (WCHAR)digits[hash % (ARRAYSIZE( digits ) - 1)];
+    }
+
+    length = GenAppend( Name, length, "." );
+    length = GenAppend( Name, length, extension );
+
+    return length;
+}
+
+static PLOG_RECORD
+GenRecord (
+    _Inout_ PGEN_STATE State,
+    _Out_writes_bytes_(MAX_LOG_RECORD_LENGTH) PVOID Buffer,
+    _In_ ULONG RecordType,
+    _In_reads_(NameLength) const WCHAR *Name,
+    _In_ ULONG NameLength
+    )
+/*++
+
+Routine Description:
+
+    Lays out a record with its name as the filter does and sets its
+    length.  The caller fills in Data.
+
+--*/
+{
+    PLOG_RECORD record = (PLOG_RECORD)Buffer;
+
+    memset( record, 0, sizeof( LOG_RECORD ) );
+
+    record->SequenceNumber = ++State->Sequence;
+    record->RecordType = RecordType;
+
+    record->Length = ROUND_TO_SIZE( sizeof( LOG_RECORD ) +
+                                    (NameLength + 1) * sizeof( WCHAR ),
+                                    sizeof( PVOID ) );
+
+    //
+    //  The padding after the name is cleared too, the same seed gives
+    //  the same bytes.
+    //
+
+    memcpy( record->Name, Name, NameLength * sizeof( WCHAR ) );
+    memset( &record->Name[NameLength], 0, record->Length - FIELD_OFFSET( LOG_RECORD, Name ) - NameLength * sizeof( WCHAR ) );
+
+    return record;
+}
+
+static ULONG
+GenProcessRecord (
+    _Inout_ PGEN_STATE State,
+    _Out_writes_bytes_(MAX_LOG_RECORD_LENGTH) PVOID Buffer,
+    _In_ ULONG Index
+    )
+{
+    PGEN_PROCESS process = &State->Process[Index];
+    PLOG_RECORD record;
+    WCHAR name[GEN_MAX_NAME + 1];
+    ULONG length;
+    char part[32];
+
+    length = GenAppend( name, 0, "\\Device\\HarddiskVolume3\\Program Files\\Generated\\" );
+    sprintf( part, "app%04lu.exe", Index );
+    length = GenAppend( name, length, part );
+
+    record = GenRecord( State, Buffer, RECORD_TYPE_PROCESS, name, length );
+
+    record->Data.ProcessId = process->ProcessId;
+    record->Data.OriginatingTime.QuadPart = process->CreateTime;
+    record->Data.CallbackMinorId = PROCESS_RECORD_CREATE;
+    record->Data.Information = 4;           // System
+    record->Data.ThreadId = 8;
+    record->Data.RequestorMode = 0;
+
+    return record->Length;
+}
+
+static UCHAR
+GenPickMajor (
+    _Inout_ PGEN_STATE State
+    )
+{
+    ULONG pick = GenBelow( State, State->WeightTotal );
+    ULONG major;
+
+    for (major = 0; major < GEN_MAJORS - 1; major++) {
+
+        if (pick < State->Cumulative[major]) {
+
+            break;
+        }
+    }
+
+    return (UCHAR)major;
+}
+
+static LONG
+GenLatency (
+    _Inout_ PGEN_STATE State,
+    _In_ UCHAR Major
+    )
+{
+    ULONG index;
+
+    for (index = 0; index < ARRAYSIZE( GenMajors ); index++) {
+
+        if (GenMajors[index].Major == Major) {
+
+            return (LONG)(-GenMajors[index].Latency * log( GenUniform( State ) )) + 1;
+        }
+    }
+
+    return 10;
+}
+
+static ULONG
+GenOperationRecord (
+    _Inout_ PGEN_STATE State,
+    _Out_writes_bytes_(MAX_LOG_RECORD_LENGTH) PVOID Buffer,
+    _In_ LONGLONG Time
+    )
+/*++
+
+Routine Description:
+
+    Generates the next operation of a thread picked by process rank.
+
+Return Value:
+
+    Length of the record.
+
+--*/
+{
+    PGEN_THREAD thread;
+    PGEN_PROCESS process;
+    PLOG_RECORD record;
+    PRECORD_DATA data;
+    PARGS_PARAMETERS parameters;
+    ULONG processIndex;
+    UCHAR major;
+    BOOLEAN failed;
+    ULONG length;
+    WCHAR name[GEN_MAX_NAME + 1];
+
+    processIndex = GenZipf( State, &State->Processes ) - 1;
+    process = &State->Process[processIndex];
+    thread = &State->Thread[processIndex * State->Config.Threads + GenBelow( State, State->Config.Threads )];
+
+    //
+    //  A thread opens a file before anything else, and closes it after
+    //  cleaning it up.  Picking create while a file is open moves on.
+    //
+
+    if (thread->State == GEN_FILE_NONE) {
+
+        major = IRP_MJ_CREATE;
+
+    } else if (thread->State == GEN_FILE_CLEANED_UP) {
+
+        major = IRP_MJ_CLOSE;
+
+    } else {
+
+        major = GenPickMajor( State );
+
+        if (major == IRP_MJ_CREATE) {
+
+            major = IRP_MJ_CLEANUP;
+        }
+    }
+
+    failed = (major != IRP_MJ_CLEANUP &&
+              major != IRP_MJ_CLOSE &&
+              GenBelow( State, 100 ) < State->Config.Failures);
+
+    if (major == IRP_MJ_CREATE) {
+
+        thread->Path = GenZipf( State, &State->Paths );
+        thread->Opens++;
+        thread->Offset = 0;
+
+        //
+        //  A pointer the kernel could hand out, unique per open.
+        //
+
+        thread->FileObject = ((ULONG_PTR)1 << (sizeof( ULONG_PTR ) * 8 - 1)) |
+                             ((ULONG_PTR)GenMix( ((ULONGLONG)thread->ThreadId << 32) | thread->Opens ) &
+                              ((ULONG_PTR)-1 >> 1) & ~(ULONG_PTR)7);
+    }
+
+    length = GenPathName( State, thread->Path, name );
+    record = GenRecord( State, Buffer, RECORD_TYPE_NORMAL, name, length );
+    data = &record->Data;
+    parameters = (PARGS_PARAMETERS)&data->Arg1;
+
+    data->OriginatingTime.QuadPart = Time;
+    data->CompletionTime.QuadPart = Time + GenLatency( State, major );
+    data->DeviceObject = (FILE_ID)((ULONG_PTR)-1 << 12);
+    data->FileObject = thread->FileObject;
+    data->ProcessId = process->ProcessId;
+    data->ThreadId = thread->ThreadId;
+    data->Flags = FLT_CALLBACK_DATA_IRP_OPERATION;
+    data->CallbackMajorId = major;
+    data->RequestorMode = GEN_USER_MODE;
+
+    switch (major) {
+
+    case IRP_MJ_CREATE:
+
+        data->IrpFlags = IRP_CREATE_OPERATION | IRP_SYNCHRONOUS_API;
+        parameters->Others.Argument2 = (PVOID)(ULONG_PTR)((GEN_FILE_OPEN_IF << 24) | GEN_FILE_NON_DIRECTORY_FILE);
+        parameters->Others.Argument3 = (PVOID)(ULONG_PTR)(FILE_ATTRIBUTE_NORMAL | (7 << 16));
+
+        if (failed) {
+
+            data->Status = GEN_STATUS_OBJECT_NAME_NOT_FOUND;
+
+        } else {
+
+            data->Information = GEN_FILE_OPENED;
+            thread->State = GEN_FILE_OPEN;
+        }
+        break;
+
+    case IRP_MJ_READ:
+    case IRP_MJ_WRITE:
+
+        parameters->ReadWrite.Length = (ULONG_PTR)0x1000 << GenBelow( State, 5 );
+        data->IrpFlags = ((major == IRP_MJ_READ) ? IRP_READ_OPERATION : IRP_WRITE_OPERATION) |
+                         IRP_SYNCHRONOUS_API;
+
+        //
+        //  One in four goes around the cache.
+        //
+
+        if (GenBelow( State, 4 ) == 0) {
+
+            data->IrpFlags |= IRP_NOCACHE;
+        }
+
+        //
+        //  Mostly sequential, one in eight somewhere in the first 16MB.
+        //
+
+        if (GenBelow( State, 8 ) == 0) {
+
+            thread->Offset = (LONGLONG)GenBelow( State, 4096 ) * 0x1000;
+        }
+
+        parameters->ReadWrite.ByteOffset.QuadPart = thread->Offset;
+
+        if (failed) {
+
+            data->Status = (major == IRP_MJ_READ) ? GEN_STATUS_END_OF_FILE : GEN_STATUS_ACCESS_DENIED;
+
+        } else {
+
+            data->Information = parameters->ReadWrite.Length;
+            thread->Offset += parameters->ReadWrite.Length;
+        }
+        break;
+
+    case IRP_MJ_QUERY_INFORMATION:
+
+        parameters->Information.Length = 104;
+        parameters->Information.InformationClass = GenQueryClasses[GenBelow( State, ARRAYSIZE( GenQueryClasses ) )];
+        data->Information = failed ? 0 : 56;
+        data->Status = failed ? GEN_STATUS_ACCESS_DENIED : 0;
+        break;
+
+    case IRP_MJ_SET_INFORMATION:
+
+        parameters->Information.Length = 40;
+        parameters->Information.InformationClass = GenSetClasses[GenBelow( State, ARRAYSIZE( GenSetClasses ) )];
+        data->Status = failed ? GEN_STATUS_ACCESS_DENIED : 0;
+        break;
+
+    case IRP_MJ_QUERY_VOLUME_INFORMATION:
+
+        parameters->Information.Length = 24;
+        parameters->Information.InformationClass = 3;          // FileFsSizeInformation
+        data->Information = failed ? 0 : 24;
+        data->Status = failed ? GEN_STATUS_ACCESS_DENIED : 0;
+        break;
+
+    case IRP_MJ_DIRECTORY_CONTROL:
+
+        data->CallbackMinorId = IRP_MN_QUERY_DIRECTORY;
+        parameters->QueryDirectory.Length = 0x1000;
+        parameters->QueryDirectory.FileInformationClass = 37;  // FileIdBothDirectoryInformation
+        data->Information = failed ? 0 : 0x1000 - GenBelow( State, 0x400 );
+        data->Status = failed ? GEN_STATUS_NO_MORE_FILES : 0;
+        break;
+
+    case IRP_MJ_FILE_SYSTEM_CONTROL:
+
+        data->CallbackMinorId = IRP_MN_USER_FS_REQUEST;
+        parameters->Control.OutputBufferLength = 0x4000;
+        parameters->Control.ControlCode = GenControlCodes[GenBelow( State, ARRAYSIZE( GenControlCodes ) )];
+        data->Status = failed ? GEN_STATUS_ACCESS_DENIED : 0;
+        break;
+
+    case IRP_MJ_LOCK_CONTROL:
+
+        data->CallbackMinorId = IRP_MN_LOCK;
+        parameters->LockControl.Length = 0x1000;
+        parameters->LockControl.ByteOffset.QuadPart = thread->Offset;
+        data->Status = failed ? GEN_STATUS_ACCESS_DENIED : 0;
+        break;
+
+    case IRP_MJ_CLEANUP:
+
+        data->IrpFlags = IRP_SYNCHRONOUS_API;
+        thread->State = GEN_FILE_CLEANED_UP;
+        break;
+
+    case IRP_MJ_CLOSE:
+
+        data->IrpFlags = IRP_CLOSE_OPERATION | IRP_SYNCHRONOUS_API;
+        thread->State = GEN_FILE_NONE;
+        break;
+
+    default:
+
+        data->Status = failed ? GEN_STATUS_ACCESS_DENIED : 0;
+        break;
+    }
+
+    if (failed) {
+
+        State->Failed++;
+    }
+
+    State->Majors[major]++;
+
+    return record->Length;
+}
+
+VOID
+GenDefaultConfig (
+    _Out_ PGEN_CONFIG Config
+    )
+{
+    ULONG index;
+
+    memset( Config, 0, sizeof( GEN_CONFIG ) );
+
+    Config->Rate = GEN_DEFAULT_RATE;
+    Config->Processes = GEN_DEFAULT_PROCESSES;
+    Config->Threads = GEN_DEFAULT_THREADS;
+    Config->Paths = GEN_DEFAULT_PATHS;
+    Config->Skew = GEN_DEFAULT_SKEW;
+    Config->ProcessSkew = GEN_DEFAULT_PROCESS_SKEW;
+    Config->Failures = GEN_DEFAULT_FAILURES;
+    Config->NameMin = GEN_DEFAULT_NAME_MIN;
+    Config->NameMax = GEN_DEFAULT_NAME_MAX;
+
+    for (index = 0; index < ARRAYSIZE( GenMajors ); index++) {
+
+        Config->Weights[GenMajors[index].Major] = GenMajors[index].Weight;
+    }
+}
+
+BOOLEAN
+GenSetOption (
+    _Inout_ PGEN_CONFIG Config,
+    _In_z_ const char *Option
+    )
+/*++
+
+Routine Description:
+
+    Sets one option given as <name>=<value>: rate, processes, threads,
+    paths, skew and pskew (in hundredths), fail (percent), names
+    (<min>-<max> characters), seed, or the weight of a major function by
+    its name in GenMajors.
+
+Return Value:
+
+    FALSE if the option is not known or its value is out of range.
+
+--*/
+{
+    const char *value = strchr( Option, '=' );
+    size_t nameLength;
+    ULONG number;
+    ULONG index;
+    char *end;
+
+    if (value == NULL) {
+
+        return FALSE;
+    }
+
+    nameLength = value - Option;
+    value++;
+    number = strtoul( value, &end, 0 );
+
+#define GEN_OPTION(_name) \
+    (nameLength == sizeof( _name ) - 1 && !_strnicmp( Option, _name, nameLength ))
+
+    if (GEN_OPTION( "names" )) {
+
+        if (*end != '-') {
+
+            return FALSE;
+        }
+
+        Config->NameMin = number;
+        Config->NameMax = strtoul( end + 1, NULL, 0 );
+
+        return (Config->NameMin <= Config->NameMax && Config->NameMax <= GEN_MAX_NAME);
+    }
+
+    if (end == value || *end != 0) {
+
+        return FALSE;
+    }
+
+    if (GEN_OPTION( "rate" )) {
+
+        Config->Rate = number;
+
+    } else if (GEN_OPTION( "processes" )) {
+
+        Config->Processes = number;
+        return (number > 0 && number <= GEN_MAX_PROCESSES);
+
+    } else if (GEN_OPTION( "threads" )) {
+
+        Config->Threads = number;
+        return (number > 0 && number <= GEN_MAX_THREADS);
+
+    } else if (GEN_OPTION( "paths" )) {
+
+        Config->Paths = number;
+        return (number > 0 && number <= GEN_MAX_PATHS);
+
+    } else if (GEN_OPTION( "skew" )) {
+
+        Config->Skew = number;
+
+    } else if (GEN_OPTION( "pskew" )) {
+
+        Config->ProcessSkew = number;
+
+    } else if (GEN_OPTION( "fail" )) {
+
+        Config->Failures = number;
+        return (number <= 100);
+
+    } else if (GEN_OPTION( "seed" )) {
+
+        Config->Seed = _strtoui64( value, NULL, 0 );
+
+    } else {
+
+        for (index = 0; index < ARRAYSIZE( GenMajors ); index++) {
+
+            if (nameLength == strlen( GenMajors[index].Name ) &&
+                !_strnicmp( Option, GenMajors[index].Name, nameLength )) {
+
+                //
+                //  Cleanup and close follow from create.
+                //
+
+                if (GenMajors[index].Weight == 0) {
+
+                    return FALSE;
+                }
+
+                Config->Weights[GenMajors[index].Major] = number;
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    }
+
+#undef GEN_OPTION
+
+    return TRUE;
+}
+
+static BOOLEAN
+GenInitialize (
+    _Out_ PGEN_STATE State,
+    _In_ const GEN_CONFIG *Config,
+    _In_ LONGLONG Now
+    )
+/*++
+
+Routine Description:
+
+    Sets up a generator with the given configuration, from Now.
+
+Return Value:
+
+    FALSE if the configuration is not valid or memory could not be had.
+
+--*/
+{
+    ULONG major;
+    ULONG index;
+
+    if (Config->Processes == 0 || Config->Processes > GEN_MAX_PROCESSES ||
+        Config->Threads == 0 || Config->Threads > GEN_MAX_THREADS ||
+        Config->Paths == 0 || Config->Paths > GEN_MAX_PATHS ||
+        Config->NameMin > Config->NameMax || Config->NameMax > GEN_MAX_NAME ||
+        Config->Weights[IRP_MJ_CREATE] == 0) {
+
+        return FALSE;
+    }
+
+    memset( State, 0, sizeof( GEN_STATE ) );
+
+    State->Process = (PGEN_PROCESS)calloc( Config->Processes, sizeof( GEN_PROCESS ) );
+    State->Thread = (PGEN_THREAD)calloc( (SIZE_T)Config->Processes * Config->Threads, sizeof( GEN_THREAD ) );
+
+    if (State->Process == NULL || State->Thread == NULL) {
+
+        free( State->Process );
+        free( State->Thread );
+        return FALSE;
+    }
+
+    //
+    //  Ids the system could hand out, multiples of 4, started a second
+    //  apart from an hour before generating starts, closer when more than
+    //  3600 are asked so every one is started before its first operation.
+    //
+
+    for (index = 0; index < Config->Processes; index++) {
+
+        State->Process[index].ProcessId = 0x1000 + (ULONG_PTR)index * 4;
+        State->Process[index].CreateTime = Now - 36000000000LL +
+                                           (LONGLONG)index * min( 10000000LL, 36000000000LL / Config->Processes );
+    }
+
+    for (index = 0; index < Config->Processes * Config->Threads; index++) {
+
+        State->Thread[index].ThreadId = 0x10000 + (ULONG_PTR)index * 4;
+    }
+
+    State->Config = *Config;
+
+    if (State->Config.Seed == 0) {
+
+        State->Config.Seed = GenMix( (ULONGLONG)Now );
+    }
+
+    State->Random = State->Config.Seed;
+
+    GenZipfInitialize( &State->Paths, Config->Paths, Config->Skew );
+    GenZipfInitialize( &State->Processes, Config->Processes, Config->ProcessSkew );
+
+    for (major = 0; major < GEN_MAJORS; major++) {
+
+        if (major != IRP_MJ_CLEANUP && major != IRP_MJ_CLOSE) {
+
+            State->WeightTotal += Config->Weights[major];
+        }
+
+        State->Cumulative[major] = State->WeightTotal;
+    }
+
+    State->StartTime = Now;
+    State->LastTime = Now;
+
+    return TRUE;
+}
+
+static VOID
+GenCleanup (
+    _Inout_ PGEN_STATE State
+    )
+{
+    free( State->Process );
+    free( State->Thread );
+    State->Process = NULL;
+    State->Thread = NULL;
+}
+
+static DWORD
+GenFillState (
+    _Inout_ PGEN_STATE State,
+    _Out_writes_bytes_to_(BufferSize, return) PVOID Buffer,
+    _In_ DWORD BufferSize,
+    _In_ LONGLONG Now
+    )
+/*++
+
+Routine Description:
+
+    Fills Buffer with the records of a generator due by Now.
+
+Return Value:
+
+    How much of Buffer was filled.
+
+--*/
+{
+    ULONGLONG due;
+    DWORD used = 0;
+    LONGLONG time;
+
+    //
+    //  Every record is checked against the longest one there could be,
+    //  so a record never has to be taken back.
+    //
+
+    while (State->Reported < State->Config.Processes &&
+           BufferSize - used >= MAX_LOG_RECORD_LENGTH) {
+
+        used += GenProcessRecord( State, Add2Ptr( Buffer, used ), State->Reported++ );
+    }
+
+    if (State->Config.Rate != 0) {
+
+        due = (ULONGLONG)(Now - State->StartTime) * State->Config.Rate / 10000000;
+        due = (due > State->Records) ? due - State->Records : 0;
+
+    } else {
+
+        due = MAXULONGLONG;
+    }
+
+    while (due > 0 && BufferSize - used >= MAX_LOG_RECORD_LENGTH) {
+
+        //
+        //  On the rate records are evenly spaced from the start, as fast
+        //  as they are taken they are 100ns apart at least.
+        //
+
+        if (State->Config.Rate != 0) {
+
+            time = State->StartTime + (LONGLONG)(State->Records * 10000000 / State->Config.Rate);
+
+        } else {
+
+            time = max( Now, State->LastTime + 1 );
+        }
+
+        used += GenOperationRecord( State, Add2Ptr( Buffer, used ), time );
+
+        State->LastTime = time;
+        State->Records++;
+        due--;
+    }
+
+    if (State->Config.Rate != 0) {
+
+        State->Behind = due;
+        State->MostBehind = max( State->MostBehind, due );
+    }
+
+    if (used != 0) {
+
+        State->Bytes += used;
+        State->Buffers++;
+    }
+
+    return used;
+}
+
+BOOLEAN
+GenStart (
+    _In_ const GEN_CONFIG *Config,
+    _In_ LONGLONG Now
+    )
+/*++
+
+Routine Description:
+
+    Starts generating records with the given configuration, from Now.
+    Generating already is restarted, with new processes.
+
+Arguments:
+
+    Config - The configuration.  Majors weighing nothing are not issued,
+        but create must weigh something.
+
+    Now - The current time, in 100ns since 1601 as the filter's times.
+
+Return Value:
+
+    FALSE if the configuration is not valid or memory could not be had,
+    whatever was generating before carries on.
+
+--*/
+{
+    GEN_STATE state;
+
+    if (!GenInitialize( &state, Config, Now )) {
+
+        return FALSE;
+    }
+
+    AcquireSRWLockExclusive( &Gen.Lock );
+
+    GenCleanup( &Gen.State );
+    Gen.State = state;
+    Gen.Active = TRUE;
+
+    ReleaseSRWLockExclusive( &Gen.Lock );
+
+    return TRUE;
+}
+
+VOID
+GenStop (
+    VOID
+    )
+{
+    AcquireSRWLockExclusive( &Gen.Lock );
+
+    Gen.Active = FALSE;
+    GenCleanup( &Gen.State );
+
+    ReleaseSRWLockExclusive( &Gen.Lock );
+}
+
+BOOLEAN
+GenActive (
+    VOID
+    )
+{
+    return Gen.Active;
+}
+
+HRESULT
+GenFill (
+    _Out_writes_bytes_to_(BufferSize, *BytesReturned) PVOID Buffer,
+    _In_ DWORD BufferSize,
+    _Out_ LPDWORD BytesReturned,
+    _In_ LONGLONG Now
+    )
+/*++
+
+Routine Description:
+
+    Fills Buffer with the records due by Now, as GetMiniSpyLog fills it
+    with the records the filter has.
+
+Arguments:
+
+    Buffer - Receives packed LOG_RECORDs, PVOID aligned.
+
+    BufferSize - Size of Buffer in bytes.
+
+    BytesReturned - Receives how much of Buffer was filled.
+
+    Now - The current time, in 100ns since 1601.
+
+Return Value:
+
+    S_OK, or HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS ) if no record is due
+    or generating is stopped.
+
+--*/
+{
+    *BytesReturned = 0;
+
+    AcquireSRWLockExclusive( &Gen.Lock );
+
+    if (Gen.Active) {
+
+        *BytesReturned = GenFillState( &Gen.State, Buffer, BufferSize, Now );
+    }
+
+    ReleaseSRWLockExclusive( &Gen.Lock );
+
+    if (*BytesReturned == 0) {
+
+        return HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS );
+    }
+
+    return S_OK;
+}
+
+BOOLEAN
+GenSample (
+    _In_ const GEN_CONFIG *Config,
+    _In_ LONGLONG Now,
+    _Out_writes_bytes_(BufferSize * Count) PVOID Buffers,
+    _In_ DWORD BufferSize,
+    _In_ ULONG Count,
+    _Out_writes_(Count) LPDWORD BytesReturned
+    )
+/*++
+
+Routine Description:
+
+    Fills Count buffers one after another with the records of a generator
+    of its own, as fast as they can be generated, whatever the rate of
+    Config.  The generator the logging thread reads is not touched.
+
+Arguments:
+
+    Config - The configuration.
+
+    Now - Time of the first record.
+
+    Buffers - Count buffers of BufferSize bytes, BufferSize a multiple of
+        sizeof(PVOID).
+
+    BufferSize - Size of each buffer in bytes.
+
+    Count - How many buffers to fill.
+
+    BytesReturned - Receives how much of each buffer was filled.
+
+Return Value:
+
+    FALSE if the configuration is not valid or memory could not be had.
+
+--*/
+{
+    GEN_STATE state;
+    GEN_CONFIG config = *Config;
+    ULONG index;
+
+    config.Rate = 0;
+
+    if (!GenInitialize( &state, &config, Now )) {
+
+        return FALSE;
+    }
+
+    for (index = 0; index < Count; index++) {
+
+        BytesReturned[index] = GenFillState( &state,
+                                             Add2Ptr( Buffers, (SIZE_T)index * BufferSize ),
+                                             BufferSize,
+                                             Now );
+    }
+
+    GenCleanup( &state );
+
+    return TRUE;
+}
+
+VOID
+GenPrintStats (
+    VOID
+    )
+{
+    double seconds;
+    ULONG index;
+
+    AcquireSRWLockShared( &Gen.Lock );
+
+    if (!Gen.Active) {
+
+        ReleaseSRWLockShared( &Gen.Lock );
+        printf( "    Generator:   stopped\n" );
+        return;
+    }
+
+    seconds = (Gen.State.LastTime - Gen.State.StartTime) / 10000000.0;
+
+    printf( "    Generator:   %lu records/s%s, %lu processes of %lu threads, %lu paths\n",
+            Gen.State.Config.Rate,
+            Gen.State.Config.Rate ? "" : " (unlimited)",
+            Gen.State.Config.Processes,
+            Gen.State.Config.Threads,
+            Gen.State.Config.Paths );
+    printf( "    Skew:        paths %lu.%02lu, processes %lu.%02lu, names %lu-%lu characters, %lu%% failing, seed 0x%I64x\n",
+            Gen.State.Config.Skew / 100, Gen.State.Config.Skew % 100,
+            Gen.State.Config.ProcessSkew / 100, Gen.State.Config.ProcessSkew % 100,
+            Gen.State.Config.NameMin,
+            Gen.State.Config.NameMax,
+            Gen.State.Config.Failures,
+            Gen.State.Config.Seed );
+    printf( "    Generated:   %I64u records, %I64u failed, %I64u bytes in %I64u buffers over %.1f seconds, %.0f records/s\n",
+            Gen.State.Records,
+            Gen.State.Failed,
+            Gen.State.Bytes,
+            Gen.State.Buffers,
+            seconds,
+            seconds > 0 ? Gen.State.Records / seconds : 0.0 );
+
+    if (Gen.State.Config.Rate != 0) {
+
+        printf( "    Behind:      %I64u records due and not taken, %I64u at most\n",
+                Gen.State.Behind,
+                Gen.State.MostBehind );
+    }
+
+    printf( "    Majors:     " );
+
+    for (index = 0; index < ARRAYSIZE( GenMajors ); index++) {
+
+        printf( " %s %I64u", GenMajors[index].Name, Gen.State.Majors[GenMajors[index].Major] );
+    }
+
+    printf( "\n" );
+
+    ReleaseSRWLockShared( &Gen.Lock );
+}
@@ -0,0 +1,130 @@
+/*++
+
+Module Name:
+
+    mspyGen.h
+
+Abstract:
+
+    Synthetic workload generator.  Fills buffers with packed LOG_RECORDs
+    as GetMiniSpyLog returns them, so the logging thread can be driven at
+    a chosen rate and mix without the filter, to load test the pipeline.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYGEN_H__
+#define __MSPYGEN_H__
+
+#include <windows.h>
+#include "minispy.h"
+#include "mspyLog.h"
+
+#define GEN_DEFAULT_RATE        10000       // records per second, 0 is as fast as they are taken
+#define GEN_DEFAULT_PROCESSES   32
+#define GEN_DEFAULT_THREADS     4           // per process
+#define GEN_DEFAULT_PATHS       100000
+#define GEN_DEFAULT_SKEW        100         // Zipf exponent of paths in hundredths
+#define GEN_DEFAULT_PROCESS_SKEW 50         // Zipf exponent of processes in hundredths
+#define GEN_DEFAULT_FAILURES    2           // percent of operations that fail
+#define GEN_DEFAULT_NAME_MIN    56          // characters
+#define GEN_DEFAULT_NAME_MAX    160
+
+#define GEN_MAX_PROCESSES       4096
+#define GEN_MAX_THREADS         64
+#define GEN_MAX_PATHS           (1 << 30)
+
+//
+//  The longest name that still fits a record the filter could send.
+//
+
+#define GEN_MAX_NAME            ((MAX_LOG_RECORD_LENGTH - sizeof(LOG_RECORD)) / sizeof(WCHAR) - 1)
+
+typedef struct _GEN_CONFIG {
+
+    ULONG Rate;
+    ULONG Processes;
+    ULONG Threads;
+    ULONG Paths;
+
+    //
+    //  Zipf exponents in hundredths, 0 picks uniformly.  The most popular
+    //  path or process is picked 2^Skew/100 times as often as the second.
+    //
+
+    ULONG Skew;
+    ULONG ProcessSkew;
+
+    ULONG Failures;
+    ULONG NameMin;
+    ULONG NameMax;
+
+    //
+    //  Relative weight of each major function a thread issues on the file
+    //  it has open.  IRP_MJ_CREATE's is how often it moves on to another
+    //  file; cleanup and close follow from that and are not weighed.
+    //
+
+    ULONG Weights[IRP_MJ_MAXIMUM_FUNCTION + 1];
+
+    //
+    //  Same seed, same records.  0 seeds from the start time.
+    //
+
+    ULONGLONG Seed;
+
+} GEN_CONFIG, *PGEN_CONFIG;
+
+VOID
+GenDefaultConfig (
+    _Out_ PGEN_CONFIG Config
+    );
+
+BOOLEAN
+GenSetOption (
+    _Inout_ PGEN_CONFIG Config,
+    _In_z_ const char *Option
+    );
+
+BOOLEAN
+GenStart (
+    _In_ const GEN_CONFIG *Config,
+    _In_ LONGLONG Now
+    );
+
+VOID
+GenStop (
+    VOID
+    );
+
+BOOLEAN
+GenActive (
+    VOID
+    );
+
+HRESULT
+GenFill (
+    _Out_writes_bytes_to_(BufferSize, *BytesReturned) PVOID Buffer,
+    _In_ DWORD BufferSize,
+    _Out_ LPDWORD BytesReturned,
+    _In_ LONGLONG Now
+    );
+
+BOOLEAN
+GenSample (
+    _In_ const GEN_CONFIG *Config,
+    _In_ LONGLONG Now,
+    _Out_writes_bytes_(BufferSize * Count) PVOID Buffers,
+    _In_ DWORD BufferSize,
+    _In_ ULONG Count,
+    _Out_writes_(Count) LPDWORD BytesReturned
+    );
+
+VOID
+GenPrintStats (
+    VOID
+    );
+
+#endif //__MSPYGEN_H__
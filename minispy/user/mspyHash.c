@@ -0,0 +1,1073 @@
+/*++
+
+Module Name:
+
+    mspyHash.c
+
+Abstract:
+
+    Hashes files for hash rules on a pool of worker threads and caches the
+    SHA-256 digests.
+
+    The log writer calls HashLookup for the file and process image of a
+    record.  A cached digest is returned at once.  Otherwise the path is
+    queued for the workers and the record is evaluated without it; the
+    records that follow find the digest in the cache.  When the writer sees
+    a write to or set information on a path it calls HashInvalidate, and
+    the next lookup has the file hashed again.  A cached entry remembers
+    the volume serial, file index, size and last write time it was hashed
+    at: if they have not changed when the file is looked at again the old
+    digest is kept without reading the file.  That is only trusted when
+    the file was last written HASH_WRITE_RESOLUTION before it was read,
+    a write within the resolution of the clock may leave the last write
+    time as it was.
+
+    The cache holds HASH_CACHE_ENTRIES paths and evicts with a clock sweep.
+    Entries that are queued or being hashed are never evicted.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyHash.h"
+
+#define HASH_MAX_PATH           1024                // WCHARs
+#define HASH_READ_SIZE          (256 * 1024)
+#define HASH_NONE               MAXULONG
+
+//
+//  How far apart two writes can be and still leave the same last write
+//  time, in 100 ns units: FAT's 2 seconds, coarser than any clock tick.
+//
+
+#define HASH_WRITE_RESOLUTION   (2 * 10000000ULL)
+
+//
+//  Device paths reported by the filter are opened through this prefix.
+//
+
+#define HASH_GLOBALROOT         L"\\\\?\\GLOBALROOT"
+
+//---------------------------------------------------------------------------
+//  SHA-256 (FIPS 180-4)
+//---------------------------------------------------------------------------
+
+typedef struct _HASH_SHA256 {
+
+    ULONG State[8];
+    ULONGLONG Length;           // bytes hashed so far
+    UCHAR Block[64];
+    ULONG Used;                 // bytes in Block
+
+} HASH_SHA256, *PHASH_SHA256;
+
+static const ULONG HashRound[64] = {
+
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define HASH_ROTR(x, n)     (((x) >> (n)) | ((x) << (32 - (n))))
+#define HASH_CH(x, y, z)    (((x) & (y)) ^ (~(x) & (z)))
+#define HASH_MAJ(x, y, z)   (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define HASH_S0(x)          (HASH_ROTR( x, 2 ) ^ HASH_ROTR( x, 13 ) ^ HASH_ROTR( x, 22 ))
+#define HASH_S1(x)          (HASH_ROTR( x, 6 ) ^ HASH_ROTR( x, 11 ) ^ HASH_ROTR( x, 25 ))
+#define HASH_G0(x)          (HASH_ROTR( x, 7 ) ^ HASH_ROTR( x, 18 ) ^ ((x) >> 3))
+#define HASH_G1(x)          (HASH_ROTR( x, 17 ) ^ HASH_ROTR( x, 19 ) ^ ((x) >> 10))
+
+static VOID
+HashSha256Blocks (
+    _Inout_updates_(8) ULONG *State,
+    _In_reads_bytes_(Blocks * 64) const UCHAR *Data,
+    _In_ SIZE_T Blocks
+    )
+/*++
+
+Routine Description:
+
+    Runs the compression function over whole 64 byte blocks, straight from
+    the caller's buffer.
+
+--*/
+{
+    ULONG w[64];
+    ULONG a, b, c, d, e, f, g, h;
+    ULONG t1, t2;
+    ULONG i;
+
+    while (Blocks-- != 0) {
+
+        for (i = 0; i < 16; i++) {
+
+            w[i] = ((ULONG)Data[i * 4] << 24) |
+                   ((ULONG)Data[i * 4 + 1] << 16) |
+                   ((ULONG)Data[i * 4 + 2] << 8) |
+                   (ULONG)Data[i * 4 + 3];
+        }
+
+        for (; i < 64; i++) {
+
+            w[i] = HASH_G1( w[i - 2] ) + w[i - 7] + HASH_G0( w[i - 15] ) + w[i - 16];
+        }
+
+        a = State[0]; b = State[1]; c = State[2]; d = State[3];
+        e = State[4]; f = State[5]; g = State[6]; h = State[7];
+
+        for (i = 0; i < 64; i++) {
+
+            t1 = h + HASH_S1( e ) + HASH_CH( e, f, g ) + HashRound[i] + w[i];
+            t2 = HASH_S0( a ) + HASH_MAJ( a, b, c );
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        State[0] += a; State[1] += b; State[2] += c; State[3] += d;
+        State[4] += e; State[5] += f; State[6] += g; State[7] += h;
+
+        Data += 64;
+    }
+}
+
+static VOID
+HashSha256Init (
+    _Out_ PHASH_SHA256 Sha
+    )
+{
+    Sha->State[0] = 0x6a09e667;
+    Sha->State[1] = 0xbb67ae85;
+    Sha->State[2] = 0x3c6ef372;
+    Sha->State[3] = 0xa54ff53a;
+    Sha->State[4] = 0x510e527f;
+    Sha->State[5] = 0x9b05688c;
+    Sha->State[6] = 0x1f83d9ab;
+    Sha->State[7] = 0x5be0cd19;
+    Sha->Length = 0;
+    Sha->Used = 0;
+}
+
+static VOID
+HashSha256Update (
+    _Inout_ PHASH_SHA256 Sha,
+    _In_reads_bytes_(Length) const UCHAR *Data,
+    _In_ SIZE_T Length
+    )
+{
+    SIZE_T take;
+
+    Sha->Length += Length;
+
+    if (Sha->Used != 0) {
+
+        take = min( Length, 64 - Sha->Used );
+        memcpy( Sha->Block + Sha->Used, Data, take );
+        Sha->Used += (ULONG)take;
+        Data += take;
+        Length -= take;
+
+        if (Sha->Used < 64) {
+
+            return;
+        }
+
+        HashSha256Blocks( Sha->State, Sha->Block, 1 );
+        Sha->Used = 0;
+    }
+
+    HashSha256Blocks( Sha->State, Data, Length / 64 );
+
+    Data += Length & ~(SIZE_T)63;
+    Length &= 63;
+
+    memcpy( Sha->Block, Data, Length );
+    Sha->Used = (ULONG)Length;
+}
+
+static VOID
+HashSha256Final (
+    _Inout_ PHASH_SHA256 Sha,
+    _Out_writes_(HASH_DIGEST_SIZE) PUCHAR Digest
+    )
+{
+    ULONGLONG bits = Sha->Length * 8;
+    ULONG i;
+
+    Sha->Block[Sha->Used++] = 0x80;
+
+    if (Sha->Used > 56) {
+
+        memset( Sha->Block + Sha->Used, 0, 64 - Sha->Used );
+        HashSha256Blocks( Sha->State, Sha->Block, 1 );
+        Sha->Used = 0;
+    }
+
+    memset( Sha->Block + Sha->Used, 0, 56 - Sha->Used );
+
+    for (i = 0; i < 8; i++) {
+
+        Sha->Block[63 - i] = (UCHAR)(bits >> (i * 8));
+    }
+
+    HashSha256Blocks( Sha->State, Sha->Block, 1 );
+
+    for (i = 0; i < 8; i++) {
+
+        Digest[i * 4] = (UCHAR)(Sha->State[i] >> 24);
+        Digest[i * 4 + 1] = (UCHAR)(Sha->State[i] >> 16);
+        Digest[i * 4 + 2] = (UCHAR)(Sha->State[i] >> 8);
+        Digest[i * 4 + 3] = (UCHAR)Sha->State[i];
+    }
+}
+
+//---------------------------------------------------------------------------
+//  Cache and work queue
+//---------------------------------------------------------------------------
+
+typedef enum _HASH_ENTRY_STATE {
+
+    HashEntryFree,
+    HashEntryQueued,
+    HashEntryHashing,
+    HashEntryReady,
+    HashEntryStale,         // invalidated, hashed again on the next lookup
+    HashEntryFailed
+
+} HASH_ENTRY_STATE;
+
+//
+//  What a digest was computed from.
+//
+
+typedef struct _HASH_FILE {
+
+    ULONG VolumeSerial;
+    ULONGLONG FileIndex;
+    ULONGLONG Size;
+    ULONGLONG LastWrite;
+    BOOLEAN Settled;        // last written HASH_WRITE_RESOLUTION before it was read
+    UCHAR Digest[HASH_DIGEST_SIZE];
+
+} HASH_FILE, *PHASH_FILE;
+
+typedef struct _HASH_ENTRY {
+
+    ULONG Next;             // next entry in the bucket, HASH_NONE at the end
+    ULONG Key;              // hash of Path
+    PWCHAR Path;            // upcased
+
+    HASH_ENTRY_STATE State;
+    BOOLEAN Referenced;     // looked up since the clock last passed
+
+    //
+    //  Changes whenever the entry is invalidated, so a worker can tell the
+    //  file changed while it was reading it.
+    //
+
+    ULONG Generation;
+
+    //
+    //  File holds the last digest computed when Known is set, it survives
+    //  invalidation so an unchanged file is not read again.
+    //
+
+    BOOLEAN Known;
+    HASH_FILE File;
+
+} HASH_ENTRY, *PHASH_ENTRY;
+
+//
+//  Statistics, under HASH_SERVICE.Lock.
+//
+
+typedef struct _HASH_STATS {
+
+    ULONGLONG Hits;
+    ULONGLONG Misses;
+    ULONGLONG Pending;
+    ULONGLONG Unavailable;
+    ULONGLONG Dropped;
+    ULONGLONG Invalidated;
+    ULONGLONG Evicted;
+
+    ULONGLONG Hashed;
+    ULONGLONG Revalidated;
+    ULONGLONG Failed;
+    ULONGLONG BytesHashed;
+    ULONGLONG HashTicks;
+
+} HASH_STATS, *PHASH_STATS;
+
+typedef struct _HASH_SERVICE {
+
+    SRWLOCK Lock;
+    CONDITION_VARIABLE Work;
+    volatile BOOLEAN Stop;
+
+    ULONG ThreadCount;
+    HANDLE Threads[HASH_MAX_THREADS];
+
+    //
+    //  HASH_CACHE_ENTRIES entries, chained from as many buckets.  NULL
+    //  while the service is not running.
+    //
+
+    PHASH_ENTRY Entries;
+    PULONG Buckets;
+    ULONG Clock;
+
+    //
+    //  Indexes of queued entries.
+    //
+
+    ULONG Queue[HASH_QUEUE_LENGTH];
+    ULONG QueueHead;
+    ULONG QueueCount;
+
+    LARGE_INTEGER Frequency;
+
+    HASH_STATS Stats;
+
+} HASH_SERVICE, *PHASH_SERVICE;
+
+static HASH_SERVICE HashService;
+
+static ULONG
+HashKey (
+    _In_z_ PCWSTR Path
+    )
+{
+    ULONG key = 2166136261UL;
+
+    while (*Path != UNICODE_NULL) {
+
+        key = (key ^ *Path++) * 16777619UL;
+    }
+
+    return key;
+}
+
+static BOOLEAN
+HashUpcasePath (
+    _In_z_ PCWSTR Path,
+    _Out_writes_(HASH_MAX_PATH) PWCHAR Upcased
+    )
+/*++
+
+Routine Description:
+
+    Copies Path upcased, cache keys ignore case the way the file system
+    does.  Names the filter made up when it had none start with '<'.
+
+--*/
+{
+    size_t length = wcslen( Path );
+
+    if (length == 0 || length >= HASH_MAX_PATH || Path[0] == L'<') {
+
+        return FALSE;
+    }
+
+    memcpy( Upcased, Path, (length + 1) * sizeof( WCHAR ) );
+    CharUpperBuffW( Upcased, (DWORD)length );
+
+    return TRUE;
+}
+
+static ULONG
+HashFind (
+    _In_ ULONG Key,
+    _In_z_ PCWSTR Path
+    )
+{
+    ULONG index = HashService.Buckets[Key & (HASH_CACHE_ENTRIES - 1)];
+    PHASH_ENTRY entry;
+
+    while (index != HASH_NONE) {
+
+        entry = &HashService.Entries[index];
+
+        if (entry->Key == Key && wcscmp( entry->Path, Path ) == 0) {
+
+            return index;
+        }
+
+        index = entry->Next;
+    }
+
+    return HASH_NONE;
+}
+
+static VOID
+HashUnlink (
+    _In_ ULONG Index
+    )
+{
+    PHASH_ENTRY entry = &HashService.Entries[Index];
+    PULONG link = &HashService.Buckets[entry->Key & (HASH_CACHE_ENTRIES - 1)];
+
+    while (*link != Index) {
+
+        link = &HashService.Entries[*link].Next;
+    }
+
+    *link = entry->Next;
+
+    free( entry->Path );
+    entry->Path = NULL;
+    entry->State = HashEntryFree;
+}
+
+static ULONG
+HashAllocate (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Finds a free entry, evicting the first one the clock hand reaches that
+    was not looked up since the hand last passed it.
+
+--*/
+{
+    ULONG sweep;
+    ULONG index;
+    PHASH_ENTRY entry;
+
+    for (sweep = 0; sweep < 2 * HASH_CACHE_ENTRIES; sweep++) {
+
+        index = HashService.Clock;
+        HashService.Clock = (HashService.Clock + 1) & (HASH_CACHE_ENTRIES - 1);
+
+        entry = &HashService.Entries[index];
+
+        if (entry->State == HashEntryFree) {
+
+            return index;
+        }
+
+        if (entry->State == HashEntryQueued || entry->State == HashEntryHashing) {
+
+            continue;
+        }
+
+        if (entry->Referenced) {
+
+            entry->Referenced = FALSE;
+            continue;
+        }
+
+        HashUnlink( index );
+        HashService.Stats.Evicted++;
+        return index;
+    }
+
+    return HASH_NONE;
+}
+
+static BOOLEAN
+HashEnqueue (
+    _In_ ULONG Index
+    )
+{
+    if (HashService.QueueCount == HASH_QUEUE_LENGTH) {
+
+        return FALSE;
+    }
+
+    HashService.Queue[(HashService.QueueHead + HashService.QueueCount) % HASH_QUEUE_LENGTH] = Index;
+    HashService.QueueCount++;
+    HashService.Entries[Index].State = HashEntryQueued;
+
+    WakeConditionVariable( &HashService.Work );
+
+    return TRUE;
+}
+
+//---------------------------------------------------------------------------
+//  Workers
+//---------------------------------------------------------------------------
+
+static BOOLEAN
+HashFile (
+    _In_z_ PCWSTR Path,
+    _Inout_ PHASH_FILE File,
+    _In_ BOOLEAN Known,
+    _Out_writes_bytes_(HASH_READ_SIZE) PUCHAR Buffer,
+    _Out_ PULONGLONG BytesRead,
+    _Out_ PBOOLEAN Revalidated
+    )
+/*++
+
+Routine Description:
+
+    Computes the digest of a file into File, unless Known is set and the
+    file still has the serial, index, size and last write time in File,
+    and was settled when File was read.
+
+Return Value:
+
+    TRUE if File holds the digest of the file.
+
+--*/
+{
+    BY_HANDLE_FILE_INFORMATION info;
+    HASH_SHA256 sha;
+    HANDLE file;
+    FILETIME now;
+    ULONGLONG fileIndex;
+    ULONGLONG size;
+    ULONGLONG lastWrite;
+    DWORD read;
+    BOOLEAN result = FALSE;
+
+    *BytesRead = 0;
+    *Revalidated = FALSE;
+
+    file = CreateFileW( Path,
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN,
+                        NULL );
+
+    if (file == INVALID_HANDLE_VALUE) {
+
+        return FALSE;
+    }
+
+    if (!GetFileInformationByHandle( file, &info ) ||
+        FlagOn( info.dwFileAttributes, FILE_ATTRIBUTE_DIRECTORY )) {
+
+        goto Exit;
+    }
+
+    fileIndex = ((ULONGLONG)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    size = ((ULONGLONG)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    lastWrite = ((ULONGLONG)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+
+    if (size > HASH_MAX_FILE_SIZE) {
+
+        goto Exit;
+    }
+
+    if (Known &&
+        File->Settled &&
+        File->VolumeSerial == info.dwVolumeSerialNumber &&
+        File->FileIndex == fileIndex &&
+        File->Size == size &&
+        File->LastWrite == lastWrite) {
+
+        *Revalidated = TRUE;
+        result = TRUE;
+        goto Exit;
+    }
+
+    GetSystemTimeAsFileTime( &now );
+    HashSha256Init( &sha );
+
+    while (ReadFile( file, Buffer, HASH_READ_SIZE, &read, NULL ) && read != 0) {
+
+        HashSha256Update( &sha, Buffer, read );
+        *BytesRead += read;
+
+        if (*BytesRead > HASH_MAX_FILE_SIZE) {
+
+            goto Exit;
+        }
+    }
+
+    HashSha256Final( &sha, File->Digest );
+
+    File->VolumeSerial = info.dwVolumeSerialNumber;
+    File->FileIndex = fileIndex;
+    File->Size = size;
+    File->LastWrite = lastWrite;
+    File->Settled = (((ULONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime) >=
+                    lastWrite + HASH_WRITE_RESOLUTION;
+    result = TRUE;
+
+Exit:
+
+    CloseHandle( file );
+    return result;
+}
+
+static DWORD WINAPI
+HashWorkerThread (
+    _In_ LPVOID Parameter
+    )
+{
+    WCHAR path[ARRAYSIZE( HASH_GLOBALROOT ) + HASH_MAX_PATH];
+    PUCHAR buffer;
+    PHASH_ENTRY entry;
+    HASH_FILE file;
+    BOOLEAN known;
+    BOOLEAN hashed;
+    BOOLEAN revalidated;
+    ULONGLONG bytesRead;
+    ULONG generation;
+    ULONG index;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    UNREFERENCED_PARAMETER( Parameter );
+
+    buffer = malloc( HASH_READ_SIZE );
+
+    if (buffer == NULL) {
+
+        return 1;
+    }
+
+    AcquireSRWLockExclusive( &HashService.Lock );
+
+    for (;;) {
+
+        while (HashService.QueueCount == 0 && !HashService.Stop) {
+
+            SleepConditionVariableSRW( &HashService.Work, &HashService.Lock, INFINITE, 0 );
+        }
+
+        if (HashService.Stop) {
+
+            break;
+        }
+
+        index = HashService.Queue[HashService.QueueHead];
+        HashService.QueueHead = (HashService.QueueHead + 1) % HASH_QUEUE_LENGTH;
+        HashService.QueueCount--;
+
+        entry = &HashService.Entries[index];
+        entry->State = HashEntryHashing;
+        generation = entry->Generation;
+        known = entry->Known;
+        file = entry->File;
+
+        if (wcsncmp( entry->Path, L"\\DEVICE\\", 8 ) == 0) {
+
+            wcscpy_s( path, ARRAYSIZE( path ), HASH_GLOBALROOT );
+            wcscat_s( path, ARRAYSIZE( path ), entry->Path );
+
+        } else {
+
+            wcscpy_s( path, ARRAYSIZE( path ), entry->Path );
+        }
+
+        //
+        //  The entry cannot be evicted while it is being hashed, but it can
+        //  be invalidated, which Generation tells us about.
+        //
+
+        ReleaseSRWLockExclusive( &HashService.Lock );
+
+        QueryPerformanceCounter( &start );
+        hashed = HashFile( path, &file, known, buffer, &bytesRead, &revalidated );
+        QueryPerformanceCounter( &end );
+
+        AcquireSRWLockExclusive( &HashService.Lock );
+
+        if (entry->Generation != generation) {
+
+            //
+            //  Written to while we read it, what we have may be neither the
+            //  old nor the new content.
+            //
+
+            entry->State = HashEntryStale;
+            entry->Known = FALSE;
+
+        } else if (hashed) {
+
+            entry->State = HashEntryReady;
+            entry->Known = TRUE;
+            entry->File = file;
+
+        } else {
+
+            entry->State = HashEntryFailed;
+            entry->Known = FALSE;
+        }
+
+        if (!hashed) {
+
+            HashService.Stats.Failed++;
+
+        } else if (revalidated) {
+
+            HashService.Stats.Revalidated++;
+
+        } else {
+
+            HashService.Stats.Hashed++;
+        }
+
+        HashService.Stats.BytesHashed += bytesRead;
+        HashService.Stats.HashTicks += end.QuadPart - start.QuadPart;
+    }
+
+    ReleaseSRWLockExclusive( &HashService.Lock );
+
+    free( buffer );
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+//  Interface
+//---------------------------------------------------------------------------
+
+BOOLEAN
+HashStart (
+    _In_ ULONG Threads
+    )
+/*++
+
+Routine Description:
+
+    Allocates the cache and starts the hashing threads.
+
+Arguments:
+
+    Threads - Number of hashing threads, 0 uses half the processors.  At
+        most HASH_MAX_THREADS are started.
+
+Return Value:
+
+    TRUE if the service is running.  Otherwise every lookup returns
+    HashUnavailable.
+
+--*/
+{
+    SYSTEM_INFO systemInfo;
+    ULONG index;
+
+    if (Threads == 0) {
+
+        GetSystemInfo( &systemInfo );
+        Threads = max( systemInfo.dwNumberOfProcessors / 2, 1 );
+    }
+
+    Threads = min( Threads, HASH_MAX_THREADS );
+
+    InitializeSRWLock( &HashService.Lock );
+    InitializeConditionVariable( &HashService.Work );
+    QueryPerformanceFrequency( &HashService.Frequency );
+
+    HashService.Stop = FALSE;
+    HashService.Clock = 0;
+    HashService.QueueHead = 0;
+    HashService.QueueCount = 0;
+    memset( &HashService.Stats, 0, sizeof( HashService.Stats ) );
+    HashService.Entries = calloc( HASH_CACHE_ENTRIES, sizeof( HASH_ENTRY ) );
+    HashService.Buckets = malloc( HASH_CACHE_ENTRIES * sizeof( ULONG ) );
+
+    if (HashService.Entries == NULL || HashService.Buckets == NULL) {
+
+        goto Fail;
+    }
+
+    for (index = 0; index < HASH_CACHE_ENTRIES; index++) {
+
+        HashService.Buckets[index] = HASH_NONE;
+    }
+
+    for (HashService.ThreadCount = 0; HashService.ThreadCount < Threads; HashService.ThreadCount++) {
+
+        HashService.Threads[HashService.ThreadCount] = CreateThread( NULL, 0, HashWorkerThread, NULL, 0, NULL );
+
+        if (HashService.Threads[HashService.ThreadCount] == NULL) {
+
+            break;
+        }
+    }
+
+    if (HashService.ThreadCount != 0) {
+
+        return TRUE;
+    }
+
+Fail:
+
+    free( HashService.Entries );
+    free( HashService.Buckets );
+    HashService.Entries = NULL;
+    HashService.Buckets = NULL;
+    return FALSE;
+}
+
+VOID
+HashStop (
+    VOID
+    )
+{
+    ULONG index;
+
+    if (HashService.Entries == NULL) {
+
+        return;
+    }
+
+    AcquireSRWLockExclusive( &HashService.Lock );
+    HashService.Stop = TRUE;
+    WakeAllConditionVariable( &HashService.Work );
+    ReleaseSRWLockExclusive( &HashService.Lock );
+
+    WaitForMultipleObjects( HashService.ThreadCount, HashService.Threads, TRUE, INFINITE );
+
+    for (index = 0; index < HashService.ThreadCount; index++) {
+
+        CloseHandle( HashService.Threads[index] );
+    }
+
+    for (index = 0; index < HASH_CACHE_ENTRIES; index++) {
+
+        free( HashService.Entries[index].Path );
+    }
+
+    free( HashService.Entries );
+    free( HashService.Buckets );
+    HashService.Entries = NULL;
+    HashService.Buckets = NULL;
+    HashService.ThreadCount = 0;
+}
+
+HASH_RESULT
+HashLookup (
+    _In_z_ PCWSTR Path,
+    _Out_writes_(HASH_DIGEST_SIZE) PUCHAR Digest
+    )
+/*++
+
+Routine Description:
+
+    Returns the cached digest of a file, or has the file hashed.  Never
+    waits for a file to be read.
+
+Arguments:
+
+    Path - The file, a \Device\... path as the filter reports it or a
+        Win32 path.
+
+    Digest - Receives the digest when HashReady is returned.
+
+Return Value:
+
+    HashReady, HashPending if the file is queued or being hashed, or
+    HashUnavailable if it cannot be hashed or the queue is full.
+
+--*/
+{
+    WCHAR upcased[HASH_MAX_PATH];
+    HASH_RESULT result;
+    PHASH_ENTRY entry;
+    ULONG index;
+    ULONG key;
+
+    if (HashService.Entries == NULL || !HashUpcasePath( Path, upcased )) {
+
+        return HashUnavailable;
+    }
+
+    key = HashKey( upcased );
+
+    AcquireSRWLockExclusive( &HashService.Lock );
+
+    index = HashFind( key, upcased );
+
+    if (index != HASH_NONE) {
+
+        entry = &HashService.Entries[index];
+        entry->Referenced = TRUE;
+
+        switch (entry->State) {
+
+        case HashEntryReady:
+            memcpy( Digest, entry->File.Digest, HASH_DIGEST_SIZE );
+            HashService.Stats.Hits++;
+            result = HashReady;
+            break;
+
+        case HashEntryStale:
+            HashService.Stats.Misses++;
+
+            if (HashEnqueue( index )) {
+
+                result = HashPending;
+
+            } else {
+
+                HashService.Stats.Dropped++;
+                result = HashUnavailable;
+            }
+            break;
+
+        case HashEntryFailed:
+            HashService.Stats.Unavailable++;
+            result = HashUnavailable;
+            break;
+
+        default:
+            HashService.Stats.Pending++;
+            result = HashPending;
+            break;
+        }
+
+        ReleaseSRWLockExclusive( &HashService.Lock );
+        return result;
+    }
+
+    HashService.Stats.Misses++;
+
+    if (HashService.QueueCount == HASH_QUEUE_LENGTH ||
+        (index = HashAllocate()) == HASH_NONE) {
+
+        HashService.Stats.Dropped++;
+        ReleaseSRWLockExclusive( &HashService.Lock );
+        return HashUnavailable;
+    }
+
+    entry = &HashService.Entries[index];
+    entry->Path = _wcsdup( upcased );
+
+    if (entry->Path == NULL) {
+
+        ReleaseSRWLockExclusive( &HashService.Lock );
+        return HashUnavailable;
+    }
+
+    entry->Key = key;
+    entry->Next = HashService.Buckets[key & (HASH_CACHE_ENTRIES - 1)];
+    HashService.Buckets[key & (HASH_CACHE_ENTRIES - 1)] = index;
+
+    entry->Referenced = TRUE;
+    entry->Known = FALSE;
+
+    HashEnqueue( index );
+
+    ReleaseSRWLockExclusive( &HashService.Lock );
+    return HashPending;
+}
+
+VOID
+HashInvalidate (
+    _In_z_ PCWSTR Path
+    )
+/*++
+
+Routine Description:
+
+    Called when the content or the name of a file may have changed.  The
+    cached digest is dropped and a file being hashed is hashed again.
+
+Arguments:
+
+    Path - The file, in any form HashLookup accepts.
+
+--*/
+{
+    WCHAR upcased[HASH_MAX_PATH];
+    PHASH_ENTRY entry;
+    ULONG index;
+    ULONG key;
+
+    if (HashService.Entries == NULL || !HashUpcasePath( Path, upcased )) {
+
+        return;
+    }
+
+    key = HashKey( upcased );
+
+    AcquireSRWLockExclusive( &HashService.Lock );
+
+    index = HashFind( key, upcased );
+
+    if (index != HASH_NONE) {
+
+        entry = &HashService.Entries[index];
+
+        switch (entry->State) {
+
+        case HashEntryReady:
+        case HashEntryFailed:
+            entry->State = HashEntryStale;
+            entry->Generation++;
+            HashService.Stats.Invalidated++;
+            break;
+
+        case HashEntryHashing:
+            entry->Generation++;
+            HashService.Stats.Invalidated++;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    ReleaseSRWLockExclusive( &HashService.Lock );
+}
+
+VOID
+HashPrintStats (
+    VOID
+    )
+{
+    HASH_STATS stats;
+    ULONGLONG lookups;
+    double seconds;
+    ULONG queued;
+
+    if (HashService.Entries == NULL) {
+
+        printf( "    Hash service is not running\n" );
+        return;
+    }
+
+    AcquireSRWLockShared( &HashService.Lock );
+
+    stats = HashService.Stats;
+    queued = HashService.QueueCount;
+
+    ReleaseSRWLockShared( &HashService.Lock );
+
+    lookups = stats.Hits + stats.Misses + stats.Pending + stats.Unavailable;
+    seconds = (double)stats.HashTicks / HashService.Frequency.QuadPart;
+
+    printf( "    Lookups:     %I64u, %I64u hits (%.1f%%), %I64u misses, %I64u pending, %I64u unavailable\n",
+            lookups,
+            stats.Hits,
+            lookups ? stats.Hits * 100.0 / lookups : 0.0,
+            stats.Misses,
+            stats.Pending,
+            stats.Unavailable );
+    printf( "    Cache:       %I64u invalidated, %I64u evicted, %I64u dropped, %lu queued\n",
+            stats.Invalidated,
+            stats.Evicted,
+            stats.Dropped,
+            queued );
+    printf( "    Hashing:     %lu threads, %I64u files hashed, %I64u unchanged, %I64u failed\n",
+            HashService.ThreadCount,
+            stats.Hashed,
+            stats.Revalidated,
+            stats.Failed );
+    printf( "    Throughput:  %.1f MB in %.3f s of thread time, %.1f MB/s per thread\n",
+            stats.BytesHashed / (1024.0 * 1024.0),
+            seconds,
+            seconds > 0 ? stats.BytesHashed / (1024.0 * 1024.0) / seconds : 0.0 );
+}
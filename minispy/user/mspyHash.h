@@ -0,0 +1,69 @@
+/*++
+
+Module Name:
+
+    mspyHash.h
+
+Abstract:
+
+    SHA-256 digests of files for hash rules.  Files are hashed by a pool of
+    threads and the digests cached, so the log writer only ever looks a
+    digest up and never reads a file itself.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYHASH_H__
+#define __MSPYHASH_H__
+
+#include <windows.h>
+
+#define HASH_DIGEST_SIZE        32          // SHA-256
+
+//
+//  Bounds on the work the service takes on.  Lookups that would go past
+//  them are answered with HashUnavailable.
+//
+
+#define HASH_MAX_THREADS        8
+#define HASH_CACHE_ENTRIES      16384
+#define HASH_QUEUE_LENGTH       1024
+#define HASH_MAX_FILE_SIZE      (256 * 1024 * 1024)
+
+typedef enum _HASH_RESULT {
+
+    HashReady,          // the digest was copied out
+    HashPending,        // the file is being hashed, ask again later
+    HashUnavailable     // the file cannot be hashed, or the service is busy
+
+} HASH_RESULT;
+
+BOOLEAN
+HashStart (
+    _In_ ULONG Threads
+    );
+
+VOID
+HashStop (
+    VOID
+    );
+
+HASH_RESULT
+HashLookup (
+    _In_z_ PCWSTR Path,
+    _Out_writes_(HASH_DIGEST_SIZE) PUCHAR Digest
+    );
+
+VOID
+HashInvalidate (
+    _In_z_ PCWSTR Path
+    );
+
+VOID
+HashPrintStats (
+    VOID
+    );
+
+#endif //__MSPYHASH_H__
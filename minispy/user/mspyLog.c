@@ -25,6 +25,24 @@ _Analysis_mode_(_Analysis_code_type_user_code_)
 #include <stdlib.h>
 #include <winioctl.h>
 #include "mspyLog.h"
+#include "mspyColStore.h"
+#include "mspySummary.h"
+#include "mspySession.h"
+#include "mspyTopK.h"
+#include "mspyMassMod.h"
+#include "mspyProcess.h"
+#include "mspyArgs.h"
+#include "mspyGen.h"
+#include "mspyPort.h"
+#include "mspyPartition.h"
+#include "mspyWal.h"
+#include "mspyRules.h"
+#include "mspyReload.h"
+#include "mspyAlert.h"
+#include "mspyFileLog.h"
+#include "mspyHash.h"
+#include "mspyUtf.h"
+#include "mspyFiles.h"
 #include <stdio.h>
 
 #include <sqlite3.h>
@@ -33,7 +51,59 @@ _Analysis_mode_(_Analysis_code_type_user_code_)
 #define TIME_BUFFER_LENGTH 20
 #define TIME_ERROR         "time error"
 
-#define POLL_INTERVAL   200     // 200 milliseconds
+//
+//  The retrieval thread's wait when there is nothing to read.  It starts
+//  short and doubles while the filter stays empty, so a busy filter is
+//  read again before its ring (RingRecords, 4096 by default) wraps, while
+//  an idle one is asked only five times a second.  Waiting the full
+//  interval every time the ring had been emptied capped what the client
+//  kept up with at about RingRecords / POLL_INTERVAL records a second.
+//
+
+#define POLL_INTERVAL       200     // 200 milliseconds
+#define POLL_INTERVAL_MIN   1       // milliseconds
+
+//
+//  Connection and statement used by DatabaseDump.  Only the log retrieval
+//  thread touches these.  Rows are written in one transaction per buffer
+//  returned by the filter.
+//
+
+static sqlite3 *LogDb = NULL;
+static sqlite3_stmt *LogInsert = NULL;
+static BOOLEAN LogBatchOpen = FALSE;
+
+//
+//  Set when a row of the open batch was inserted but could not be counted
+//  in the summaries.  The batch is then rolled back rather than committed
+//  with summaries that miss rows.
+//
+
+static BOOLEAN LogBatchFailed = FALSE;
+
+//
+//  Statement alert rules write with.  The rules themselves are published
+//  by mspyReload.c and taken for one record at a time.
+//
+
+static sqlite3_stmt *LogAlert = NULL;
+
+//
+//  Partitioning asked for by DatabaseSetPartitioning, and the partition the
+//  connection above is open on.  LogBatchRange covers the rows of the open
+//  batch and is added to the catalog when it commits.
+//
+
+static volatile PARTITION_WINDOW LogWindow = PartitionNone;
+static volatile ULONG LogKeep = 0;
+
+static PARTITION_WINDOW LogOpenWindow = PartitionNone;
+static LONGLONG LogOpenStart = 0;
+static char LogDbPath[MAX_PATH];
+static PARTITION_RANGE LogBatchRange;
+
+char DatabaseFileLocation[MAX_PATH] = DATABASE_DEFAULT_FILE_LOCATION;
+char DatabasePartitionBase[MAX_PATH] = DATABASE_DEFAULT_PARTITION_BASE;
 
 BOOLEAN
 TranslateFileTag(
@@ -121,13 +191,12 @@ Return Value:
 {
     PLOG_CONTEXT context = (PLOG_CONTEXT)lpParameter;
     DWORD bytesReturned = 0;
-    DWORD used;
     PVOID alignedBuffer[BUFFER_SIZE/sizeof( PVOID )];
     PCHAR buffer = (PCHAR) alignedBuffer;
     HRESULT hResult;
-    PLOG_RECORD pLogRecord;
-    PRECORD_DATA pRecordData;
     COMMAND_MESSAGE commandMessage;
+    FILETIME now;
+    DWORD wait = POLL_INTERVAL_MIN;
 
     //printf("Log: Starting up\n");
 
@@ -148,17 +217,35 @@ Return Value:
         }
 
         //
-        //  Request log data from MiniSpy.
+        //  Request log data from MiniSpy, or from the generator in its
+        //  place.  Without the filter there is nothing to read until the
+        //  generator is started again.
         //
 
-        commandMessage.Command = GetMiniSpyLog;
+        if (GenActive()) {
+
+            GetSystemTimeAsFileTime( &now );
+
+            hResult = GenFill( buffer,
+                               sizeof(alignedBuffer),
+                               &bytesReturned,
+                               ((LONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime );
+
+        } else if (context->Port == NULL) {
 
-        hResult = FilterSendMessage( context->Port,
-                                     &commandMessage,
-                                     sizeof( COMMAND_MESSAGE ),
-                                     buffer,
-                                     sizeof(alignedBuffer),
-                                     &bytesReturned );
+            hResult = HRESULT_FROM_WIN32( ERROR_NO_MORE_ITEMS );
+
+        } else {
+
+            commandMessage.Command = GetMiniSpyLog;
+
+            hResult = PortSendMessage( context->Port,
+                                       &commandMessage,
+                                       sizeof( COMMAND_MESSAGE ),
+                                       buffer,
+                                       sizeof(alignedBuffer),
+                                       &bytesReturned );
+        }
 
         if (IS_ERROR( hResult )) {
 
@@ -176,141 +263,226 @@ Return Value:
                     WriteAlertToDatabase("UNEXPECTED ERROR received: %x", hResult);
                 }
 
-                Sleep( POLL_INTERVAL );
+                Sleep( wait );
+                wait = min( wait * 2, POLL_INTERVAL );
             }
 
             continue;
         }
 
+        ProcessLogBuffer( context, buffer, bytesReturned );
+
         //
-        //  Buffer is filled with a series of LOG_RECORD structures, one
-        //  right after another.  Each LOG_RECORD says how long it is, so
-        //  we know where the next LOG_RECORD begins.
+        //  If we didn't get any data, pause, otherwise read again at once
+        //  and wait only briefly the next time the filter is empty.
         //
 
-        pLogRecord = (PLOG_RECORD) buffer;
-        used = 0;
+        if (bytesReturned == 0) {
 
-        //
-        //  Logic to write record to screen and/or file
-        //
+            Sleep( wait );
+            wait = min( wait * 2, POLL_INTERVAL );
 
-        for (;;) {
+        } else {
 
-            if (used+FIELD_OFFSET(LOG_RECORD,Name) > bytesReturned) {
+            wait = POLL_INTERVAL_MIN;
+        }
+    }
 
-                break;
-            }
+    DatabaseEndSessions();
+    DatabaseCloseLog();
 
-            if (pLogRecord->Length < (sizeof(LOG_RECORD)+sizeof(WCHAR))) {
+    printf( "Log: Shutting down\n" );
+    WriteAlertToDatabase("Log: Shutting down");
 
-                printf( "UNEXPECTED LOG_RECORD->Length: length=%d expected>=%d\n",
-                        pLogRecord->Length,
-                        (ULONG)(sizeof(LOG_RECORD)+sizeof(WCHAR)));
-                WriteAlertToDatabase("UNEXPECTED LOG_RECORD->Length: length=%d expected>=%d", pLogRecord->Length, (ULONG)(sizeof(LOG_RECORD) + sizeof(WCHAR)));
+    ReleaseSemaphore( context->ShutDown, 1, NULL );
 
-                break;
-            }
+    printf( "Log: All done\n" );
+    WriteAlertToDatabase("Log: All done");
+
+    return 0;
+}
 
-            used += pLogRecord->Length;
 
-            if (used > bytesReturned) {
+PLOG_RECORD
+NextLogRecord(
+    _In_reads_bytes_(BytesReturned) PCHAR Buffer,
+    _In_ DWORD BytesReturned,
+    _Inout_ PDWORD Used
+    )
+/*++
 
-                printf( "UNEXPECTED LOG_RECORD size: used=%d bytesReturned=%d\n",
-                        used,
-                        bytesReturned);
-                WriteAlertToDatabase("UNEXPECTED LOG_RECORD size: used=%d bytesReturned=%d", used, bytesReturned);
+Routine Description:
 
-                break;
-            }
+    Walks a buffer filled by GetMiniSpyLog.  Buffer is filled with a series
+    of LOG_RECORD structures, one right after another.  Each LOG_RECORD
+    says how long it is, so we know where the next LOG_RECORD begins.
 
-            pRecordData = &pLogRecord->Data;
+Arguments:
 
-            //
-            //  See if a reparse point entry
-            //
+    Buffer - The buffer.
 
-            if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FILETAG)) {
+    BytesReturned - How much of it was filled.
 
-                if (!TranslateFileTag( pLogRecord )){
+    Used - Offset of the next record, 0 for the first.  Moved past the
+        record returned.
 
-                    //
-                    // If this is a reparse point that can't be interpreted, move on.
-                    //
+Return Value:
 
-                    pLogRecord = (PLOG_RECORD)Add2Ptr(pLogRecord,pLogRecord->Length);
-                    continue;
-                }
-            }
+    The next record, NULL after the last or if its length cannot be right.
 
-            if (context->LogToFile) {
+--*/
+{
+    PLOG_RECORD pLogRecord = (PLOG_RECORD)(Buffer + *Used);
 
-                DatabaseDump(
-                    pLogRecord->SequenceNumber,
-                    pLogRecord->Name,
-                    pRecordData);
-            }
+    if (*Used+FIELD_OFFSET(LOG_RECORD,Name) > BytesReturned) {
 
-            //
-            //  The RecordType could also designate that we are out of memory
-            //  or hit our program defined memory limit, so check for these
-            //  cases.
-            //
+        return NULL;
+    }
 
-            if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_OUT_OF_MEMORY)) {
+    if (pLogRecord->Length < (sizeof(LOG_RECORD)+sizeof(WCHAR))) {
 
-                if (context->LogToScreen) {
+        printf( "UNEXPECTED LOG_RECORD->Length: length=%d expected>=%d\n",
+                pLogRecord->Length,
+                (ULONG)(sizeof(LOG_RECORD)+sizeof(WCHAR)));
+        WriteAlertToDatabase("UNEXPECTED LOG_RECORD->Length: length=%d expected>=%d", pLogRecord->Length, (ULONG)(sizeof(LOG_RECORD) + sizeof(WCHAR)));
 
-                    printf( "M:  %08X System Out of Memory\n",
-                            pLogRecord->SequenceNumber );
-                    
-                }
+        return NULL;
+    }
 
-                if (context->LogToFile) {
+    if (*Used + pLogRecord->Length > BytesReturned) {
 
-                    WriteAlertToDatabase("M:\t0x%08X\tSystem Out of Memory", pLogRecord->SequenceNumber);
-                }
+        printf( "UNEXPECTED LOG_RECORD size: used=%d bytesReturned=%d\n",
+                *Used + pLogRecord->Length,
+                BytesReturned);
+        WriteAlertToDatabase("UNEXPECTED LOG_RECORD size: used=%d bytesReturned=%d", *Used + pLogRecord->Length, BytesReturned);
 
-            } else if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE)) {
+        return NULL;
+    }
 
-                if (context->LogToScreen) {
+    *Used += pLogRecord->Length;
 
-                    printf( "M:  %08X Exceeded Mamimum Allowed Memory Buffers\n",
-                            pLogRecord->SequenceNumber );
-                }
+    return pLogRecord;
+}
 
-                if (context->LogToFile) {
 
-                    WriteAlertToDatabase("M:\t0x%08X\tExceeded Mamimum Allowed Memory Buffers", pLogRecord->SequenceNumber);
-                }
-            }
+VOID
+ProcessLogBuffer(
+    _In_ PLOG_CONTEXT context,
+    _In_reads_bytes_(bytesReturned) PCHAR buffer,
+    _In_ DWORD bytesReturned
+    )
+/*++
+
+Routine Description:
+
+    Logs every record of a buffer filled by GetMiniSpyLog, and commits
+    them together.
+
+Arguments:
+
+    context - Where the records go.
+
+    buffer - The buffer.
+
+    bytesReturned - How much of it was filled.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PLOG_RECORD pLogRecord;
+    PRECORD_DATA pRecordData;
+    DWORD used = 0;
+
+    //
+    //  Logic to write record to screen and/or file
+    //
 
-            //
-            // Move to next LOG_RECORD
-            //
+    while ((pLogRecord = NextLogRecord( buffer, bytesReturned, &used )) != NULL) {
 
-            pLogRecord = (PLOG_RECORD)Add2Ptr(pLogRecord,pLogRecord->Length);
+        pRecordData = &pLogRecord->Data;
+
+        //
+        //  Process records only feed the process table
+        //
+
+        if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_PROCESS)) {
+
+            DatabaseProcess( pLogRecord );
+            continue;
         }
 
         //
-        //  If we didn't get any data, pause for 1/2 second
+        //  See if a reparse point entry
         //
 
-        if (bytesReturned == 0) {
+        if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FILETAG)) {
+
+            if (!TranslateFileTag( pLogRecord )){
 
-            Sleep( POLL_INTERVAL );
+                //
+                // If this is a reparse point that can't be interpreted, move on.
+                //
+
+                continue;
+            }
         }
-    }
 
-    printf( "Log: Shutting down\n" );
-    WriteAlertToDatabase("Log: Shutting down");
+        if (context->Recent != NULL) {
 
-    ReleaseSemaphore( context->ShutDown, 1, NULL );
+            ColStoreAppend( context->Recent, pLogRecord );
+        }
 
-    printf( "Log: All done\n" );
-    WriteAlertToDatabase("Log: All done");
+        if (context->LogToFile) {
 
-    return 0;
+            DatabaseDump(
+                pLogRecord->SequenceNumber,
+                pLogRecord->Name,
+                pRecordData);
+        }
+
+        //
+        //  The RecordType could also designate that we are out of memory
+        //  or hit our program defined memory limit, so check for these
+        //  cases.
+        //
+
+        if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_OUT_OF_MEMORY)) {
+
+            if (context->LogToScreen) {
+
+                printf( "M:  %08X System Out of Memory\n",
+                        pLogRecord->SequenceNumber );
+                
+            }
+
+            if (context->LogToFile) {
+
+                WriteAlertToDatabase("M:\t0x%08X\tSystem Out of Memory", pLogRecord->SequenceNumber);
+            }
+
+        } else if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE)) {
+
+            if (context->LogToScreen) {
+
+                printf( "M:  %08X Exceeded Mamimum Allowed Memory Buffers\n",
+                        pLogRecord->SequenceNumber );
+            }
+
+            if (context->LogToFile) {
+
+                WriteAlertToDatabase("M:\t0x%08X\tExceeded Mamimum Allowed Memory Buffers", pLogRecord->SequenceNumber);
+            }
+        }
+    }
+
+    //
+    //  Commit the rows and summary counts of this buffer together
+    //
+
+    DatabaseEndBatch();
 }
 
 
@@ -901,6 +1073,62 @@ NtStatusToString(
     }
 }
 
+void
+FormatIrpFlags(
+    _In_ PRECORD_DATA RecordData,
+    _Out_writes_z_(9) char* FlagString
+)
+/*
+Routine Desciption:
+
+    Formats IrpFlags as eight characters, one per flag, '-' where it is
+    not set.
+
+Arguments:
+
+    RecordData - The record, the major function disambiguates one flag.
+    FlagString - Receives the characters and a terminating null.
+
+Return Value:
+
+    None.
+
+*/
+{
+    // Interpret set IrpFlags (it acts as bit mask, so we want to translate so more human readable)
+    strcpy_s(FlagString, 9, "--------");
+
+    if (RecordData->IrpFlags & IRP_NOCACHE) FlagString[0] = 'N';
+    if (RecordData->IrpFlags & IRP_PAGING_IO) FlagString[1] = 'P';
+    if (RecordData->IrpFlags & IRP_SYNCHRONOUS_API) FlagString[2] = 'S';
+
+    // This Irp Flag has overloaded meaning (multiple definitions for same value / contedxt specific)
+    if (RecordData->IrpFlags & 0x40) {
+        // if its a read or write operation
+        if (RecordData->CallbackMajorId == IRP_MJ_READ || RecordData->CallbackMajorId == IRP_MJ_WRITE) {
+            // Interpret as input vs output
+            FlagString[3] = (RecordData->IrpFlags & IRP_INPUT_OPERATION) ? 'I' : 'O';
+        }
+        else if (RecordData->IrpFlags & IRP_PAGING_IO) {
+            // Interpret as synchronous paging
+            FlagString[3] = 'Y';
+        }
+        else {
+            // Not sure, just log the bit was set - shouldn't really happen but just in case
+            FlagString[3] = '?';
+        }
+    }
+    else {
+        //If the flag is not there, then give empty
+        FlagString[3] = '-';
+    }
+
+    if (RecordData->IrpFlags & IRP_CREATE_OPERATION) FlagString[4] = 'C';
+    if (RecordData->IrpFlags & IRP_READ_OPERATION) FlagString[5] = 'R';
+    if (RecordData->IrpFlags & IRP_WRITE_OPERATION) FlagString[6] = 'W';
+    if (RecordData->IrpFlags & IRP_CLOSE_OPERATION) FlagString[7] = 'X';
+}
+
 void
 WriteToLogAnsi(
     const char* message
@@ -915,11 +1143,25 @@ WriteToLogAnsi(
     vsnprintf(buffer, sizeof(buffer), message, args);
     va_end(args);
 
+    SYSTEMTIME time;
+    GetLocalTime(&time);
+
+    //Queued for the flusher thread, which appends lines to the file in
+    //batches.  Never waits for the disk.
+    char line[FILELOG_LINE_SIZE];
+    int length = snprintf(line, sizeof(line), "[%02d:%02d:%02d] %s\n",
+        time.wHour, time.wMinute, time.wSecond, buffer);
+
+    if (length > (int)sizeof(line) - 1) {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
+    }
+    if (length > 0 && FileLogPost(line, (ULONG)length)) return;
+
+    //Before the flusher starts and after it stops, write it here.
     FILE* logFile;
     fopen_s(&logFile, USER_LOG_FILE, "a+");
     if (logFile) {
-        SYSTEMTIME time;
-        GetLocalTime(&time);
         fprintf(logFile, "[%02d:%02d:%02d] %s\n",
             time.wHour, time.wMinute, time.wSecond, buffer);
         fclose(logFile);
@@ -939,11 +1181,12 @@ FileExists(
 //For initialising database from create.sql file
 char* 
 LoadEmbeddedSQL(
+    LPCWSTR resourceName,
     DWORD* outSize
 ) 
 {
     HMODULE hModule = GetModuleHandle(NULL);
-    HRSRC hRes = FindResource(hModule, L"CREATE_SQL", RT_RCDATA);
+    HRSRC hRes = FindResource(hModule, resourceName, RT_RCDATA);
     if (!hRes) return NULL;
 
     HGLOBAL hData = LoadResource(hModule, hRes);
@@ -957,77 +1200,99 @@ LoadEmbeddedSQL(
     return (char*)pData;
 }
 
-// Function to initialize the database
+//Runs one of the embedded .sql files against an open database
 int
-InitializeDatabase()
+ExecEmbeddedSQL(
+    sqlite3* db,
+    LPCWSTR resourceName
+)
 {
-    sqlite3* db = NULL;
+    DWORD sqlSize = 0;
+    char* sqlContent = LoadEmbeddedSQL(resourceName, &sqlSize);
+    char* sqlText;
     char* errMsg = NULL;
+    int rc;
+
+    if (!sqlContent || sqlSize == 0) return SQLITE_ERROR;
+
+    // Resource data is not NUL terminated
+    sqlText = malloc(sqlSize + 1);
+    if (!sqlText) return SQLITE_NOMEM;
+
+    memcpy(sqlText, sqlContent, sqlSize);
+    sqlText[sqlSize] = '\0';
+
+    rc = sqlite3_exec(db, sqlText, NULL, NULL, &errMsg);
+    if (rc != SQLITE_OK) {
+        WriteToLogAnsi("SQL error in %S: %s", resourceName, errMsg ? errMsg : sqlite3_errstr(rc));
+    }
+
+    sqlite3_free(errMsg);
+    free(sqlText);
+    return rc;
+}
+
+// Creates the log schema in a database file, the main one or a partition
+int
+InitializeDatabaseFile(
+    const char* path
+)
+{
+    sqlite3* db = NULL;
 
     // Check if database file exists
-    if (FileExists(DATABASE_FILE_LOCATION)) {
+    if (FileExists(path)) {
         //if it does, no need to go further
         return 1;
     }
 
     // Try to open/create the database
-    if (sqlite3_open(DATABASE_FILE_LOCATION, &db) != SQLITE_OK) {
+    if (sqlite3_open(path, &db) != SQLITE_OK) {
         WriteToLogAnsi("Failed to open database: %s\n", sqlite3_errmsg(db));
         return 0;
     }
 
-    // Load embedded SQL from resource
-    DWORD sqlSize = 0;
-    char* sqlContent = LoadEmbeddedSQL(&sqlSize);
-    if (!sqlContent || sqlSize == 0) {
-        sqlite3_close(db);
-        return 0;
-    }
-
     // Initialize schema using embedded SQL
     WriteToLogAnsi("Database does not exist. Initializing...");
-    int rc = sqlite3_exec(db, sqlContent, NULL, NULL, &errMsg);
+    int rc = ExecEmbeddedSQL(db, L"CREATE_SQL");
+    if (rc == SQLITE_OK) {
+        rc = ExecEmbeddedSQL(db, L"SUMMARY_SQL");
+    }
+    if (rc == SQLITE_OK) {
+        rc = ExecEmbeddedSQL(db, L"SESSION_SQL");
+    }
+    if (rc == SQLITE_OK) {
+        rc = ExecEmbeddedSQL(db, L"TOPK_SQL");
+    }
+    if (rc == SQLITE_OK) {
+        rc = ExecEmbeddedSQL(db, L"PROCESS_SQL");
+    }
+    if (rc == SQLITE_OK) {
+        rc = ExecEmbeddedSQL(db, L"FILES_SQL");
+    }
     if (rc != SQLITE_OK) {
-        WriteToLogAnsi("SQL error: %s\n", errMsg);
-        sqlite3_free(errMsg);
         sqlite3_close(db);
         return 0;
     }
-    WriteAlertToDatabase("Database creation and initialization!");
+    WriteAlertToDatabase("Database creation and initialization! %s", path);
 
     WriteToLogAnsi("Database initialized.");
     sqlite3_close(db);
     return 1;
 }
 
+// Function to initialize the database
+int
+InitializeDatabase()
+{
+    return InitializeDatabaseFile(DATABASE_FILE_LOCATION);
+}
+
 VOID
 WriteAlertToDatabase(
     const char* message
     , ...
 ) {
-    //Check whether database exists and initialized first
-    int success = InitializeDatabase();
-    if (!success) return;
-
-    //Assume database doesn't exist yet, and start setting it up.
-    sqlite3* db = NULL;
-    sqlite3_stmt* stmt = NULL;
-
-    int rc = sqlite3_open(DATABASE_FILE_LOCATION, &db);
-    if (rc != SQLITE_OK) return;
-
-    // Set insert statement
-    char* sql = "INSERT INTO Alerts (Timestamp, AlertMessage) VALUES (?, ?);";;
-
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        sqlite3_close(db);
-        return;
-    }
-
-    // For using unix timestamp
-    /*time_t now = time(NULL);
-    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)now);*/
-
     char timeStr[64];  // Output buffer
 
     SYSTEMTIME localTime;
@@ -1043,25 +1308,47 @@ WriteAlertToDatabase(
         localTime.wSecond,
         localTime.wMilliseconds);
 
-    sqlite3_bind_text(stmt, 1, timeStr, -1, SQLITE_TRANSIENT); // 100ns ticks
-
     //Proceed to format message.
-    char buffer[1024];
+    char buffer[ALERT_MESSAGE_SIZE];
 
     va_list args;
     va_start(args, message);
     vsnprintf(buffer, sizeof(buffer), message, args);
     va_end(args);
 
+    //Queued for the alert thread, which writes alerts in batches.  The
+    //format string identifies the caller for the rate limit.
+    if (AlertPost(message, timeStr, buffer)) return;
+
+    //Before the alert thread starts and after it stops, write it here.
+    //Check whether database exists and initialized first
+    int success = InitializeDatabase();
+    if (!success) return;
+
+    sqlite3* db = NULL;
+    sqlite3_stmt* stmt = NULL;
+
+    int rc = sqlite3_open(DATABASE_FILE_LOCATION, &db);
+    if (rc != SQLITE_OK) {
+        sqlite3_close(db);
+        return;
+    }
+
+    // Set insert statement
+    char* sql = "INSERT INTO Alerts (Timestamp, AlertMessage) VALUES (?, ?);";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        sqlite3_close(db);
+        return;
+    }
+
+    sqlite3_bind_text(stmt, 1, timeStr, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 2, buffer, -1, SQLITE_TRANSIENT);
 
-    //Execute insert command
+    //Execute insert command.  A failure goes to the log file, raising an
+    //alert about it would only fail the same way.
     if (sqlite3_step(stmt) != SQLITE_DONE) {
-        //if it fails?
-        const char* errorMsg = sqlite3_errmsg(db);
-        char logMessage[512];
-        snprintf(logMessage, sizeof(logMessage), "SQLite insert failed on Alert: %s", errorMsg);
-        WriteAlertToDatabase(logMessage);
+        WriteToLogAnsi("SQLite insert failed on Alert: %s", sqlite3_errmsg(db));
     }
 
     //Clean up
@@ -1069,52 +1356,743 @@ WriteAlertToDatabase(
     sqlite3_close(db);
 }
 
-VOID
-DatabaseDump(
-    _In_ ULONG SequenceNumber,
-    _In_ WCHAR CONST* Name,
-    _In_ PRECORD_DATA RecordData
+BOOLEAN
+DatabaseUpgradeLog(
+    sqlite3* db
 )
 /*
 Routine Desciption:
 
-    Grabs all the data from the log records and writes them to database
+    Adds the MinifilterLog columns that were introduced after a database
+    was created.  create.sql already has them for new databases.  Also
+    creates the Files table their FileID refers to, and the views reading
+    names through it.
 
-Arguments:
+Return Value:
 
-    SequenceNumber - the sequence number for this log record
-    Name - the name of the file that this Irp relates to
-    RecordData - the Data record to print
+    TRUE if MinifilterLog has every column DatabaseDump writes.
+
+*/
+{
+    //In the order they were added, as create.sql has them.  AllLog relies
+    //on FileID being last.
+    static const char* columns[] = { "StatusCode", "ByteOffset", "ByteLength", "InfoClass", "ControlCode", "FileID" };
+    sqlite3_stmt* probe = NULL;
+    char sql[128];
+    int i;
+
+    for (i = 0; i < ARRAYSIZE(columns); i++) {
+
+        //Preparing a statement that names the column fails if it is missing
+        sprintf_s(sql, sizeof(sql), "SELECT %s FROM MinifilterLog LIMIT 0;", columns[i]);
+        if (sqlite3_prepare_v2(db, sql, -1, &probe, NULL) == SQLITE_OK) {
+            sqlite3_finalize(probe);
+            continue;
+        }
+
+        WriteToLogAnsi("Adding %s column to MinifilterLog", columns[i]);
+        sprintf_s(sql, sizeof(sql), "ALTER TABLE MinifilterLog ADD COLUMN %s INTEGER;", columns[i]);
+        if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+            WriteToLogAnsi("Failed to upgrade MinifilterLog: %s", sqlite3_errmsg(db));
+            return FALSE;
+        }
+    }
+
+    return ExecEmbeddedSQL(db, L"FILES_SQL") == SQLITE_OK;
+}
+
+BOOLEAN
+DatabaseOpenLog(
+    PARTITION_WINDOW window,
+    LONGLONG windowStart
+)
+/*
+Routine Desciption:
+
+    Opens the connection DatabaseDump writes through and prepares its insert
+    statement.  Does nothing if that was already done.
+
+    When partitioning, the connection is opened on the partition for the
+    window starting at windowStart, the main database is attached for its
+    Partitions catalog and expired partitions are removed.
 
 Return Value:
 
-    None.
+    TRUE if the connection is ready to use.
 
 */
 {
-    //For storing sql query
+    //Insert statement, prepared once for the whole run
+    const char* sql = "INSERT INTO MinifilterLog (SeqNum, OprType, PreOpTime, PostOpTime, ProcessId, ProcessFilePath, ThreadId, MajorOp, MinorOp, IrpFlags, DeviceObj, FileObj, FileTransaction, OpStatus, Information, Arg1, Arg2, Arg3, Arg4, Arg5, Arg6, OpFileName, RequestorMode, RuleID, RuleAction, StatusCode, ByteOffset, ByteLength, InfoClass, ControlCode, FileID) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+    if (LogDb != NULL) return TRUE;
 
     //Try to initialise Database first and return status
-    int success = InitializeDatabase();
-    if (!success) return; //
+    if (!InitializeDatabase()) return FALSE;
+
+    if (window == PartitionNone) {
+        strcpy_s(LogDbPath, sizeof(LogDbPath), DATABASE_FILE_LOCATION);
+    }
+    else if (PartitionFileName(DATABASE_PARTITION_BASE, window, windowStart, LogDbPath, sizeof(LogDbPath)) != 0 ||
+             !InitializeDatabaseFile(LogDbPath)) {
+        return FALSE;
+    }
+
+    if (sqlite3_open(LogDbPath, &LogDb) != SQLITE_OK) {
+        WriteToLogAnsi("Failed to open database: %s", sqlite3_errmsg(LogDb));
+        goto Fail;
+    }
+
+    //The dashboard reads the same file while we write to it
+    sqlite3_busy_timeout(LogDb, 5000);
+    WalAttach(LogDb, LogDbPath);
+
+    //Databases created before the summary tables and indexes existed get them here
+    if (!DatabaseUpgradeLog(LogDb)) goto Fail;
+    if (ExecEmbeddedSQL(LogDb, L"SUMMARY_SQL") != SQLITE_OK) goto Fail;
+    if (ExecEmbeddedSQL(LogDb, L"SESSION_SQL") != SQLITE_OK) goto Fail;
+    if (ExecEmbeddedSQL(LogDb, L"TOPK_SQL") != SQLITE_OK) goto Fail;
+    if (ExecEmbeddedSQL(LogDb, L"PROCESS_SQL") != SQLITE_OK) goto Fail;
+    if (ExecEmbeddedSQL(LogDb, L"INDEX_SQL") != SQLITE_OK) goto Fail;
+
+    if (sqlite3_prepare_v2(LogDb, sql, -1, &LogInsert, NULL) != SQLITE_OK) {
+        WriteToLogAnsi("Failed to prepare log insert: %s", sqlite3_errmsg(LogDb));
+        goto Fail;
+    }
+
+    if (!FilesPrepare(LogDb)) {
+        WriteToLogAnsi("Failed to prepare file name lookups: %s", sqlite3_errmsg(LogDb));
+        goto Fail;
+    }
+
+    if (!SummaryPrepare(LogDb)) {
+        FilesFinalize();
+        goto Fail;
+    }
+
+    //Without the handle session insert only the sessions are lost
+    SessionPrepare(LogDb);
+
+    //Likewise the top talkers, /k still shows them
+    TopKPrepare(LogDb);
+
+    //And the Processes rows, attribution works from memory
+    ProcessTablePrepare(LogDb);
+
+    if (window != PartitionNone) {
+        char* attach = sqlite3_mprintf("ATTACH DATABASE %Q AS " PARTITION_CATALOG_SCHEMA ";", DATABASE_FILE_LOCATION);
+        int rc = (attach == NULL) ? SQLITE_NOMEM : sqlite3_exec(LogDb, attach, NULL, NULL, NULL);
+        sqlite3_free(attach);
+
+        if (rc == SQLITE_OK) rc = PartitionCatalogCreate(LogDb, PARTITION_CATALOG_SCHEMA);
+
+        //Register the partition even before its first row commits
+        memset(&LogBatchRange, 0, sizeof(LogBatchRange));
+        if (rc == SQLITE_OK) rc = PartitionCatalogRecord(LogDb, PARTITION_CATALOG_SCHEMA, LogDbPath, window, windowStart, &LogBatchRange);
+
+        if (rc != SQLITE_OK) {
+            WriteToLogAnsi("Failed to open partition catalog: %s", sqlite3_errmsg(LogDb));
+            FilesFinalize();
+            SummaryFinalize();
+            SessionFinalize();
+            TopKFinalize();
+            ProcessTableFinalize();
+            goto Fail;
+        }
+
+        //A partition still open elsewhere is tried again at the next roll
+        if (PartitionRetain(LogDb, PARTITION_CATALOG_SCHEMA, window, windowStart, LogKeep, LogDbPath) != SQLITE_OK) {
+            WriteToLogAnsi("Partition retention failed: %s", sqlite3_errmsg(LogDb));
+        }
+
+        WriteAlertToDatabase("Logging to partition %s", LogDbPath);
+    }
+
+    //Alerts live in the main database, attached when partitioning
+    {
+        const char* schema = (window == PartitionNone) ? "main" : PARTITION_CATALOG_SCHEMA;
+        char* alertSql = sqlite3_mprintf("INSERT INTO \"%w\".Alerts (Timestamp, AlertMessage) VALUES (?, ?);", schema);
+
+        if (alertSql == NULL || sqlite3_prepare_v2(LogDb, alertSql, -1, &LogAlert, NULL) != SQLITE_OK) {
+            WriteToLogAnsi("Failed to prepare alert insert: %s", sqlite3_errmsg(LogDb));
+        }
+        sqlite3_free(alertSql);
+    }
+
+    LogOpenWindow = window;
+    LogOpenStart = windowStart;
+    memset(&LogBatchRange, 0, sizeof(LogBatchRange));
+
+    return TRUE;
+
+Fail:
+    sqlite3_finalize(LogInsert);
+    LogInsert = NULL;
+    //The checkpoint thread was pointed at this file once it opened
+    WalDetach();
+    sqlite3_close(LogDb);
+    LogDb = NULL;
+    return FALSE;
+}
+
+VOID
+DatabaseEndBatch(
+    VOID
+)
+/*
+Routine Desciption:
+
+    Commits the rows written by DatabaseDump since the last call, together
+    with the summary counts they add up to.  If either part fails both are
+    rolled back so the summaries never disagree with MinifilterLog.
+
+*/
+{
+    int rc;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    if (!LogBatchOpen) return;
+    LogBatchOpen = FALSE;
+
+    rc = SummaryFlush();
+    if (rc == SQLITE_OK && LogBatchFailed) rc = SQLITE_NOMEM;
+    LogBatchFailed = FALSE;
+    if (rc == SQLITE_OK && LogOpenWindow != PartitionNone && LogBatchRange.Rows != 0) {
+        rc = PartitionCatalogRecord(LogDb, PARTITION_CATALOG_SCHEMA, LogDbPath, LogOpenWindow, LogOpenStart, &LogBatchRange);
+    }
+    if (rc == SQLITE_OK) {
+        QueryPerformanceCounter(&start);
+        rc = sqlite3_exec(LogDb, "COMMIT;", NULL, NULL, NULL);
+        QueryPerformanceCounter(&end);
+
+        if (rc == SQLITE_OK) WalCommitted(end.QuadPart - start.QuadPart);
+    }
+    memset(&LogBatchRange, 0, sizeof(LogBatchRange));
+
+    if (rc != SQLITE_OK) {
+        WriteToLogAnsi("SQLite commit failed on Kernel Operations: %s", sqlite3_errmsg(LogDb));
+        sqlite3_exec(LogDb, "ROLLBACK;", NULL, NULL, NULL);
+        SummaryDiscard();
+        FilesForget();
+    }
+}
+
+VOID
+DatabaseEndSessions(
+    VOID
+)
+/*
+Routine Desciption:
+
+    Writes out the handle sessions still open and the top talkers of the
+    unfinished window when logging stops, so neither is lost.
+
+*/
+{
+    if (LogDb == NULL) return;
+
+    if (!LogBatchOpen) {
+        if (sqlite3_exec(LogDb, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK) return;
+        LogBatchOpen = TRUE;
+    }
+
+    SessionEndAll();
+    TopKEndWindow();
+    DatabaseEndBatch();
+}
+
+VOID
+DatabaseCloseLog(
+    VOID
+)
+{
+    DatabaseEndBatch();
+
+    FilesFinalize();
+    SummaryFinalize();
+    SessionFinalize();
+    TopKFinalize();
+    ProcessTableFinalize();
+    sqlite3_finalize(LogInsert);
+    LogInsert = NULL;
+    sqlite3_finalize(LogAlert);
+    LogAlert = NULL;
+    WalDetach();
+    sqlite3_close(LogDb);
+    LogDb = NULL;
+}
+
+VOID
+DatabaseRuleAlert(
+    RULE_REF rule,
+    const char* majorOp,
+    const char* name,
+    const char* processPath
+)
+/*
+Routine Desciption:
+
+    Records an alert for an operation that matched a rule.  Written through
+    the log writer's connection so it commits with the row that caused it.
+
+*/
+{
+    char timeStr[64];
+    char message[1024];
+    SYSTEMTIME localTime;
+
+    if (LogAlert == NULL) return;
+
+    GetLocalTime(&localTime);
+    snprintf(timeStr, sizeof(timeStr),
+        "%04d-%02d-%02d %02d:%02d:%02d.%03d",
+        localTime.wYear,
+        localTime.wMonth,
+        localTime.wDay,
+        localTime.wHour,
+        localTime.wMinute,
+        localTime.wSecond,
+        localTime.wMilliseconds);
+
+    snprintf(message, sizeof(message), "Rule %d (%s): %s on %s by %s",
+        rule.RuleId,
+        rule.Action == RULE_ACTION_BLOCK ? "block" : "alert",
+        majorOp,
+        name,
+        processPath);
+
+    sqlite3_bind_text(LogAlert, 1, timeStr, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(LogAlert, 2, message, -1, SQLITE_TRANSIENT);
+
+    if (sqlite3_step(LogAlert) != SQLITE_DONE) {
+        WriteToLogAnsi("SQLite insert failed on rule alert: %s", sqlite3_errmsg(LogDb));
+    }
+
+    sqlite3_reset(LogAlert);
+}
+
+VOID
+DatabaseSetLocation(
+    const char* path,
+    const char* partitionBase
+)
+/*
+Routine Desciption:
+
+    Moves the log database and its partitions somewhere else.  Only called
+    before anything has opened the database, tools/mspyPerfBench.c uses it
+    to keep its rows out of the real log.
+
+Arguments:
+
+    path - Path of the main database.
+    partitionBase - Partitions are named <partitionBase>-YYYYMMDD[-HH].db.
+
+*/
+{
+    strcpy_s(DatabaseFileLocation, sizeof(DatabaseFileLocation), path);
+    strcpy_s(DatabasePartitionBase, sizeof(DatabasePartitionBase), partitionBase);
+}
+
+VOID
+DatabaseSetPartitioning(
+    PARTITION_WINDOW window,
+    ULONG keep
+)
+/*
+Routine Desciption:
 
-    //Start with assuming we have no database
+    Changes how the log is split into files.  The writer switches to the new
+    partitioning with the next record it writes.
+
+Arguments:
+
+    window - PartitionNone writes everything to the main database.
+    keep - Number of windows to keep, 0 keeps every partition.
+
+*/
+{
+    LogKeep = keep;
+    LogWindow = window;
+}
+
+VOID
+DatabaseShowPartitions(
+    VOID
+)
+{
     sqlite3* db = NULL;
-    sqlite3_stmt* stmt = NULL;
 
-    int rc = sqlite3_open(DATABASE_FILE_LOCATION, &db);
-    if (rc != SQLITE_OK) return;
+    if (!InitializeDatabase()) return;
 
-    //sqlite3_exec(db, "PRAGMA journal_mode=WAL;", 0, 0, 0);
+    if (sqlite3_open(DATABASE_FILE_LOCATION, &db) != SQLITE_OK) {
+        printf("    Could not open %s: %s\n", DATABASE_FILE_LOCATION, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return;
+    }
 
-    // Set insert statement
-    char* sql = "INSERT INTO MinifilterLog (SeqNum, OprType, PreOpTime, PostOpTime, ProcessId, ProcessFilePath, ThreadId, MajorOp, MinorOp, IrpFlags, DeviceObj, FileObj, FileTransaction, OpStatus, Information, Arg1, Arg2, Arg3, Arg4, Arg5, Arg6, OpFileName, RequestorMode, RuleID, RuleAction) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";;
+    sqlite3_busy_timeout(db, 5000);
+    PartitionPrintCatalog(db);
+    sqlite3_close(db);
+}
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+struct _SPY_RULES_HEADER*
+DatabaseBuildFilterRules(
+    VOID
+)
+/*
+Routine Desciption:
+
+    Compiles the active rules of the main database into the rule set the
+    filter enforces: the file location and extension rules that block.
+
+Return Value:
+
+    The rule set, free it with free.  NULL if the rules could not be read.
+
+*/
+{
+    sqlite3* db = NULL;
+    PRULE_SET ruleSet;
+    PSPY_RULES_HEADER rules;
+
+    if (!InitializeDatabase()) return NULL;
+
+    if (sqlite3_open(DATABASE_FILE_LOCATION, &db) != SQLITE_OK) {
+        WriteToLogAnsi("Could not open %s: %s", DATABASE_FILE_LOCATION, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    sqlite3_busy_timeout(db, 5000);
+    ruleSet = RulesCompile(db, "main");
+    sqlite3_close(db);
+
+    if (ruleSet == NULL) return NULL;
+
+    //The filter's copy does not point into the rule set
+    rules = RulesBuildFilterSet(ruleSet);
+    RulesFree(ruleSet);
+
+    return rules;
+}
+
+VOID
+DatabaseQueryRecent(
+    ULONG minutes
+)
+/*
+Routine Desciption:
+
+    Prints the operations logged in the last few minutes per major function,
+    reading the main database and only the partitions that overlap that
+    time range.
+
+Arguments:
+
+    minutes - How far back to look.
+
+*/
+{
+    sqlite3* db = NULL;
+    sqlite3_stmt* stmt = NULL;
+    FILETIME now;
+    LONGLONG to;
+    LONGLONG from;
+    int attached;
+
+    GetSystemTimeAsFileTime(&now);
+    to = ((LONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime;
+    from = to - (LONGLONG)minutes * 60 * 10000000;
+
+    if (!InitializeDatabase()) return;
+
+    if (sqlite3_open(DATABASE_FILE_LOCATION, &db) != SQLITE_OK) {
+        printf("    Could not open %s: %s\n", DATABASE_FILE_LOCATION, sqlite3_errmsg(db));
         sqlite3_close(db);
         return;
     }
 
+    sqlite3_busy_timeout(db, 5000);
+
+    //AllLog needs main.MinifilterLog to have the same columns as the partitions
+    if (!DatabaseUpgradeLog(db)) goto Exit;
+
+    attached = PartitionAttach(db, from, to + 1);
+    if (attached < 0) goto Exit;
+
+    //StatusCode is stored signed, so the error severity statuses, 0xC0000000
+    //and up, are -1073741824 to -1; warnings are below them
+    if (sqlite3_prepare_v2(db,
+                           "SELECT MajorOp, COUNT(*), SUM(StatusCode BETWEEN -1073741824 AND -1) FROM AllLog"
+                           " WHERE PreOpTime >= ?1 AND PreOpTime <= ?2"
+                           " GROUP BY MajorOp ORDER BY 2 DESC;",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        printf("    Query failed: %s\n", sqlite3_errmsg(db));
+        goto Exit;
+    }
+
+    sqlite3_bind_int64(stmt, 1, from);
+    sqlite3_bind_int64(stmt, 2, to);
+
+    printf("    Operations in the last %lu minutes, %d partition(s) read\n", minutes, attached);
+    printf("    %-44s %12s %12s\n", "Major", "Count", "Errors");
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        printf("    %-44s %12lld %12lld\n",
+               sqlite3_column_type(stmt, 0) == SQLITE_NULL ? "<NONE>" : (const char*)sqlite3_column_text(stmt, 0),
+               sqlite3_column_int64(stmt, 1),
+               sqlite3_column_int64(stmt, 2));
+    }
+
+Exit:
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+}
+
+static BOOLEAN
+DatabaseDosPath(
+    _In_z_ WCHAR CONST* NativePath,
+    _Out_writes_(Size) char* DosPath,
+    _In_ int Size
+)
+/*
+Routine Desciption:
+
+    Turns an image path as the kernel opened it, "\Device\HarddiskVolume3\..."
+    or "\??\C:\...", into the "C:\..." form QueryFullProcessImageNameA gives,
+    which is what ProcessFilePath holds.
+
+*/
+{
+    static WCHAR devices[26][MAX_PATH];
+    static BOOLEAN mapped = FALSE;
+    WCHAR dosPath[MAX_PATH];
+    WCHAR drive[3] = L"A:";
+    size_t length;
+    int letter;
+    int pass;
+
+    if (wcsncmp(NativePath, L"\\??\\", 4) == 0) {
+        return WideCharToMultiByte(CP_ACP, 0, NativePath + 4, -1, DosPath, Size, NULL, NULL) != 0;
+    }
+
+    //Drive mappings are read once, and again when a path matches none of
+    //them in case a volume was mounted since
+    for (pass = mapped ? 0 : 1; pass < 2; pass++) {
+        if (pass == 1) {
+            for (letter = 0; letter < 26; letter++) {
+                drive[0] = (WCHAR)(L'A' + letter);
+                if (QueryDosDeviceW(drive, devices[letter], MAX_PATH) == 0) devices[letter][0] = L'\0';
+            }
+            mapped = TRUE;
+        }
+
+        for (letter = 0; letter < 26; letter++) {
+            length = wcslen(devices[letter]);
+            if (length != 0 && _wcsnicmp(NativePath, devices[letter], length) == 0 && NativePath[length] == L'\\') {
+                swprintf_s(dosPath, MAX_PATH, L"%c:%s", L'A' + letter, NativePath + length);
+                return WideCharToMultiByte(CP_ACP, 0, dosPath, -1, DosPath, Size, NULL, NULL) != 0;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+VOID
+DatabaseProcess(
+    _In_ PLOG_RECORD LogRecord
+)
+/*
+Routine Desciption:
+
+    Applies a process record from the filter to the process table.  The
+    Processes row is written with the current batch when logging.
+
+Arguments:
+
+    LogRecord - A RECORD_TYPE_PROCESS record
+
+*/
+{
+    PRECORD_DATA recordData = &LogRecord->Data;
+    char imagePath[MAX_PATH];
+    BOOLEAN haveImagePath = FALSE;
+
+    //Rows are committed in batches by DatabaseEndBatch
+    if (LogDb != NULL && !LogBatchOpen) {
+        if (sqlite3_exec(LogDb, "BEGIN;", NULL, NULL, NULL) == SQLITE_OK) LogBatchOpen = TRUE;
+    }
+
+    if (recordData->CallbackMinorId == PROCESS_RECORD_EXIT) {
+        ProcessTableExit(recordData->ProcessId,
+                         recordData->OriginatingTime.QuadPart,
+                         recordData->CompletionTime.QuadPart,
+                         recordData->Status);
+        return;
+    }
+
+    if (LogRecord->Name[0] != L'\0') {
+        haveImagePath = DatabaseDosPath(LogRecord->Name, imagePath, sizeof(imagePath));
+    }
+
+    ProcessTableCreate(recordData->ProcessId,
+                       recordData->OriginatingTime.QuadPart,
+                       recordData->Information,
+                       recordData->Arg6.QuadPart,
+                       recordData->ThreadId,
+                       haveImagePath ? imagePath : NULL,
+                       (LogRecord->Name[0] != L'\0') ? LogRecord->Name : NULL,
+                       FALSE,
+                       recordData->OriginatingTime.QuadPart);
+}
+
+BOOLEAN
+DatabaseQueryProcess(
+    _In_ ULONG_PTR ProcessId,
+    _Out_ PLONGLONG CreateTime,
+    _Out_writes_z_(MAX_PATH) char* ImagePath,
+    _Out_writes_z_(MAX_PATH) WCHAR* NativeImagePath
+)
+/*
+Routine Desciption:
+
+    Opens the process that has an id now for ProcessTableAttribute, which
+    only asks about processes the filter did not report: those older than
+    the filter.
+
+*/
+{
+    FILETIME createTime, exitTime, kernelTime, userTime;
+    DWORD size;
+    HANDLE hProcess;
+
+    hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)ProcessId);
+    if (hProcess == NULL) return FALSE;
+
+    if (!GetProcessTimes(hProcess, &createTime, &exitTime, &kernelTime, &userTime)) {
+        CloseHandle(hProcess);
+        return FALSE;
+    }
+
+    *CreateTime = ((LONGLONG)createTime.dwHighDateTime << 32) | createTime.dwLowDateTime;
+
+    size = MAX_PATH;
+    if (!QueryFullProcessImageNameA(hProcess, 0, ImagePath, &size)) ImagePath[0] = '\0';
+    size = MAX_PATH;
+    if (!QueryFullProcessImageNameW(hProcess, PROCESS_NAME_NATIVE, NativeImagePath, &size)) NativeImagePath[0] = L'\0';
+    CloseHandle(hProcess);
+
+    //A process new to the table is written to Processes with the batch the
+    //operation opens
+    if (LogDb != NULL && !LogBatchOpen) {
+        if (sqlite3_exec(LogDb, "BEGIN;", NULL, NULL, NULL) == SQLITE_OK) LogBatchOpen = TRUE;
+    }
+
+    return TRUE;
+}
+
+VOID
+DatabaseDump(
+    _In_ ULONG SequenceNumber,
+    _In_ WCHAR CONST* Name,
+    _In_ PRECORD_DATA RecordData
+)
+/*
+Routine Desciption:
+
+    Grabs all the data from the log records and writes them to database
+
+Arguments:
+
+    SequenceNumber - the sequence number for this log record
+    Name - the name of the file that this Irp relates to
+    RecordData - the Data record to print
+
+Return Value:
+
+    None.
+
+*/
+{
+    //Roll to a new partition when the window or the partitioning changed.
+    //Never roll back to an older window: an operation that started before
+    //the last roll is kept in the newer partition.
+    PARTITION_WINDOW window = LogWindow;
+    LONGLONG windowStart = PartitionWindowStart(window, RecordData->OriginatingTime.QuadPart);
+
+    if (LogDb != NULL &&
+        (window != LogOpenWindow || (window != PartitionNone && windowStart > LogOpenStart))) {
+        DatabaseCloseLog();
+    }
+    else if (LogDb != NULL) {
+        windowStart = LogOpenStart;
+    }
+
+    //Open the connection on first use
+    if (!DatabaseOpenLog(window, windowStart)) return;
+
+    sqlite3* db = LogDb;
+    sqlite3_stmt* stmt = LogInsert;
+
+    //The process comes from the table the filter's process records fill,
+    //only processes older than the filter are opened
+    PPROCESS_ENTRY process = ProcessTableAttribute((ULONG_PTR)RecordData->ProcessId,
+                                                   RecordData->OriginatingTime.QuadPart,
+                                                   DatabaseQueryProcess);
+    const char* processPathStr = (process == NULL) ? "<NO PROCESS>" :
+                                 (process->ImagePath == NULL) ? "<NO PATH>" : process->ImagePath;
+    RULE_REF rule = { RecordData->BlockingRuleID, RecordData->RuleAction };
+    ULONG rulesSlot;
+    PRULE_SET rules = ReloadAcquire(&rulesSlot);
+
+    //Apply the rules.  A rule the filter already applied takes precedence.
+    if (rule.RuleId == 0 && rules != NULL) {
+        WCHAR processPathW[MAX_PATH];
+        UCHAR fileDigest[HASH_DIGEST_SIZE];
+        UCHAR processDigest[HASH_DIGEST_SIZE];
+        RULE_INPUT input = { Name, NULL, NULL, NULL };
+
+        if (RulesWantProcessPath(rules) && process != NULL && process->ImagePath != NULL &&
+            MultiByteToWideChar(CP_ACP, 0, process->ImagePath, -1, processPathW, MAX_PATH) != 0) {
+            input.ProcessPath = processPathW;
+        }
+
+        //Digests come from the cache only.  A file that is still being
+        //hashed is matched without its digest this time round.
+        if (RulesWantDigest(rules, RULE_TARGET_FILE) && Name[0] != L'\0' &&
+            HashLookup(Name, fileDigest) == HashReady) {
+            input.FileDigest = fileDigest;
+        }
+        //The hashing pool opens files by their device path, as the filter
+        //reports them
+        if (RulesWantDigest(rules, RULE_TARGET_PROCESS) && process != NULL && process->NativeImagePath != NULL &&
+            HashLookup(process->NativeImagePath, processDigest) == HashReady) {
+            input.ProcessDigest = processDigest;
+        }
+
+        rule = RulesMatch(rules, &input);
+    }
+
+    ReloadRelease(rulesSlot);
+
+    //A write or rename makes whatever digest the cache holds for the file
+    //suspect
+    if (RecordData->CallbackMajorId == IRP_MJ_WRITE || RecordData->CallbackMajorId == IRP_MJ_SET_INFORMATION) {
+        HashInvalidate(Name);
+    }
+
+    //Ignored operations are not logged at all
+    if (rule.RuleId != 0 && rule.Action == RULE_ACTION_IGNORE) return;
+
+    //Rows are committed in batches by DatabaseEndBatch
+    if (!LogBatchOpen) {
+        if (sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK) return;
+        LogBatchOpen = TRUE;
+    }
+
     //Set Sequence Number
     sqlite3_bind_int64(stmt, 1, (sqlite3_int64)SequenceNumber);
 
@@ -1134,24 +2112,9 @@ Return Value:
 
     //Set Process ID
     sqlite3_bind_int64(stmt, 5, (sqlite3_int64)RecordData->ProcessId);
-    
-    // Set Process File Path using ANSI version (QueryFullProcessImageNameA)
-    char processPath[MAX_PATH];
-    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)(ULONG_PTR)RecordData->ProcessId);
-
-    if (hProcess != NULL) {
-        DWORD size = MAX_PATH;
-        if (QueryFullProcessImageNameA(hProcess, 0, processPath, &size)) {
-            sqlite3_bind_text(stmt, 6, processPath, -1, SQLITE_TRANSIENT);
-        }
-        else {
-            sqlite3_bind_text(stmt, 6, "<NO PATH>", -1, SQLITE_TRANSIENT);
-        }
-        CloseHandle(hProcess);
-    }
-    else {
-        sqlite3_bind_text(stmt, 6, "<NO PROCESS>", -1, SQLITE_TRANSIENT);
-    }
+
+    //Set Process File Path
+    sqlite3_bind_text(stmt, 6, processPathStr, -1, SQLITE_TRANSIENT);
 
     //Set Thread ID
     sqlite3_bind_int64(stmt, 7, (sqlite3_int64)RecordData->ThreadId);
@@ -1171,38 +2134,8 @@ Return Value:
     sqlite3_bind_text(stmt, 9, minorStrBuf, -1, SQLITE_TRANSIENT);
 
     //Set IRP (I/O Request Packet) Flags
-    // Interpret set IrpFlags (it acts as bit mask, so we want to translate so more human readable)
-    char flagStr[9] = "--------";
-
-    if (RecordData->IrpFlags & IRP_NOCACHE) flagStr[0] = 'N';
-    if (RecordData->IrpFlags & IRP_PAGING_IO) flagStr[1] = 'P';
-    if (RecordData->IrpFlags & IRP_SYNCHRONOUS_API) flagStr[2] = 'S';
-
-    // This Irp Flag has overloaded meaning (multiple definitions for same value / contedxt specific)
-    if (RecordData->IrpFlags & 0x40) {
-        // if its a read or write operation
-        if (RecordData->CallbackMajorId == IRP_MJ_READ || RecordData->CallbackMajorId == IRP_MJ_WRITE) {
-            // Interpret as input vs output
-            flagStr[3] = (RecordData->IrpFlags & IRP_INPUT_OPERATION) ? 'I' : 'O';
-        }
-        else if (RecordData->IrpFlags & IRP_PAGING_IO) {
-            // Interpret as synchronous paging
-            flagStr[3] = 'Y';
-        }
-        else {
-            // Not sure, just log the bit was set - shouldn't really happen but just in case
-            flagStr[3] = '?';
-        }
-    }
-    else {
-        //If the flag is not there, then give empty
-        flagStr[3] = '-';
-    }
-
-    if (RecordData->IrpFlags & IRP_CREATE_OPERATION) flagStr[4] = 'C';
-    if (RecordData->IrpFlags & IRP_READ_OPERATION) flagStr[5] = 'R';
-    if (RecordData->IrpFlags & IRP_WRITE_OPERATION) flagStr[6] = 'W';
-    if (RecordData->IrpFlags & IRP_CLOSE_OPERATION) flagStr[7] = 'X';
+    char flagStr[9];
+    FormatIrpFlags(RecordData, flagStr);
     sqlite3_bind_text(stmt, 10, flagStr, -1, SQLITE_TRANSIENT);
 
     char ptrBuf[32];
@@ -1226,27 +2159,46 @@ Return Value:
     sprintf_s(ptrBuf, sizeof(ptrBuf), "%p", (void*)RecordData->Information);
     sqlite3_bind_text(stmt, 15, ptrBuf, -1, SQLITE_TRANSIENT);
 
-    //Set Arguments for the operations
-    sqlite3_bind_int(stmt, 16, *(int*)&RecordData->Arg1);
-    sqlite3_bind_int(stmt, 17, *(int*)&RecordData->Arg2);
-    sqlite3_bind_int(stmt, 18, *(int*)&RecordData->Arg3);
-    sqlite3_bind_int(stmt, 19, *(int*)&RecordData->Arg4);
-    sqlite3_bind_int(stmt, 20, *(int*)&RecordData->Arg5);
-
-    /*sprintf_s(ptrBuf, sizeof(ptrBuf), "%I64d", RecordData->Arg6.QuadPart);
-    sqlite3_bind_text(stmt, 21, ptrBuf, -1, SQLITE_TRANSIENT);*/
-
-    sqlite3_bind_int64(stmt, 21, *(sqlite3_int64*)&RecordData->Arg6.QuadPart);
-
-    //Set the file name associated with the operation
-    sqlite3_bind_text16(stmt, 22, Name, -1, SQLITE_TRANSIENT);
+    //Set Arguments for the operations, whole pointers as they were
+    sqlite3_bind_int64(stmt, 16, (sqlite3_int64)(LONG_PTR)RecordData->Arg1);
+    sqlite3_bind_int64(stmt, 17, (sqlite3_int64)(LONG_PTR)RecordData->Arg2);
+    sqlite3_bind_int64(stmt, 18, (sqlite3_int64)(LONG_PTR)RecordData->Arg3);
+    sqlite3_bind_int64(stmt, 19, (sqlite3_int64)(LONG_PTR)RecordData->Arg4);
+    sqlite3_bind_int64(stmt, 20, (sqlite3_int64)(LONG_PTR)RecordData->Arg5);
+    sqlite3_bind_int64(stmt, 21, RecordData->Arg6.QuadPart);
+
+    //Set the file name associated with the operation, converted once for
+    //the row and every sink below.  The row refers to it in Files, and only
+    //holds it itself if that fails.
+    char nameStr[UTF8_NAME_SIZE(MAX_NAME_SPACE / sizeof(WCHAR))];
+    ULONG nameLength = Utf16ToUtf8(Name, (ULONG)wcslen(Name), nameStr, sizeof(nameStr));
+    sqlite3_int64 fileId = FilesLookup(nameStr, nameLength);
+    if (fileId != 0) {
+        sqlite3_bind_int64(stmt, 31, fileId);
+    }
+    else {
+        sqlite3_bind_text(stmt, 22, nameStr, (int)nameLength, SQLITE_TRANSIENT);
+    }
 
     //Set Requestor mode, whether operation from kernel or user
-    sqlite3_bind_text(stmt, 23, RecordData->RequestorMode ? "Kernel" : "User", -1, SQLITE_TRANSIENT);
-    //Set what rule then blocked the operation if it was (from the block list)
-    sqlite3_bind_int(stmt, 24, RecordData->BlockingRuleID);
+    const char* requestorStr = RecordData->RequestorMode ? "Kernel" : "User";
+    sqlite3_bind_text(stmt, 23, requestorStr, -1, SQLITE_TRANSIENT);
+    //Set what rule matched the operation, and what it did about it
+    if (rule.RuleId != 0) {
+        sqlite3_bind_int(stmt, 24, rule.RuleId);
+        sqlite3_bind_int(stmt, 25, rule.Action);
+    }
 
-    sqlite3_bind_int(stmt, 25, 0);
+    //Raw status, sign extended so errors and warnings sort below success
+    sqlite3_bind_int64(stmt, 26, (sqlite3_int64)(LONG)RecordData->Status);
+
+    //What the arguments mean for this major function, left NULL otherwise
+    RECORD_ARGS args;
+    ArgsDecode(RecordData, &args);
+    if (FlagOn(args.Valid, ARGS_OFFSET)) sqlite3_bind_int64(stmt, 27, args.Offset);
+    if (FlagOn(args.Valid, ARGS_LENGTH)) sqlite3_bind_int64(stmt, 28, (sqlite3_int64)args.Length);
+    if (FlagOn(args.Valid, ARGS_INFO_CLASS)) sqlite3_bind_int64(stmt, 29, args.InfoClass);
+    if (FlagOn(args.Valid, ARGS_CONTROL_CODE)) sqlite3_bind_int64(stmt, 30, args.ControlCode);
 
     //Execute insert command
     if (sqlite3_step(stmt) != SQLITE_DONE) {
@@ -1256,8 +2208,33 @@ Return Value:
         snprintf(logMessage, sizeof(logMessage), "SQLite insert failed on Kernel Operation: %s", errorMsg);
         WriteToLogAnsi(logMessage);
     }
+    else {
+        PartitionRangeAdd(&LogBatchRange, preOpUnix, SequenceNumber);
+
+        if (rule.RuleId != 0 && rule.Action != RULE_ACTION_IGNORE) {
+            DatabaseRuleAlert(rule, majorStrBuf, nameStr, processPathStr);
+        }
+
+        //Count the row in the summary tables, written with the same batch.
+        //A row the summaries miss fails the whole batch in DatabaseEndBatch.
+        if (!SummaryAdd(majorStrBuf, minorStrBuf, requestorStr, statusStr,
+                        (LONGLONG)RecordData->ProcessId, processPathStr, nameStr) &&
+            !LogBatchFailed) {
+            WriteToLogAnsi("Out of memory counting the summaries, the batch will be rolled back");
+            LogBatchFailed = TRUE;
+        }
+
+        //Follow the handle, a session ending is written with the same batch
+        SessionAdd(RecordData, nameStr, processPathStr);
+
+        //Rank the process and file, a window ending is written with the same batch
+        TopKAdd(RecordData, nameStr, processPathStr);
+    }
 
-    //Clean up
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    //Watch for mass modification even when the row could not be stored
+    MassModAdd(RecordData, Name, processPathStr);
+
+    //Ready the statement for the next record
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
 }
\ No newline at end of file
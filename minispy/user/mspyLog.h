@@ -22,21 +22,37 @@ Environment:
 #include <stdio.h>
 #include <fltUser.h>
 #include "minispy.h"
+#include "mspyPartition.h"
 
 #define BUFFER_SIZE     (64 * 1024) //64 KB - user mode memory
 
-#define DATABASE_FILE_LOCATION "C:\\Users\\Public\\log.db"
+#define DATABASE_FILE_LOCATION DatabaseFileLocation
+#define DATABASE_PARTITION_BASE DatabasePartitionBase   // partitions are <base>-YYYYMMDD[-HH].db
+#define DATABASE_DEFAULT_FILE_LOCATION "C:\\Users\\Public\\log.db"
+#define DATABASE_DEFAULT_PARTITION_BASE "C:\\Users\\Public\\log"
 #define USER_LOG_FILE "C:\\Users\\Public\\MySimpleCService.log"
 
 #define EPOCH_DIFF 116444736000000000ULL
 
+//
+//  Where the log database lives, the defaults unless a tool moved it
+//  aside with DatabaseSetLocation before anything opened it.
+//
+
+extern char DatabaseFileLocation[MAX_PATH];
+extern char DatabasePartitionBase[MAX_PATH];
+
 //
 //  Structure for managing current state.
 //
 
 typedef struct _LOG_CONTEXT {
 
-    HANDLE Port;
+    //
+    //  The filter, or its stand-in, NULL when only generating records.
+    //
+
+    struct _PORT *Port;
     BOOLEAN LogToScreen;
     BOOLEAN LogToFile;
     FILE   *OutputFile;
@@ -50,6 +66,13 @@ typedef struct _LOG_CONTEXT {
     BOOLEAN CleaningUp;
     HANDLE  ShutDown;
 
+    //
+    //  Recent records kept in memory for live queries, NULL if the
+    //  store could not be allocated.
+    //
+
+    struct _COL_STORE *Recent;
+
 } LOG_CONTEXT, *PLOG_CONTEXT;
 
 //
@@ -61,6 +84,20 @@ RetrieveLogRecords(
     _In_ LPVOID lpParameter
     );
 
+PLOG_RECORD
+NextLogRecord(
+    _In_reads_bytes_(BytesReturned) PCHAR Buffer,
+    _In_ DWORD BytesReturned,
+    _Inout_ PDWORD Used
+    );
+
+VOID
+ProcessLogBuffer(
+    _In_ PLOG_CONTEXT context,
+    _In_reads_bytes_(bytesReturned) PCHAR buffer,
+    _In_ DWORD bytesReturned
+    );
+
 VOID
 DatabaseDump(
     _In_ ULONG SequenceNumber,
@@ -68,12 +105,97 @@ DatabaseDump(
     _In_ PRECORD_DATA RecordData
     );
 
+VOID
+DatabaseProcess(
+    _In_ PLOG_RECORD LogRecord
+    );
+
+VOID
+DatabaseSetLocation(
+    const char* path,
+    const char* partitionBase
+    );
+
+VOID
+DatabaseSetPartitioning(
+    PARTITION_WINDOW window,
+    ULONG keep
+    );
+
+VOID
+DatabaseShowPartitions(
+    VOID
+    );
+
+VOID
+DatabaseQueryRecent(
+    ULONG minutes
+    );
+
+struct _SPY_RULES_HEADER*
+DatabaseBuildFilterRules(
+    VOID
+    );
+
+VOID
+DatabaseEndBatch(
+    VOID
+    );
+
+VOID
+DatabaseEndSessions(
+    VOID
+    );
+
+VOID
+DatabaseCloseLog(
+    VOID
+    );
+
+int
+InitializeDatabase(
+    VOID
+    );
+
+int
+ExecEmbeddedSQL(
+    struct sqlite3* db,
+    LPCWSTR resourceName
+    );
+
 VOID
 WriteAlertToDatabase(
     const char* message
     , ...
     );
 
+VOID
+PrintIrpCode(
+    _In_ UCHAR MajorCode,
+    _In_ UCHAR MinorCode,
+    _Out_ const CHAR** MajorStringOut,
+    _Out_ const CHAR** MinorStringOut
+    );
+
+void
+WriteToLogAnsi(
+    const char* message
+    , ...
+    );
+
+void
+NtStatusToString(
+    ULONG status,
+    char* buffer,
+    size_t bufferSize
+    );
+
+void
+FormatIrpFlags(
+    _In_ PRECORD_DATA RecordData,
+    _Out_writes_z_(9) char* FlagString
+    );
+
 //VOID
 //FileDump (
 //    _In_ ULONG SequenceNumber,
@@ -340,6 +462,7 @@ typedef enum {
 #define IRP_MN_VERIFY_VOLUME                0x02
 #define IRP_MN_LOAD_FILE_SYSTEM             0x03
 #define IRP_MN_TRACK_LINK                   0x04
+#define IRP_MN_KERNEL_CALL                  0x04
 #define IRP_MN_LOCK                         0x01
 #define IRP_MN_UNLOCK_SINGLE                0x02
 #define IRP_MN_UNLOCK_ALL                   0x03
@@ -0,0 +1,606 @@
+/*++
+
+Module Name:
+
+    mspyMassMod.c
+
+Abstract:
+
+    Watches every process for mass modification of files as the log writer
+    inserts records.
+
+    Successful non paging writes, renames and deletes are counted per
+    process in MASSMOD_PANES panes of MASSMOD_PANE each.  Written and
+    renamed files are also added to a HyperLogLog sketch per pane, and the
+    union of the panes' sketches is kept up to date register by register,
+    so the distinct file estimate for the window costs the same for every
+    record however many files a process touches.  When the newest pane
+    moves on the expired panes are cleared and the union rebuilt, once per
+    pane per process.
+
+    A process whose window count reaches a threshold raises one alert
+    through WriteAlertToDatabase, then stays quiet for a window.
+
+    Processes are kept in a hash table and dropped a window after their
+    last counted operation, so memory follows the number of processes
+    modifying files, up to MASSMOD_MAX_PROCESSES.
+
+    MassModAdd is only called from the log writer thread.  The thresholds
+    and counters are read and set from the console.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyMassMod.h"
+
+#define MASSMOD_BUCKETS         1024        // power of two
+
+//
+//  FILE_INFORMATION_CLASS values of IRP_MJ_SET_INFORMATION, which the
+//  filter records in Arg2.
+//
+
+#define MASSMOD_FILE_RENAME_INFORMATION         10
+#define MASSMOD_FILE_DISPOSITION_INFORMATION    13
+#define MASSMOD_FILE_DISPOSITION_INFORMATION_EX 64
+#define MASSMOD_FILE_RENAME_INFORMATION_EX      65
+
+typedef struct _MASSMOD_PROCESS {
+
+    struct _MASSMOD_PROCESS *Next;
+
+    ULONG_PTR ProcessId;
+    char *ProcessFilePath;
+
+    LONGLONG Pane;              // record time / MASSMOD_PANE of the newest pane
+    LONGLONG LastTime;
+    LONGLONG QuietUntil;        // no further alert before this
+
+    ULONG Writes[MASSMOD_PANES];
+    ULONG Renames[MASSMOD_PANES];
+    ULONG Deletes[MASSMOD_PANES];
+
+    ULONG WindowWrites;
+    ULONG WindowRenames;
+    ULONG WindowDeletes;
+
+    //
+    //  Registers of every pane and their union, with the sum of 2^-register
+    //  and the number of zero registers of the union for the estimate.
+    //
+
+    double Sum;
+    ULONG Zeros;
+    UCHAR Union[MASSMOD_REGISTERS];
+    UCHAR Registers[MASSMOD_PANES][MASSMOD_REGISTERS];
+
+} MASSMOD_PROCESS, *PMASSMOD_PROCESS;
+
+typedef struct _MASSMOD_STATE {
+
+    //
+    //  Thresholds, set from the console.
+    //
+
+    volatile LONG Files;
+    volatile LONG Writes;
+    volatile LONG Renames;
+    volatile LONG Deletes;
+
+    //
+    //  Counters for /x.
+    //
+
+    volatile LONG Alerts;
+    volatile LONG Untracked;
+    volatile LONG Count;
+    volatile LONG Peak;
+
+    LONGLONG SweepPane;
+    PMASSMOD_PROCESS Buckets[MASSMOD_BUCKETS];
+
+} MASSMOD_STATE;
+
+static MASSMOD_STATE MassMod = {
+    MASSMOD_DEFAULT_FILES,
+    MASSMOD_DEFAULT_WRITES,
+    MASSMOD_DEFAULT_RENAMES,
+    MASSMOD_DEFAULT_DELETES,
+    0,
+    0,
+    0,
+    0,
+    0,
+    { NULL }
+};
+
+static ULONG
+MassModBucket (
+    _In_ ULONG_PTR ProcessId
+    )
+{
+    //
+    //  Process ids are multiples of 4.
+    //
+
+    return (ULONG)(((ULONGLONG)ProcessId >> 2) * 0x9E3779B97F4A7C15ULL >> 32) & (MASSMOD_BUCKETS - 1);
+}
+
+static ULONGLONG
+MassModHashName (
+    _In_z_ const WCHAR *Name
+    )
+/*++
+
+Routine Description:
+
+    Hashes a file name without regard to case.  The sketch takes its
+    register from the top bits and its rank from the rest, so the result
+    is mixed until every bit depends on every character.
+
+--*/
+{
+    ULONGLONG hash = 14695981039346656037ULL;
+    WCHAR ch;
+
+    for (; *Name != L'\0'; Name++) {
+
+        ch = *Name;
+
+        if (ch >= L'a' && ch <= L'z') {
+
+            ch -= L'a' - L'A';
+
+        } else if (ch >= 0x80) {
+
+            ch = (WCHAR)(ULONG_PTR)CharUpperW( (LPWSTR)(ULONG_PTR)ch );
+        }
+
+        hash = (hash ^ ch) * 1099511628211ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+static VOID
+MassModAdvance (
+    _Inout_ PMASSMOD_PROCESS Process,
+    _In_ LONGLONG Pane
+    )
+/*++
+
+Routine Description:
+
+    Makes Pane the newest pane of a process, clearing the panes that fall
+    out of the window and rebuilding the union from those left.
+
+--*/
+{
+    LONGLONG step;
+    ULONG slot;
+    ULONG index;
+    ULONG pane;
+    UCHAR value;
+
+    if (Pane <= Process->Pane) {
+
+        return;
+    }
+
+    for (step = Process->Pane + 1; step <= Pane && step <= Process->Pane + MASSMOD_PANES; step++) {
+
+        slot = (ULONG)(step % MASSMOD_PANES);
+
+        Process->WindowWrites -= Process->Writes[slot];
+        Process->WindowRenames -= Process->Renames[slot];
+        Process->WindowDeletes -= Process->Deletes[slot];
+        Process->Writes[slot] = 0;
+        Process->Renames[slot] = 0;
+        Process->Deletes[slot] = 0;
+
+        memset( Process->Registers[slot], 0, MASSMOD_REGISTERS );
+    }
+
+    Process->Pane = Pane;
+    Process->Sum = 0;
+    Process->Zeros = 0;
+
+    for (index = 0; index < MASSMOD_REGISTERS; index++) {
+
+        value = 0;
+
+        for (pane = 0; pane < MASSMOD_PANES; pane++) {
+
+            value = max( value, Process->Registers[pane][index] );
+        }
+
+        Process->Union[index] = value;
+        Process->Sum += ldexp( 1.0, -(int)value );
+        Process->Zeros += (value == 0);
+    }
+}
+
+static VOID
+MassModAddFile (
+    _Inout_ PMASSMOD_PROCESS Process,
+    _In_ ULONG Slot,
+    _In_z_ const WCHAR *Name
+    )
+{
+    ULONGLONG hash = MassModHashName( Name );
+    ULONG index = (ULONG)(hash >> (64 - MASSMOD_REGISTER_BITS));
+    ULONGLONG rest = hash << MASSMOD_REGISTER_BITS;
+    UCHAR rank = 1;
+
+    //
+    //  Rank is the position of the first set bit of the rest, capped where
+    //  the rest runs out of bits.
+    //
+
+    while (rank <= 64 - MASSMOD_REGISTER_BITS && (rest & (1ULL << 63)) == 0) {
+
+        rest <<= 1;
+        rank++;
+    }
+
+    if (rank > Process->Registers[Slot][index]) {
+
+        Process->Registers[Slot][index] = rank;
+    }
+
+    if (rank > Process->Union[index]) {
+
+        Process->Sum += ldexp( 1.0, -(int)rank ) - ldexp( 1.0, -(int)Process->Union[index] );
+        Process->Zeros -= (Process->Union[index] == 0);
+        Process->Union[index] = rank;
+    }
+}
+
+static ULONG
+MassModEstimate (
+    _In_ PMASSMOD_PROCESS Process
+    )
+/*++
+
+Routine Description:
+
+    Returns the HyperLogLog estimate of the distinct files in the window,
+    with linear counting while most registers are still zero.
+
+--*/
+{
+    const double registers = MASSMOD_REGISTERS;
+    double estimate;
+
+    estimate = 0.7213 / (1.0 + 1.079 / registers) * registers * registers / Process->Sum;
+
+    if (estimate <= 2.5 * registers && Process->Zeros != 0) {
+
+        estimate = registers * log( registers / Process->Zeros );
+    }
+
+    return (ULONG)(estimate + 0.5);
+}
+
+static VOID
+MassModSweep (
+    _In_ LONGLONG Now
+    )
+/*++
+
+Routine Description:
+
+    Drops the processes that counted nothing for a whole window.
+
+--*/
+{
+    PMASSMOD_PROCESS *link;
+    PMASSMOD_PROCESS process;
+    ULONG bucket;
+
+    for (bucket = 0; bucket < MASSMOD_BUCKETS; bucket++) {
+
+        link = &MassMod.Buckets[bucket];
+
+        while (*link != NULL) {
+
+            process = *link;
+
+            if (process->LastTime + MASSMOD_WINDOW > Now) {
+
+                link = &process->Next;
+                continue;
+            }
+
+            *link = process->Next;
+            free( process->ProcessFilePath );
+            free( process );
+            InterlockedDecrement( &MassMod.Count );
+        }
+    }
+}
+
+static PMASSMOD_PROCESS
+MassModFind (
+    _In_ ULONG_PTR ProcessId,
+    _In_z_ const char *ProcessFilePath,
+    _In_ LONGLONG Pane
+    )
+/*++
+
+Routine Description:
+
+    Returns the entry of a process, creating it if there is room.  An entry
+    whose image differs belongs to an earlier process with the same id and
+    is started over.
+
+--*/
+{
+    PMASSMOD_PROCESS *bucket = &MassMod.Buckets[MassModBucket( ProcessId )];
+    PMASSMOD_PROCESS process;
+    char *path;
+    LONG count;
+
+    for (process = *bucket; process != NULL; process = process->Next) {
+
+        if (process->ProcessId == ProcessId) {
+
+            break;
+        }
+    }
+
+    if (process != NULL && strcmp( process->ProcessFilePath, ProcessFilePath ) == 0) {
+
+        return process;
+    }
+
+    path = _strdup( ProcessFilePath );
+
+    if (path == NULL) {
+
+        return NULL;
+    }
+
+    if (process != NULL) {
+
+        free( process->ProcessFilePath );
+        memset( &process->QuietUntil, 0, sizeof( MASSMOD_PROCESS ) - FIELD_OFFSET( MASSMOD_PROCESS, QuietUntil ) );
+
+    } else {
+
+        if (MassMod.Count >= MASSMOD_MAX_PROCESSES) {
+
+            InterlockedIncrement( &MassMod.Untracked );
+            free( path );
+            return NULL;
+        }
+
+        process = calloc( 1, sizeof( MASSMOD_PROCESS ) );
+
+        if (process == NULL) {
+
+            free( path );
+            return NULL;
+        }
+
+        process->ProcessId = ProcessId;
+        process->Next = *bucket;
+        *bucket = process;
+
+        count = InterlockedIncrement( &MassMod.Count );
+
+        if (count > MassMod.Peak) {
+
+            InterlockedExchange( &MassMod.Peak, count );
+        }
+    }
+
+    process->ProcessFilePath = path;
+    process->Pane = Pane;
+    process->Sum = MASSMOD_REGISTERS;
+    process->Zeros = MASSMOD_REGISTERS;
+
+    return process;
+}
+
+VOID
+MassModAdd (
+    _In_ PRECORD_DATA RecordData,
+    _In_z_ const WCHAR *Name,
+    _In_z_ const char *ProcessFilePath
+    )
+/*++
+
+Routine Description:
+
+    Counts one logged record against its process and raises an alert if
+    the process went over a threshold.
+
+Arguments:
+
+    RecordData - The record.
+
+    Name - Its file name.
+
+    ProcessFilePath - Image of the process that issued it.
+
+--*/
+{
+    LONGLONG now = RecordData->OriginatingTime.QuadPart;
+    LONGLONG pane = now / MASSMOD_PANE;
+    PMASSMOD_PROCESS process;
+    ULONG infoClass;
+    ULONG slot;
+    ULONG files = 0;
+    LONG filesThreshold;
+    LONG writesThreshold;
+    LONG renamesThreshold;
+    LONG deletesThreshold;
+    BOOLEAN writing = FALSE;
+    BOOLEAN renaming = FALSE;
+    BOOLEAN deleting = FALSE;
+
+    //
+    //  Only what went through.  Paging writes are issued by the cache and
+    //  memory managers, not by the process they are charged to.
+    //
+
+    if ((ULONG)RecordData->Status >= 0x80000000) {
+
+        return;
+    }
+
+    if (RecordData->CallbackMajorId == IRP_MJ_WRITE) {
+
+        writing = !(RecordData->IrpFlags & IRP_PAGING_IO);
+
+    } else if (RecordData->CallbackMajorId == IRP_MJ_SET_INFORMATION) {
+
+        infoClass = (ULONG)(ULONG_PTR)RecordData->Arg2;
+
+        renaming = (infoClass == MASSMOD_FILE_RENAME_INFORMATION ||
+                  infoClass == MASSMOD_FILE_RENAME_INFORMATION_EX);
+
+        deleting = (infoClass == MASSMOD_FILE_DISPOSITION_INFORMATION ||
+                  infoClass == MASSMOD_FILE_DISPOSITION_INFORMATION_EX);
+    }
+
+    if (!writing && !renaming && !deleting) {
+
+        return;
+    }
+
+    if (pane != MassMod.SweepPane) {
+
+        MassModSweep( now );
+        MassMod.SweepPane = pane;
+    }
+
+    process = MassModFind( RecordData->ProcessId, ProcessFilePath, pane );
+
+    if (process == NULL) {
+
+        return;
+    }
+
+    //
+    //  Records a little out of order count in the newest pane.
+    //
+
+    MassModAdvance( process, pane );
+    process->LastTime = max( process->LastTime, now );
+    slot = (ULONG)(process->Pane % MASSMOD_PANES);
+
+    if (writing) {
+
+        process->Writes[slot]++;
+        process->WindowWrites++;
+
+    } else if (renaming) {
+
+        process->Renames[slot]++;
+        process->WindowRenames++;
+
+    } else {
+
+        process->Deletes[slot]++;
+        process->WindowDeletes++;
+    }
+
+    if (!deleting) {
+
+        MassModAddFile( process, slot, Name );
+    }
+
+    if (now < process->QuietUntil) {
+
+        return;
+    }
+
+    filesThreshold = MassMod.Files;
+    writesThreshold = MassMod.Writes;
+    renamesThreshold = MassMod.Renames;
+    deletesThreshold = MassMod.Deletes;
+
+    if (filesThreshold != 0) {
+
+        files = MassModEstimate( process );
+    }
+
+    if ((filesThreshold != 0 && files >= (ULONG)filesThreshold) ||
+        (writesThreshold != 0 && process->WindowWrites >= (ULONG)writesThreshold) ||
+        (renamesThreshold != 0 && process->WindowRenames >= (ULONG)renamesThreshold) ||
+        (deletesThreshold != 0 && process->WindowDeletes >= (ULONG)deletesThreshold)) {
+
+        WriteAlertToDatabase( "Mass modification by %s (%I64u): about %lu distinct files written or renamed, %lu writes, %lu renames and %lu deletes in %lu seconds",
+                              process->ProcessFilePath,
+                              (ULONGLONG)process->ProcessId,
+                              files ? files : MassModEstimate( process ),
+                              process->WindowWrites,
+                              process->WindowRenames,
+                              process->WindowDeletes,
+                              (ULONG)(MASSMOD_WINDOW / 10000000) );
+
+        process->QuietUntil = now + MASSMOD_WINDOW;
+        InterlockedIncrement( &MassMod.Alerts );
+    }
+}
+
+VOID
+MassModSetThresholds (
+    _In_ ULONG Files,
+    _In_ ULONG Writes,
+    _In_ ULONG Renames,
+    _In_ ULONG Deletes
+    )
+/*++
+
+Routine Description:
+
+    Sets the counts per window at which a process raises an alert.  0
+    turns a check off.
+
+--*/
+{
+    InterlockedExchange( &MassMod.Files, (LONG)Files );
+    InterlockedExchange( &MassMod.Writes, (LONG)Writes );
+    InterlockedExchange( &MassMod.Renames, (LONG)Renames );
+    InterlockedExchange( &MassMod.Deletes, (LONG)Deletes );
+}
+
+VOID
+MassModPrintStats (
+    VOID
+    )
+{
+    printf( "    Thresholds:  %ld distinct files, %ld writes, %ld renames, %ld deletes in %lu seconds (0 is off)\n",
+            MassMod.Files,
+            MassMod.Writes,
+            MassMod.Renames,
+            MassMod.Deletes,
+            (ULONG)(MASSMOD_WINDOW / 10000000) );
+    printf( "    Processes:   %ld followed, %ld at most, %ld not followed for lack of room\n",
+            MassMod.Count,
+            MassMod.Peak,
+            MassMod.Untracked );
+    printf( "    Alerts:      %ld raised\n",
+            MassMod.Alerts );
+}
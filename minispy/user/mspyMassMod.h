@@ -0,0 +1,81 @@
+/*++
+
+Module Name:
+
+    mspyMassMod.h
+
+Abstract:
+
+    Raises an alert when a process writes or renames more distinct files,
+    or writes, renames or deletes more often, than a threshold within a
+    sliding window, the pattern of ransomware encrypting a volume.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYMASSMOD_H__
+#define __MSPYMASSMOD_H__
+
+#include <windows.h>
+#include "minispy.h"
+
+//
+//  The window slides in MASSMOD_PANES steps of MASSMOD_PANE, so the counts
+//  compared against the thresholds cover between the last
+//  (MASSMOD_PANES - 1) * MASSMOD_PANE and MASSMOD_PANES * MASSMOD_PANE of
+//  record time.
+//
+
+#define MASSMOD_PANES           5
+#define MASSMOD_PANE            (2LL * 10000000)        // 2 seconds in 100ns
+#define MASSMOD_WINDOW          (MASSMOD_PANES * MASSMOD_PANE)
+
+//
+//  Distinct files are estimated with a HyperLogLog sketch of
+//  MASSMOD_REGISTERS one byte registers per pane, about 6.5% standard
+//  error.  MASSMOD_REGISTERS must be 2^MASSMOD_REGISTER_BITS.
+//
+
+#define MASSMOD_REGISTER_BITS   8
+#define MASSMOD_REGISTERS       (1 << MASSMOD_REGISTER_BITS)
+
+//
+//  Processes followed at once.  A process is dropped a window after its
+//  last write, rename or delete, and new processes past the limit are not
+//  followed until room is made.
+//
+
+#define MASSMOD_MAX_PROCESSES   4096
+
+//
+//  Thresholds per window until changed with /x.  0 turns a check off.
+//
+
+#define MASSMOD_DEFAULT_FILES   100
+#define MASSMOD_DEFAULT_WRITES  0
+#define MASSMOD_DEFAULT_RENAMES 100
+#define MASSMOD_DEFAULT_DELETES 100
+
+VOID
+MassModAdd (
+    _In_ PRECORD_DATA RecordData,
+    _In_z_ const WCHAR *Name,
+    _In_z_ const char *ProcessFilePath
+    );
+
+VOID
+MassModSetThresholds (
+    _In_ ULONG Files,
+    _In_ ULONG Writes,
+    _In_ ULONG Renames,
+    _In_ ULONG Deletes
+    );
+
+VOID
+MassModPrintStats (
+    VOID
+    );
+
+#endif //__MSPYMASSMOD_H__
@@ -0,0 +1,781 @@
+/*++
+
+Module Name:
+
+    mspyPartition.c
+
+Abstract:
+
+    Time partitioning of the log database.  The writer in mspyLog.c opens
+    the partition for the window of the record it is writing, attaches the
+    main database as PARTITION_CATALOG_SCHEMA and keeps that partition's
+    row in the Partitions catalog up to date in the same transaction as the
+    rows.  Every partition is a complete log database of its own, with its
+    own summary tables, so removing one never leaves counts behind.
+
+    Nothing here calls Win32, only the C runtime and SQLite, so the window
+    arithmetic, naming, retention and attach logic can be built and tried
+    out on any platform.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mspyPartition.h"
+
+#define PARTITION_TICKS_PER_SECOND  10000000LL
+#define PARTITION_TICKS_PER_HOUR    (3600 * PARTITION_TICKS_PER_SECOND)
+#define PARTITION_TICKS_PER_DAY     (24 * PARTITION_TICKS_PER_HOUR)
+
+//
+//  Days from 1601-01-01, where PreOpTime counts from, to 1970-01-01.
+//
+
+#define PARTITION_DAYS_TO_1970      134774LL
+
+//
+//  Files SQLite may leave next to a database, removed with it.
+//
+
+static const char *PartitionSideFiles[] = { "-wal", "-shm", "-journal" };
+
+static void
+PartitionCivilTime (
+    long long Time,
+    int *Year,
+    int *Month,
+    int *Day,
+    int *Hour,
+    int *Minute,
+    int *Second
+    )
+/*++
+
+Routine Description:
+
+    Splits a UTC time in 100ns units since 1601 into its calendar fields,
+    using the days to civil date conversion of the proleptic Gregorian
+    calendar so no platform time routines are needed.
+
+--*/
+{
+    long long days = Time / PARTITION_TICKS_PER_DAY;
+    long long rest = (Time % PARTITION_TICKS_PER_DAY) / PARTITION_TICKS_PER_SECOND;
+    long long z = days - PARTITION_DAYS_TO_1970 + 719468;
+    long long era = (z >= 0 ? z : z - 146096) / 146097;
+    long long doe = z - era * 146097;
+    long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long long mp = (5 * doy + 2) / 153;
+    long long m = mp < 10 ? mp + 3 : mp - 9;
+
+    *Year = (int)(yoe + era * 400 + (m <= 2));
+    *Month = (int)m;
+    *Day = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *Hour = (int)(rest / 3600);
+    *Minute = (int)((rest / 60) % 60);
+    *Second = (int)(rest % 60);
+}
+
+static void
+PartitionFormatTime (
+    long long Time,
+    char *Buffer,
+    size_t BufferSize
+    )
+{
+    int year, month, day, hour, minute, second;
+
+    PartitionCivilTime( Time, &year, &month, &day, &hour, &minute, &second );
+
+    snprintf( Buffer, BufferSize, "%04d-%02d-%02d %02d:%02d:%02d",
+              year, month, day, hour, minute, second );
+}
+
+long long
+PartitionWindowLength (
+    PARTITION_WINDOW Window
+    )
+{
+    switch (Window) {
+
+    case PartitionHourly:
+        return PARTITION_TICKS_PER_HOUR;
+
+    case PartitionDaily:
+        return PARTITION_TICKS_PER_DAY;
+
+    default:
+        return 0;
+    }
+}
+
+long long
+PartitionWindowStart (
+    PARTITION_WINDOW Window,
+    long long Time
+    )
+/*++
+
+Routine Description:
+
+    Returns the start of the window holding Time.  With PartitionNone there
+    is a single window starting at 0.
+
+--*/
+{
+    long long length = PartitionWindowLength( Window );
+
+    if (length == 0 || Time < 0) {
+
+        return 0;
+    }
+
+    return Time - (Time % length);
+}
+
+int
+PartitionFileName (
+    const char *Base,
+    PARTITION_WINDOW Window,
+    long long WindowStart,
+    char *Buffer,
+    size_t BufferSize
+    )
+/*++
+
+Routine Description:
+
+    Builds the file name of the partition for a window, Base-YYYYMMDD.db
+    for daily windows and Base-YYYYMMDD-HH.db for hourly ones.  Names sort
+    in time order.
+
+Arguments:
+
+    Base - Path of the main database without the .db extension.
+
+    Window - The partitioning in use.
+
+    WindowStart - Start of the window, as returned by PartitionWindowStart.
+
+    Buffer - Receives the NUL terminated file name.
+
+    BufferSize - Size of Buffer in bytes.
+
+Return Value:
+
+    0 on success, -1 if the name did not fit.
+
+--*/
+{
+    int year, month, day, hour, minute, second;
+    int length;
+
+    PartitionCivilTime( WindowStart, &year, &month, &day, &hour, &minute, &second );
+
+    switch (Window) {
+
+    case PartitionHourly:
+        length = snprintf( Buffer, BufferSize, "%s-%04d%02d%02d-%02d.db",
+                           Base, year, month, day, hour );
+        break;
+
+    case PartitionDaily:
+        length = snprintf( Buffer, BufferSize, "%s-%04d%02d%02d.db",
+                           Base, year, month, day );
+        break;
+
+    default:
+        length = snprintf( Buffer, BufferSize, "%s.db", Base );
+        break;
+    }
+
+    return (length < 0 || (size_t)length >= BufferSize) ? -1 : 0;
+}
+
+void
+PartitionRangeAdd (
+    PPARTITION_RANGE Range,
+    long long Time,
+    long long Sequence
+    )
+{
+    if (Range->Rows == 0) {
+
+        Range->FirstTime = Range->LastTime = Time;
+        Range->FirstSeq = Range->LastSeq = Sequence;
+
+    } else {
+
+        if (Time < Range->FirstTime) Range->FirstTime = Time;
+        if (Time > Range->LastTime) Range->LastTime = Time;
+        if (Sequence < Range->FirstSeq) Range->FirstSeq = Sequence;
+        if (Sequence > Range->LastSeq) Range->LastSeq = Sequence;
+    }
+
+    Range->Rows++;
+}
+
+int
+PartitionCatalogCreate (
+    sqlite3 *Db,
+    const char *Schema
+    )
+/*++
+
+Routine Description:
+
+    Creates the Partitions catalog in the given schema if it is missing.
+    FirstTime/LastTime can fall outside WindowStart/WindowEnd: a record is
+    never written to an older partition than the one open, so an operation
+    that started before the window rolled is kept in the newer file.
+
+--*/
+{
+    char *sql;
+    int rc;
+
+    sql = sqlite3_mprintf( "CREATE TABLE IF NOT EXISTS \"%w\".Partitions ("
+                           "    FileName TEXT PRIMARY KEY,"
+                           "    WindowStart INTEGER NOT NULL,"
+                           "    WindowEnd INTEGER NOT NULL,"
+                           "    FirstTime INTEGER,"
+                           "    LastTime INTEGER,"
+                           "    FirstSeq INTEGER,"
+                           "    LastSeq INTEGER,"
+                           "    Rows INTEGER NOT NULL DEFAULT 0"
+                           ");",
+                           Schema );
+
+    if (sql == NULL) {
+
+        return SQLITE_NOMEM;
+    }
+
+    rc = sqlite3_exec( Db, sql, NULL, NULL, NULL );
+
+    sqlite3_free( sql );
+    return rc;
+}
+
+int
+PartitionCatalogRecord (
+    sqlite3 *Db,
+    const char *Schema,
+    const char *FileName,
+    PARTITION_WINDOW Window,
+    long long WindowStart,
+    const PARTITION_RANGE *Range
+    )
+/*++
+
+Routine Description:
+
+    Adds the rows in Range to the catalog entry of a partition, creating
+    the entry if needed.  An empty range only registers the file.  Run it
+    in the transaction that commits those rows.
+
+--*/
+{
+    sqlite3_stmt *stmt = NULL;
+    char *sql;
+    int rc;
+
+    sql = sqlite3_mprintf( "INSERT INTO \"%w\".Partitions"
+                           " (FileName, WindowStart, WindowEnd, FirstTime, LastTime, FirstSeq, LastSeq, Rows)"
+                           " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)"
+                           " ON CONFLICT (FileName) DO UPDATE SET"
+                           "  FirstTime = MIN(IFNULL(FirstTime, excluded.FirstTime), IFNULL(excluded.FirstTime, FirstTime)),"
+                           "  LastTime = MAX(IFNULL(LastTime, excluded.LastTime), IFNULL(excluded.LastTime, LastTime)),"
+                           "  FirstSeq = MIN(IFNULL(FirstSeq, excluded.FirstSeq), IFNULL(excluded.FirstSeq, FirstSeq)),"
+                           "  LastSeq = MAX(IFNULL(LastSeq, excluded.LastSeq), IFNULL(excluded.LastSeq, LastSeq)),"
+                           "  Rows = Rows + excluded.Rows;",
+                           Schema );
+
+    if (sql == NULL) {
+
+        return SQLITE_NOMEM;
+    }
+
+    rc = sqlite3_prepare_v2( Db, sql, -1, &stmt, NULL );
+    sqlite3_free( sql );
+
+    if (rc != SQLITE_OK) {
+
+        return rc;
+    }
+
+    sqlite3_bind_text( stmt, 1, FileName, -1, SQLITE_TRANSIENT );
+    sqlite3_bind_int64( stmt, 2, WindowStart );
+    sqlite3_bind_int64( stmt, 3, WindowStart + PartitionWindowLength( Window ) );
+
+    if (Range->Rows != 0) {
+
+        sqlite3_bind_int64( stmt, 4, Range->FirstTime );
+        sqlite3_bind_int64( stmt, 5, Range->LastTime );
+        sqlite3_bind_int64( stmt, 6, Range->FirstSeq );
+        sqlite3_bind_int64( stmt, 7, Range->LastSeq );
+    }
+
+    sqlite3_bind_int64( stmt, 8, Range->Rows );
+
+    rc = sqlite3_step( stmt );
+    sqlite3_finalize( stmt );
+
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+static int
+PartitionRemoveFile (
+    const char *FileName
+    )
+/*++
+
+Routine Description:
+
+    Deletes a partition and the journal files SQLite may have left next to
+    it.
+
+Return Value:
+
+    Nonzero if the partition is gone.  Deleting fails while another process
+    still has the file open, the caller then tries again later.
+
+--*/
+{
+    char sideName[1024];
+    size_t index;
+
+    if (remove( FileName ) != 0 && errno != ENOENT) {
+
+        return 0;
+    }
+
+    for (index = 0; index < sizeof( PartitionSideFiles ) / sizeof( PartitionSideFiles[0] ); index++) {
+
+        if (snprintf( sideName, sizeof( sideName ), "%s%s", FileName, PartitionSideFiles[index] ) < (int)sizeof( sideName )) {
+
+            remove( sideName );
+        }
+    }
+
+    return 1;
+}
+
+int
+PartitionRetain (
+    sqlite3 *Db,
+    const char *Schema,
+    PARTITION_WINDOW Window,
+    long long Now,
+    unsigned int Keep,
+    const char *Current
+    )
+/*++
+
+Routine Description:
+
+    Deletes the partitions that fell out of the retention period and their
+    catalog entries.  The window holding Now and the Keep - 1 windows
+    before it are kept.
+
+Arguments:
+
+    Db - Connection the catalog is reachable from.
+
+    Schema - Schema of the catalog on Db.
+
+    Window - The partitioning in use.
+
+    Now - Current time.
+
+    Keep - Number of windows to keep, 0 keeps everything.
+
+    Current - The partition being written, never removed.
+
+Return Value:
+
+    SQLITE_OK, or the SQLite error that stopped the sweep.
+
+--*/
+{
+    sqlite3_stmt *stmt = NULL;
+    char **expired = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t index;
+    size_t length;
+    long long cutoff;
+    char *sql;
+    int rc;
+
+    if (Keep == 0 || Window == PartitionNone) {
+
+        return SQLITE_OK;
+    }
+
+    cutoff = PartitionWindowStart( Window, Now ) - (long long)(Keep - 1) * PartitionWindowLength( Window );
+
+    sql = sqlite3_mprintf( "SELECT FileName FROM \"%w\".Partitions"
+                           " WHERE WindowEnd <= ?1 AND FileName <> ?2"
+                           " ORDER BY WindowStart;",
+                           Schema );
+
+    if (sql == NULL) {
+
+        return SQLITE_NOMEM;
+    }
+
+    rc = sqlite3_prepare_v2( Db, sql, -1, &stmt, NULL );
+    sqlite3_free( sql );
+
+    if (rc != SQLITE_OK) {
+
+        return rc;
+    }
+
+    sqlite3_bind_int64( stmt, 1, cutoff );
+    sqlite3_bind_text( stmt, 2, Current, -1, SQLITE_TRANSIENT );
+
+    //
+    //  Collect the names first, the catalog is changed below.
+    //
+
+    while ((rc = sqlite3_step( stmt )) == SQLITE_ROW) {
+
+        if (count == capacity) {
+
+            char **grown;
+
+            capacity = capacity ? capacity * 2 : 16;
+            grown = realloc( expired, capacity * sizeof( char * ) );
+
+            if (grown == NULL) {
+
+                rc = SQLITE_NOMEM;
+                break;
+            }
+
+            expired = grown;
+        }
+
+        length = (size_t)sqlite3_column_bytes( stmt, 0 ) + 1;
+        expired[count] = malloc( length );
+
+        if (expired[count] == NULL) {
+
+            rc = SQLITE_NOMEM;
+            break;
+        }
+
+        memcpy( expired[count], sqlite3_column_text( stmt, 0 ), length );
+        count++;
+    }
+
+    sqlite3_finalize( stmt );
+    stmt = NULL;
+
+    if (rc == SQLITE_DONE) {
+
+        sql = sqlite3_mprintf( "DELETE FROM \"%w\".Partitions WHERE FileName = ?1;", Schema );
+        rc = (sql == NULL) ? SQLITE_NOMEM : sqlite3_prepare_v2( Db, sql, -1, &stmt, NULL );
+        sqlite3_free( sql );
+    }
+
+    for (index = 0; index < count; index++) {
+
+        if (rc == SQLITE_OK && PartitionRemoveFile( expired[index] )) {
+
+            printf( "Partition: removed %s\n", expired[index] );
+
+            sqlite3_bind_text( stmt, 1, expired[index], -1, SQLITE_TRANSIENT );
+
+            if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+                rc = sqlite3_errcode( Db );
+            }
+
+            sqlite3_reset( stmt );
+        }
+
+        free( expired[index] );
+    }
+
+    sqlite3_finalize( stmt );
+    free( expired );
+
+    return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+static void
+PartitionAppendLog (
+    sqlite3 *Db,
+    sqlite3_str *View,
+    const char *Schema
+    )
+/*++
+
+Routine Description:
+
+    Appends the select of one database's MinifilterLog to AllLog, with the
+    name of each row's file from its Files table as FilePath.  Databases
+    no writer has opened since FileID was added get the missing columns as
+    NULL.
+
+--*/
+{
+    sqlite3_stmt *probe = NULL;
+    char *sql;
+    int hasFileId;
+    int hasFiles;
+
+    sql = sqlite3_mprintf( "SELECT FileID FROM \"%w\".MinifilterLog LIMIT 0;", Schema );
+    hasFileId = (sql != NULL && sqlite3_prepare_v2( Db, sql, -1, &probe, NULL ) == SQLITE_OK);
+    sqlite3_finalize( probe );
+    sqlite3_free( sql );
+
+    probe = NULL;
+    sql = sqlite3_mprintf( "SELECT FileID, Path FROM \"%w\".Files LIMIT 0;", Schema );
+    hasFiles = (sql != NULL && sqlite3_prepare_v2( Db, sql, -1, &probe, NULL ) == SQLITE_OK);
+    sqlite3_finalize( probe );
+    sqlite3_free( sql );
+
+    if (hasFileId && hasFiles) {
+
+        sqlite3_str_appendf( View,
+                             "SELECT l.*, COALESCE(f.Path, l.OpFileName) AS FilePath"
+                             " FROM \"%w\".MinifilterLog l LEFT JOIN \"%w\".Files f ON f.FileID = l.FileID",
+                             Schema,
+                             Schema );
+
+    } else {
+
+        //
+        //  FileID is the last column of MinifilterLog.
+        //
+
+        sqlite3_str_appendf( View,
+                             "SELECT *, %sOpFileName AS FilePath FROM \"%w\".MinifilterLog",
+                             hasFileId ? "" : "NULL AS FileID, ",
+                             Schema );
+    }
+}
+
+int
+PartitionAttach (
+    sqlite3 *Db,
+    long long From,
+    long long To
+    )
+/*++
+
+Routine Description:
+
+    Attaches the partitions holding rows between From and To to a
+    connection on the main database and creates the temporary view AllLog,
+    the union of MinifilterLog in the main database and in every attached
+    partition.  Queries against AllLog should still filter on PreOpTime,
+    partitions only narrow down the files that are read.
+
+    AllLog adds FilePath to the columns of MinifilterLog, the name of the
+    file of the row from the Files table of its own database, or the
+    OpFileName of rows logged before Files existed.  FileIDs are only
+    unique within one database, so compare names across partitions.
+
+    main.MinifilterLog must have the same columns as the partitions, open
+    it through the log writer's upgrade first.
+
+Arguments:
+
+    Db - Connection on the main database.
+
+    From - Start of the time range, inclusive.
+
+    To - End of the time range, exclusive.
+
+Return Value:
+
+    The number of partitions attached, or -1 on error.  SQLite limits the
+    number of attached databases, the limit is raised as far as the build
+    of SQLite allows, SQLITE_MAX_ATTACHED, and a range holding more
+    partitions than that fails rather than leaving the newest out.
+
+--*/
+{
+    sqlite3_stmt *stmt = NULL;
+    sqlite3_str *view;
+    char *viewSql;
+    char *attach;
+    char schema[32];
+    FILE *probe;
+    int limit;
+    int attached = 0;
+    int index;
+    int rc;
+
+    //
+    //  Values past the hard limit SQLite was built with are cut down to
+    //  it.
+    //
+
+    sqlite3_limit( Db, SQLITE_LIMIT_ATTACHED, INT_MAX );
+    limit = sqlite3_limit( Db, SQLITE_LIMIT_ATTACHED, -1 );
+
+    sqlite3_exec( Db, "DROP VIEW IF EXISTS temp.AllLog;", NULL, NULL, NULL );
+
+    view = sqlite3_str_new( Db );
+    sqlite3_str_appendall( view, "CREATE TEMP VIEW AllLog AS " );
+    PartitionAppendLog( Db, view, "main" );
+
+    //
+    //  Without a catalog partitioning was never turned on, only the main
+    //  database holds rows.
+    //
+
+    rc = sqlite3_prepare_v2( Db,
+                             "SELECT FileName FROM main.Partitions"
+                             " WHERE MIN(WindowStart, IFNULL(FirstTime, WindowStart)) < ?2"
+                             "   AND WindowEnd > ?1"
+                             " ORDER BY WindowStart;",
+                             -1,
+                             &stmt,
+                             NULL );
+
+    if (rc == SQLITE_OK) {
+
+        sqlite3_bind_int64( stmt, 1, From );
+        sqlite3_bind_int64( stmt, 2, To );
+
+        while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+            const char *fileName = (const char *)sqlite3_column_text( stmt, 0 );
+
+            //
+            //  ATTACH creates missing files, skip partitions that were
+            //  deleted behind the catalog's back.
+            //
+
+            probe = fopen( fileName, "rb" );
+
+            if (probe == NULL) {
+
+                continue;
+            }
+
+            fclose( probe );
+
+            if (attached >= limit) {
+
+                printf( "Partition: more than %d partitions in range, the most SQLite attaches, narrow the range\n", limit );
+                attached = -1;
+                break;
+            }
+
+            attach = sqlite3_mprintf( "ATTACH DATABASE %Q AS \"" PARTITION_SCHEMA_PREFIX "%d\";", fileName, attached );
+
+            if (attach == NULL || sqlite3_exec( Db, attach, NULL, NULL, NULL ) != SQLITE_OK) {
+
+                printf( "Partition: could not attach %s: %s\n", fileName, sqlite3_errmsg( Db ) );
+                sqlite3_free( attach );
+                continue;
+            }
+
+            sqlite3_free( attach );
+
+            sqlite3_snprintf( sizeof( schema ), schema, PARTITION_SCHEMA_PREFIX "%d", attached );
+            sqlite3_str_appendall( view, " UNION ALL " );
+            PartitionAppendLog( Db, view, schema );
+            attached++;
+        }
+
+        sqlite3_finalize( stmt );
+    }
+
+    sqlite3_str_appendall( view, ";" );
+    viewSql = sqlite3_str_finish( view );
+
+    if (attached < 0) {
+
+        //
+        //  Let go of the ones attached, the caller gets nothing.
+        //
+
+        for (index = 0; index < limit; index++) {
+
+            attach = sqlite3_mprintf( "DETACH DATABASE \"" PARTITION_SCHEMA_PREFIX "%d\";", index );
+            sqlite3_exec( Db, attach, NULL, NULL, NULL );
+            sqlite3_free( attach );
+        }
+
+        sqlite3_free( viewSql );
+        return -1;
+    }
+
+    if (viewSql == NULL) {
+
+        return -1;
+    }
+
+    rc = sqlite3_exec( Db, viewSql, NULL, NULL, NULL );
+    sqlite3_free( viewSql );
+
+    if (rc != SQLITE_OK) {
+
+        printf( "Partition: could not create AllLog: %s\n", sqlite3_errmsg( Db ) );
+        return -1;
+    }
+
+    return attached;
+}
+
+void
+PartitionPrintCatalog (
+    sqlite3 *Db
+    )
+{
+    sqlite3_stmt *stmt = NULL;
+    char firstTime[32];
+    char lastTime[32];
+
+    if (sqlite3_prepare_v2( Db,
+                            "SELECT FileName, FirstTime, LastTime, Rows"
+                            " FROM main.Partitions ORDER BY WindowStart;",
+                            -1,
+                            &stmt,
+                            NULL ) != SQLITE_OK) {
+
+        printf( "    No partitions\n" );
+        return;
+    }
+
+    printf( "    %-40s %-19s   %-19s %12s\n", "File", "First", "Last", "Rows" );
+
+    while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        if (sqlite3_column_type( stmt, 1 ) == SQLITE_NULL) {
+
+            strcpy( firstTime, "-" );
+            strcpy( lastTime, "-" );
+
+        } else {
+
+            PartitionFormatTime( sqlite3_column_int64( stmt, 1 ), firstTime, sizeof( firstTime ) );
+            PartitionFormatTime( sqlite3_column_int64( stmt, 2 ), lastTime, sizeof( lastTime ) );
+        }
+
+        printf( "    %-40s %-19s - %-19s %12lld\n",
+                (const char *)sqlite3_column_text( stmt, 0 ),
+                firstTime,
+                lastTime,
+                sqlite3_column_int64( stmt, 3 ) );
+    }
+
+    sqlite3_finalize( stmt );
+}
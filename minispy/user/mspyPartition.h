@@ -0,0 +1,128 @@
+/*++
+
+Module Name:
+
+    mspyPartition.h
+
+Abstract:
+
+    Splits MinifilterLog into one database file per hour or per day.  The
+    main database keeps a Partitions catalog with the time and sequence
+    range held by every file, so old partitions can be removed by deleting
+    the file and queries only attach the files that overlap the time range
+    they ask for.
+
+    Times are in the same 100ns units since 1601 as PreOpTime.  Windows are
+    aligned to UTC.
+
+    The module only uses the C runtime and SQLite so it builds on any
+    platform.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYPARTITION_H__
+#define __MSPYPARTITION_H__
+
+#include <stddef.h>
+#include <sqlite3.h>
+
+typedef enum _PARTITION_WINDOW {
+
+    PartitionNone,          // everything in the main database
+    PartitionHourly,
+    PartitionDaily
+
+} PARTITION_WINDOW;
+
+//
+//  Range of the rows written to a partition, accumulated by the writer
+//  between two catalog updates.  Rows is 0 when nothing was added.
+//
+
+typedef struct _PARTITION_RANGE {
+
+    long long FirstTime;
+    long long LastTime;
+    long long FirstSeq;
+    long long LastSeq;
+    long long Rows;
+
+} PARTITION_RANGE, *PPARTITION_RANGE;
+
+//
+//  Schema name the writer attaches the main database under, and the prefix
+//  PartitionAttach uses for the partitions it attaches.
+//
+
+#define PARTITION_CATALOG_SCHEMA    "catalog"
+#define PARTITION_SCHEMA_PREFIX     "p"
+
+long long
+PartitionWindowLength (
+    PARTITION_WINDOW Window
+    );
+
+long long
+PartitionWindowStart (
+    PARTITION_WINDOW Window,
+    long long Time
+    );
+
+int
+PartitionFileName (
+    const char *Base,
+    PARTITION_WINDOW Window,
+    long long WindowStart,
+    char *Buffer,
+    size_t BufferSize
+    );
+
+void
+PartitionRangeAdd (
+    PPARTITION_RANGE Range,
+    long long Time,
+    long long Sequence
+    );
+
+int
+PartitionCatalogCreate (
+    sqlite3 *Db,
+    const char *Schema
+    );
+
+int
+PartitionCatalogRecord (
+    sqlite3 *Db,
+    const char *Schema,
+    const char *FileName,
+    PARTITION_WINDOW Window,
+    long long WindowStart,
+    const PARTITION_RANGE *Range
+    );
+
+int
+PartitionRetain (
+    sqlite3 *Db,
+    const char *Schema,
+    PARTITION_WINDOW Window,
+    long long Now,
+    unsigned int Keep,
+    const char *Current
+    );
+
+int
+PartitionAttach (
+    sqlite3 *Db,
+    long long From,
+    long long To
+    );
+
+void
+PartitionPrintCatalog (
+    sqlite3 *Db
+    );
+
+#endif //__MSPYPARTITION_H__
@@ -0,0 +1,427 @@
+/*++
+
+Module Name:
+
+    mspyPort.c
+
+Abstract:
+
+    The connection to the filter, over its communication port or over a
+    local socket to a stand-in for it.
+
+    A PORT is a transport and its handle.  The filter's port is used
+    through FilterSendMessage as before.  The local transport sends each
+    message framed as minispy.h describes and waits for the reply, one
+    message at a time since the logging thread and the command loop share
+    the connection.  A stand-in that goes away looks like a filter that
+    unloaded: every further message fails with ERROR_INVALID_HANDLE.
+
+    Local sockets need Windows 10 1803 or later.  The stand-in may run in
+    WSL, whose sockets Windows programs can connect to by path.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+#include <fltUser.h>
+#include "minispy.h"
+#include "mspyPort.h"
+
+typedef HRESULT
+(*PORT_SEND) (
+    _In_ PPORT Port,
+    _In_reads_bytes_(InBufferSize) LPVOID InBuffer,
+    _In_ DWORD InBufferSize,
+    _Out_writes_bytes_to_opt_(OutBufferSize, *BytesReturned) LPVOID OutBuffer,
+    _In_ DWORD OutBufferSize,
+    _Out_ LPDWORD BytesReturned
+    );
+
+typedef VOID
+(*PORT_CLOSE) (
+    _In_ PPORT Port
+    );
+
+typedef struct _PORT_TRANSPORT {
+
+    PORT_SEND Send;
+    PORT_CLOSE Close;
+
+} PORT_TRANSPORT, *PPORT_TRANSPORT;
+
+struct _PORT {
+
+    const PORT_TRANSPORT *Transport;
+
+    //
+    //  The filter's port.
+    //
+
+    HANDLE Handle;
+
+    //
+    //  The local socket, INVALID_SOCKET once the stand-in went away.  Lock
+    //  keeps a request and its reply together.
+    //
+
+    SOCKET Socket;
+    SRWLOCK Lock;
+};
+
+//
+//  Filter communication port
+//
+
+static HRESULT
+PortFilterSend (
+    _In_ PPORT Port,
+    _In_reads_bytes_(InBufferSize) LPVOID InBuffer,
+    _In_ DWORD InBufferSize,
+    _Out_writes_bytes_to_opt_(OutBufferSize, *BytesReturned) LPVOID OutBuffer,
+    _In_ DWORD OutBufferSize,
+    _Out_ LPDWORD BytesReturned
+    )
+{
+    return FilterSendMessage( Port->Handle,
+                              InBuffer,
+                              InBufferSize,
+                              OutBuffer,
+                              OutBufferSize,
+                              BytesReturned );
+}
+
+static VOID
+PortFilterClose (
+    _In_ PPORT Port
+    )
+{
+    CloseHandle( Port->Handle );
+}
+
+static const PORT_TRANSPORT PortFilterTransport = {
+    PortFilterSend,
+    PortFilterClose
+};
+
+//
+//  Local socket
+//
+
+static BOOLEAN
+PortLocalTransfer (
+    _In_ SOCKET Socket,
+    _Inout_updates_bytes_(Size) PVOID Buffer,
+    _In_ DWORD Size,
+    _In_ BOOLEAN Receive
+    )
+{
+    int done;
+
+    while (Size > 0) {
+
+        done = Receive ? recv( Socket, (char *)Buffer, (int)min( Size, MAXLONG ), 0 ) :
+                         send( Socket, (const char *)Buffer, (int)min( Size, MAXLONG ), 0 );
+
+        if (done <= 0) {
+
+            return FALSE;
+        }
+
+        Buffer = Add2Ptr( Buffer, done );
+        Size -= (DWORD)done;
+    }
+
+    return TRUE;
+}
+
+static HRESULT
+PortLocalSend (
+    _In_ PPORT Port,
+    _In_reads_bytes_(InBufferSize) LPVOID InBuffer,
+    _In_ DWORD InBufferSize,
+    _Out_writes_bytes_to_opt_(OutBufferSize, *BytesReturned) LPVOID OutBuffer,
+    _In_ DWORD OutBufferSize,
+    _Out_ LPDWORD BytesReturned
+    )
+{
+    MINISPY_LOCAL_REQUEST request;
+    MINISPY_LOCAL_REPLY reply;
+    HRESULT hResult = HRESULT_FROM_WIN32( ERROR_INVALID_HANDLE );
+
+    *BytesReturned = 0;
+
+    request.InputSize = InBufferSize;
+    request.OutputSize = (OutBuffer != NULL) ? OutBufferSize : 0;
+
+    AcquireSRWLockExclusive( &Port->Lock );
+
+    if (Port->Socket == INVALID_SOCKET) {
+
+        goto Exit;
+    }
+
+    if (!PortLocalTransfer( Port->Socket, &request, sizeof( request ), FALSE ) ||
+        !PortLocalTransfer( Port->Socket, InBuffer, InBufferSize, FALSE ) ||
+        !PortLocalTransfer( Port->Socket, &reply, sizeof( reply ), TRUE ) ||
+        reply.BytesReturned > request.OutputSize ||
+        !PortLocalTransfer( Port->Socket, OutBuffer, reply.BytesReturned, TRUE )) {
+
+        closesocket( Port->Socket );
+        Port->Socket = INVALID_SOCKET;
+        goto Exit;
+    }
+
+    *BytesReturned = reply.BytesReturned;
+    hResult = reply.Status;
+
+Exit:
+
+    ReleaseSRWLockExclusive( &Port->Lock );
+
+    return hResult;
+}
+
+static VOID
+PortLocalClose (
+    _In_ PPORT Port
+    )
+{
+    if (Port->Socket != INVALID_SOCKET) {
+
+        closesocket( Port->Socket );
+    }
+
+    WSACleanup();
+}
+
+static const PORT_TRANSPORT PortLocalTransport = {
+    PortLocalSend,
+    PortLocalClose
+};
+
+HRESULT
+PortConnectFilter (
+    _Outptr_ PPORT *Port
+    )
+/*++
+
+Routine Description:
+
+    Connects to the filter's communication port.
+
+Arguments:
+
+    Port - Receives the connection.
+
+Return Value:
+
+    What FilterConnectCommunicationPort returned.
+
+--*/
+{
+    PPORT port;
+    HRESULT hResult;
+
+    *Port = NULL;
+
+    port = calloc( 1, sizeof( PORT ) );
+
+    if (port == NULL) {
+
+        return E_OUTOFMEMORY;
+    }
+
+    hResult = FilterConnectCommunicationPort( MINISPY_PORT_NAME,
+                                              0,
+                                              NULL,
+                                              0,
+                                              NULL,
+                                              &port->Handle );
+
+    if (IS_ERROR( hResult )) {
+
+        free( port );
+        return hResult;
+    }
+
+    port->Transport = &PortFilterTransport;
+    *Port = port;
+
+    return S_OK;
+}
+
+HRESULT
+PortConnectLocal (
+    _In_z_ const char *Path,
+    _Outptr_ PPORT *Port
+    )
+/*++
+
+Routine Description:
+
+    Connects to a stand-in for the filter listening on a local socket, and
+    checks it speaks this version of the messages.
+
+Arguments:
+
+    Path - Path of the socket.
+
+    Port - Receives the connection.
+
+Return Value:
+
+    S_OK, the error of the connection, or ERROR_REVISION_MISMATCH if the
+    stand-in was built with another major version of minispy.h.
+
+--*/
+{
+    struct sockaddr_un address;
+    WSADATA wsaData;
+    COMMAND_MESSAGE commandMessage;
+    MINISPYVER version;
+    DWORD bytesReturned;
+    PPORT port;
+    HRESULT hResult;
+    int error;
+
+    *Port = NULL;
+
+    if (strlen( Path ) >= sizeof( address.sun_path )) {
+
+        return HRESULT_FROM_WIN32( ERROR_BAD_PATHNAME );
+    }
+
+    error = WSAStartup( MAKEWORD( 2, 2 ), &wsaData );
+
+    if (error != 0) {
+
+        return HRESULT_FROM_WIN32( error );
+    }
+
+    port = calloc( 1, sizeof( PORT ) );
+
+    if (port == NULL) {
+
+        WSACleanup();
+        return E_OUTOFMEMORY;
+    }
+
+    port->Transport = &PortLocalTransport;
+    InitializeSRWLock( &port->Lock );
+
+    port->Socket = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+    if (port->Socket == INVALID_SOCKET) {
+
+        hResult = HRESULT_FROM_WIN32( WSAGetLastError() );
+        goto Fail;
+    }
+
+    memset( &address, 0, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+    strcpy_s( address.sun_path, sizeof( address.sun_path ), Path );
+
+    if (connect( port->Socket, (struct sockaddr *)&address, sizeof( address ) ) == SOCKET_ERROR) {
+
+        hResult = HRESULT_FROM_WIN32( WSAGetLastError() );
+        goto Fail;
+    }
+
+    commandMessage.Command = GetMiniSpyVersion;
+    commandMessage.Reserved = 0;
+
+    hResult = PortLocalSend( port,
+                             &commandMessage,
+                             sizeof( COMMAND_MESSAGE ),
+                             &version,
+                             sizeof( version ),
+                             &bytesReturned );
+
+    if (IS_ERROR( hResult )) {
+
+        goto Fail;
+    }
+
+    if (bytesReturned < sizeof( version ) || version.Major != MINISPY_MAJ_VERSION) {
+
+        hResult = HRESULT_FROM_WIN32( ERROR_REVISION_MISMATCH );
+        goto Fail;
+    }
+
+    *Port = port;
+
+    return S_OK;
+
+Fail:
+
+    PortClose( port );
+
+    return hResult;
+}
+
+HRESULT
+PortSendMessage (
+    _In_opt_ PPORT Port,
+    _In_reads_bytes_(InBufferSize) LPVOID InBuffer,
+    _In_ DWORD InBufferSize,
+    _Out_writes_bytes_to_opt_(OutBufferSize, *BytesReturned) LPVOID OutBuffer,
+    _In_ DWORD OutBufferSize,
+    _Out_ LPDWORD BytesReturned
+    )
+/*++
+
+Routine Description:
+
+    Sends a message to the filter, or its stand-in, and waits for the
+    reply, as FilterSendMessage does.
+
+Arguments:
+
+    Port - The connection, NULL when running without one.
+
+    InBuffer, InBufferSize - The COMMAND_MESSAGE.
+
+    OutBuffer, OutBufferSize - Where the reply goes.
+
+    BytesReturned - Receives how much of OutBuffer the reply filled.
+
+Return Value:
+
+    What FilterSendMessage returns for the message, ERROR_NOT_CONNECTED
+    without a connection.
+
+--*/
+{
+    if (Port == NULL) {
+
+        *BytesReturned = 0;
+        return HRESULT_FROM_WIN32( ERROR_NOT_CONNECTED );
+    }
+
+    return Port->Transport->Send( Port,
+                                  InBuffer,
+                                  InBufferSize,
+                                  OutBuffer,
+                                  OutBufferSize,
+                                  BytesReturned );
+}
+
+VOID
+PortClose (
+    _In_ PPORT Port
+    )
+{
+    Port->Transport->Close( Port );
+    free( Port );
+}
@@ -0,0 +1,52 @@
+/*++
+
+Module Name:
+
+    mspyPort.h
+
+Abstract:
+
+    The connection to the filter.  Either the filter's communication port,
+    or a local socket served by a stand-in for the filter, tools/mspyFake.c,
+    so the client can be run end to end without the driver.  Messages have
+    the same contents and results over both.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYPORT_H__
+#define __MSPYPORT_H__
+
+#include <windows.h>
+
+typedef struct _PORT PORT, *PPORT;
+
+HRESULT
+PortConnectFilter (
+    _Outptr_ PPORT *Port
+    );
+
+HRESULT
+PortConnectLocal (
+    _In_z_ const char *Path,
+    _Outptr_ PPORT *Port
+    );
+
+HRESULT
+PortSendMessage (
+    _In_opt_ PPORT Port,
+    _In_reads_bytes_(InBufferSize) LPVOID InBuffer,
+    _In_ DWORD InBufferSize,
+    _Out_writes_bytes_to_opt_(OutBufferSize, *BytesReturned) LPVOID OutBuffer,
+    _In_ DWORD OutBufferSize,
+    _Out_ LPDWORD BytesReturned
+    );
+
+VOID
+PortClose (
+    _In_ PPORT Port
+    );
+
+#endif //__MSPYPORT_H__
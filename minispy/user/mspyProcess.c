@@ -0,0 +1,680 @@
+/*++
+
+Module Name:
+
+    mspyProcess.c
+
+Abstract:
+
+    Keeps the processes the filter reports as they are created and exit,
+    and finds the one that issued an operation from its process id and
+    time alone.
+
+    A process id is only unique while the process runs, so entries are
+    keyed by id and create time.  An operation belongs to the newest
+    process with its id created before it, unless that one is known to
+    have exited before it.  Exited processes stay for PROCESS_TABLE_LINGER
+    so the records of their last operations, which may reach us after the
+    exit, still find them, then are dropped.
+
+    Processes started before the filter are never reported.
+    ProcessTableAttribute asks the caller's query about those and adds
+    them with Queried set, see PROCESS_TABLE_RECHECK.  What the query
+    finds never replaces what the filter reported, and a process it finds
+    created after an operation is not given the operation.
+
+    Every process is also written to the Processes table of the writer's
+    connection when it is created and again when it exits.
+
+    Nothing here calls the system but through the query.  Only the log
+    writer thread calls in here, the counters are read from the console.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyProcess.h"
+
+typedef struct _PROCESS_TABLE_STATS {
+
+    ULONGLONG Lookups;
+    ULONGLONG Misses;
+    ULONGLONG Reported;
+    ULONGLONG Queried;
+    ULONGLONG Exited;
+    ULONGLONG Expired;
+    ULONG Entries;
+
+} PROCESS_TABLE_STATS;
+
+typedef struct _PROCESS_TABLE_STATE {
+
+    PPROCESS_ENTRY *Buckets;
+    ULONG BucketCount;              // 0 until the first process is added
+
+    LONGLONG LastSweep;
+
+    sqlite3_stmt *Write;
+    sqlite3 *Db;
+
+    PROCESS_TABLE_STATS Stats;
+
+} PROCESS_TABLE_STATE;
+
+static PROCESS_TABLE_STATE ProcessTable;
+
+static ULONG
+ProcessTableBucket (
+    _In_ ULONG_PTR ProcessId
+    )
+{
+    //
+    //  Process ids are multiples of 4.
+    //
+
+    return (ULONG)(((ULONGLONG)ProcessId >> 2) * 0x9E3779B97F4A7C15ULL >> 32) & (ProcessTable.BucketCount - 1);
+}
+
+static PPROCESS_ENTRY
+ProcessTableChain (
+    _In_ ULONG_PTR ProcessId
+    )
+{
+    return (ProcessTable.BucketCount != 0) ? ProcessTable.Buckets[ProcessTableBucket( ProcessId )] : NULL;
+}
+
+static BOOLEAN
+ProcessTableGrow (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Doubles the buckets and moves the processes into them.
+
+--*/
+{
+    PPROCESS_ENTRY *oldBuckets = ProcessTable.Buckets;
+    ULONG oldCount = ProcessTable.BucketCount;
+    ULONG newCount = oldCount ? oldCount * 2 : PROCESS_TABLE_INITIAL_BUCKETS;
+    PPROCESS_ENTRY *newBuckets;
+    PPROCESS_ENTRY entry;
+    ULONG index;
+    ULONG bucket;
+
+    newBuckets = calloc( newCount, sizeof( PPROCESS_ENTRY ) );
+
+    if (newBuckets == NULL) {
+
+        return FALSE;
+    }
+
+    ProcessTable.Buckets = newBuckets;
+    ProcessTable.BucketCount = newCount;
+
+    for (index = 0; index < oldCount; index++) {
+
+        while ((entry = oldBuckets[index]) != NULL) {
+
+            oldBuckets[index] = entry->Next;
+
+            bucket = ProcessTableBucket( entry->ProcessId );
+            entry->Next = newBuckets[bucket];
+            newBuckets[bucket] = entry;
+        }
+    }
+
+    free( oldBuckets );
+
+    return TRUE;
+}
+
+static VOID
+ProcessTableFree (
+    _In_ PPROCESS_ENTRY Entry
+    )
+{
+    free( Entry->ImagePath );
+    free( Entry->NativeImagePath );
+    free( Entry );
+    ProcessTable.Stats.Entries--;
+}
+
+static VOID
+ProcessTableWriteRow (
+    _In_ PPROCESS_ENTRY Entry
+    )
+/*++
+
+Routine Description:
+
+    Inserts a process into Processes, or records its exit if it is there.
+
+--*/
+{
+    sqlite3_stmt *stmt = ProcessTable.Write;
+
+    if (stmt == NULL) {
+
+        return;
+    }
+
+    sqlite3_bind_int64( stmt, 1, (sqlite3_int64)Entry->ProcessId );
+    sqlite3_bind_int64( stmt, 2, Entry->CreateTime );
+
+    if (Entry->ExitTime != 0) {
+
+        sqlite3_bind_int64( stmt, 3, Entry->ExitTime );
+        sqlite3_bind_int64( stmt, 4, (sqlite3_int64)Entry->ExitStatus );
+
+    } else {
+
+        sqlite3_bind_null( stmt, 3 );
+        sqlite3_bind_null( stmt, 4 );
+    }
+
+    if (Entry->Queried) {
+
+        sqlite3_bind_null( stmt, 5 );
+        sqlite3_bind_null( stmt, 6 );
+        sqlite3_bind_null( stmt, 7 );
+
+    } else {
+
+        sqlite3_bind_int64( stmt, 5, (sqlite3_int64)Entry->ParentProcessId );
+
+        if (Entry->ParentCreateTime != 0) {
+
+            sqlite3_bind_int64( stmt, 6, Entry->ParentCreateTime );
+
+        } else {
+
+            sqlite3_bind_null( stmt, 6 );
+        }
+
+        sqlite3_bind_int64( stmt, 7, (sqlite3_int64)Entry->CreatingThreadId );
+    }
+
+    sqlite3_bind_text( stmt, 8, Entry->ImagePath, -1, SQLITE_STATIC );
+    sqlite3_bind_text16( stmt, 9, Entry->NativeImagePath, -1, SQLITE_STATIC );
+    sqlite3_bind_text( stmt, 10, Entry->Queried ? "Query" : "Filter", -1, SQLITE_STATIC );
+
+    if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+        WriteToLogAnsi( "SQLite insert failed on Process: %s", sqlite3_errmsg( ProcessTable.Db ) );
+    }
+
+    sqlite3_reset( stmt );
+}
+
+static VOID
+ProcessTableSweep (
+    _In_ LONGLONG Now
+    )
+/*++
+
+Routine Description:
+
+    Drops the processes that exited more than PROCESS_TABLE_LINGER ago,
+    once per PROCESS_TABLE_LINGER.
+
+--*/
+{
+    PPROCESS_ENTRY *link;
+    PPROCESS_ENTRY entry;
+    ULONG bucket;
+
+    if (Now < ProcessTable.LastSweep + PROCESS_TABLE_LINGER) {
+
+        return;
+    }
+
+    ProcessTable.LastSweep = Now;
+
+    for (bucket = 0; bucket < ProcessTable.BucketCount; bucket++) {
+
+        link = &ProcessTable.Buckets[bucket];
+
+        while (*link != NULL) {
+
+            entry = *link;
+
+            if (entry->ExitTime == 0 || entry->ExitTime + PROCESS_TABLE_LINGER > Now) {
+
+                link = &entry->Next;
+                continue;
+            }
+
+            *link = entry->Next;
+            ProcessTableFree( entry );
+            ProcessTable.Stats.Expired++;
+        }
+    }
+}
+
+BOOLEAN
+ProcessTablePrepare (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Prepares the Processes writes on the writer's connection.  The table in
+    memory carries over from the previous connection.
+
+--*/
+{
+    ProcessTable.Db = Db;
+
+    if (sqlite3_prepare_v2( Db,
+                            "INSERT INTO Processes (ProcessId, CreateTime, ExitTime, ExitStatus,"
+                            " ParentProcessId, ParentCreateTime, CreatingThreadId, ImagePath,"
+                            " NativeImagePath, Source)"
+                            " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"
+                            " ON CONFLICT (ProcessId, CreateTime) DO UPDATE SET"
+                            " ExitTime = COALESCE(excluded.ExitTime, ExitTime),"
+                            " ExitStatus = COALESCE(excluded.ExitStatus, ExitStatus),"
+                            " ParentProcessId = COALESCE(excluded.ParentProcessId, ParentProcessId),"
+                            " ParentCreateTime = COALESCE(excluded.ParentCreateTime, ParentCreateTime),"
+                            " CreatingThreadId = COALESCE(excluded.CreatingThreadId, CreatingThreadId),"
+                            " ImagePath = COALESCE(ImagePath, excluded.ImagePath),"
+                            " NativeImagePath = COALESCE(NativeImagePath, excluded.NativeImagePath),"
+                            " Source = CASE WHEN excluded.Source = 'Filter' THEN 'Filter' ELSE Source END;",
+                            -1,
+                            &ProcessTable.Write,
+                            NULL ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "Failed to prepare process insert: %s", sqlite3_errmsg( Db ) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+ProcessTableFinalize (
+    VOID
+    )
+{
+    sqlite3_finalize( ProcessTable.Write );
+    ProcessTable.Write = NULL;
+    ProcessTable.Db = NULL;
+}
+
+PPROCESS_ENTRY
+ProcessTableCreate (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG CreateTime,
+    _In_ ULONG_PTR ParentProcessId,
+    _In_ LONGLONG ParentCreateTime,
+    _In_ ULONG_PTR CreatingThreadId,
+    _In_opt_z_ const char *ImagePath,
+    _In_opt_z_ const WCHAR *NativeImagePath,
+    _In_ BOOLEAN Queried,
+    _In_ LONGLONG Now
+    )
+/*++
+
+Routine Description:
+
+    Adds a process, replacing any entry with the same id and create time.
+    Written to Processes on the writer's connection, so call with the batch
+    open.
+
+Arguments:
+
+    ProcessId, CreateTime - The process.
+
+    ParentProcessId, ParentCreateTime, CreatingThreadId - Who created it,
+        unknown for a queried process.
+
+    ImagePath, NativeImagePath - Its image, NULL if not known.
+
+    Queried - TRUE if the caller looked the process up, FALSE if the filter
+        reported it.
+
+    Now - Current record time.
+
+Return Value:
+
+    The entry, or NULL if out of memory.
+
+--*/
+{
+    PPROCESS_ENTRY *bucket;
+    PPROCESS_ENTRY *link;
+    PPROCESS_ENTRY entry;
+    PPROCESS_ENTRY older;
+
+    ProcessTableSweep( Now );
+
+    //
+    //  Past one process a bucket on average the chains start to grow.  If
+    //  the table cannot grow it keeps working with longer chains.
+    //
+
+    if (ProcessTable.Stats.Entries >= ProcessTable.BucketCount &&
+        !ProcessTableGrow() &&
+        ProcessTable.BucketCount == 0) {
+
+        return NULL;
+    }
+
+    bucket = &ProcessTable.Buckets[ProcessTableBucket( ProcessId )];
+
+    //
+    //  What the filter reported is kept over what was looked up, which
+    //  has no parent.
+    //
+
+    if (Queried) {
+
+        for (entry = *bucket; entry != NULL; entry = entry->Next) {
+
+            if (entry->ProcessId == ProcessId && entry->CreateTime == CreateTime && !entry->Queried) {
+
+                return entry;
+            }
+        }
+    }
+
+    entry = calloc( 1, sizeof( PROCESS_ENTRY ) );
+
+    if (entry == NULL) {
+
+        return NULL;
+    }
+
+    entry->ProcessId = ProcessId;
+    entry->CreateTime = CreateTime;
+    entry->ParentProcessId = ParentProcessId;
+    entry->ParentCreateTime = ParentCreateTime;
+    entry->CreatingThreadId = CreatingThreadId;
+    entry->ImagePath = (ImagePath != NULL) ? _strdup( ImagePath ) : NULL;
+    entry->NativeImagePath = (NativeImagePath != NULL) ? _wcsdup( NativeImagePath ) : NULL;
+    entry->Queried = Queried;
+    entry->CheckedTime = Now;
+
+    //
+    //  A process reported twice, or looked up before its report arrived,
+    //  keeps only the newer entry.
+    //
+
+    for (link = bucket; *link != NULL; link = &(*link)->Next) {
+
+        if ((*link)->ProcessId == ProcessId && (*link)->CreateTime == CreateTime) {
+
+            older = *link;
+            *link = older->Next;
+            ProcessTableFree( older );
+            break;
+        }
+    }
+
+    //
+    //  Any other entry with this id is an earlier process whose exit was
+    //  not reported.  It is known to be gone by now, not how it ended.
+    //
+
+    for (older = *bucket; older != NULL; older = older->Next) {
+
+        if (older->ProcessId == ProcessId && older->ExitTime == 0 && older->CreateTime < CreateTime) {
+
+            older->ExitTime = CreateTime;
+            ProcessTableWriteRow( older );
+        }
+    }
+
+    entry->Next = *bucket;
+    *bucket = entry;
+
+    ProcessTable.Stats.Entries++;
+
+    if (Queried) {
+
+        ProcessTable.Stats.Queried++;
+
+    } else {
+
+        ProcessTable.Stats.Reported++;
+    }
+
+    ProcessTableWriteRow( entry );
+
+    return entry;
+}
+
+VOID
+ProcessTableExit (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG CreateTime,
+    _In_ LONGLONG ExitTime,
+    _In_ NTSTATUS ExitStatus
+    )
+/*++
+
+Routine Description:
+
+    Records that a process exited.  A process never seen is written to
+    Processes with what the exit tells of it.  Call with the batch open.
+
+--*/
+{
+    PPROCESS_ENTRY entry;
+    PROCESS_ENTRY unknown;
+
+    ProcessTableSweep( ExitTime );
+
+    for (entry = ProcessTableChain( ProcessId );
+         entry != NULL;
+         entry = entry->Next) {
+
+        if (entry->ProcessId == ProcessId && entry->CreateTime == CreateTime) {
+
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+
+        memset( &unknown, 0, sizeof( unknown ) );
+        unknown.ProcessId = ProcessId;
+        unknown.CreateTime = CreateTime;
+        unknown.Queried = TRUE;
+        entry = &unknown;
+    }
+
+    entry->ExitTime = ExitTime;
+    entry->ExitStatus = ExitStatus;
+    ProcessTable.Stats.Exited++;
+
+    ProcessTableWriteRow( entry );
+}
+
+static PPROCESS_ENTRY
+ProcessTableFind (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG Time
+    )
+{
+    PPROCESS_ENTRY entry;
+    PPROCESS_ENTRY best = NULL;
+
+    for (entry = ProcessTableChain( ProcessId );
+         entry != NULL;
+         entry = entry->Next) {
+
+        if (entry->ProcessId == ProcessId &&
+            entry->CreateTime <= Time &&
+            (best == NULL || entry->CreateTime > best->CreateTime)) {
+
+            best = entry;
+        }
+    }
+
+    //
+    //  Gone before the operation, it was issued by a process we were not
+    //  told of.
+    //
+
+    if (best != NULL && best->ExitTime != 0 && best->ExitTime < Time) {
+
+        return NULL;
+    }
+
+    return best;
+}
+
+PPROCESS_ENTRY
+ProcessTableLookup (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG Time
+    )
+/*++
+
+Routine Description:
+
+    Finds the process that issued an operation: the newest process with
+    its id created no later than the operation, if it had not exited
+    before it.
+
+Arguments:
+
+    ProcessId - Process id of the operation.
+
+    Time - When it started.
+
+Return Value:
+
+    The entry, valid until the next ProcessTableCreate or ProcessTableExit,
+    or NULL if no such process is known.
+
+--*/
+{
+    PPROCESS_ENTRY best = ProcessTableFind( ProcessId, Time );
+
+    ProcessTable.Stats.Lookups++;
+
+    if (best == NULL) {
+
+        ProcessTable.Stats.Misses++;
+    }
+
+    return best;
+}
+
+PPROCESS_ENTRY
+ProcessTableAttribute (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG Time,
+    _In_ PPROCESS_TABLE_QUERY Query
+    )
+/*++
+
+Routine Description:
+
+    Finds the process that issued an operation as ProcessTableLookup does,
+    asking Query about processes the filter did not report: when the table
+    has none, and again every PROCESS_TABLE_RECHECK to notice their id
+    being reused.  Processes the filter reported are never asked about.
+
+    Query is asked about the process that has the id now, which may have
+    been created after the operation when the record came late.  It is
+    added to the table, but the operation stays with whatever process the
+    table had for it.
+
+Arguments:
+
+    ProcessId - Process id of the operation.
+
+    Time - When it started.
+
+    Query - Looks up the process that has the id now.
+
+Return Value:
+
+    The entry, valid until the next call in here, or NULL if no process is
+    known to have issued the operation.
+
+--*/
+{
+    PPROCESS_ENTRY process = ProcessTableFind( ProcessId, Time );
+    char imagePath[MAX_PATH];
+    WCHAR nativePath[MAX_PATH];
+    LONGLONG created;
+
+    ProcessTable.Stats.Lookups++;
+
+    if (process != NULL && (!process->Queried || process->CheckedTime + PROCESS_TABLE_RECHECK > Time)) {
+
+        return process;
+    }
+
+    imagePath[0] = '\0';
+    nativePath[0] = L'\0';
+
+    //
+    //  Gone or not ours to open, the entry we have is still the best
+    //  guess.
+    //
+
+    if (Query( ProcessId, &created, imagePath, nativePath )) {
+
+        if (process != NULL && process->CreateTime == created) {
+
+            process->CheckedTime = Time;
+
+        } else {
+
+            //
+            //  Found again rather than kept, the sweep may have dropped it.
+            //
+
+            ProcessTableCreate( ProcessId, created, 0, 0, 0,
+                                (imagePath[0] != '\0') ? imagePath : NULL,
+                                (nativePath[0] != L'\0') ? nativePath : NULL,
+                                TRUE,
+                                Time );
+
+            process = ProcessTableFind( ProcessId, Time );
+        }
+    }
+
+    if (process == NULL) {
+
+        ProcessTable.Stats.Misses++;
+    }
+
+    return process;
+}
+
+VOID
+ProcessTablePrintStats (
+    VOID
+    )
+{
+    PROCESS_TABLE_STATS stats = ProcessTable.Stats;
+
+    printf( "    Processes:   %lu known in %lu buckets, %I64u reported by the filter, %I64u looked up, %I64u exited, %I64u dropped\n",
+            stats.Entries,
+            ProcessTable.BucketCount,
+            stats.Reported,
+            stats.Queried,
+            stats.Exited,
+            stats.Expired );
+    printf( "    Attribution: %I64u lookups, %I64u found no process\n",
+            stats.Lookups,
+            stats.Misses );
+}
@@ -0,0 +1,142 @@
+/*++
+
+Module Name:
+
+    mspyProcess.h
+
+Abstract:
+
+    Table of the processes the filter reported, keyed by process id and
+    create time, so operations are attributed to the image that issued
+    them without opening the process, even once it is gone or its id has
+    been reused.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYPROCESS_H__
+#define __MSPYPROCESS_H__
+
+#include <windows.h>
+#include <sqlite3.h>
+#include "minispy.h"
+
+//
+//  The table starts with this many buckets and doubles whenever it holds
+//  more processes than buckets.
+//
+
+#define PROCESS_TABLE_INITIAL_BUCKETS   1024        // power of two
+
+//
+//  A process is kept this long in record time after it exits, for the
+//  records of its last operations still on their way.
+//
+
+#define PROCESS_TABLE_LINGER    (60LL * 10000000)       // 1 minute in 100ns
+
+//
+//  A process the filter did not report, because it was started before the
+//  filter, is looked up by its caller and checked again this often in
+//  record time, in case its id was reused.
+//
+
+#define PROCESS_TABLE_RECHECK   (10LL * 10000000)       // 10 seconds in 100ns
+
+typedef struct _PROCESS_ENTRY {
+
+    struct _PROCESS_ENTRY *Next;
+
+    ULONG_PTR ProcessId;
+    LONGLONG CreateTime;
+    LONGLONG ExitTime;              // 0 while it runs
+    NTSTATUS ExitStatus;
+
+    ULONG_PTR ParentProcessId;
+    LONGLONG ParentCreateTime;      // 0 if not known
+    ULONG_PTR CreatingThreadId;
+
+    //
+    //  Image as QueryFullProcessImageName returns it, "C:\...", and as the
+    //  kernel opened it, "\Device\HarddiskVolume3\...".  Either may be NULL.
+    //
+
+    char *ImagePath;
+    WCHAR *NativeImagePath;
+
+    //
+    //  TRUE if the caller looked the process up rather than the filter
+    //  reporting it, and when it last did.
+    //
+
+    BOOLEAN Queried;
+    LONGLONG CheckedTime;
+
+} PROCESS_ENTRY, *PPROCESS_ENTRY;
+
+//
+//  Asks the system about the process that has an id now, for
+//  ProcessTableAttribute: its create time and image paths, left empty if
+//  not known.  FALSE if there is none or it cannot be opened.
+//
+
+typedef BOOLEAN
+(*PPROCESS_TABLE_QUERY) (
+    _In_ ULONG_PTR ProcessId,
+    _Out_ PLONGLONG CreateTime,
+    _Out_writes_z_(MAX_PATH) char *ImagePath,
+    _Out_writes_z_(MAX_PATH) WCHAR *NativeImagePath
+    );
+
+BOOLEAN
+ProcessTablePrepare (
+    _In_ sqlite3 *Db
+    );
+
+VOID
+ProcessTableFinalize (
+    VOID
+    );
+
+PPROCESS_ENTRY
+ProcessTableCreate (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG CreateTime,
+    _In_ ULONG_PTR ParentProcessId,
+    _In_ LONGLONG ParentCreateTime,
+    _In_ ULONG_PTR CreatingThreadId,
+    _In_opt_z_ const char *ImagePath,
+    _In_opt_z_ const WCHAR *NativeImagePath,
+    _In_ BOOLEAN Queried,
+    _In_ LONGLONG Now
+    );
+
+VOID
+ProcessTableExit (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG CreateTime,
+    _In_ LONGLONG ExitTime,
+    _In_ NTSTATUS ExitStatus
+    );
+
+PPROCESS_ENTRY
+ProcessTableLookup (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG Time
+    );
+
+PPROCESS_ENTRY
+ProcessTableAttribute (
+    _In_ ULONG_PTR ProcessId,
+    _In_ LONGLONG Time,
+    _In_ PPROCESS_TABLE_QUERY Query
+    );
+
+VOID
+ProcessTablePrintStats (
+    VOID
+    );
+
+#endif //__MSPYPROCESS_H__
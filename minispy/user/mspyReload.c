@@ -0,0 +1,521 @@
+/*++
+
+Module Name:
+
+    mspyReload.c
+
+Abstract:
+
+    Reloads the rules when the Rules table changes.
+
+    Triggers from rules.sql bump RuleVersion on every insert, update or
+    delete of a rule, whoever makes it.  The reload thread checks PRAGMA
+    data_version on its own connection, which only changes when another
+    connection commits, and reads RuleVersion only then.  When the version
+    moved it compiles the rules on its own thread and publishes them.
+
+    Published rule sets live in two slots, each with a count of the
+    readers using it.  A reader counts itself into the active slot and
+    checks the slot is still active, otherwise it backs off and tries
+    again, so it never waits.  The thread installs the new set in the idle
+    slot, makes that slot active, waits for the readers of the old slot to
+    finish and only then frees the old set.  Evaluations that started on
+    the old rules finish on them.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyReload.h"
+
+typedef struct _RELOAD_STATE {
+
+    //
+    //  Published rules.  Only the thread that publishes writes Sets and
+    //  Active, see ReloadPublish.
+    //
+
+    PRULE_SET Sets[2];
+    volatile LONG Readers[2];
+    volatile LONG Active;
+
+    sqlite3 *Db;
+    LONGLONG DataVersion;
+    LONGLONG Version;
+
+    PRELOAD_NOTIFY Notify;
+    PVOID Context;
+
+    HANDLE Thread;
+    HANDLE Wake;
+    volatile BOOLEAN Stop;
+
+    LARGE_INTEGER Frequency;
+
+    //
+    //  Metrics, under Lock.
+    //
+
+    SRWLOCK Lock;
+    ULONGLONG Reloads;
+    ULONGLONG Failures;
+    ULONG RuleCount;
+    ULONG CompileMicroseconds;
+    ULONG CompileMaxMicroseconds;
+    ULONG PublishMicroseconds;
+    ULONG PublishMaxMicroseconds;
+    ULONGLONG LastReloadTick;
+
+} RELOAD_STATE, *PRELOAD_STATE;
+
+static RELOAD_STATE ReloadState;
+
+static ULONG
+ReloadElapsedMicroseconds (
+    _In_ LONGLONG Ticks
+    )
+{
+    LONGLONG microseconds = Ticks * 1000000 / ReloadState.Frequency.QuadPart;
+
+    return (microseconds > MAXULONG) ? MAXULONG : (ULONG)microseconds;
+}
+
+static BOOLEAN
+ReloadQueryInt64 (
+    _In_ sqlite3 *Db,
+    _In_z_ const char *Sql,
+    _Out_ LONGLONG *Value
+    )
+{
+    sqlite3_stmt *stmt;
+    BOOLEAN found = FALSE;
+
+    if (sqlite3_prepare_v2( Db, Sql, -1, &stmt, NULL ) != SQLITE_OK) {
+
+        return FALSE;
+    }
+
+    if (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        *Value = sqlite3_column_int64( stmt, 0 );
+        found = TRUE;
+    }
+
+    sqlite3_finalize( stmt );
+    return found;
+}
+
+static BOOLEAN
+ReloadRulesChanged (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Tells whether the rules changed since the last compile.  Costs one
+    pragma unless some other connection committed.
+
+--*/
+{
+    LONGLONG dataVersion;
+    LONGLONG version;
+
+    if (!ReloadQueryInt64( ReloadState.Db, "PRAGMA data_version;", &dataVersion ) ||
+        dataVersion == ReloadState.DataVersion) {
+
+        return FALSE;
+    }
+
+    ReloadState.DataVersion = dataVersion;
+
+    if (!ReloadQueryInt64( ReloadState.Db, "SELECT Version FROM RuleVersion WHERE ID = 1;", &version ) ||
+        version == ReloadState.Version) {
+
+        return FALSE;
+    }
+
+    ReloadState.Version = version;
+    return TRUE;
+}
+
+static VOID
+ReloadPublish (
+    _In_ PRULE_SET RuleSet
+    )
+/*++
+
+Routine Description:
+
+    Makes RuleSet the rules readers get and frees the rules it replaces
+    once no reader uses them any more.  Only one thread publishes.
+
+--*/
+{
+    LONG active = ReloadState.Active;
+    LONG idle = active ^ 1;
+    PRULE_SET old;
+
+    //
+    //  Readers that still counted themselves into the idle slot read
+    //  Active before the last swap.  They see it changed and back off.
+    //
+
+    while (ReloadState.Readers[idle] != 0) {
+
+        Sleep( 0 );
+    }
+
+    InterlockedExchangePointer( (PVOID *)&ReloadState.Sets[idle], RuleSet );
+    InterlockedExchange( &ReloadState.Active, idle );
+
+    //
+    //  Wait out the evaluations running on the old rules.  The writer
+    //  holds a slot for one record, so this is short.
+    //
+
+    while (ReloadState.Readers[active] != 0) {
+
+        Sleep( 1 );
+    }
+
+    old = InterlockedExchangePointer( (PVOID *)&ReloadState.Sets[active], NULL );
+    RulesFree( old );
+}
+
+static BOOLEAN
+ReloadCompile (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Compiles the rules, publishes them and tells the caller of ReloadStart.
+    If the rules cannot be compiled the published ones stay in effect.
+
+--*/
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER compiled;
+    LARGE_INTEGER published;
+    PRULE_SET ruleSet;
+    ULONG compileMicroseconds;
+    ULONG publishMicroseconds;
+
+    QueryPerformanceCounter( &start );
+
+    ruleSet = RulesCompile( ReloadState.Db, "main" );
+
+    QueryPerformanceCounter( &compiled );
+
+    if (ruleSet == NULL) {
+
+        AcquireSRWLockExclusive( &ReloadState.Lock );
+        ReloadState.Failures++;
+        ReleaseSRWLockExclusive( &ReloadState.Lock );
+
+        WriteToLogAnsi( "Could not reload the rules, version %I64d, keeping the current rules", ReloadState.Version );
+        return FALSE;
+    }
+
+    ReloadPublish( ruleSet );
+
+    QueryPerformanceCounter( &published );
+
+    compileMicroseconds = ReloadElapsedMicroseconds( compiled.QuadPart - start.QuadPart );
+    publishMicroseconds = ReloadElapsedMicroseconds( published.QuadPart - compiled.QuadPart );
+
+    AcquireSRWLockExclusive( &ReloadState.Lock );
+
+    ReloadState.Reloads++;
+    ReloadState.RuleCount = ruleSet->Process.RuleCount + ruleSet->File.RuleCount;
+    ReloadState.CompileMicroseconds = compileMicroseconds;
+    ReloadState.PublishMicroseconds = publishMicroseconds;
+    ReloadState.LastReloadTick = GetTickCount64();
+
+    if (compileMicroseconds > ReloadState.CompileMaxMicroseconds) {
+
+        ReloadState.CompileMaxMicroseconds = compileMicroseconds;
+    }
+
+    if (publishMicroseconds > ReloadState.PublishMaxMicroseconds) {
+
+        ReloadState.PublishMaxMicroseconds = publishMicroseconds;
+    }
+
+    ReleaseSRWLockExclusive( &ReloadState.Lock );
+
+    WriteToLogAnsi( "Rules version %I64d loaded: %lu rule(s), compiled in %lu us, published in %lu us",
+                    ReloadState.Version,
+                    ruleSet->Process.RuleCount + ruleSet->File.RuleCount,
+                    compileMicroseconds,
+                    publishMicroseconds );
+
+    if (ReloadState.Notify != NULL) {
+
+        ReloadState.Notify( ruleSet, ReloadState.Context );
+    }
+
+    return TRUE;
+}
+
+static DWORD WINAPI
+ReloadThread (
+    _In_ LPVOID Parameter
+    )
+{
+    UNREFERENCED_PARAMETER( Parameter );
+
+    while (!ReloadState.Stop) {
+
+        WaitForSingleObject( ReloadState.Wake, RELOAD_POLL_INTERVAL );
+
+        if (ReloadState.Stop) {
+
+            break;
+        }
+
+        if (ReloadRulesChanged()) {
+
+            ReloadCompile();
+        }
+    }
+
+    return 0;
+}
+
+BOOLEAN
+ReloadStart (
+    _In_opt_ PRELOAD_NOTIFY Notify,
+    _In_opt_ PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Loads the rules and starts the thread that reloads them.  Call before
+    the log writer starts.
+
+Arguments:
+
+    Notify - Called with every rule set published, the first time on the
+        calling thread before this returns.
+
+    Context - Passed to Notify.
+
+Return Value:
+
+    TRUE if the rules will be reloaded when they change.  Otherwise the
+    rules loaded here, if any, stay in effect.
+
+--*/
+{
+    InitializeSRWLock( &ReloadState.Lock );
+    QueryPerformanceFrequency( &ReloadState.Frequency );
+
+    ReloadState.Notify = Notify;
+    ReloadState.Context = Context;
+    ReloadState.Stop = FALSE;
+
+    if (!InitializeDatabase()) {
+
+        return FALSE;
+    }
+
+    if (sqlite3_open( DATABASE_FILE_LOCATION, &ReloadState.Db ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "Could not open %s to load the rules: %s", DATABASE_FILE_LOCATION, sqlite3_errmsg( ReloadState.Db ) );
+        sqlite3_close( ReloadState.Db );
+        ReloadState.Db = NULL;
+        return FALSE;
+    }
+
+    sqlite3_busy_timeout( ReloadState.Db, 5000 );
+
+    if (ExecEmbeddedSQL( ReloadState.Db, L"RULES_SQL" ) != SQLITE_OK) {
+
+        goto Fail;
+    }
+
+    //
+    //  Take the versions before compiling, a change made meanwhile is
+    //  picked up by the first poll.
+    //
+
+    ReloadQueryInt64( ReloadState.Db, "PRAGMA data_version;", &ReloadState.DataVersion );
+    ReloadQueryInt64( ReloadState.Db, "SELECT Version FROM RuleVersion WHERE ID = 1;", &ReloadState.Version );
+
+    ReloadCompile();
+
+    ReloadState.Wake = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+    if (ReloadState.Wake == NULL) {
+
+        goto Fail;
+    }
+
+    ReloadState.Thread = CreateThread( NULL, 0, ReloadThread, NULL, 0, NULL );
+
+    if (ReloadState.Thread == NULL) {
+
+        CloseHandle( ReloadState.Wake );
+        ReloadState.Wake = NULL;
+        goto Fail;
+    }
+
+    return TRUE;
+
+Fail:
+
+    sqlite3_close( ReloadState.Db );
+    ReloadState.Db = NULL;
+    return FALSE;
+}
+
+VOID
+ReloadStop (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Stops the reload thread and frees the rules.  Call after the log
+    writer has stopped.
+
+--*/
+{
+    ULONG slot;
+
+    if (ReloadState.Thread != NULL) {
+
+        ReloadState.Stop = TRUE;
+        SetEvent( ReloadState.Wake );
+
+        WaitForSingleObject( ReloadState.Thread, INFINITE );
+
+        CloseHandle( ReloadState.Thread );
+        CloseHandle( ReloadState.Wake );
+        ReloadState.Thread = NULL;
+        ReloadState.Wake = NULL;
+    }
+
+    sqlite3_close( ReloadState.Db );
+    ReloadState.Db = NULL;
+
+    for (slot = 0; slot < 2; slot++) {
+
+        RulesFree( ReloadState.Sets[slot] );
+        ReloadState.Sets[slot] = NULL;
+    }
+}
+
+PRULE_SET
+ReloadAcquire (
+    _Out_ PULONG Slot
+    )
+/*++
+
+Routine Description:
+
+    Gets the current rules for one evaluation.  Never waits.  The rules
+    stay valid until ReloadRelease, hold them only briefly as a reload
+    waits for every holder of the rules it replaces.
+
+Arguments:
+
+    Slot - Receives the value to pass to ReloadRelease.
+
+Return Value:
+
+    The rules, NULL if none are loaded.
+
+--*/
+{
+    LONG slot;
+
+    for (;;) {
+
+        slot = ReloadState.Active;
+        InterlockedIncrement( &ReloadState.Readers[slot] );
+
+        //
+        //  If the slot was swapped out before we counted ourselves in, its
+        //  rules may already be freed.
+        //
+
+        if (InterlockedCompareExchange( &ReloadState.Active, slot, slot ) == slot) {
+
+            break;
+        }
+
+        InterlockedDecrement( &ReloadState.Readers[slot] );
+    }
+
+    *Slot = (ULONG)slot;
+    return ReloadState.Sets[slot];
+}
+
+VOID
+ReloadRelease (
+    _In_ ULONG Slot
+    )
+{
+    InterlockedDecrement( &ReloadState.Readers[Slot] );
+}
+
+VOID
+ReloadPrintStats (
+    VOID
+    )
+{
+    ULONGLONG reloads;
+    ULONGLONG failures;
+    ULONG ruleCount;
+    ULONG compile;
+    ULONG compileMax;
+    ULONG publish;
+    ULONG publishMax;
+    ULONGLONG lastReload;
+
+    AcquireSRWLockShared( &ReloadState.Lock );
+
+    reloads = ReloadState.Reloads;
+    failures = ReloadState.Failures;
+    ruleCount = ReloadState.RuleCount;
+    compile = ReloadState.CompileMicroseconds;
+    compileMax = ReloadState.CompileMaxMicroseconds;
+    publish = ReloadState.PublishMicroseconds;
+    publishMax = ReloadState.PublishMaxMicroseconds;
+    lastReload = ReloadState.LastReloadTick;
+
+    ReleaseSRWLockShared( &ReloadState.Lock );
+
+    if (reloads == 0) {
+
+        printf( "    No rules loaded\n" );
+        return;
+    }
+
+    printf( "    Rules:              %lu active, loaded %I64u time(s), %I64u failed, last %I64u s ago\n",
+            ruleCount,
+            reloads,
+            failures,
+            (GetTickCount64() - lastReload) / 1000 );
+    printf( "    Compile (us):       last %lu  max %lu\n", compile, compileMax );
+    printf( "    Publish (us):       last %lu  max %lu\n", publish, publishMax );
+    printf( "    Changes are picked up within %u ms plus the compile time%s\n",
+            RELOAD_POLL_INTERVAL,
+            (ReloadState.Thread == NULL) ? ", but the reload thread is not running" : "" );
+}
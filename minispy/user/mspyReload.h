@@ -0,0 +1,70 @@
+/*++
+
+Module Name:
+
+    mspyReload.h
+
+Abstract:
+
+    Picks up changes to the Rules table while the log writer runs.  A
+    thread of its own notices the change, compiles the new rules and
+    publishes them.  The writer never waits for a compile or for the old
+    rules to be freed.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYRELOAD_H__
+#define __MSPYRELOAD_H__
+
+#include <windows.h>
+#include "mspyRules.h"
+
+//
+//  How often the thread checks the rules for changes.  A change is in
+//  effect at most this long plus the compile time after it commits.
+//
+
+#define RELOAD_POLL_INTERVAL    1000        // milliseconds
+
+//
+//  Called on the thread that published RuleSet, once for the rules loaded
+//  by ReloadStart and again after every reload.  RuleSet stays valid for
+//  the duration of the call.
+//
+
+typedef VOID
+(*PRELOAD_NOTIFY) (
+    _In_ PRULE_SET RuleSet,
+    _In_opt_ PVOID Context
+    );
+
+BOOLEAN
+ReloadStart (
+    _In_opt_ PRELOAD_NOTIFY Notify,
+    _In_opt_ PVOID Context
+    );
+
+VOID
+ReloadStop (
+    VOID
+    );
+
+PRULE_SET
+ReloadAcquire (
+    _Out_ PULONG Slot
+    );
+
+VOID
+ReloadRelease (
+    _In_ ULONG Slot
+    );
+
+VOID
+ReloadPrintStats (
+    VOID
+    );
+
+#endif //__MSPYRELOAD_H__
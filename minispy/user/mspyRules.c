@@ -0,0 +1,1266 @@
+/*++
+
+Module Name:
+
+    mspyRules.c
+
+Abstract:
+
+    Turns the active rows of the Rules table into matchers and evaluates
+    them against log records.
+
+    Location rules are split into path components and inserted into a trie
+    whose edges are kept in one hash table, so matching a path costs one
+    probe per component whatever the number of rules.  A rule only matches
+    whole components: C:\Users\Bob matches C:\Users\Bob\a.txt but not
+    C:\Users\Bobby.  File rules written with a drive letter are rewritten
+    to the \Device\... form the filter reports.  Extension and hash rules
+    are single hash set lookups.  All text is compared case insensitively.
+
+    When several rules match, the strongest action wins, ties go to the
+    lowest RuleID.  Hashing, probing and tie breaking are shared with the
+    filter through spyRules.h, and the file rules that block are copied in
+    that format for the filter to enforce.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyRules.h"
+
+#define RULE_MIN_SLOTS          16
+#define RULE_MAX_EXTENSION      SPY_RULES_MAX_EXTENSION
+
+//
+//  A row of the Rules table while the rule set is being built.
+//
+
+typedef struct _RULE_SOURCE {
+
+    RULE_REF Rule;
+    LONG Type;
+    LONG Target;
+    PWCHAR String;
+
+} RULE_SOURCE, *PRULE_SOURCE;
+
+static ULONG
+RuleRoundUpPow2 (
+    _In_ ULONG Value
+    )
+{
+    ULONG result = RULE_MIN_SLOTS;
+
+    while (result < Value && result < 0x80000000) {
+
+        result <<= 1;
+    }
+
+    return result;
+}
+
+static __forceinline WCHAR
+RuleUpcase (
+    _In_ WCHAR Char
+    )
+{
+    if (Char < 0x80) {
+
+        return (Char >= L'a' && Char <= L'z') ? (WCHAR)(Char - (L'a' - L'A')) : Char;
+    }
+
+    //
+    //  CharUpperW converts a single character passed in the low word.
+    //
+
+    return (WCHAR)(ULONG_PTR)CharUpperW( (LPWSTR)(ULONG_PTR)Char );
+}
+
+//
+//  Trie
+//
+
+static PRULE_TRIE_EDGE
+RuleTrieFind (
+    _In_ PRULE_TRIE Trie,
+    _In_ ULONG Parent,
+    _In_ ULONG Hash,
+    _In_reads_(Length) PCWSTR Text,
+    _In_ USHORT Length,
+    _In_ BOOLEAN Upcase
+    )
+/*++
+
+Routine Description:
+
+    Finds the edge for a component, or the empty slot it would go in.
+    Text is upcased while comparing if Upcase is set.
+
+--*/
+{
+    ULONG slot = SpyRulesEdgeSlot( Parent, Hash ) & Trie->EdgeMask;
+    PRULE_TRIE_EDGE edge;
+    USHORT index;
+
+    for (;;) {
+
+        edge = &Trie->Edges[slot];
+
+        if (edge->Child == 0) {
+
+            return edge;
+        }
+
+        if (edge->Parent == Parent && edge->Hash == Hash && edge->Length == Length) {
+
+            for (index = 0; index < Length; index++) {
+
+                if (edge->Text[index] != (Upcase ? RuleUpcase( Text[index] ) : Text[index])) {
+
+                    break;
+                }
+            }
+
+            if (index == Length) {
+
+                return edge;
+            }
+        }
+
+        slot = (slot + 1) & Trie->EdgeMask;
+    }
+}
+
+static VOID
+RuleTrieInsert (
+    _Inout_ PRULE_TRIE Trie,
+    _In_z_ PCWSTR Path,
+    _In_ RULE_REF Rule
+    )
+/*++
+
+Routine Description:
+
+    Adds a location rule.  Path must already be upcased and the trie sized
+    for every component of every rule.
+
+--*/
+{
+    ULONG node = 0;
+    PCWSTR component;
+    PRULE_TRIE_EDGE edge = NULL;
+    ULONG hash;
+    USHORT length;
+
+    while (*Path != UNICODE_NULL) {
+
+        while (SpyRulesIsSeparator( *Path )) {
+
+            Path++;
+        }
+
+        if (*Path == UNICODE_NULL) {
+
+            break;
+        }
+
+        component = Path;
+        hash = SPY_RULES_HASH_SEED;
+
+        while (*Path != UNICODE_NULL && !SpyRulesIsSeparator( *Path )) {
+
+            hash = SpyRulesHashStep( hash, *Path );
+            Path++;
+        }
+
+        length = (USHORT)(Path - component);
+        edge = RuleTrieFind( Trie, node, hash, component, length, FALSE );
+
+        if (edge->Child == 0) {
+
+            edge->Parent = node;
+            edge->Hash = hash;
+            edge->Length = length;
+            edge->Text = component;
+            edge->Child = Trie->NodeCount++;
+        }
+
+        node = edge->Child;
+    }
+
+    //
+    //  A rule on the root would match everything, it is not allowed.
+    //
+
+    if (node != 0) {
+
+        Trie->Nodes[node] = SpyRulesStronger( Trie->Nodes[node], Rule );
+        edge->Rule = Trie->Nodes[node];
+    }
+}
+
+static RULE_REF
+RuleTrieMatch (
+    _In_ PRULE_TRIE Trie,
+    _In_z_ PCWSTR Path,
+    _Outptr_ PCWSTR *Name
+    )
+/*++
+
+Routine Description:
+
+    Walks the trie down Path, and Path to its end: past the first component
+    with no edge only the separators are looked for, to return the last
+    component for the extension rules without a second walk.
+
+--*/
+{
+    RULE_REF best = { 0, 0 };
+    ULONG node = 0;
+    PCWSTR component;
+    PRULE_TRIE_EDGE edge;
+    BOOLEAN walking = TRUE;
+    ULONG hash;
+
+    *Name = Path;
+
+    while (*Path != UNICODE_NULL) {
+
+        while (SpyRulesIsSeparator( *Path )) {
+
+            Path++;
+        }
+
+        *Name = Path;
+
+        if (*Path == UNICODE_NULL) {
+
+            break;
+        }
+
+        if (!walking) {
+
+            while (*Path != UNICODE_NULL && !SpyRulesIsSeparator( *Path )) {
+
+                Path++;
+            }
+
+            continue;
+        }
+
+        component = Path;
+        hash = SPY_RULES_HASH_SEED;
+
+        while (*Path != UNICODE_NULL && !SpyRulesIsSeparator( *Path )) {
+
+            hash = SpyRulesHashStep( hash, RuleUpcase( *Path ) );
+            Path++;
+        }
+
+        edge = RuleTrieFind( Trie, node, hash, component, (USHORT)(Path - component), TRUE );
+
+        if (edge->Child == 0) {
+
+            walking = FALSE;
+            continue;
+        }
+
+        node = edge->Child;
+        best = SpyRulesStronger( best, edge->Rule );
+    }
+
+    return best;
+}
+
+//
+//  Extensions
+//
+
+static PRULE_EXTENSION
+RuleExtensionFind (
+    _In_ PRULE_MATCHER Matcher,
+    _In_ ULONG Hash,
+    _In_reads_(Length) PCWSTR Text,
+    _In_ USHORT Length
+    )
+{
+    ULONG slot = Hash & Matcher->ExtensionMask;
+    PRULE_EXTENSION entry;
+
+    for (;;) {
+
+        entry = &Matcher->Extensions[slot];
+
+        if (entry->Length == 0 ||
+            (entry->Hash == Hash &&
+             entry->Length == Length &&
+             memcmp( entry->Text, Text, Length * sizeof( WCHAR ) ) == 0)) {
+
+            return entry;
+        }
+
+        slot = (slot + 1) & Matcher->ExtensionMask;
+    }
+}
+
+static USHORT
+RuleExtensionOf (
+    _In_z_ PCWSTR Name,
+    _Out_writes_(RULE_MAX_EXTENSION) PWCHAR Extension
+    )
+/*++
+
+Routine Description:
+
+    Copies the upcased extension of Name, the last component of a path as
+    RuleTrieMatch returns it, ignoring any :stream suffix.
+
+Return Value:
+
+    Length of the extension in WCHARs, 0 if there is none or it is longer
+    than any rule could be.
+
+--*/
+{
+    PCWSTR end;
+    PCWSTR dot = NULL;
+    PCWSTR scan;
+    USHORT length = 0;
+
+    for (end = Name; *end != UNICODE_NULL && *end != L':'; end++) {
+
+        if (*end == L'.') {
+
+            dot = end;
+        }
+    }
+
+    if (dot == NULL || (end - dot - 1) > RULE_MAX_EXTENSION || end == dot + 1) {
+
+        return 0;
+    }
+
+    for (scan = dot + 1; scan < end; scan++) {
+
+        Extension[length++] = RuleUpcase( *scan );
+    }
+
+    return length;
+}
+
+static ULONG
+RuleHashText (
+    _In_reads_(Length) PCWSTR Text,
+    _In_ USHORT Length
+    )
+{
+    ULONG hash = SPY_RULES_HASH_SEED;
+    USHORT index;
+
+    for (index = 0; index < Length; index++) {
+
+        hash = SpyRulesHashStep( hash, Text[index] );
+    }
+
+    return hash;
+}
+
+static RULE_REF
+RuleExtensionMatch (
+    _In_ PRULE_MATCHER Matcher,
+    _In_z_ PCWSTR Name
+    )
+{
+    RULE_REF none = { 0, 0 };
+    WCHAR extension[RULE_MAX_EXTENSION];
+    USHORT length;
+    PRULE_EXTENSION entry;
+
+    length = RuleExtensionOf( Name, extension );
+
+    if (length == 0) {
+
+        return none;
+    }
+
+    entry = RuleExtensionFind( Matcher, RuleHashText( extension, length ), extension, length );
+
+    return (entry->Length != 0) ? entry->Rule : none;
+}
+
+//
+//  Digests
+//
+
+static PRULE_DIGEST
+RuleDigestFind (
+    _In_ PRULE_MATCHER Matcher,
+    _In_reads_(RULE_DIGEST_SIZE) const UCHAR *Digest
+    )
+{
+    ULONG slot;
+    PRULE_DIGEST entry;
+
+    //
+    //  The digest is already uniformly distributed.
+    //
+
+    memcpy( &slot, Digest, sizeof( slot ) );
+    slot &= Matcher->DigestMask;
+
+    for (;;) {
+
+        entry = &Matcher->Digests[slot];
+
+        if (!entry->Used || memcmp( entry->Digest, Digest, RULE_DIGEST_SIZE ) == 0) {
+
+            return entry;
+        }
+
+        slot = (slot + 1) & Matcher->DigestMask;
+    }
+}
+
+static BOOLEAN
+RuleParseDigest (
+    _In_z_ PCWSTR Text,
+    _Out_writes_(RULE_DIGEST_SIZE) PUCHAR Digest
+    )
+{
+    ULONG index;
+    ULONG nibble;
+    WCHAR c;
+
+    for (index = 0; index < RULE_DIGEST_SIZE * 2; index++) {
+
+        c = Text[index];
+
+        if (c >= L'0' && c <= L'9') {
+
+            nibble = c - L'0';
+
+        } else if (c >= L'A' && c <= L'F') {
+
+            nibble = c - L'A' + 10;
+
+        } else {
+
+            return FALSE;
+        }
+
+        if (index % 2 == 0) {
+
+            Digest[index / 2] = (UCHAR)(nibble << 4);
+
+        } else {
+
+            Digest[index / 2] |= (UCHAR)nibble;
+        }
+    }
+
+    return Text[index] == UNICODE_NULL;
+}
+
+//
+//  Compiling
+//
+
+static PWCHAR
+RuleNormalize (
+    _In_z_ PCWSTR Text,
+    _In_ LONG Type,
+    _In_ LONG Target
+    )
+/*++
+
+Routine Description:
+
+    Makes the upcased copy of a rule string the matchers use.  Extensions
+    lose a leading "*." or ".", locations lose trailing separators and file
+    locations starting with a drive letter get the drive's device name.
+
+--*/
+{
+    WCHAR device[MAX_PATH];
+    WCHAR drive[3];
+    PCWSTR rest = Text;
+    size_t deviceLength = 0;
+    size_t length;
+    PWCHAR result;
+    size_t index;
+
+    while (*Text == L' ') {
+
+        Text++;
+    }
+
+    if (Type == RULE_TYPE_EXTENSION) {
+
+        if (Text[0] == L'*') Text++;
+        if (Text[0] == L'.') Text++;
+        rest = Text;
+
+    } else if (Type == RULE_TYPE_LOCATION &&
+               Target == RULE_TARGET_FILE &&
+               Text[0] != UNICODE_NULL && Text[1] == L':') {
+
+        drive[0] = Text[0];
+        drive[1] = L':';
+        drive[2] = UNICODE_NULL;
+
+        if (QueryDosDeviceW( drive, device, MAX_PATH ) != 0) {
+
+            deviceLength = wcslen( device );
+            rest = Text + 2;
+
+        } else {
+
+            rest = Text;
+        }
+
+    } else {
+
+        rest = Text;
+    }
+
+    length = wcslen( rest );
+
+    while (length > 0 && (rest[length - 1] == L' ' || (Type == RULE_TYPE_LOCATION && SpyRulesIsSeparator( rest[length - 1] )))) {
+
+        length--;
+    }
+
+    if (length == 0 || (Type == RULE_TYPE_EXTENSION && length > RULE_MAX_EXTENSION)) {
+
+        return NULL;
+    }
+
+    result = malloc( (deviceLength + length + 1) * sizeof( WCHAR ) );
+
+    if (result == NULL) {
+
+        return NULL;
+    }
+
+    memcpy( result, device, deviceLength * sizeof( WCHAR ) );
+    memcpy( result + deviceLength, rest, length * sizeof( WCHAR ) );
+    result[deviceLength + length] = UNICODE_NULL;
+
+    for (index = 0; index < deviceLength + length; index++) {
+
+        result[index] = RuleUpcase( result[index] );
+    }
+
+    return result;
+}
+
+static ULONG
+RuleCountComponents (
+    _In_z_ PCWSTR Path
+    )
+{
+    ULONG count = 0;
+    BOOLEAN inComponent = FALSE;
+
+    for (; *Path != UNICODE_NULL; Path++) {
+
+        if (SpyRulesIsSeparator( *Path )) {
+
+            inComponent = FALSE;
+
+        } else if (!inComponent) {
+
+            inComponent = TRUE;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static BOOLEAN
+RuleBuildMatcher (
+    _Out_ PRULE_MATCHER Matcher,
+    _In_reads_(SourceCount) PRULE_SOURCE Sources,
+    _In_ ULONG SourceCount,
+    _In_ LONG Target,
+    _In_ LONG MinAction
+    )
+/*++
+
+Routine Description:
+
+    Builds the matchers for the rules with the given target and at least
+    the given action.
+
+--*/
+{
+    ULONG components = 0;
+    ULONG extensions = 0;
+    ULONG digests = 0;
+    ULONG index;
+    PRULE_SOURCE source;
+    PRULE_EXTENSION extension;
+    PRULE_DIGEST digest;
+    UCHAR value[RULE_DIGEST_SIZE];
+    USHORT length;
+    ULONG hash;
+
+    ZeroMemory( Matcher, sizeof( RULE_MATCHER ) );
+
+    for (index = 0; index < SourceCount; index++) {
+
+        source = &Sources[index];
+
+        if (source->Target != Target || source->Rule.Action < MinAction) {
+
+            continue;
+        }
+
+        switch (source->Type) {
+
+        case RULE_TYPE_LOCATION:
+            components += RuleCountComponents( source->String );
+            break;
+
+        case RULE_TYPE_EXTENSION:
+            extensions++;
+            break;
+
+        case RULE_TYPE_HASH:
+            digests++;
+            break;
+        }
+    }
+
+    Matcher->Locations.Nodes = calloc( components + 1, sizeof( RULE_REF ) );
+    Matcher->Locations.EdgeMask = RuleRoundUpPow2( components * 2 ) - 1;
+    Matcher->Locations.Edges = calloc( Matcher->Locations.EdgeMask + 1, sizeof( RULE_TRIE_EDGE ) );
+    Matcher->Locations.NodeCount = 1;
+
+    Matcher->ExtensionMask = RuleRoundUpPow2( extensions * 2 ) - 1;
+    Matcher->Extensions = calloc( Matcher->ExtensionMask + 1, sizeof( RULE_EXTENSION ) );
+
+    Matcher->DigestMask = RuleRoundUpPow2( digests * 2 ) - 1;
+    Matcher->Digests = calloc( Matcher->DigestMask + 1, sizeof( RULE_DIGEST ) );
+
+    if (Matcher->Locations.Nodes == NULL ||
+        Matcher->Locations.Edges == NULL ||
+        Matcher->Extensions == NULL ||
+        Matcher->Digests == NULL) {
+
+        return FALSE;
+    }
+
+    for (index = 0; index < SourceCount; index++) {
+
+        source = &Sources[index];
+
+        if (source->Target != Target || source->Rule.Action < MinAction) {
+
+            continue;
+        }
+
+        switch (source->Type) {
+
+        case RULE_TYPE_LOCATION:
+            RuleTrieInsert( &Matcher->Locations, source->String, source->Rule );
+            break;
+
+        case RULE_TYPE_EXTENSION:
+            length = (USHORT)wcslen( source->String );
+            hash = RuleHashText( source->String, length );
+            extension = RuleExtensionFind( Matcher, hash, source->String, length );
+
+            extension->Hash = hash;
+            extension->Length = length;
+            extension->Text = source->String;
+            extension->Rule = SpyRulesStronger( extension->Rule, source->Rule );
+            break;
+
+        case RULE_TYPE_HASH:
+            if (!RuleParseDigest( source->String, value )) {
+
+                WriteToLogAnsi( "Rule %d: \"%S\" is not a SHA-256 digest, ignored", source->Rule.RuleId, source->String );
+                continue;
+            }
+
+            digest = RuleDigestFind( Matcher, value );
+            Matcher->DigestCount += !digest->Used;
+            digest->Used = TRUE;
+            memcpy( digest->Digest, value, RULE_DIGEST_SIZE );
+            digest->Rule = SpyRulesStronger( digest->Rule, source->Rule );
+            break;
+        }
+
+        Matcher->RuleCount++;
+    }
+
+    return TRUE;
+}
+
+static VOID
+RuleFreeMatcher (
+    _Inout_ PRULE_MATCHER Matcher
+    )
+{
+    free( Matcher->Locations.Nodes );
+    free( Matcher->Locations.Edges );
+    free( Matcher->Extensions );
+    free( Matcher->Digests );
+}
+
+static ULONGLONG
+RuleFilterSetSize (
+    _In_ PRULE_MATCHER Matcher
+    )
+/*++
+
+Routine Description:
+
+    Size of the rule set RulesBuildFilterSet lays out for a matcher.
+
+--*/
+{
+    PRULE_TRIE trie = &Matcher->Locations;
+    ULONGLONG textLength = 0;
+    ULONG index;
+
+    for (index = 0; index <= trie->EdgeMask; index++) {
+
+        if (trie->Edges[index].Child != 0) {
+
+            textLength += trie->Edges[index].Length;
+        }
+    }
+
+    for (index = 0; index <= Matcher->ExtensionMask; index++) {
+
+        textLength += Matcher->Extensions[index].Length;
+    }
+
+    return sizeof( SPY_RULES_HEADER ) +
+           (ULONGLONG)trie->NodeCount * sizeof( SPY_RULE_REF ) +
+           ((ULONGLONG)trie->EdgeMask + 1) * sizeof( SPY_RULE_EDGE ) +
+           ((ULONGLONG)Matcher->ExtensionMask + 1) * sizeof( SPY_RULE_EXTENSION ) +
+           textLength * sizeof( WCHAR );
+}
+
+static BOOLEAN
+RuleBuildBlocking (
+    _Inout_ PRULE_SET RuleSet,
+    _In_reads_(SourceCount) PRULE_SOURCE Sources,
+    _In_ ULONG SourceCount
+    )
+/*++
+
+Routine Description:
+
+    Builds the matcher of the file rules that block.  If the filter cannot
+    take them all, keeps the most rules, in RuleID order, that fit rather
+    than none, so the filter never goes on enforcing rules deleted since.
+    The size only grows with the rules, the count is found by bisection.
+
+--*/
+{
+    ULONG fits = 0;
+    ULONG tooMany = SourceCount;
+    ULONG middle;
+    ULONG index;
+
+    if (!RuleBuildMatcher( &RuleSet->Blocking, Sources, SourceCount, RULE_TARGET_FILE, RULE_ACTION_BLOCK )) {
+
+        return FALSE;
+    }
+
+    if (RuleFilterSetSize( &RuleSet->Blocking ) <= SPY_RULES_MAX_SIZE) {
+
+        return TRUE;
+    }
+
+    while (tooMany - fits > 1) {
+
+        middle = fits + (tooMany - fits) / 2;
+
+        RuleFreeMatcher( &RuleSet->Blocking );
+
+        if (!RuleBuildMatcher( &RuleSet->Blocking, Sources, middle, RULE_TARGET_FILE, RULE_ACTION_BLOCK )) {
+
+            return FALSE;
+        }
+
+        if (RuleFilterSetSize( &RuleSet->Blocking ) <= SPY_RULES_MAX_SIZE) {
+
+            fits = middle;
+
+        } else {
+
+            tooMany = middle;
+        }
+    }
+
+    RuleFreeMatcher( &RuleSet->Blocking );
+
+    if (!RuleBuildMatcher( &RuleSet->Blocking, Sources, fits, RULE_TARGET_FILE, RULE_ACTION_BLOCK )) {
+
+        return FALSE;
+    }
+
+    //
+    //  The filter cannot hash files, hash rules never reach it anyway.
+    //
+
+    for (index = fits; index < SourceCount; index++) {
+
+        if (Sources[index].Target == RULE_TARGET_FILE &&
+            Sources[index].Rule.Action >= RULE_ACTION_BLOCK &&
+            Sources[index].Type != RULE_TYPE_HASH) {
+
+            if (RuleSet->BlockingDropped++ == 0) {
+
+                RuleSet->BlockingFirstDropped = Sources[index].Rule.RuleId;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+VOID
+RulesFree (
+    _In_opt_ PRULE_SET RuleSet
+    )
+{
+    ULONG index;
+
+    if (RuleSet == NULL) {
+
+        return;
+    }
+
+    RuleFreeMatcher( &RuleSet->Process );
+    RuleFreeMatcher( &RuleSet->File );
+    RuleFreeMatcher( &RuleSet->Blocking );
+
+    for (index = 0; index < RuleSet->StringCount; index++) {
+
+        free( RuleSet->Strings[index] );
+    }
+
+    free( RuleSet->Strings );
+    free( RuleSet );
+}
+
+PRULE_SET
+RulesCompile (
+    _In_ sqlite3 *Db,
+    _In_z_ const char *Schema
+    )
+/*++
+
+Routine Description:
+
+    Reads the active rules and builds the matchers for them.  Rows with an
+    unknown action, type or target, or a string that cannot match anything,
+    are skipped and logged.
+
+Arguments:
+
+    Db - Connection the Rules table is reachable from.
+
+    Schema - Schema of the Rules table on Db.
+
+Return Value:
+
+    The rule set, free it with RulesFree.  NULL if the rules could not be
+    read or there was not enough memory.
+
+--*/
+{
+    sqlite3_stmt *stmt = NULL;
+    PRULE_SET ruleSet;
+    PRULE_SOURCE sources = NULL;
+    PRULE_SOURCE grown;
+    PRULE_SOURCE source;
+    ULONG count = 0;
+    ULONG capacity = 0;
+    PCWSTR text;
+    char *sql;
+    BOOLEAN built;
+
+    ruleSet = calloc( 1, sizeof( RULE_SET ) );
+
+    if (ruleSet == NULL) {
+
+        return NULL;
+    }
+
+    sql = sqlite3_mprintf( "SELECT RuleID, Action, RuleType, RuleTarget, RuleString"
+                           " FROM \"%w\".Rules WHERE Active = 1 AND Deleted = 0"
+                           " ORDER BY RuleID;",
+                           Schema );
+
+    if (sql == NULL || sqlite3_prepare_v2( Db, sql, -1, &stmt, NULL ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "Could not read the rules: %s", sqlite3_errmsg( Db ) );
+        sqlite3_free( sql );
+        free( ruleSet );
+        return NULL;
+    }
+
+    sqlite3_free( sql );
+
+    while (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        if (count == capacity) {
+
+            capacity = capacity ? capacity * 2 : 64;
+            grown = realloc( sources, capacity * sizeof( RULE_SOURCE ) );
+
+            if (grown == NULL) {
+
+                goto Fail;
+            }
+
+            sources = grown;
+        }
+
+        source = &sources[count];
+        source->Rule.RuleId = sqlite3_column_int( stmt, 0 );
+        source->Rule.Action = sqlite3_column_int( stmt, 1 );
+        source->Type = sqlite3_column_int( stmt, 2 );
+        source->Target = sqlite3_column_int( stmt, 3 );
+        text = sqlite3_column_text16( stmt, 4 );
+
+        if (source->Rule.RuleId == 0 ||
+            source->Rule.Action < RULE_ACTION_IGNORE || source->Rule.Action > RULE_ACTION_BLOCK ||
+            source->Type < RULE_TYPE_HASH || source->Type > RULE_TYPE_EXTENSION ||
+            source->Target < RULE_TARGET_PROCESS || source->Target > RULE_TARGET_FILE ||
+            text == NULL) {
+
+            WriteToLogAnsi( "Rule %d is not valid, ignored", source->Rule.RuleId );
+            continue;
+        }
+
+        source->String = RuleNormalize( text, source->Type, source->Target );
+
+        if (source->String == NULL) {
+
+            WriteToLogAnsi( "Rule %d: \"%S\" cannot match anything, ignored", source->Rule.RuleId, text );
+            continue;
+        }
+
+        count++;
+    }
+
+    sqlite3_finalize( stmt );
+    stmt = NULL;
+
+    built = RuleBuildMatcher( &ruleSet->Process, sources, count, RULE_TARGET_PROCESS, RULE_ACTION_IGNORE ) &&
+            RuleBuildMatcher( &ruleSet->File, sources, count, RULE_TARGET_FILE, RULE_ACTION_IGNORE ) &&
+            RuleBuildBlocking( ruleSet, sources, count );
+
+    //
+    //  The matchers point into the strings, the rule set keeps them.
+    //
+
+    ruleSet->Strings = malloc( (count ? count : 1) * sizeof( PWCHAR ) );
+
+    if (ruleSet->Strings == NULL) {
+
+        goto Fail;
+    }
+
+    for (ruleSet->StringCount = 0; ruleSet->StringCount < count; ruleSet->StringCount++) {
+
+        ruleSet->Strings[ruleSet->StringCount] = sources[ruleSet->StringCount].String;
+    }
+
+    free( sources );
+
+    if (!built) {
+
+        RulesFree( ruleSet );
+        return NULL;
+    }
+
+    return ruleSet;
+
+Fail:
+
+    sqlite3_finalize( stmt );
+
+    while (count > 0) {
+
+        free( sources[--count].String );
+    }
+
+    free( sources );
+    RulesFree( ruleSet );
+    return NULL;
+}
+
+BOOLEAN
+RulesWantProcessPath (
+    _In_ PRULE_SET RuleSet
+    )
+{
+    return RuleSet->Process.RuleCount != 0;
+}
+
+BOOLEAN
+RulesWantDigest (
+    _In_ PRULE_SET RuleSet,
+    _In_ LONG Target
+    )
+{
+    PRULE_MATCHER matcher = (Target == RULE_TARGET_FILE) ? &RuleSet->File : &RuleSet->Process;
+
+    return matcher->DigestCount != 0;
+}
+
+static RULE_REF
+RuleMatchTarget (
+    _In_ PRULE_MATCHER Matcher,
+    _In_opt_z_ PCWSTR Path,
+    _In_opt_ const UCHAR *Digest
+    )
+{
+    RULE_REF best = { 0, 0 };
+    PRULE_DIGEST entry;
+    PCWSTR name;
+
+    if (Matcher->RuleCount == 0) {
+
+        return best;
+    }
+
+    if (Path != NULL) {
+
+        best = SpyRulesStronger( best, RuleTrieMatch( &Matcher->Locations, Path, &name ) );
+        best = SpyRulesStronger( best, RuleExtensionMatch( Matcher, name ) );
+    }
+
+    if (Digest != NULL) {
+
+        entry = RuleDigestFind( Matcher, Digest );
+
+        if (entry->Used) {
+
+            best = SpyRulesStronger( best, entry->Rule );
+        }
+    }
+
+    return best;
+}
+
+RULE_REF
+RulesMatch (
+    _In_ PRULE_SET RuleSet,
+    _In_ PRULE_INPUT Input
+    )
+/*++
+
+Routine Description:
+
+    Evaluates every rule against one record.
+
+Arguments:
+
+    RuleSet - Compiled rules.
+
+    Input - The record's file name, process image path and optionally
+        their SHA-256 digests.
+
+Return Value:
+
+    The strongest matching rule, RuleId is 0 if none matched.
+
+--*/
+{
+    RULE_REF best;
+
+    best = RuleMatchTarget( &RuleSet->File, Input->FileName, Input->FileDigest );
+    best = SpyRulesStronger( best, RuleMatchTarget( &RuleSet->Process, Input->ProcessPath, Input->ProcessDigest ) );
+
+    return best;
+}
+
+PSPY_RULES_HEADER
+RulesBuildFilterSet (
+    _In_ PRULE_SET RuleSet
+    )
+/*++
+
+Routine Description:
+
+    Lays the location and extension rules that block out in the format the
+    filter matches with.  The trie and the extension table are copied slot
+    for slot, only the strings move into the text area.  The filter cannot
+    hash files, hash rules are left to the log writer.
+
+Arguments:
+
+    RuleSet - Compiled rules.
+
+Return Value:
+
+    The rule set to send with SetMiniSpyRules, its Size member is the number
+    of bytes to send.  Free it with free.  NULL if there was not enough
+    memory, send RulesEmptyFilterSet then.
+
+--*/
+{
+    PRULE_MATCHER matcher = &RuleSet->Blocking;
+    PRULE_TRIE trie = &matcher->Locations;
+    PSPY_RULES_HEADER rules;
+    PSPY_RULE_EDGE edge;
+    PSPY_RULE_EXTENSION extension;
+    PWCHAR text;
+    ULONGLONG size;
+    ULONG index;
+
+    size = RuleFilterSetSize( matcher );
+
+    if (RuleSet->BlockingDropped != 0) {
+
+        WriteToLogAnsi( "%lu blocking rules do not fit in the filter, it does not enforce the ones from RuleID %d on",
+                        RuleSet->BlockingDropped,
+                        RuleSet->BlockingFirstDropped );
+        WriteAlertToDatabase( "%lu blocking rules do not fit in the filter, it does not enforce the ones from RuleID %d on",
+                              RuleSet->BlockingDropped,
+                              RuleSet->BlockingFirstDropped );
+    }
+
+    if (size > SPY_RULES_MAX_SIZE) {
+
+        WriteToLogAnsi( "%lu blocking rules need %I64u bytes, more than the filter accepts", matcher->RuleCount, size );
+        return NULL;
+    }
+
+    rules = calloc( 1, (size_t)size );
+
+    if (rules == NULL) {
+
+        return NULL;
+    }
+
+    rules->Version = SPY_RULES_VERSION;
+    rules->Size = (ULONG)size;
+    rules->RuleCount = matcher->RuleCount;
+
+    rules->NodeCount = trie->NodeCount;
+    rules->NodeOffset = sizeof( SPY_RULES_HEADER );
+
+    rules->EdgeMask = trie->EdgeMask;
+    rules->EdgeOffset = rules->NodeOffset + trie->NodeCount * sizeof( SPY_RULE_REF );
+
+    rules->ExtensionMask = matcher->ExtensionMask;
+    rules->ExtensionOffset = rules->EdgeOffset + (trie->EdgeMask + 1) * sizeof( SPY_RULE_EDGE );
+
+    rules->TextOffset = rules->ExtensionOffset + (matcher->ExtensionMask + 1) * sizeof( SPY_RULE_EXTENSION );
+
+    memcpy( SpyRulesNodes( rules ), trie->Nodes, trie->NodeCount * sizeof( SPY_RULE_REF ) );
+
+    text = SpyRulesText( rules );
+
+    for (index = 0; index <= trie->EdgeMask; index++) {
+
+        if (trie->Edges[index].Child == 0) {
+
+            continue;
+        }
+
+        edge = &SpyRulesEdges( rules )[index];
+        edge->Parent = trie->Edges[index].Parent;
+        edge->Hash = trie->Edges[index].Hash;
+        edge->Child = trie->Edges[index].Child;
+        edge->Length = trie->Edges[index].Length;
+        edge->Text = rules->TextLength;
+
+        memcpy( text + rules->TextLength, trie->Edges[index].Text, edge->Length * sizeof( WCHAR ) );
+        rules->TextLength += edge->Length;
+    }
+
+    for (index = 0; index <= matcher->ExtensionMask; index++) {
+
+        if (matcher->Extensions[index].Length == 0) {
+
+            continue;
+        }
+
+        extension = &SpyRulesExtensions( rules )[index];
+        extension->Hash = matcher->Extensions[index].Hash;
+        extension->Length = matcher->Extensions[index].Length;
+        extension->Rule = matcher->Extensions[index].Rule;
+        extension->Text = rules->TextLength;
+
+        memcpy( text + rules->TextLength, matcher->Extensions[index].Text, extension->Length * sizeof( WCHAR ) );
+        rules->TextLength += extension->Length;
+    }
+
+    return rules;
+}
+
+//
+//  A rule set that blocks nothing, for when the rules cannot be built.
+//
+
+typedef struct _RULE_EMPTY_FILTER_SET {
+
+    SPY_RULES_HEADER Header;
+    SPY_RULE_REF Root;
+    SPY_RULE_EDGE Edge;
+    SPY_RULE_EXTENSION Extension;
+
+} RULE_EMPTY_FILTER_SET;
+
+static RULE_EMPTY_FILTER_SET RuleEmptyFilterSet = {
+
+    {
+        SPY_RULES_VERSION,
+        sizeof( RULE_EMPTY_FILTER_SET ),
+        0,
+        1,
+        FIELD_OFFSET( RULE_EMPTY_FILTER_SET, Root ),
+        0,
+        FIELD_OFFSET( RULE_EMPTY_FILTER_SET, Edge ),
+        0,
+        FIELD_OFFSET( RULE_EMPTY_FILTER_SET, Extension ),
+        0,
+        sizeof( RULE_EMPTY_FILTER_SET )
+    },
+    { 0, 0 },
+    { 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, { 0, 0 } }
+};
+
+PSPY_RULES_HEADER
+RulesEmptyFilterSet (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    The rule set to send when RulesBuildFilterSet fails, so the filter
+    stops enforcing rules that may have been deleted since.  Do not free it.
+
+Return Value:
+
+    A rule set without rules.
+
+--*/
+{
+    return &RuleEmptyFilterSet.Header;
+}
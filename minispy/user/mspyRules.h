@@ -0,0 +1,178 @@
+/*++
+
+Module Name:
+
+    mspyRules.h
+
+Abstract:
+
+    Compiles the active rows of the Rules table into matchers the log
+    writer runs against every record: a trie of path components for
+    location rules, a hash set of extensions and a hash set of SHA-256
+    digests, one of each for process rules and for file rules.  The file
+    rules that block are also laid out in the format of spyRules.h for the
+    filter to enforce.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYRULES_H__
+#define __MSPYRULES_H__
+
+#include <windows.h>
+#include <sqlite3.h>
+#include "minispy.h"
+#include "spyRules.h"
+
+#define RULE_DIGEST_SIZE    32      // SHA-256
+
+//
+//  A rule as it applies to a match.  RuleId 0 means no rule.
+//
+
+typedef SPY_RULE_REF RULE_REF, *PRULE_REF;
+
+//
+//  Trie over path components.  Node 0 is the root.  Edges live in one open
+//  addressing table keyed by parent node and component, so walking a path
+//  costs one probe per component however many rules there are.
+//
+
+typedef struct _RULE_TRIE_EDGE {
+
+    ULONG Parent;
+    ULONG Hash;
+    ULONG Child;            // 0 means the slot is empty
+    USHORT Length;          // in WCHARs
+    PCWSTR Text;            // upcased component
+    RULE_REF Rule;          // Nodes[Child], read along with the edge
+
+} RULE_TRIE_EDGE, *PRULE_TRIE_EDGE;
+
+typedef struct _RULE_TRIE {
+
+    ULONG NodeCount;
+    PRULE_REF Nodes;        // rule ending at each node
+
+    ULONG EdgeMask;
+    PRULE_TRIE_EDGE Edges;
+
+} RULE_TRIE, *PRULE_TRIE;
+
+typedef struct _RULE_EXTENSION {
+
+    ULONG Hash;
+    USHORT Length;          // 0 means the slot is empty
+    PCWSTR Text;            // upcased, without the dot
+    RULE_REF Rule;
+
+} RULE_EXTENSION, *PRULE_EXTENSION;
+
+typedef struct _RULE_DIGEST {
+
+    BOOLEAN Used;
+    UCHAR Digest[RULE_DIGEST_SIZE];
+    RULE_REF Rule;
+
+} RULE_DIGEST, *PRULE_DIGEST;
+
+//
+//  Every matcher for one RuleTarget.
+//
+
+typedef struct _RULE_MATCHER {
+
+    RULE_TRIE Locations;
+
+    ULONG ExtensionMask;
+    PRULE_EXTENSION Extensions;
+
+    ULONG DigestMask;
+    PRULE_DIGEST Digests;
+    ULONG DigestCount;
+
+    ULONG RuleCount;
+
+} RULE_MATCHER, *PRULE_MATCHER;
+
+typedef struct _RULE_SET {
+
+    RULE_MATCHER Process;
+    RULE_MATCHER File;
+
+    //
+    //  The file rules whose action is Block, what RulesBuildFilterSet
+    //  hands to the filter.  When they do not all fit in the filter it
+    //  gets the ones before BlockingFirstDropped, in RuleID order, and the
+    //  BlockingDropped location and extension rules from there on are
+    //  only matched by the log writer.
+    //
+
+    RULE_MATCHER Blocking;
+    ULONG BlockingDropped;
+    LONG BlockingFirstDropped;
+
+    //
+    //  Upcased copies of every rule string, the matchers point into them.
+    //
+
+    ULONG StringCount;
+    PWCHAR *Strings;
+
+} RULE_SET, *PRULE_SET;
+
+//
+//  What the writer needs to evaluate a record.  Digests are optional, a
+//  hash rule can only match when the caller supplies the digest.
+//
+
+typedef struct _RULE_INPUT {
+
+    PCWSTR FileName;
+    PCWSTR ProcessPath;
+    const UCHAR *FileDigest;
+    const UCHAR *ProcessDigest;
+
+} RULE_INPUT, *PRULE_INPUT;
+
+PRULE_SET
+RulesCompile (
+    _In_ sqlite3 *Db,
+    _In_z_ const char *Schema
+    );
+
+VOID
+RulesFree (
+    _In_opt_ PRULE_SET RuleSet
+    );
+
+BOOLEAN
+RulesWantProcessPath (
+    _In_ PRULE_SET RuleSet
+    );
+
+BOOLEAN
+RulesWantDigest (
+    _In_ PRULE_SET RuleSet,
+    _In_ LONG Target
+    );
+
+RULE_REF
+RulesMatch (
+    _In_ PRULE_SET RuleSet,
+    _In_ PRULE_INPUT Input
+    );
+
+PSPY_RULES_HEADER
+RulesBuildFilterSet (
+    _In_ PRULE_SET RuleSet
+    );
+
+PSPY_RULES_HEADER
+RulesEmptyFilterSet (
+    VOID
+    );
+
+#endif //__MSPYRULES_H__
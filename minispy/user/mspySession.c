@@ -0,0 +1,555 @@
+/*++
+
+Module Name:
+
+    mspySession.c
+
+Abstract:
+
+    Reconstructs handle sessions from the records as the log writer
+    inserts them.
+
+    A session starts with a successful IRP_MJ_CREATE on a FileObject, or
+    with the first operation seen on one opened before logging started.
+    Reads, writes, bytes transferred and failures are counted until
+    IRP_MJ_CLOSE, when the session is written to HandleSessions in the
+    writer's current batch.  Paging I/O is counted as other operations,
+    it is not done through the handle.
+
+    Sessions live in a fixed table of SESSION_MAX_OPEN entries, hashed by
+    FileObject and kept on a list from most to least recently used.
+    Sessions idle past SESSION_IDLE_TIMEOUT are written out from the old
+    end of the list, and when the table is full the oldest is written out
+    to make room, so memory stays bounded however many closes are missed.
+
+    Only the log writer thread calls in here.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspySession.h"
+
+#define SESSION_BUCKETS         SESSION_MAX_OPEN        // power of two
+#define SESSION_NONE            MAXULONG
+
+typedef struct _SESSION {
+
+    ULONG Next;             // bucket chain, or the free list
+    ULONG Newer;
+    ULONG Older;
+
+    FILE_ID FileObject;
+    LONGLONG ProcessId;
+    char *ProcessFilePath;
+    char *Name;
+
+    LONGLONG OpenTime;
+    LONGLONG CleanupTime;
+    LONGLONG LastTime;
+
+    BOOLEAN CreateSeen;
+    BOOLEAN CleanupSeen;
+
+    ULONG Reads;
+    ULONG Writes;
+    ULONG OtherOps;
+    ULONG Errors;
+    ULONGLONG BytesRead;
+    ULONGLONG BytesWritten;
+
+} SESSION, *PSESSION;
+
+typedef struct _SESSION_STATE {
+
+    PSESSION Entries;
+    ULONG Buckets[SESSION_BUCKETS];
+    ULONG Free;
+
+    //
+    //  Most and least recently used sessions.
+    //
+
+    ULONG Newest;
+    ULONG Oldest;
+
+    sqlite3_stmt *Insert;
+    sqlite3 *Db;
+
+} SESSION_STATE;
+
+static SESSION_STATE Sessions;
+
+static ULONG
+SessionBucket (
+    _In_ FILE_ID FileObject
+    )
+{
+    //
+    //  Pool allocations are 16 byte aligned, the low bits carry nothing.
+    //
+
+    return (ULONG)(((ULONGLONG)FileObject >> 4) * 0x9E3779B97F4A7C15ULL >> 32) & (SESSION_BUCKETS - 1);
+}
+
+static ULONG
+SessionFind (
+    _In_ FILE_ID FileObject
+    )
+{
+    ULONG index = Sessions.Buckets[SessionBucket( FileObject )];
+
+    while (index != SESSION_NONE && Sessions.Entries[index].FileObject != FileObject) {
+
+        index = Sessions.Entries[index].Next;
+    }
+
+    return index;
+}
+
+static VOID
+SessionUnlinkAge (
+    _In_ ULONG Index
+    )
+{
+    PSESSION session = &Sessions.Entries[Index];
+
+    if (session->Newer != SESSION_NONE) {
+
+        Sessions.Entries[session->Newer].Older = session->Older;
+
+    } else {
+
+        Sessions.Newest = session->Older;
+    }
+
+    if (session->Older != SESSION_NONE) {
+
+        Sessions.Entries[session->Older].Newer = session->Newer;
+
+    } else {
+
+        Sessions.Oldest = session->Newer;
+    }
+}
+
+static VOID
+SessionTouch (
+    _In_ ULONG Index
+    )
+/*++
+
+Routine Description:
+
+    Moves a session to the most recently used end of the list.
+
+--*/
+{
+    PSESSION session = &Sessions.Entries[Index];
+
+    if (Sessions.Newest == Index) {
+
+        return;
+    }
+
+    SessionUnlinkAge( Index );
+
+    session->Newer = SESSION_NONE;
+    session->Older = Sessions.Newest;
+
+    if (Sessions.Newest != SESSION_NONE) {
+
+        Sessions.Entries[Sessions.Newest].Newer = Index;
+    }
+
+    Sessions.Newest = Index;
+
+    if (Sessions.Oldest == SESSION_NONE) {
+
+        Sessions.Oldest = Index;
+    }
+}
+
+static VOID
+SessionEnd (
+    _In_ ULONG Index,
+    _In_z_ const char *Reason,
+    _In_ LONGLONG CloseTime
+    )
+/*++
+
+Routine Description:
+
+    Writes a session to HandleSessions and frees its entry.
+
+--*/
+{
+    PSESSION session = &Sessions.Entries[Index];
+    sqlite3_stmt *stmt = Sessions.Insert;
+    ULONG *link;
+    char fileObject[32];
+
+    if (stmt != NULL) {
+
+        sprintf_s( fileObject, sizeof( fileObject ), "%p", (void*)session->FileObject );
+
+        sqlite3_bind_text( stmt, 1, fileObject, -1, SQLITE_TRANSIENT );
+        sqlite3_bind_int64( stmt, 2, session->ProcessId );
+        sqlite3_bind_text( stmt, 3, session->ProcessFilePath, -1, SQLITE_STATIC );
+        sqlite3_bind_text( stmt, 4, session->Name, -1, SQLITE_STATIC );
+        sqlite3_bind_int64( stmt, 5, session->OpenTime );
+
+        if (session->CleanupSeen) {
+
+            sqlite3_bind_int64( stmt, 6, session->CleanupTime );
+
+        } else {
+
+            sqlite3_bind_null( stmt, 6 );
+        }
+
+        sqlite3_bind_int64( stmt, 7, CloseTime );
+        sqlite3_bind_int64( stmt, 8, CloseTime - session->OpenTime );
+        sqlite3_bind_int( stmt, 9, session->CreateSeen );
+        sqlite3_bind_text( stmt, 10, Reason, -1, SQLITE_STATIC );
+        sqlite3_bind_int64( stmt, 11, session->Reads );
+        sqlite3_bind_int64( stmt, 12, session->Writes );
+        sqlite3_bind_int64( stmt, 13, session->OtherOps );
+        sqlite3_bind_int64( stmt, 14, (sqlite3_int64)session->BytesRead );
+        sqlite3_bind_int64( stmt, 15, (sqlite3_int64)session->BytesWritten );
+        sqlite3_bind_int64( stmt, 16, session->Errors );
+
+        if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+            WriteToLogAnsi( "SQLite insert failed on Handle Session: %s", sqlite3_errmsg( Sessions.Db ) );
+        }
+
+        sqlite3_reset( stmt );
+    }
+
+    //
+    //  Unlink from the bucket and the age list, then free.
+    //
+
+    link = &Sessions.Buckets[SessionBucket( session->FileObject )];
+
+    while (*link != Index) {
+
+        link = &Sessions.Entries[*link].Next;
+    }
+
+    *link = session->Next;
+
+    SessionUnlinkAge( Index );
+
+    free( session->ProcessFilePath );
+    free( session->Name );
+    memset( session, 0, sizeof( SESSION ) );
+
+    session->Next = Sessions.Free;
+    Sessions.Free = Index;
+}
+
+static ULONG
+SessionBegin (
+    _In_ PRECORD_DATA RecordData,
+    _In_z_ const char *Name,
+    _In_z_ const char *ProcessFilePath,
+    _In_ BOOLEAN CreateSeen
+    )
+{
+    PSESSION session;
+    ULONG bucket;
+    ULONG index;
+
+    if (Sessions.Free == SESSION_NONE) {
+
+        SessionEnd( Sessions.Oldest, "Evicted", Sessions.Entries[Sessions.Oldest].LastTime );
+    }
+
+    index = Sessions.Free;
+    session = &Sessions.Entries[index];
+    Sessions.Free = session->Next;
+
+    session->FileObject = RecordData->FileObject;
+    session->ProcessId = (LONGLONG)RecordData->ProcessId;
+    session->ProcessFilePath = _strdup( ProcessFilePath );
+    session->Name = _strdup( Name );
+    session->OpenTime = RecordData->OriginatingTime.QuadPart;
+    session->LastTime = session->OpenTime;
+    session->CreateSeen = CreateSeen;
+
+    if (session->ProcessFilePath == NULL || session->Name == NULL) {
+
+        free( session->ProcessFilePath );
+        free( session->Name );
+        memset( session, 0, sizeof( SESSION ) );
+        session->Next = Sessions.Free;
+        Sessions.Free = index;
+        return SESSION_NONE;
+    }
+
+    bucket = SessionBucket( session->FileObject );
+    session->Next = Sessions.Buckets[bucket];
+    Sessions.Buckets[bucket] = index;
+
+    session->Newer = SESSION_NONE;
+    session->Older = SESSION_NONE;
+
+    if (Sessions.Newest == SESSION_NONE) {
+
+        Sessions.Newest = index;
+        Sessions.Oldest = index;
+
+    } else {
+
+        session->Older = Sessions.Newest;
+        Sessions.Entries[Sessions.Newest].Newer = index;
+        Sessions.Newest = index;
+    }
+
+    return index;
+}
+
+BOOLEAN
+SessionPrepare (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Prepares the insert on the writer's connection.  The sessions being
+    followed carry over from the previous connection.
+
+--*/
+{
+    ULONG index;
+
+    if (Sessions.Entries == NULL) {
+
+        Sessions.Entries = calloc( SESSION_MAX_OPEN, sizeof( SESSION ) );
+
+        if (Sessions.Entries == NULL) {
+
+            return FALSE;
+        }
+
+        for (index = 0; index < SESSION_BUCKETS; index++) {
+
+            Sessions.Buckets[index] = SESSION_NONE;
+        }
+
+        for (index = 0; index < SESSION_MAX_OPEN; index++) {
+
+            Sessions.Entries[index].Next = (index + 1 < SESSION_MAX_OPEN) ? index + 1 : SESSION_NONE;
+        }
+
+        Sessions.Free = 0;
+        Sessions.Newest = SESSION_NONE;
+        Sessions.Oldest = SESSION_NONE;
+    }
+
+    Sessions.Db = Db;
+
+    if (sqlite3_prepare_v2( Db,
+                            "INSERT INTO HandleSessions (FileObj, ProcessId, ProcessFilePath, OpFileName,"
+                            " OpenTime, CleanupTime, CloseTime, Duration, CreateSeen, EndReason,"
+                            " Reads, Writes, OtherOps, BytesRead, BytesWritten, Errors)"
+                            " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);",
+                            -1,
+                            &Sessions.Insert,
+                            NULL ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "Failed to prepare handle session insert: %s", sqlite3_errmsg( Db ) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+SessionFinalize (
+    VOID
+    )
+{
+    sqlite3_finalize( Sessions.Insert );
+    Sessions.Insert = NULL;
+    Sessions.Db = NULL;
+}
+
+VOID
+SessionAdd (
+    _In_ PRECORD_DATA RecordData,
+    _In_z_ const char *Name,
+    _In_z_ const char *ProcessFilePath
+    )
+/*++
+
+Routine Description:
+
+    Applies one logged record to the session of its FileObject.  Sessions
+    that end are inserted on the writer's connection, so call with the
+    batch open.
+
+Arguments:
+
+    RecordData - The record.
+
+    Name - Its file name.
+
+    ProcessFilePath - Image of the process that issued it.
+
+--*/
+{
+    LONGLONG now = RecordData->OriginatingTime.QuadPart;
+    BOOLEAN failed = ((ULONG)RecordData->Status >= 0xC0000000);
+    PSESSION session;
+    ULONG index;
+
+    if (Sessions.Entries == NULL || RecordData->FileObject == 0) {
+
+        return;
+    }
+
+    //
+    //  Write out the sessions nothing happened to for too long.
+    //
+
+    while (Sessions.Oldest != SESSION_NONE &&
+           Sessions.Entries[Sessions.Oldest].LastTime + SESSION_IDLE_TIMEOUT < now) {
+
+        SessionEnd( Sessions.Oldest, "Idle", Sessions.Entries[Sessions.Oldest].LastTime );
+    }
+
+    index = SessionFind( RecordData->FileObject );
+
+    if (RecordData->CallbackMajorId == IRP_MJ_CREATE) {
+
+        //
+        //  A failed create leaves no handle.  A successful one on a
+        //  FileObject we follow means its close was missed and the memory
+        //  reused.
+        //
+
+        if ((LONG)RecordData->Status < 0) {
+
+            return;
+        }
+
+        if (index != SESSION_NONE) {
+
+            SessionEnd( index, "Reused", Sessions.Entries[index].LastTime );
+        }
+
+        SessionBegin( RecordData, Name, ProcessFilePath, TRUE );
+        return;
+    }
+
+    if (index == SESSION_NONE) {
+
+        //
+        //  Opened before we started, or its create was not logged.  A close
+        //  alone is not worth a session.
+        //
+
+        if (RecordData->CallbackMajorId == IRP_MJ_CLOSE) {
+
+            return;
+        }
+
+        index = SessionBegin( RecordData, Name, ProcessFilePath, FALSE );
+
+        if (index == SESSION_NONE) {
+
+            return;
+        }
+    }
+
+    session = &Sessions.Entries[index];
+    session->LastTime = max( session->LastTime, now );
+    SessionTouch( index );
+
+    if (failed) {
+
+        session->Errors++;
+    }
+
+    switch (RecordData->CallbackMajorId) {
+
+    case IRP_MJ_READ:
+
+        if (RecordData->IrpFlags & IRP_PAGING_IO) {
+
+            session->OtherOps++;
+            break;
+        }
+
+        session->Reads++;
+        session->BytesRead += failed ? 0 : RecordData->Information;
+        break;
+
+    case IRP_MJ_WRITE:
+
+        if (RecordData->IrpFlags & IRP_PAGING_IO) {
+
+            session->OtherOps++;
+            break;
+        }
+
+        session->Writes++;
+        session->BytesWritten += failed ? 0 : RecordData->Information;
+        break;
+
+    case IRP_MJ_CLEANUP:
+
+        session->CleanupSeen = TRUE;
+        session->CleanupTime = now;
+        session->OtherOps++;
+        break;
+
+    case IRP_MJ_CLOSE:
+
+        SessionEnd( index, "Close", now );
+        break;
+
+    default:
+
+        session->OtherOps++;
+        break;
+    }
+}
+
+VOID
+SessionEndAll (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Writes out every session still open, at shutdown.  Call with the batch
+    open.
+
+--*/
+{
+    if (Sessions.Entries == NULL) {
+
+        return;
+    }
+
+    while (Sessions.Oldest != SESSION_NONE) {
+
+        SessionEnd( Sessions.Oldest, "Open", Sessions.Entries[Sessions.Oldest].LastTime );
+    }
+}
@@ -0,0 +1,62 @@
+/*++
+
+Module Name:
+
+    mspySession.h
+
+Abstract:
+
+    Follows every FileObject from its create to its close as records are
+    logged and writes one HandleSessions row per handle, so the life of a
+    handle does not have to be pieced together from MinifilterLog.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYSESSION_H__
+#define __MSPYSESSION_H__
+
+#include <windows.h>
+#include <sqlite3.h>
+#include "minispy.h"
+
+//
+//  At most this many handles are followed at once.  When a new one comes
+//  along the one idle the longest is written out as Evicted.
+//
+
+#define SESSION_MAX_OPEN        16384
+
+//
+//  A handle nothing was done with for this long, in record time, is
+//  written out as Idle.  Its close may never be seen, for instance when
+//  the filter dropped the record.
+//
+
+#define SESSION_IDLE_TIMEOUT    (10LL * 60 * 10000000)     // 10 minutes in 100ns
+
+BOOLEAN
+SessionPrepare (
+    _In_ sqlite3 *Db
+    );
+
+VOID
+SessionFinalize (
+    VOID
+    );
+
+VOID
+SessionAdd (
+    _In_ PRECORD_DATA RecordData,
+    _In_z_ const char *Name,
+    _In_z_ const char *ProcessFilePath
+    );
+
+VOID
+SessionEndAll (
+    VOID
+    );
+
+#endif //__MSPYSESSION_H__
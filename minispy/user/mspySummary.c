@@ -0,0 +1,701 @@
+/*++
+
+Module Name:
+
+    mspySummary.c
+
+Abstract:
+
+    Maintains the Summary_* tables that back View_TotalOperations,
+    View_OperationBreakdown, View_RequestorModeCount, View_OpStatusCount,
+    View_ProcessOpCounts and View_FileOpCounts.
+
+    The log writer calls SummaryAdd for every row it inserts.  The counts
+    are grouped in memory and SummaryFlush turns each group into a single
+    upsert, inside the same transaction as the rows themselves, so the
+    summaries and MinifilterLog always commit together.
+
+    SummaryCheck recomputes every summary from MinifilterLog and reports
+    the groups that differ, optionally rebuilding them.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspySummary.h"
+
+typedef enum _SUMMARY_KIND {
+
+    SummaryTotals,
+    SummaryOperations,
+    SummaryRequestorMode,
+    SummaryOpStatus,
+    SummaryProcesses,
+    SummaryFiles,
+    SummaryKindCount
+
+} SUMMARY_KIND;
+
+//
+//  One pending group.  Which key fields are used depends on Kind.
+//
+
+typedef struct _SUMMARY_GROUP {
+
+    ULONG Hash;
+    SUMMARY_KIND Kind;
+    LONGLONG IntKey;
+    char *Text1;
+    char *Text2;
+    LONGLONG Count;
+
+} SUMMARY_GROUP, *PSUMMARY_GROUP;
+
+typedef struct _SUMMARY_STATE {
+
+    //
+    //  Open addressing table of pending groups, SlotCount is a power of
+    //  two and at most half full.
+    //
+
+    PSUMMARY_GROUP Slots;
+    ULONG SlotCount;
+    ULONG Used;
+
+    sqlite3_stmt *Upsert[SummaryKindCount];
+
+} SUMMARY_STATE;
+
+static SUMMARY_STATE Summary;
+
+#define SUMMARY_INITIAL_SLOTS   1024
+
+static const char *SummaryUpsertSql[SummaryKindCount] = {
+
+    "INSERT INTO Summary_Totals (Name, Count) VALUES ('Operations', ?3) "
+    "ON CONFLICT (Name) DO UPDATE SET Count = Count + excluded.Count;",
+
+    "INSERT INTO Summary_Operations (MajorOp, MinorOp, Count) VALUES (?1, ?2, ?3) "
+    "ON CONFLICT (MajorOp, MinorOp) DO UPDATE SET Count = Count + excluded.Count;",
+
+    "INSERT INTO Summary_RequestorMode (RequestorMode, Count) VALUES (?1, ?3) "
+    "ON CONFLICT (RequestorMode) DO UPDATE SET Count = Count + excluded.Count;",
+
+    "INSERT INTO Summary_OpStatus (OpStatus, Count) VALUES (?1, ?3) "
+    "ON CONFLICT (OpStatus) DO UPDATE SET Count = Count + excluded.Count;",
+
+    "INSERT INTO Summary_Processes (ProcessId, ProcessFilePath, Count) VALUES (?4, ?1, ?3) "
+    "ON CONFLICT (ProcessId, ProcessFilePath) DO UPDATE SET Count = Count + excluded.Count;",
+
+    "INSERT INTO Summary_Files (OpFileName, Count) VALUES (?1, ?3) "
+    "ON CONFLICT (OpFileName) DO UPDATE SET Count = Count + excluded.Count;"
+};
+
+//
+//  Recomputes every summary from the raw log.  Files are counted by FileID,
+//  from Index_MinifilterLog_File alone, and only the counts are given their
+//  name.  Rows logged before Files existed are counted apart by the
+//  OpFileName they hold, counting both together reads every row.
+//
+
+static const char *SummaryRebuildSql =
+    "DELETE FROM Summary_Totals;"
+    "INSERT INTO Summary_Totals (Name, Count) "
+    "    SELECT 'Operations', COUNT(*) FROM MinifilterLog;"
+    "DELETE FROM Summary_Operations;"
+    "INSERT INTO Summary_Operations (MajorOp, MinorOp, Count) "
+    "    SELECT COALESCE(MajorOp, ''), COALESCE(MinorOp, ''), COUNT(*) FROM MinifilterLog GROUP BY 1, 2;"
+    "DELETE FROM Summary_RequestorMode;"
+    "INSERT INTO Summary_RequestorMode (RequestorMode, Count) "
+    "    SELECT COALESCE(RequestorMode, ''), COUNT(*) FROM MinifilterLog GROUP BY 1;"
+    "DELETE FROM Summary_OpStatus;"
+    "INSERT INTO Summary_OpStatus (OpStatus, Count) "
+    "    SELECT COALESCE(OpStatus, ''), COUNT(*) FROM MinifilterLog GROUP BY 1;"
+    "DELETE FROM Summary_Processes;"
+    "INSERT INTO Summary_Processes (ProcessId, ProcessFilePath, Count) "
+    "    SELECT ProcessId, COALESCE(ProcessFilePath, ''), COUNT(*) FROM MinifilterLog GROUP BY 1, 2;"
+    "DELETE FROM Summary_Files;"
+    "INSERT INTO Summary_Files (OpFileName, Count) "
+    "    SELECT COALESCE(f.Path, r.OpFileName, ''), SUM(r.c) FROM "
+    "        (SELECT FileID, NULL OpFileName, COUNT(*) c FROM MinifilterLog WHERE FileID IS NOT NULL GROUP BY 1 "
+    "         UNION ALL "
+    "         SELECT NULL, OpFileName, COUNT(*) FROM MinifilterLog WHERE FileID IS NULL GROUP BY 2) r "
+    "        LEFT JOIN Files f ON f.FileID = r.FileID GROUP BY 1;";
+
+//
+//  Each query counts the groups present on one side but not the other,
+//  in both directions.
+//
+
+static const struct {
+
+    const char *Table;
+    const char *Sql;
+
+} SummaryCheckSql[] = {
+
+    { "Summary_Totals",
+      "SELECT (SELECT COUNT(*) FROM MinifilterLog) != "
+      "       COALESCE((SELECT Count FROM Summary_Totals WHERE Name = 'Operations'), 0);" },
+
+    { "Summary_Operations",
+      "WITH r AS (SELECT COALESCE(MajorOp, '') a, COALESCE(MinorOp, '') b, COUNT(*) c FROM MinifilterLog GROUP BY 1, 2), "
+      "     s AS (SELECT MajorOp a, MinorOp b, Count c FROM Summary_Operations WHERE Count != 0) "
+      "SELECT (SELECT COUNT(*) FROM (SELECT * FROM r EXCEPT SELECT * FROM s)) + "
+      "       (SELECT COUNT(*) FROM (SELECT * FROM s EXCEPT SELECT * FROM r));" },
+
+    { "Summary_RequestorMode",
+      "WITH r AS (SELECT COALESCE(RequestorMode, '') a, COUNT(*) c FROM MinifilterLog GROUP BY 1), "
+      "     s AS (SELECT RequestorMode a, Count c FROM Summary_RequestorMode WHERE Count != 0) "
+      "SELECT (SELECT COUNT(*) FROM (SELECT * FROM r EXCEPT SELECT * FROM s)) + "
+      "       (SELECT COUNT(*) FROM (SELECT * FROM s EXCEPT SELECT * FROM r));" },
+
+    { "Summary_OpStatus",
+      "WITH r AS (SELECT COALESCE(OpStatus, '') a, COUNT(*) c FROM MinifilterLog GROUP BY 1), "
+      "     s AS (SELECT OpStatus a, Count c FROM Summary_OpStatus WHERE Count != 0) "
+      "SELECT (SELECT COUNT(*) FROM (SELECT * FROM r EXCEPT SELECT * FROM s)) + "
+      "       (SELECT COUNT(*) FROM (SELECT * FROM s EXCEPT SELECT * FROM r));" },
+
+    { "Summary_Processes",
+      "WITH r AS (SELECT ProcessId a, COALESCE(ProcessFilePath, '') b, COUNT(*) c FROM MinifilterLog GROUP BY 1, 2), "
+      "     s AS (SELECT ProcessId a, ProcessFilePath b, Count c FROM Summary_Processes WHERE Count != 0) "
+      "SELECT (SELECT COUNT(*) FROM (SELECT * FROM r EXCEPT SELECT * FROM s)) + "
+      "       (SELECT COUNT(*) FROM (SELECT * FROM s EXCEPT SELECT * FROM r));" },
+
+    { "Summary_Files",
+      "WITH g AS (SELECT FileID, NULL OpFileName, COUNT(*) c FROM MinifilterLog WHERE FileID IS NOT NULL GROUP BY 1 "
+      "           UNION ALL "
+      "           SELECT NULL, OpFileName, COUNT(*) FROM MinifilterLog WHERE FileID IS NULL GROUP BY 2), "
+      "     r AS (SELECT COALESCE(f.Path, g.OpFileName, '') a, SUM(g.c) c FROM g LEFT JOIN Files f ON f.FileID = g.FileID GROUP BY 1), "
+      "     s AS (SELECT OpFileName a, Count c FROM Summary_Files WHERE Count != 0) "
+      "SELECT (SELECT COUNT(*) FROM (SELECT * FROM r EXCEPT SELECT * FROM s)) + "
+      "       (SELECT COUNT(*) FROM (SELECT * FROM s EXCEPT SELECT * FROM r));" }
+};
+
+static ULONG
+SummaryHash (
+    _In_ SUMMARY_KIND Kind,
+    _In_ LONGLONG IntKey,
+    _In_opt_z_ const char *Text1,
+    _In_opt_z_ const char *Text2
+    )
+{
+    ULONG hash = 2166136261UL ^ (ULONG)Kind;
+
+    hash = (hash ^ (ULONG)IntKey) * 16777619UL;
+    hash = (hash ^ (ULONG)(IntKey >> 32)) * 16777619UL;
+
+    while (Text1 != NULL && *Text1 != '\0') {
+
+        hash = (hash ^ (UCHAR)*Text1++) * 16777619UL;
+    }
+
+    hash = (hash ^ 0xff) * 16777619UL;
+
+    while (Text2 != NULL && *Text2 != '\0') {
+
+        hash = (hash ^ (UCHAR)*Text2++) * 16777619UL;
+    }
+
+    return hash;
+}
+
+static BOOLEAN
+SummaryTextEqual (
+    _In_opt_z_ const char *Left,
+    _In_opt_z_ const char *Right
+    )
+{
+    if (Left == NULL || Right == NULL) {
+
+        return (Left == Right);
+    }
+
+    return (strcmp( Left, Right ) == 0);
+}
+
+static char *
+SummaryDup (
+    _In_opt_z_ const char *Text
+    )
+{
+    return (Text == NULL) ? NULL : _strdup( Text );
+}
+
+static BOOLEAN
+SummaryGrow (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Doubles the pending group table and rehashes the groups into it.
+
+--*/
+{
+    PSUMMARY_GROUP oldSlots = Summary.Slots;
+    ULONG oldCount = Summary.SlotCount;
+    ULONG newCount = oldCount ? oldCount * 2 : SUMMARY_INITIAL_SLOTS;
+    PSUMMARY_GROUP newSlots;
+    ULONG index;
+    ULONG slot;
+
+    newSlots = calloc( newCount, sizeof( SUMMARY_GROUP ) );
+
+    if (newSlots == NULL) {
+
+        return FALSE;
+    }
+
+    for (index = 0; index < oldCount; index++) {
+
+        if (oldSlots[index].Count == 0) {
+
+            continue;
+        }
+
+        slot = oldSlots[index].Hash & (newCount - 1);
+
+        while (newSlots[slot].Count != 0) {
+
+            slot = (slot + 1) & (newCount - 1);
+        }
+
+        newSlots[slot] = oldSlots[index];
+    }
+
+    free( oldSlots );
+
+    Summary.Slots = newSlots;
+    Summary.SlotCount = newCount;
+
+    return TRUE;
+}
+
+static BOOLEAN
+SummaryCount (
+    _In_ SUMMARY_KIND Kind,
+    _In_ LONGLONG IntKey,
+    _In_opt_z_ const char *Text1,
+    _In_opt_z_ const char *Text2
+    )
+/*++
+
+Routine Description:
+
+    Adds one to the pending group for the given key, creating the group if
+    this batch has not seen it yet.
+
+Return Value:
+
+    FALSE if there was no memory for a new group, the row is then not
+    counted.
+
+--*/
+{
+    ULONG hash = SummaryHash( Kind, IntKey, Text1, Text2 );
+    PSUMMARY_GROUP group;
+    ULONG slot;
+    char *text1;
+    char *text2;
+
+    if ((Summary.Used + 1) * 2 > Summary.SlotCount && !SummaryGrow()) {
+
+        return FALSE;
+    }
+
+    slot = hash & (Summary.SlotCount - 1);
+
+    for (;;) {
+
+        group = &Summary.Slots[slot];
+
+        if (group->Count == 0) {
+
+            break;
+        }
+
+        if (group->Hash == hash &&
+            group->Kind == Kind &&
+            group->IntKey == IntKey &&
+            SummaryTextEqual( group->Text1, Text1 ) &&
+            SummaryTextEqual( group->Text2, Text2 )) {
+
+            group->Count++;
+            return TRUE;
+        }
+
+        slot = (slot + 1) & (Summary.SlotCount - 1);
+    }
+
+    text1 = SummaryDup( Text1 );
+    text2 = SummaryDup( Text2 );
+
+    if ((Text1 != NULL && text1 == NULL) || (Text2 != NULL && text2 == NULL)) {
+
+        free( text1 );
+        free( text2 );
+        return FALSE;
+    }
+
+    group->Hash = hash;
+    group->Kind = Kind;
+    group->IntKey = IntKey;
+    group->Text1 = text1;
+    group->Text2 = text2;
+    group->Count = 1;
+
+    Summary.Used++;
+
+    return TRUE;
+}
+
+
+BOOLEAN
+SummaryPrepare (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Prepares the upsert statements on the log writer's connection.  If the
+    summaries are empty while the log is not, for example on a database
+    created before the summaries existed, they are rebuilt first.
+
+Arguments:
+
+    Db - The log writer's connection.
+
+Return Value:
+
+    TRUE if the statements were prepared.
+
+--*/
+{
+    sqlite3_stmt *stmt = NULL;
+    BOOLEAN empty = FALSE;
+    int kind;
+
+    if (sqlite3_prepare_v2( Db,
+                            "SELECT NOT EXISTS (SELECT 1 FROM Summary_Totals) "
+                            "   AND EXISTS (SELECT 1 FROM MinifilterLog);",
+                            -1, &stmt, NULL ) == SQLITE_OK &&
+        sqlite3_step( stmt ) == SQLITE_ROW) {
+
+        empty = (BOOLEAN)sqlite3_column_int( stmt, 0 );
+    }
+
+    sqlite3_finalize( stmt );
+
+    if (empty) {
+
+        WriteAlertToDatabase( "Summary tables are empty, rebuilding them from MinifilterLog" );
+
+        if (SummaryRebuild( Db ) != SQLITE_OK) {
+
+            return FALSE;
+        }
+    }
+
+    for (kind = 0; kind < SummaryKindCount; kind++) {
+
+        if (sqlite3_prepare_v2( Db,
+                                SummaryUpsertSql[kind],
+                                -1,
+                                &Summary.Upsert[kind],
+                                NULL ) != SQLITE_OK) {
+
+            SummaryFinalize();
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+VOID
+SummaryFinalize (
+    VOID
+    )
+{
+    int kind;
+
+    SummaryDiscard();
+
+    for (kind = 0; kind < SummaryKindCount; kind++) {
+
+        sqlite3_finalize( Summary.Upsert[kind] );
+        Summary.Upsert[kind] = NULL;
+    }
+
+    free( Summary.Slots );
+    Summary.Slots = NULL;
+    Summary.SlotCount = 0;
+}
+
+
+BOOLEAN
+SummaryAdd (
+    _In_z_ const char *MajorOp,
+    _In_opt_z_ const char *MinorOp,
+    _In_z_ const char *RequestorMode,
+    _In_z_ const char *OpStatus,
+    _In_ LONGLONG ProcessId,
+    _In_z_ const char *ProcessFilePath,
+    _In_z_ const char *OpFileName
+    )
+/*++
+
+Routine Description:
+
+    Counts one MinifilterLog row in every summary.  The values must be the
+    ones bound to the row so the summaries group exactly like the raw table.
+
+Arguments:
+
+    The column values of the row.
+
+Return Value:
+
+    FALSE if the row could not be counted in every summary.  The batch
+    must then be rolled back, or the summaries would miss the row.
+
+--*/
+{
+    return (SummaryCount( SummaryTotals, 0, NULL, NULL ) &&
+            SummaryCount( SummaryOperations, 0, MajorOp, MinorOp ? MinorOp : "" ) &&
+            SummaryCount( SummaryRequestorMode, 0, RequestorMode, NULL ) &&
+            SummaryCount( SummaryOpStatus, 0, OpStatus, NULL ) &&
+            SummaryCount( SummaryProcesses, ProcessId, ProcessFilePath, NULL ) &&
+            SummaryCount( SummaryFiles, 0, OpFileName, NULL ));
+}
+
+
+int
+SummaryFlush (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Writes every pending group with one upsert each and empties the table.
+    The caller owns the surrounding transaction.
+
+Return Value:
+
+    SQLITE_OK or the first SQLite error hit.  The pending groups are
+    dropped either way, a failed batch is rolled back by the caller.
+
+--*/
+{
+    PSUMMARY_GROUP group;
+    sqlite3_stmt *stmt;
+    ULONG index;
+    int rc = SQLITE_OK;
+
+    for (index = 0; index < Summary.SlotCount && rc == SQLITE_OK; index++) {
+
+        group = &Summary.Slots[index];
+
+        if (group->Count == 0) {
+
+            continue;
+        }
+
+        stmt = Summary.Upsert[group->Kind];
+
+        if (stmt == NULL) {
+
+            continue;
+        }
+
+        sqlite3_bind_text( stmt, 1, group->Text1 ? group->Text1 : "", -1, SQLITE_STATIC );
+        sqlite3_bind_text( stmt, 2, group->Text2 ? group->Text2 : "", -1, SQLITE_STATIC );
+        sqlite3_bind_int64( stmt, 3, group->Count );
+        sqlite3_bind_int64( stmt, 4, group->IntKey );
+
+        if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+            rc = sqlite3_errcode( sqlite3_db_handle( stmt ) );
+        }
+
+        sqlite3_reset( stmt );
+        sqlite3_clear_bindings( stmt );
+    }
+
+    SummaryDiscard();
+
+    return rc;
+}
+
+
+VOID
+SummaryDiscard (
+    VOID
+    )
+{
+    ULONG index;
+
+    for (index = 0; index < Summary.SlotCount; index++) {
+
+        if (Summary.Slots[index].Count != 0) {
+
+            free( Summary.Slots[index].Text1 );
+            free( Summary.Slots[index].Text2 );
+            ZeroMemory( &Summary.Slots[index], sizeof( SUMMARY_GROUP ) );
+        }
+    }
+
+    Summary.Used = 0;
+}
+
+
+int
+SummaryRebuild (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Recomputes every summary table from MinifilterLog in one transaction.
+
+Arguments:
+
+    Db - An open connection with no transaction in progress.
+
+Return Value:
+
+    SQLITE_OK or the SQLite error.
+
+--*/
+{
+    char *errMsg = NULL;
+    int rc;
+
+    rc = sqlite3_exec( Db, "BEGIN IMMEDIATE;", NULL, NULL, &errMsg );
+
+    if (rc == SQLITE_OK) {
+
+        rc = sqlite3_exec( Db, SummaryRebuildSql, NULL, NULL, &errMsg );
+
+        sqlite3_exec( Db, (rc == SQLITE_OK) ? "COMMIT;" : "ROLLBACK;", NULL, NULL, NULL );
+    }
+
+    if (rc != SQLITE_OK) {
+
+        WriteAlertToDatabase( "Summary rebuild failed: %s", errMsg ? errMsg : sqlite3_errstr( rc ) );
+    }
+
+    sqlite3_free( errMsg );
+
+    return rc;
+}
+
+
+LONGLONG
+SummaryCheck (
+    _In_z_ const char *DatabasePath,
+    _In_ BOOLEAN Repair
+    )
+/*++
+
+Routine Description:
+
+    Compares every summary table with the groups computed from
+    MinifilterLog and prints the number of differing groups per table.
+    This is a full scan of the log and is meant to be run on demand.
+
+Arguments:
+
+    DatabasePath - The database to check.
+
+    Repair - Rebuild the summaries if any of them differ.
+
+Return Value:
+
+    Number of differing groups found, or -1 if the check could not run.
+
+--*/
+{
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    LONGLONG total = 0;
+    LONGLONG differences;
+    int index;
+
+    if (sqlite3_open( DatabasePath, &db ) != SQLITE_OK) {
+
+        printf( "    Could not open %s: %s\n", DatabasePath, sqlite3_errmsg( db ) );
+        sqlite3_close( db );
+        return -1;
+    }
+
+    sqlite3_busy_timeout( db, 5000 );
+
+    //
+    //  Read every table from the same snapshot.
+    //
+
+    sqlite3_exec( db, "BEGIN;", NULL, NULL, NULL );
+
+    for (index = 0; index < _countof( SummaryCheckSql ); index++) {
+
+        differences = -1;
+
+        if (sqlite3_prepare_v2( db, SummaryCheckSql[index].Sql, -1, &stmt, NULL ) == SQLITE_OK &&
+            sqlite3_step( stmt ) == SQLITE_ROW) {
+
+            differences = sqlite3_column_int64( stmt, 0 );
+        }
+
+        sqlite3_finalize( stmt );
+        stmt = NULL;
+
+        if (differences < 0) {
+
+            printf( "    %-24s check failed: %s\n", SummaryCheckSql[index].Table, sqlite3_errmsg( db ) );
+            total = -1;
+            break;
+        }
+
+        printf( "    %-24s %I64d differing groups\n", SummaryCheckSql[index].Table, differences );
+        total += differences;
+    }
+
+    sqlite3_exec( db, "COMMIT;", NULL, NULL, NULL );
+
+    //
+    //  A check that could not run says nothing about the summaries, so
+    //  it neither alerts nor rebuilds them.
+    //
+
+    if (total > 0) {
+
+        WriteAlertToDatabase( "Summary check found %I64d differing groups", total );
+
+        if (Repair && SummaryRebuild( db ) == SQLITE_OK) {
+
+            printf( "    Summaries rebuilt from MinifilterLog\n" );
+            WriteAlertToDatabase( "Summaries rebuilt from MinifilterLog" );
+        }
+    }
+
+    sqlite3_close( db );
+
+    return total;
+}
@@ -0,0 +1,66 @@
+/*++
+
+Module Name:
+
+    mspySummary.h
+
+Abstract:
+
+    Summary tables kept next to MinifilterLog so the dashboard counts are
+    read from a handful of rows instead of being recomputed over the whole
+    log on every refresh.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYSUMMARY_H__
+#define __MSPYSUMMARY_H__
+
+#include <windows.h>
+#include <sqlite3.h>
+
+BOOLEAN
+SummaryPrepare (
+    _In_ sqlite3 *Db
+    );
+
+VOID
+SummaryFinalize (
+    VOID
+    );
+
+BOOLEAN
+SummaryAdd (
+    _In_z_ const char *MajorOp,
+    _In_opt_z_ const char *MinorOp,
+    _In_z_ const char *RequestorMode,
+    _In_z_ const char *OpStatus,
+    _In_ LONGLONG ProcessId,
+    _In_z_ const char *ProcessFilePath,
+    _In_z_ const char *OpFileName
+    );
+
+int
+SummaryFlush (
+    VOID
+    );
+
+VOID
+SummaryDiscard (
+    VOID
+    );
+
+int
+SummaryRebuild (
+    _In_ sqlite3 *Db
+    );
+
+LONGLONG
+SummaryCheck (
+    _In_z_ const char *DatabasePath,
+    _In_ BOOLEAN Repair
+    );
+
+#endif //__MSPYSUMMARY_H__
@@ -0,0 +1,802 @@
+/*++
+
+Module Name:
+
+    mspyTopK.c
+
+Abstract:
+
+    Ranks the busiest processes and files of each window as the log writer
+    inserts records, by operation count, bytes transferred and time spent
+    in the file system.
+
+    Each of the six rankings is a Space-Saving summary of TOPK_COUNTERS
+    counters.  A key already counted adds its weight to its counter.  A new
+    key takes over the counter with the smallest count, inheriting that
+    count as its Error, so a count is never under the true value and never
+    over it by more than Error.  Every key whose true weight is more than
+    1/TOPK_COUNTERS of the window total is always held.
+
+    Counters are kept in a min-heap for the takeover and found through a
+    small open addressing index, so a record costs a few probes and a heap
+    step per ranking and memory does not grow with the number of distinct
+    processes or files.
+
+    When a record falls past the end of the window the top TOPK_REPORT of
+    every ranking are written to TopTalkers in the writer's current batch,
+    copied for /k, and the rankings start over.
+
+    TopKAdd and TopKEndWindow are only called from the log writer thread,
+    TopKPrint from the console.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyTopK.h"
+
+#define TOPK_INDEX_SIZE     (TOPK_COUNTERS * 2)     // power of two, at most half full
+#define TOPK_NONE           0xFFFF
+#define TOPK_NAME_SIZE      260
+
+typedef enum _TOPK_KIND {
+
+    TopKProcess,
+    TopKFile,
+    TopKKinds
+
+} TOPK_KIND;
+
+typedef enum _TOPK_METRIC {
+
+    TopKOps,
+    TopKBytes,
+    TopKLatency,
+    TopKMetrics
+
+} TOPK_METRIC;
+
+static const char *TopKKindNames[TopKKinds] = { "Process", "File" };
+static const char *TopKMetricNames[TopKMetrics] = { "Ops", "Bytes", "Latency" };
+
+typedef struct _TOPK_COUNTER {
+
+    ULONGLONG Count;
+    ULONGLONG Error;        // count of the key this counter was taken from
+    ULONG Hash;
+    USHORT KeyLength;
+    USHORT HeapSlot;
+
+    //
+    //  A process is its id followed by its image path, a file its name in
+    //  UTF-8.  Neither is terminated.
+    //
+
+    UCHAR Key[TOPK_KEY_SIZE];
+
+} TOPK_COUNTER, *PTOPK_COUNTER;
+
+typedef struct _TOPK_SKETCH {
+
+    ULONGLONG Total;
+    ULONG Used;
+    USHORT Heap[TOPK_COUNTERS];         // smallest Count first
+    USHORT Index[TOPK_INDEX_SIZE];      // by Hash, linear probing
+    TOPK_COUNTER Counters[TOPK_COUNTERS];
+
+} TOPK_SKETCH, *PTOPK_SKETCH;
+
+typedef struct _TOPK_ENTRY {
+
+    ULONGLONG Count;
+    ULONGLONG Error;
+    char Name[TOPK_NAME_SIZE];
+
+} TOPK_ENTRY;
+
+typedef struct _TOPK_REPORTED {
+
+    LONGLONG WindowStart;
+    LONGLONG WindowEnd;
+    ULONGLONG Total[TopKKinds][TopKMetrics];
+    ULONG Count[TopKKinds][TopKMetrics];
+    TOPK_ENTRY Entries[TopKKinds][TopKMetrics][TOPK_REPORT];
+
+} TOPK_REPORTED;
+
+typedef struct _TOPK_STATE {
+
+    PTOPK_SKETCH Sketches;              // [TopKKinds * TopKMetrics]
+
+    LONGLONG WindowStart;
+    LONGLONG LastTime;
+
+    sqlite3_stmt *Insert;
+    sqlite3 *Db;
+
+    //
+    //  The last window written, for /k.
+    //
+
+    SRWLOCK Lock;
+    TOPK_REPORTED Reported;
+
+} TOPK_STATE;
+
+static TOPK_STATE TopK;
+
+static ULONG
+TopKHash (
+    _In_reads_bytes_(Length) const UCHAR *Key,
+    _In_ ULONG Length
+    )
+{
+    ULONG hash = 2166136261;
+    ULONG index;
+
+    for (index = 0; index < Length; index++) {
+
+        hash = (hash ^ Key[index]) * 16777619;
+    }
+
+    return hash;
+}
+
+static USHORT
+TopKFind (
+    _In_ PTOPK_SKETCH Sketch,
+    _In_reads_bytes_(Length) const UCHAR *Key,
+    _In_ ULONG Length,
+    _In_ ULONG Hash
+    )
+{
+    ULONG slot = Hash & (TOPK_INDEX_SIZE - 1);
+    PTOPK_COUNTER counter;
+
+    while (Sketch->Index[slot] != TOPK_NONE) {
+
+        counter = &Sketch->Counters[Sketch->Index[slot]];
+
+        if (counter->Hash == Hash &&
+            counter->KeyLength == Length &&
+            memcmp( counter->Key, Key, Length ) == 0) {
+
+            return Sketch->Index[slot];
+        }
+
+        slot = (slot + 1) & (TOPK_INDEX_SIZE - 1);
+    }
+
+    return TOPK_NONE;
+}
+
+static VOID
+TopKIndexInsert (
+    _In_ PTOPK_SKETCH Sketch,
+    _In_ USHORT Counter
+    )
+{
+    ULONG slot = Sketch->Counters[Counter].Hash & (TOPK_INDEX_SIZE - 1);
+
+    while (Sketch->Index[slot] != TOPK_NONE) {
+
+        slot = (slot + 1) & (TOPK_INDEX_SIZE - 1);
+    }
+
+    Sketch->Index[slot] = Counter;
+}
+
+static VOID
+TopKIndexRemove (
+    _In_ PTOPK_SKETCH Sketch,
+    _In_ USHORT Counter
+    )
+/*++
+
+Routine Description:
+
+    Removes a counter from the index, moving back the entries after it in
+    the same run that would no longer be found past the hole.
+
+--*/
+{
+    ULONG hole = Sketch->Counters[Counter].Hash & (TOPK_INDEX_SIZE - 1);
+    ULONG next;
+    ULONG home;
+
+    while (Sketch->Index[hole] != Counter) {
+
+        hole = (hole + 1) & (TOPK_INDEX_SIZE - 1);
+    }
+
+    next = hole;
+
+    for (;;) {
+
+        Sketch->Index[hole] = TOPK_NONE;
+
+        for (;;) {
+
+            next = (next + 1) & (TOPK_INDEX_SIZE - 1);
+
+            if (Sketch->Index[next] == TOPK_NONE) {
+
+                return;
+            }
+
+            //
+            //  An entry may fill the hole unless its home slot lies
+            //  cyclically in (hole, next].
+            //
+
+            home = Sketch->Counters[Sketch->Index[next]].Hash & (TOPK_INDEX_SIZE - 1);
+
+            if (((next - home) & (TOPK_INDEX_SIZE - 1)) >= ((next - hole) & (TOPK_INDEX_SIZE - 1))) {
+
+                break;
+            }
+        }
+
+        Sketch->Index[hole] = Sketch->Index[next];
+        hole = next;
+    }
+}
+
+static VOID
+TopKHeapSwap (
+    _In_ PTOPK_SKETCH Sketch,
+    _In_ ULONG A,
+    _In_ ULONG B
+    )
+{
+    USHORT counter = Sketch->Heap[A];
+
+    Sketch->Heap[A] = Sketch->Heap[B];
+    Sketch->Heap[B] = counter;
+    Sketch->Counters[Sketch->Heap[A]].HeapSlot = (USHORT)A;
+    Sketch->Counters[Sketch->Heap[B]].HeapSlot = (USHORT)B;
+}
+
+static VOID
+TopKSiftDown (
+    _In_ PTOPK_SKETCH Sketch,
+    _In_ ULONG Slot
+    )
+{
+    ULONG child;
+
+    for (;;) {
+
+        child = Slot * 2 + 1;
+
+        if (child >= Sketch->Used) {
+
+            return;
+        }
+
+        if (child + 1 < Sketch->Used &&
+            Sketch->Counters[Sketch->Heap[child + 1]].Count < Sketch->Counters[Sketch->Heap[child]].Count) {
+
+            child++;
+        }
+
+        if (Sketch->Counters[Sketch->Heap[Slot]].Count <= Sketch->Counters[Sketch->Heap[child]].Count) {
+
+            return;
+        }
+
+        TopKHeapSwap( Sketch, Slot, child );
+        Slot = child;
+    }
+}
+
+static VOID
+TopKSiftUp (
+    _In_ PTOPK_SKETCH Sketch,
+    _In_ ULONG Slot
+    )
+{
+    ULONG parent;
+
+    while (Slot > 0) {
+
+        parent = (Slot - 1) / 2;
+
+        if (Sketch->Counters[Sketch->Heap[parent]].Count <= Sketch->Counters[Sketch->Heap[Slot]].Count) {
+
+            return;
+        }
+
+        TopKHeapSwap( Sketch, Slot, parent );
+        Slot = parent;
+    }
+}
+
+static VOID
+TopKCount (
+    _In_ PTOPK_SKETCH Sketch,
+    _In_reads_bytes_(Length) const UCHAR *Key,
+    _In_ ULONG Length,
+    _In_ ULONG Hash,
+    _In_ ULONGLONG Weight
+    )
+/*++
+
+Routine Description:
+
+    Adds Weight to a key, taking over the smallest counter if the key is
+    not held and every counter is in use.
+
+--*/
+{
+    PTOPK_COUNTER counter;
+    USHORT index;
+
+    if (Weight == 0) {
+
+        return;
+    }
+
+    Sketch->Total += Weight;
+
+    index = TopKFind( Sketch, Key, Length, Hash );
+
+    if (index != TOPK_NONE) {
+
+        //
+        //  Counts only grow, so the counter can only move away from the
+        //  top of the heap.
+        //
+
+        counter = &Sketch->Counters[index];
+        counter->Count += Weight;
+        TopKSiftDown( Sketch, counter->HeapSlot );
+        return;
+    }
+
+    if (Sketch->Used < TOPK_COUNTERS) {
+
+        index = (USHORT)Sketch->Used;
+        counter = &Sketch->Counters[index];
+        counter->Count = Weight;
+        counter->Error = 0;
+        counter->HeapSlot = (USHORT)Sketch->Used;
+        Sketch->Heap[Sketch->Used++] = index;
+
+    } else {
+
+        index = Sketch->Heap[0];
+        counter = &Sketch->Counters[index];
+        TopKIndexRemove( Sketch, index );
+        counter->Error = counter->Count;
+        counter->Count += Weight;
+    }
+
+    counter->Hash = Hash;
+    counter->KeyLength = (USHORT)Length;
+    memcpy( counter->Key, Key, Length );
+    TopKIndexInsert( Sketch, index );
+
+    TopKSiftUp( Sketch, counter->HeapSlot );
+    TopKSiftDown( Sketch, counter->HeapSlot );
+}
+
+static VOID
+TopKReset (
+    _In_ PTOPK_SKETCH Sketch
+    )
+{
+    Sketch->Total = 0;
+    Sketch->Used = 0;
+    memset( Sketch->Index, 0xFF, sizeof( Sketch->Index ) );
+}
+
+static int __cdecl
+TopKCompare (
+    _In_ const void *A,
+    _In_ const void *B
+    )
+{
+    ULONGLONG a = (*(const PTOPK_COUNTER *)A)->Count;
+    ULONGLONG b = (*(const PTOPK_COUNTER *)B)->Count;
+
+    return (a < b) ? 1 : (a > b) ? -1 : 0;
+}
+
+static VOID
+TopKWrite (
+    _In_ TOPK_KIND Kind,
+    _In_ TOPK_METRIC Metric,
+    _In_ PTOPK_SKETCH Sketch,
+    _In_ LONGLONG WindowEnd,
+    _Inout_ TOPK_REPORTED *Reported
+    )
+/*++
+
+Routine Description:
+
+    Writes the top TOPK_REPORT counters of one ranking to TopTalkers and
+    to Reported.
+
+--*/
+{
+    PTOPK_COUNTER ranked[TOPK_COUNTERS];
+    sqlite3_stmt *stmt = TopK.Insert;
+    PTOPK_COUNTER counter;
+    TOPK_ENTRY *entry;
+    ULONGLONG processId;
+    ULONG count;
+    ULONG index;
+    int length;
+
+    for (index = 0; index < Sketch->Used; index++) {
+
+        ranked[index] = &Sketch->Counters[index];
+    }
+
+    qsort( ranked, Sketch->Used, sizeof( PTOPK_COUNTER ), TopKCompare );
+
+    count = min( Sketch->Used, TOPK_REPORT );
+    Reported->Total[Kind][Metric] = Sketch->Total;
+    Reported->Count[Kind][Metric] = count;
+
+    for (index = 0; index < count; index++) {
+
+        counter = ranked[index];
+        entry = &Reported->Entries[Kind][Metric][index];
+        entry->Count = counter->Count;
+        entry->Error = counter->Error;
+
+        if (Kind == TopKProcess) {
+
+            memcpy( &processId, counter->Key, sizeof( processId ) );
+            length = counter->KeyLength - (int)sizeof( processId );
+
+            sprintf_s( entry->Name, sizeof( entry->Name ), "%.*s (%I64u)",
+                       min( length, TOPK_NAME_SIZE - 32 ),
+                       (const char *)counter->Key + sizeof( processId ),
+                       processId );
+
+        } else {
+
+            length = min( counter->KeyLength, TOPK_NAME_SIZE - 1 );
+
+            while (length > 0 && length < counter->KeyLength && (counter->Key[length] & 0xC0) == 0x80) {
+
+                length--;
+            }
+
+            memcpy( entry->Name, counter->Key, length );
+            entry->Name[length] = '\0';
+        }
+
+        if (stmt == NULL) {
+
+            continue;
+        }
+
+        sqlite3_bind_int64( stmt, 1, Reported->WindowStart );
+        sqlite3_bind_int64( stmt, 2, WindowEnd );
+        sqlite3_bind_text( stmt, 3, TopKKindNames[Kind], -1, SQLITE_STATIC );
+        sqlite3_bind_text( stmt, 4, TopKMetricNames[Metric], -1, SQLITE_STATIC );
+        sqlite3_bind_int( stmt, 5, index + 1 );
+
+        if (Kind == TopKProcess) {
+
+            sqlite3_bind_int64( stmt, 6, (sqlite3_int64)processId );
+            sqlite3_bind_text( stmt, 7, (const char *)counter->Key + sizeof( processId ),
+                               counter->KeyLength - (int)sizeof( processId ), SQLITE_STATIC );
+
+        } else {
+
+            sqlite3_bind_null( stmt, 6 );
+            sqlite3_bind_text( stmt, 7, (const char *)counter->Key, counter->KeyLength, SQLITE_STATIC );
+        }
+
+        sqlite3_bind_int64( stmt, 8, (sqlite3_int64)counter->Count );
+        sqlite3_bind_int64( stmt, 9, (sqlite3_int64)counter->Error );
+        sqlite3_bind_int64( stmt, 10, (sqlite3_int64)Sketch->Total );
+
+        if (sqlite3_step( stmt ) != SQLITE_DONE) {
+
+            WriteToLogAnsi( "SQLite insert failed on Top Talkers: %s", sqlite3_errmsg( TopK.Db ) );
+        }
+
+        sqlite3_reset( stmt );
+    }
+}
+
+static VOID
+TopKPublish (
+    _In_ LONGLONG WindowEnd
+    )
+/*++
+
+Routine Description:
+
+    Writes out the current window and starts the next one.
+
+--*/
+{
+    static TOPK_REPORTED reported;
+    ULONG kind;
+    ULONG metric;
+
+    memset( &reported, 0, sizeof( reported ) );
+    reported.WindowStart = TopK.WindowStart;
+    reported.WindowEnd = WindowEnd;
+
+    for (kind = 0; kind < TopKKinds; kind++) {
+
+        for (metric = 0; metric < TopKMetrics; metric++) {
+
+            TopKWrite( kind, metric, &TopK.Sketches[kind * TopKMetrics + metric], WindowEnd, &reported );
+            TopKReset( &TopK.Sketches[kind * TopKMetrics + metric] );
+        }
+    }
+
+    AcquireSRWLockExclusive( &TopK.Lock );
+    TopK.Reported = reported;
+    ReleaseSRWLockExclusive( &TopK.Lock );
+}
+
+BOOLEAN
+TopKPrepare (
+    _In_ sqlite3 *Db
+    )
+/*++
+
+Routine Description:
+
+    Prepares the insert on the writer's connection.  The window being
+    counted carries over from the previous connection.
+
+--*/
+{
+    ULONG index;
+
+    if (TopK.Sketches == NULL) {
+
+        TopK.Sketches = calloc( TopKKinds * TopKMetrics, sizeof( TOPK_SKETCH ) );
+
+        if (TopK.Sketches == NULL) {
+
+            return FALSE;
+        }
+
+        for (index = 0; index < TopKKinds * TopKMetrics; index++) {
+
+            TopKReset( &TopK.Sketches[index] );
+        }
+
+        InitializeSRWLock( &TopK.Lock );
+    }
+
+    TopK.Db = Db;
+
+    if (sqlite3_prepare_v2( Db,
+                            "INSERT INTO TopTalkers (WindowStart, WindowEnd, Kind, Metric, Rank,"
+                            " ProcessId, Name, Value, Error, WindowTotal)"
+                            " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);",
+                            -1,
+                            &TopK.Insert,
+                            NULL ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "Failed to prepare top talkers insert: %s", sqlite3_errmsg( Db ) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+TopKFinalize (
+    VOID
+    )
+{
+    sqlite3_finalize( TopK.Insert );
+    TopK.Insert = NULL;
+    TopK.Db = NULL;
+}
+
+VOID
+TopKAdd (
+    _In_ PRECORD_DATA RecordData,
+    _In_z_ const char *Name,
+    _In_z_ const char *ProcessFilePath
+    )
+/*++
+
+Routine Description:
+
+    Counts one logged record in every ranking.  A window that ends is
+    inserted on the writer's connection, so call with the batch open.
+
+Arguments:
+
+    RecordData - The record.
+
+    Name - Its file name.
+
+    ProcessFilePath - Image of the process that issued it.
+
+--*/
+{
+    LONGLONG now = RecordData->OriginatingTime.QuadPart;
+    UCHAR processKey[TOPK_KEY_SIZE];
+    ULONGLONG processId = (ULONGLONG)RecordData->ProcessId;
+    ULONGLONG bytes = 0;
+    ULONGLONG latency = 0;
+    PTOPK_SKETCH sketch;
+    size_t processLength;
+    size_t nameLength;
+    ULONG processHash;
+    ULONG nameHash;
+
+    if (TopK.Sketches == NULL) {
+
+        return;
+    }
+
+    if (TopK.WindowStart == 0) {
+
+        TopK.WindowStart = now - now % TOPK_WINDOW;
+
+    } else if (now >= TopK.WindowStart + TOPK_WINDOW) {
+
+        TopKPublish( TopK.WindowStart + TOPK_WINDOW );
+        TopK.WindowStart = now - now % TOPK_WINDOW;
+    }
+
+    TopK.LastTime = max( TopK.LastTime, now );
+
+    //
+    //  Bytes moved by reads and writes that went through, and the time
+    //  from the pre-operation to the completion when both were seen.
+    //
+
+    if ((RecordData->CallbackMajorId == IRP_MJ_READ || RecordData->CallbackMajorId == IRP_MJ_WRITE) &&
+        (ULONG)RecordData->Status < 0xC0000000) {
+
+        bytes = RecordData->Information;
+    }
+
+    if (RecordData->CompletionTime.QuadPart > now) {
+
+        latency = RecordData->CompletionTime.QuadPart - now;
+    }
+
+    processLength = min( strlen( ProcessFilePath ), TOPK_KEY_SIZE - sizeof( processId ) );
+    memcpy( processKey, &processId, sizeof( processId ) );
+    memcpy( processKey + sizeof( processId ), ProcessFilePath, processLength );
+    processLength += sizeof( processId );
+    processHash = TopKHash( processKey, (ULONG)processLength );
+
+    //
+    //  A long name is cut at a character, so the key stays UTF-8
+    //
+
+    nameLength = strlen( Name );
+
+    if (nameLength > TOPK_KEY_SIZE) {
+
+        nameLength = TOPK_KEY_SIZE;
+
+        while (nameLength > 0 && (Name[nameLength] & 0xC0) == 0x80) {
+
+            nameLength--;
+        }
+    }
+
+    nameHash = TopKHash( (const UCHAR *)Name, (ULONG)nameLength );
+
+    sketch = &TopK.Sketches[TopKProcess * TopKMetrics];
+    TopKCount( &sketch[TopKOps], processKey, (ULONG)processLength, processHash, 1 );
+    TopKCount( &sketch[TopKBytes], processKey, (ULONG)processLength, processHash, bytes );
+    TopKCount( &sketch[TopKLatency], processKey, (ULONG)processLength, processHash, latency );
+
+    if (nameLength == 0) {
+
+        return;
+    }
+
+    sketch = &TopK.Sketches[TopKFile * TopKMetrics];
+    TopKCount( &sketch[TopKOps], (const UCHAR *)Name, (ULONG)nameLength, nameHash, 1 );
+    TopKCount( &sketch[TopKBytes], (const UCHAR *)Name, (ULONG)nameLength, nameHash, bytes );
+    TopKCount( &sketch[TopKLatency], (const UCHAR *)Name, (ULONG)nameLength, nameHash, latency );
+}
+
+VOID
+TopKEndWindow (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Writes out the window being counted, up to the last record seen, at
+    shutdown.  Call with the batch open.
+
+--*/
+{
+    if (TopK.Sketches == NULL || TopK.WindowStart == 0) {
+
+        return;
+    }
+
+    TopKPublish( TopK.LastTime );
+    TopK.WindowStart = 0;
+}
+
+VOID
+TopKPrint (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Prints the rankings of the last window written, for the /k command.
+
+--*/
+{
+    static TOPK_REPORTED reported;
+    static const char *units[TopKMetrics] = { "ops", "bytes", "us" };
+    ULONGLONG divisors[TopKMetrics] = { 1, 1, 10 };
+    const TOPK_ENTRY *entry;
+    ULONG kind;
+    ULONG metric;
+    ULONG index;
+
+    if (TopK.Sketches == NULL) {
+
+        printf( "    No window has ended yet\n" );
+        return;
+    }
+
+    AcquireSRWLockShared( &TopK.Lock );
+    reported = TopK.Reported;
+    ReleaseSRWLockShared( &TopK.Lock );
+
+    if (reported.WindowStart == 0) {
+
+        printf( "    No window has ended yet\n" );
+        return;
+    }
+
+    printf( "    Window of %I64d ms, each count is at most +error over the true value\n",
+            (reported.WindowEnd - reported.WindowStart) / 10000 );
+
+    for (kind = 0; kind < TopKKinds; kind++) {
+
+        for (metric = 0; metric < TopKMetrics; metric++) {
+
+            printf( "    %s by %s, %I64u %s in total\n",
+                    TopKKindNames[kind],
+                    TopKMetricNames[metric],
+                    reported.Total[kind][metric] / divisors[metric],
+                    units[metric] );
+
+            for (index = 0; index < reported.Count[kind][metric]; index++) {
+
+                entry = &reported.Entries[kind][metric][index];
+
+                printf( "      %2lu %12I64u +%-10I64u %s\n",
+                        index + 1,
+                        entry->Count / divisors[metric],
+                        entry->Error / divisors[metric],
+                        entry->Name );
+            }
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/*++
+
+Module Name:
+
+    mspyTopK.h
+
+Abstract:
+
+    Busiest processes and files per time window, by operations, bytes and
+    latency, kept in constant memory while records are logged instead of
+    being ranked over every stored row.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYTOPK_H__
+#define __MSPYTOPK_H__
+
+#include <windows.h>
+#include <sqlite3.h>
+#include "minispy.h"
+
+//
+//  Counters per ranking.  Any key with more than 1/TOPK_COUNTERS of a
+//  window's total is guaranteed to be counted, and no count is over by
+//  more than the Error written next to it.
+//
+
+#define TOPK_COUNTERS       256
+
+//
+//  Keys are cut to this many bytes, longer file names share a counter
+//  when they only differ past it.
+//
+
+#define TOPK_KEY_SIZE       512
+
+//
+//  Entries written to TopTalkers and kept for /k per ranking.
+//
+
+#define TOPK_REPORT         10
+
+//
+//  Length of a window in record time.  A window is written out with the
+//  batch of the first record past its end.
+//
+
+#define TOPK_WINDOW         (5LL * 10000000)        // 5 seconds in 100ns
+
+BOOLEAN
+TopKPrepare (
+    _In_ sqlite3 *Db
+    );
+
+VOID
+TopKFinalize (
+    VOID
+    );
+
+VOID
+TopKAdd (
+    _In_ PRECORD_DATA RecordData,
+    _In_z_ const char *Name,
+    _In_z_ const char *ProcessFilePath
+    );
+
+VOID
+TopKEndWindow (
+    VOID
+    );
+
+VOID
+TopKPrint (
+    VOID
+    );
+
+#endif //__MSPYTOPK_H__
@@ -27,6 +27,20 @@ _Analysis_mode_(_Analysis_code_type_user_code_)
 #include <windows.h>
 #include <assert.h>
 #include "mspyLog.h"
+#include "mspyColStore.h"
+#include "mspySummary.h"
+#include "mspyWal.h"
+#include "mspyHash.h"
+#include "mspyReload.h"
+#include "mspyAlert.h"
+#include "mspyFileLog.h"
+#include "mspyTopK.h"
+#include "mspyMassMod.h"
+#include "mspyProcess.h"
+#include "mspyFiles.h"
+#include "mspyGen.h"
+#include "mspyPort.h"
+#include "spyRules.h"
 #include <strsafe.h>
 
 #define SUCCESS              0
@@ -54,6 +68,28 @@ ListDevices (
     VOID
     );
 
+VOID
+ShowClientStats (
+    _In_ PLOG_CONTEXT Context
+    );
+
+VOID
+SetClientProcessFilter (
+    _In_ PLOG_CONTEXT Context,
+    _In_ ULONG ProcessId
+    );
+
+VOID
+PushFilterRules (
+    _In_ PLOG_CONTEXT Context
+    );
+
+VOID
+FilterRulesReloaded (
+    _In_ PRULE_SET RuleSet,
+    _In_opt_ PVOID Context
+    );
+
 VOID
 DisplayError (
    _In_ DWORD Code
@@ -185,41 +221,97 @@ Return Value:
 
 --*/
 {
-    HANDLE port = INVALID_HANDLE_VALUE;
+    PPORT port = NULL;
     HRESULT hResult = S_OK;
     DWORD result;
     ULONG threadId;
     HANDLE thread = NULL;
     LOG_CONTEXT context;
+    COL_STORE recent;
     CHAR inputChar;
+    BOOLEAN generate = FALSE;
+    const char *localPath = NULL;
+    int parmIndex;
 
     //
     //  Initialize handle in case of error
     //
 
     context.ShutDown = NULL;
+    context.Recent = NULL;
 
     //
-    //  Open the port that is used to talk to
-    //  MiniSpy.
+    //  The service log and the alerts are written in batches by threads
+    //  of their own, so neither waits for the disk on the caller's thread.
     //
 
-    printf( "Connecting to filter's port...\n" );
-    WriteAlertToDatabase("Connecting to filter's port...");
+    if (!FileLogStart()) {
 
-    hResult = FilterConnectCommunicationPort( MINISPY_PORT_NAME,
-                                              0,
-                                              NULL,
-                                              0,
-                                              NULL,
-                                              &port );
+        printf( "Could not start the service log flusher, lines are written as they are logged\n" );
+    }
 
-    if (IS_ERROR( hResult )) {
+    if (!AlertStart()) {
 
-        printf( "Could not connect to filter: 0x%08x\n", hResult );
-        WriteAlertToDatabase("Could not connect to filter: 0x%08x", hResult);
-        DisplayError( hResult );
-        goto Main_Exit;
+        printf( "Could not start the alert thread, alerts are written as they are raised\n" );
+    }
+
+    //
+    //  Generated records stand in for the filter's, with /g on the command
+    //  line we run without it.  With /u the filter is a stand-in serving
+    //  its messages over a local socket.
+    //
+
+    for (parmIndex = 1; parmIndex < argc; parmIndex++) {
+
+        if (!_stricmp( argv[parmIndex], "/g" )) {
+
+            generate = TRUE;
+
+        } else if (!_stricmp( argv[parmIndex], "/u" ) && parmIndex + 1 < argc) {
+
+            localPath = argv[parmIndex + 1];
+        }
+    }
+
+    if (generate) {
+
+        printf( "Generating records, not connecting to the filter\n" );
+        WriteAlertToDatabase("Generating records, not connecting to the filter");
+
+    } else if (localPath != NULL) {
+
+        printf( "Connecting to %s...\n", localPath );
+        WriteAlertToDatabase("Connecting to %s...", localPath);
+
+        hResult = PortConnectLocal( localPath, &port );
+
+        if (IS_ERROR( hResult )) {
+
+            printf( "Could not connect to %s: 0x%08x\n", localPath, hResult );
+            WriteAlertToDatabase("Could not connect to %s: 0x%08x", localPath, hResult);
+            DisplayError( hResult );
+            goto Main_Exit;
+        }
+
+    } else {
+
+        //
+        //  Open the port that is used to talk to
+        //  MiniSpy.
+        //
+
+        printf( "Connecting to filter's port...\n" );
+        WriteAlertToDatabase("Connecting to filter's port...");
+
+        hResult = PortConnectFilter( &port );
+
+        if (IS_ERROR( hResult )) {
+
+            printf( "Could not connect to filter: 0x%08x\n", hResult );
+            WriteAlertToDatabase("Could not connect to filter: 0x%08x", hResult);
+            DisplayError( hResult );
+            goto Main_Exit;
+        }
     }
 
     //
@@ -237,6 +329,16 @@ Return Value:
     context.NextLogToScreen = TRUE;
     context.OutputFile = NULL;
 
+    if (ColStoreInitialize( &recent, COL_STORE_DEFAULT_EVENTS )) {
+
+        context.Recent = &recent;
+
+    } else {
+
+        printf( "Could not allocate the recent operations store, /q is disabled\n" );
+        WriteAlertToDatabase("Could not allocate the recent operations store");
+    }
+
     if (context.ShutDown == NULL) {
 
         result = GetLastError();
@@ -260,6 +362,39 @@ Return Value:
         }
     }
 
+    //
+    //  Checkpoint the log database off the logging thread, it must be
+    //  running before the logging thread opens the database.
+    //
+
+    if (!WalStart()) {
+
+        printf( "Could not start the checkpoint thread, SQLite will checkpoint on commit\n" );
+        WriteAlertToDatabase("Could not start the checkpoint thread");
+    }
+
+    //
+    //  Hash rules are matched against digests the hashing threads compute,
+    //  the logging thread only looks them up.
+    //
+
+    if (!HashStart( 0 )) {
+
+        printf( "Could not start the hashing threads, hash rules will not match\n" );
+        WriteAlertToDatabase("Could not start the hashing threads");
+    }
+
+    //
+    //  Load the rules and reload them whenever they change.  The filter is
+    //  sent the blocking rules each time, from the start.
+    //
+
+    if (!ReloadStart( FilterRulesReloaded, &context )) {
+
+        printf( "Could not start the rule reload thread, rule changes need a restart\n" );
+        WriteAlertToDatabase("Could not start the rule reload thread");
+    }
+
     //
     // Create the thread to read the log records that are gathered
     // by MiniSpy.sys.
@@ -426,7 +561,12 @@ Main_Cleanup:
 
     WaitForSingleObject( context.ShutDown, INFINITE );
 
-    if (context.LogToFile) {
+    //
+    //  LogToFile means logging to the database, /a sets it without opening
+    //  an output file.
+    //
+
+    if (context.OutputFile != NULL) {
 
         fclose( context.OutputFile );
     }
@@ -447,10 +587,29 @@ Main_Exit:
         CloseHandle( thread );
     }
 
-    if (INVALID_HANDLE_VALUE != port) {
-        CloseHandle( port );
+    //
+    //  The reload thread sends every rule set it publishes through the
+    //  port, so stop it and the generator before the port goes away.
+    //
+
+    GenStop();
+    ReloadStop();
+
+    if (port != NULL) {
+        PortClose( port );
     }
+
+    if (context.Recent != NULL) {
+
+        ColStoreCleanup( context.Recent );
+    }
+
+    HashStop();
+    WalStop();
+
     WriteAlertToDatabase("Shutting down!");
+    AlertStop();
+    FileLogStop();
     return 0;
 }
 
@@ -482,6 +641,14 @@ Return Value:
     DWORD bufferLength;
     PWCHAR instanceString;
     WCHAR instanceName[INSTANCE_NAME_MAX_CHARS + 1];
+    ULONG seconds;
+    BOOLEAN repair;
+    PARTITION_WINDOW window;
+    ULONG keep;
+    ULONG thresholds[4];
+    ULONG thresholdIndex;
+    GEN_CONFIG genConfig;
+    FILETIME now;
 
     //
     // Interpret the command line parameters
@@ -561,6 +728,25 @@ Return Value:
 
                 break;
 
+            case 'c':
+            case 'C':
+
+                //
+                // Compare the summary tables against MinifilterLog,
+                // rebuilding them if "fix" follows
+                //
+
+                repair = FALSE;
+
+                if ((parmIndex + 1 < argc) && !_stricmp( argv[parmIndex + 1], "fix" )) {
+
+                    parmIndex++;
+                    repair = TRUE;
+                }
+
+                SummaryCheck( DATABASE_FILE_LOCATION, repair );
+                break;
+
             case 'd':
             case 'D':
 
@@ -663,6 +849,81 @@ Return Value:
                 }
                 break;
 
+            case 'g':
+            case 'G':
+
+                //
+                // Generate records in place of the filter's, with the
+                // defaults changed by <name>=<value> options, or stop.
+                // Without arguments show the generator's counters.
+                //
+
+                if ((parmIndex + 1 >= argc) || (argv[parmIndex + 1][0] == '/')) {
+
+                    GenPrintStats();
+                    break;
+                }
+
+                if (!_stricmp( argv[parmIndex + 1], "off" )) {
+
+                    parmIndex++;
+                    GenStop();
+                    printf( "    Generator stopped\n" );
+                    WriteAlertToDatabase( "Generator stopped" );
+                    break;
+                }
+
+                GenDefaultConfig( &genConfig );
+
+                if (!_stricmp( argv[parmIndex + 1], "on" )) {
+
+                    parmIndex++;
+                }
+
+                while ((parmIndex + 1 < argc) && (argv[parmIndex + 1][0] != '/')) {
+
+                    parmIndex++;
+
+                    if (!GenSetOption( &genConfig, argv[parmIndex] )) {
+
+                        goto InterpretCommand_Usage;
+                    }
+                }
+
+                GetSystemTimeAsFileTime( &now );
+
+                if (!GenStart( &genConfig, ((LONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime )) {
+
+                    printf( "    Could not start the generator\n" );
+                    break;
+                }
+
+                Context->LogToFile = TRUE;
+
+                GenPrintStats();
+                WriteAlertToDatabase( "Generator started at %lu records/s", genConfig.Rate );
+                break;
+
+            case 'h':
+            case 'H':
+
+                //
+                // Show the digest cache hit rate and hashing throughput
+                //
+
+                HashPrintStats();
+                break;
+
+            case 'k':
+            case 'K':
+
+                //
+                // Show the busiest processes and files of the last window
+                //
+
+                TopKPrint();
+                break;
+
             case 'l':
             case 'L':
 
@@ -673,6 +934,208 @@ Return Value:
                 ListDevices();
                 break;
 
+            case 'm':
+            case 'M':
+
+                //
+                // Show commit latency, WAL size and checkpoint counters,
+                // what the service log wrote and dropped, and how file
+                // names were found in Files
+                //
+
+                WalPrintMetrics();
+                FileLogPrintStats();
+                FilesPrintStats();
+                break;
+
+            case 'p':
+            case 'P':
+
+                //
+                // Only read records of the given process, 0 reads all.
+                // Without arguments show the process table counters
+                //
+
+                if ((parmIndex + 1 >= argc) || (argv[parmIndex + 1][0] == '/')) {
+
+                    ProcessTablePrintStats();
+                    break;
+                }
+
+                parmIndex++;
+
+                SetClientProcessFilter( Context, strtoul( argv[parmIndex], NULL, 0 ) );
+                break;
+
+            case 'q':
+            case 'Q':
+
+                //
+                // Break down the recent operations held in memory,
+                // optionally only the last <seconds> seconds
+                //
+
+                if (Context->Recent == NULL) {
+
+                    printf( "    Recent operations store is not available\n" );
+                    break;
+                }
+
+                seconds = 0;
+
+                if ((parmIndex + 1 < argc) && (argv[parmIndex + 1][0] != '/')) {
+
+                    parmIndex++;
+                    seconds = strtoul( argv[parmIndex], NULL, 0 );
+                }
+
+                ColStorePrintSummary( Context->Recent, seconds );
+                break;
+
+            case 'r':
+            case 'R':
+
+                //
+                // Send the current blocking rules to the filter and show
+                // how the rules were last reloaded
+                //
+
+                PushFilterRules( Context );
+                ReloadPrintStats();
+                break;
+
+            case 's':
+            case 'S':
+
+                //
+                // Show the read position and counters of this connection
+                //
+
+                ShowClientStats( Context );
+                break;
+
+            case 't':
+            case 'T':
+
+                //
+                // Break down the operations logged in the last <minutes>
+                // minutes, reading only the partitions that hold them
+                //
+
+                parmIndex++;
+
+                if (parmIndex >= argc) {
+
+                    goto InterpretCommand_Usage;
+                }
+
+                DatabaseQueryRecent( strtoul( argv[parmIndex], NULL, 0 ) );
+                break;
+
+            case 'u':
+            case 'U':
+
+                //
+                // The stand-in for the filter is connected to in main
+                // before anything else, only from the command line.
+                //
+
+                parmIndex++;
+
+                if (parmIndex >= argc) {
+
+                    goto InterpretCommand_Usage;
+                }
+
+                if (Context->Port == NULL) {
+
+                    printf( "    Connect to a stand-in for the filter from the command line: minispy /u <socket path>\n" );
+                }
+
+                break;
+
+            case 'w':
+            case 'W':
+
+                //
+                // Split the log into hourly or daily files, keeping the
+                // last <keep> of them.  Without arguments list the files.
+                //
+
+                if ((parmIndex + 1 >= argc) || (argv[parmIndex + 1][0] == '/')) {
+
+                    DatabaseShowPartitions();
+                    break;
+                }
+
+                parmIndex++;
+                parm = argv[parmIndex];
+
+                if (!_stricmp( parm, "hourly" )) {
+
+                    window = PartitionHourly;
+
+                } else if (!_stricmp( parm, "daily" )) {
+
+                    window = PartitionDaily;
+
+                } else if (!_stricmp( parm, "off" )) {
+
+                    window = PartitionNone;
+
+                } else {
+
+                    goto InterpretCommand_Usage;
+                }
+
+                keep = 0;
+
+                if ((parmIndex + 1 < argc) && (argv[parmIndex + 1][0] != '/')) {
+
+                    parmIndex++;
+                    keep = strtoul( argv[parmIndex], NULL, 0 );
+                }
+
+                DatabaseSetPartitioning( window, keep );
+                printf( "    Log partitioning %s, keeping %s\n",
+                        parm,
+                        keep ? argv[parmIndex] : "every file" );
+                WriteAlertToDatabase( "Log partitioning set to %s, keep %lu", parm, keep );
+                break;
+
+            case 'x':
+            case 'X':
+
+                //
+                // Set the mass modification thresholds, distinct files,
+                // writes, renames and deletes per window.  Without
+                // arguments show them with the detector's counters.
+                //
+
+                if ((parmIndex + 1 >= argc) || (argv[parmIndex + 1][0] == '/')) {
+
+                    MassModPrintStats();
+                    break;
+                }
+
+                for (thresholdIndex = 0; thresholdIndex < ARRAYSIZE( thresholds ); thresholdIndex++) {
+
+                    parmIndex++;
+
+                    if ((parmIndex >= argc) || (argv[parmIndex][0] == '/')) {
+
+                        goto InterpretCommand_Usage;
+                    }
+
+                    thresholds[thresholdIndex] = strtoul( argv[parmIndex], NULL, 0 );
+                }
+
+                MassModSetThresholds( thresholds[0], thresholds[1], thresholds[2], thresholds[3] );
+                MassModPrintStats();
+                WriteAlertToDatabase( "Mass modification thresholds set to %lu files, %lu writes, %lu renames, %lu deletes",
+                                      thresholds[0], thresholds[1], thresholds[2], thresholds[3] );
+                break;
+
             default:
 
                 //
@@ -727,11 +1190,36 @@ InterpretCommand_Exit:
     return returnValue;
 
 InterpretCommand_Usage:
-    printf("Valid switches: [/a <drive>] [/d <drive>] [/l] [/f]\n"
+    printf("Valid switches: [/a <drive>] [/c [fix]] [/d <drive>] [/g [on|off|<name>=<value>...]] [/h] [/k] [/l] [/m]\n"
+           "                [/p [<pid>]] [/q [<seconds>]] [/r] [/s] [/t <minutes>] [/u <socket path>]\n"
+           "                [/w [off|hourly|daily [<keep>]]] [/x [<files> <writes> <renames> <deletes>]]\n"
            "\n"
            "    [/a <drive>] starts monitoring <drive> with logs stored at C:/Users/Public/log.db\n"
+           "    [/c [fix]] checks the summary tables against the log, fix rebuilds them from the log\n"
            "    [/d <drive> [<instance id>]] detaches filter <instance id> from <drive> and stops logging\n"
+           "    [/g [on|off|<name>=<value>...]] generates records in place of the filter's to load test logging,\n"
+           "        the defaults changed by rate, processes, threads, paths, skew and pskew (hundredths),\n"
+           "        fail (percent), names=<min>-<max>, seed, or create, read, write, query, set, flush,\n"
+           "        volume, dir, fsctl or lock weights; off stops; without arguments shows its counters;\n"
+           "        given on the command line minispy runs without the filter\n"
+           "    [/h] shows the hit rate of the file digest cache and how fast files are hashed\n"
+           "    [/k] shows the busiest processes and files of the last 5 second window by operations, bytes and latency\n"
            "    [/l] lists all the volumes and which the driver is currently attached to and monitoring\n"
+           "    [/m] shows database commit latency, WAL size and checkpoint counters, service log and file name counters\n"
+           "    [/p [<pid>]] only logs operations of process <pid>, 0 logs every process;\n"
+           "        without arguments shows how operations were attributed to processes\n"
+           "    [/q [<seconds>]] breaks down the recent operations held in memory, optionally only the last <seconds>\n"
+           "    [/r] sends the file location and extension rules whose action is Block to the filter to enforce\n"
+           "        and shows when the rules were last reloaded and how long compiling them took\n"
+           "    [/s] shows how far this client has read and how many records it missed\n"
+           "    [/t <minutes>] breaks down the operations logged in the last <minutes> from the database\n"
+           "    [/u <socket path>] reads records from a stand-in for the filter, tools/mspyFake, listening on\n"
+           "        <socket path> instead of the filter; only on the command line\n"
+           "    [/w [off|hourly|daily [<keep>]]] writes the log to one file per hour or day, keeping the last <keep> files;\n"
+           "        without arguments lists the files\n"
+           "    [/x [<files> <writes> <renames> <deletes>]] alerts when a process writes or renames <files> distinct files,\n"
+           "        or makes <writes>, <renames> or <deletes>, within 10 seconds; 0 turns a check off;\n"
+           "        without arguments shows the thresholds and alerts raised\n"
            "  If you are in command mode:\n"
            "    [enter] will enter command mode\n"
            "    [go|g] will exit command mode\n"
@@ -943,3 +1431,273 @@ Return Value:
     }
 }
 
+
+VOID
+ShowClientStats (
+    _In_ PLOG_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    Prints the position of this client in the filter's record buffer and
+    how many records it was given, missed or filtered out.  Other tools
+    connected to the filter have their own counters.
+
+Arguments:
+
+    Context - The log context holding the port.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    COMMAND_MESSAGE commandMessage;
+    MINISPY_CLIENT_STATS stats;
+    DWORD bytesReturned = 0;
+    HRESULT hResult;
+
+    commandMessage.Command = GetMiniSpyClientStats;
+
+    hResult = PortSendMessage( Context->Port,
+                               &commandMessage,
+                               sizeof( COMMAND_MESSAGE ),
+                               &stats,
+                               sizeof( stats ),
+                               &bytesReturned );
+
+    if (IS_ERROR( hResult )) {
+
+        printf( "    Could not query client statistics: 0x%08x\n", hResult );
+        DisplayError( hResult );
+        return;
+    }
+
+    printf( "    Buffer:    oldest %I64u, newest %I64u\n",
+            stats.OldestSequence,
+            stats.HeadSequence - 1 );
+    printf( "    Next read: %I64u (%I64u behind)\n",
+            stats.NextSequence,
+            stats.HeadSequence - stats.NextSequence );
+    printf( "    Delivered: %I64u\n", stats.Delivered );
+    printf( "    Dropped:   %I64u\n", stats.Dropped );
+    printf( "    Filtered:  %I64u\n", stats.Filtered );
+}
+
+
+VOID
+SetClientProcessFilter (
+    _In_ PLOG_CONTEXT Context,
+    _In_ ULONG ProcessId
+    )
+/*++
+
+Routine Description:
+
+    Asks the filter to only hand this client records from the given process.
+    The filter keeps returning out of memory records regardless.
+
+Arguments:
+
+    Context - The log context holding the port.
+
+    ProcessId - The process to keep, 0 to keep every process.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PVOID buffer[(sizeof( COMMAND_MESSAGE ) + sizeof( MINISPY_CLIENT_FILTER ) +
+                  sizeof( PVOID ) - 1) / sizeof( PVOID )];
+    PCOMMAND_MESSAGE commandMessage = (PCOMMAND_MESSAGE)buffer;
+    PMINISPY_CLIENT_FILTER filter = (PMINISPY_CLIENT_FILTER)commandMessage->Data;
+    DWORD bytesReturned = 0;
+    HRESULT hResult;
+
+    ZeroMemory( buffer, sizeof( buffer ) );
+
+    commandMessage->Command = SetMiniSpyClientFilter;
+    filter->ProcessId = (FILE_ID)ProcessId;
+
+    hResult = PortSendMessage( Context->Port,
+                               commandMessage,
+                               sizeof( COMMAND_MESSAGE ) + sizeof( MINISPY_CLIENT_FILTER ),
+                               NULL,
+                               0,
+                               &bytesReturned );
+
+    if (IS_ERROR( hResult )) {
+
+        printf( "    Could not set process filter: 0x%08x\n", hResult );
+        DisplayError( hResult );
+        return;
+    }
+
+    if (ProcessId == 0) {
+
+        printf( "    Logging every process\n" );
+        WriteAlertToDatabase( "Process filter cleared" );
+
+    } else {
+
+        printf( "    Logging process %lu only\n", ProcessId );
+        WriteAlertToDatabase( "Process filter set to %lu", ProcessId );
+    }
+}
+
+
+static VOID
+SendFilterRules (
+    _In_ PLOG_CONTEXT Context,
+    _In_ PSPY_RULES_HEADER Rules
+    )
+/*++
+
+Routine Description:
+
+    Sends a rule set built by RulesBuildFilterSet to the filter, which then
+    fails the creates, writes and set information operations it matches.
+
+Arguments:
+
+    Context - The log context holding the port.
+
+    Rules - The rule set to send.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PCOMMAND_MESSAGE commandMessage;
+    DWORD bytesReturned = 0;
+    DWORD size;
+    HRESULT hResult;
+
+    //
+    //  Running on generated records, there is no filter to enforce them.
+    //
+
+    if (Context->Port == NULL) {
+
+        return;
+    }
+
+    size = FIELD_OFFSET( COMMAND_MESSAGE, Data ) + Rules->Size;
+    commandMessage = malloc( size );
+
+    if (commandMessage == NULL) {
+
+        return;
+    }
+
+    commandMessage->Command = SetMiniSpyRules;
+    commandMessage->Reserved = 0;
+    memcpy( commandMessage->Data, Rules, Rules->Size );
+
+    hResult = PortSendMessage( Context->Port,
+                               commandMessage,
+                               size,
+                               NULL,
+                               0,
+                               &bytesReturned );
+
+    free( commandMessage );
+
+    if (IS_ERROR( hResult )) {
+
+        printf( "    Could not set the filter rules: 0x%08x\n", hResult );
+        DisplayError( hResult );
+        return;
+    }
+
+    printf( "    Filter enforces %lu blocking rule(s)\n", Rules->RuleCount );
+    WriteAlertToDatabase( "Filter enforces %lu blocking rule(s)", Rules->RuleCount );
+}
+
+
+VOID
+PushFilterRules (
+    _In_ PLOG_CONTEXT Context
+    )
+/*++
+
+Routine Description:
+
+    Compiles the blocking rules of the Rules table and sends them to the
+    filter.  If the rules cannot be compiled the filter gets an empty set
+    rather than keep rules that may have been deleted since.
+
+Arguments:
+
+    Context - The log context holding the port.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSPY_RULES_HEADER rules;
+
+    rules = DatabaseBuildFilterRules();
+
+    if (rules == NULL) {
+
+        printf( "    Could not compile the rules, the filter blocks nothing until they are reloaded\n" );
+        WriteAlertToDatabase( "Could not compile the rules for the filter, it blocks nothing until they are reloaded" );
+        SendFilterRules( Context, RulesEmptyFilterSet() );
+        return;
+    }
+
+    SendFilterRules( Context, rules );
+    free( rules );
+}
+
+
+VOID
+FilterRulesReloaded (
+    _In_ PRULE_SET RuleSet,
+    _In_opt_ PVOID Context
+    )
+/*++
+
+Routine Description:
+
+    Called by the rule reload thread with every rule set it publishes, so
+    the filter enforces the same blocking rules as the log writer.  If the
+    filter set cannot be built the filter gets an empty one rather than
+    keep the rules of the previous set.
+
+Arguments:
+
+    RuleSet - The rules just published.
+
+    Context - The log context holding the port.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSPY_RULES_HEADER rules;
+
+    rules = RulesBuildFilterSet( RuleSet );
+
+    if (rules == NULL) {
+
+        printf( "    Could not build the blocking rules, the filter blocks nothing until they are reloaded\n" );
+        WriteAlertToDatabase( "Could not build the blocking rules for the filter, it blocks nothing until they are reloaded" );
+        SendFilterRules( (PLOG_CONTEXT)Context, RulesEmptyFilterSet() );
+        return;
+    }
+
+    SendFilterRules( (PLOG_CONTEXT)Context, rules );
+    free( rules );
+}
@@ -0,0 +1,341 @@
+/*++
+
+Module Name:
+
+    mspyUtf.c
+
+Abstract:
+
+    Converts UTF-16 to UTF-8.
+
+    The writer used to hand every file name to sqlite3_bind_text16, which
+    converts one unit at a time, and converted it again for the summaries
+    and the rankings.  Names are converted once per record here instead,
+    and file names are nearly all ASCII, so runs of ASCII are converted a
+    block at a time: 16 units with AVX2 or SSE2, then 4 in a 64 bit word.
+    AVX2 tests a block with one load where SSE2 takes two, and is used when
+    the processor and the system support it, checked on the first call.
+    Anything else is converted one unit at a time, after which the block
+    conversion is tried again.
+
+    A surrogate without its other half is converted to U+FFFD, as
+    WideCharToMultiByte converts it.
+
+    Nothing here calls the system.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <string.h>
+#include <windows.h>
+#include "mspyUtf.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define UTF_X64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define UTF_TARGET_AVX2
+#else
+#define UTF_TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+#endif
+#endif
+
+typedef ULONG
+(*UTF_ASCII_RUN) (
+    _In_reads_(Length) const WCHAR *Source,
+    _In_ ULONG Length,
+    _Out_writes_(Length) UCHAR *Destination
+    );
+
+static ULONG
+UtfAsciiPick (
+    _In_reads_(Length) const WCHAR *Source,
+    _In_ ULONG Length,
+    _Out_writes_(Length) UCHAR *Destination
+    );
+
+//
+//  Converts the leading ASCII of a string a block at a time, returning
+//  how many units it converted.  What is left of a block is left to the
+//  caller.
+//
+
+static UTF_ASCII_RUN UtfAsciiRun = UtfAsciiPick;
+
+static ULONG
+UtfAsciiWord (
+    _In_reads_(Length) const WCHAR *Source,
+    _In_ ULONG Length,
+    _Out_writes_(Length) UCHAR *Destination
+    )
+{
+    ULONGLONG word;
+    ULONG index = 0;
+
+    while (index + 4 <= Length) {
+
+        memcpy( &word, Source + index, sizeof( word ) );
+
+        if ((word & 0xFF80FF80FF80FF80ULL) != 0) {
+
+            break;
+        }
+
+        Destination[index] = (UCHAR)word;
+        Destination[index + 1] = (UCHAR)(word >> 16);
+        Destination[index + 2] = (UCHAR)(word >> 32);
+        Destination[index + 3] = (UCHAR)(word >> 48);
+        index += 4;
+    }
+
+    return index;
+}
+
+#ifdef UTF_X64
+
+static ULONG
+UtfAsciiSse2 (
+    _In_reads_(Length) const WCHAR *Source,
+    _In_ ULONG Length,
+    _Out_writes_(Length) UCHAR *Destination
+    )
+{
+    const __m128i high = _mm_set1_epi16( (short)0xFF80 );
+    __m128i first;
+    __m128i second;
+    ULONG index = 0;
+
+    while (index + 16 <= Length) {
+
+        first = _mm_loadu_si128( (const __m128i *)(Source + index) );
+        second = _mm_loadu_si128( (const __m128i *)(Source + index + 8) );
+
+        if (_mm_movemask_epi8( _mm_cmpeq_epi16( _mm_and_si128( _mm_or_si128( first, second ), high ),
+                                                _mm_setzero_si128() ) ) != 0xFFFF) {
+
+            break;
+        }
+
+        _mm_storeu_si128( (__m128i *)(Destination + index), _mm_packus_epi16( first, second ) );
+        index += 16;
+    }
+
+    return index + UtfAsciiWord( Source + index, Length - index, Destination + index );
+}
+
+UTF_TARGET_AVX2
+static ULONG
+UtfAsciiAvx2 (
+    _In_reads_(Length) const WCHAR *Source,
+    _In_ ULONG Length,
+    _Out_writes_(Length) UCHAR *Destination
+    )
+{
+    const __m256i high = _mm256_set1_epi16( (short)0xFF80 );
+    __m256i units;
+    ULONG index = 0;
+
+    while (index + 16 <= Length) {
+
+        units = _mm256_loadu_si256( (const __m256i *)(Source + index) );
+
+        if (!_mm256_testz_si256( units, high )) {
+
+            break;
+        }
+
+        //
+        //  Packing works within 128 bit lanes, gather the low quarter of
+        //  each lane
+        //
+
+        _mm_storeu_si128( (__m128i *)(Destination + index),
+                          _mm256_castsi256_si128( _mm256_permute4x64_epi64( _mm256_packus_epi16( units, units ), 0x08 ) ) );
+        index += 16;
+    }
+
+    //
+    //  SSE code run with the upper halves of the YMM registers dirty is
+    //  slowed down by every instruction, and the compiler does not always
+    //  clear them before it returns
+    //
+
+    _mm256_zeroupper();
+
+    return index + UtfAsciiWord( Source + index, Length - index, Destination + index );
+}
+
+static BOOLEAN
+UtfHaveAvx2 (
+    VOID
+    )
+{
+#if defined(_MSC_VER)
+    int registers[4];
+
+    //
+    //  The processor must have AVX2, and the system must save the YMM
+    //  registers
+    //
+
+    __cpuid( registers, 1 );
+
+    if ((registers[2] & (1 << 27)) == 0 || (_xgetbv( 0 ) & 6) != 6) {
+
+        return FALSE;
+    }
+
+    __cpuidex( registers, 7, 0 );
+
+    return (registers[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports( "avx2" ) != 0;
+#endif
+}
+
+#endif
+
+static ULONG
+UtfAsciiPick (
+    _In_reads_(Length) const WCHAR *Source,
+    _In_ ULONG Length,
+    _Out_writes_(Length) UCHAR *Destination
+    )
+{
+#ifdef UTF_X64
+    UtfAsciiRun = UtfHaveAvx2() ? UtfAsciiAvx2 : UtfAsciiSse2;
+#else
+    UtfAsciiRun = UtfAsciiWord;
+#endif
+
+    return UtfAsciiRun( Source, Length, Destination );
+}
+
+ULONG
+Utf16ToUtf8 (
+    _In_reads_(Length) const WCHAR *Source,
+    _In_ ULONG Length,
+    _Out_writes_z_(Size) char *Destination,
+    _In_ ULONG Size
+    )
+/*++
+
+Routine Description:
+
+    Converts UTF-16 to UTF-8.  Conversion stops at the first character
+    that does not fit, so the result is whole characters, and it is always
+    terminated.
+
+Arguments:
+
+    Source - The UTF-16.
+
+    Length - Its length in units, not counting a terminator.
+
+    Destination - Receives the UTF-8.
+
+    Size - Size of Destination in bytes.  UTF8_NAME_SIZE( Length ) always
+        holds the whole of Source.
+
+Return Value:
+
+    The bytes written, not counting the terminator.
+
+--*/
+{
+    UCHAR *out = (UCHAR *)Destination;
+    ULONG limit;
+    ULONG used = 0;
+    ULONG index = 0;
+    ULONG run;
+    ULONG ch;
+
+    if (Size == 0) {
+
+        return 0;
+    }
+
+    limit = Size - 1;
+
+    while (index < Length) {
+
+        ch = Source[index];
+
+        if (ch < 0x80) {
+
+            run = (Length - index < limit - used) ? Length - index : limit - used;
+
+            if (run == 0) {
+
+                break;
+            }
+
+            run = UtfAsciiRun( Source + index, run, out + used );
+            index += run;
+            used += run;
+
+            while (index < Length && used < limit && Source[index] < 0x80) {
+
+                out[used++] = (UCHAR)Source[index++];
+            }
+
+            continue;
+        }
+
+        if (ch < 0x800) {
+
+            if (used + 2 > limit) {
+
+                break;
+            }
+
+            out[used++] = (UCHAR)(0xC0 | (ch >> 6));
+            out[used++] = (UCHAR)(0x80 | (ch & 0x3F));
+            index++;
+            continue;
+        }
+
+        if (ch >= 0xD800 && ch <= 0xDFFF) {
+
+            if (ch <= 0xDBFF && index + 1 < Length &&
+                Source[index + 1] >= 0xDC00 && Source[index + 1] <= 0xDFFF) {
+
+                if (used + 4 > limit) {
+
+                    break;
+                }
+
+                ch = 0x10000 + ((ch - 0xD800) << 10) + (Source[index + 1] - 0xDC00);
+                out[used++] = (UCHAR)(0xF0 | (ch >> 18));
+                out[used++] = (UCHAR)(0x80 | ((ch >> 12) & 0x3F));
+                out[used++] = (UCHAR)(0x80 | ((ch >> 6) & 0x3F));
+                out[used++] = (UCHAR)(0x80 | (ch & 0x3F));
+                index += 2;
+                continue;
+            }
+
+            ch = 0xFFFD;
+        }
+
+        if (used + 3 > limit) {
+
+            break;
+        }
+
+        out[used++] = (UCHAR)(0xE0 | (ch >> 12));
+        out[used++] = (UCHAR)(0x80 | ((ch >> 6) & 0x3F));
+        out[used++] = (UCHAR)(0x80 | (ch & 0x3F));
+        index++;
+    }
+
+    out[used] = '\0';
+
+    return used;
+}
@@ -0,0 +1,38 @@
+/*++
+
+Module Name:
+
+    mspyUtf.h
+
+Abstract:
+
+    Converts the UTF-16 file names the filter logs to the UTF-8 the
+    database, the summaries, the sessions, the rankings and the alerts
+    store.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYUTF_H__
+#define __MSPYUTF_H__
+
+#include <windows.h>
+
+//
+//  Room for any name that fits in a LOG_RECORD, in UTF-8 with its
+//  terminator.  A UTF-16 unit takes at most 3 bytes, a surrogate pair 4.
+//
+
+#define UTF8_NAME_SIZE(Wchars)  ((Wchars) * 3 + 1)
+
+ULONG
+Utf16ToUtf8 (
+    _In_reads_(Length) const WCHAR *Source,
+    _In_ ULONG Length,
+    _Out_writes_z_(Size) char *Destination,
+    _In_ ULONG Size
+    );
+
+#endif //__MSPYUTF_H__
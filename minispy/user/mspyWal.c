@@ -0,0 +1,565 @@
+/*++
+
+Module Name:
+
+    mspyWal.c
+
+Abstract:
+
+    Puts the log database in WAL mode and checkpoints it from a thread of
+    its own.
+
+    The log writer commits with synchronous=NORMAL, so a commit only
+    appends to the WAL and dashboard readers no longer block it.  SQLite's
+    automatic checkpoint would run inside whichever commit crosses the
+    threshold, which shows up as a latency spike on the writer.  Instead
+    the writer's WAL hook wakes the checkpoint thread, which runs passive
+    checkpoints on its own connection.  Passive checkpoints never wait, so
+    they only copy what no reader still needs.  If readers keep the WAL
+    from being reset and it grows past WAL_ESCALATE_BYTES the thread runs
+    one truncating checkpoint.
+
+    The writer reports every commit's latency so /m can show percentiles
+    together with the WAL size and checkpoint counters.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <DriverSpecs.h>
+_Analysis_mode_(_Analysis_code_type_user_code_)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mspyLog.h"
+#include "mspyWal.h"
+
+typedef struct _WAL_STATE {
+
+    SRWLOCK Lock;
+
+    HANDLE Thread;
+    HANDLE Wake;
+    volatile BOOLEAN Stop;
+
+    //
+    //  Database the writer has open, empty if none.  Generation changes
+    //  every time it does so the thread knows to reopen.
+    //
+
+    char Path[MAX_PATH];
+    ULONG Generation;
+    ULONG PageSize;
+
+    LARGE_INTEGER Frequency;
+
+    //
+    //  Metrics, under Lock.
+    //
+
+    ULONG Latency[WAL_LATENCY_SAMPLES];     // microseconds
+    ULONGLONG Commits;
+    ULONGLONG WalBytes;
+    ULONGLONG WalBytesMax;
+    ULONGLONG Passive;
+    ULONGLONG Escalated;
+    ULONGLONG Busy;
+    ULONG CheckpointMaxMicroseconds;
+
+} WAL_STATE, *PWAL_STATE;
+
+static WAL_STATE WalState;
+
+static int
+WalHook (
+    _In_opt_ void *Context,
+    _In_ sqlite3 *Db,
+    _In_z_ const char *Schema,
+    _In_ int Pages
+    )
+/*++
+
+Routine Description:
+
+    Called by SQLite on the writer's connection after every commit with the
+    number of pages in the WAL.  Only records the size and wakes the
+    checkpoint thread, the commit itself must not wait on anything.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( Context );
+    UNREFERENCED_PARAMETER( Db );
+
+    //
+    //  The catalog attached while partitioning keeps its own journal.
+    //
+
+    if (strcmp( Schema, "main" ) != 0) {
+
+        return SQLITE_OK;
+    }
+
+    AcquireSRWLockExclusive( &WalState.Lock );
+
+    WalState.WalBytes = (ULONGLONG)Pages * WalState.PageSize;
+
+    ReleaseSRWLockExclusive( &WalState.Lock );
+
+    if (Pages >= WAL_CHECKPOINT_PAGES) {
+
+        SetEvent( WalState.Wake );
+    }
+
+    return SQLITE_OK;
+}
+
+static ULONG
+WalPageSize (
+    _In_ sqlite3 *Db
+    )
+{
+    sqlite3_stmt *stmt;
+    ULONG pageSize = 4096;
+
+    if (sqlite3_prepare_v2( Db, "PRAGMA page_size;", -1, &stmt, NULL ) == SQLITE_OK) {
+
+        if (sqlite3_step( stmt ) == SQLITE_ROW) {
+
+            pageSize = (ULONG)sqlite3_column_int( stmt, 0 );
+        }
+
+        sqlite3_finalize( stmt );
+    }
+
+    return pageSize;
+}
+
+static ULONG
+WalElapsedMicroseconds (
+    _In_ LONGLONG Ticks
+    )
+{
+    LONGLONG microseconds = Ticks * 1000000 / WalState.Frequency.QuadPart;
+
+    return (microseconds > MAXULONG) ? MAXULONG : (ULONG)microseconds;
+}
+
+static VOID
+WalCheckpoint (
+    _In_ sqlite3 *Db,
+    _In_ ULONG PageSize
+    )
+/*++
+
+Routine Description:
+
+    Runs one passive checkpoint and escalates to a truncating one if the
+    WAL is still over the size limit afterwards.
+
+--*/
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    int logFrames = 0;
+    int checkpointed = 0;
+    int rc;
+    BOOLEAN escalated = FALSE;
+    ULONG elapsed;
+
+    QueryPerformanceCounter( &start );
+
+    rc = sqlite3_wal_checkpoint_v2( Db, "main", SQLITE_CHECKPOINT_PASSIVE, &logFrames, &checkpointed );
+
+    //
+    //  logFrames is -1 when the connection does not see the database in
+    //  WAL mode.
+    //
+
+    if (rc == SQLITE_OK &&
+        logFrames > 0 &&
+        (ULONGLONG)logFrames * PageSize >= WAL_ESCALATE_BYTES) {
+
+        //
+        //  Waits up to the busy timeout for readers, then resets the WAL
+        //  to zero bytes so it stops growing.
+        //
+
+        escalated = TRUE;
+        rc = sqlite3_wal_checkpoint_v2( Db, "main", SQLITE_CHECKPOINT_TRUNCATE, &logFrames, &checkpointed );
+    }
+
+    QueryPerformanceCounter( &end );
+    elapsed = WalElapsedMicroseconds( end.QuadPart - start.QuadPart );
+
+    AcquireSRWLockExclusive( &WalState.Lock );
+
+    if (rc == SQLITE_BUSY) {
+
+        WalState.Busy++;
+
+    } else if (rc == SQLITE_OK) {
+
+        WalState.WalBytes = (logFrames > 0) ? (ULONGLONG)logFrames * PageSize : 0;
+    }
+
+    if (escalated) {
+
+        WalState.Escalated++;
+
+    } else {
+
+        WalState.Passive++;
+    }
+
+    if (elapsed > WalState.CheckpointMaxMicroseconds) {
+
+        WalState.CheckpointMaxMicroseconds = elapsed;
+    }
+
+    ReleaseSRWLockExclusive( &WalState.Lock );
+}
+
+static DWORD WINAPI
+WalCheckpointThread (
+    _In_ LPVOID Parameter
+    )
+{
+    sqlite3 *db = NULL;
+    char path[MAX_PATH];
+    ULONG generation = 0;
+    ULONG pageSize = 4096;
+
+    UNREFERENCED_PARAMETER( Parameter );
+
+    while (!WalState.Stop) {
+
+        WaitForSingleObject( WalState.Wake, WAL_CHECKPOINT_INTERVAL );
+
+        if (WalState.Stop) {
+
+            break;
+        }
+
+        //
+        //  Follow the writer to the database it has open now.  Closing our
+        //  connection to the old one lets SQLite remove its WAL.
+        //
+
+        AcquireSRWLockShared( &WalState.Lock );
+
+        if (generation != WalState.Generation) {
+
+            generation = WalState.Generation;
+            strcpy_s( path, sizeof( path ), WalState.Path );
+
+            ReleaseSRWLockShared( &WalState.Lock );
+
+            sqlite3_close( db );
+            db = NULL;
+
+            if (path[0] != '\0') {
+
+                if (sqlite3_open_v2( path, &db, SQLITE_OPEN_READWRITE, NULL ) != SQLITE_OK) {
+
+                    sqlite3_close( db );
+                    db = NULL;
+                    continue;
+                }
+
+                sqlite3_busy_timeout( db, 1000 );
+
+                //
+                //  A connection only learns the database is in WAL mode
+                //  when it first reads it, until then a checkpoint on it
+                //  does nothing.
+                //
+
+                if (sqlite3_exec( db, "SELECT COUNT(*) FROM sqlite_master;", NULL, NULL, NULL ) != SQLITE_OK) {
+
+                    sqlite3_close( db );
+                    db = NULL;
+                    continue;
+                }
+
+                pageSize = WalPageSize( db );
+            }
+
+        } else {
+
+            ReleaseSRWLockShared( &WalState.Lock );
+        }
+
+        if (db != NULL) {
+
+            WalCheckpoint( db, pageSize );
+        }
+    }
+
+    sqlite3_close( db );
+    return 0;
+}
+
+BOOLEAN
+WalStart (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Starts the checkpoint thread.  Call before the log writer opens the
+    database, if it fails SQLite keeps checkpointing on commit.
+
+Return Value:
+
+    TRUE if the thread is running.
+
+--*/
+{
+    InitializeSRWLock( &WalState.Lock );
+    QueryPerformanceFrequency( &WalState.Frequency );
+
+    WalState.Stop = FALSE;
+    WalState.Wake = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+    if (WalState.Wake == NULL) {
+
+        return FALSE;
+    }
+
+    WalState.Thread = CreateThread( NULL, 0, WalCheckpointThread, NULL, 0, NULL );
+
+    if (WalState.Thread == NULL) {
+
+        CloseHandle( WalState.Wake );
+        WalState.Wake = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+WalStop (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Stops the checkpoint thread if it runs, and clears the metrics, so
+    whatever writes next, with the thread or without, counts from nothing.
+
+--*/
+{
+    if (WalState.Thread != NULL) {
+
+        WalState.Stop = TRUE;
+        SetEvent( WalState.Wake );
+
+        WaitForSingleObject( WalState.Thread, INFINITE );
+
+        CloseHandle( WalState.Thread );
+        CloseHandle( WalState.Wake );
+        WalState.Thread = NULL;
+        WalState.Wake = NULL;
+    }
+
+    AcquireSRWLockExclusive( &WalState.Lock );
+
+    WalState.Commits = 0;
+    WalState.WalBytes = 0;
+    WalState.WalBytesMax = 0;
+    WalState.Passive = 0;
+    WalState.Escalated = 0;
+    WalState.Busy = 0;
+    WalState.CheckpointMaxMicroseconds = 0;
+
+    ReleaseSRWLockExclusive( &WalState.Lock );
+}
+
+VOID
+WalAttach (
+    _In_ sqlite3 *Db,
+    _In_z_ const char *Path
+    )
+/*++
+
+Routine Description:
+
+    Switches the writer's connection to WAL mode and hands checkpointing of
+    its database to the checkpoint thread.
+
+Arguments:
+
+    Db - The writer's connection, with nothing else attached yet.
+
+    Path - File Db is open on.
+
+--*/
+{
+    if (sqlite3_exec( Db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, NULL ) != SQLITE_OK) {
+
+        WriteToLogAnsi( "Could not enable WAL on %s: %s", Path, sqlite3_errmsg( Db ) );
+        return;
+    }
+
+    if (WalState.Thread == NULL) {
+
+        return;
+    }
+
+    //
+    //  Replaces the automatic checkpoint, which is itself a WAL hook.
+    //
+
+    sqlite3_wal_hook( Db, WalHook, NULL );
+
+    AcquireSRWLockExclusive( &WalState.Lock );
+
+    strcpy_s( WalState.Path, sizeof( WalState.Path ), Path );
+    WalState.Generation++;
+    WalState.PageSize = WalPageSize( Db );
+    WalState.WalBytes = 0;
+
+    ReleaseSRWLockExclusive( &WalState.Lock );
+}
+
+VOID
+WalDetach (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Called before the writer closes its connection.  The checkpoint thread
+    lets go of the database at its next wake up.
+
+--*/
+{
+    if (WalState.Thread == NULL) {
+
+        return;
+    }
+
+    AcquireSRWLockExclusive( &WalState.Lock );
+
+    WalState.Path[0] = '\0';
+    WalState.Generation++;
+
+    ReleaseSRWLockExclusive( &WalState.Lock );
+
+    SetEvent( WalState.Wake );
+}
+
+VOID
+WalCommitted (
+    _In_ LONGLONG Ticks
+    )
+/*++
+
+Routine Description:
+
+    Records the latency of one commit by the log writer.
+
+Arguments:
+
+    Ticks - Duration of the commit in QueryPerformanceCounter ticks.
+
+--*/
+{
+    ULONG microseconds;
+
+    if (WalState.Frequency.QuadPart == 0) {
+
+        QueryPerformanceFrequency( &WalState.Frequency );
+    }
+
+    microseconds = WalElapsedMicroseconds( Ticks );
+
+    AcquireSRWLockExclusive( &WalState.Lock );
+
+    WalState.Latency[WalState.Commits % WAL_LATENCY_SAMPLES] = microseconds;
+    WalState.Commits++;
+
+    if (WalState.WalBytes > WalState.WalBytesMax) {
+
+        WalState.WalBytesMax = WalState.WalBytes;
+    }
+
+    ReleaseSRWLockExclusive( &WalState.Lock );
+}
+
+static int __cdecl
+WalCompareUlong (
+    _In_ const void *Left,
+    _In_ const void *Right
+    )
+{
+    ULONG left = *(const ULONG *)Left;
+    ULONG right = *(const ULONG *)Right;
+
+    return (left > right) - (left < right);
+}
+
+VOID
+WalPrintMetrics (
+    VOID
+    )
+{
+    ULONG sorted[WAL_LATENCY_SAMPLES];
+    ULONG count;
+    ULONGLONG commits;
+    ULONGLONG walBytes;
+    ULONGLONG walBytesMax;
+    ULONGLONG passive;
+    ULONGLONG escalated;
+    ULONGLONG busy;
+    ULONG checkpointMax;
+
+    AcquireSRWLockShared( &WalState.Lock );
+
+    commits = WalState.Commits;
+    count = (commits < WAL_LATENCY_SAMPLES) ? (ULONG)commits : WAL_LATENCY_SAMPLES;
+    memcpy( sorted, WalState.Latency, count * sizeof( ULONG ) );
+
+    walBytes = WalState.WalBytes;
+    walBytesMax = WalState.WalBytesMax;
+    passive = WalState.Passive;
+    escalated = WalState.Escalated;
+    busy = WalState.Busy;
+    checkpointMax = WalState.CheckpointMaxMicroseconds;
+
+    ReleaseSRWLockShared( &WalState.Lock );
+
+    printf( "    Commits:            %I64u\n", commits );
+
+    if (count != 0) {
+
+        qsort( sorted, count, sizeof( ULONG ), WalCompareUlong );
+
+        printf( "    Commit latency (us) over the last %lu: p50 %lu  p90 %lu  p99 %lu  max %lu\n",
+                count,
+                sorted[count / 2],
+                sorted[count * 9 / 10],
+                sorted[count * 99 / 100],
+                sorted[count - 1] );
+    }
+
+    printf( "    WAL size:           %I64u KB (max %I64u KB)\n", walBytes / 1024, walBytesMax / 1024 );
+    printf( "    Checkpoints:        %I64u passive, %I64u escalated, %I64u busy, slowest %lu us\n",
+            passive,
+            escalated,
+            busy,
+            checkpointMax );
+
+    if (WalState.Thread == NULL) {
+
+        printf( "    Checkpoint thread is not running, SQLite checkpoints on commit\n" );
+    }
+}
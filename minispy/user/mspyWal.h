@@ -0,0 +1,76 @@
+/*++
+
+Module Name:
+
+    mspyWal.h
+
+Abstract:
+
+    Write ahead log mode for the log database and the thread that
+    checkpoints it, so commits by the log writer never pay for copying the
+    WAL back into the database.
+
+Environment:
+
+    User mode
+
+--*/
+#ifndef __MSPYWAL_H__
+#define __MSPYWAL_H__
+
+#include <windows.h>
+#include <sqlite3.h>
+
+//
+//  The checkpoint thread runs a passive checkpoint at least this often, and
+//  sooner once a commit leaves this many pages in the WAL.
+//
+
+#define WAL_CHECKPOINT_INTERVAL     1000            // milliseconds
+#define WAL_CHECKPOINT_PAGES        1000
+
+//
+//  Past this size the thread escalates to a truncating checkpoint, which
+//  waits for readers to move off the old WAL and briefly holds the writer.
+//
+
+#define WAL_ESCALATE_BYTES          (64 * 1024 * 1024)
+
+//
+//  Number of most recent commits the latency percentiles are taken over.
+//
+
+#define WAL_LATENCY_SAMPLES         1024
+
+BOOLEAN
+WalStart (
+    VOID
+    );
+
+VOID
+WalStop (
+    VOID
+    );
+
+VOID
+WalAttach (
+    _In_ sqlite3 *Db,
+    _In_z_ const char *Path
+    );
+
+VOID
+WalDetach (
+    VOID
+    );
+
+VOID
+WalCommitted (
+    _In_ LONGLONG Ticks
+    );
+
+VOID
+WalPrintMetrics (
+    VOID
+    );
+
+#endif //__MSPYWAL_H__
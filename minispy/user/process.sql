@@ -0,0 +1,21 @@
+-- Processes the log writer attributed operations to (mspyProcess.c), as the
+-- filter reported their creation and exit, or as the writer looked up the
+-- ones started before the filter.  This file is applied every time the
+-- writer opens the database, so every statement must be safe to run again.
+-- Times are in the same 100ns ticks as MinifilterLog.PreOpTime.
+
+CREATE TABLE IF NOT EXISTS Processes (
+    ProcessId INTEGER NOT NULL,
+    CreateTime INTEGER NOT NULL,         -- With ProcessId names one process even once the id is reused.
+    ExitTime INTEGER,                    -- NULL while it runs or if the exit was not seen.
+    ExitStatus INTEGER,
+    ParentProcessId INTEGER,             -- NULL for processes looked up by the writer.
+    ParentCreateTime INTEGER,
+    CreatingThreadId INTEGER,
+    ImagePath TEXT,                      -- As MinifilterLog.ProcessFilePath holds it.
+    NativeImagePath TEXT,                -- As the kernel opened it, \Device\HarddiskVolumeN\...
+    Source TEXT NOT NULL,                -- Filter or Query.
+    PRIMARY KEY (ProcessId, CreateTime)
+);
+
+CREATE INDEX IF NOT EXISTS Processes_Parent ON Processes (ParentProcessId, ParentCreateTime);
\ No newline at end of file
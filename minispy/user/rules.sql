@@ -0,0 +1,25 @@
+-- Version counter for the Rules table, read by the rule reload thread
+-- (mspyReload.c) to notice changes made by any client, the dashboard
+-- included.  This file is applied every time the thread starts, so every
+-- statement must be safe to run again.
+
+CREATE TABLE IF NOT EXISTS RuleVersion (
+    ID INTEGER PRIMARY KEY CHECK (ID = 1),
+    Version INTEGER NOT NULL
+);
+INSERT OR IGNORE INTO RuleVersion (ID, Version) VALUES (1, 0);
+
+CREATE TRIGGER IF NOT EXISTS Trigger_Rules_Insert AFTER INSERT ON Rules
+BEGIN
+    UPDATE RuleVersion SET Version = Version + 1 WHERE ID = 1;
+END;
+
+CREATE TRIGGER IF NOT EXISTS Trigger_Rules_Update AFTER UPDATE ON Rules
+BEGIN
+    UPDATE RuleVersion SET Version = Version + 1 WHERE ID = 1;
+END;
+
+CREATE TRIGGER IF NOT EXISTS Trigger_Rules_Delete AFTER DELETE ON Rules
+BEGIN
+    UPDATE RuleVersion SET Version = Version + 1 WHERE ID = 1;
+END;
@@ -0,0 +1,35 @@
+-- Handle sessions written by the log writer (mspySession.c): one row per
+-- FileObject from IRP_MJ_CREATE to IRP_MJ_CLOSE, with what was done
+-- through it.  This file is applied every time the writer opens the
+-- database, so every statement must be safe to run again.  Times are in
+-- the same 100ns ticks as MinifilterLog.PreOpTime.
+
+CREATE TABLE IF NOT EXISTS HandleSessions (
+    SessionID INTEGER PRIMARY KEY,
+    FileObj TEXT NOT NULL,               -- File object pointer, as in MinifilterLog.FileObj.
+    ProcessId INTEGER NOT NULL,          -- The process that opened the handle.
+    ProcessFilePath TEXT NOT NULL,
+    OpFileName TEXT NOT NULL,            -- Name at the first operation seen.
+    OpenTime INTEGER NOT NULL,           -- Create, or the first operation if the create was not seen.
+    CleanupTime INTEGER,                 -- Last handle closed, NULL if not seen.
+    CloseTime INTEGER NOT NULL,          -- Close, or the last operation if the session was evicted.
+    Duration INTEGER NOT NULL,           -- CloseTime - OpenTime.
+    CreateSeen INTEGER NOT NULL,         -- 1 if the session started with its create.
+    EndReason TEXT NOT NULL,             -- Close, Idle, Evicted, Reused or Open (still open at shutdown).
+    Reads INTEGER NOT NULL,
+    Writes INTEGER NOT NULL,
+    OtherOps INTEGER NOT NULL,
+    BytesRead INTEGER NOT NULL,
+    BytesWritten INTEGER NOT NULL,
+    Errors INTEGER NOT NULL              -- Operations that failed.
+);
+
+-- Handles of a process over time.
+--   SELECT ... FROM HandleSessions WHERE ProcessId = ? ORDER BY OpenTime
+CREATE INDEX IF NOT EXISTS Index_HandleSessions_Process
+    ON HandleSessions (ProcessId, OpenTime);
+
+-- Who had a file open.
+--   SELECT ... FROM HandleSessions WHERE OpFileName = ? COLLATE NOCASE
+CREATE INDEX IF NOT EXISTS Index_HandleSessions_File
+    ON HandleSessions (OpFileName COLLATE NOCASE);
@@ -0,0 +1,90 @@
+-- Summary tables maintained by the log writer (mspySummary.c) in the same
+-- transaction as the MinifilterLog rows they count.  This file is applied
+-- every time the writer opens the database, so every statement must be
+-- safe to run again.  Text keys are never NULL, a missing value is ''.
+
+CREATE TABLE IF NOT EXISTS Summary_Totals (
+    Name TEXT PRIMARY KEY,
+    Count INTEGER NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS Summary_Operations (
+    MajorOp TEXT NOT NULL,
+    MinorOp TEXT NOT NULL,
+    Count INTEGER NOT NULL,
+    PRIMARY KEY (MajorOp, MinorOp)
+);
+
+CREATE TABLE IF NOT EXISTS Summary_RequestorMode (
+    RequestorMode TEXT PRIMARY KEY,
+    Count INTEGER NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS Summary_OpStatus (
+    OpStatus TEXT PRIMARY KEY,
+    Count INTEGER NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS Summary_Processes (
+    ProcessId INTEGER NOT NULL,
+    ProcessFilePath TEXT NOT NULL,
+    Count INTEGER NOT NULL,
+    PRIMARY KEY (ProcessId, ProcessFilePath)
+);
+
+CREATE TABLE IF NOT EXISTS Summary_Files (
+    OpFileName TEXT PRIMARY KEY,
+    Count INTEGER NOT NULL
+);
+
+-- =================================================================== Views ===================================================================
+
+-- Total Operations Count
+DROP VIEW IF EXISTS View_TotalOperations;
+CREATE VIEW View_TotalOperations AS
+SELECT COALESCE((SELECT Count FROM Summary_Totals WHERE Name = 'Operations'), 0) AS TotalOperations;
+
+-- Operation Breakdown (for Pie Chart)
+DROP VIEW IF EXISTS View_OperationBreakdown;
+CREATE VIEW View_OperationBreakdown AS
+SELECT 
+    MajorOp,
+    NULLIF(MinorOp, '') AS MinorOp,
+    Count
+FROM Summary_Operations;
+
+-- Kernel vs User Requested Operations (Bar Chart)
+DROP VIEW IF EXISTS View_RequestorModeCount;
+CREATE VIEW View_RequestorModeCount AS
+SELECT 
+    RequestorMode,
+    Count
+FROM Summary_RequestorMode;
+
+-- Operation Status Frequency (Ranked Table)
+DROP VIEW IF EXISTS View_OpStatusCount;
+CREATE VIEW View_OpStatusCount AS
+SELECT 
+    OpStatus,
+    Count
+FROM Summary_OpStatus
+ORDER BY Count DESC;
+
+-- File Operation Counts (Tree + Table)
+DROP VIEW IF EXISTS View_FileOpCounts;
+CREATE VIEW View_FileOpCounts AS
+SELECT 
+    OpFileName,
+    Count
+FROM Summary_Files
+ORDER BY Count DESC;
+
+-- Process Operation Counts
+DROP VIEW IF EXISTS View_ProcessOpCounts;
+CREATE VIEW View_ProcessOpCounts AS
+SELECT 
+    ProcessId,
+    ProcessFilePath,
+    Count
+FROM Summary_Processes
+ORDER BY Count DESC;
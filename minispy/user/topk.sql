@@ -0,0 +1,19 @@
+-- Busiest processes and files written by the log writer (mspyTopK.c): the
+-- top entries of every window by operations, bytes and latency.  This file
+-- is applied every time the writer opens the database, so every statement
+-- must be safe to run again.  Times are in the same 100ns ticks as
+-- MinifilterLog.PreOpTime.
+
+CREATE TABLE IF NOT EXISTS TopTalkers (
+    WindowStart INTEGER NOT NULL,
+    WindowEnd INTEGER NOT NULL,          -- End of the window, or the last record at shutdown.
+    Kind TEXT NOT NULL,                  -- Process or File.
+    Metric TEXT NOT NULL,                -- Ops, Bytes or Latency (100ns from pre-operation to completion).
+    Rank INTEGER NOT NULL,               -- 1 is the busiest.
+    ProcessId INTEGER,                   -- NULL for files.
+    Name TEXT NOT NULL,                  -- Process image path or file name.
+    Value INTEGER NOT NULL,              -- Never under the true value.
+    Error INTEGER NOT NULL,              -- Value is at most this much over the true value.
+    WindowTotal INTEGER NOT NULL,        -- Sum of the metric over every record of the window.
+    PRIMARY KEY (WindowStart, Kind, Metric, Rank)
+);